@@ -19,6 +19,8 @@
 /*! \file
  * Test application which puts the radio in continous TX mode transmitting random data.
  * Usefull for measuring center frequency offset on a spectrum analyzer
+ * With CONTINUOUS_TX_TRAFFIC_GENERATOR the channel carries the D7A requests of emulated sensors instead, see
+ * traffic_generator.h
  * Note: works only on cc1101 since this is not using the public hw_radio API but depends on cc1101 internal functions
  *
  *  Created on: Mar 24, 2015
@@ -39,6 +41,10 @@
 #include "log.h"
 #include "hwradio.h"
 
+#ifdef CONTINUOUS_TX_TRAFFIC_GENERATOR
+#include "traffic_generator.h"
+#endif
+
 #if NUM_USERBUTTONS > 1
 #include "button.h"
 #endif
@@ -185,11 +191,15 @@ void start()
     lcd_write_string(string);
 #endif
 
+#ifdef CONTINUOUS_TX_TRAFFIC_GENERATOR
+    traffic_generator_start(&tx_cfg.channel_id, tx_cfg.eirp);
+#else
     /* Configure */
     configure_radio(current_modulation);
 
     /* start the radio */
     start_radio();
+#endif
 
 }
 
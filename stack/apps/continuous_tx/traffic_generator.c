@@ -0,0 +1,414 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "string.h"
+#include "stdio.h"
+#include "debug.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "random.h"
+#include "crc.h"
+#include "aes.h"
+#include "key.h"
+#include "console.h"
+#include "hwradio.h"
+
+#include "traffic_generator.h"
+
+#if TRAFFIC_GENERATOR_PAYLOAD_MIN < 4 || TRAFFIC_GENERATOR_PAYLOAD_MAX < TRAFFIC_GENERATOR_PAYLOAD_MIN
+    #error "The payload of the generated frames holds at least the 4 bytes of the sequence number"
+#endif
+
+// the headers, the longest authentication tag and the CRC leave this much for the file data in a 255 byte frame
+#if TRAFFIC_GENERATOR_PAYLOAD_MAX > 200
+    #error "TRAFFIC_GENERATOR_PAYLOAD_MAX does not fit a frame"
+#endif
+
+#if TRAFFIC_GENERATOR_NODE_COUNT < 1 || TRAFFIC_GENERATOR_NODE_COUNT > 65536
+    #error "TRAFFIC_GENERATOR_NODE_COUNT should be between 1 and 65536"
+#endif
+
+// the D7A values used while assembling the frames, the stack headers are not available to the application
+#define ID_TYPE_NOID 1
+#define ID_TYPE_UID 2
+#define ALP_OP_RETURN_FILE_DATA 32
+#define D7ATP_CTRL_IS_START 0x80
+
+#define NLS_METHOD_COUNT 8
+#define AES_NONE 0x00
+#define AES_CTR 0x01
+#define AES_CCM_128 0x05
+
+// the mean time between two arrivals, a burst counts as one arrival
+#define MEAN_ARRIVAL_INTERVAL ((timer_tick_t)(60ULL * TIMER_TICKS_PER_SEC * TRAFFIC_GENERATOR_BURST_SIZE / TRAFFIC_GENERATOR_RATE))
+
+// the frames waiting for the radio, the arrivals beyond are dropped: the offered load exceeds what the radio carries
+#define MAX_PENDING_FRAMES 32
+
+static uint8_t tx_buffer[sizeof(hw_radio_packet_t) + 255] = { 0 };
+static uint8_t background_buffer[sizeof(hw_radio_packet_t) + BACKGROUND_FRAME_LENGTH + 1] = { 0 };
+static hw_radio_packet_t* tx_packet = (hw_radio_packet_t*)tx_buffer;
+static hw_radio_packet_t* background_packet = (hw_radio_packet_t*)background_buffer;
+
+static hw_tx_cfg_t tx_cfg;
+static aes_ctx_t aes_ctx;
+static uint8_t nls_methods[NLS_METHOD_COUNT];
+static uint8_t nls_method_count;
+static uint8_t uid_prefix[6];
+
+static bool running = false;
+static bool tx_busy = false;
+static uint8_t pending_frames = 0;
+static timer_tick_t next_arrival;
+static uint32_t sequence_number = 0;
+static uint32_t frame_counter = 0;
+
+static uint32_t sent_count = 0;
+static uint32_t background_count = 0;
+static uint32_t dropped_count = 0;
+static uint32_t sent_bytes = 0;
+
+static void transmit_frame();
+
+static inline uint8_t get_auth_len(uint8_t nls_method)
+{
+    switch(nls_method)
+    {
+    case 0x02: case 0x05: return 16; // AES-CBC-MAC-128, AES-CCM-128
+    case 0x03: case 0x06: return 8;  // AES-CBC-MAC-64, AES-CCM-64
+    case 0x04: case 0x07: return 4;  // AES-CBC-MAC-32, AES-CCM-32
+    default: return 0;
+    }
+}
+
+static inline uint32_t get_random(uint32_t min, uint32_t max)
+{
+    return min + get_rnd() % (max - min + 1);
+}
+
+/*
+ * A sample of the exponential distribution of mean, for the Poisson arrivals. -ln(u) is derived for u uniform in
+ * (0, 1] from the position of the highest bit of a 16 bit sample and a linear interpolation of the bits below it,
+ * which is within 6 % and does not need the floating point library.
+ */
+static timer_tick_t get_exponential_delay(timer_tick_t mean)
+{
+    uint32_t r = (get_rnd() & 0xFFFF) + 1;
+    uint8_t msb = 31 - __builtin_clz(r);
+    uint32_t log2_r = ((uint32_t)msb << 16) + ((r << (16 - msb)) - 0x10000); // 16.16
+    uint32_t ln_u = ((uint64_t)((16UL << 16) - log2_r) * 45426) >> 16;     // ln(2) = 45426 / 2^16
+    return ((uint64_t)mean * ln_u) >> 16;
+}
+
+static timer_tick_t get_arrival_interval()
+{
+#ifdef TRAFFIC_GENERATOR_ARRIVAL_PERIODIC
+    return MEAN_ARRIVAL_INTERVAL;
+#else
+    return get_exponential_delay(MEAN_ARRIVAL_INTERVAL);
+#endif
+}
+
+// the airtime of a frame of length bytes (without the length byte), like dll_calculate_tx_duration() of the stack
+static uint16_t calculate_tx_duration(uint8_t length)
+{
+    uint32_t bitrate = 55555;
+    uint8_t preamble_length = PREAMBLE_NORMAL_RATE_CLASS;
+    if (tx_cfg.channel_id.channel_header.ch_class == PHY_CLASS_LO_RATE)
+    {
+        bitrate = 9600;
+        preamble_length = PREAMBLE_LOW_RATE_CLASS;
+    }
+    else if (tx_cfg.channel_id.channel_header.ch_class == PHY_CLASS_HI_RATE)
+    {
+        bitrate = 166667;
+        preamble_length = PREAMBLE_HI_RATE_CLASS;
+    }
+
+    uint32_t bits = 8 * (uint32_t)(preamble_length + sizeof(uint16_t) + length);
+    return ((uint64_t)bits * TIMER_TICKS_PER_SEC + bitrate - 1) / bitrate + 1;
+}
+
+static void write_be32(uint8_t* ptr, uint32_t value)
+{
+    ptr[0] = value >> 24;
+    ptr[1] = value >> 16;
+    ptr[2] = value >> 8;
+    ptr[3] = value;
+}
+
+static void write_length(uint8_t** ptr, uint8_t length)
+{
+    // the ALP length operand, one byte up to 63
+    if (length < 64)
+        *(*ptr)++ = length;
+    else
+    {
+        *(*ptr)++ = 0x40;
+        *(*ptr)++ = length;
+    }
+}
+
+/*
+ * Secures the D7ATP header and the ALP payload as d7anp_secure_payload() does for a broadcast request, the
+ * authentication tag is appended. Returns the length of the tag.
+ */
+static uint8_t secure_payload(uint8_t nls_method, const uint8_t* uid, uint8_t d7anp_ctrl, uint8_t* payload, uint8_t payload_len)
+{
+    uint8_t iv[AES_BLOCK_SIZE] = { 0 };
+    uint8_t ctr_blk[AES_BLOCK_SIZE];
+    uint8_t auth[AES_BLOCK_SIZE];
+    uint8_t auth_len = get_auth_len(nls_method);
+
+    iv[0] = nls_method << 4;
+    if (nls_method == AES_CTR || nls_method >= AES_CCM_128)
+    {
+        iv[1] = TRAFFIC_GENERATOR_KEY_COUNTER;
+        write_be32(&iv[2], frame_counter);
+    }
+
+    memcpy(iv + 6, uid, 8);
+    iv[14] = d7anp_ctrl;
+    iv[15] = payload_len;
+
+    if (nls_method == AES_CTR)
+        AES128_CTR_encrypt_ctx(&aes_ctx, payload, payload, payload_len, iv);
+    else if (nls_method < AES_CCM_128)
+    {
+        // AES-CBC-MAC
+        AES128_CBC_MAC_ctx(&aes_ctx, auth, payload, payload_len, iv, NULL, 0, auth_len);
+        memcpy(payload + payload_len, auth, auth_len);
+    }
+    else
+    {
+        memcpy(ctr_blk, iv, AES_BLOCK_SIZE);
+        AES128_CCM_encrypt_ctx(&aes_ctx, payload, payload_len, iv, NULL, 0, ctr_blk, auth_len);
+    }
+
+    return auth_len;
+}
+
+// a broadcast request of a random node, returning TRAFFIC_GENERATOR_FILE_ID
+static void assemble_request()
+{
+    uint8_t nls_method = nls_methods[get_rnd() % nls_method_count];
+    uint8_t uid[8];
+    uint16_t node = get_rnd() % TRAFFIC_GENERATOR_NODE_COUNT;
+    memcpy(uid, uid_prefix, sizeof(uid_prefix));
+    uid[6] = node >> 8;
+    uid[7] = node & 0xFF;
+
+    uint8_t* ptr = tx_packet->data + 1; // the length byte is filled in last
+    *ptr++ = TRAFFIC_GENERATOR_SUBNET;
+    *ptr++ = (ID_TYPE_NOID << 6) | ((tx_cfg.eirp + 32) & 0x3F);
+
+    // D7ANP
+    uint8_t d7anp_ctrl = (ID_TYPE_UID << 4) | nls_method;
+    *ptr++ = d7anp_ctrl;
+    *ptr++ = TRAFFIC_GENERATOR_SUBNET; // origin access class
+    memcpy(ptr, uid, 8);
+    ptr += 8;
+
+    if (nls_method == AES_CTR || nls_method >= AES_CCM_128)
+    {
+        frame_counter++;
+        *ptr++ = TRAFFIC_GENERATOR_KEY_COUNTER;
+        write_be32(ptr, frame_counter);
+        ptr += sizeof(uint32_t);
+    }
+
+    // D7ATP, an unsolicited request without response
+    uint8_t* nwl_payload = ptr;
+    *ptr++ = D7ATP_CTRL_IS_START;
+    *ptr++ = get_rnd() & 0xFF; // dialog ID
+    *ptr++ = 0;                // transaction ID
+
+    // ALP
+    uint8_t length = get_random(TRAFFIC_GENERATOR_PAYLOAD_MIN, TRAFFIC_GENERATOR_PAYLOAD_MAX);
+    *ptr++ = ALP_OP_RETURN_FILE_DATA;
+    *ptr++ = TRAFFIC_GENERATOR_FILE_ID;
+    *ptr++ = 0; // offset
+    write_length(&ptr, length);
+    write_be32(ptr, sequence_number++);
+    for (uint8_t i = sizeof(uint32_t); i < length; i++)
+        ptr[i] = get_rnd() & 0xFF;
+
+    ptr += length;
+
+    if (nls_method != AES_NONE)
+        ptr += secure_payload(nls_method, uid, d7anp_ctrl, nwl_payload, ptr - nwl_payload);
+
+    tx_packet->length = ptr - tx_packet->data - 1 + 2; // exclude the length byte and add the CRC bytes
+    tx_packet->data[0] = tx_packet->length;
+
+    uint8_t capability = tx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9 ? HW_RADIO_CAP_CRC_FEC : HW_RADIO_CAP_CRC;
+    if (!(hw_radio_get_capabilities() & capability))
+    {
+        uint16_t crc = __builtin_bswap16(crc_calculate(tx_packet->data, tx_packet->length + 1 - 2));
+        memcpy(ptr, &crc, 2);
+    }
+
+    tx_packet->tx_meta.tx_cfg = tx_cfg;
+    tx_packet->tx_meta.tx_cfg.syncword_class = PHY_SYNCWORD_CLASS1;
+}
+
+// the advertising of a broadcast background request, the ETA is updated by the radio driver
+static void assemble_background_frame(timer_tick_t eta)
+{
+    uint8_t* ptr = background_packet->data + 1;
+    *ptr++ = TRAFFIC_GENERATOR_SUBNET;
+    *ptr++ = (ID_TYPE_NOID << 6) | ((tx_cfg.eirp + 32) & 0x3F);
+    uint16_t eta_ti = __builtin_bswap16(TIMER_TICKS_TO_TI(eta));
+    memcpy(ptr, &eta_ti, sizeof(uint16_t));
+    ptr += sizeof(uint16_t);
+
+    background_packet->length = BACKGROUND_FRAME_LENGTH;
+    background_packet->data[0] = BACKGROUND_FRAME_LENGTH;
+
+    // the length byte is not transmitted, nor covered by the CRC
+    if (!(hw_radio_get_capabilities() & HW_RADIO_CAP_CRC_BACKGROUND))
+    {
+        uint16_t crc = __builtin_bswap16(crc_calculate(background_packet->data + 1, BACKGROUND_FRAME_LENGTH - 2));
+        memcpy(ptr, &crc, 2);
+    }
+
+    background_packet->tx_meta.tx_cfg = tx_cfg;
+    background_packet->tx_meta.tx_cfg.syncword_class = PHY_SYNCWORD_CLASS0;
+}
+
+static void frame_transmitted(hw_radio_packet_t* packet)
+{
+    tx_busy = false;
+    if (running && pending_frames > 0)
+        sched_post_task(&transmit_frame);
+}
+
+static void advertising_terminated(hw_radio_packet_t* packet)
+{
+    // the request follows the advertising straight away
+    error_t err = hw_radio_send_packet(tx_packet, &frame_transmitted);
+    assert(err == SUCCESS);
+}
+
+static void transmit_frame()
+{
+    if (!running || tx_busy || pending_frames == 0)
+        return;
+
+    pending_frames--;
+    tx_busy = true;
+    assemble_request();
+    sent_count++;
+    sent_bytes += tx_packet->length + 1;
+
+    error_t err;
+    if (get_random(1, 100) <= TRAFFIC_GENERATOR_BACKGROUND_PERCENT)
+    {
+        timer_tick_t eta = TRAFFIC_GENERATOR_ADVERTISING_PERIOD * TIMER_TICKS_PER_SEC / 1000;
+        assemble_background_frame(eta);
+        background_count++;
+        err = hw_radio_send_background_packet(background_packet, &advertising_terminated, eta,
+                                              calculate_tx_duration(BACKGROUND_FRAME_LENGTH));
+    }
+    else
+        err = hw_radio_send_packet(tx_packet, &frame_transmitted);
+
+    assert(err == SUCCESS);
+}
+
+static void frame_arrived()
+{
+    if (!running)
+        return;
+
+    for (uint8_t i = 0; i < TRAFFIC_GENERATOR_BURST_SIZE; i++)
+    {
+        if (pending_frames < MAX_PENDING_FRAMES)
+            pending_frames++;
+        else
+            dropped_count++;
+    }
+
+    // the arrivals keep their own pace, independent of the airtime of the frames
+    next_arrival += get_arrival_interval();
+    timer_post_task(&frame_arrived, next_arrival);
+    sched_post_task(&transmit_frame);
+}
+
+static void report_statistics()
+{
+    char str[128];
+    snprintf(str, sizeof(str), "TG sent %lu (%lu background), %lu bytes, %lu dropped, next seq %lu\r\n",
+             (unsigned long)sent_count, (unsigned long)background_count, (unsigned long)sent_bytes,
+             (unsigned long)dropped_count, (unsigned long)sequence_number);
+    console_print(str);
+    timer_post_task_delay(&report_statistics, TRAFFIC_GENERATOR_REPORT_PERIOD * TIMER_TICKS_PER_SEC);
+}
+
+void traffic_generator_start(const channel_id_t* channel_id, eirp_t eirp)
+{
+    static bool initialized = false;
+    if (!initialized)
+    {
+        sched_register_task(&transmit_frame);
+        sched_register_task(&frame_arrived);
+        sched_register_task(&report_statistics);
+
+        nls_method_count = 0;
+        for (uint8_t method = 0; method < NLS_METHOD_COUNT; method++)
+        {
+            if (TRAFFIC_GENERATOR_NLS_METHODS & (1 << method))
+                nls_methods[nls_method_count++] = method;
+        }
+
+        if (nls_method_count == 0)
+            nls_methods[nls_method_count++] = AES_NONE;
+
+        AES128_ctx_init(&aes_ctx, AES128_key);
+
+        // the UIDs should differ between boots, the frame counters restarting from 0 are rejected as replays otherwise.
+        // The RSSI samples only add entropy when the radio reports the noise while idle, the start time always does.
+        for (uint8_t i = 0; i < 8; i++)
+            add_rng_entropy(hw_radio_get_rssi());
+
+        add_rng_entropy(timer_get_counter_value());
+        for (uint8_t i = 0; i < sizeof(uid_prefix); i++)
+            uid_prefix[i] = get_rnd() & 0xFF;
+
+        initialized = true;
+    }
+
+    traffic_generator_stop();
+
+    tx_cfg.channel_id = *channel_id;
+    tx_cfg.eirp = eirp;
+    running = true;
+    next_arrival = timer_get_counter_value();
+    sched_post_task(&frame_arrived);
+    sched_post_task(&report_statistics);
+}
+
+void traffic_generator_stop()
+{
+    running = false;
+    pending_frames = 0;
+    timer_cancel_task(&frame_arrived);
+    sched_cancel_task(&frame_arrived);
+    timer_cancel_task(&report_statistics);
+    sched_cancel_task(&report_statistics);
+}
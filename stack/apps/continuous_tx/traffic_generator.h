@@ -0,0 +1,40 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file traffic_generator.h
+ * Emulates a population of sensors pushing unsolicited D7A requests, to load test a gateway.
+ *
+ * The frames are assembled here from the D7A frame format, without the stack: broadcast foreground requests from
+ * random UIDs returning the data of a file, optionally preceded by a background advertising, and secured with a
+ * mix of NLS methods under the preconfigured key of key.h. The radio transmits them without CCA, at the configured
+ * rate. The data of every frame starts with a 32 bit sequence number (big endian), so the drop rate can be derived
+ * from the frames the gateway output.
+ */
+
+#ifndef TRAFFIC_GENERATOR_H_
+#define TRAFFIC_GENERATOR_H_
+
+#include "hwradio.h"
+
+/*! \brief Starts (or restarts) generating traffic on the channel, at the EIRP */
+void traffic_generator_start(const channel_id_t* channel_id, eirp_t eirp);
+
+/*! \brief Stops generating traffic, the frame on air is completed */
+void traffic_generator_stop();
+
+#endif /* TRAFFIC_GENERATOR_H_ */
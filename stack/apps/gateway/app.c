@@ -20,6 +20,16 @@
  * \author	maarten.weyn@uantwerpen.be
  */
 
+/*
+ * The gateway scans the active access class and GATEWAY_EXTRA_SCAN_ACCESS_CLASSES, so it receives the sensors using the
+ * lo rate class as well as the normal rate ones. A concentrator serving many sensors is best built with:
+ * - MODULE_D7AP_DLL_SCAN_EXTRA_ACCESS_CLASS_COUNT covering GATEWAY_EXTRA_SCAN_ACCESS_CLASSES
+ * - MODULE_D7AP_DLL_FG_SCAN_DWELL_TIME well above the duration of a lo rate frame, to scan the channels of all the
+ *   classes in turn on a single radio (the additional radio instances scan the next channels in parallel)
+ * - a larger MODULE_D7AP_PACKET_QUEUE_SIZE and MODULE_D7AP_DLL_RX_OVERFLOW_POLICY 1, to queue the uplinks of a burst
+ * - MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE, to forward them to the host in batches
+ */
+
 #include "hwuart.h"
 #include "hwleds.h"
 #include "hwsystem.h"
@@ -34,8 +44,10 @@
 
 #include "hwlcd.h"
 #include "d7ap_stack.h"
+#include "dll.h"
 #include "hwuart.h"
 #include "fifo.h"
+#include "console.h"
 #include "version.h"
 
 #if HW_NUM_LEDS > 0
@@ -188,6 +200,13 @@ void bootstrap()
     alp_init_args.alp_received_unsolicited_data_cb = &on_unsolicited_response_received;
     d7ap_stack_init(&fs_init_args, &alp_init_args, true, NULL);
 
+    const uint8_t extra_scan_access_classes[] = { GATEWAY_EXTRA_SCAN_ACCESS_CLASSES };
+    if (dll_set_extra_scan_access_classes(extra_scan_access_classes, sizeof(extra_scan_access_classes)) != SUCCESS)
+        log_print_string("MODULE_D7AP_DLL_SCAN_EXTRA_ACCESS_CLASS_COUNT too small, only scanning the active access class");
+
+    // the unsolicited responses are forwarded over the serial interface, a burst should delay them instead of losing bytes
+    console_set_tx_blocking(true);
+
 #ifdef HAS_LCD
     lcd_write_string("GW %s", _GIT_SHA1);
 #endif
@@ -0,0 +1,450 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Measures the round trip time through the complete D7A stack. The master reads the file of the responder (this app
+// built with the LATENCY_BENCH_RESPONDER option) LATENCY_BENCH_REQUEST_COUNT times for every combination of the access
+// classes and the NLS methods to sweep, each request being queued with d7asp_queue_alp_actions() once the previous
+// one completed. The round trip lasts from queueing the request until its response is handed to the application, the
+// master prints a RESULT line with the round trip times of every combination.
+//
+// With FRAMEWORK_TRACE_ENABLED the round trip is broken down in the stages below, found in the trace recorded during
+// each request:
+// - queue: until the DLL starts CSMA-CA for the request
+// - csma: until the transmission of the request starts
+// - tx: the transmission of the request
+// - response: from the end of the request until D7ATP receives the response
+// - responder: the response stage minus the airtime of the response, the time the responder takes to answer
+// The responder also prints its turnaround, from the reception of a request until the transmission of its response,
+// every REPORT_PERIOD from its own trace.
+//
+// The responder is switched to the next access class by a write of the active access class in its DLL
+// configuration file, over the access class it is scanning.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "debug.h"
+#include "console.h"
+#include "hwsystem.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "trace.h"
+#include "d7ap_stack.h"
+#include "dll.h"
+#include "fs.h"
+
+#define BENCH_FILE_ID           0x40
+#define BENCH_FILE_SIZE         LATENCY_BENCH_READ_LENGTH
+
+// the access profiles on the first channel of 868 MHz, indexed by the access specifier
+static const phy_channel_class_t channel_classes[] = { PHY_CLASS_NORMAL_RATE, PHY_CLASS_LO_RATE, PHY_CLASS_HI_RATE };
+#define ACCESS_PROFILE_COUNT    (sizeof(channel_classes) / sizeof(channel_classes[0]))
+
+// the access class of both nodes after a reboot
+#define INITIAL_ACCESS_CLASS    0x01
+
+static alp_init_args_t alp_init_args;
+
+static inline uint32_t ticks_to_ms(uint32_t ticks)
+{
+    return (uint32_t)(((uint64_t)ticks * 1000) / TIMER_TICKS_PER_SEC);
+}
+
+#ifdef LATENCY_BENCH_RESPONDER
+
+// the responder scans the first subband of its active access class continuously
+#define SCAN_SUBBAND_BITMAP     0x01
+// the trace (FRAMEWORK_TRACE_SIZE) should hold the records of the requests received in a period
+#define REPORT_PERIOD           (TIMER_TICKS_PER_SEC / 4)
+
+#ifdef FRAMEWORK_TRACE_ENABLED
+// prints the turnaround of the requests received since the previous report. A request received just before the
+// trace is cleared is not counted
+static void report_turnaround()
+{
+    uint16_t count = 0;
+    timer_tick_t min = UINT32_MAX, max = 0;
+    uint32_t total = 0;
+    bool is_request_received = false;
+    timer_tick_t rx_time = 0;
+    trace_record_t record;
+    for(uint16_t i = 0; trace_get_record(i, &record) == SUCCESS; i++)
+    {
+        if(record.layer == LOG_STACK_TRANS && record.event == TRACE_EVENT_RX)
+        {
+            is_request_received = true;
+            rx_time = record.timestamp;
+        }
+        else if(is_request_received && record.layer == LOG_STACK_DLL && record.event == TRACE_EVENT_STATE
+                && record.arg2 == DLL_STATE_TX_FOREGROUND)
+        {
+            timer_tick_t turnaround = record.timestamp - rx_time;
+            if(turnaround < min)
+                min = turnaround;
+
+            if(turnaround > max)
+                max = turnaround;
+
+            total += turnaround;
+            count++;
+            is_request_received = false;
+        }
+    }
+
+    trace_reset();
+    if(count > 0)
+        console_printf("RESPONDER,%lu,%u,%lu,%lu,%lu\n", (unsigned long)timer_get_counter_value(), count,
+                       (unsigned long)ticks_to_ms(min), (unsigned long)ticks_to_ms(total / count),
+                       (unsigned long)ticks_to_ms(max));
+}
+#endif
+
+static void init_user_files()
+{
+    fs_file_header_t file_header = (fs_file_header_t){
+        .file_properties.action_protocol_enabled = 0,
+        .file_properties.storage_class = FS_STORAGE_VOLATILE,
+        .file_properties.permissions = 0, // TODO
+        .length = BENCH_FILE_SIZE
+    };
+
+    uint8_t data[BENCH_FILE_SIZE];
+    for(uint8_t i = 0; i < BENCH_FILE_SIZE; i++)
+        data[i] = i;
+
+    fs_init_file(BENCH_FILE_ID, &file_header, data);
+}
+
+static void start()
+{
+#ifdef FRAMEWORK_TRACE_ENABLED
+    console_print("RESPONDER,timestamp,requests,turnaround_min_ms,turnaround_avg_ms,turnaround_max_ms\n");
+    trace_reset();
+    sched_register_task(&report_turnaround);
+    timer_post_periodic_task(&report_turnaround, REPORT_PERIOD, DEFAULT_PRIORITY);
+#endif
+}
+
+#else
+
+// the master does not scan, it only listens for the responses to its requests
+#define SCAN_SUBBAND_BITMAP     0x00
+#define SWITCH_ATTEMPTS         3
+
+static const uint8_t access_classes[] = { LATENCY_BENCH_ACCESS_CLASSES };
+static const uint8_t security_modes[] = { LATENCY_BENCH_SECURITY_MODES };
+#define ACCESS_CLASS_COUNT      (sizeof(access_classes) / sizeof(access_classes[0]))
+#define SECURITY_MODE_COUNT     (sizeof(security_modes) / sizeof(security_modes[0]))
+#define CONFIG_COUNT            (ACCESS_CLASS_COUNT * SECURITY_MODE_COUNT)
+
+typedef enum
+{
+    STAGE_QUEUE,
+    STAGE_CSMA,
+    STAGE_TX,
+    STAGE_RESPONSE,
+    STAGE_RESPONDER,
+    STAGE_COUNT
+} stage_t;
+
+typedef struct
+{
+    uint16_t sent;
+    uint16_t responses;
+    timer_tick_t rtt_min;
+    timer_tick_t rtt_max;
+    uint32_t rtt_total;
+    uint16_t traced;                        // the responses of which all the stages were found in the trace
+    uint32_t stage_totals[STAGE_COUNT];
+} bench_stats_t;
+
+static d7asp_master_session_config_t session_config = {
+    .qos = {
+        .qos_resp_mode = SESSION_RESP_MODE_ANY,
+        .qos_retry_mode = SESSION_RETRY_MODE_NO,
+        .qos_stop_on_error = false,
+        .qos_record = false
+    },
+    .dormant_timeout = 0,
+    .addressee = {
+        .ctrl = {
+            .nls_method = AES_NONE,
+            .id_type = ID_TYPE_NOID,
+        },
+        .id = 0
+    }
+};
+
+static uint8_t config_index;
+static uint8_t responder_access_class = INITIAL_ACCESS_CLASS;
+static bool is_switching;                   // the pending request writes the access class of the responder
+static uint8_t switch_attempts;
+static uint8_t fifo_token;
+static timer_tick_t request_time;
+static timer_tick_t response_time;
+static bool is_response_received;
+static bench_stats_t stats;
+
+static void start_config();
+static void send_request();
+
+static uint8_t get_access_class(uint8_t index)
+{
+    return access_classes[index / SECURITY_MODE_COUNT];
+}
+
+static uint8_t get_security_mode(uint8_t index)
+{
+    return security_modes[index % SECURITY_MODE_COUNT];
+}
+
+static void queue_request(uint8_t* request, uint8_t length, uint8_t response_length)
+{
+    d7asp_master_session_t* session = d7asp_master_session_create(&session_config);
+    d7asp_queue_result_t result = d7asp_queue_alp_actions(session, request, length, response_length, D7ASP_PRIORITY_NORMAL);
+    fifo_token = result.fifo_token;
+}
+
+static void print_header()
+{
+    console_printf("RESULT,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n", "timestamp", "access_class", "nls_method", "sent",
+                   "responses", "rtt_min_ms", "rtt_avg_ms", "rtt_max_ms", "traced", "queue_avg_ms", "csma_avg_ms",
+                   "tx_avg_ms", "response_avg_ms", "responder_avg_ms");
+}
+
+static void print_result()
+{
+    uint32_t stage_avgs[STAGE_COUNT] = { 0 };
+    for(uint8_t i = 0; i < STAGE_COUNT && stats.traced > 0; i++)
+        stage_avgs[i] = ticks_to_ms(stats.stage_totals[i] / stats.traced);
+
+    console_printf("RESULT,%lu,0x%02X,%u,%u,%u,%lu,%lu,%lu,%u,%lu,%lu,%lu,%lu,%lu\n", (unsigned long)timer_get_counter_value(),
+                   get_access_class(config_index), get_security_mode(config_index), stats.sent, stats.responses,
+                   (unsigned long)ticks_to_ms(stats.responses ? stats.rtt_min : 0),
+                   (unsigned long)ticks_to_ms(stats.responses ? stats.rtt_total / stats.responses : 0),
+                   (unsigned long)ticks_to_ms(stats.rtt_max), stats.traced, (unsigned long)stage_avgs[STAGE_QUEUE],
+                   (unsigned long)stage_avgs[STAGE_CSMA], (unsigned long)stage_avgs[STAGE_TX],
+                   (unsigned long)stage_avgs[STAGE_RESPONSE], (unsigned long)stage_avgs[STAGE_RESPONDER]);
+}
+
+#ifdef FRAMEWORK_TRACE_ENABLED
+// adds the stages of the request which just completed, from the records of the trace since it was queued
+static void add_stages()
+{
+    enum { MARK_CSMA, MARK_TX, MARK_TX_COMPLETED, MARK_RX, MARK_COUNT };
+    timer_tick_t marks[MARK_COUNT];
+    uint8_t mark_count = 0;
+    uint8_t response_length = 0;
+    trace_record_t record;
+    for(uint16_t i = 0; mark_count < MARK_COUNT && trace_get_record(i, &record) == SUCCESS; i++)
+    {
+        bool is_dll_state = record.layer == LOG_STACK_DLL && record.event == TRACE_EVENT_STATE;
+        if((mark_count == MARK_CSMA && is_dll_state && record.arg2 == DLL_STATE_CSMA_CA_STARTED)
+           || (mark_count == MARK_TX && is_dll_state && record.arg2 == DLL_STATE_TX_FOREGROUND)
+           || (mark_count == MARK_TX_COMPLETED && is_dll_state && record.arg2 == DLL_STATE_TX_FOREGROUND_COMPLETED))
+            marks[mark_count++] = record.timestamp;
+        else if(mark_count == MARK_RX && record.layer == LOG_STACK_TRANS && record.event == TRACE_EVENT_RX)
+        {
+            marks[mark_count++] = record.timestamp;
+            response_length = record.arg2;
+        }
+    }
+
+    if(mark_count < MARK_COUNT)
+        return; // the trace overflowed or missed a stage
+
+    timer_tick_t response = marks[MARK_RX] - marks[MARK_TX_COMPLETED];
+    timer_tick_t response_airtime = dll_calculate_tx_duration(
+                channel_classes[ACCESS_SPECIFIER(get_access_class(config_index))], PHY_CODING_PN9, response_length + 1);
+    stats.stage_totals[STAGE_QUEUE] += marks[MARK_CSMA] - request_time;
+    stats.stage_totals[STAGE_CSMA] += marks[MARK_TX] - marks[MARK_CSMA];
+    stats.stage_totals[STAGE_TX] += marks[MARK_TX_COMPLETED] - marks[MARK_TX];
+    stats.stage_totals[STAGE_RESPONSE] += response;
+    stats.stage_totals[STAGE_RESPONDER] += response > response_airtime ? response - response_airtime : 0;
+    stats.traced++;
+}
+#endif
+
+// the responder only receives on the access class it scans, it is switched over that access class
+static void switch_access_class()
+{
+    uint8_t request[] = { ALP_OP_WRITE_FILE_DATA, D7A_FILE_DLL_CONF_FILE_ID, 0, 1, get_access_class(config_index) };
+    session_config.addressee.access_class = responder_access_class;
+    session_config.addressee.ctrl.nls_method = AES_NONE;
+    is_switching = true;
+    switch_attempts++;
+    queue_request(request, sizeof(request), 0);
+}
+
+static void next_config()
+{
+    config_index++;
+    start_config();
+}
+
+static void start_config()
+{
+    if(config_index == CONFIG_COUNT)
+    {
+        console_print("latency_bench done\r\n");
+        return;
+    }
+
+#ifndef MODULE_D7AP_NLS_ENABLED
+    if(get_security_mode(config_index) != AES_NONE)
+    {
+        console_printf("skipping NLS method %u, MODULE_D7AP_NLS_ENABLED is not set\n", get_security_mode(config_index));
+        next_config();
+        return;
+    }
+#endif
+
+    if(get_access_class(config_index) != responder_access_class)
+    {
+        switch_access_class();
+        return;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    stats.rtt_min = UINT32_MAX;
+    session_config.addressee.access_class = get_access_class(config_index);
+    session_config.addressee.ctrl.nls_method = get_security_mode(config_index);
+    sched_post_task(&send_request);
+}
+
+static void send_request()
+{
+    if(stats.sent == LATENCY_BENCH_REQUEST_COUNT)
+    {
+        print_result();
+        next_config();
+        return;
+    }
+
+    uint8_t request[] = { ALP_OP_READ_FILE_DATA, BENCH_FILE_ID, 0, BENCH_FILE_SIZE };
+    trace_reset();
+    is_response_received = false;
+    request_time = timer_get_counter_value();
+    queue_request(request, sizeof(request), BENCH_FILE_SIZE);
+    stats.sent++;
+}
+
+static void on_alp_command_completed_cb(uint8_t tag_id, bool success)
+{
+    if(tag_id != fifo_token)
+        return;
+
+    if(is_switching)
+    {
+        is_switching = false;
+        if(!success && switch_attempts < SWITCH_ATTEMPTS)
+        {
+            sched_post_task(&switch_access_class);
+            return;
+        }
+
+        // when the write was not acked the responder might have switched nonetheless
+        responder_access_class = get_access_class(config_index);
+        switch_attempts = 0;
+        sched_post_task(&start_config);
+        return;
+    }
+
+    if(is_response_received)
+    {
+        timer_tick_t rtt = response_time - request_time;
+        if(rtt < stats.rtt_min)
+            stats.rtt_min = rtt;
+
+        if(rtt > stats.rtt_max)
+            stats.rtt_max = rtt;
+
+        stats.rtt_total += rtt;
+        stats.responses++;
+#ifdef FRAMEWORK_TRACE_ENABLED
+        add_stages();
+#endif
+    }
+
+    // not queued from the callback of the session which just completed
+    sched_post_task(&send_request);
+}
+
+static void on_response_received_cb(d7asp_result_t result, uint8_t* alp_command, uint8_t alp_command_size)
+{
+    if(is_switching || result.fifo_token != fifo_token || is_response_received)
+        return;
+
+    response_time = timer_get_counter_value();
+    is_response_received = true;
+}
+
+static void start()
+{
+    sched_register_task(&send_request);
+    sched_register_task(&start_config);
+    sched_register_task(&switch_access_class);
+    print_header();
+    config_index = 0;
+    start_config();
+}
+
+#endif
+
+void bootstrap()
+{
+    dae_access_profile_t access_profiles[ACCESS_PROFILE_COUNT];
+    for(uint8_t i = 0; i < ACCESS_PROFILE_COUNT; i++)
+    {
+        access_profiles[i] = (dae_access_profile_t){
+            .channel_header = {
+                .ch_coding = PHY_CODING_PN9,
+                .ch_class = channel_classes[i],
+                .ch_freq_band = PHY_BAND_868
+            },
+            .subprofiles[0] = {
+                .subband_bitmap = SCAN_SUBBAND_BITMAP,
+                .scan_automation_period = 0,
+            },
+            .subbands[0] = (subband_t){
+                .channel_index_start = 0,
+                .channel_index_end = 0,
+                .eirp = 10,
+                .cca = -86,
+                .duty = 0,
+            }
+        };
+    }
+
+    fs_init_args_t fs_init_args = (fs_init_args_t){
+#ifdef LATENCY_BENCH_RESPONDER
+        .fs_user_files_init_cb = &init_user_files,
+#endif
+        .access_profiles_count = ACCESS_PROFILE_COUNT,
+        .access_profiles = access_profiles,
+        .access_class = INITIAL_ACCESS_CLASS
+    };
+
+#ifndef LATENCY_BENCH_RESPONDER
+    alp_init_args.alp_command_completed_cb = &on_alp_command_completed_cb;
+    alp_init_args.alp_received_unsolicited_data_cb = &on_response_received_cb;
+#endif
+    d7ap_stack_init(&fs_init_args, &alp_init_args, false, NULL);
+    start();
+}
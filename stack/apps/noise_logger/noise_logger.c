@@ -56,7 +56,29 @@
 #define TEMPERATURE_PERIOD TIMER_TICKS_PER_SEC * 10
 
 #define RX_MAX_WINDOW 50
-#define RSSI_SAMPLES_PER_MEASUREMENT 10
+#define RSSI_SAMPLES_PER_MEASUREMENT NOISE_LOGGER_SAMPLE_COUNT
+
+#ifdef NOISE_LOGGER_BINARY_OUTPUT
+// a block starts with BLOCK_MARKER and the length of the rest of the block, followed by the block sequence number (to
+// detect the blocks dropped by the console), the type of the block, the raw channel header and the center frequency index
+// (16 bit, little endian) of the channel, the timestamp of the first sample (32 bit, little endian) and the RSSI values.
+// These are the samples (BLOCK_TYPE_SAMPLES) or their minimum, maximum, median and 90th percentile (BLOCK_TYPE_AGGREGATE),
+// each as the negated RSSI in dBm in a byte. See tools/noise_logger_decoder.py
+#define BLOCK_MARKER 0x1D
+#define BLOCK_HEADER_SIZE 9
+#define BLOCK_TYPE_SAMPLES 'S'
+#define BLOCK_TYPE_AGGREGATE 'A'
+
+#ifdef NOISE_LOGGER_AGGREGATE
+#define BLOCK_RSSI_COUNT 4
+#else
+#define BLOCK_RSSI_COUNT RSSI_SAMPLES_PER_MEASUREMENT
+#endif
+
+#if RSSI_SAMPLES_PER_MEASUREMENT > 240
+#error "the samples of a channel visit do not fit a block"
+#endif
+#endif
 
 typedef struct
 {
@@ -72,6 +94,9 @@ static uint8_t uart_rx_buffer[UART_RX_BUFFER_SIZE] = { 0 };
 static fifo_t uart_rx_fifo;
 static uint16_t rx_measurement_counter = 0;
 static timestamped_rssi_t rx_measurement_max = { 0, -200};
+#ifdef NOISE_LOGGER_BINARY_OUTPUT
+static uint8_t block_sequence_number = 0;
+#endif
 
 static hw_rx_cfg_t rx_cfg = {
     .channel_id = {
@@ -84,6 +109,7 @@ static hw_rx_cfg_t rx_cfg = {
 };
 
 void start_rx();
+void rssi_valid(int16_t cur_rssi);
 
 static void switch_prev_channel()
 {
@@ -257,22 +283,77 @@ static void channel_id_to_string(channel_id_t* channel, char* str, size_t len)
     snprintf(str, len, "%.3s%c%03i", band, rate, channel->center_freq_index);
 }
 
+#ifdef NOISE_LOGGER_BINARY_OUTPUT
+static uint8_t encode_rssi(int16_t rssi)
+{
+    if(rssi > 0)
+        return 0;
+
+    return rssi < -255 ? 255 : -rssi;
+}
+
+static void output_block(timestamped_rssi_t* rssi_measurement)
+{
+    uint8_t block[2 + BLOCK_HEADER_SIZE + BLOCK_RSSI_COUNT];
+    block[0] = BLOCK_MARKER;
+    block[1] = BLOCK_HEADER_SIZE + BLOCK_RSSI_COUNT;
+    block[2] = block_sequence_number++;
+    block[4] = rx_cfg.channel_id.channel_header_raw;
+    block[5] = rx_cfg.channel_id.center_freq_index & 0xFF;
+    block[6] = rx_cfg.channel_id.center_freq_index >> 8;
+    for(uint8_t i = 0; i < 4; i++)
+        block[7 + i] = (rssi_measurement->tick >> (8 * i)) & 0xFF;
+
+    uint8_t* rssi = block + 2 + BLOCK_HEADER_SIZE;
+#ifdef NOISE_LOGGER_AGGREGATE
+    block[3] = BLOCK_TYPE_AGGREGATE;
+
+    // insertion sort of the samples, in ascending order
+    int16_t* samples = rssi_measurement->rssi;
+    for(uint8_t i = 1; i < RSSI_SAMPLES_PER_MEASUREMENT; i++)
+    {
+        int16_t sample = samples[i];
+        uint8_t j = i;
+        for(; j > 0 && samples[j - 1] > sample; j--)
+            samples[j] = samples[j - 1];
+
+        samples[j] = sample;
+    }
+
+    rssi[0] = encode_rssi(samples[0]);
+    rssi[1] = encode_rssi(samples[RSSI_SAMPLES_PER_MEASUREMENT - 1]);
+    rssi[2] = encode_rssi(samples[RSSI_SAMPLES_PER_MEASUREMENT / 2]);
+    rssi[3] = encode_rssi(samples[(RSSI_SAMPLES_PER_MEASUREMENT * 9 + 9) / 10 - 1]); // nearest rank
+#else
+    block[3] = BLOCK_TYPE_SAMPLES;
+    for(uint8_t i = 0; i < RSSI_SAMPLES_PER_MEASUREMENT; i++)
+        rssi[i] = encode_rssi(rssi_measurement->rssi[i]);
+#endif
+
+    console_print_bytes(block, sizeof(block));
+}
+#endif
+
 void read_rssi()
 {
     timestamped_rssi_t rssi_measurement;
     rssi_measurement.tick = timer_get_counter_value();
 
-    char rssi_samples_str[5 * RSSI_SAMPLES_PER_MEASUREMENT] = "";
+    // the samples are taken back to back, they are formatted afterwards
     int16_t max_rssi_sample = -200;
     for(int i = 0; i < RSSI_SAMPLES_PER_MEASUREMENT; i++)
     {
         rssi_measurement.rssi[i] = hw_radio_get_rssi();
         if(rssi_measurement.rssi[i] > max_rssi_sample)
             max_rssi_sample = rssi_measurement.rssi[i];
+    }
 
+#ifdef NOISE_LOGGER_BINARY_OUTPUT
+    output_block(&rssi_measurement);
+#else
+    char rssi_samples_str[5 * RSSI_SAMPLES_PER_MEASUREMENT + 1] = "";
+    for(int i = 0; i < RSSI_SAMPLES_PER_MEASUREMENT; i++)
         sprintf(rssi_samples_str + (i * 5), ",%04i", rssi_measurement.rssi[i]);
-        // TODO delay?
-    }
 
     char str[80];
     char channel_str[8] = "";
@@ -290,11 +371,18 @@ void read_rssi()
     sprintf(str, "%7s,%d\n", channel_str, max_rssi_sample);
     lcd_write_string(str);
 #endif
+#endif // NOISE_LOGGER_BINARY_OUTPUT
 
     if(!use_manual_channel_switching)
     {
         switch_next_channel();
+#ifdef NOISE_LOGGER_BINARY_OUTPUT
+        // retune right away, start_rx() logs and updates the LCD. Only the center frequency index changes, which the
+        // radio drivers apply without configuring the channel again
+        hw_radio_set_rx(&rx_cfg, NULL, &rssi_valid);
+#else
         sched_post_task(&start_rx);
+#endif
     }
     else
     {
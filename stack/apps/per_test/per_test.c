@@ -35,6 +35,7 @@
 #include <hwwatchdog.h>
 
 #include "crc.h"
+#include "phy_coding.h"
 #include "debug.h"
 
 #ifdef PLATFORM_EFM32GG_STK3700
@@ -70,6 +71,8 @@
 #define COMMAND_RECV "RECV"
 #define COMMAND_RSET "RSET"
 #define COMMAND_DATA "DATA"
+#define COMMAND_SWEP "SWEP"
+#define COMMAND_RESP "RESP"
 
 // Define the maximum length of the user data according the size occupied already by the parameters length, counter, id and crc
 #define DATA_MAX_LEN PACKET_SIZE - 2*sizeof(uint16_t) /* word for crc + counter */  - sizeof(uint64_t) /* id */ - 1 /*byte length*/
@@ -123,6 +126,7 @@ static void packet_received(hw_radio_packet_t* packet);
 static void packet_transmitted(hw_radio_packet_t* packet);
 static void start();
 static void increase_channel();
+static void sweep_stop();
 
 static void start_rx() {
     DPRINT("start RX");
@@ -270,6 +274,7 @@ static void packet_transmitted(hw_radio_packet_t* packet) {
 static void stop() {
 	// make sure to cancel tasks which might me pending already
 	hw_radio_set_idle();
+	sweep_stop();
 
 	if(is_mode_rx) {
 		sched_cancel_task(&start_rx);
@@ -372,6 +377,311 @@ static void start() {
 
 }
 
+// The automated benchmark (SWEP and RESP commands). The initiator sends PER_TEST_SWEEP_PACKET_COUNT requests for every
+// combination of channel class, coding, frame length and EIRP of the tables below, on the band and center frequency set
+// with CHAN. The responder answers every request right away on the same channel, with the number of requests it received
+// in the configuration. Both nodes go through the same sequence of configurations: the initiator a guard time after the
+// last request of a configuration, the responder a shorter guard time after the last request was due, so it keeps up
+// when requests are lost. After each configuration the initiator prints a RESULT line (see sweep_print_header()), the
+// requests received by the responder are as reported in the last response received. The round trip time is measured from
+// the start of the transmission of a request until the end of its response, the goodput from the payload bytes of the
+// requests the responder received.
+
+#define SWEEP_REQUEST 0xA0
+#define SWEEP_RESPONSE 0xA1
+// the type, the configuration index, the sequence number and the number of requests the responder received
+#define SWEEP_HEADER_SIZE 6
+#define SWEEP_MIN_LENGTH (SWEEP_HEADER_SIZE + 2)
+// the frames start with the length byte, coded with FEC they should fit the 255 bytes a radio transmits at once
+#define SWEEP_MAX_FEC_FRAME_SIZE 125
+// an upper bound of the preamble and the sync word of all channel classes, in bytes
+#define SWEEP_PHY_OVERHEAD 8
+#define SWEEP_TURNAROUND_TIME (TIMER_TICKS_PER_SEC / 50)
+#define SWEEP_RESPONDER_GUARD_TIME (TIMER_TICKS_PER_SEC / 10)
+#define SWEEP_INITIATOR_GUARD_TIME (TIMER_TICKS_PER_SEC / 5)
+
+static const phy_channel_class_t sweep_classes[] = { PHY_CLASS_LO_RATE, PHY_CLASS_NORMAL_RATE, PHY_CLASS_HI_RATE };
+static const phy_coding_t sweep_codings[] = { PHY_CODING_PN9, PHY_CODING_FEC_PN9 };
+static const uint8_t sweep_lengths[] = { PER_TEST_SWEEP_LENGTHS };
+static const int8_t sweep_eirps[] = { PER_TEST_SWEEP_EIRPS };
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+#define SWEEP_CONFIG_COUNT (COUNT(sweep_classes) * COUNT(sweep_codings) * COUNT(sweep_lengths) * COUNT(sweep_eirps))
+
+typedef struct
+{
+    channel_id_t channel_id;
+    uint8_t length;         // the value of the length byte, the CRC included
+    int8_t eirp;
+    timer_tick_t period;    // the time between two requests, long enough for the request and the response
+} sweep_config_t;
+
+typedef struct
+{
+    uint16_t sent;
+    uint16_t responses;
+    uint16_t received_by_responder;
+    timer_tick_t start;
+    timer_tick_t end;
+    timer_tick_t rtt_min;
+    timer_tick_t rtt_max;
+    uint32_t rtt_sum;
+    int32_t rssi_sum;
+} sweep_stats_t;
+
+static bool sweep_is_initiator;
+static uint8_t sweep_config_index;
+static sweep_config_t sweep_config;
+static uint16_t sweep_seq;
+static timer_tick_t sweep_request_time;
+static sweep_stats_t sweep_stats;
+static uint16_t sweep_responder_count;
+static uint8_t sweep_response_config_index;
+static uint16_t sweep_response_seq;
+
+static void sweep_next_config();
+static void sweep_send_request();
+static void sweep_send_response();
+static void sweep_packet_received(hw_radio_packet_t* packet);
+
+static timer_tick_t sweep_airtime(const channel_id_t* channel_id, uint8_t length)
+{
+    uint32_t bitrate;
+    switch(channel_id->channel_header.ch_class)
+    {
+        case PHY_CLASS_LO_RATE: bitrate = 9600; break;
+        case PHY_CLASS_HI_RATE: bitrate = 166667; break;
+        default: bitrate = 55555; break;
+    }
+
+    uint8_t stages = channel_id->channel_header.ch_coding == PHY_CODING_FEC_PN9 ? PHY_STAGE_FEC : 0;
+    uint32_t bits = 8 * (SWEEP_PHY_OVERHEAD + phy_calculate_encoded_length(stages, length + 1));
+    return (timer_tick_t)(((uint64_t)bits * TIMER_TICKS_PER_SEC + bitrate - 1) / bitrate);
+}
+
+// fills sweep_config with the configuration of the index, false when the radio cannot use it
+static bool sweep_get_config(uint8_t index)
+{
+    uint8_t eirp_index = index % COUNT(sweep_eirps);
+    index /= COUNT(sweep_eirps);
+    uint8_t length_index = index % COUNT(sweep_lengths);
+    index /= COUNT(sweep_lengths);
+    uint8_t coding_index = index % COUNT(sweep_codings);
+    index /= COUNT(sweep_codings);
+
+    channel_id_t* channel_id = &sweep_config.channel_id;
+    channel_id->channel_header.ch_freq_band = current_channel_id.channel_header.ch_freq_band;
+    channel_id->channel_header.ch_class = sweep_classes[index];
+    channel_id->channel_header.ch_coding = sweep_codings[coding_index];
+    // the center frequency indexes of the normal and high rate channels are multiples of 8
+    channel_id->center_freq_index = current_channel_id.center_freq_index & ~7;
+    sweep_config.length = sweep_lengths[length_index];
+    sweep_config.eirp = sweep_eirps[eirp_index];
+
+    if(channel_id->channel_header.ch_freq_band == PHY_BAND_433 && channel_id->channel_header.ch_class == PHY_CLASS_HI_RATE)
+        return false;
+
+    if(sweep_config.length < SWEEP_MIN_LENGTH)
+        return false;
+
+    if(channel_id->channel_header.ch_coding == PHY_CODING_FEC_PN9 && sweep_config.length + 1 > SWEEP_MAX_FEC_FRAME_SIZE)
+        return false;
+
+    sweep_config.period = 2 * sweep_airtime(channel_id, sweep_config.length) + SWEEP_TURNAROUND_TIME;
+    rx_cfg.channel_id = sweep_config.channel_id;
+    tx_cfg.channel_id = sweep_config.channel_id;
+    tx_cfg.eirp = sweep_config.eirp;
+    return true;
+}
+
+static void sweep_print_header()
+{
+    console_printf("RESULT,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n", "timestamp", "config", "channel_id", "coding",
+                   "length", "eirp", "sent", "received", "responses", "per_down", "per_up", "rtt_min_ms", "rtt_avg_ms",
+                   "rtt_max_ms", "rssi_avg", "goodput_bps");
+}
+
+static uint32_t sweep_ticks_to_ms(uint32_t ticks)
+{
+    return (uint32_t)(((uint64_t)ticks * 1000) / TIMER_TICKS_PER_SEC);
+}
+
+static void sweep_print_result()
+{
+    char chan[8];
+    channel_id_to_string(&sweep_config.channel_id, chan, sizeof(chan));
+
+    // the losses of the requests, and of the responses to the requests which were received
+    uint16_t received = sweep_stats.received_by_responder;
+    uint32_t per_down = sweep_stats.sent ? 1000 - (uint32_t)received * 1000 / sweep_stats.sent : 0;
+    uint32_t per_up = received ? 1000 - (uint32_t)sweep_stats.responses * 1000 / received : 1000;
+    uint32_t rtt_avg = sweep_stats.responses ? sweep_stats.rtt_sum / sweep_stats.responses : 0;
+    uint32_t duration_ms = sweep_ticks_to_ms(sweep_stats.end - sweep_stats.start);
+    int16_t rssi_avg = sweep_stats.responses ? sweep_stats.rssi_sum / sweep_stats.responses : 0;
+    uint32_t payload_bits = (uint32_t)received * (sweep_config.length - SWEEP_MIN_LENGTH) * 8;
+    uint32_t goodput = duration_ms ? (uint32_t)((uint64_t)payload_bits * 1000 / duration_ms) : 0;
+
+    console_printf("RESULT,%lu,%u,%s,%s,%u,%i,%u,%u,%u,%lu.%lu,%lu.%lu,%lu,%lu,%lu,%i,%lu\n",
+                   (unsigned long)sweep_stats.end, sweep_config_index, chan,
+                   sweep_config.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9 ? "FEC" : "PN9",
+                   sweep_config.length, sweep_config.eirp, sweep_stats.sent, received, sweep_stats.responses,
+                   (unsigned long)per_down / 10, (unsigned long)per_down % 10, (unsigned long)per_up / 10,
+                   (unsigned long)per_up % 10, (unsigned long)sweep_ticks_to_ms(sweep_stats.responses ? sweep_stats.rtt_min : 0),
+                   (unsigned long)sweep_ticks_to_ms(rtt_avg), (unsigned long)sweep_ticks_to_ms(sweep_stats.rtt_max),
+                   rssi_avg, (unsigned long)goodput);
+}
+
+static void sweep_build_frame(uint8_t type, uint8_t config_index, uint16_t seq, uint16_t received_count)
+{
+    uint8_t length = sweep_config.length;
+    tx_packet->data[0] = length;
+    tx_packet->data[1] = type;
+    tx_packet->data[2] = config_index;
+    tx_packet->data[3] = seq & 0xFF;
+    tx_packet->data[4] = seq >> 8;
+    tx_packet->data[5] = received_count & 0xFF;
+    tx_packet->data[6] = received_count >> 8;
+    for(uint8_t i = 1 + SWEEP_HEADER_SIZE; i < length + 1 - 2; i++)
+        tx_packet->data[i] = i;
+
+    uint16_t crc = __builtin_bswap16(crc_calculate(tx_packet->data, length + 1 - 2));
+    memcpy(tx_packet->data + length + 1 - 2, &crc, 2);
+    tx_packet->tx_meta.tx_cfg = tx_cfg;
+}
+
+static void sweep_start_config()
+{
+    memset(&sweep_stats, 0, sizeof(sweep_stats));
+    sweep_stats.rtt_min = UINT32_MAX;
+    sweep_stats.start = timer_get_counter_value();
+    sweep_seq = 0;
+    sweep_responder_count = 0;
+    hw_radio_set_rx(&rx_cfg, &sweep_packet_received, NULL);
+
+    if(sweep_is_initiator)
+        sched_post_task(&sweep_send_request);
+    else
+        timer_post_task_delay(&sweep_next_config, PER_TEST_SWEEP_PACKET_COUNT * sweep_config.period + SWEEP_RESPONDER_GUARD_TIME);
+}
+
+static void sweep_start(bool is_initiator)
+{
+    // the configuration index is a byte of the frames
+    assert(SWEEP_CONFIG_COUNT <= UINT8_MAX);
+    sweep_is_initiator = is_initiator;
+    sweep_config_index = 0;
+    while(sweep_config_index < SWEEP_CONFIG_COUNT && !sweep_get_config(sweep_config_index))
+        sweep_config_index++;
+
+    if(sweep_config_index == SWEEP_CONFIG_COUNT)
+    {
+        console_print("No valid sweep configuration\r\n");
+        return;
+    }
+
+    current_state = STATE_RUNNING;
+    if(is_initiator)
+        sweep_print_header();
+
+    sweep_start_config();
+}
+
+static void sweep_stop()
+{
+    sched_cancel_task(&sweep_send_request);
+    timer_cancel_task(&sweep_send_request);
+    sched_cancel_task(&sweep_send_response);
+    sched_cancel_task(&sweep_next_config);
+    timer_cancel_task(&sweep_next_config);
+}
+
+static void sweep_next_config()
+{
+    if(sweep_is_initiator)
+    {
+        sweep_print_result();
+        hw_watchdog_feed();
+    }
+
+    do
+        sweep_config_index++;
+    while(sweep_config_index < SWEEP_CONFIG_COUNT && !sweep_get_config(sweep_config_index));
+
+    if(sweep_config_index == SWEEP_CONFIG_COUNT)
+    {
+        hw_radio_set_idle();
+        console_print("SWEEP done\r\n");
+        return;
+    }
+
+    sweep_start_config();
+}
+
+static void sweep_packet_transmitted(hw_radio_packet_t* packet)
+{
+    hw_radio_set_rx(&rx_cfg, &sweep_packet_received, NULL);
+}
+
+static void sweep_send_request()
+{
+    if(sweep_seq == PER_TEST_SWEEP_PACKET_COUNT)
+    {
+        // the responder follows once the last request was due
+        sweep_stats.end = timer_get_counter_value();
+        timer_post_task_delay(&sweep_next_config, SWEEP_INITIATOR_GUARD_TIME);
+        return;
+    }
+
+    sweep_request_time = timer_get_counter_value();
+    timer_post_task(&sweep_send_request, sweep_request_time + sweep_config.period);
+    sweep_build_frame(SWEEP_REQUEST, sweep_config_index, sweep_seq++, 0);
+    sweep_stats.sent++;
+    hw_radio_send_packet(tx_packet, &sweep_packet_transmitted);
+}
+
+static void sweep_send_response()
+{
+    sweep_build_frame(SWEEP_RESPONSE, sweep_response_config_index, sweep_response_seq, sweep_responder_count);
+    hw_radio_send_packet(tx_packet, &sweep_packet_transmitted);
+}
+
+static void sweep_packet_received(hw_radio_packet_t* packet)
+{
+    uint8_t length = packet->length;
+    if(length < SWEEP_MIN_LENGTH || packet->rx_meta.crc_status == HW_CRC_INVALID)
+        return;
+
+    uint16_t crc = __builtin_bswap16(crc_calculate(packet->data, length + 1 - 2));
+    if(memcmp(&crc, packet->data + length + 1 - 2, 2) != 0 || packet->data[2] != sweep_config_index)
+        return;
+
+    uint16_t seq = packet->data[3] | (packet->data[4] << 8);
+    if(!sweep_is_initiator && packet->data[1] == SWEEP_REQUEST)
+    {
+        // answered from a task, the frames of both directions share the tx buffer
+        sweep_responder_count++;
+        sweep_response_config_index = packet->data[2];
+        sweep_response_seq = seq;
+        sched_post_task(&sweep_send_response);
+
+        // move on once the last request of the configuration is due
+        timer_post_task_delay(&sweep_next_config, (PER_TEST_SWEEP_PACKET_COUNT - seq) * sweep_config.period + SWEEP_RESPONDER_GUARD_TIME);
+    }
+    else if(sweep_is_initiator && packet->data[1] == SWEEP_RESPONSE && seq == sweep_seq - 1)
+    {
+        timer_tick_t rtt = packet->rx_meta.timestamp - sweep_request_time;
+        sweep_stats.responses++;
+        sweep_stats.received_by_responder = packet->data[5] | (packet->data[6] << 8);
+        sweep_stats.rtt_sum += rtt;
+        sweep_stats.rssi_sum += packet->rx_meta.rssi;
+        if(rtt < sweep_stats.rtt_min)
+            sweep_stats.rtt_min = rtt;
+
+        if(rtt > sweep_stats.rtt_max)
+            sweep_stats.rtt_max = rtt;
+    }
+}
+
 static void userbutton_callback(button_id_t button_id)
 {
 	stop();
@@ -514,6 +824,12 @@ static void process_uart_rx_fifo()
             current_state = STATE_RUNNING;
             sched_post_task(&start);
         }
+        else if(strncmp((const char*)received_cmd, COMMAND_SWEP, COMMAND_SIZE) == 0
+                || strncmp((const char*)received_cmd, COMMAND_RESP, COMMAND_SIZE) == 0)
+        {
+            stop();
+            sweep_start(strncmp((const char*)received_cmd, COMMAND_SWEP, COMMAND_SIZE) == 0);
+        }
         else if(strncmp((const char*)received_cmd, COMMAND_RSET, COMMAND_SIZE) == 0)
         {
             DPRINT("resetting...\r\n");
@@ -565,6 +881,8 @@ void bootstrap() {
     console_print("               iii center_freq_index\r\n");
     console_print("  TRANsss      transmit a packet every sss seconds.\r\n");
     console_print("  RECV         receive packets\r\n");
+    console_print("  SWEP         measure PER, latency and goodput per channel class, coding, length and EIRP\r\n");
+    console_print("  RESP         answer the requests of a node running SWEP\r\n");
     console_print("  RSET         reset module\r\n");
 
     id = hw_get_unique_id();
@@ -586,6 +904,9 @@ void bootstrap() {
     sched_register_task(&transmit_packet);
     sched_register_task(&start);
     sched_register_task(&process_uart_rx_fifo);
+    sched_register_task(&sweep_send_request);
+    sched_register_task(&sweep_send_response);
+    sched_register_task(&sweep_next_config);
 
     current_state = STATE_CONFIG_DIRECTION;
 
@@ -59,10 +59,11 @@
 #define SENSOR_FILE_SIZE         8
 #define ACTION_FILE_ID           0x41
 
-#define SENSOR_INTERVAL_SEC	TIMER_TICKS_PER_SEC * 10
+#define SENSOR_INTERVAL_MS	10000
 
 
-void execute_sensor_measurement()
+// refreshes the sensor file before its action is executed periodically
+void execute_sensor_measurement(uint8_t file_id)
 {
 #if (defined PLATFORM_EFM32HG_STK3400  || defined PLATFORM_EZR32LG_WSTK6200A \
   || defined PLATFORM_EZR32LG_OCTA || defined PLATFORM_EFM32GG_STK3700 || defined PLATFORM_EZR32LG_USB01)
@@ -112,8 +113,6 @@ void execute_sensor_measurement()
   fs_write_file(SENSOR_FILE_ID, 0, (uint8_t*)&t, sizeof(timer_tick_t));
 #endif
 
-  timer_post_task_delay(&execute_sensor_measurement, SENSOR_INTERVAL_SEC);
-
 #ifdef PLATFORM_EZR32LG_OCTA
   led_flash_green();
 #endif
@@ -208,8 +207,7 @@ void bootstrap()
     initSensors();
 #endif
 
-    sched_register_task(&execute_sensor_measurement);
-    timer_post_task_delay(&execute_sensor_measurement, SENSOR_INTERVAL_SEC);
+    fs_set_file_action_period(SENSOR_FILE_ID, SENSOR_INTERVAL_MS, &execute_sensor_measurement);
 
     LCD_WRITE_STRING("EFM32 Sensor\n");
 }
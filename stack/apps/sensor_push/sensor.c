@@ -19,6 +19,14 @@
 
 // This examples pushes sensor data to gateway(s) by manually constructing an ALP command with a file read result action
 // (unsolicited message). The D7 session is configured to request ACKs. All received ACKs are printed.
+// The sensors are sampled every SENSOR_PUSH_SAMPLE_PERIOD, but a sample is only recorded when one of its values changed
+// by SENSOR_PUSH_CHANGE_THRESHOLD since the last recorded sample. The recorded samples are packed in one report, sent
+// SENSOR_PUSH_REPORT_HOLDOFF after the first one, as soon as SENSOR_PUSH_REPORT_SAMPLE_COUNT are recorded, or with the
+// current sample after SENSOR_PUSH_MAX_REPORT_INTERVAL without any change. The data of the report is an array of
+// records: the age of the sample in seconds (uint16) followed by its SENSOR_VALUE_COUNT values (uint16), little endian.
+// With SENSOR_PUSH_COMPRESSED_REPORTS the records are delta coded instead (see compress_delta_encode()), the first one
+// against a record of zeros so every report decodes on its own, and returned as the data of SENSOR_COMPRESSED_FILE_ID.
+// The report packs as many samples as fit in an ALP command, the others are kept for the next report.
 
 #include "hwleds.h"
 #include "hwsystem.h"
@@ -29,12 +37,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "hwlcd.h"
 #include "hwadc.h"
 #include "d7ap_stack.h"
 #include "fs.h"
 #include "log.h"
+#include "compress.h"
 
 #if (defined PLATFORM_EFM32GG_STK3700 || defined PLATFORM_EFM32HG_STK3400 || defined PLATFORM_EZR32LG_WSTK6200A || defined PLATFORM_EZR32LG_OCTA)
   #include "platform_sensors.h"
@@ -55,8 +65,35 @@
 
 
 #define SENSOR_FILE_ID           0x40
-#define SENSOR_FILE_SIZE         8
-#define SENSOR_INTERVAL_SEC	TIMER_TICKS_PER_SEC * 10
+#define SENSOR_VALUE_COUNT       4
+#define SENSOR_RECORD_SIZE       (2 + 2 * SENSOR_VALUE_COUNT)
+#define SENSOR_FILE_SIZE         (SENSOR_PUSH_REPORT_SAMPLE_COUNT * SENSOR_RECORD_SIZE)
+#define SENSOR_COMPRESSED_FILE_ID 0x41
+
+#ifdef SENSOR_PUSH_COMPRESSED_REPORTS
+  #define SENSOR_REPORT_MAX_SIZE ALP_PAYLOAD_MAX_SIZE
+  #if SENSOR_PUSH_REPORT_SAMPLE_COUNT < 1
+    #error "SENSOR_PUSH_REPORT_SAMPLE_COUNT should be at least 1"
+  #endif
+#else
+  #define SENSOR_REPORT_MAX_SIZE (3 + 2 + SENSOR_FILE_SIZE)
+  #if SENSOR_PUSH_REPORT_SAMPLE_COUNT < 1 || SENSOR_REPORT_MAX_SIZE > ALP_PAYLOAD_MAX_SIZE
+    #error "SENSOR_PUSH_REPORT_SAMPLE_COUNT should be at least 1 and the report should fit in ALP_PAYLOAD_MAX_SIZE"
+  #endif
+#endif
+
+typedef struct
+{
+  timer_tick_t time;
+  uint16_t values[SENSOR_VALUE_COUNT];
+} sensor_sample_t;
+
+static sensor_sample_t samples[SENSOR_PUSH_REPORT_SAMPLE_COUNT];
+static uint8_t sample_count = 0;
+// the values of the last recorded sample, the changes are relative to them
+static uint16_t recorded_values[SENSOR_VALUE_COUNT];
+static bool has_recorded_values = false;
+static timer_tick_t last_report_time;
 
 // Define the D7 interface configuration used for sending the ALP command on
 static d7asp_master_session_config_t session_config = {
@@ -79,11 +116,9 @@ static d7asp_master_session_config_t session_config = {
 
 
 
-void execute_sensor_measurement()
+static void read_sensor_values(uint16_t* sensor_values)
 {
-  // first get the sensor reading ...
-
-  uint8_t sensor_values[SENSOR_FILE_SIZE] = { 0 };
+  memset(sensor_values, 0, SENSOR_VALUE_COUNT * sizeof(uint16_t));
 
 #if (defined PLATFORM_EFM32HG_STK3400  || defined PLATFORM_EZR32LG_WSTK6200A \
   || defined PLATFORM_EZR32LG_OCTA || defined PLATFORM_EFM32GG_STK3700 || defined PLATFORM_EZR32LG_USB01)
@@ -119,7 +154,7 @@ void execute_sensor_measurement()
   LCD_WRITE_LINE(5,str);
   log_print_string(str);
 
-  uint16_t *pointer =  (uint16_t*) sensor_values;
+  uint16_t *pointer = sensor_values;
   *pointer++ = (uint16_t) (internal_temp * 10);
   *pointer++ = (uint16_t) (tData /100);
   *pointer++ = (uint16_t) (rhData /100);
@@ -129,32 +164,130 @@ void execute_sensor_measurement()
   timer_tick_t t = timer_get_counter_value();
   memcpy(sensor_values, (uint8_t*)&t, sizeof(timer_tick_t));
 #endif
+}
+
+void send_report()
+{
+  timer_cancel_task(&send_report);
+  if(sample_count == 0)
+    return;
 
   // Generate ALP command. We do this manually for now (until we have an API for this).
   // We will be sending a return file data action, without a preceding file read request.
   // This is an unsolicited message, where we push the sensor data to the gateway(s).
   // Please refer to the spec for the format
 
-  uint8_t alp_command[4 + SENSOR_FILE_SIZE] = {
+  uint8_t alp_command[SENSOR_REPORT_MAX_SIZE] = {
     // ALP Control byte
     ALP_OP_RETURN_FILE_DATA,
     // File Data Request operand:
+#ifdef SENSOR_PUSH_COMPRESSED_REPORTS
+    SENSOR_COMPRESSED_FILE_ID, // the file ID
+#else
     SENSOR_FILE_ID, // the file ID
+#endif
     0, // offset in file
-    SENSOR_FILE_SIZE // data length
-    // the sensor data, see below
+    // the data length and the sensor data, see below
   };
 
-  memcpy(alp_command + 4, sensor_values, SENSOR_FILE_SIZE);
+  timer_tick_t now = timer_get_counter_value();
+#ifdef SENSOR_PUSH_COMPRESSED_REPORTS
+  uint8_t data[SENSOR_REPORT_MAX_SIZE - 3 - 2];
+  uint8_t data_length = 0;
+  int32_t previous[1 + SENSOR_VALUE_COUNT] = { 0 };
+  uint8_t reported_count = 0;
+  for(; reported_count < sample_count; reported_count++)
+  {
+    uint32_t age = (now - samples[reported_count].time) / TIMER_TICKS_PER_SEC;
+    int32_t record[1 + SENSOR_VALUE_COUNT] = { age > UINT16_MAX ? UINT16_MAX : age };
+    for(uint8_t i = 0; i < SENSOR_VALUE_COUNT; i++)
+      record[1 + i] = samples[reported_count].values[i];
+
+    uint8_t length = compress_delta_encode(previous, record, 1 + SENSOR_VALUE_COUNT, data + data_length,
+                                           sizeof(data) - data_length);
+    if(length == 0)
+      break;
+
+    data_length += length;
+  }
+
+  uint8_t* ptr = alp_command + 3;
+  ptr += alp_encode_length_operand(ptr, data_length);
+  memcpy(ptr, data, data_length);
+  ptr += data_length;
+#else
+  uint8_t* ptr = alp_command + 3;
+  ptr += alp_encode_length_operand(ptr, sample_count * SENSOR_RECORD_SIZE);
+
+  uint8_t reported_count = sample_count;
+  for(uint8_t i = 0; i < sample_count; i++)
+  {
+    uint32_t age = (now - samples[i].time) / TIMER_TICKS_PER_SEC;
+    uint16_t record[1 + SENSOR_VALUE_COUNT] = { age > UINT16_MAX ? UINT16_MAX : age };
+    memcpy(record + 1, samples[i].values, sizeof(samples[i].values));
+    memcpy(ptr, record, SENSOR_RECORD_SIZE);
+    ptr += SENSOR_RECORD_SIZE;
+  }
+#endif
 
-  alp_execute_command(alp_command, sizeof(alp_command), &session_config);
-  timer_post_task_delay(&execute_sensor_measurement, SENSOR_INTERVAL_SEC);
+  log_print_string("Reporting %d samples", reported_count);
+  sample_count -= reported_count;
+  memmove(samples, samples + reported_count, sample_count * sizeof(sensor_sample_t));
+  last_report_time = now;
+  alp_execute_command(alp_command, ptr - alp_command, &session_config);
+  if(sample_count > 0)
+    timer_post_task_delay(&send_report, SENSOR_PUSH_REPORT_HOLDOFF * TIMER_TICKS_PER_SEC);
 
 #ifdef PLATFORM_EZR32LG_OCTA
   led_flash_green();
 #endif
 }
 
+static bool is_significant_change(const uint16_t* sensor_values)
+{
+  if(!has_recorded_values)
+    return true;
+
+  for(uint8_t i = 0; i < SENSOR_VALUE_COUNT; i++)
+  {
+    if(abs((int32_t)sensor_values[i] - recorded_values[i]) >= SENSOR_PUSH_CHANGE_THRESHOLD)
+      return true;
+  }
+
+  return false;
+}
+
+static void record_sample(const uint16_t* sensor_values)
+{
+  samples[sample_count].time = timer_get_counter_value();
+  memcpy(samples[sample_count].values, sensor_values, sizeof(samples[sample_count].values));
+  sample_count++;
+
+  memcpy(recorded_values, sensor_values, sizeof(recorded_values));
+  has_recorded_values = true;
+}
+
+void execute_sensor_measurement()
+{
+  uint16_t sensor_values[SENSOR_VALUE_COUNT];
+  read_sensor_values(sensor_values);
+
+  bool heartbeat = timer_get_counter_value() - last_report_time >= SENSOR_PUSH_MAX_REPORT_INTERVAL * TIMER_TICKS_PER_SEC;
+  if(!is_significant_change(sensor_values) && !(heartbeat && sample_count == 0))
+  {
+    if(heartbeat)
+      send_report();
+
+    return;
+  }
+
+  record_sample(sensor_values);
+  if(heartbeat || sample_count == SENSOR_PUSH_REPORT_SAMPLE_COUNT)
+    send_report();
+  else if(sample_count == 1)
+    timer_post_task_delay(&send_report, SENSOR_PUSH_REPORT_HOLDOFF * TIMER_TICKS_PER_SEC);
+}
+
 void on_alp_command_completed_cb(uint8_t tag_id, bool success)
 {
     if(success)
@@ -211,7 +344,9 @@ void bootstrap()
 #endif
 
     sched_register_task(&execute_sensor_measurement);
-    timer_post_task_delay(&execute_sensor_measurement, SENSOR_INTERVAL_SEC);
+    sched_register_task(&send_report);
+    last_report_time = timer_get_counter_value();
+    timer_post_periodic_task(&execute_sensor_measurement, SENSOR_PUSH_SAMPLE_PERIOD * TIMER_TICKS_PER_SEC, DEFAULT_PRIORITY);
 
     LCD_WRITE_STRING("Sensor push\n");
 }
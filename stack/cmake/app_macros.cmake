@@ -135,6 +135,21 @@ MACRO(APP_BUILD)
 
     SET_TARGET_PROPERTIES(${ELF} ${__APP_BUILD_NAME}.axf PROPERTIES LINK_FLAGS "${__LINKER_SCRIPT_FLAG} ${LINKER_FLAGS}")
 
+    # generate a linker map per application, used for the static RAM usage report below
+    SET(MAP ${CMAKE_CURRENT_BINARY_DIR}/${__APP_BUILD_NAME}.map)
+    SET_TARGET_PROPERTIES(${ELF} PROPERTIES LINK_FLAGS "${__LINKER_SCRIPT_FLAG} ${LINKER_FLAGS} -Xlinker -Map=${MAP}")
+
+    # generate target for reporting the static RAM usage per symbol, object and library, which fails if it exceeds PLATFORM_RAM_BUDGET
+    IF(NOT PLATFORM_RAM_BUDGET)
+        SET(PLATFORM_RAM_BUDGET 0)
+    ENDIF()
+
+    ADD_CUSTOM_TARGET(
+        ram-report-${__APP_BUILD_NAME}
+        COMMAND sh ${PROJECT_SOURCE_DIR}/tools/gcc-arm-embedded/ram_usage_report.sh ${MAP} ${PLATFORM_RAM_BUDGET}
+        DEPENDS ${ELF}
+    )
+
     IF(${PLATFORM_BUILD_BOOTLOADABLE_VERSION})
         SET(BOOTLOADABLE_ELF ${__APP_BUILD_NAME}_bootloadable.elf)
         SET(BOOTLOADABLE_BIN ${__APP_BUILD_NAME}_bootloadable.bin)
@@ -0,0 +1,27 @@
+# 
+# OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+# lowpower wireless sensor communication
+#
+# Copyright 2017 University of Antwerp
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+#######################################
+# Toolchain setup for the host (native)
+#######################################
+
+# The compiler of the host is used, select another one using -DCMAKE_C_COMPILER=clang for instance (needed for libFuzzer).
+# The framework is built as a regular host program, see the 'native' platform.
+
+MESSAGE(STATUS "Compiling for the host using the native toolchain")
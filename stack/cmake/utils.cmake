@@ -547,7 +547,7 @@ MACRO(PARSE_HEADER_VARS prefix)
 	SET_GLOBAL(${prefix}_NUMBER "${${prefix}_NUMBER};${_PHV_NUMBER}")
     ENDIF()
     IF(NOT ("${_PHV_ID}" STREQUAL ""))
-	SET_GLOBAL(${prefix}_ID "${${prefix}_STRING};${_PHV_ID}")
+	SET_GLOBAL(${prefix}_ID "${${prefix}_ID};${_PHV_ID}")
     ENDIF()
 
     UNSET(_PHV_ID)
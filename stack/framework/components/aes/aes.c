@@ -61,6 +61,8 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
 #include "stdbool.h"
 #include "aes.h"
 #include "hwaes.h"
+#include "hal_defs.h"
+#include "framework_defs.h"
 
 /*****************************************************************************/
 /* Defines:                                                                  */
@@ -82,7 +84,9 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
 #endif
 
 
-#if (defined PLATFORM_EFM32GG_STK3700 || defined PLATFORM_EFM32HG_STK3400 || defined PLATFORM_EZR32LG_WSTK6200A)
+// the block cipher is executed by the AES accelerator of the MCU when the chip provides one, see HAL_AES_USE_HW.
+// The accelerator only processes whole blocks, the modes below complete a trailing partial block themselves.
+#ifdef HAL_AES_USE_HW
     #define AES_HARDWARE_SUPPORT
 #endif
 
@@ -90,22 +94,15 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
 /* Private variables:                                                        */
 /*****************************************************************************/
 // state - array holding the intermediate results during decryption.
+// The state and the key schedule are passed to the cipher functions, which makes them reentrant.
 typedef uint8_t state_t[4][4];
-static state_t *state;
 
-// The array that stores the round keys.
-static uint8_t RoundKey[176];
+// The key schedule used by the functions without context parameter, set by AES128_init()
+static aes_ctx_t default_ctx;
+static bool default_ctx_initialized = false;
 
-// The array that stores the 128 bits key
-static uint8_t AES128_key[16];
-
-// The Key input to the AES Program
-static const uint8_t *Key;
-
-#if defined(CBC) && CBC
-    // Initial Vector used only for CBC mode
-    static uint8_t *Iv;
-#endif
+// The software cipher below is not needed when the accelerator is used
+#ifndef AES_HARDWARE_SUPPORT
 
 // The lookup-tables are marked const so they can be placed in read-only storage instead of RAM
 // The numbers below can be computed dynamically trading ROM for RAM -
@@ -148,6 +145,45 @@ static const uint8_t rsbox[256] = {
     0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d };
 
 
+#ifdef FRAMEWORK_AES_TTABLE
+// The combined SubBytes and MixColumns transformation of a byte in the first row of a state column, as the big endian
+// word {02}.S[x], S[x], S[x], {03}.S[x]. The other rows use the same word rotated right by 8, 16 and 24 bits, so a
+// single 1kB table is used instead of the four tables of the usual T-table implementation.
+static const uint32_t Te0[256] = {
+    0xc66363a5, 0xf87c7c84, 0xee777799, 0xf67b7b8d, 0xfff2f20d, 0xd66b6bbd, 0xde6f6fb1, 0x91c5c554,
+    0x60303050, 0x02010103, 0xce6767a9, 0x562b2b7d, 0xe7fefe19, 0xb5d7d762, 0x4dababe6, 0xec76769a,
+    0x8fcaca45, 0x1f82829d, 0x89c9c940, 0xfa7d7d87, 0xeffafa15, 0xb25959eb, 0x8e4747c9, 0xfbf0f00b,
+    0x41adadec, 0xb3d4d467, 0x5fa2a2fd, 0x45afafea, 0x239c9cbf, 0x53a4a4f7, 0xe4727296, 0x9bc0c05b,
+    0x75b7b7c2, 0xe1fdfd1c, 0x3d9393ae, 0x4c26266a, 0x6c36365a, 0x7e3f3f41, 0xf5f7f702, 0x83cccc4f,
+    0x6834345c, 0x51a5a5f4, 0xd1e5e534, 0xf9f1f108, 0xe2717193, 0xabd8d873, 0x62313153, 0x2a15153f,
+    0x0804040c, 0x95c7c752, 0x46232365, 0x9dc3c35e, 0x30181828, 0x379696a1, 0x0a05050f, 0x2f9a9ab5,
+    0x0e070709, 0x24121236, 0x1b80809b, 0xdfe2e23d, 0xcdebeb26, 0x4e272769, 0x7fb2b2cd, 0xea75759f,
+    0x1209091b, 0x1d83839e, 0x582c2c74, 0x341a1a2e, 0x361b1b2d, 0xdc6e6eb2, 0xb45a5aee, 0x5ba0a0fb,
+    0xa45252f6, 0x763b3b4d, 0xb7d6d661, 0x7db3b3ce, 0x5229297b, 0xdde3e33e, 0x5e2f2f71, 0x13848497,
+    0xa65353f5, 0xb9d1d168, 0x00000000, 0xc1eded2c, 0x40202060, 0xe3fcfc1f, 0x79b1b1c8, 0xb65b5bed,
+    0xd46a6abe, 0x8dcbcb46, 0x67bebed9, 0x7239394b, 0x944a4ade, 0x984c4cd4, 0xb05858e8, 0x85cfcf4a,
+    0xbbd0d06b, 0xc5efef2a, 0x4faaaae5, 0xedfbfb16, 0x864343c5, 0x9a4d4dd7, 0x66333355, 0x11858594,
+    0x8a4545cf, 0xe9f9f910, 0x04020206, 0xfe7f7f81, 0xa05050f0, 0x783c3c44, 0x259f9fba, 0x4ba8a8e3,
+    0xa25151f3, 0x5da3a3fe, 0x804040c0, 0x058f8f8a, 0x3f9292ad, 0x219d9dbc, 0x70383848, 0xf1f5f504,
+    0x63bcbcdf, 0x77b6b6c1, 0xafdada75, 0x42212163, 0x20101030, 0xe5ffff1a, 0xfdf3f30e, 0xbfd2d26d,
+    0x81cdcd4c, 0x180c0c14, 0x26131335, 0xc3ecec2f, 0xbe5f5fe1, 0x359797a2, 0x884444cc, 0x2e171739,
+    0x93c4c457, 0x55a7a7f2, 0xfc7e7e82, 0x7a3d3d47, 0xc86464ac, 0xba5d5de7, 0x3219192b, 0xe6737395,
+    0xc06060a0, 0x19818198, 0x9e4f4fd1, 0xa3dcdc7f, 0x44222266, 0x542a2a7e, 0x3b9090ab, 0x0b888883,
+    0x8c4646ca, 0xc7eeee29, 0x6bb8b8d3, 0x2814143c, 0xa7dede79, 0xbc5e5ee2, 0x160b0b1d, 0xaddbdb76,
+    0xdbe0e03b, 0x64323256, 0x743a3a4e, 0x140a0a1e, 0x924949db, 0x0c06060a, 0x4824246c, 0xb85c5ce4,
+    0x9fc2c25d, 0xbdd3d36e, 0x43acacef, 0xc46262a6, 0x399191a8, 0x319595a4, 0xd3e4e437, 0xf279798b,
+    0xd5e7e732, 0x8bc8c843, 0x6e373759, 0xda6d6db7, 0x018d8d8c, 0xb1d5d564, 0x9c4e4ed2, 0x49a9a9e0,
+    0xd86c6cb4, 0xac5656fa, 0xf3f4f407, 0xcfeaea25, 0xca6565af, 0xf47a7a8e, 0x47aeaee9, 0x10080818,
+    0x6fbabad5, 0xf0787888, 0x4a25256f, 0x5c2e2e72, 0x381c1c24, 0x57a6a6f1, 0x73b4b4c7, 0x97c6c651,
+    0xcbe8e823, 0xa1dddd7c, 0xe874749c, 0x3e1f1f21, 0x964b4bdd, 0x61bdbddc, 0x0d8b8b86, 0x0f8a8a85,
+    0xe0707090, 0x7c3e3e42, 0x71b5b5c4, 0xcc6666aa, 0x904848d8, 0x06030305, 0xf7f6f601, 0x1c0e0e12,
+    0xc26161a3, 0x6a35355f, 0xae5757f9, 0x69b9b9d0, 0x17868691, 0x99c1c158, 0x3a1d1d27, 0x279e9eb9,
+    0xd9e1e138, 0xebf8f813, 0x2b9898b3, 0x22111133, 0xd26969bb, 0xa9d9d970, 0x078e8e89, 0x339494a7,
+    0x2d9b9bb6, 0x3c1e1e22, 0x15878792, 0xc9e9e920, 0x87cece49, 0xaa5555ff, 0x50282878, 0xa5dfdf7a,
+    0x038c8c8f, 0x59a1a1f8, 0x09898980, 0x1a0d0d17, 0x65bfbfda, 0xd7e6e631, 0x844242c6, 0xd06868b8,
+    0x824141c3, 0x299999b0, 0x5a2d2d77, 0x1e0f0f11, 0x7bb0b0cb, 0xa85454fc, 0x6dbbbbd6, 0x2c16163a };
+#endif
+
 // The round constant word array, Rcon[i], contains the values given by
 // x to th e power (i-1) being powers of x (x is denoted as {02}) in the field GF(2^8)
 // Note that i starts at 1, not 0).
@@ -184,8 +220,10 @@ static uint8_t getSBoxInvert(uint8_t num)
 }
 
 // This function produces Nb(Nr+1) round keys. The round keys are used in each round to decrypt the states.
-static void KeyExpansion(void)
+static void KeyExpansion(aes_ctx_t *ctx)
 {
+    const uint8_t *Key = ctx->key;
+    uint8_t *RoundKey = ctx->round_keys;
     uint32_t i, j, k;
     uint8_t tempa[4]; // Used for the column/row operations
 
@@ -247,11 +285,19 @@ static void KeyExpansion(void)
         RoundKey[i * 4 + 2] = RoundKey[(i - Nk) * 4 + 2] ^ tempa[2];
         RoundKey[i * 4 + 3] = RoundKey[(i - Nk) * 4 + 3] ^ tempa[3];
     }
+
+#ifdef FRAMEWORK_AES_TTABLE
+    for (i = 0; i < Nb * (Nr + 1); ++i)
+    {
+        ctx->round_key_words[i] = ((uint32_t)RoundKey[i * 4] << 24) | ((uint32_t)RoundKey[i * 4 + 1] << 16)
+                           | ((uint32_t)RoundKey[i * 4 + 2] << 8) | RoundKey[i * 4 + 3];
+    }
+#endif
 }
 
 // This function adds the round key to state.
 // The round key is added to the state by an XOR function.
-static void AddRoundKey(uint8_t round)
+static void AddRoundKey(state_t *state, const uint8_t *RoundKey, uint8_t round)
 {
     uint8_t i, j;
 
@@ -264,9 +310,10 @@ static void AddRoundKey(uint8_t round)
     }
 }
 
+#ifndef FRAMEWORK_AES_TTABLE
 // The SubBytes Function Substitutes the values in the
 // state matrix with values in an S-box.
-static void SubBytes(void)
+static void SubBytes(state_t *state)
 {
     uint8_t i, j;
 
@@ -282,7 +329,7 @@ static void SubBytes(void)
 // The ShiftRows() function shifts the rows in the state to the left.
 // Each row is shifted with different offset.
 // Offset = Row number. So the first row is not shifted.
-static void ShiftRows(void)
+static void ShiftRows(state_t *state)
 {
     uint8_t temp;
 
@@ -310,13 +357,16 @@ static void ShiftRows(void)
     (*state)[1][3] = temp;
 }
 
+#endif // FRAMEWORK_AES_TTABLE
+
 static uint8_t xtime(uint8_t x)
 {
     return ((x<<1) ^ (((x>>7) & 1) * 0x1b));
 }
 
+#ifndef FRAMEWORK_AES_TTABLE
 // MixColumns function mixes the columns of the state matrix
-static void MixColumns(void)
+static void MixColumns(state_t *state)
 {
     uint8_t i;
     uint8_t Tmp, Tm, t;
@@ -331,6 +381,7 @@ static void MixColumns(void)
         Tm  = (*state)[i][3] ^ t ;        Tm = xtime(Tm);  (*state)[i][3] ^= Tm ^ Tmp ;
     }
 }
+#endif // FRAMEWORK_AES_TTABLE
 
 // Multiply is used to multiply numbers in the field GF(2^8)
 #if MULTIPLY_AS_A_FUNCTION
@@ -355,7 +406,7 @@ static uint8_t Multiply(uint8_t x, uint8_t y)
 // MixColumns function mixes the columns of the state matrix.
 // The method used to multiply may be difficult to understand for the inexperienced.
 // Please use the references to gain more information.
-static void InvMixColumns(void)
+static void InvMixColumns(state_t *state)
 {
     int i;
     uint8_t a, b, c, d;
@@ -377,7 +428,7 @@ static void InvMixColumns(void)
 
 // The SubBytes Function Substitutes the values in the
 // state matrix with values in an S-box.
-static void InvSubBytes(void)
+static void InvSubBytes(state_t *state)
 {
     uint8_t i, j;
 
@@ -390,7 +441,7 @@ static void InvSubBytes(void)
     }
 }
 
-static void InvShiftRows(void)
+static void InvShiftRows(state_t *state)
 {
     uint8_t temp;
 
@@ -419,55 +470,121 @@ static void InvShiftRows(void)
 }
 
 
+#ifdef FRAMEWORK_AES_TTABLE
+
+static inline uint32_t ror32(uint32_t x, uint8_t n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t load_column(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// a round on whole state columns: the SubBytes, ShiftRows and MixColumns of a column are combined in the lookups of
+// the bytes it takes from the 4 columns, followed by AddRoundKey
+#define TTABLE_COLUMN(a, b, c, d, rk) \
+    (Te0[(a) >> 24] ^ ror32(Te0[((b) >> 16) & 0xFF], 8) ^ ror32(Te0[((c) >> 8) & 0xFF], 16) ^ ror32(Te0[(d) & 0xFF], 24) ^ (rk))
+
+#define LAST_ROUND_COLUMN(a, b, c, d, rk) \
+    ((((uint32_t)sbox[(a) >> 24] << 24) | ((uint32_t)sbox[((b) >> 16) & 0xFF] << 16) \
+      | ((uint32_t)sbox[((c) >> 8) & 0xFF] << 8) | sbox[(d) & 0xFF]) ^ (rk))
+
+// Cipher is the main function that encrypts the PlainText, word oriented variant.
+static void Cipher(state_t *state, const aes_ctx_t *ctx)
+{
+    uint8_t *out = (uint8_t *)state;
+    const uint32_t *rk = ctx->round_key_words;
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    uint8_t round;
+
+    s0 = load_column(out) ^ rk[0];
+    s1 = load_column(out + 4) ^ rk[1];
+    s2 = load_column(out + 8) ^ rk[2];
+    s3 = load_column(out + 12) ^ rk[3];
+
+    for (round = 1; round < Nr; ++round)
+    {
+        rk += Nb;
+        t0 = TTABLE_COLUMN(s0, s1, s2, s3, rk[0]);
+        t1 = TTABLE_COLUMN(s1, s2, s3, s0, rk[1]);
+        t2 = TTABLE_COLUMN(s2, s3, s0, s1, rk[2]);
+        t3 = TTABLE_COLUMN(s3, s0, s1, s2, rk[3]);
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    rk += Nb;
+    t0 = LAST_ROUND_COLUMN(s0, s1, s2, s3, rk[0]);
+    t1 = LAST_ROUND_COLUMN(s1, s2, s3, s0, rk[1]);
+    t2 = LAST_ROUND_COLUMN(s2, s3, s0, s1, rk[2]);
+    t3 = LAST_ROUND_COLUMN(s3, s0, s1, s2, rk[3]);
+
+    const uint32_t columns[4] = { t0, t1, t2, t3 };
+    for (round = 0; round < 4; ++round)
+    {
+        out[round * 4] = columns[round] >> 24;
+        out[round * 4 + 1] = columns[round] >> 16;
+        out[round * 4 + 2] = columns[round] >> 8;
+        out[round * 4 + 3] = columns[round];
+    }
+}
+
+#else
+
 // Cipher is the main function that encrypts the PlainText.
-static void Cipher(void)
+static void Cipher(state_t *state, const aes_ctx_t *ctx)
 {
+    const uint8_t *RoundKey = ctx->round_keys;
     uint8_t round = 0;
 
     // Add the First round key to the state before starting the rounds.
-    AddRoundKey(0);
+    AddRoundKey(state, RoundKey, 0);
 
     // There will be Nr rounds.
     // The first Nr-1 rounds are identical.
     // These Nr-1 rounds are executed in the loop below.
     for (round = 1; round < Nr; ++round)
     {
-      SubBytes();
-      ShiftRows();
-      MixColumns();
-      AddRoundKey(round);
+      SubBytes(state);
+      ShiftRows(state);
+      MixColumns(state);
+      AddRoundKey(state, RoundKey, round);
     }
 
     // The last round is given below.
     // The MixColumns function is not here in the last round.
-    SubBytes();
-    ShiftRows();
-    AddRoundKey(Nr);
+    SubBytes(state);
+    ShiftRows(state);
+    AddRoundKey(state, RoundKey, Nr);
 }
 
-static void InvCipher(void)
+#endif // FRAMEWORK_AES_TTABLE
+
+static void InvCipher(state_t *state, const aes_ctx_t *ctx)
 {
+    const uint8_t *RoundKey = ctx->round_keys;
     uint8_t round = 0;
 
     // Add the First round key to the state before starting the rounds.
-    AddRoundKey(Nr);
+    AddRoundKey(state, RoundKey, Nr);
 
     // There will be Nr rounds.
     // The first Nr-1 rounds are identical.
     // These Nr-1 rounds are executed in the loop below.
     for (round = Nr-1; round > 0; round--)
     {
-      InvShiftRows();
-      InvSubBytes();
-      AddRoundKey(round);
-      InvMixColumns();
+      InvShiftRows(state);
+      InvSubBytes(state);
+      AddRoundKey(state, RoundKey, round);
+      InvMixColumns(state);
     }
 
     // The last round is given below.
     // The MixColumns function is not here in the last round.
-    InvShiftRows();
-    InvSubBytes();
-    AddRoundKey(0);
+    InvShiftRows(state);
+    InvSubBytes(state);
+    AddRoundKey(state, RoundKey, 0);
 }
 
 static void BlockCopy(uint8_t *output, uint8_t *input)
@@ -480,57 +597,84 @@ static void BlockCopy(uint8_t *output, uint8_t *input)
     }
 }
 
+#endif // AES_HARDWARE_SUPPORT
+
 
 
 /*****************************************************************************/
 /* Public functions:                                                         */
 /*****************************************************************************/
 
+void AES128_ctx_init(aes_ctx_t *ctx, const uint8_t *key)
+{
+    memcpy(ctx->key, key, KEYLEN);
+#ifndef AES_HARDWARE_SUPPORT
+    // the accelerator expands the key itself
+    KeyExpansion(ctx);
+#endif
+}
+
 void AES128_init(const uint8_t *key)
 {
-    memcpy(AES128_key, key, KEYLEN);
-    Key = AES128_key;
-    KeyExpansion();
+    // the round keys are kept as long as the key does not change
+    if (default_ctx_initialized && memcmp(default_ctx.key, key, KEYLEN) == 0)
+        return;
+
+    AES128_ctx_init(&default_ctx, key);
+    default_ctx_initialized = true;
+}
+
+const aes_ctx_t *AES128_default_ctx()
+{
+    return &default_ctx;
 }
 
 #if defined(ECB) && ECB
 
 
-void AES128_ECB_encrypt(uint8_t *input, uint8_t *output)
+void AES128_ECB_encrypt_ctx(const aes_ctx_t *ctx, uint8_t *input, uint8_t *output)
 {
 #ifdef AES_HARDWARE_SUPPORT
     /*
      * Hardware AES support for ECB through the low level peripheral library EMLIB
      * The functions AES128_ECB_encrypt() expects inputs of 128 bit length = 16 bytes.
      */
-    hw_aes_ecb128(output, input, 16, Key, true);
+    hw_aes_ecb128(output, input, 16, ctx->key, true);
 #else
     // Copy input to output, and work in-memory on output
     BlockCopy(output, input);
-    state = (state_t *)output;
 
     // The next function call encrypts the PlainText with the Key using AES algorithm.
-    Cipher();
+    Cipher((state_t *)output, ctx);
 #endif // AES_HARDWARE_SUPPORT
 }
 
-void AES128_ECB_decrypt(uint8_t *input, uint8_t *output)
+void AES128_ECB_decrypt_ctx(const aes_ctx_t *ctx, uint8_t *input, uint8_t *output)
 {
 #ifdef AES_HARDWARE_SUPPORT
     /*
      * Hardware AES support for ECB through the low level peripheral library EMLIB
      * The functions AES128_ECB_decrypt() expects inputs of 128 bit length = 16 bytes.
      */
-    hw_aes_ecb128(output, input, 16, Key, false);
+    hw_aes_ecb128(output, input, 16, ctx->key, false);
 #else
     // Copy input to output, and work in-memory on output
     BlockCopy(output, input);
-    state = (state_t *)output;
 
-    InvCipher();
+    InvCipher((state_t *)output, ctx);
 #endif // AES_HARDWARE_SUPPORT
 }
 
+void AES128_ECB_encrypt(uint8_t *input, uint8_t *output)
+{
+    AES128_ECB_encrypt_ctx(&default_ctx, input, output);
+}
+
+void AES128_ECB_decrypt(uint8_t *input, uint8_t *output)
+{
+    AES128_ECB_decrypt_ctx(&default_ctx, input, output);
+}
+
 
 #endif // #if defined(ECB) && ECB
 
@@ -538,7 +682,8 @@ void AES128_ECB_decrypt(uint8_t *input, uint8_t *output)
 #if defined(CBC) && CBC
 
 
-static void XorWithIv(uint8_t *buf)
+#ifndef AES_HARDWARE_SUPPORT
+static void XorWithIv(uint8_t *buf, const uint8_t *Iv)
 {
     uint8_t i;
 
@@ -547,28 +692,40 @@ static void XorWithIv(uint8_t *buf)
         buf[i] ^= Iv[i];
     }
 }
+#endif
 
-void AES128_CBC_encrypt_buffer(uint8_t *output, uint8_t *input, uint32_t length, const uint8_t *iv)
+void AES128_CBC_encrypt_buffer_ctx(aes_ctx_t *ctx, uint8_t *output, uint8_t *input, uint32_t length, const uint8_t *iv)
 {
+    // If iv is passed as 0, we continue to encrypt without re-setting the Iv
+    if (iv != 0)
+        ctx->cbc_iv = iv;
+
 #ifdef AES_HARDWARE_SUPPORT
     // Hardware AES support for CBC through the low level peripheral library EMLIB
-    hw_aes_cbc128(output, input, length, Key, iv, true);
-#else
-    uintptr_t i;
-    uint8_t remainders = length % KEYLEN; /* Remaining bytes in the last non-full block */
+    uint32_t blocks_length = length - (length % KEYLEN);
+    if (blocks_length)
+    {
+        hw_aes_cbc128(output, input, blocks_length, ctx->key, ctx->cbc_iv, true);
+        ctx->cbc_iv = output + blocks_length - KEYLEN;
+    }
 
-    if (iv != 0)
+    if (length % KEYLEN)
     {
-        Iv = (uint8_t *)iv;
+        uint8_t blk[KEYLEN] = { 0 }; /* add 0-padding */
+        memcpy(blk, input + blocks_length, length % KEYLEN);
+        hw_aes_cbc128(output + blocks_length, blk, KEYLEN, ctx->key, ctx->cbc_iv, true);
+        ctx->cbc_iv = output + blocks_length;
     }
+#else
+    uintptr_t i;
+    uint8_t remainders = length % KEYLEN; /* Remaining bytes in the last non-full block */
 
     for(i = KEYLEN; i <= length; i += KEYLEN)
     {
         BlockCopy(output, input);
-        XorWithIv(output);
-        state = (state_t *)output;
-        Cipher();
-        Iv = output;
+        XorWithIv(output, ctx->cbc_iv);
+        Cipher((state_t *)output, ctx);
+        ctx->cbc_iv = output;
         input += KEYLEN;
         output += KEYLEN;
     }
@@ -577,40 +734,48 @@ void AES128_CBC_encrypt_buffer(uint8_t *output, uint8_t *input, uint32_t length,
     {
         BlockCopy(output, input);
         memset(output + remainders, 0, KEYLEN - remainders); /* add 0-padding */
-        XorWithIv(output);
-        state = (state_t *)output;
-        Cipher();
+        XorWithIv(output, ctx->cbc_iv);
+        Cipher((state_t *)output, ctx);
+        ctx->cbc_iv = output;
     }
 #endif // AES_HARDWARE_SUPPORT
 }
 
-void AES128_CBC_decrypt_buffer(uint8_t *output, uint8_t *input, uint32_t length, const uint8_t *iv)
+void AES128_CBC_decrypt_buffer_ctx(aes_ctx_t *ctx, uint8_t *output, uint8_t *input, uint32_t length, const uint8_t *iv)
 {
+    // If iv is passed as 0, we continue to decrypt without re-setting the Iv
+    if (iv != 0)
+        ctx->cbc_iv = iv;
+
 #ifdef AES_HARDWARE_SUPPORT
     // Hardware AES support for CBC through the low level peripheral library EMLIB
-    hw_aes_cbc128(output, input, length, Key, iv, false);
+    hw_aes_cbc128(output, input, length, ctx->key, ctx->cbc_iv, false);
+    ctx->cbc_iv = input + length - KEYLEN;
 #else
     uintptr_t i;
 
-    // If iv is passed as 0, we continue to encrypt without re-setting the Iv
-    if (iv != 0)
-    {
-        Iv = (uint8_t *)iv;
-    }
-
     for(i = KEYLEN; i <= length; i += KEYLEN)
     {
         BlockCopy(output, input);
-        state = (state_t *)output;
-        InvCipher();
-        XorWithIv(output);
-        Iv = input;
+        InvCipher((state_t *)output, ctx);
+        XorWithIv(output, ctx->cbc_iv);
+        ctx->cbc_iv = input;
         input += KEYLEN;
         output += KEYLEN;
     }
 #endif // AES_HARDWARE_SUPPORT
 }
 
+void AES128_CBC_encrypt_buffer(uint8_t *output, uint8_t *input, uint32_t length, const uint8_t *iv)
+{
+    AES128_CBC_encrypt_buffer_ctx(&default_ctx, output, input, length, iv);
+}
+
+void AES128_CBC_decrypt_buffer(uint8_t *output, uint8_t *input, uint32_t length, const uint8_t *iv)
+{
+    AES128_CBC_decrypt_buffer_ctx(&default_ctx, output, input, length, iv);
+}
+
 
 #endif // #if defined(CBC) && CBC
 
@@ -633,22 +798,31 @@ void AES128_CBC_decrypt_buffer(uint8_t *output, uint8_t *input, uint32_t length,
  * the most significant bits.
  */
 
-void AES128_CTR_encrypt(uint8_t *output, uint8_t *input, uint32_t length, uint8_t *ctr_blk)
+void AES128_CTR_encrypt_ctx(const aes_ctx_t *ctx, uint8_t *output, uint8_t *input, uint32_t length, uint8_t *ctr_blk)
 {
 #ifdef AES_HARDWARE_SUPPORT
-    // Hardware AES support for CTR through the low level peripheral library EMLIB
-    hw_aes_ctr128(output, input, length, Key, ctr_blk);
+    // Hardware AES support for CTR through the low level peripheral library EMLIB, which increments ctr_blk
+    uint32_t blocks_length = length - (length % KEYLEN);
+    if (blocks_length)
+        hw_aes_ctr128(output, input, blocks_length, ctx->key, ctr_blk);
+
+    if (length % KEYLEN)
+    {
+        uint8_t ctr[KEYLEN];
+        hw_aes_ecb128(ctr, ctr_blk, KEYLEN, ctx->key, true);
+        for (uint8_t i = 0; i < length % KEYLEN; ++i)
+            output[blocks_length + i] = input[blocks_length + i] ^ ctr[i];
+    }
 #else
     uintptr_t i, j;
     uint8_t remainders = length % KEYLEN; /* Remaining bytes in the last non-full block */
     uint8_t ctr[KEYLEN];
 
     BlockCopy(ctr, ctr_blk);
-    state = (state_t *)ctr;
 
     for(i = KEYLEN; i <= length; i += KEYLEN)
     {
-        Cipher();
+        Cipher((state_t *)ctr, ctx);
         BlockCopy(output, input);
         for (j = 0; j < KEYLEN; j++)
             output[j] ^= ctr[j];
@@ -668,11 +842,16 @@ void AES128_CTR_encrypt(uint8_t *output, uint8_t *input, uint32_t length, uint8_
 
     if(remainders)
     {
-        Cipher();
+        Cipher((state_t *)ctr, ctx);
         for (i=0; i < remainders; ++i)
             output[i] = input[i] ^ ctr[i];
     }
 #endif
 }
 
+void AES128_CTR_encrypt(uint8_t *output, uint8_t *input, uint32_t length, uint8_t *ctr_blk)
+{
+    AES128_CTR_encrypt_ctx(&default_ctx, output, input, length, ctr_blk);
+}
+
 #endif // #if defined(CTR) && CTR
@@ -31,6 +31,7 @@
 #include "types.h"
 #include "errors.h"
 #include "log.h"
+#include "hwdebug.h"
 #include "framework_defs.h"
 
 
@@ -47,16 +48,6 @@
  * block cipher mode
  */
 
-static void xor_aes_block(uint8_t *dst, const uint8_t *src)
-{
-    uint8_t i;
-
-    for (i = 0; i < AES_BLOCK_SIZE; ++i)
-    {
-        dst[i] ^= src[i];
-    }
-}
-
 /*
  * Authentication
  *
@@ -65,36 +56,38 @@ static void xor_aes_block(uint8_t *dst, const uint8_t *src)
  * 
  */
 
-error_t AES128_CBC_MAC( uint8_t *auth, uint8_t *payload, uint8_t length, const uint8_t *iv,
-                        const uint8_t *add, uint8_t add_len, uint8_t auth_len )
+/* The CBC-MAC is computed by:
+ *
+ * X_1 := E( K, B_0 )
+ * X_i+1 := E( K, X_i XOR B_i )  for i=1, ..., n
+ * T := first-M-bytes( X_n+1 )
+ */
+
+/* X_i+1 = E(K, X_i XOR B_i), where B_i is zero-padded when shorter than a block */
+static void cbc_mac_update(const aes_ctx_t *ctx, uint8_t *tag, const uint8_t *blk, uint8_t len)
 {
-    uint8_t blk[AES_BLOCK_SIZE];
     uint8_t i;
-    uint8_t remainders;
-    uint8_t tag[AES_BLOCK_SIZE];
 
-    /* sanity checks */
-    if (auth_len != 4 && auth_len != 8 && auth_len != 16)
-        return EINVAL;
+    DPRINT("B_i");
+    DPRINT_DATA((uint8_t *)blk, len);
 
-    if (add_len > (2 * AES_BLOCK_SIZE - 1))
-        return EINVAL;
+    for (i = 0; i < len; i++)
+        tag[i] ^= blk[i];
 
-    /* For DASH7, the payload length shall be less than 250 - authentication tag len */
-    if (length > (250 - auth_len))
-        return EINVAL;
+    AES128_ECB_encrypt_ctx(ctx, tag, tag);
+    DPRINT("X_i+1 = E(K, X_i XOR B_i)");
+    DPRINT_DATA(tag, AES_BLOCK_SIZE);
+}
 
-    /* The CBC-MAC is computed by:
-     *
-     * X_1 := E( K, B_0 )
-     * X_i+1 := E( K, X_i XOR B_i )  for i=1, ..., n
-     * T := first-M-bytes( X_n+1 )
-     */
+/* Authenticates B_0 and the additional authentication data blocks */
+static void cbc_mac_start(const aes_ctx_t *ctx, uint8_t *tag, const uint8_t *iv, const uint8_t *add, uint8_t add_len)
+{
+    uint8_t blk[AES_BLOCK_SIZE];
 
     /* X_1 = E(K, B_0) */
     DPRINT("Blk0");
     DPRINT_DATA((uint8_t *)iv, AES_BLOCK_SIZE);
-    AES128_ECB_encrypt((uint8_t *)iv, tag);
+    AES128_ECB_encrypt_ctx(ctx, (uint8_t *)iv, tag);
     DPRINT("X_1 = AES(B_0)");
     DPRINT_DATA(tag, AES_BLOCK_SIZE);
 
@@ -107,77 +100,41 @@ error_t AES128_CBC_MAC( uint8_t *auth, uint8_t *payload, uint8_t length, const u
         memset(blk, 0, AES_BLOCK_SIZE);
         // For DASH7, the additional data length shall be encoded in a field of 1 octet.
         blk[0] = add_len;
+        memcpy(blk + 1, add, use_len);
 
-        memcpy( blk + 1, add, use_len );
-
-        DPRINT("Blk1");
-        DPRINT_DATA(blk, AES_BLOCK_SIZE);
-
-        xor_aes_block(blk, tag);
-        DPRINT("X_1 XOR B_1");
-        DPRINT_DATA(blk, AES_BLOCK_SIZE);
         /* X_2 = E(K, X_1 XOR B_1) */
-        AES128_ECB_encrypt(blk, tag);
-        DPRINT("X_2 = AES(X_1 XOR B_1)");
-        DPRINT_DATA(tag, AES_BLOCK_SIZE);
+        cbc_mac_update(ctx, tag, blk, AES_BLOCK_SIZE);
 
+        /* X_3 = E(K, X_2 XOR B_2) */
         if (remainders)
-        {
-            memset(blk, 0, AES_BLOCK_SIZE);
-            memcpy(blk, add + use_len, remainders);
-
-            DPRINT("blk2");
-            DPRINT_DATA(blk, AES_BLOCK_SIZE);
-
-            DPRINT("X_2 XOR B_2");
-            xor_aes_block(blk, tag);
-             /* X_3 = E(K, X_2 XOR B_2) */
-            AES128_ECB_encrypt(blk, tag);
-            DPRINT("X_3 = AES(X_1 XOR B_1)");
-            DPRINT_DATA(tag, AES_BLOCK_SIZE);
-        }
+            cbc_mac_update(ctx, tag, add + use_len, remainders);
     }
+}
 
-    remainders = length % AES_BLOCK_SIZE; /* Remaining bytes in the last non-full block */
-    DPRINT("Remainders %d length %d", remainders, length);
-
-    for (i = 0; i < length / AES_BLOCK_SIZE; i++)
-    {
-        DPRINT("Xi");
-        DPRINT_DATA(tag, AES_BLOCK_SIZE);
+error_t AES128_CBC_MAC_ctx( const aes_ctx_t *ctx, uint8_t *auth, uint8_t *payload, uint8_t length, const uint8_t *iv,
+                            const uint8_t *add, uint8_t add_len, uint8_t auth_len )
+{
+    uint8_t tag[AES_BLOCK_SIZE];
+    uint8_t len;
 
-        DPRINT("B_i");
-        DPRINT_DATA(payload, AES_BLOCK_SIZE);
+    /* sanity checks */
+    if (auth_len != 4 && auth_len != 8 && auth_len != 16)
+        return EINVAL;
 
-        /* X_i+1 = E(K, X_i XOR B_i) */
-        xor_aes_block(tag, payload);
-        DPRINT("X_i XOR B_i");
-        DPRINT_DATA(tag, AES_BLOCK_SIZE);
+    if (add_len > (2 * AES_BLOCK_SIZE - 1))
+        return EINVAL;
 
-        payload += AES_BLOCK_SIZE;
+    /* For DASH7, the payload length shall be less than 250 - authentication tag len */
+    if (length > (250 - auth_len))
+        return EINVAL;
 
-        AES128_ECB_encrypt(tag, tag);
-        DPRINT("X_i+1 = E(K, X_i XOR B_i)");
-        DPRINT_DATA(tag, AES_BLOCK_SIZE);
-    }
+    cbc_mac_start(ctx, tag, iv, add, add_len);
 
-    if (remainders)
+    DPRINT("length %d", length);
+    for (; length > 0; length -= len, payload += len)
     {
-        /* XOR zero-padded last block */
-        DPRINT("Xi");
-        DPRINT_DATA(tag, AES_BLOCK_SIZE);
-
-        DPRINT("B_i");
-        DPRINT_DATA(payload, AES_BLOCK_SIZE);
-
-        for (i = 0; i < remainders; i++)
-            tag[i] ^= *payload++;
-        DPRINT("X_i XOR B_i");
-        DPRINT_DATA(tag, AES_BLOCK_SIZE);
-
-        AES128_ECB_encrypt(tag, tag);
-        DPRINT("X_i+1 = E(K, X_i XOR B_i)");
-        DPRINT_DATA(tag, AES_BLOCK_SIZE);
+        len = length < AES_BLOCK_SIZE ? length : AES_BLOCK_SIZE;
+        cbc_mac_update(ctx, tag, payload, len);
     }
 
     memcpy(auth, tag, auth_len);
@@ -186,101 +143,153 @@ error_t AES128_CBC_MAC( uint8_t *auth, uint8_t *payload, uint8_t length, const u
 }
 
 /*
- * Authenticated encryption
+ * Authenticated encryption and decryption
  *
- * Ensure that the output is sized to contain the encrypted message payload
+ * Ensure that the output of an encryption is sized to contain the encrypted message payload
  * + the encrypted authentication Tag.
+ *
+ * CCM is done in a single pass over the payload: each block is authenticated and encrypted in place
+ * (or decrypted and then authenticated), while it is still in cache.
  */
-error_t AES128_CCM_encrypt( uint8_t *payload, uint8_t length, const uint8_t *iv,
-                            const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
-                            uint8_t auth_len )
+error_t AES128_CCM_start_ctx( aes_ccm_t *ccm, const aes_ctx_t *ctx, bool decrypt, uint8_t *payload, uint8_t length,
+                              const uint8_t *iv, const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
+                              const uint8_t *auth, uint8_t auth_len )
 {
-    uint8_t auth[AES_BLOCK_SIZE];
-    uint8_t auth_crypted[AES_BLOCK_SIZE];
-    error_t ret;
-
     /* sanity checks */
     if (auth_len != 4 && auth_len != 8 && auth_len != 16)
         return EINVAL;
 
-     /* For DASH7, the payload length shall be less than 250 - Security header len - authentication tag len */
+    /* For DASH7, the payload length shall be less than 250 - Security header len - authentication tag len */
     if (length > (250 - 5 - auth_len))
         return EINVAL;
 
     if (add_len > (2 * AES_BLOCK_SIZE - 1))
         return EINVAL;
 
-    /* Authentication */
-    ret = AES128_CBC_MAC(auth, payload, length, iv, add, add_len, auth_len);
-    if (ret != SUCCESS)
-        return ret;
+    ccm->ctx = ctx;
+    ccm->payload = payload;
+    ccm->length = length;
+    ccm->ctr_blk = ctr_blk;
+    ccm->auth_len = auth_len;
+    ccm->decrypt = decrypt;
 
-    DPRINT("Authentication tag:");
-    DPRINT_DATA(auth, auth_len);
+    DEBUG_PROBE_SET(CCM);
+    if (decrypt)
+    {
+        /* Decryption of the encrypted authentication Tag */
+        ctr_blk[0] = (ctr_blk[0] & 0xF0);
+        AES128_CTR_encrypt_ctx(ctx, ccm->auth, (uint8_t *)auth, auth_len, ctr_blk);
+        DPRINT("Decrypted authentication tag:");
+        DPRINT_DATA(ccm->auth, auth_len);
+    }
 
-    /* Encryption with Counter (CTR) mode*/
+    cbc_mac_start(ctx, ccm->tag, iv, add, add_len);
 
-    /* Encryption of the message payload, counter set to 1 */
+    /* Encryption of the message payload with Counter (CTR) mode, counter set to 1 */
     ctr_blk[0] = (ctr_blk[0] & 0xF0) + 1;
     DPRINT("ctr0");
     DPRINT_DATA(ctr_blk, AES_BLOCK_SIZE);
+    DEBUG_PROBE_CLR(CCM);
+
+    return SUCCESS;
+}
 
-    AES128_CTR_encrypt(payload, payload, length, ctr_blk);
-    DPRINT("CTR output:");
-    DPRINT_DATA(payload, length);
+bool AES128_CCM_step( aes_ccm_t *ccm, uint8_t blocks )
+{
+    uint8_t len;
+
+    DEBUG_PROBE_SET(CCM);
+    for (; ccm->length > 0 && blocks > 0; ccm->length -= len, ccm->payload += len, blocks--)
+    {
+        len = ccm->length < AES_BLOCK_SIZE ? ccm->length : AES_BLOCK_SIZE;
+        if (ccm->decrypt)
+        {
+            AES128_CTR_encrypt_ctx(ccm->ctx, ccm->payload, ccm->payload, len, ccm->ctr_blk);
+            cbc_mac_update(ccm->ctx, ccm->tag, ccm->payload, len);
+        }
+        else
+        {
+            cbc_mac_update(ccm->ctx, ccm->tag, ccm->payload, len);
+            AES128_CTR_encrypt_ctx(ccm->ctx, ccm->payload, ccm->payload, len, ccm->ctr_blk);
+        }
+    }
+    DEBUG_PROBE_CLR(CCM);
+
+    return ccm->length > 0;
+}
+
+error_t AES128_CCM_finish( aes_ccm_t *ccm )
+{
+    if (ccm->decrypt)
+    {
+        DPRINT("Computed authentication tag:");
+        DPRINT_DATA(ccm->tag, ccm->auth_len);
+
+        /* check the authentication Tag */
+        if (memcmp(ccm->tag, ccm->auth, ccm->auth_len) != 0)
+        {
+            DPRINT("CCM: Auth mismatch");
+            return FAIL;
+        }
+
+        return SUCCESS;
+    }
+
+    DPRINT("Authentication tag:");
+    DPRINT_DATA(ccm->tag, ccm->auth_len);
 
     /* Encryption of the authentication tag , reset counter to 0*/
-    ctr_blk[0] = (ctr_blk[0] & 0xF0);
-    AES128_CTR_encrypt(auth_crypted, auth, auth_len, ctr_blk);
-    DPRINT("Encrypted authentication tag:");
-    DPRINT_DATA(auth_crypted, auth_len);
     // the 4, 8 or 16 MSB of the MAC are then appended to the payload
-    memcpy(payload + length, auth_crypted, auth_len);
+    ccm->ctr_blk[0] = (ccm->ctr_blk[0] & 0xF0);
+    AES128_CTR_encrypt_ctx(ccm->ctx, ccm->payload, ccm->tag, ccm->auth_len, ccm->ctr_blk);
+    DPRINT("Encrypted authentication tag:");
+    DPRINT_DATA(ccm->payload, ccm->auth_len);
 
     return SUCCESS;
 }
 
-/*
- * Authenticated decryption
- */
-error_t AES128_CCM_decrypt( uint8_t *payload, uint8_t length, const uint8_t *iv,
-                            const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
-                            const uint8_t *auth, uint8_t auth_len )
+error_t AES128_CCM_encrypt_ctx( const aes_ctx_t *ctx, uint8_t *payload, uint8_t length, const uint8_t *iv,
+                                const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
+                                uint8_t auth_len )
 {
-    uint8_t T[AES_BLOCK_SIZE];
-    uint8_t auth_decrypted[AES_BLOCK_SIZE];
-
-    /* sanity checks */
-    if (auth_len != 4 && auth_len != 8 && auth_len != 16)
-        return EINVAL;
-
-    /* For DASH7, the payload length shall be less than 250 - Security header len - authentication tag len */
-    if (length > (250 - 5 - auth_len))
-        return EINVAL;
+    aes_ccm_t ccm;
+    error_t err = AES128_CCM_start_ctx(&ccm, ctx, false, payload, length, iv, add, add_len, ctr_blk, NULL, auth_len);
+    if (err != SUCCESS)
+        return err;
 
-    if (add_len > (2 * AES_BLOCK_SIZE - 1))
-        return EINVAL;
+    AES128_CCM_step(&ccm, UINT8_MAX);
+    return AES128_CCM_finish(&ccm);
+}
 
-    /* Decryption of the encrypted authentication Tag */
-    ctr_blk[0] = (ctr_blk[0] & 0xF0);
-    AES128_CTR_encrypt(auth_decrypted, (uint8_t *)auth, auth_len, ctr_blk);
-    DPRINT("Decrypted authentication tag:");
-    DPRINT_DATA(auth_decrypted, auth_len);
+error_t AES128_CCM_decrypt_ctx( const aes_ctx_t *ctx, uint8_t *payload, uint8_t length, const uint8_t *iv,
+                                const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
+                                const uint8_t *auth, uint8_t auth_len )
+{
+    aes_ccm_t ccm;
+    error_t err = AES128_CCM_start_ctx(&ccm, ctx, true, payload, length, iv, add, add_len, ctr_blk, auth, auth_len);
+    if (err != SUCCESS)
+        return err;
 
-    /* Decryption of the message payload, counter set to 1 */
-    ctr_blk[0] = (ctr_blk[0] & 0xF0) + 1;
-    AES128_CTR_encrypt(payload, payload, length, ctr_blk);
+    AES128_CCM_step(&ccm, UINT8_MAX);
+    return AES128_CCM_finish(&ccm);
+}
 
-    /* Recompute the CBC-MAC and check the authentication Tag */
-    AES128_CBC_MAC(T, payload, length, iv, add, add_len, auth_len);
-    DPRINT("Computed authentication tag:");
-    DPRINT_DATA(T, auth_len);
+error_t AES128_CBC_MAC( uint8_t *auth, uint8_t *payload, uint8_t length, const uint8_t *iv,
+                        const uint8_t *add, uint8_t add_len, uint8_t auth_len )
+{
+    return AES128_CBC_MAC_ctx(AES128_default_ctx(), auth, payload, length, iv, add, add_len, auth_len);
+}
 
-    if (memcmp(T, auth_decrypted, auth_len) != 0)
-    {
-        DPRINT("CCM: Auth mismatch");
-        return -1;
-    }
+error_t AES128_CCM_encrypt( uint8_t *payload, uint8_t length, const uint8_t *iv,
+                            const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
+                            uint8_t auth_len )
+{
+    return AES128_CCM_encrypt_ctx(AES128_default_ctx(), payload, length, iv, add, add_len, ctr_blk, auth_len);
+}
 
-    return SUCCESS;
+error_t AES128_CCM_decrypt( uint8_t *payload, uint8_t length, const uint8_t *iv,
+                            const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
+                            const uint8_t *auth, uint8_t auth_len )
+{
+    return AES128_CCM_decrypt_ctx(AES128_default_ctx(), payload, length, iv, add, add_len, ctr_blk, auth, auth_len);
 }
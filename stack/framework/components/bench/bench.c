@@ -0,0 +1,133 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file bench.c
+ *
+ */
+
+#include "bench.h"
+#include "ng.h"
+#include "hwatomic.h"
+
+#include <stdio.h>
+
+#ifdef FRAMEWORK_BENCH_ENABLED
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+    #define DEMCR (*(volatile uint32_t*) 0xE000EDFC)
+    #define DEMCR_TRCENA (1UL << 24)
+    #define DWT_CTRL (*(volatile uint32_t*) 0xE0001000)
+    #define DWT_CTRL_CYCCNTENA 1UL
+
+    static void enable_timestamps()
+    {
+        DEMCR |= DEMCR_TRCENA;
+        DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    }
+#else
+    static void enable_timestamps() {}
+#endif
+
+static bench_probe_t NGDEF(_probes)[FRAMEWORK_BENCH_PROBE_COUNT];
+#define probes NG(_probes)
+
+static uint8_t NGDEF(_probe_count);
+#define probe_count NG(_probe_count)
+
+static void reset_probe(bench_probe_t* probe)
+{
+    probe->count = 0;
+    probe->min = UINT32_MAX;
+    probe->max = 0;
+    probe->total = 0;
+}
+
+__LINK_C bench_probe_id_t bench_register(const char* name)
+{
+    enable_timestamps();
+    start_atomic();
+    if(probe_count == FRAMEWORK_BENCH_PROBE_COUNT)
+    {
+        end_atomic();
+        return BENCH_NO_PROBE;
+    }
+
+    bench_probe_id_t id = probe_count;
+    probes[id].name = name;
+    reset_probe(&probes[id]);
+    probe_count++;
+    end_atomic();
+    return id;
+}
+
+__LINK_C void bench_add_run(bench_probe_id_t probe, uint32_t duration)
+{
+    if(probe >= probe_count)
+        return;
+
+    start_atomic();
+    bench_probe_t* p = &probes[probe];
+    p->count++;
+    p->total += duration;
+    if(duration < p->min)
+        p->min = duration;
+
+    if(duration > p->max)
+        p->max = duration;
+
+    end_atomic();
+}
+
+__LINK_C error_t bench_get_probe(bench_probe_id_t probe, bench_probe_t* result)
+{
+    if(probe >= probe_count)
+        return EINVAL;
+
+    start_atomic();
+    *result = probes[probe];
+    end_atomic();
+    return SUCCESS;
+}
+
+__LINK_C void bench_report()
+{
+    bench_probe_t probe;
+    printf("\n\rprobe\tcount\tmin\tavg\tmax (" BENCH_UNIT ")");
+    for(bench_probe_id_t id = 0; bench_get_probe(id, &probe) == SUCCESS; id++)
+    {
+        if(probe.count == 0)
+            printf("\n\r%s\t0\t-\t-\t-", probe.name);
+        else
+            printf("\n\r%s\t%lu\t%lu\t%lu\t%lu", probe.name, (unsigned long) probe.count, (unsigned long) probe.min,
+                   (unsigned long) (probe.total / probe.count), (unsigned long) probe.max);
+    }
+
+    printf("\n\r");
+    fflush(stdout);
+}
+
+__LINK_C void bench_reset()
+{
+    start_atomic();
+    for(bench_probe_id_t id = 0; id < probe_count; id++)
+        reset_probe(&probes[id]);
+
+    end_atomic();
+}
+
+#endif //FRAMEWORK_BENCH_ENABLED
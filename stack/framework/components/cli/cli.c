@@ -32,7 +32,7 @@
 #include "cli.h"
 
 // TODO configure this elsewhere, in another way
-#define CLI_CMDS 10
+#define CLI_CMDS 13 // including the built-in statistics commands
 
 struct cli_command {
   char          component;
@@ -47,51 +47,36 @@ static uint8_t       last_command = 0;
 static char* cli_name;
 static char  cli_id;
 
-static uint8_t consume(fifo_t* cmd) {
-  uint8_t buffer;
-  fifo_pop(cmd, &buffer, 1);
-  return buffer;
-}
-
-static uint8_t peek(fifo_t* input, uint8_t pos) {
-  uint8_t buffer;
-  fifo_peek(input, &buffer, pos, 1);
-  return buffer;
-}
-
-static void drop(fifo_t* input) {
-  while(consume(input) != '\r');
-}
-
-static void drop_invalid(fifo_t* input) {
-  console_print("ERROR: invalid command\r\n");
-  drop(input);
+// a command is complete when it ends with \r
+static int16_t cli_get_command_length(const uint8_t* cmd, uint16_t available) {
+  for(uint16_t i=SHELL_CMD_HEADER_SIZE; i<available; i++) {
+    if(cmd[i] == '\r') { return i + 1; }
+  }
+  return 0;
 }
 
-static void cli_handle_command(fifo_t* input) {
-  if(fifo_get_size(input) < 7) { return; } // not enough AT$...\r
-
-  // wait for a complete command, ending with \r
-  bool complete = false;
-  for(uint8_t i=3; ! complete && i<fifo_get_size(input); i++) {
-    complete = peek(input, i) == '\r';
+static bool cli_handle_command(uint8_t* cmd, uint16_t length) {
+  if(length < 7) { // not enough AT$...\r
+    console_print("ERROR: invalid command\r\n");
+    return true;
   }
-  if( ! complete ) { return; }
 
-  // consume AT$.
-  consume(input); consume(input); consume(input); consume(input);
+  // AT$.
+  char component = (char)cmd[4];
+  char command   = (char)cmd[5];
+
+  // the arguments up to and including the \r, the shell removes the complete command afterwards
+  fifo_t input;
+  fifo_init_filled(&input, cmd + 6, length - 6, length - 6);
 
-  char component = (char)consume(input);
-  char command   = (char)consume(input);
-  
   for(uint8_t c=0; c<last_command; c++) {
     if(commands[c].component == component && commands[c].command == command) {
-      commands[c].handler(input);
+      commands[c].handler(&input);
       break;
     }
   }
-  
-  drop(input);
+
+  return true;
 }
 
 static void cli_info() {  
@@ -104,6 +89,21 @@ static void cli_info() {
   console_print("with x being a component and y being a command for that components.\r\n");
 }
 
+// the built-in statistics commands (component s), of the pools and counters registered with the shell
+
+static void cli_print_stats(fifo_t* input) {
+  shell_print_counters(false);
+}
+
+static void cli_print_compact_stats(fifo_t* input) {
+  shell_print_counters(true);
+}
+
+static void cli_reset_stats(fifo_t* input) {
+  shell_reset_counters();
+  console_print("statistics reset\r\n");
+}
+
 // public API
 
 void cli_init(char* name, char id) {
@@ -113,9 +113,14 @@ void cli_init(char* name, char id) {
   shell_echo_enable();
   shell_register_handler((cmd_handler_registration_t) {
     .id                   = id,
+    .get_cmd_length       = &cli_get_command_length,
     .cmd_handler_callback = &cli_handle_command
   });
   
+  cli_register_command('s', 'p', "print the statistics", &cli_print_stats);
+  cli_register_command('s', 'c', "print the statistics, one line per group", &cli_print_compact_stats);
+  cli_register_command('s', 'r', "reset the statistics", &cli_reset_stats);
+
   cli_info();
 }
 
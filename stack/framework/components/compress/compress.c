@@ -22,22 +22,116 @@
 #include "assert.h"
 #include "compress.h"
 
-uint8_t compress_data(uint16_t value, bool ceil)
+uint8_t compress_data_rounded(uint32_t value, compress_rounding_t rounding)
 {
-    uint8_t mantissa;
-    uint16_t remainder;
+    if (value > CT_VALUE_MAX)
+        return 0xFF;
 
-    for ( int i = 0; i < 8; i++)
+    // the smallest exponent for which value <= 31 * 4^exponent follows from the number of significant bits
+    uint8_t exponent = 0;
+    if (value > CT_MANTISSA_MAX)
     {
-        if (value <= (pow(4, i) * 31))
-        {
-            mantissa = value / pow(4, i);
-            remainder = value % (uint16_t)(pow(4, i));
+        exponent = (32 - __builtin_clz(value) - 4) / 2;
+        if (value > ((uint32_t)CT_MANTISSA_MAX << (2 * exponent)))
+            exponent++;
+    }
+
+    uint8_t shift = 2 * exponent;
+    uint32_t mantissa;
+    switch (rounding)
+    {
+        case COMPRESS_ROUND_UP:
+            mantissa = (value + (1UL << shift) - 1) >> shift;
+            break;
+        case COMPRESS_ROUND_NEAREST:
+            mantissa = (value + ((1UL << shift) >> 1)) >> shift;
+            break;
+        default:
+            mantissa = value >> shift;
+            break;
+    }
+
+    // value <= 31 << shift, so no rounding mode gives a mantissa above 31
+    assert(mantissa <= CT_MANTISSA_MAX);
+    return (uint8_t)(exponent << 5 | mantissa);
+}
+
+uint8_t compress_data(uint32_t value, bool ceil)
+{
+    return compress_data_rounded(value, ceil ? COMPRESS_ROUND_UP : COMPRESS_ROUND_DOWN);
+}
+
+static uint8_t get_varint_size(uint32_t value)
+{
+    uint8_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+static uint32_t zigzag_encode(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
 
-            if (ceil && remainder)
-                mantissa++;
+static int32_t zigzag_decode(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+uint8_t compress_delta_encode(int32_t* previous, const int32_t* values, uint8_t count, uint8_t* ptr, uint8_t size)
+{
+    uint16_t length = 0;
+    for (uint8_t i = 0; i < count; i++)
+        length += get_varint_size(zigzag_encode((int32_t)((uint32_t)values[i] - (uint32_t)previous[i])));
+
+    if (length > size)
+        return 0;
 
-            return (uint8_t)( i<<5 | mantissa);
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint32_t delta = zigzag_encode((int32_t)((uint32_t)values[i] - (uint32_t)previous[i]));
+        while (delta >= 0x80)
+        {
+            *ptr++ = (uint8_t)delta | 0x80;
+            delta >>= 7;
         }
+
+        *ptr++ = (uint8_t)delta;
+        previous[i] = values[i];
     }
+
+    return (uint8_t)length;
+}
+
+uint8_t compress_delta_decode(int32_t* previous, const uint8_t* ptr, uint8_t length, int32_t* values, uint8_t count)
+{
+    uint8_t index = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint32_t delta = 0;
+        uint8_t shift = 0;
+        uint8_t byte;
+        do
+        {
+            if (index == length || shift > 28)
+                return 0;
+
+            byte = ptr[index++];
+            delta |= (uint32_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        values[i] = (int32_t)((uint32_t)previous[i] + (uint32_t)zigzag_decode(delta));
+    }
+
+    // previous is only updated once the whole record is decoded
+    for (uint8_t i = 0; i < count; i++)
+        previous[i] = values[i];
+
+    return index;
 }
@@ -9,45 +9,183 @@
 #include "scheduler.h"
 #include "console.h"
 #include "hal_defs.h"
+#include "debug.h"
 
 #ifdef FRAMEWORK_CONSOLE_ENABLED
 
-#define TX_FIFO_FLUSH_CHUNK_SIZE 10 // at a baudrate of 115200 this ensures completion within 1 ms
-                                    // TODO baudrate dependent
+#ifdef FRAMEWORK_CONSOLE_ON_RTT
+#include "SEGGER_RTT.h"
+#include "timer.h"
+#endif
+
+static bool tx_blocking = false;
+static uint32_t tx_dropped_count = 0; // the bytes dropped when the fifo was full, saturates at UINT32_MAX
+
+static void count_dropped(uint16_t length) {
+  tx_dropped_count = (UINT32_MAX - tx_dropped_count < length) ? UINT32_MAX : tx_dropped_count + length;
+}
+
+#ifdef FRAMEWORK_CONSOLE_ON_RTT
+// the console uses the terminal channel 0 of RTT in both directions, the J-Link software makes it available to the host
+// (on the telnet port 19021 for example). The up buffer of the RTT control block replaces the console fifo, the J-Link
+// reads it from the RAM, there is nothing to transmit
+#define RTT_CHANNEL 0
+
+static uart_rx_inthandler_t rx_cb = NULL;
+
+// RTT does not interrupt the target when the host writes, the down buffer is polled while the reception is enabled
+static void poll_rx() {
+  uint8_t data[16];
+  unsigned len = SEGGER_RTT_Read(RTT_CHANNEL, data, sizeof(data));
+  for(unsigned i = 0; i < len; i++)
+    rx_cb(data[i]);
+
+  if(len == sizeof(data))
+    sched_post_task_prio(&poll_rx, MIN_PRIORITY); // there could be more, read it without waiting
+  else
+    timer_post_task_prio_delay(&poll_rx, FRAMEWORK_CONSOLE_RTT_POLL_PERIOD, MIN_PRIORITY);
+}
+
+static void set_rtt_mode() {
+  // skipping drops the output of a print completely, as with the UART
+  SEGGER_RTT_SetFlagsUpBuffer(RTT_CHANNEL, tx_blocking ? SEGGER_RTT_MODE_BLOCK_IF_FIFO_FULL : SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+}
+
+SCHED_REGISTER_TASK(poll_rx);
+
+void console_init(void) {
+  SEGGER_RTT_Init();
+  set_rtt_mode();
+}
+
+void console_enable(void) {
+}
+
+void console_disable(void) {
+}
+
+void console_set_tx_blocking(bool blocking) {
+  tx_blocking = blocking;
+  set_rtt_mode();
+}
+
+void console_print_bytes(uint8_t* bytes, uint16_t length) {
+  if(SEGGER_RTT_Write(RTT_CHANNEL, bytes, length) < length)
+    count_dropped(length);
+}
+
+uint8_t* console_tx_reserve(uint16_t length) {
+  return NULL; // the RTT up buffer cannot be written in place
+}
+
+void console_tx_commit(uint16_t length) {
+}
+
+inline void console_set_rx_interrupt_callback(uart_rx_inthandler_t uart_rx_cb) {
+  rx_cb = uart_rx_cb;
+}
+
+inline void console_rx_interrupt_enable() {
+  sched_post_task_prio(&poll_rx, MIN_PRIORITY);
+}
+
+#else
+
+// without DMA the bytes sent per flush, about 1 ms at the baudrate, so the transmission does not interfere with the
+// stack timings. The flush is reposted with the lowest priority while data is left in the fifo
+#define TX_FLUSH_CHUNK_SIZE ((CONSOLE_BAUDRATE / 10 / 1000) + 1)
 
 static uart_handle_t* uart;
 
-#define CONSOLE_TX_FIFO_SIZE 255
-static uint8_t console_tx_buffer[CONSOLE_TX_FIFO_SIZE];
+static uint8_t console_tx_buffer[FRAMEWORK_CONSOLE_TX_BUFFER_SIZE];
 static fifo_t console_tx_fifo;
+// an empty fifo restarts at the start of the buffer, so the complete buffer is contiguous for the next output
+static void rewind_when_empty() {
+  if(fifo_get_size(&console_tx_fifo) == 0)
+    fifo_clear(&console_tx_fifo);
+}
+
+#ifdef HAL_UART_USE_DMA_TX
+// the number of bytes at the head of the fifo being transmitted by DMA, they are only removed when the transfer completed
+static uint16_t tx_length;
+static volatile bool tx_done;
+
+static void flush_console_tx_fifo();
+
+static void complete_tx() {
+  if(tx_length == 0 || !tx_done)
+    return;
+
+  fifo_skip(&console_tx_fifo, tx_length);
+  tx_length = 0;
+  tx_done = false;
+  rewind_when_empty();
+}
+
+static void console_tx_completed() {
+  complete_tx();
+  flush_console_tx_fifo();
+}
+
+SCHED_REGISTER_TASK(console_tx_completed);
+
+static void console_tx_done(uart_handle_t* uart_handle) {
+  // interrupt context, the fifo is only updated by the task or by a blocking print
+  tx_done = true;
+  sched_post_handle_from_isr(SCHED_TASK_HANDLE(console_tx_completed), MIN_PRIORITY);
+}
+#endif
 
 static void flush_console_tx_fifo() {
-  uint8_t len = fifo_get_size(&console_tx_fifo);
+  uint8_t* data;
 #ifdef HAL_UART_USE_DMA_TX
-  // when using DMA we transmit the whole FIFO at once
-  uint8_t buffer[CONSOLE_TX_FIFO_SIZE];
-  fifo_pop(&console_tx_fifo, buffer, len);
-  uart_send_bytes(uart, buffer, len);
+  // DMA transmits the fifo without blocking the task, new output is appended to the fifo meanwhile
+  if(tx_length > 0)
+    return; // flushed again when the ongoing transfer completes
+
+  tx_length = fifo_get_contiguous_readable(&console_tx_fifo, &data);
+  if(tx_length == 0)
+    return;
+
+  error_t err = uart_send_bytes_async(uart, data, tx_length, &console_tx_done); assert(err == SUCCESS);
 #else
-  // only send small chunks over uart each invocation, to make sure
-  // we don't interfer with critical stack timings.
-  // When there is still data left in the fifo this will be rescheduled
-  // with lowest prio
-  uint8_t chunk[TX_FIFO_FLUSH_CHUNK_SIZE];
-  if(len < 10) {
-    fifo_pop(&console_tx_fifo, chunk, len);
-    uart_send_bytes(uart, chunk, len);
-  } else {
-    fifo_pop(&console_tx_fifo, chunk, TX_FIFO_FLUSH_CHUNK_SIZE);
-    uart_send_bytes(uart, chunk, TX_FIFO_FLUSH_CHUNK_SIZE);
+  // sent straight from the fifo, without copying
+  uint16_t len = fifo_get_contiguous_readable(&console_tx_fifo, &data);
+  if(len == 0)
+    return;
+
+  if(len > TX_FLUSH_CHUNK_SIZE)
+    len = TX_FLUSH_CHUNK_SIZE;
+
+  uart_send_bytes(uart, data, len);
+  fifo_skip(&console_tx_fifo, len);
+  rewind_when_empty();
+  if(fifo_get_size(&console_tx_fifo) > 0)
     sched_post_task_prio(&flush_console_tx_fifo, MIN_PRIORITY);
-  }
 #endif
 }
 
+// blocking policy: transmits the oldest output synchronously, returns false when there was none left
+static bool transmit_oldest() {
+#ifdef HAL_UART_USE_DMA_TX
+  while(tx_length > 0 && !tx_done); // the DMA interrupt ends the ongoing transfer
+  complete_tx();
+#endif
+  uint8_t* data;
+  uint16_t len = fifo_get_contiguous_readable(&console_tx_fifo, &data);
+  if(len == 0)
+    return false;
+
+  uart_send_bytes(uart, data, len);
+  fifo_skip(&console_tx_fifo, len);
+  rewind_when_empty();
+  return true;
+}
+
+SCHED_REGISTER_TASK(flush_console_tx_fifo);
+
 void console_init(void) {
-  fifo_init(&console_tx_fifo, console_tx_buffer, CONSOLE_TX_FIFO_SIZE);
-  sched_register_task(&flush_console_tx_fifo);
+  fifo_init(&console_tx_fifo, console_tx_buffer, FRAMEWORK_CONSOLE_TX_BUFFER_SIZE);
 
   uart = uart_init(CONSOLE_UART, CONSOLE_BAUDRATE, CONSOLE_LOCATION);
   uart_enable(uart);
@@ -61,18 +199,41 @@ void console_disable(void) {
   uart_disable(uart);
 }
 
-inline void console_print_byte(uint8_t byte) {
-  fifo_put_byte(&console_tx_fifo, byte);
-  sched_post_task_prio(&flush_console_tx_fifo, MIN_PRIORITY);
+void console_set_tx_blocking(bool blocking) {
+  tx_blocking = blocking;
 }
 
-inline void console_print_bytes(uint8_t* bytes, uint8_t length) {
-  fifo_put(&console_tx_fifo, bytes, length);
+void console_print_bytes(uint8_t* bytes, uint16_t length) {
+  // the output is either queued completely or not at all, a partial write would corrupt the framing of the caller
+  while(fifo_put(&console_tx_fifo, bytes, length) != SUCCESS) {
+    if(!tx_blocking) {
+      count_dropped(length);
+      return;
+    }
+
+    if(!transmit_oldest()) {
+      uart_send_bytes(uart, bytes, length); // larger than the fifo, sent directly now that the older output is out
+      return;
+    }
+  }
+
   sched_post_task_prio(&flush_console_tx_fifo, MIN_PRIORITY);
 }
 
-inline void console_print(char* string) {
-  console_print_bytes((uint8_t*) string, strnlen(string, 100));
+uint8_t* console_tx_reserve(uint16_t length) {
+  uint8_t* data;
+  while(fifo_get_contiguous_writable(&console_tx_fifo, &data) < length) {
+    // an emptied fifo is rewound, so the complete buffer becomes contiguous
+    if(!tx_blocking || !transmit_oldest())
+      return NULL;
+  }
+
+  return data;
+}
+
+void console_tx_commit(uint16_t length) {
+  error_t err = fifo_commit(&console_tx_fifo, length); assert(err == SUCCESS);
+  sched_post_task_prio(&flush_console_tx_fifo, MIN_PRIORITY);
 }
 
 inline void console_set_rx_interrupt_callback(uart_rx_inthandler_t uart_rx_cb) {
@@ -88,3 +249,21 @@ inline void console_rx_interrupt_enable() {
 }
 
 #endif
+
+uint32_t console_get_tx_dropped_count() {
+  return tx_dropped_count;
+}
+
+void console_reset_tx_dropped_count() {
+  tx_dropped_count = 0;
+}
+
+inline void console_print_byte(uint8_t byte) {
+  console_print_bytes(&byte, 1);
+}
+
+inline void console_print(char* string) {
+  console_print_bytes((uint8_t*) string, strnlen(string, 100));
+}
+
+#endif
@@ -0,0 +1,188 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file debounce.c
+ *
+ */
+
+#include "debounce.h"
+#include "ng.h"
+#include "debug.h"
+#include "hwatomic.h"
+#include "scheduler.h"
+#include "framework_defs.h"
+
+typedef struct
+{
+    pin_id_t pin_id;
+    debounce_callback_t callback;
+    timer_tick_t settle_time;
+    timer_tick_t edge_time;     // of the first edge since the pin settled, while settling
+    uint8_t event_mask;
+    bool level;                 // the debounced level
+    volatile bool settling;     // the interrupt of the pin is disabled until it is sampled
+    bool in_use;
+} debounce_pin_t;
+
+static debounce_pin_t NGDEF(_pins)[FRAMEWORK_DEBOUNCE_MAX_PINS];
+#define pins NG(_pins)
+
+static task_handle_t NGDEF(_task_handle);
+#define task_handle NG(_task_handle)
+
+static bool NGDEF(_task_registered);
+#define task_registered NG(_task_registered)
+
+static debounce_pin_t* get_pin(pin_id_t pin_id)
+{
+    for(uint8_t i = 0; i < FRAMEWORK_DEBOUNCE_MAX_PINS; i++)
+    {
+        if(pins[i].in_use && hw_gpio_pin_matches(pins[i].pin_id, pin_id))
+            return &pins[i];
+    }
+
+    return NULL;
+}
+
+// the bounces which follow are not interrupting until the pin is sampled
+static void start_settling(debounce_pin_t* pin, timer_tick_t now)
+{
+    hw_gpio_disable_interrupt(pin->pin_id);
+    pin->edge_time = now;
+    pin->settling = true;
+}
+
+static void edge_isr(pin_id_t pin_id, uint8_t event_mask)
+{
+    debounce_pin_t* pin = get_pin(pin_id);
+    if(pin == NULL || pin->settling)
+        return;
+
+    start_settling(pin, timer_get_counter_value());
+    sched_post_handle_from_isr(task_handle, DEFAULT_PRIORITY);
+}
+
+// samples the pins which settled, and waits for the next one to settle
+static void debounce_task()
+{
+    timer_tick_t now = timer_get_counter_value();
+    timer_tick_t next_delay = 0;
+    for(uint8_t i = 0; i < FRAMEWORK_DEBOUNCE_MAX_PINS; i++)
+    {
+        debounce_pin_t* pin = &pins[i];
+        if(!pin->in_use || !pin->settling)
+            continue;
+
+        timer_tick_t elapsed = now - pin->edge_time;
+        if(elapsed < pin->settle_time)
+        {
+            if(next_delay == 0 || pin->settle_time - elapsed < next_delay)
+                next_delay = pin->settle_time - elapsed;
+
+            continue;
+        }
+
+        bool level = hw_gpio_get_in(pin->pin_id);
+        start_atomic();
+        pin->settling = false;
+        hw_gpio_enable_interrupt(pin->pin_id);
+        // an edge before the interrupt was enabled again is not interrupting, it starts a new settle time here
+        if(hw_gpio_get_in(pin->pin_id) != level)
+        {
+            start_settling(pin, now);
+            if(next_delay == 0 || pin->settle_time < next_delay)
+                next_delay = pin->settle_time;
+        }
+        end_atomic();
+
+        if(level != pin->level)
+        {
+            pin->level = level;
+            if(pin->event_mask & (level ? GPIO_RISING_EDGE : GPIO_FALLING_EDGE))
+                pin->callback(pin->pin_id, level);
+        }
+    }
+
+    if(next_delay != 0)
+    {
+        timer_cancel_task(&debounce_task);
+        error_t err = timer_post_task_delay(&debounce_task, next_delay);
+        assert(err == SUCCESS);
+    }
+}
+
+error_t debounce_register_pin(pin_id_t pin_id, uint8_t event_mask, timer_tick_t settle_time,
+                              debounce_callback_t callback)
+{
+    if(callback == NULL || event_mask == 0 || event_mask > (GPIO_RISING_EDGE | GPIO_FALLING_EDGE) || settle_time == 0)
+        return EINVAL;
+
+    if(get_pin(pin_id) != NULL)
+        return EALREADY;
+
+    debounce_pin_t* pin = NULL;
+    for(uint8_t i = 0; i < FRAMEWORK_DEBOUNCE_MAX_PINS && pin == NULL; i++)
+    {
+        if(!pins[i].in_use)
+            pin = &pins[i];
+    }
+
+    if(pin == NULL)
+        return ENOMEM;
+
+    if(!task_registered)
+    {
+        error_t err = sched_register_task_handle(&debounce_task, &task_handle);
+        assert(err == SUCCESS);
+        task_registered = true;
+    }
+
+    // both edges interrupt, a bounce can start with either of them
+    error_t err = hw_gpio_configure_interrupt(pin_id, &edge_isr, GPIO_RISING_EDGE | GPIO_FALLING_EDGE);
+    if(err != SUCCESS)
+        return err;
+
+    pin->pin_id = pin_id;
+    pin->callback = callback;
+    pin->settle_time = settle_time;
+    pin->event_mask = event_mask;
+    pin->level = hw_gpio_get_in(pin_id);
+    pin->settling = false;
+    pin->in_use = true;
+    return hw_gpio_enable_interrupt(pin_id);
+}
+
+error_t debounce_unregister_pin(pin_id_t pin_id)
+{
+    debounce_pin_t* pin = get_pin(pin_id);
+    if(pin == NULL)
+        return EALREADY;
+
+    start_atomic();
+    hw_gpio_disable_interrupt(pin_id);
+    pin->in_use = false;
+    pin->settling = false;
+    end_atomic();
+    return SUCCESS;
+}
+
+bool debounce_get_level(pin_id_t pin_id)
+{
+    debounce_pin_t* pin = get_pin(pin_id);
+    return pin != NULL && pin->level;
+}
@@ -0,0 +1,135 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file energy.c
+ *
+ */
+
+#include "energy.h"
+#include "ng.h"
+#include "timer.h"
+#include "hwatomic.h"
+
+#include <string.h>
+
+#ifdef FRAMEWORK_ENERGY_ACCOUNTING_ENABLED
+
+#define NO_TX_ENTRY 0xFF
+
+// the times are accumulated as the differences of timestamps, so the sum of the states matches the elapsed time
+static energy_stats_t NGDEF(_stats);
+#define stats NG(_stats)
+
+static timer_tick_t NGDEF(_reset_time);
+#define reset_time NG(_reset_time)
+
+static energy_radio_state_t NGDEF(_radio_state);
+#define radio_state NG(_radio_state)
+
+static timer_tick_t NGDEF(_radio_change_time);
+#define radio_change_time NG(_radio_change_time)
+
+// the entry of stats.tx of the current transmission, NO_TX_ENTRY when the EIRP is not in the table
+static uint8_t NGDEF(_tx_entry);
+#define tx_entry NG(_tx_entry)
+
+static uint8_t NGDEF(_sleep_mode);
+#define sleep_mode NG(_sleep_mode)
+
+static timer_tick_t NGDEF(_sleep_time);
+#define sleep_time NG(_sleep_time)
+
+// accounts the time since the last state change of the radio, called atomically
+static void account_radio(timer_tick_t now)
+{
+    timer_tick_t time = now - radio_change_time;
+    stats.radio[radio_state] += time;
+    if(radio_state == ENERGY_RADIO_TX && tx_entry != NO_TX_ENTRY)
+        stats.tx[tx_entry].time += time;
+
+    radio_change_time = now;
+}
+
+static uint8_t get_tx_entry(int8_t eirp)
+{
+    for(uint8_t i = 0; i < stats.tx_eirp_count; i++)
+    {
+        if(stats.tx[i].eirp == eirp)
+            return i;
+    }
+
+    if(stats.tx_eirp_count == FRAMEWORK_ENERGY_TX_EIRP_COUNT)
+        return NO_TX_ENTRY;
+
+    stats.tx[stats.tx_eirp_count] = (energy_tx_time_t){ .eirp = eirp, .time = 0 };
+    return stats.tx_eirp_count++;
+}
+
+__LINK_C void energy_radio_state_changed(energy_radio_state_t state, int8_t eirp)
+{
+    start_atomic();
+    account_radio(timer_get_counter_value());
+    radio_state = state;
+    tx_entry = state == ENERGY_RADIO_TX ? get_tx_entry(eirp) : NO_TX_ENTRY;
+    end_atomic();
+}
+
+__LINK_C void energy_cpu_sleep(uint8_t mode)
+{
+    sleep_mode = mode < ENERGY_LOWPOWER_MODE_COUNT ? mode : ENERGY_LOWPOWER_MODE_COUNT - 1;
+    sleep_time = timer_get_counter_value();
+}
+
+__LINK_C void energy_cpu_wakeup()
+{
+    timer_tick_t now = timer_get_counter_value();
+    start_atomic();
+    stats.cpu_sleep[sleep_mode] += now - sleep_time;
+    end_atomic();
+}
+
+__LINK_C void energy_get_stats(energy_stats_t* result)
+{
+    start_atomic();
+    timer_tick_t now = timer_get_counter_value();
+    account_radio(now);
+    *result = stats;
+    result->elapsed = now - reset_time;
+    end_atomic();
+
+    result->cpu_active = result->elapsed;
+    for(uint8_t mode = 0; mode < ENERGY_LOWPOWER_MODE_COUNT; mode++)
+        result->cpu_active -= result->cpu_sleep[mode];
+}
+
+__LINK_C void energy_reset_stats()
+{
+    start_atomic();
+    // a transmission in progress keeps its entry
+    bool in_tx_entry = radio_state == ENERGY_RADIO_TX && tx_entry != NO_TX_ENTRY;
+    int8_t eirp = in_tx_entry ? stats.tx[tx_entry].eirp : 0;
+    memset(&stats, 0, sizeof(stats));
+    if(in_tx_entry)
+        tx_entry = get_tx_entry(eirp);
+
+    reset_time = timer_get_counter_value();
+    radio_change_time = reset_time;
+    end_atomic();
+}
+
+#endif //FRAMEWORK_ENERGY_ACCOUNTING_ENABLED
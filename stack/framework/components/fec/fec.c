@@ -28,35 +28,35 @@
 #include <string.h>
 
 #include "fec.h"
+#include "ramfunc.h"
+
+#ifdef __ARM_FEATURE_SIMD32
+#include <arm_acle.h>
+#endif
 
 #define INITIAL_FECSTATE 0x00
 #define TRELLIS_TERMINATOR 0x0B
-#define FEC_BUFFER_SIZE 128
 
 #define INTERLEAVING
 
 //#ifdef D7_PHY_USE_FEC
 
-const static uint8_t fec_lut[16] = {0, 3, 1, 2, 3, 0, 2, 1, 3, 0, 2, 1, 0, 3, 1, 2};
-const static uint8_t trellis0_lut[8] = {0, 1, 3, 2, 3, 2, 0, 1};
-const static uint8_t trellis1_lut[8] = {3, 2, 0, 1, 0, 1, 3, 2};
-
-static uint8_t data_buffer[FEC_BUFFER_SIZE];
-static uint8_t* input_buffer;
-static uint8_t* output_buffer;
-
-static uint8_t packetlength;
-static uint16_t fecpacketlength;
-static uint16_t output_packet_length;
+const static uint8_t fec_lut[16] __HOT_RAMDATA = {0, 3, 1, 2, 3, 0, 2, 1, 3, 0, 2, 1, 0, 3, 1, 2};
 
-static uint8_t processedbytes;
-static uint16_t fecprocessedbytes;
+/*
+ * The Hamming distance between a received symbol and the symbol of a transition, packed like the path metrics: indexed by
+ * the input bit of the transition, the half of the states it starts from (0-3, 4-7) and the received symbol
+ */
+const static uint32_t branch_metrics[2][2][4] __HOT_RAMDATA = {
+	{{0x01020100, 0x02010001, 0x00010201, 0x01000102}, {0x01000102, 0x00010201, 0x02010001, 0x01020100}},
+	{{0x01000102, 0x00010201, 0x02010001, 0x01020100}, {0x01020100, 0x02010001, 0x00010201, 0x01000102}},
+};
 
-static uint16_t pn9;
-static uint16_t fecstate;
-static VITERBISTATE vstate;
+// the cost of the states which are not the initial state; the metrics are kept below 128, SWAR_GUARD is their 8th bit
+#define INITIAL_STATE_COST 64
+#define SWAR_GUARD 0x80808080
 
-static bool fec_decode(uint8_t* input);
+static bool fec_decode(fec_decoder_t* decoder, const uint8_t* input);
 
 #if defined(FRAMEWORK_LOG_ENABLED) && defined(FRAMEWORK_PHY_LOG_ENABLED) // TODO more granular (LOG_PHY_ENABLED)
 #define DPRINT(...) log_print_stack_string(LOG_STACK_PHY, __VA_ARGS__)
@@ -97,124 +97,187 @@ const char *int_to_binary(uint16_t x)
     return b;
 }
 
-static void print_vstate()
+uint16_t fec_calculated_decoded_length(uint8_t packet_length)
 {
-//	typedef struct {
-//		uint8_t cost;
-//		uint16_t path;
-//	} VITERBIPATH;
-//	typedef struct {
-//		uint8_t path_size;
-//		VITERBIPATH* old;
-//		VITERBIPATH* new;
-//		VITERBIPATH states1[8];
-//		VITERBIPATH states2[8];
-//	} VITERBISTATE;
-
-	printf("VSTATE:\n");
-	printf(" - path_size: %d\n", vstate.path_size);
-	//printf(" - old: %03d - %s\n", vstate.old->cost, int_to_binary(vstate.old->path));
-	//printf(" - new: %03d - %s\n", vstate.new->cost, int_to_binary(vstate.new->path));
-	int i;
-	for (i=0;i<8;i++)
-		printf(" - states - %d: %03d - %s\n", i, vstate.old[i].cost, int_to_binary(vstate.old[i].path));
+	return 2* (packet_length + 2 - (packet_length % 2));
+}
+
+/*
+ * The symbols of the 4 bits of a nibble, indexed by the 3 previous bits (the state of the encoder) and the nibble. The first
+ * bit is in the MSBs, like fec_lut[] applied bit per bit. The next state is the 3 LSBs of the nibble.
+ */
+const static uint8_t fec_nibble_lut[8][16] __HOT_RAMDATA = {
+	{0x00, 0x03, 0x0d, 0x0e, 0x37, 0x34, 0x3a, 0x39, 0xdf, 0xdc, 0xd2, 0xd1, 0xe8, 0xeb, 0xe5, 0xe6},
+	{0x7c, 0x7f, 0x71, 0x72, 0x4b, 0x48, 0x46, 0x45, 0xa3, 0xa0, 0xae, 0xad, 0x94, 0x97, 0x99, 0x9a},
+	{0xf0, 0xf3, 0xfd, 0xfe, 0xc7, 0xc4, 0xca, 0xc9, 0x2f, 0x2c, 0x22, 0x21, 0x18, 0x1b, 0x15, 0x16},
+	{0x8c, 0x8f, 0x81, 0x82, 0xbb, 0xb8, 0xb6, 0xb5, 0x53, 0x50, 0x5e, 0x5d, 0x64, 0x67, 0x69, 0x6a},
+	{0xc0, 0xc3, 0xcd, 0xce, 0xf7, 0xf4, 0xfa, 0xf9, 0x1f, 0x1c, 0x12, 0x11, 0x28, 0x2b, 0x25, 0x26},
+	{0xbc, 0xbf, 0xb1, 0xb2, 0x8b, 0x88, 0x86, 0x85, 0x63, 0x60, 0x6e, 0x6d, 0x54, 0x57, 0x59, 0x5a},
+	{0x30, 0x33, 0x3d, 0x3e, 0x07, 0x04, 0x0a, 0x09, 0xef, 0xec, 0xe2, 0xe1, 0xd8, 0xdb, 0xd5, 0xd6},
+	{0x4c, 0x4f, 0x41, 0x42, 0x7b, 0x78, 0x76, 0x75, 0x93, 0x90, 0x9e, 0x9d, 0xa4, 0xa7, 0xa9, 0xaa},
+};
+
+/*
+ * The 2 symbols of a nibble spread to the LSBs of 2 interleaved bytes (little endian), the symbol in the LSBs of the nibble
+ * to the first byte. The interleaved block is the OR of the spread encoded bytes, shifted by 2 bits per encoded byte.
+ */
+const static uint16_t interleave_lut[16] __HOT_RAMDATA = {
+	0x0000, 0x0001, 0x0002, 0x0003, 0x0100, 0x0101, 0x0102, 0x0103,
+	0x0200, 0x0201, 0x0202, 0x0203, 0x0300, 0x0301, 0x0302, 0x0303,
+};
 
+static inline uint8_t encode_nibble(uint8_t* encstate, uint8_t nibble)
+{
+	uint8_t symbols = fec_nibble_lut[*encstate][nibble];
+	*encstate = nibble & 0x07;
+	return symbols;
 }
 
+static inline uint32_t spread_symbols(uint8_t symbols)
+{
+	return interleave_lut[symbols & 0x0F] | ((uint32_t) interleave_lut[symbols >> 4] << 16);
+}
 
-uint16_t fec_calculated_decoded_length(uint8_t packet_length)
+// byte n of the output holds the symbols n (counted from the LSBs) of the 4 input bytes
+__HOT_RAMFUNC static void interleave(const uint8_t* input, uint8_t* output)
 {
-	return 2* (packet_length + 2 - (packet_length % 2));
+	uint32_t block = spread_symbols(input[0]) | (spread_symbols(input[1]) << 2)
+			| (spread_symbols(input[2]) << 4) | (spread_symbols(input[3]) << 6);
+	output[0] = block;
+	output[1] = block >> 8;
+	output[2] = block >> 16;
+	output[3] = block >> 24;
 }
 
-/* Convolutional encoder */
-uint16_t fec_encode(uint8_t *data, uint16_t nbytes)
+uint16_t fec_calculate_encoded_length(uint16_t nbytes)
 {
-	memcpy(data_buffer, data, nbytes);
-	uint8_t *input = data_buffer;
-	unsigned int encstate = 0;
-	int i;
-
-	int termintor_bytes = 2 + nbytes%2;
-	//printf("Length %d -> terminator %d\n", nbytes, termintor_bytes);
-	nbytes+=termintor_bytes;
-	uint16_t length = 0;
-	uint8_t fecbuffer[4] = {0,0,0,0};
-
-	int8_t buffer_pointer = 0;
-	while(nbytes-- > 0){
-		if (nbytes < termintor_bytes) *input = TRELLIS_TERMINATOR;
-
-		//printf("%02X:", *input);
-
-		int j = 6;
-		for(i=7;i>=0;i--){
-				encstate = (encstate << 1) | ((*input >> i) & 1);
-				fecbuffer[buffer_pointer] |= fec_lut[encstate & 0x0F] << j;
-				j -=2;
-
-				//printf("%d: %d - %d -> %s\n",j+2, ((*input >> i) & 1), encstate & 0x0F, byte_to_binary(fec_lut[encstate & 0x0F]));
-				if (j < 0)
-				{
-//						//fecbuffer[buffer_pointer] = 0;
-					buffer_pointer++;
-					j = 6;
-//						length++;
-				}
-		}
+	// the data is terminated by 2 trellis terminator bytes, and a third one when needed to fill the last 4 byte block
+	return 2 * (nbytes + 2 + nbytes % 2);
+}
+
+/* Convolutional encoder, per 2 input bytes giving a block of 4 encoded bytes */
+__HOT_RAMFUNC static void encode_block(fec_encoder_t* encoder, uint8_t first, uint8_t second, uint8_t* output)
+{
+	uint8_t fecbuffer[4];
+	fecbuffer[0] = encode_nibble(&encoder->state, first >> 4);
+	fecbuffer[1] = encode_nibble(&encoder->state, first & 0x0F);
+	fecbuffer[2] = encode_nibble(&encoder->state, second >> 4);
+	fecbuffer[3] = encode_nibble(&encoder->state, second & 0x0F);
 
-		if (buffer_pointer == 4)
-		{
 #ifdef INTERLEAVING
-			//printf("Non: "); print_array(fecbuffer, 4); printf("\n");
-			//Interleaving and write to output buffer
-			*data++ = ((fecbuffer[0] & 0x03)) |\
-						((fecbuffer[1] & 0x03) << 2) |\
-						((fecbuffer[2] & 0x03) << 4) |\
-						((fecbuffer[3] & 0x03) << 6);
-			*data++ = (((fecbuffer[0] >> 2) & 0x03)) |\
-							(((fecbuffer[1] >> 2) & 0x03) << 2) |\
-							(((fecbuffer[2] >> 2) & 0x03) << 4) |\
-							(((fecbuffer[3] >> 2) & 0x03) << 6);
-			*data++ = (((fecbuffer[0] >> 4) & 0x03)) |\
-							(((fecbuffer[1] >> 4) & 0x03) << 2) |\
-							(((fecbuffer[2] >> 4) & 0x03) << 4) |\
-							(((fecbuffer[3] >> 4) & 0x03) << 6);
-			*data++ = (((fecbuffer[0] >> 6) & 0x03)) |\
-							(((fecbuffer[1] >> 6) & 0x03) << 2) |\
-							(((fecbuffer[2] >> 6) & 0x03) << 4) |\
-							(((fecbuffer[3] >> 6) & 0x03) << 6);
-			//printf("Int: "); print_array(output-4, 4); printf("\n");
+	interleave(fecbuffer, output);
 #else
-			*output++ = fecbuffer[0];
-			*output++ = fecbuffer[1];
-			*output++ = fecbuffer[2];
-			*output++ = fecbuffer[3];
-
+	memcpy(output, fecbuffer, 4);
 #endif
-			buffer_pointer=0;
-			fecbuffer[0] = 0;
-			fecbuffer[1] = 0;
-			fecbuffer[2] = 0;
-			fecbuffer[3] = 0;
-			length+=4;
-		}
+}
 
+void fec_encoder_init(fec_encoder_t* encoder)
+{
+	encoder->state = INITIAL_FECSTATE;
+	encoder->has_pending_input = false;
+}
 
-		//printf("%02X%02X ", *(output-2), *(output-1));
+__HOT_RAMFUNC uint16_t fec_encoder_feed(fec_encoder_t* encoder, const uint8_t* input, uint16_t nbytes, uint8_t* output)
+{
+	uint8_t* start = output;
+	if(encoder->has_pending_input && nbytes > 0)
+	{
+		encode_block(encoder, encoder->pending_input, *input++, output);
+		output += 4;
+		nbytes--;
+		encoder->has_pending_input = false;
+	}
 
-		input++;
+	// a block is read before it is written, the input may overlap the end of the output
+	for(; nbytes >= 2; nbytes -= 2, input += 2, output += 4)
+		encode_block(encoder, input[0], input[1], output);
 
+	if(nbytes)
+	{
+		encoder->pending_input = *input;
+		encoder->has_pending_input = true;
 	}
 
+	return output - start;
+}
 
-	//printf("\n");
+uint16_t fec_encoder_finish(fec_encoder_t* encoder, uint8_t* output)
+{
+	uint16_t length = 4;
+	if(encoder->has_pending_input)
+	{
+		encode_block(encoder, encoder->pending_input, TRELLIS_TERMINATOR, output);
+		output += 4;
+		length += 4;
+		encoder->has_pending_input = false;
+	}
+
+	encode_block(encoder, TRELLIS_TERMINATOR, TRELLIS_TERMINATOR, output);
 	return length;
 }
 
+uint16_t fec_encode_to(const uint8_t* input, uint16_t nbytes, uint8_t* output)
+{
+	fec_encoder_t encoder;
+	fec_encoder_init(&encoder);
+	uint16_t length = fec_encoder_feed(&encoder, input, nbytes, output);
+	return length + fec_encoder_finish(&encoder, output + length);
+}
+
+uint16_t fec_encode(uint8_t *data, uint16_t nbytes)
+{
+	// the input is moved to the end of the encoded area first, the encoder writes behind the bytes it reads then
+	uint16_t length = fec_calculate_encoded_length(nbytes);
+	uint8_t* input = data + length - nbytes;
+	memmove(input, data, nbytes);
+	return fec_encode_to(input, nbytes, data);
+}
+
+void fec_decoder_init(fec_decoder_t* decoder, uint8_t* output, uint8_t output_length, uint16_t packet_length)
+{
+	decoder->output = output;
+	decoder->output_length = output_length;
+	decoder->encoded_length = packet_length;
+
+	decoder->processed_bytes = 0;
+	decoder->fec_processed_bytes = 0;
+	decoder->pending_input_count = 0;
+
+	decoder->path_size = 0;
+	decoder->symbol_count = 0;
+	decoder->metrics[0] = INITIAL_STATE_COST * 0x01010100;
+	decoder->metrics[1] = INITIAL_STATE_COST * 0x01010101;
+}
+
+__HOT_RAMFUNC uint8_t fec_decoder_feed(fec_decoder_t* decoder, const uint8_t* data, uint8_t length)
+{
+	while(length--)
+	{
+		decoder->pending_input[decoder->pending_input_count++] = *data++;
+		if(decoder->pending_input_count == 4)
+		{
+			decoder->pending_input_count = 0;
+			if(!fec_decode(decoder, decoder->pending_input))
+				DPRINT("FEC decoding error\n");
+		}
+	}
+
+	return decoder->processed_bytes;
+}
+
+bool fec_decoder_finish(fec_decoder_t* decoder)
+{
+	if(decoder->pending_input_count != 0 || decoder->fec_processed_bytes < decoder->encoded_length)
+	{
+		DPRINT("FEC decoding error: frame incomplete\n");
+		return false;
+	}
+
+	return true;
+}
+
 uint8_t fec_decode_packet(uint8_t* data, uint8_t packet_length, uint8_t output_length)
 {
-	uint8_t* output = data_buffer;
 	if(output_length < packet_length)
 	{
 		DPRINT("FEC decoding error: buffer to small\n");
@@ -227,178 +290,164 @@ uint8_t fec_decode_packet(uint8_t* data, uint8_t packet_length, uint8_t output_l
 		return 0;
 	}
 
-	output_buffer = output;
-	packetlength = packet_length;
-	fecpacketlength = ((packet_length & 0xFE) + 2) << 1;
-	output_packet_length = output_length;
-
-	processedbytes = 0;
-	fecprocessedbytes = 0;
+	// decoded in place, a block of 4 encoded bytes is read before the (at most 3) decoded bytes are written
+	fec_decoder_t decoder;
+	fec_decoder_init(&decoder, data, packet_length, ((packet_length & 0xFE) + 2) << 1);
 
-	vstate.path_size = 0;
-
-	vstate.states1[0].cost = 0;
 	int16_t i;
-	for (i=1;i<8;i++)
-			vstate.states1[i].cost = 100;
-
-	vstate.old = vstate.states1;
-	vstate.new = vstate.states2;
-
 	uint8_t decoded_length = 0;
 
 	for(i = 0; i < packet_length; i =i+4)
 	{
 		//printf("FEC encoding i = %d\n", i);
 
-		bool err = fec_decode(&data[i]);
+		bool err = fec_decode(&decoder, &data[i]);
 		decoded_length+=2;
 		if (!err)
 			DPRINT("FEC encoding error\n");
 	}
 
-	memcpy(data, data_buffer, decoded_length);
-
 	return decoded_length;
 }
 
-static bool fec_decode(uint8_t* input)
+/*
+ * The per byte minimum of the metrics x and y (below 128), x when equal. The bit 7 of the bytes in which y is selected are
+ * set in y_selected. On cores with the DSP extension the GE flags of a byte wise subtraction select instead.
+ */
+static inline uint32_t select_min(uint32_t x, uint32_t y, uint32_t* y_selected)
+{
+#ifdef __ARM_FEATURE_SIMD32
+	__usub8(y, x); // GE set where y >= x
+	*y_selected = __sel(0, SWAR_GUARD);
+	return __sel(x, y);
+#else
+	uint32_t x_selected = ((y | SWAR_GUARD) - x) & SWAR_GUARD; // no borrows between bytes, the guard bit stays set where y >= x
+	uint32_t mask = (x_selected >> 7) * 0xFF;
+	*y_selected = ~x_selected & SWAR_GUARD;
+	return (x & mask) | (y & ~mask);
+#endif
+}
+
+// the bit 7 of the 4 bytes as a nibble
+static inline uint8_t gather_guard_bits(uint32_t bits)
+{
+	bits >>= 7;
+	return (bits | (bits >> 7) | (bits >> 14) | (bits >> 21)) & 0x0F;
+}
+
+// the byte wise sum, the metrics stay below 128 so no carries occur
+static inline uint32_t add_metrics(uint32_t a, uint32_t b)
+{
+#ifdef __ARM_FEATURE_SIMD32
+	return __uadd8(a, b);
+#else
+	return a + b;
+#endif
+}
+
+/*
+ * Add-compare-select of the 8 states for one symbol. New state k has the states k >> 1 and (k >> 1) + 4 as predecessors
+ * and k & 1 as input bit, so the bytes of both metric words give the even (input 0) and the odd (input 1) new states.
+ * The decision of the symbol holds a bit per new state, set when the predecessor is in the upper half: bit (k >> 1) for
+ * the even states and bit 4 + (k >> 1) for the odd states.
+ */
+__HOT_RAMFUNC static void add_compare_select(fec_decoder_t* decoder, uint8_t symbol)
+{
+	uint32_t y_selected;
+	uint32_t even = select_min(add_metrics(decoder->metrics[0], branch_metrics[0][0][symbol]),
+							   add_metrics(decoder->metrics[1], branch_metrics[0][1][symbol]), &y_selected);
+	uint8_t decision = gather_guard_bits(y_selected);
+	uint32_t odd = select_min(add_metrics(decoder->metrics[0], branch_metrics[1][0][symbol]),
+							  add_metrics(decoder->metrics[1], branch_metrics[1][1][symbol]), &y_selected);
+	decision |= gather_guard_bits(y_selected) << 4;
+	decoder->decisions[decoder->symbol_count++ % FEC_TRACEBACK_LENGTH] = decision;
+
+	// interleave the bytes of the even and odd states back to the order of the states
+	uint32_t low = (even & 0x0000FFFF) | (odd << 16);
+	uint32_t high = (even >> 16) | (odd & 0xFFFF0000);
+	uint32_t t = (low ^ (low >> 8)) & 0x0000FF00;
+	decoder->metrics[0] = low ^ t ^ (t << 8);
+	t = (high ^ (high >> 8)) & 0x0000FF00;
+	decoder->metrics[1] = high ^ t ^ (t << 8);
+}
+
+/*
+ * The state with the lowest metric: the first state when it is one of them, else the highest. After subtracting the
+ * minimum, the states with the lowest metric are the zero bytes.
+ */
+__HOT_RAMFUNC static uint8_t normalize_metrics(fec_decoder_t* decoder)
+{
+	uint32_t unused;
+	uint32_t min = select_min(decoder->metrics[0], decoder->metrics[1], &unused);
+	min = select_min(min, min >> 16, &unused);
+	min = select_min(min, min >> 8, &unused) & 0xFF;
+	decoder->metrics[0] -= min * 0x01010101;
+	decoder->metrics[1] -= min * 0x01010101;
+
+	uint8_t lowest = 0;
+	for(uint8_t half = 0; half < 2; half++)
+	{
+		uint32_t non_zero = ((decoder->metrics[half] | SWAR_GUARD) - 0x01010101) & SWAR_GUARD;
+		lowest |= gather_guard_bits(~non_zero & SWAR_GUARD) << (4 * half);
+	}
+
+	return (lowest & 0x01) ? 0 : 31 - __builtin_clz(lowest);
+}
+
+// the path of the state over the last FEC_TRACEBACK_LENGTH symbols, the input bit of the last symbol in the LSB
+__HOT_RAMFUNC static uint16_t trace_back(fec_decoder_t* decoder, uint8_t state)
+{
+	uint16_t path = 0;
+	for(uint8_t age = 0; age < FEC_TRACEBACK_LENGTH; age++)
+	{
+		uint8_t decision = decoder->decisions[(uint8_t)(decoder->symbol_count - 1 - age) % FEC_TRACEBACK_LENGTH];
+		path |= (uint16_t)(state & 1) << age;
+		bool upper = (decision >> ((state >> 1) + 4 * (state & 1))) & 1;
+		state = (state >> 1) + (upper ? 4 : 0);
+	}
+
+	return path;
+}
+
+__HOT_RAMFUNC static bool fec_decode(fec_decoder_t* decoder, const uint8_t* input)
 {
-	uint8_t i, k;
-	int8_t j;
-	uint8_t min_state;
-	uint8_t symbol;
-	uint16_t tmppn9;
 	uint8_t fecbuffer[4];
-	VITERBIPATH* vstate_tmp;
 
-	if(fecprocessedbytes >= fecpacketlength)
+	if(decoder->fec_processed_bytes >= decoder->encoded_length)
 		return false;
 
-	//Deinterleaving (symbols are stored in reverse as this is easier for Viterbi decoding)
-
+	//Deinterleaving, the interleaving swaps the symbols like a transposition so it is undone by interleaving again
 #ifdef INTERLEAVING
-	//printf("Int: "); print_array(input, 4); printf("\n");
-	fecbuffer[0] = ((input[0] & 0x03)) |\
-					((input[1] & 0x03) << 2) |\
-					((input[2] & 0x03) << 4) |\
-					((input[3] & 0x03) << 6);
-	fecbuffer[1] = (((input[0] >> 2) & 0x03)) |\
-					(((input[1] >> 2) & 0x03) << 2) |\
-					(((input[2] >> 2) & 0x03) << 4) |\
-					(((input[3] >> 2) & 0x03) << 6);
-	fecbuffer[2] = (((input[0] >> 4) & 0x03)) |\
-					(((input[1] >> 4) & 0x03) << 2) |\
-					(((input[2] >> 4) & 0x03) << 4) |\
-					(((input[3] >> 4) & 0x03) << 6);
-	fecbuffer[3] = (((input[0] >> 6) & 0x03)) |\
-					(((input[1] >> 6) & 0x03) << 2) |\
-					(((input[2] >> 6) & 0x03) << 4) |\
-					(((input[3] >> 6) & 0x03) << 6);
-	//printf("DeI: "); print_array(fecbuffer, 4); printf("\n");
+	interleave(input, fecbuffer);
 #else
-	fecbuffer[0] = input[0];
-	fecbuffer[1] = input[1];
-	fecbuffer[2] = input[2];
-	fecbuffer[3] = input[3];
+	memcpy(fecbuffer, input, 4);
 #endif
-	//printf(" input = %04X%04X\n", fecbuffer[0],fecbuffer[1]);
-	fecprocessedbytes +=4;
-
-	for (i = 0; i < 3; i=i+2) {
-		//Viterbi decoding
-		//printf(" Encode i  %d -> %04X %s\n", i, fecbuffer[i], int_to_binary(fecbuffer[i]));
-
-		// todo: fix for loop
-		for (j = 7; j >= 0; j--) {
-			if (j>3)
-				symbol = (fecbuffer[i] >> (j-4)*2) & 0x03;
-			else
-				symbol = (fecbuffer[i+1] >> j*2) & 0x03;
-			//printf(" Symbol %d %x - %s\n", j, symbol, int_to_binary(symbol));
-			//fecbuffer[i] >>= 2;
-
-			for(k = 0; k < 8; k++) {
-				uint8_t cost0, cost1;
-				uint8_t state0, state1;
-				uint8_t hamming0, hamming1;
-
-				state0 = k >> 1;
-				state1 = state0 + 4;
-
-				cost0  = vstate.old[state0].cost;
-				cost1  = vstate.old[state1].cost;
-
-				//butterfly operation for 0
-				hamming0 = cost0 + (((trellis0_lut[state0] ^ symbol) + 1) >> 1);
-				hamming1 = cost1 + (((trellis0_lut[state1] ^ symbol) + 1) >> 1);
-
-				if(hamming0 <= hamming1) {
-					vstate.new[k].cost = hamming0;
-					vstate.new[k].path = vstate.old[state0].path << 1;
-				} else {
-					vstate.new[k].cost = hamming1;
-					vstate.new[k].path = vstate.old[state1].path << 1;
-				}
-
-				//printf("k %d part 1\n");
-				//print_vstate();
-
-				k++;
-
-				//butterfly operation for 1
-				hamming0 = cost0 + (((trellis1_lut[state0] ^ symbol) + 1) >> 1);
-				hamming1 = cost1 + (((trellis1_lut[state1] ^ symbol) + 1) >> 1);
-
-				if(hamming0 <= hamming1) {
-					vstate.new[k].cost = hamming0;
-					vstate.new[k].path = vstate.old[state0].path << 1 | 0x01;
-				} else {
-					vstate.new[k].cost = hamming1;
-					vstate.new[k].path = vstate.old[state1].path << 1 | 0x01;
-				}
-
-				//printf("k %d part 2\n");
-				//print_vstate();
-			}
-
-			//Swap Viterbi paths
-			vstate_tmp = vstate.new;
-			vstate.new = vstate.old;
-			vstate.old = vstate_tmp;
-
-			//print_vstate();
-		}
+	decoder->fec_processed_bytes +=4;
 
-		vstate.path_size++;
+	for (uint8_t i = 0; i < 3; i=i+2) {
+		//Viterbi decoding, the symbols of the 2 bytes from the MSBs
+		uint16_t symbols = (fecbuffer[i] << 8) | fecbuffer[i + 1];
+		for (int8_t j = 14; j >= 0; j -= 2)
+			add_compare_select(decoder, (symbols >> j) & 0x03);
 
-		//Flush out byte if path is full
-		if ((vstate.path_size == 2) && (processedbytes < packetlength)) {
-			//Calculate path with lowest cost
-			min_state = 0;
-			for (j = 7; j != 0; j--) {
-				if(vstate.old[j].cost < vstate.old[min_state].cost)
-					min_state = j;
-			}
+		decoder->path_size++;
 
-	        //Normalize costs
-			if (vstate.old[min_state].cost > 0)
-				for (j = 0; j < 8; j++) vstate.old[j].cost -= vstate.old[min_state].cost;
+		// the metrics are normalized every byte, which keeps them below 128
+		uint8_t min_state = normalize_metrics(decoder);
 
-			*output_buffer++ = vstate.old[min_state].path >> 8;
-			vstate.path_size--;
+		//Flush out byte if path is full
+		if ((decoder->path_size == 2) && (decoder->processed_bytes < decoder->output_length)) {
+			uint16_t path = trace_back(decoder, min_state);
+			*decoder->output++ = path >> 8;
+			decoder->path_size--;
 
-			processedbytes++;
+			decoder->processed_bytes++;
 
-			if (processedbytes+ 2 == packetlength)
-				*output_buffer = (uint8_t) (vstate.old[min_state].path);
+			if (decoder->processed_bytes+ 2 == decoder->output_length)
+				*decoder->output = (uint8_t) path;
 		}
 	}
 
-	//print_vstate();
-
-
-
 	return true;
 }
 
@@ -24,6 +24,10 @@
 #include "string.h"
 #include "errors.h"
 
+// prevents the compiler from moving memory accesses across this point, used to publish the indices of the SPSC FIFO
+// only after the data itself is written (or read). A hardware barrier is not needed on the single core targets we support.
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
 void fifo_init(fifo_t *fifo, uint8_t *buffer, uint16_t max_size)
 {
     fifo_init_filled(fifo, buffer, 0, max_size);
@@ -37,8 +41,20 @@ void fifo_init_filled(fifo_t *fifo, uint8_t *buffer, uint16_t filled_size, uint1
     fifo->tail_idx = filled_size;
 }
 
-error_t fifo_put(fifo_t *fifo, uint8_t *data, uint16_t len)
+error_t fifo_put(fifo_t *fifo, const uint8_t *data, uint16_t len)
 {
+    if(fifo->tail_idx < fifo->head_idx)
+    {
+        // the data already wraps, the free space is contiguous up to the head
+        // (tail reaching the head would make the FIFO look empty)
+        if(fifo->tail_idx + len >= fifo->head_idx)
+            return ESIZE;
+
+        memcpy(fifo->buffer + fifo->tail_idx, data, len);
+        fifo->tail_idx += len;
+        return SUCCESS;
+    }
+
     if(fifo->tail_idx + len <= fifo->max_size)
     {
         memcpy(fifo->buffer + fifo->tail_idx, data, len);
@@ -62,15 +78,31 @@ error_t fifo_put(fifo_t *fifo, uint8_t *data, uint16_t len)
 
 error_t fifo_put_byte(fifo_t* fifo, uint8_t byte)
 {
-    return fifo_put(fifo, &byte, 1);
+    // avoid the memcpy() overhead, this is called for every byte received on the UART
+    if(fifo->tail_idx < fifo->max_size)
+    {
+        if(fifo->tail_idx + 1 == fifo->head_idx)
+            return ESIZE;
+
+        fifo->buffer[fifo->tail_idx++] = byte;
+        return SUCCESS;
+    }
+
+    // wrap, the tail should not end up on the head
+    if(fifo->head_idx <= 1)
+        return ESIZE;
+
+    fifo->buffer[0] = byte;
+    fifo->tail_idx = 1;
+    return SUCCESS;
 }
 
-static error_t check_len(fifo_t* fifo, uint16_t len) {
+static error_t check_len(fifo_t* fifo, uint16_t offset, uint16_t len) {
   // quickly bail out if requested length is zero, nothing to do
   if(len == 0) { return SUCCESS; }
 
-  // quick check if requested len doesn't exceed available data
-  if(len > fifo_get_size(fifo)) { return ESIZE; }
+  // quick check if requested range doesn't exceed available data
+  if(offset + len > fifo_get_size(fifo)) { return ESIZE; }
 
   return SUCCESS;
 }
@@ -83,7 +115,7 @@ static void skip(fifo_t* fifo, uint16_t len) {
 }
 
 error_t fifo_skip(fifo_t* fifo, uint16_t len) {
-  error_t err = check_len(fifo, len);
+  error_t err = check_len(fifo, 0, len);
   if(err != SUCCESS)
     return err;
 
@@ -92,33 +124,34 @@ error_t fifo_skip(fifo_t* fifo, uint16_t len) {
   return SUCCESS;
 }
 
-error_t fifo_peek(fifo_t* fifo, uint8_t* buffer, uint16_t offset, uint16_t len) {
-  error_t err = check_len(fifo, len);
-  if(err != SUCCESS)
-    return err;
-
-  // determine start/end index (in circular buffer)
-  uint16_t start_idx = (fifo->head_idx + offset) % fifo->max_size;
-  uint16_t end_idx   = (start_idx      + len   ) % fifo->max_size;
-
+// copies len bytes starting at start_idx out of the circular buffer, in at most two contiguous chunks
+static void copy_out(uint8_t* fifo_buffer, uint16_t max_size, uint16_t start_idx, uint8_t* buffer, uint16_t len) {
   // simple case: the end doesn't wrap...
   // .............
   //     S-len->E
-  if(end_idx >= start_idx) {
-    memcpy(buffer, fifo->buffer + start_idx, len);
-    return SUCCESS;
+  if(start_idx + len <= max_size) {
+    memcpy(buffer, fifo_buffer + start_idx, len);
+    return;
   }
 
   // the end does wrap...
   // .............
   // ->E S--len-->
   //      <--p1-->
-  uint16_t part1 = fifo->max_size - start_idx;
+  uint16_t part1 = max_size - start_idx;
   // copy first part from start up to the end of the buffer
-  memcpy(buffer,         fifo->buffer + start_idx, part1);
+  memcpy(buffer,         fifo_buffer + start_idx, part1);
   // copy remaining (wrapped) bytes from start
-  memcpy(buffer + part1, fifo->buffer,             len - part1);
+  memcpy(buffer + part1, fifo_buffer,             len - part1);
+}
 
+error_t fifo_peek(fifo_t* fifo, uint8_t* buffer, uint16_t offset, uint16_t len) {
+  error_t err = check_len(fifo, offset, len);
+  if(err != SUCCESS || len == 0)
+    return err;
+
+  // determine start index (in circular buffer)
+  copy_out(fifo->buffer, fifo->max_size, (fifo->head_idx + offset) % fifo->max_size, buffer, len);
   return SUCCESS;
 }
 
@@ -132,6 +165,48 @@ error_t fifo_pop(fifo_t* fifo, uint8_t* buffer, uint16_t len) {
   return SUCCESS;
 }
 
+uint16_t fifo_get_contiguous_readable(fifo_t* fifo, uint8_t** data)
+{
+    uint16_t head_idx = fifo->head_idx;
+    if(head_idx == fifo->max_size && fifo->tail_idx < head_idx)
+        head_idx = 0; // see skip(), the FIFO is empty when the tail is at max_size as well
+
+    (*data) = fifo->buffer + head_idx;
+    if(head_idx <= fifo->tail_idx)
+        return fifo->tail_idx - head_idx;
+    else
+        return fifo->max_size - head_idx;
+}
+
+// follows fifo_put(): the tail never reaches the head from below, and a tail at max_size continues at the start
+uint16_t fifo_get_contiguous_writable(fifo_t* fifo, uint8_t** data)
+{
+    if(fifo->tail_idx < fifo->head_idx)
+    {
+        (*data) = fifo->buffer + fifo->tail_idx;
+        return fifo->head_idx - fifo->tail_idx - 1;
+    }
+
+    if(fifo->tail_idx < fifo->max_size)
+    {
+        (*data) = fifo->buffer + fifo->tail_idx;
+        return fifo->max_size - fifo->tail_idx;
+    }
+
+    (*data) = fifo->buffer;
+    return fifo->head_idx > 0 ? fifo->head_idx - 1 : 0;
+}
+
+error_t fifo_commit(fifo_t* fifo, uint16_t len)
+{
+    uint8_t* data;
+    if(len > fifo_get_contiguous_writable(fifo, &data))
+        return ESIZE;
+
+    fifo->tail_idx = (data - fifo->buffer) + len;
+    return SUCCESS;
+}
+
 uint16_t fifo_get_size(fifo_t* fifo)
 {
     if(fifo->head_idx <= fifo->tail_idx)
@@ -149,3 +224,110 @@ void fifo_clear(fifo_t* fifo)
 bool fifo_is_full(fifo_t* fifo) {
     return fifo_get_size(fifo) == fifo->max_size;
 }
+
+void spsc_fifo_init(spsc_fifo_t* fifo, uint8_t* buffer, uint16_t buffer_size)
+{
+    fifo->buffer = buffer;
+    fifo->buffer_size = buffer_size;
+    fifo->head_idx = 0;
+    fifo->tail_idx = 0;
+}
+
+uint16_t spsc_fifo_get_size(spsc_fifo_t* fifo)
+{
+    // read each index only once, it might be changed concurrently by the other side
+    uint16_t head_idx = fifo->head_idx;
+    uint16_t tail_idx = fifo->tail_idx;
+    if(head_idx <= tail_idx)
+        return tail_idx - head_idx;
+    else
+        return tail_idx + (fifo->buffer_size - head_idx);
+}
+
+error_t spsc_fifo_put(spsc_fifo_t* fifo, uint8_t* data, uint16_t len)
+{
+    // one byte is always kept free, to distinguish a full from an empty FIFO
+    if(len >= fifo->buffer_size - spsc_fifo_get_size(fifo))
+        return ESIZE;
+
+    uint16_t tail_idx = fifo->tail_idx;
+    uint16_t part1 = fifo->buffer_size - tail_idx;
+    if(len < part1)
+    {
+        memcpy(fifo->buffer + tail_idx, data, len);
+        tail_idx += len;
+    }
+    else
+    {
+        memcpy(fifo->buffer + tail_idx, data, part1);
+        memcpy(fifo->buffer, data + part1, len - part1);
+        tail_idx = len - part1;
+    }
+
+    // only make the data visible to the consumer once it is written
+    COMPILER_BARRIER();
+    fifo->tail_idx = tail_idx;
+    return SUCCESS;
+}
+
+error_t spsc_fifo_put_byte(spsc_fifo_t* fifo, uint8_t byte)
+{
+    uint16_t tail_idx = fifo->tail_idx;
+    uint16_t next_tail_idx = tail_idx + 1;
+    if(next_tail_idx == fifo->buffer_size)
+        next_tail_idx = 0;
+
+    if(next_tail_idx == fifo->head_idx)
+        return ESIZE;
+
+    fifo->buffer[tail_idx] = byte;
+    COMPILER_BARRIER();
+    fifo->tail_idx = next_tail_idx;
+    return SUCCESS;
+}
+
+error_t spsc_fifo_peek(spsc_fifo_t* fifo, uint8_t* buffer, uint16_t offset, uint16_t len)
+{
+    if(offset + len > spsc_fifo_get_size(fifo))
+        return ESIZE;
+
+    if(len == 0)
+        return SUCCESS;
+
+    COMPILER_BARRIER(); // read the data only after the tail index
+    copy_out(fifo->buffer, fifo->buffer_size, (fifo->head_idx + offset) % fifo->buffer_size, buffer, len);
+    return SUCCESS;
+}
+
+error_t spsc_fifo_skip(spsc_fifo_t* fifo, uint16_t len)
+{
+    if(len > spsc_fifo_get_size(fifo))
+        return ESIZE;
+
+    // only hand the space back to the producer once the data is read
+    COMPILER_BARRIER();
+    fifo->head_idx = (fifo->head_idx + len) % fifo->buffer_size;
+    return SUCCESS;
+}
+
+error_t spsc_fifo_pop(spsc_fifo_t* fifo, uint8_t* buffer, uint16_t len)
+{
+    error_t err = spsc_fifo_peek(fifo, buffer, 0, len);
+    if(err != SUCCESS)
+        return err;
+
+    return spsc_fifo_skip(fifo, len);
+}
+
+uint16_t spsc_fifo_get_contiguous_readable(spsc_fifo_t* fifo, uint8_t** data)
+{
+    uint16_t head_idx = fifo->head_idx;
+    uint16_t tail_idx = fifo->tail_idx;
+    COMPILER_BARRIER();
+
+    (*data) = fifo->buffer + head_idx;
+    if(head_idx <= tail_idx)
+        return tail_idx - head_idx;
+    else
+        return fifo->buffer_size - head_idx;
+}
@@ -29,6 +29,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <hwradio.h>
 #include "framework_defs.h"
@@ -38,15 +39,192 @@
 
 #ifdef FRAMEWORK_LOG_ENABLED
 
+#ifdef FRAMEWORK_LOG_DEFERRED
+#include "scheduler.h"
+#include "spsc_ring.h"
+#include "hwatomic.h"
+#include "debug.h"
+#endif
+
 
 static uint32_t NGDEF(counter);
 
+// the runtime filter. Both are zero initialized to output everything: a set bit (1 << layer) disables a layer, and the
+// level is stored as its distance to LOG_LEVEL_DEBUG
+static uint32_t NGDEF(_disabled_layers);
+#define disabled_layers NG(_disabled_layers)
+
+static uint8_t NGDEF(_level_distance);
+#define level_distance NG(_level_distance)
+
 
 __LINK_C void log_counter_reset()
 {
 	NG(counter) = 0;
 }
 
+__LINK_C void log_set_level(uint8_t level)
+{
+    level_distance = level < LOG_LEVEL_DEBUG ? LOG_LEVEL_DEBUG - level : 0;
+}
+
+__LINK_C uint8_t log_get_level()
+{
+    return LOG_LEVEL_DEBUG - level_distance;
+}
+
+__LINK_C void log_set_layer_enabled(log_stack_layer_t type, bool enabled)
+{
+    if(enabled)
+        disabled_layers &= ~(UINT32_C(1) << type);
+    else
+        disabled_layers |= UINT32_C(1) << type;
+}
+
+__LINK_C bool log_is_enabled(log_stack_layer_t type, uint8_t level)
+{
+    return level <= LOG_LEVEL_DEBUG - level_distance && !(disabled_layers & (UINT32_C(1) << type));
+}
+
+#ifdef FRAMEWORK_LOG_DEFERRED
+
+#define LOG_RECORD_MAX_ARGS 6
+
+// the byte starting a binary record in the log output, which does not occur in the text logs. It is followed by the length
+// of the rest of the record, the log counter (16 bit), the layer, the address of the format string and the arguments, as
+// 32 bit little endian words. tools/log_decoder.py formats the records using the format strings in the ELF file
+#define LOG_RECORD_MARKER 0x1E
+
+typedef struct
+{
+    const char* format;
+    uint16_t counter;
+    uint8_t layer;
+    uint8_t arg_count;
+    uint32_t args[LOG_RECORD_MAX_ARGS];
+} log_record_t;
+
+// the ring keeps one slot free
+static log_record_t NGDEF(_log_records)[FRAMEWORK_LOG_DEFERRED_SIZE + 1];
+#define log_records NG(_log_records)
+
+static spsc_ring_t NGDEF(_log_ring);
+#define log_ring NG(_log_ring)
+
+static bool NGDEF(_log_initialized);
+#define log_initialized NG(_log_initialized)
+
+static inline void put_word(uint8_t* buffer, uint32_t word)
+{
+    buffer[0] = word & 0xFF;
+    buffer[1] = (word >> 8) & 0xFF;
+    buffer[2] = (word >> 16) & 0xFF;
+    buffer[3] = word >> 24;
+}
+
+__LINK_C void log_flush()
+{
+    log_record_t record;
+    uint8_t output[3 + 2 + 4 + (LOG_RECORD_MAX_ARGS * 4)];
+    while(spsc_ring_get(&log_ring, &record) == SUCCESS)
+    {
+        uint8_t length = 0;
+        output[length++] = LOG_RECORD_MARKER;
+        output[length++] = 2 + 1 + 4 + (record.arg_count * 4);
+        output[length++] = record.counter & 0xFF;
+        output[length++] = record.counter >> 8;
+        output[length++] = record.layer;
+        put_word(output + length, (uint32_t)(uintptr_t)record.format); length += 4;
+        for(uint8_t i = 0; i < record.arg_count; i++)
+        {
+            put_word(output + length, record.args[i]);
+            length += 4;
+        }
+
+        fwrite(output, 1, length, stdout);
+    }
+
+    fflush(stdout);
+}
+
+SCHED_REGISTER_TASK(log_flush);
+
+__LINK_C void log_init()
+{
+    spsc_ring_init(&log_ring, log_records, sizeof(log_record_t), FRAMEWORK_LOG_DEFERRED_SIZE + 1);
+    log_initialized = true;
+}
+
+static inline void add_arg(log_record_t* record, uint64_t value, uint8_t size)
+{
+    // the words beyond LOG_RECORD_MAX_ARGS are dropped
+    for(uint8_t i = 0; i < size; i += 4)
+    {
+        if(record->arg_count < LOG_RECORD_MAX_ARGS)
+            record->args[record->arg_count++] = (uint32_t)value;
+
+        value >>= 32;
+    }
+}
+
+// only the sizes of the arguments are taken from the format string, they are formatted by the host
+static void add_args(log_record_t* record, const char* format, va_list args)
+{
+    for(const char* c = format; *c != '\0'; c++)
+    {
+        if(*c != '%')
+            continue;
+
+        c++;
+        while(*c == '-' || *c == '+' || *c == ' ' || *c == '#' || *c == '.' || *c == '*' || (*c >= '0' && *c <= '9'))
+        {
+            if(*c == '*')
+                add_arg(record, va_arg(args, unsigned int), sizeof(unsigned int));
+
+            c++;
+        }
+
+        char length = 0;
+        while(*c == 'h' || *c == 'l' || *c == 'j' || *c == 'z' || *c == 't' || *c == 'L')
+        {
+            length = (length == 'l' && *c == 'l') ? 'q' : *c; // 'q' marks ll
+            c++;
+        }
+
+        switch(*c)
+        {
+        case '\0':
+            return;
+        case '%':
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': ;
+            double d = va_arg(args, double);
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            add_arg(record, bits, sizeof(double));
+            break;
+        case 's': case 'p':
+            add_arg(record, (uintptr_t)va_arg(args, void*), sizeof(void*));
+            break;
+        default:
+            if(length == 'q')
+                add_arg(record, va_arg(args, unsigned long long), sizeof(unsigned long long));
+            else if(length == 'l')
+                add_arg(record, va_arg(args, unsigned long), sizeof(unsigned long));
+            else if(length == 'j')
+                add_arg(record, va_arg(args, uintmax_t), sizeof(uintmax_t));
+            else if(length == 'z')
+                add_arg(record, va_arg(args, size_t), sizeof(size_t));
+            else if(length == 't')
+                add_arg(record, va_arg(args, ptrdiff_t), sizeof(ptrdiff_t));
+            else
+                add_arg(record, va_arg(args, unsigned int), sizeof(unsigned int));
+        }
+    }
+}
+
+#endif // FRAMEWORK_LOG_DEFERRED
+
 __LINK_C void log_print_string(char* format, ...)
 {
     va_list args;
@@ -56,12 +234,48 @@ __LINK_C void log_print_string(char* format, ...)
     va_end(args);
 }
 
+static void print_stack_string(log_stack_layer_t type, char* format, va_list args)
+{
+#ifdef FRAMEWORK_LOG_DEFERRED
+    log_record_t record = { .format = format, .layer = type, .arg_count = 0 };
+    add_args(&record, format, args);
+    if(!log_initialized)
+        return;
+
+    // a dropped record leaves a gap in the counters of the output
+    start_atomic();
+    record.counter = NG(counter)++;
+    bool queued = spsc_ring_put(&log_ring, &record) == SUCCESS;
+    end_atomic();
+    if(queued)
+        sched_post_task_prio(&log_flush, MIN_PRIORITY);
+#else
+    printf("\n\r[%03d] ", NG(counter)++);
+    vprintf(format, args);
+#endif
+}
+
+#if FRAMEWORK_LOG_LEVEL >= LOG_LEVEL_DEBUG
 __LINK_C void log_print_stack_string(log_stack_layer_t type, char* format, ...)
 {
+    if(!log_is_enabled(type, LOG_LEVEL_DEBUG))
+        return;
+
     va_list args;
     va_start(args, format);
-    printf("\n\r[%03d] ", NG(counter)++);
-    vprintf(format, args);
+    print_stack_string(type, format, args);
+    va_end(args);
+}
+#endif
+
+__LINK_C void log_print_stack_level(log_stack_layer_t type, uint8_t level, char* format, ...)
+{
+    if(!log_is_enabled(type, level))
+        return;
+
+    va_list args;
+    va_start(args, format);
+    print_stack_string(type, format, args);
     va_end(args);
 }
 
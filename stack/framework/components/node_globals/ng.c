@@ -18,10 +18,69 @@
 
 #include "ng.h"
 #if defined(NODE_GLOBALS)
-size_t __ng_node_id__ = 0xFFFFFFFF;
+NG_THREAD_LOCAL size_t __ng_node_id__ = 0xFFFFFFFF;
+
+#if defined(NODE_GLOBALS_BLOCKS)
+#include <stdlib.h>
+#include <string.h>
+
+// the blocks start on a cache line, so switching nodes does not share lines between nodes
+#define BLOCK_ALIGNMENT 64
+
+extern char __start_ng_node_globals[];
+extern char __stop_ng_node_globals[];
+
+NG_THREAD_LOCAL uintptr_t __ng_node_offset__ = 0;
+static char* blocks = NULL;
+
+static size_t get_block_size()
+{
+    size_t size = __stop_ng_node_globals - __start_ng_node_globals;
+    return (size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+}
+
+static char* allocate_blocks()
+{
+    size_t size = __stop_ng_node_globals - __start_ng_node_globals;
+    size_t block_size = get_block_size();
+    // never freed, the blocks are used until the simulation exits
+    char* memory = malloc(block_size * __ng_max_nodes__ + BLOCK_ALIGNMENT);
+    assert(memory != NULL);
+    char* allocated = (char*)(((uintptr_t)memory + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT);
+    for(size_t node_id = 0; node_id < __ng_max_nodes__; node_id++)
+        memcpy(allocated + node_id * block_size, __start_ng_node_globals, size);
+
+#if defined(NODE_GLOBALS_TLS)
+    // threads can select their first node at the same time, the first allocation published is used by all of them
+    char* expected = NULL;
+    if(!__atomic_compare_exchange_n(&blocks, &expected, allocated, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        free(memory);
+        return expected;
+    }
+#else
+    blocks = allocated;
+#endif
+    return allocated;
+}
+
+static char* get_blocks()
+{
+#if defined(NODE_GLOBALS_TLS)
+    char* current = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE);
+#else
+    char* current = blocks;
+#endif
+    return current != NULL ? current : allocate_blocks();
+}
+#endif
+
 __LINK_C void set_node_global_id(size_t node_id)
 {
 	assert(node_id < __ng_max_nodes__);
     __ng_node_id__ = node_id;
+#if defined(NODE_GLOBALS_BLOCKS)
+    __ng_node_offset__ = (uintptr_t)(get_blocks() + node_id * get_block_size()) - (uintptr_t)__start_ng_node_globals;
+#endif
 }
 #endif
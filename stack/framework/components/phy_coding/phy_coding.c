@@ -0,0 +1,239 @@
+/*! \file phy_coding.c
+ *
+
+ *  \copyright (C) Copyright 2017 University of Antwerp and others (http://oss-7.cosys.be)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "debug.h"
+#include "crc.h"
+#include "phy_coding.h"
+#include "ramfunc.h"
+
+// the bytes coded per step, each step applies all the stages to its block while it is at hand
+#define BLOCK_SIZE 16
+
+uint16_t phy_calculate_encoded_length(uint8_t stages, uint16_t length)
+{
+    if(stages & PHY_STAGE_FEC)
+        return fec_calculate_encoded_length(length);
+
+    return length;
+}
+
+void phy_encoder_init(phy_encoder_t* encoder, uint8_t stages)
+{
+    encoder->stages = stages;
+    encoder->crc = crc16_init();
+    fec_encoder_init(&encoder->fec);
+    pn9_init(&encoder->pn9);
+}
+
+// the input bytes of a block are read before its output is written
+__HOT_RAMFUNC static uint16_t encode_block(phy_encoder_t* encoder, const uint8_t* data, uint16_t length, uint8_t* output)
+{
+    uint16_t encoded_length = length;
+    if(encoder->stages & PHY_STAGE_FEC)
+        encoded_length = fec_encoder_feed(&encoder->fec, data, length, output);
+    else if(output != data)
+        memmove(output, data, length);
+
+    if(encoder->stages & PHY_STAGE_PN9)
+        pn9_whiten(&encoder->pn9, output, encoded_length);
+
+    return encoded_length;
+}
+
+__HOT_RAMFUNC uint16_t phy_encoder_feed(phy_encoder_t* encoder, const uint8_t* data, uint16_t length, uint8_t* output)
+{
+    uint8_t* start = output;
+    while(length > 0)
+    {
+        uint16_t block_length = length < BLOCK_SIZE ? length : BLOCK_SIZE;
+        if(encoder->stages & PHY_STAGE_CRC)
+            encoder->crc = crc16_update(encoder->crc, data, block_length);
+
+        output += encode_block(encoder, data, block_length, output);
+        data += block_length;
+        length -= block_length;
+    }
+
+    return output - start;
+}
+
+uint16_t phy_encoder_finish(phy_encoder_t* encoder, uint8_t* output)
+{
+    uint8_t* start = output;
+    if(encoder->stages & PHY_STAGE_CRC)
+    {
+        // the CRC is transmitted MSB first
+        uint16_t crc = crc16_final(encoder->crc);
+        uint8_t crc_bytes[2] = { crc >> 8, crc & 0xFF };
+        output += encode_block(encoder, crc_bytes, 2, output);
+    }
+
+    if(encoder->stages & PHY_STAGE_FEC)
+    {
+        uint16_t length = fec_encoder_finish(&encoder->fec, output);
+        if(encoder->stages & PHY_STAGE_PN9)
+            pn9_whiten(&encoder->pn9, output, length);
+
+        output += length;
+    }
+
+    return output - start;
+}
+
+uint16_t phy_encode_frame(uint8_t stages, uint8_t* data, uint16_t length)
+{
+    assert(!(stages & PHY_STAGE_CRC) || length >= 2);
+
+    // as for fec_encode(), the frame is moved to the end of the encoded area first, the encoder writes behind the bytes
+    // it reads then
+    uint16_t encoded_length = phy_calculate_encoded_length(stages, length);
+    uint8_t* input = data + encoded_length - length;
+    if(input != data)
+        memmove(input, data, length);
+
+    phy_encoder_t encoder;
+    phy_encoder_init(&encoder, stages);
+    uint16_t written = phy_encoder_feed(&encoder, input, (stages & PHY_STAGE_CRC) ? length - 2 : length, data);
+    written += phy_encoder_finish(&encoder, data + written);
+    assert(written == encoded_length);
+    return written;
+}
+
+void phy_decoder_init(phy_decoder_t* decoder, uint8_t stages, uint8_t* output, uint16_t frame_length,
+                      uint16_t encoded_length)
+{
+    decoder->stages = stages;
+    decoder->output = output;
+    decoder->frame_length = frame_length;
+    decoder->decoded_length = 0;
+    decoder->crc_length = 0;
+    decoder->crc = crc16_init();
+    pn9_init(&decoder->pn9);
+    if(stages & PHY_STAGE_FEC)
+        fec_decoder_init(&decoder->fec, output, frame_length, encoded_length);
+}
+
+// adds the bytes decoded so far to the CRC, up to the CRC of the frame
+__HOT_RAMFUNC static void update_crc(phy_decoder_t* decoder)
+{
+    if(!(decoder->stages & PHY_STAGE_CRC) || decoder->frame_length < 2)
+        return;
+
+    uint16_t end = decoder->frame_length - 2;
+    if(decoder->decoded_length < end)
+        end = decoder->decoded_length;
+
+    if(end > decoder->crc_length)
+    {
+        decoder->crc = crc16_update(decoder->crc, decoder->output + decoder->crc_length, end - decoder->crc_length);
+        decoder->crc_length = end;
+    }
+}
+
+__HOT_RAMFUNC void phy_decoder_update(phy_decoder_t* decoder, uint16_t available)
+{
+    assert(!(decoder->stages & PHY_STAGE_FEC));
+    if(available > decoder->frame_length)
+        available = decoder->frame_length;
+
+    while(decoder->decoded_length < available)
+    {
+        uint16_t block_length = available - decoder->decoded_length;
+        if(decoder->stages & PHY_STAGE_PN9)
+        {
+            if(block_length > BLOCK_SIZE)
+                block_length = BLOCK_SIZE;
+
+            pn9_whiten(&decoder->pn9, decoder->output + decoder->decoded_length, block_length);
+        }
+
+        decoder->decoded_length += block_length;
+        update_crc(decoder);
+    }
+}
+
+__HOT_RAMFUNC uint16_t phy_decoder_feed(phy_decoder_t* decoder, const uint8_t* data, uint16_t length)
+{
+    if(!(decoder->stages & PHY_STAGE_FEC))
+    {
+        if(length > decoder->frame_length - decoder->decoded_length)
+            length = decoder->frame_length - decoder->decoded_length;
+
+        uint8_t* output = decoder->output + decoder->decoded_length;
+        if(output != data)
+            memmove(output, data, length);
+
+        phy_decoder_update(decoder, decoder->decoded_length + length);
+        return decoder->decoded_length;
+    }
+
+    while(length > 0)
+    {
+        uint8_t block_length = length < BLOCK_SIZE ? length : BLOCK_SIZE;
+        const uint8_t* block = data;
+        uint8_t dewhitened[BLOCK_SIZE];
+        if(decoder->stages & PHY_STAGE_PN9)
+        {
+            memcpy(dewhitened, data, block_length);
+            pn9_whiten(&decoder->pn9, dewhitened, block_length);
+            block = dewhitened;
+        }
+
+        // decoding in place, the decoder reads a block of 4 encoded bytes before writing the (at most 3) decoded bytes
+        decoder->decoded_length = fec_decoder_feed(&decoder->fec, block, block_length);
+        update_crc(decoder);
+        data += block_length;
+        length -= block_length;
+    }
+
+    return decoder->decoded_length;
+}
+
+bool phy_decoder_finish(phy_decoder_t* decoder)
+{
+    if(decoder->stages & PHY_STAGE_FEC)
+    {
+        if(!fec_decoder_finish(&decoder->fec))
+            return false;
+    }
+    else if(decoder->decoded_length < decoder->frame_length)
+        return false;
+
+    if(!(decoder->stages & PHY_STAGE_CRC))
+        return true;
+
+    if(decoder->frame_length < 2 || decoder->crc_length != decoder->frame_length - 2)
+        return false;
+
+    uint16_t crc = crc16_final(decoder->crc);
+    const uint8_t* frame_crc = decoder->output + decoder->crc_length;
+    return frame_crc[0] == (crc >> 8) && frame_crc[1] == (crc & 0xFF);
+}
+
+bool phy_decode_frame(uint8_t stages, uint8_t* data, uint16_t encoded_length, uint16_t frame_length)
+{
+    phy_decoder_t decoder;
+    phy_decoder_init(&decoder, stages, data, frame_length, encoded_length);
+    phy_decoder_feed(&decoder, data, encoded_length);
+    return phy_decoder_finish(&decoder);
+}
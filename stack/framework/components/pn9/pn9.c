@@ -22,32 +22,95 @@
 #include <stdint.h>
 
 #include "pn9.h"
+#include "framework_defs.h"
+#include "ramfunc.h"
 
-void pn9_next(uint16_t *last)
+#ifdef FRAMEWORK_PN9_TABLE
+#define PN9_TABLE_SIZE 255
+#define PN9_STATE_AFTER_TABLE 0x1f0
+
+// the sequence from PN9_INITIALIZER on, frames up to 255 bytes are whitened with a XOR of the table
+static const uint8_t pn9_table[PN9_TABLE_SIZE] __HOT_RAMDATA = {
+    0xff, 0xe1, 0x1d, 0x9a, 0xed, 0x85, 0x33, 0x24, 0xea, 0x7a, 0xd2, 0x39, 0x70, 0x97, 0x57, 0x0a,
+    0x54, 0x7d, 0x2d, 0xd8, 0x6d, 0x0d, 0xba, 0x8f, 0x67, 0x59, 0xc7, 0xa2, 0xbf, 0x34, 0xca, 0x18,
+    0x30, 0x53, 0x93, 0xdf, 0x92, 0xec, 0xa7, 0x15, 0x8a, 0xdc, 0xf4, 0x86, 0x55, 0x4e, 0x18, 0x21,
+    0x40, 0xc4, 0xc4, 0xd5, 0xc6, 0x91, 0x8a, 0xcd, 0xe7, 0xd1, 0x4e, 0x09, 0x32, 0x17, 0xdf, 0x83,
+    0xff, 0xf0, 0x0e, 0xcd, 0xf6, 0xc2, 0x19, 0x12, 0x75, 0x3d, 0xe9, 0x1c, 0xb8, 0xcb, 0x2b, 0x05,
+    0xaa, 0xbe, 0x16, 0xec, 0xb6, 0x06, 0xdd, 0xc7, 0xb3, 0xac, 0x63, 0xd1, 0x5f, 0x1a, 0x65, 0x0c,
+    0x98, 0xa9, 0xc9, 0x6f, 0x49, 0xf6, 0xd3, 0x0a, 0x45, 0x6e, 0x7a, 0xc3, 0x2a, 0x27, 0x8c, 0x10,
+    0x20, 0x62, 0xe2, 0x6a, 0xe3, 0x48, 0xc5, 0xe6, 0xf3, 0x68, 0xa7, 0x04, 0x99, 0x8b, 0xef, 0xc1,
+    0x7f, 0x78, 0x87, 0x66, 0x7b, 0xe1, 0x0c, 0x89, 0xba, 0x9e, 0x74, 0x0e, 0xdc, 0xe5, 0x95, 0x02,
+    0x55, 0x5f, 0x0b, 0x76, 0x5b, 0x83, 0xee, 0xe3, 0x59, 0xd6, 0xb1, 0xe8, 0x2f, 0x8d, 0x32, 0x06,
+    0xcc, 0xd4, 0xe4, 0xb7, 0x24, 0xfb, 0x69, 0x85, 0x22, 0x37, 0xbd, 0x61, 0x95, 0x13, 0x46, 0x08,
+    0x10, 0x31, 0x71, 0xb5, 0x71, 0xa4, 0x62, 0xf3, 0x79, 0xb4, 0x53, 0x82, 0xcc, 0xc5, 0xf7, 0xe0,
+    0x3f, 0xbc, 0x43, 0xb3, 0xbd, 0x70, 0x86, 0x44, 0x5d, 0x4f, 0x3a, 0x07, 0xee, 0xf2, 0x4a, 0x81,
+    0xaa, 0xaf, 0x05, 0xbb, 0xad, 0x41, 0xf7, 0xf1, 0x2c, 0xeb, 0x58, 0xf4, 0x97, 0x46, 0x19, 0x03,
+    0x66, 0x6a, 0xf2, 0x5b, 0x92, 0xfd, 0xb4, 0x42, 0x91, 0x9b, 0xde, 0xb0, 0xca, 0x09, 0x23, 0x04,
+    0x88, 0x98, 0xb8, 0xda, 0x38, 0x52, 0xb1, 0xf9, 0x3c, 0xda, 0x29, 0x41, 0xe6, 0xe2, 0x7b };
+
+__HOT_RAMFUNC static void xor_sequence(uint8_t* data, const uint8_t* sequence, uint16_t length)
 {
-    uint16_t pn9_new;
-    pn9_new =  (((*last & 0x20) >> 5) ^ *last) << 8;
-    pn9_new |= (*last >> 1) & 0xff;
-    *last = pn9_new & 0x1ff;
+    // 32 bit at a time, the (builtin) memcpy compiles to unaligned loads and stores on the Cortex-M3/M4
+    for(; length >= 4; length -= 4, data += 4, sequence += 4)
+    {
+        uint32_t word, key;
+        __builtin_memcpy(&word, data, 4);
+        __builtin_memcpy(&key, sequence, 4);
+        word ^= key;
+        __builtin_memcpy(data, &word, 4);
+    }
+
+    for(; length > 0; length--)
+        *data++ ^= *sequence++;
 }
+#endif
 
-uint16_t pn9_generator(uint16_t *pn9)
+/*
+ * The LFSR (x^9 + x^5 + 1) advanced by 8 steps at once. Each step shifts right and feeds bit 0 ^ bit 5 into bit 8, so the
+ * 4 first feedback bits only depend on the current state and the 4 next ones on these.
+ */
+static inline uint16_t next_byte(uint16_t lfsr)
 {
-    int i;
+    uint16_t low = (lfsr ^ (lfsr >> 5)) & 0x0F;
+    uint16_t high = ((lfsr >> 4) ^ low) & 0x0F;
+    return (lfsr >> 8) | (low << 1) | (high << 5);
+}
 
-    for (i=0; i<8; i++) {
-        pn9_next(pn9);
-    }
-    return *pn9;
+void pn9_init(pn9_t* pn9)
+{
+    pn9->lfsr = PN9_INITIALIZER;
+    pn9->position = 0;
 }
 
-void pn9_encode(uint8_t *data, uint8_t length)
+__HOT_RAMFUNC void pn9_whiten(pn9_t* pn9, uint8_t* data, uint16_t length)
 {
-    uint16_t pn9 = PN9_INITIALIZER; //// LFSR initialised to the specified polynomial
-    uint8_t *p = data;
+#ifdef FRAMEWORK_PN9_TABLE
+    if(pn9->position < PN9_TABLE_SIZE)
+    {
+        uint16_t table_length = PN9_TABLE_SIZE - pn9->position;
+        if(table_length > length)
+            table_length = length;
+
+        xor_sequence(data, pn9_table + pn9->position, table_length);
+        pn9->position += table_length;
+        data += table_length;
+        length -= table_length;
+        if(pn9->position == PN9_TABLE_SIZE)
+            pn9->lfsr = PN9_STATE_AFTER_TABLE;
+    }
+#endif
 
-    for (; p < data + length; p++) {
-        *p ^= pn9;
-        pn9_generator(&pn9);
+    for(; length > 0; length--)
+    {
+        *data++ ^= pn9->lfsr;
+        pn9->lfsr = next_byte(pn9->lfsr);
+        pn9->position++;
     }
 }
+
+void pn9_encode(uint8_t *data, uint8_t length)
+{
+    pn9_t pn9;
+    pn9_init(&pn9);
+    pn9_whiten(&pn9, data, length);
+}
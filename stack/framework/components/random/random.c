@@ -18,14 +18,55 @@
 
 #include "random.h"
 #include "types.h"
-#include <stdlib.h>
+#include "ng.h"
+
+/*
+ * xoroshiro64** instead of the rand() of the C library: it only uses 32 bit operations, its low bits are as good as
+ * its high bits (the slot selections take the random number modulo a small count) and its state is a node global, so
+ * every simulated node has its own sequence.
+ */
+static uint32_t NGDEF(_rng_state)[2] = { 0x9E3779B9, 0x7F4A7C15 };
+#define rng_state NG(_rng_state)
+
+static inline uint32_t rotl(uint32_t value, uint8_t shift)
+{
+    return (value << shift) | (value >> (32 - shift));
+}
+
+// the 32 bit finalizer of MurmurHash3, spreads every bit of the seed or entropy over the whole state word
+static uint32_t mix(uint32_t value)
+{
+    value ^= value >> 16;
+    value *= 0x85EBCA6B;
+    value ^= value >> 13;
+    value *= 0xC2B2AE35;
+    value ^= value >> 16;
+    return value;
+}
 
 __LINK_C uint32_t get_rnd()
 {
-    return (uint32_t) rand();
+    uint32_t s0 = rng_state[0];
+    uint32_t s1 = rng_state[1] ^ s0;
+    uint32_t result = rotl(s0 * 0x9E3779BB, 5) * 5;
+    rng_state[0] = rotl(s0, 26) ^ s1 ^ (s1 << 9);
+    rng_state[1] = rotl(s1, 13);
+    return result;
+}
+
+__LINK_C void set_rng_seed(uint64_t seed)
+{
+    rng_state[0] = mix((uint32_t) seed ^ 0x9E3779B9);
+    rng_state[1] = mix((uint32_t)(seed >> 32) ^ 0x7F4A7C15);
+    if (rng_state[0] == 0 && rng_state[1] == 0)
+        rng_state[1] = 1; // the all zero state only generates zeros
 }
 
-__LINK_C void set_rng_seed(unsigned int seed)
+__LINK_C void add_rng_entropy(uint32_t entropy)
 {
-    srand(seed);
+    rng_state[1] ^= mix(entropy);
+    if (rng_state[0] == 0 && rng_state[1] == 0)
+        rng_state[1] = 1;
+
+    get_rnd();
 }
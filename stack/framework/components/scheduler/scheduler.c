@@ -33,20 +33,37 @@
 #include "hwatomic.h"
 #include "ng.h"
 #include "hwsystem.h"
+#include "hwdebug.h"
+#include "energy.h"
 
 #include "framework_defs.h"
+#include "ramfunc.h"
+
+#if defined(FRAMEWORK_SCHEDULER_PROFILING_ENABLED) || defined(FRAMEWORK_SCHEDULER_LP_MODE_DYNAMIC) \
+	|| FRAMEWORK_SCHEDULER_LIVENESS_CHECKS > 0 || defined(FRAMEWORK_SCHEDULER_DEADLINES_ENABLED)
+#include "timer.h"
+#endif
+
+#if FRAMEWORK_SCHEDULER_LIVENESS_CHECKS > 0
+#include "hwwatchdog.h"
+#endif
+
 #define SCHEDULER_MAX_TASKS FRAMEWORK_SCHEDULER_MAX_TASKS
+#define SCHEDULER_MAX_DEFERRED_CALLS FRAMEWORK_SCHEDULER_MAX_DEFERRED_CALLS
 
-#ifdef NODE_GLOBALS
-    #warning NODE_GLOBALS is defined when using the default scheduler. Are you sure this is what you want ?
+#if SCHEDULER_MAX_TASKS + SCHEDULER_MAX_DEFERRED_CALLS >= 255
+    #error The scheduler supports at most 254 tasks and deferred calls combined
 #endif
 
 enum
 {
 	NUM_PRIORITIES = MIN_PRIORITY+1,
 	NUM_TASKS = SCHEDULER_MAX_TASKS,
+	NUM_CALLS = SCHEDULER_MAX_DEFERRED_CALLS,
+	//entries [0, NUM_TASKS) are registered tasks, entries [NUM_TASKS, NUM_ENTRIES) are deferred calls
+	NUM_ENTRIES = NUM_TASKS + NUM_CALLS,
 	NOT_SCHEDULED = NUM_PRIORITIES,
-	NO_TASK = SCHEDULER_MAX_TASKS,
+	NO_TASK = NUM_ENTRIES,
 };
 
 typedef struct
@@ -65,20 +82,180 @@ typedef struct
 	uint8_t index;
 } taskindex_info_t;
 
+typedef struct
+{
+	deferred_call_t call;
+	void* arg;
+} call_info_t;
+
 taskindex_info_t NGDEF(m_index)[NUM_TASKS];
-task_info_t NGDEF(m_info)[NUM_TASKS];
+//deferred calls are queued in the same priority lists as tasks, so both run in FIFO order
+task_info_t NGDEF(m_info)[NUM_ENTRIES];
+call_info_t NGDEF(m_calls)[NUM_CALLS];
+//the unused deferred call entries, linked through task_info_t.next
+uint8_t NGDEF(m_free_call);
 
 uint8_t NGDEF(m_head)[NUM_PRIORITIES];
 uint8_t NGDEF(m_tail)[NUM_PRIORITIES];
-volatile uint8_t NGDEF(current_priority);
+//bitmask of the priorities that have tasks waiting. Priority p is stored in bit (31 - p)
+//so the highest priority with waiting tasks is found with a single count leading zeros
+volatile uint32_t NGDEF(m_ready_mask);
+#define PRIORITY_MASK(priority) (UINT32_C(0x80000000) >> (priority))
+//the tasks posted by sched_post_handle_from_isr(), a bitset of the task handles per priority. The bits are only set
+//and taken with atomic_set_bits() / atomic_clear_bits(), the tasks are appended to the priority lists by pop_task()
+#define ISR_POST_WORDS ((NUM_TASKS + 31) / 32)
+volatile uint32_t NGDEF(m_isr_posts)[NUM_PRIORITIES][ISR_POST_WORDS];
+//the priorities with bits set in m_isr_posts, set after the bit of the task and taken before the bits of the tasks
+volatile uint32_t NGDEF(m_isr_post_mask);
 unsigned int NGDEF(num_registered_tasks);
+pool_stats_t NGDEF(m_call_stats);
+uint8_t NGDEF(low_power_mode);
+
+#ifdef FRAMEWORK_SCHEDULER_PROFILING_ENABLED
+sched_task_profile_t NGDEF(m_profile)[NUM_TASKS];
+uint32_t NGDEF(m_posted_at)[NUM_TASKS];
+
+static void profile_post(uint8_t id, error_t result)
+{
+	if(id >= NUM_TASKS)
+		return;
+
+	if(result == SUCCESS)
+		NG(m_posted_at)[id] = timer_get_counter_value();
+	else if(result == EALREADY)
+		NG(m_profile)[id].already_posted_count++;
+}
+
+static void profile_run(uint8_t id)
+{
+	uint32_t start = timer_get_counter_value();
+	uint32_t latency = start - NG(m_posted_at)[id];
+
+	NG(m_info)[id].task();
+
+	uint32_t run_ticks = timer_get_counter_value() - start;
+	sched_task_profile_t* profile = &NG(m_profile)[id];
+	profile->invocation_count++;
+	profile->total_run_ticks += run_ticks;
+	if(run_ticks > profile->max_run_ticks)
+		profile->max_run_ticks = run_ticks;
+
+	profile->total_latency_ticks += latency;
+	if(latency > profile->max_latency_ticks)
+		profile->max_latency_ticks = latency;
+}
+#else
+static inline void profile_post(uint8_t id, error_t result){}
+#endif
+#ifdef FRAMEWORK_SCHEDULER_DEADLINES_ENABLED
+//the tasks posted with a deadline are at the head of the list of their priority, in order of deadline. This is the
+//last of them, NO_TASK when there is none
+uint8_t NGDEF(m_deadline_tail)[NUM_PRIORITIES];
+uint32_t NGDEF(m_deadline)[NUM_TASKS];
+uint32_t NGDEF(m_deadline_miss_count);
+
+//this function should only be called from an atomic context, the task is taken from the head of the list
+static void pop_deadline(uint8_t id, uint8_t priority)
+{
+	if(NG(m_deadline_tail)[priority] == NO_TASK)
+		return;
+
+	if(NG(m_deadline_tail)[priority] == id)
+		NG(m_deadline_tail)[priority] = NO_TASK;
+
+	if((int32_t)(timer_get_counter_value() - NG(m_deadline)[id]) > 0)
+		NG(m_deadline_miss_count)++;
+}
+
+//this function should only be called from an atomic context, before the task is unlinked
+static void cancel_deadline(uint8_t id)
+{
+	if(NG(m_deadline_tail)[NG(m_info)[id].priority] == id)
+		NG(m_deadline_tail)[NG(m_info)[id].priority] = NG(m_info)[id].prev;
+}
+#else
+static inline void pop_deadline(uint8_t id, uint8_t priority){}
+static inline void cancel_deadline(uint8_t id){}
+#endif
+#ifdef FRAMEWORK_SCHEDULER_STACK_WATERMARK_ENABLED
+#define STACK_PAINT UINT32_C(0xCDCDCDCD)
+//the words just below the frame of scheduler_init() which are not painted, for the calls it still makes
+#define STACK_PAINT_MARGIN 16
+
+uint32_t* NGDEF(m_stack_limit);
+uint32_t* NGDEF(m_stack_top);
+//the deepest word of the stack found overwritten so far, the words below it are still painted
+uint32_t* NGDEF(m_stack_watermark);
+uint8_t NGDEF(m_stack_max_used_task);
+//the used bytes of the stack when a task moved the watermark deeper for the last time
+uint16_t NGDEF(m_stack_max_used)[NUM_TASKS];
+
+static void paint_stack()
+{
+	hw_get_stack_region(&NG(m_stack_limit), &NG(m_stack_top));
+	uint32_t marker;
+	uint32_t* end = &marker - STACK_PAINT_MARGIN;
+	for(uint32_t* word = NG(m_stack_limit); word < end; word++)
+		*word = STACK_PAINT;
+
+	NG(m_stack_watermark) = end;
+	NG(m_stack_max_used_task) = SCHED_NO_TASK_HANDLE;
+	memset(NG(m_stack_max_used), 0, sizeof(NG(m_stack_max_used)));
+}
+
+//the stack is searched from its limit, as a function may leave the top of its frame untouched. Only the
+//words below the watermark are read, so this costs one read per unused word of the stack
+static void sample_stack(uint8_t id)
+{
+	uint32_t* word = NG(m_stack_limit);
+	while(word < NG(m_stack_watermark) && *word == STACK_PAINT)
+		word++;
+
+	if(word == NG(m_stack_watermark))
+		return;
+
+	NG(m_stack_watermark) = word;
+	NG(m_stack_max_used_task) = (id < NUM_TASKS) ? id : SCHED_NO_TASK_HANDLE;
+	if(id < NUM_TASKS)
+		NG(m_stack_max_used)[id] = (NG(m_stack_top) - word) * sizeof(uint32_t);
+}
+#else
+static inline void paint_stack(){}
+static inline void sample_stack(uint8_t id){}
+#endif
+#if FRAMEWORK_SCHEDULER_LIVENESS_CHECKS > 0
+typedef struct
+{
+	timer_tick_t deadline;
+	volatile timer_tick_t last_check_in;
+} liveness_check_t;
+
+liveness_check_t NGDEF(m_liveness_checks)[FRAMEWORK_SCHEDULER_LIVENESS_CHECKS];
+uint8_t NGDEF(m_liveness_check_count);
+
+// only feeds the watchdog when none of the checks missed its deadline, a task missing its check in keeps it
+// from being fed from then on
+static void feed_watchdog()
+{
+	timer_tick_t now = timer_get_counter_value();
+	for(uint8_t i = 0; i < NG(m_liveness_check_count); i++)
+	{
+		if(now - NG(m_liveness_checks)[i].last_check_in > NG(m_liveness_checks)[i].deadline)
+			return;
+	}
+
+	hw_watchdog_feed();
+}
+#else
+static inline void feed_watchdog(){}
+#endif
 #ifdef SCHEDULER_DEBUG
 void check_structs_are_valid()
 {
 	start_atomic();
 	assert(NG(num_registered_tasks) <= NUM_TASKS);
-	bool visited[NUM_TASKS];
-	memset(visited, false, NUM_TASKS);
+	bool visited[NUM_ENTRIES];
+	memset(visited, false, NUM_ENTRIES);
 	for(int i = 0; i < NG(num_registered_tasks); i++)
 	{
 		assert(NG(m_index)[i].task != 0x0);
@@ -97,13 +274,16 @@ void check_structs_are_valid()
 		assert(visited[i] || NG(m_info)[i].task == 0x0);
 
 
-	memset(visited, false, NUM_TASKS);
+	memset(visited, false, NUM_ENTRIES);
 	for(int prio = 0; prio < NUM_PRIORITIES;prio++)
 	{
 		uint8_t prev_ind=NO_TASK;
+#ifdef FRAMEWORK_SCHEDULER_DEADLINES_ENABLED
+		bool in_deadlines = NG(m_deadline_tail)[prio] != NO_TASK;
+#endif
 		for(uint8_t cur_ind = NG(m_head)[prio]; cur_ind != NO_TASK; cur_ind = NG(m_info)[cur_ind].next)
 		{
-			assert(cur_ind < NUM_TASKS);
+			assert(cur_ind < NUM_ENTRIES);
 			assert(!visited[cur_ind]);
 			visited[cur_ind] = true;
 			assert(NG(m_info)[cur_ind].prev == prev_ind);
@@ -113,26 +293,72 @@ void check_structs_are_valid()
 			else
 				assert(NG(m_head)[prio] == cur_ind);
 
-			assert(NG(m_info)[cur_ind].task != 0x0);
+			if(cur_ind < NUM_TASKS)
+				assert(NG(m_info)[cur_ind].task != 0x0);
+			else
+				assert(NG(m_calls)[cur_ind - NUM_TASKS].call != 0x0);
 			assert(NG(m_info)[cur_ind].priority == prio);
+#ifdef FRAMEWORK_SCHEDULER_DEADLINES_ENABLED
+			if(in_deadlines)
+			{
+				assert(cur_ind < NUM_TASKS);
+				if(prev_ind != NO_TASK)
+					assert((int32_t)(NG(m_deadline)[cur_ind] - NG(m_deadline)[prev_ind]) >= 0);
+				in_deadlines = cur_ind != NG(m_deadline_tail)[prio];
+			}
+#endif
 			prev_ind=cur_ind;
 		}
 		assert(NG(m_tail)[prio] == prev_ind);
+#ifdef FRAMEWORK_SCHEDULER_DEADLINES_ENABLED
+		assert(!in_deadlines);
+#endif
 	}
-	for(int i = 0; i < NUM_TASKS; i++)
+	for(int i = 0; i < NUM_ENTRIES; i++)
 	{
 		assert((visited[i]) || NG(m_info)[i].priority == NOT_SCHEDULED);
 	}
+	for(uint8_t cur_ind = NG(m_free_call); cur_ind != NO_TASK; cur_ind = NG(m_info)[cur_ind].next)
+	{
+		assert(cur_ind >= NUM_TASKS && cur_ind < NUM_ENTRIES);
+		assert(!visited[cur_ind]);
+		visited[cur_ind] = true;
+	}
+	for(int i = NUM_TASKS; i < NUM_ENTRIES; i++)
+		assert(visited[i]);
 
-	assert(NG(current_priority) <= NUM_PRIORITIES);
-	for(int i = 0; i < NG(current_priority); i++)
-		assert(NG(m_head)[i] == NO_TASK);
+	for(int i = 0; i < NUM_PRIORITIES; i++)
+		assert(((NG(m_ready_mask) & PRIORITY_MASK(i)) != 0) == (NG(m_head)[i] != NO_TASK));
 	//INT_Enable();
 	end_atomic();
 }
 #else
 static inline void check_structs_are_valid(){}
 #endif
+//the tasks of SCHED_REGISTER_TASK() take the first handles, in the order of the table. The index is sorted once, the
+//interrupts are not enabled yet
+static void register_static_tasks()
+{
+	unsigned int count = __stop_sched_tasks - __start_sched_tasks;
+	assert(count <= NUM_TASKS);
+	for(unsigned int id = 0; id < count; id++)
+	{
+		task_t task = __start_sched_tasks[id].task;
+		NG(m_info)[id].task = task;
+		int i = id;
+		for(; i > 0 && ((void*)task) < ((void*)NG(m_index)[i - 1].task); i--)
+			NG(m_index)[i] = NG(m_index)[i - 1];
+
+		assert(i == 0 || NG(m_index)[i - 1].task != task);
+		NG(m_index)[i].task = task;
+		NG(m_index)[i].index = id;
+	}
+	NG(num_registered_tasks) = count;
+#ifdef FRAMEWORK_SCHEDULER_PROFILING_ENABLED
+	memset(NG(m_profile), 0, sizeof(NG(m_profile)));
+#endif
+}
+
 __LINK_C void scheduler_init()
 {
 	for(unsigned int i = 0; i < NUM_TASKS; i++)
@@ -145,10 +371,34 @@ __LINK_C void scheduler_init()
 		NG(m_index)[i].index = NO_TASK;
 		NG(m_index)[i].task = 0x0;
 	}
+	for(unsigned int i = NUM_TASKS; i < NUM_ENTRIES; i++)
+	{
+		NG(m_info)[i].next = (i + 1 < NUM_ENTRIES) ? i + 1 : NO_TASK;
+		NG(m_info)[i].prev = NO_TASK;
+		NG(m_info)[i].task = 0x0;
+		NG(m_info)[i].priority = NOT_SCHEDULED;
+
+		NG(m_calls)[i - NUM_TASKS].call = 0x0;
+		NG(m_calls)[i - NUM_TASKS].arg = NULL;
+	}
+	NG(m_free_call) = (NUM_CALLS > 0) ? NUM_TASKS : NO_TASK;
 	memset(NG(m_head), NO_TASK, sizeof(NG(m_head)));
 	memset(NG(m_tail), NO_TASK, sizeof(NG(m_tail)));
-	NG(current_priority) = NUM_PRIORITIES;
+	NG(m_ready_mask) = 0;
+	memset((void*) NG(m_isr_posts), 0, sizeof(NG(m_isr_posts)));
+	NG(m_isr_post_mask) = 0;
 	NG(num_registered_tasks) = 0;
+	pool_stats_init(&NG(m_call_stats), NUM_CALLS);
+	NG(low_power_mode) = FRAMEWORK_SCHEDULER_LP_MODE;
+#ifdef FRAMEWORK_SCHEDULER_DEADLINES_ENABLED
+	memset(NG(m_deadline_tail), NO_TASK, sizeof(NG(m_deadline_tail)));
+	NG(m_deadline_miss_count) = 0;
+#endif
+#if FRAMEWORK_SCHEDULER_LIVENESS_CHECKS > 0
+	NG(m_liveness_check_count) = 0;
+#endif
+	paint_stack();
+	register_static_tasks();
 	check_structs_are_valid();
 }
 
@@ -177,9 +427,9 @@ __LINK_C uint8_t get_task_id(task_t task)
 	return NO_TASK;
 }
 
-__LINK_C error_t sched_register_task(task_t task)
+__LINK_C error_t sched_register_task_handle(task_t task, task_handle_t* handle)
 {
-    assert(NG(num_registered_tasks) <= NUM_TASKS);
+    assert(NG(num_registered_tasks) < NUM_TASKS);
     assert(get_task_id(task) == NO_TASK);
 	error_t retVal;
 	check_structs_are_valid();
@@ -200,6 +450,12 @@ __LINK_C error_t sched_register_task(task_t task)
             NG(m_index)[i] = NG(m_index)[i-1];
         }
     }
+#ifdef FRAMEWORK_SCHEDULER_PROFILING_ENABLED
+    memset(&NG(m_profile)[NG(num_registered_tasks)], 0, sizeof(sched_task_profile_t));
+#endif
+    //the index in m_info never changes once assigned, so it can be handed out as the task handle
+    if(handle != NULL)
+        *handle = NG(num_registered_tasks);
     NG(num_registered_tasks)++;
     retVal = SUCCESS;
 
@@ -209,6 +465,29 @@ __LINK_C error_t sched_register_task(task_t task)
 	return retVal;
 }
 
+__LINK_C error_t sched_register_task(task_t task)
+{
+	return sched_register_task_handle(task, NULL);
+}
+
+__LINK_C error_t sched_get_task_handle(task_t task, task_handle_t* handle)
+{
+	error_t retVal = SUCCESS;
+	start_atomic();
+	uint8_t task_id = get_task_id(task);
+	if(task_id == NO_TASK)
+		retVal = EINVAL;
+	else
+		*handle = task_id;
+	end_atomic();
+	return retVal;
+}
+
+static inline bool is_valid_handle(task_handle_t handle)
+{
+	return handle < NG(num_registered_tasks);
+}
+
 static inline bool is_scheduled(uint8_t id)
 {
 	assert(id < NUM_TASKS);
@@ -229,43 +508,273 @@ __LINK_C bool sched_is_scheduled(task_t task)
 	return retVal;
 }
 
+static inline uint32_t isr_post_bit(uint8_t id)
+{
+	return UINT32_C(1) << (id % 32);
+}
+
+static bool is_posted_from_isr(uint8_t id)
+{
+	for(uint8_t priority = 0; priority < NUM_PRIORITIES; priority++)
+		if(NG(m_isr_posts)[priority][id / 32] & isr_post_bit(id))
+			return true;
+
+	return false;
+}
+
+__LINK_C bool sched_is_handle_scheduled(task_handle_t handle)
+{
+	if(!is_valid_handle(handle))
+		return false;
+
+	return NG(m_info)[handle].priority != NOT_SCHEDULED || is_posted_from_isr(handle);
+}
+
+//this function should only be called from an atomic context
+static void append_entry(uint8_t id, uint8_t priority)
+{
+	if(NG(m_head)[priority] == NO_TASK)
+	{
+		NG(m_head)[priority] = id;
+		NG(m_tail)[priority] = id;
+		NG(m_ready_mask) |= PRIORITY_MASK(priority);
+	}
+	else
+	{
+		NG(m_info)[NG(m_tail)[priority]].next = id;
+		NG(m_info)[id].prev = NG(m_tail)[priority];
+		NG(m_tail)[priority] = id;
+	}
+	NG(m_info)[id].priority = priority;
+}
+
+//this function should only be called from an atomic context
+static error_t post_task_id(uint8_t task_id, uint8_t priority)
+{
+	if(priority > MIN_PRIORITY || priority < MAX_PRIORITY)
+		return ESIZE;
+	else if (is_scheduled(task_id))
+		return EALREADY;
+
+	append_entry(task_id, priority);
+	check_structs_are_valid();
+	return SUCCESS;
+}
+
 __LINK_C error_t sched_post_task_prio(task_t task, uint8_t priority)
 {
 	error_t retVal;
 	start_atomic();
 	check_structs_are_valid();
 	uint8_t task_id = get_task_id(task);
+	if(task_id == NO_TASK)
+		retVal = EINVAL;
+	else
+		retVal = post_task_id(task_id, priority);
+	profile_post(task_id, retVal);
+	end_atomic();
+	check_structs_are_valid();
+	return retVal;
+}
+
+#ifdef FRAMEWORK_SCHEDULER_DEADLINES_ENABLED
+//this function should only be called from an atomic context
+static void insert_deadline_entry(uint8_t id, uint8_t priority, uint32_t deadline)
+{
+	//after the tasks with the same or an earlier deadline, before the tasks posted without one
+	uint8_t last = NG(m_deadline_tail)[priority];
+	uint8_t prev = NO_TASK;
+	uint8_t next = NG(m_head)[priority];
+	while(prev != last && (int32_t)(NG(m_deadline)[next] - deadline) <= 0)
+	{
+		prev = next;
+		next = NG(m_info)[next].next;
+	}
+
+	NG(m_info)[id].prev = prev;
+	NG(m_info)[id].next = next;
+	if(prev == NO_TASK)
+		NG(m_head)[priority] = id;
+	else
+		NG(m_info)[prev].next = id;
+
+	if(next == NO_TASK)
+		NG(m_tail)[priority] = id;
+	else
+		NG(m_info)[next].prev = id;
+
+	if(prev == last)
+		NG(m_deadline_tail)[priority] = id;
+
+	NG(m_deadline)[id] = deadline;
+	NG(m_info)[id].priority = priority;
+	NG(m_ready_mask) |= PRIORITY_MASK(priority);
+}
+
+__LINK_C error_t sched_post_task_deadline_prio(task_t task, uint32_t deadline, uint8_t priority)
+{
+	error_t retVal = SUCCESS;
+	start_atomic();
+	uint8_t task_id = get_task_id(task);
 	if(task_id == NO_TASK)
 		retVal = EINVAL;
 	else if(priority > MIN_PRIORITY || priority < MAX_PRIORITY)
 		retVal = ESIZE;
-	else if (is_scheduled(task_id))
+	else if(is_scheduled(task_id))
 		retVal = EALREADY;
 	else
+		insert_deadline_entry(task_id, priority, deadline);
+	profile_post(task_id, retVal);
+	end_atomic();
+	check_structs_are_valid();
+	return retVal;
+}
+
+__LINK_C uint32_t sched_get_deadline_miss_count()
+{
+	return NG(m_deadline_miss_count);
+}
+
+__LINK_C void sched_reset_deadline_miss_count()
+{
+	NG(m_deadline_miss_count) = 0;
+}
+#endif
+
+__LINK_C error_t sched_post_handle_prio(task_handle_t handle, uint8_t priority)
+{
+	if(!is_valid_handle(handle))
+		return EINVAL;
+
+	start_atomic();
+	error_t retVal = post_task_id(handle, priority);
+	profile_post(handle, retVal);
+	end_atomic();
+	return retVal;
+}
+
+__LINK_C error_t sched_post_handle_from_isr(task_handle_t handle, uint8_t priority)
+{
+	if(!is_valid_handle(handle))
+		return EINVAL;
+	else if(priority > MIN_PRIORITY || priority < MAX_PRIORITY)
+		return ESIZE;
+	else if(NG(m_info)[handle].priority != NOT_SCHEDULED)
+		return EALREADY;
+
+	if(atomic_set_bits(&NG(m_isr_posts)[priority][handle / 32], isr_post_bit(handle)) & isr_post_bit(handle))
+		return EALREADY;
+
+	atomic_set_bits(&NG(m_isr_post_mask), PRIORITY_MASK(priority));
+	return SUCCESS;
+}
+
+//this function should only be called from an atomic context
+__HOT_RAMFUNC static void append_isr_posts()
+{
+	uint32_t priorities = atomic_clear_bits(&NG(m_isr_post_mask), UINT32_MAX);
+	while(priorities != 0)
 	{
-		if(NG(m_head)[priority] == NO_TASK)
+		uint8_t priority = __builtin_clz(priorities);
+		priorities &= ~PRIORITY_MASK(priority);
+		for(uint8_t word = 0; word < ISR_POST_WORDS; word++)
 		{
-			NG(m_head)[priority] = task_id;
-			NG(m_tail)[priority] = task_id;
-		}
-		else
-		{
-			NG(m_info)[NG(m_tail)[priority]].next = task_id;
-			NG(m_info)[task_id].prev = NG(m_tail)[priority];
-			NG(m_tail)[priority] = task_id;
+			uint32_t bits = atomic_clear_bits(&NG(m_isr_posts)[priority][word], UINT32_MAX);
+			while(bits != 0)
+			{
+				uint8_t id = word * 32 + __builtin_ctz(bits);
+				bits &= bits - 1;
+				error_t result = post_task_id(id, priority);
+				profile_post(id, result);
+			}
 		}
-		NG(m_info)[task_id].priority = priority;
-		//if our priority is higher than the currently known maximum priority
-		if((priority < NG(current_priority)))
-			NG(current_priority) = priority;
+	}
+}
+
+//this function should only be called from an atomic context, returns whether the task was posted from an interrupt
+static bool cancel_isr_posts(uint8_t id)
+{
+	bool cancelled = false;
+	for(uint8_t priority = 0; priority < NUM_PRIORITIES; priority++)
+		if(atomic_clear_bits(&NG(m_isr_posts)[priority][id / 32], isr_post_bit(id)) & isr_post_bit(id))
+			cancelled = true;
+
+	return cancelled;
+}
+
+__LINK_C error_t sched_post_call(deferred_call_t call, void* arg, uint8_t priority)
+{
+	if(call == 0x0)
+		return EINVAL;
+	else if(priority > MIN_PRIORITY || priority < MAX_PRIORITY)
+		return ESIZE;
+
+	error_t retVal = SUCCESS;
+	start_atomic();
+	uint8_t id = NG(m_free_call);
+	if(id == NO_TASK)
+	{
+		retVal = ENOMEM;
+		pool_stats_alloc_failed(&NG(m_call_stats));
+	}
+	else
+	{
+		pool_stats_alloc(&NG(m_call_stats));
+		NG(m_free_call) = NG(m_info)[id].next;
+		NG(m_info)[id].next = NO_TASK;
+		NG(m_calls)[id - NUM_TASKS].call = call;
+		NG(m_calls)[id - NUM_TASKS].arg = arg;
+		append_entry(id, priority);
 		check_structs_are_valid();
-		retVal = SUCCESS;
 	}
 	end_atomic();
-	check_structs_are_valid();
 	return retVal;
 }
 
+static void run_job_step(void* arg)
+{
+	sched_job_t* job = (sched_job_t*) arg;
+	//the entry of this call was released before it started, so the next step finds a free one
+	if(job->step(job->state))
+		assert(sched_post_call(&run_job_step, job, job->priority) == SUCCESS);
+}
+
+__LINK_C error_t sched_post_job(sched_job_t* job, uint8_t priority)
+{
+	assert(job->step != 0x0);
+	job->priority = priority;
+	return sched_post_call(&run_job_step, job, priority);
+}
+
+//this function should only be called from an atomic context
+static error_t cancel_task_id(uint8_t id)
+{
+	bool cancelled = cancel_isr_posts(id);
+	if(!is_scheduled(id))
+		return cancelled ? SUCCESS : EALREADY;
+
+	cancel_deadline(id);
+	if (NG(m_info)[id].prev == NO_TASK)
+	{
+		NG(m_head)[NG(m_info)[id].priority] = NG(m_info)[id].next;
+		if(NG(m_info)[id].next == NO_TASK)
+			NG(m_ready_mask) &= ~PRIORITY_MASK(NG(m_info)[id].priority);
+	}
+	else
+		NG(m_info)[NG(m_info)[id].prev].next = NG(m_info)[id].next;
+
+	if (NG(m_info)[id].next == NO_TASK)
+		NG(m_tail)[NG(m_info)[id].priority] = NG(m_info)[id].prev;
+	else
+		NG(m_info)[NG(m_info)[id].next].prev = NG(m_info)[id].prev;
+
+	NG(m_info)[id].prev = NO_TASK;
+	NG(m_info)[id].next = NO_TASK;
+	NG(m_info)[id].priority = NOT_SCHEDULED;
+	check_structs_are_valid();
+	return SUCCESS;
+}
+
 __LINK_C error_t sched_cancel_task(task_t task)
 {
 	check_structs_are_valid();
@@ -275,92 +784,228 @@ __LINK_C error_t sched_cancel_task(task_t task)
 	uint8_t id = get_task_id(task);
 	if(id == NO_TASK)
 		retVal = EINVAL;
-	else if(!is_scheduled(id))
-		retVal = EALREADY;
 	else
-	{
-		if (NG(m_info)[id].prev == NO_TASK)
-			NG(m_head)[NG(m_info)[id].priority] = NG(m_info)[id].next;
-		else
-			NG(m_info)[NG(m_info)[id].prev].next = NG(m_info)[id].next;
+		retVal = cancel_task_id(id);
+	end_atomic();
+	return retVal;
+}
 
-		if (NG(m_info)[id].next == NO_TASK)
-			NG(m_tail)[NG(m_info)[id].priority] = NG(m_info)[id].prev;
-		else
-			NG(m_info)[NG(m_info)[id].next].prev = NG(m_info)[id].prev;
+__LINK_C error_t sched_cancel_handle(task_handle_t handle)
+{
+	if(!is_valid_handle(handle))
+		return EINVAL;
 
-		NG(m_info)[id].prev = NO_TASK;
-		NG(m_info)[id].next = NO_TASK;
-		NG(m_info)[id].priority = NOT_SCHEDULED;
-		check_structs_are_valid();
-		retVal = SUCCESS;
-	}
+	start_atomic();
+	error_t retVal = cancel_task_id(handle);
 	end_atomic();
 	return retVal;
 }
 
-static uint8_t pop_task(int priority)
+__HOT_RAMFUNC static uint8_t pop_task(call_info_t* call)
 {
 	uint8_t id = NO_TASK;
 	check_structs_are_valid();
 	start_atomic();
-	if (NG(m_head)[priority] != NO_TASK)
+	if(NG(m_isr_post_mask) != 0)
+		append_isr_posts();
+
+	if (NG(m_ready_mask) != 0)
 	{
+		//the highest priority with waiting tasks
+		uint8_t priority = __builtin_clz(NG(m_ready_mask));
 		id = NG(m_head)[priority];
+		pop_deadline(id, priority);
 		NG(m_head)[priority] = NG(m_info)[NG(m_head)[priority]].next;
 		if(NG(m_head)[priority] == NO_TASK)
+		{
 			NG(m_tail)[priority] = NO_TASK;
+			NG(m_ready_mask) &= ~PRIORITY_MASK(priority);
+		}
 		else
 			NG(m_info)[NG(m_head)[priority]].prev = NO_TASK;
 
 		NG(m_info)[id].next = NO_TASK;
 		NG(m_info)[id].prev = NO_TASK;
 		NG(m_info)[id].priority = NOT_SCHEDULED;
+
+		if(id >= NUM_TASKS)
+		{
+			//release the deferred call entry right away, so it can be reused by the call itself
+			*call = NG(m_calls)[id - NUM_TASKS];
+			NG(m_calls)[id - NUM_TASKS].call = 0x0;
+			NG(m_info)[id].next = NG(m_free_call);
+			NG(m_free_call) = id;
+			pool_stats_free(&NG(m_call_stats));
+		}
 	}
 	end_atomic();
 	check_structs_are_valid();
 	return id;
 }
 
-static inline bool tasks_waiting(int priority)
+__LINK_C void sched_get_task_table_stats(pool_stats_t* stats)
+{
+	// tasks are never unregistered, so the number of registered tasks is also the high water mark
+	start_atomic();
+	pool_stats_init(stats, NUM_TASKS);
+	pool_stats_set_in_use(stats, NG(num_registered_tasks));
+	end_atomic();
+}
+
+__LINK_C void sched_get_deferred_call_stats(pool_stats_t* stats)
+{
+	start_atomic();
+	*stats = NG(m_call_stats);
+	end_atomic();
+}
+
+__LINK_C void sched_reset_deferred_call_stats()
+{
+	start_atomic();
+	pool_stats_reset(&NG(m_call_stats));
+	end_atomic();
+}
+
+#if defined(FRAMEWORK_SCHEDULER_PROFILING_ENABLED) || defined(FRAMEWORK_SCHEDULER_STACK_WATERMARK_ENABLED)
+__LINK_C uint8_t sched_get_registered_task_count()
+{
+	return NG(num_registered_tasks);
+}
+#endif
+
+#ifdef FRAMEWORK_SCHEDULER_PROFILING_ENABLED
+
+__LINK_C error_t sched_get_task_profile(task_handle_t handle, sched_task_profile_t* profile)
+{
+	if(!is_valid_handle(handle))
+		return EINVAL;
+
+	start_atomic();
+	*profile = NG(m_profile)[handle];
+	end_atomic();
+	return SUCCESS;
+}
+
+__LINK_C void sched_reset_profile()
+{
+	start_atomic();
+	memset(NG(m_profile), 0, sizeof(NG(m_profile)));
+	end_atomic();
+}
+#endif
+
+#ifdef FRAMEWORK_SCHEDULER_STACK_WATERMARK_ENABLED
+__LINK_C void sched_get_stack_stats(sched_stack_stats_t* stats)
+{
+	start_atomic();
+	stats->size = (NG(m_stack_top) - NG(m_stack_limit)) * sizeof(uint32_t);
+	stats->max_used = (NG(m_stack_top) - NG(m_stack_watermark)) * sizeof(uint32_t);
+	stats->max_used_task = NG(m_stack_max_used_task);
+	end_atomic();
+}
+
+__LINK_C error_t sched_get_task_stack_max_used(task_handle_t handle, uint16_t* max_used)
 {
-	return NG(m_head)[priority] != NO_TASK;
+	if(!is_valid_handle(handle))
+		return EINVAL;
+
+	*max_used = NG(m_stack_max_used)[handle];
+	return SUCCESS;
 }
+#endif
 
-static uint8_t low_power_mode = FRAMEWORK_SCHEDULER_LP_MODE;
+#if FRAMEWORK_SCHEDULER_LIVENESS_CHECKS > 0
+__LINK_C error_t sched_register_liveness_check(uint32_t deadline, sched_liveness_check_t* check)
+{
+	if(deadline == 0)
+		return EINVAL;
+
+	if(NG(m_liveness_check_count) == FRAMEWORK_SCHEDULER_LIVENESS_CHECKS)
+		return ENOMEM;
+
+	liveness_check_t* entry = &NG(m_liveness_checks)[NG(m_liveness_check_count)];
+	entry->deadline = deadline;
+	entry->last_check_in = timer_get_counter_value();
+	*check = NG(m_liveness_check_count)++;
+	return SUCCESS;
+}
+
+__LINK_C void sched_liveness_check_in(sched_liveness_check_t check)
+{
+	assert(check < NG(m_liveness_check_count));
+	NG(m_liveness_checks)[check].last_check_in = timer_get_counter_value();
+}
+#endif
 
 uint8_t sched_get_low_power_mode(void) {
-  return low_power_mode;
+  return NG(low_power_mode);
 }
 
 void sched_set_low_power_mode(uint8_t mode) {
-  low_power_mode = mode;
+  NG(low_power_mode) = mode;
+}
+
+#ifdef FRAMEWORK_SCHEDULER_LP_MODE_DYNAMIC
+//low_power_mode is the deepest mode we are allowed to use, go as deep as the next timer event allows
+static uint8_t select_low_power_mode()
+{
+	timer_tick_t delay;
+	//without a pending timer event only an external interrupt can wake us up anyway
+	if(!timer_get_next_event_delay(&delay))
+		return NG(low_power_mode);
+
+	for(uint8_t mode = NG(low_power_mode); mode > 0; mode--)
+	{
+		uint32_t latency = hw_get_lowpower_mode_wakeup_latency(mode);
+		if(latency != HW_LOWPOWER_NO_TIMER_WAKEUP &&
+				(((uint64_t)latency) * TIMER_TICKS_PER_SEC) / 1000000 < delay)
+			return mode;
+	}
+	return 0;
+}
+#endif
+
+__LINK_C __HOT_RAMFUNC void scheduler_run_pending_tasks()
+{
+	//always pick the next task from the highest priority that has tasks waiting,
+	//so tasks posted (from an interrupt) while running a lower priority task run first
+	call_info_t call;
+	for(uint8_t id = pop_task(&call); id != NO_TASK; id = pop_task(&call))
+	{
+		check_structs_are_valid();
+		DEBUG_PROBE_SET(TASK);
+		if(id < NUM_TASKS)
+#ifdef FRAMEWORK_SCHEDULER_PROFILING_ENABLED
+			profile_run(id);
+#else
+			NG(m_info)[id].task();
+#endif
+		else
+			call.call(call.arg);
+
+		DEBUG_PROBE_CLR(TASK);
+		sample_stack(id);
+		feed_watchdog();
+	}
 }
 
 __LINK_C void scheduler_run()
 {
 	while(1)
 	{
-		while(NG(current_priority) < NUM_PRIORITIES)
-		{
-			check_structs_are_valid();
-			for(uint8_t id = pop_task((NG(current_priority))); id != NO_TASK; id = pop_task(NG(current_priority)))
-			{
-				check_structs_are_valid();
-				NG(m_info)[id].task();
-			}
-			//this needs to be done atomically since otherwise we risk decrementing the current priority
-			//while a higher priority task is waiting in the queue
-			start_atomic();
-			if (!tasks_waiting(NG(current_priority)))
-				NG(current_priority)++;
-#ifndef NDEBUG
-			for(int i = 0; i < NG(current_priority); i++)
-				assert(!tasks_waiting(i));
+		scheduler_run_pending_tasks();
+		feed_watchdog(); // also when woken without a task to run
+		DEBUG_PROBE_SET(SLEEP);
+#ifdef FRAMEWORK_SCHEDULER_LP_MODE_DYNAMIC
+		uint8_t mode = select_low_power_mode();
+#else
+		uint8_t mode = NG(low_power_mode);
 #endif
-			end_atomic();
-		}
-		hw_enter_lowpower_mode(low_power_mode);
+		energy_cpu_sleep(mode);
+		hw_enter_lowpower_mode(mode);
+		energy_cpu_wakeup();
+		DEBUG_PROBE_CLR(SLEEP);
+		sample_stack(NO_TASK); // the interrupts handled while sleeping
 	}
 
 }
@@ -29,32 +29,183 @@
 
 
 #define CMD_BUFFER_SIZE 512
+#define UART_RX_RING_SIZE 128 // bytes received in interrupt context which are not yet moved to the cmd_buffer by the shell task
 #define CMD_HANDLER_REGISTRATIONS_COUNT 3 // TODO configurable using cmake
 #define CMD_HANDLER_ID_NOT_SET -1
+#define CMD_HANDLER_ID_MIN ' ' // the handler ids are printable characters, from ' ' to 127
+#define CMD_HANDLER_INDEX_NOT_SET 0xFF
+#define RX_WAKEUP_UNKNOWN_LENGTH 4 // the bytes after which a command of which the length is not known yet is checked again
+#define POOL_STATS_REGISTRATIONS_COUNT 5
+#define COUNTERS_REGISTRATIONS_COUNT 4
+
+#include <string.h>
 
 #include "hwuart.h"
 #include "scheduler.h"
 #include "hwsystem.h"
 #include "hwatomic.h"
 #include "debug.h"
+#include "spsc_ring.h"
+#include "timer.h"
+#include "trace.h"
 
 #include "console.h"
 
 #include "platform.h"
 #include "ng.h"
 
+// the received bytes, the command being received always starts at the beginning so the handlers get it contiguously
 static uint8_t NGDEF(_cmd_buffer)[CMD_BUFFER_SIZE] = { 0 };
 #define cmd_buffer NG(_cmd_buffer)
 
-static fifo_t NGDEF(_cmd_fifo);
-#define cmd_fifo NG(_cmd_fifo)
+static uint16_t NGDEF(_cmd_buffer_length);
+#define cmd_buffer_length NG(_cmd_buffer_length)
+
+static uint8_t NGDEF(_uart_rx_ring_buffer)[UART_RX_RING_SIZE] = { 0 };
+#define uart_rx_ring_buffer NG(_uart_rx_ring_buffer)
+
+// the UART ISR is the only producer and process_cmd_buffer() the only consumer, so the cmd_buffer is only accessed
+// from task context and the command handlers do not need to disable interrupts
+static spsc_ring_t NGDEF(_uart_rx_ring);
+#define uart_rx_ring NG(_uart_rx_ring)
+
+// the bytes received since the shell task last looked, and the number it waits for to find a complete command
+static volatile uint16_t NGDEF(_rx_count);
+#define rx_count NG(_rx_count)
+
+static volatile uint16_t NGDEF(_rx_wakeup_count);
+#define rx_wakeup_count NG(_rx_wakeup_count)
+
 
 static cmd_handler_registration_t NGDEF(_cmd_handler_registrations)[CMD_HANDLER_REGISTRATIONS_COUNT];
 #define cmd_handler_registrations NG(_cmd_handler_registrations)
 
+// the index in cmd_handler_registrations of each handler id, to dispatch without searching
+static uint8_t NGDEF(_cmd_handler_index)[128 - CMD_HANDLER_ID_MIN];
+#define cmd_handler_index NG(_cmd_handler_index)
+
+typedef struct {
+    const char* name;
+    pool_stats_getter_t get_stats;
+    pool_stats_reset_t reset_stats;
+} pool_stats_registration_t;
+
+static pool_stats_registration_t NGDEF(_pool_stats_registrations)[POOL_STATS_REGISTRATIONS_COUNT];
+#define pool_stats_registrations NG(_pool_stats_registrations)
+
+typedef struct {
+    const char* name;
+    counters_getter_t get_counters;
+    counters_reset_t reset_counters;
+} counters_registration_t;
+
+static counters_registration_t NGDEF(_counters_registrations)[COUNTERS_REGISTRATIONS_COUNT];
+#define counters_registrations NG(_counters_registrations)
+
+// the bytes dropped because the UART RX ring was full
+static uint32_t NGDEF(_rx_dropped_count);
+#define rx_dropped_count NG(_rx_dropped_count)
+
 static bool echo = false;
 
-static void process_shell_cmd(char cmd)
+#ifdef FRAMEWORK_SCHEDULER_PROFILING_ENABLED
+static void print_scheduler_profile()
+{
+    sched_task_profile_t profile;
+    console_print("task\tcount\trun\trun max\tlat\tlat max\talready\r\n");
+    for(task_handle_t handle = 0; handle < sched_get_registered_task_count(); handle++)
+    {
+        sched_get_task_profile(handle, &profile);
+        console_printf("%d\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\r\n", handle,
+                       profile.invocation_count, profile.total_run_ticks, profile.max_run_ticks,
+                       profile.total_latency_ticks, profile.max_latency_ticks, profile.already_posted_count);
+    }
+}
+#endif
+
+#ifdef FRAMEWORK_SCHEDULER_STACK_WATERMARK_ENABLED
+static void print_stack_stats()
+{
+    sched_stack_stats_t stats;
+    sched_get_stack_stats(&stats);
+    console_printf("stack size %d, max used %d by task %d\r\n", stats.size, stats.max_used, stats.max_used_task);
+    console_print("task\tmax used\r\n");
+    for(task_handle_t handle = 0; handle < sched_get_registered_task_count(); handle++)
+    {
+        uint16_t max_used;
+        sched_get_task_stack_max_used(handle, &max_used);
+        if(max_used > 0)
+            console_printf("%d\t%d\r\n", handle, max_used);
+    }
+}
+#endif
+
+static void print_pool_stats(bool compact)
+{
+    pool_stats_t stats;
+    if(!compact)
+        console_print("pool\tsize\tin use\tmax\tfailed\r\n");
+
+    for(uint8_t i = 0; i < POOL_STATS_REGISTRATIONS_COUNT; i++)
+    {
+        if(pool_stats_registrations[i].get_stats == NULL)
+            continue;
+
+        pool_stats_registrations[i].get_stats(&stats);
+        console_printf(compact ? "%s:size=%d,in_use=%d,max=%d,failed=%d\r\n" : "%s\t%d\t%d\t%d\t%d\r\n",
+                       pool_stats_registrations[i].name, stats.size, stats.in_use, stats.high_water_mark,
+                       stats.alloc_failed_count);
+    }
+}
+
+static uint8_t get_console_counters(shell_counter_t* counters)
+{
+    counters[0] = (shell_counter_t){ .name = "tx_dropped", .value = console_get_tx_dropped_count() };
+    counters[1] = (shell_counter_t){ .name = "rx_dropped", .value = rx_dropped_count };
+    return 2;
+}
+
+static void reset_console_counters()
+{
+    console_reset_tx_dropped_count();
+    rx_dropped_count = 0;
+}
+
+#ifdef FRAMEWORK_SCHEDULER_DEADLINES_ENABLED
+static uint8_t get_scheduler_counters(shell_counter_t* counters)
+{
+    counters[0] = (shell_counter_t){ .name = "deadline_missed", .value = sched_get_deadline_miss_count() };
+    return 1;
+}
+#endif
+
+#ifdef FRAMEWORK_LOG_ENABLED
+// the layers as selected by ATL, in the order of log_stack_layer_t
+static const struct { char id; log_stack_layer_t layer; } log_layers[] = {
+    { 'p', LOG_STACK_PHY }, { 'd', LOG_STACK_DLL }, { 'm', LOG_STACK_MAC }, { 'n', LOG_STACK_NWL },
+    { 't', LOG_STACK_TRANS }, { 's', LOG_STACK_SESSION }, { 'a', LOG_STACK_ALP }, { 'f', LOG_STACK_FWK }
+};
+
+static void process_log_cmd(char arg)
+{
+    if(arg >= '0' && arg <= '0' + LOG_LEVEL_DEBUG)
+        log_set_level(arg - '0');
+
+    for(uint8_t i = 0; i < sizeof(log_layers) / sizeof(log_layers[0]); i++)
+    {
+        if(log_layers[i].id == arg)
+            log_set_layer_enabled(log_layers[i].layer, !log_is_enabled(log_layers[i].layer, LOG_LEVEL_NONE));
+    }
+
+    console_printf("log level %d (compiled in %d), layers ", log_get_level(), FRAMEWORK_LOG_LEVEL);
+    for(uint8_t i = 0; i < sizeof(log_layers) / sizeof(log_layers[0]); i++)
+        console_print_byte(log_is_enabled(log_layers[i].layer, LOG_LEVEL_NONE) ? log_layers[i].id : '-');
+
+    console_print("\r\n");
+}
+#endif
+
+static void process_shell_cmd(char cmd, char arg)
 {
     switch(cmd)
     {
@@ -66,19 +217,47 @@ static void process_shell_cmd(char cmd)
         case 'R':
             hw_reset();
             break;
+        case 'M':
+            shell_print_counters(false);
+            break;
+#ifdef FRAMEWORK_SCHEDULER_PROFILING_ENABLED
+        case 'P':
+            print_scheduler_profile();
+            break;
+        case 'C':
+            sched_reset_profile();
+            console_print("profile cleared\r\n");
+            break;
+#endif
+#ifdef FRAMEWORK_SCHEDULER_STACK_WATERMARK_ENABLED
+        case 'S':
+            print_stack_stats();
+            break;
+#endif
+#ifdef FRAMEWORK_TRACE_ENABLED
+        case 'T':
+            trace_dump();
+            break;
+        case 'Z':
+            trace_reset();
+            console_print("trace cleared\r\n");
+            break;
+#endif
+#ifdef FRAMEWORK_LOG_ENABLED
+        case 'L':
+            process_log_cmd(arg);
+            break;
+#endif
         default:
             // TODO log
             break;
     }
 }
 
-static cmd_handler_t get_cmd_handler_callback(int8_t id)
+static cmd_handler_registration_t* get_cmd_handler_registration(int8_t id)
 {
-    for(uint8_t i = 0; i < CMD_HANDLER_REGISTRATIONS_COUNT; i++)
-    {
-        if(cmd_handler_registrations[i].id == id)
-            return cmd_handler_registrations[i].cmd_handler_callback;
-    }
+    if(id >= CMD_HANDLER_ID_MIN && cmd_handler_index[id - CMD_HANDLER_ID_MIN] != CMD_HANDLER_INDEX_NOT_SET)
+        return &cmd_handler_registrations[cmd_handler_index[id - CMD_HANDLER_ID_MIN]];
 
     console_printf("ERROR: unknown command handler %d\r\n", id);
     console_print(" possible ids are: ");
@@ -87,55 +266,112 @@ static cmd_handler_t get_cmd_handler_callback(int8_t id)
         console_printf("%d:%d ", i, cmd_handler_registrations[i].id);
     }
     console_print("\r\n");
+    return NULL;
 }
 
-// TODO doc
 // ATx\r : shell command, where x is a char which maps to a command.
 // List of supported commands:
 // - R: reboot device
-// AT$<command handler id> : command to be handled by the command handler specified. The command handler id is a byte < 65 (non ASCII)
-// The handlers are passed the command fifo (including the header) and are responsible for pop()-ing the bytes which are processed by the handler.
-// When the fifo does not yet contain a full command which can be processed by the specific handler nothing should be popped and the handler will
-// called again later when more data is received.
-static void process_cmd_fifo()
+// - M: print the usage statistics of the registered pools and the counters (see shell_register_pool_stats() and
+//   shell_register_counters())
+// - P: print the scheduler task profile (when FRAMEWORK_SCHEDULER_PROFILING_ENABLED)
+// - C: clear the scheduler task profile (when FRAMEWORK_SCHEDULER_PROFILING_ENABLED)
+// - S: print the deepest use of the stack and the tasks which reached it (when FRAMEWORK_SCHEDULER_STACK_WATERMARK_ENABLED)
+// - T: dump the trace (when FRAMEWORK_TRACE_ENABLED)
+// - Z: clear the trace (when FRAMEWORK_TRACE_ENABLED)
+// - L<x>: filter the logs at runtime (when FRAMEWORK_LOG_ENABLED), x is a level from 0 (none) to 4 (debug) or the letter of
+//   a layer to toggle (p, d, m, n, t, s, a or f, see log_stack_layer_t). The current filter is printed
+// AT$<command handler id> : command to be handled by the command handler specified. The command handler id is a printable
+// character (see shell_register_handler()).
+// The handler tells the length of the command from its first bytes (see cmd_length_t), it is only called once the
+// complete command is received and the shell removes the command afterwards.
+// Returns the number of bytes to remove from the start of the buffer, or 0 when more bytes are needed. The number of
+// missing bytes is returned in missing then, or 0 when the length of the command is not known yet.
+static uint16_t process_cmd(uint8_t* cmd, uint16_t length, uint16_t* missing)
 {
-    if(fifo_get_size(&cmd_fifo) >= SHELL_CMD_HEADER_SIZE)
+    *missing = 0;
+    if(length > 0 && cmd[0] != 'A')
     {
-        uint8_t cmd_header[SHELL_CMD_HEADER_SIZE];
-        fifo_peek(&cmd_fifo, cmd_header, 0, SHELL_CMD_HEADER_SIZE);
-        if(cmd_header[0] != 'A' || cmd_header[1] != 'T')
-        {
-            // unexpected data, pop and return
-            // TODO log?
-            fifo_pop(&cmd_fifo, cmd_header, 1);
-            sched_post_task(&process_cmd_fifo);
-            return;
-        }
-
-        if(cmd_header[2] != '$')
-        {
-            process_shell_cmd(cmd_header[2]);
-            fifo_pop(&cmd_fifo, cmd_header, SHELL_CMD_HEADER_SIZE);
-        }
-        else
-        {
-            get_cmd_handler_callback(cmd_header[3])(&cmd_fifo);
-        }
+        // unexpected data, resync on the next "AT"
+        uint8_t* next = memchr(cmd, 'A', length);
+        return next == NULL ? length : next - cmd;
+    }
 
-        sched_post_task(&process_cmd_fifo);
-    } else if(fifo_get_size(&cmd_fifo) >= 3) {
-      // AT[\r|\n]
-      uint8_t cmd_header[3];
-      fifo_peek(&cmd_fifo, cmd_header, 0, 3);
-      if( cmd_header[0] == 'A' && cmd_header[1] == 'T'
-          && ( cmd_header[2] == '\r' || cmd_header[2] == '\n' ) )
-      {
+    if(length >= 3 && cmd[0] == 'A' && cmd[1] == 'T' && (cmd[2] == '\r' || cmd[2] == '\n'))
+    {
         console_print("OK\r\n");
-        fifo_pop(&cmd_fifo, cmd_header, 3);
-      }
+        return 3;
+    }
+
+    if(length < SHELL_CMD_HEADER_SIZE)
+    {
+        *missing = SHELL_CMD_HEADER_SIZE - length;
+        return 0;
+    }
+
+    if(cmd[1] != 'T')
+        return 1;
+
+    if(cmd[2] != '$')
+    {
+        process_shell_cmd(cmd[2], cmd[3]);
+        return SHELL_CMD_HEADER_SIZE;
     }
+
+    cmd_handler_registration_t* registration = get_cmd_handler_registration(cmd[3]);
+    if(registration == NULL)
+        return SHELL_CMD_HEADER_SIZE;
+
+    int16_t cmd_length = registration->get_cmd_length(cmd, length);
+    if(cmd_length == SHELL_CMD_INVALID || cmd_length > CMD_BUFFER_SIZE)
+        return SHELL_CMD_HEADER_SIZE;
+
+    if(cmd_length == 0)
+        return 0;
+
+    if(cmd_length > length)
+    {
+        *missing = cmd_length - length;
+        return 0;
+    }
+
+    return registration->cmd_handler_callback(cmd, cmd_length) ? cmd_length : SHELL_CMD_HEADER_SIZE;
 }
 
+static void process_cmd_buffer()
+{
+    rx_count = 0; // counts the bytes which are received from now on
+    uint8_t data;
+    while(cmd_buffer_length < CMD_BUFFER_SIZE && spsc_ring_get(&uart_rx_ring, &data) == SUCCESS)
+        cmd_buffer[cmd_buffer_length++] = data;
+
+    uint16_t missing;
+    uint16_t processed = process_cmd(cmd_buffer, cmd_buffer_length, &missing);
+    if(processed == 0 && cmd_buffer_length == CMD_BUFFER_SIZE)
+        processed = SHELL_CMD_HEADER_SIZE; // the command does not fit, drop its header to resync
+
+    if(processed > 0)
+    {
+        // usually the command is all there is, otherwise the start of the next one is moved to the front
+        cmd_buffer_length -= processed;
+        memmove(cmd_buffer, cmd_buffer + processed, cmd_buffer_length);
+        sched_post_task(&process_cmd_buffer);
+        return;
+    }
+
+    // woken up again once the command can be complete. A command of unknown length is checked again after a few more
+    // bytes or at the end of a line, before the ring fills up in any case
+    if(missing == 0)
+        missing = RX_WAKEUP_UNKNOWN_LENGTH;
+
+    rx_wakeup_count = missing < UART_RX_RING_SIZE / 2 ? missing : UART_RX_RING_SIZE / 2;
+    if(rx_count >= rx_wakeup_count)
+        sched_post_task(&process_cmd_buffer); // received meanwhile
+}
+
+// posted from the UART ISR by its handle, without disabling the interrupts
+SCHED_REGISTER_TASK(process_cmd_buffer);
+
 static void uart_rx_cb(uint8_t data)
 {
     if( echo ) {
@@ -143,14 +379,16 @@ static void uart_rx_cb(uint8_t data)
       if( data == '\r' ) { console_print_byte('\n'); }
     }
 
-    error_t err;
-
-    start_atomic();
-        err = fifo_put(&cmd_fifo, &data, 1); assert(err == SUCCESS);
-    end_atomic();
+    // when the ring is full the byte is dropped, the command handlers detect the corrupted command and the shell resyncs on the next "AT"
+    if(spsc_ring_put(&uart_rx_ring, &data) != SUCCESS)
+        rx_dropped_count++;
 
-    if(!sched_is_scheduled(&process_cmd_fifo))
-        sched_post_task(&process_cmd_fifo);
+    // the shell runs once per command instead of once per byte
+    rx_count++;
+    if(rx_count >= rx_wakeup_count || data == '\r' || data == '\n')
+    {
+        sched_post_handle_from_isr(SCHED_TASK_HANDLE(process_cmd_buffer), DEFAULT_PRIORITY);
+    }
 }
 
 void shell_init()
@@ -158,15 +396,35 @@ void shell_init()
     for(uint8_t i = 0; i < CMD_HANDLER_REGISTRATIONS_COUNT; i++)
     {
         cmd_handler_registrations[i].id = CMD_HANDLER_ID_NOT_SET;
+        cmd_handler_registrations[i].get_cmd_length = NULL;
         cmd_handler_registrations[i].cmd_handler_callback = NULL;
     }
 
-    fifo_init(&cmd_fifo, cmd_buffer, sizeof(cmd_buffer));
+    memset(cmd_handler_index, CMD_HANDLER_INDEX_NOT_SET, sizeof(cmd_handler_index));
+
+    for(uint8_t i = 0; i < POOL_STATS_REGISTRATIONS_COUNT; i++)
+        pool_stats_registrations[i] = (pool_stats_registration_t){ .name = NULL, .get_stats = NULL, .reset_stats = NULL };
+
+    shell_register_pool_stats("tasks", &sched_get_task_table_stats, NULL);
+    shell_register_pool_stats("calls", &sched_get_deferred_call_stats, &sched_reset_deferred_call_stats);
+    shell_register_pool_stats("timers", &timer_get_stats, &timer_reset_stats);
+
+    for(uint8_t i = 0; i < COUNTERS_REGISTRATIONS_COUNT; i++)
+        counters_registrations[i] = (counters_registration_t){ .name = NULL, .get_counters = NULL, .reset_counters = NULL };
+
+    rx_dropped_count = 0;
+    shell_register_counters("console", &get_console_counters, &reset_console_counters);
+#ifdef FRAMEWORK_SCHEDULER_DEADLINES_ENABLED
+    shell_register_counters("scheduler", &get_scheduler_counters, &sched_reset_deadline_miss_count);
+#endif
+
+    cmd_buffer_length = 0;
+    rx_count = 0;
+    rx_wakeup_count = SHELL_CMD_HEADER_SIZE;
+    spsc_ring_init(&uart_rx_ring, uart_rx_ring_buffer, sizeof(uint8_t), sizeof(uart_rx_ring_buffer));
 
     console_set_rx_interrupt_callback(&uart_rx_cb);
     console_rx_interrupt_enable();
-
-    sched_register_task(&process_cmd_fifo);
 }
 
 void shell_echo_enable() {
@@ -179,7 +437,8 @@ void shell_echo_disable() {
 
 void shell_register_handler(cmd_handler_registration_t handler_registration)
 {
-    assert(handler_registration.id >= ' ');
+    assert(handler_registration.id >= CMD_HANDLER_ID_MIN);
+    assert(handler_registration.get_cmd_length != NULL);
     assert(handler_registration.cmd_handler_callback != NULL);
 
     int8_t empty_index = -1;
@@ -196,6 +455,78 @@ void shell_register_handler(cmd_handler_registration_t handler_registration)
     assert(empty_index != -1); // no empty spot found
 
     cmd_handler_registrations[empty_index] = handler_registration;
+    cmd_handler_index[handler_registration.id - CMD_HANDLER_ID_MIN] = empty_index;
+}
+
+void shell_register_pool_stats(const char* name, pool_stats_getter_t get_stats, pool_stats_reset_t reset_stats)
+{
+    assert(get_stats != NULL);
+    for(uint8_t i = 0; i < POOL_STATS_REGISTRATIONS_COUNT; i++)
+    {
+        if(pool_stats_registrations[i].get_stats == NULL)
+        {
+            pool_stats_registrations[i] = (pool_stats_registration_t){ .name = name, .get_stats = get_stats,
+                                                                        .reset_stats = reset_stats };
+            return;
+        }
+    }
+
+    assert(false); // no empty spot found
+}
+
+void shell_register_counters(const char* name, counters_getter_t get_counters, counters_reset_t reset_counters)
+{
+    assert(get_counters != NULL);
+    for(uint8_t i = 0; i < COUNTERS_REGISTRATIONS_COUNT; i++)
+    {
+        if(counters_registrations[i].get_counters == NULL)
+        {
+            counters_registrations[i] = (counters_registration_t){ .name = name, .get_counters = get_counters,
+                                                                   .reset_counters = reset_counters };
+            return;
+        }
+    }
+
+    assert(false); // no empty spot found
+}
+
+void shell_print_counters(bool compact)
+{
+    print_pool_stats(compact);
+
+    shell_counter_t counters[SHELL_COUNTERS_MAX];
+    for(uint8_t i = 0; i < COUNTERS_REGISTRATIONS_COUNT; i++)
+    {
+        if(counters_registrations[i].get_counters == NULL)
+            continue;
+
+        uint8_t count = counters_registrations[i].get_counters(counters);
+        assert(count <= SHELL_COUNTERS_MAX);
+        console_printf(compact ? "%s:" : "%s\r\n", counters_registrations[i].name);
+        for(uint8_t j = 0; j < count; j++)
+        {
+            console_printf(compact ? (j == 0 ? "%s=%lu" : ",%s=%lu") : "  %-12s %lu\r\n", counters[j].name,
+                           (unsigned long) counters[j].value);
+        }
+
+        if(compact)
+            console_printf("\r\n");
+    }
+}
+
+void shell_reset_counters()
+{
+    for(uint8_t i = 0; i < POOL_STATS_REGISTRATIONS_COUNT; i++)
+    {
+        if(pool_stats_registrations[i].reset_stats != NULL)
+            pool_stats_registrations[i].reset_stats();
+    }
+
+    for(uint8_t i = 0; i < COUNTERS_REGISTRATIONS_COUNT; i++)
+    {
+        if(counters_registrations[i].reset_counters != NULL)
+            counters_registrations[i].reset_counters();
+    }
 }
 
 #endif
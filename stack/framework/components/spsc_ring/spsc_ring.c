@@ -0,0 +1,83 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file spsc_ring.c
+ *
+ */
+
+#include "spsc_ring.h"
+#include "string.h"
+
+// orders the element accesses against the index updates. A compiler barrier is enough on single core cortex-M (see ARM AN321),
+// the dmb is added for the cores with a write buffer. Other targets only need the compiler barrier.
+#if defined(__ARM_ARCH) && (__ARM_ARCH >= 6)
+    #define MEMORY_BARRIER() __asm__ __volatile__("dmb" ::: "memory")
+#else
+    #define MEMORY_BARRIER() __asm__ __volatile__("" ::: "memory")
+#endif
+
+static inline uint16_t next_idx(spsc_ring_t* ring, uint16_t idx)
+{
+    idx++;
+    return idx == ring->element_count? 0 : idx;
+}
+
+void spsc_ring_init(spsc_ring_t* ring, void* buffer, uint8_t element_size, uint16_t element_count)
+{
+    ring->buffer = buffer;
+    ring->element_size = element_size;
+    ring->element_count = element_count;
+    ring->head_idx = 0;
+    ring->tail_idx = 0;
+}
+
+error_t spsc_ring_put(spsc_ring_t* ring, const void* element)
+{
+    uint16_t tail_idx = ring->tail_idx;
+    uint16_t next_tail_idx = next_idx(ring, tail_idx);
+    if(next_tail_idx == ring->head_idx)
+        return ESIZE;
+
+    memcpy(ring->buffer + tail_idx * ring->element_size, element, ring->element_size);
+
+    // publish the element only after it is written
+    MEMORY_BARRIER();
+    ring->tail_idx = next_tail_idx;
+    return SUCCESS;
+}
+
+error_t spsc_ring_get(spsc_ring_t* ring, void* element)
+{
+    uint16_t head_idx = ring->head_idx;
+    if(head_idx == ring->tail_idx)
+        return ESIZE;
+
+    // read the element only after reading the tail index
+    MEMORY_BARRIER();
+    memcpy(element, ring->buffer + head_idx * ring->element_size, ring->element_size);
+
+    // hand the slot back to the producer only after the element is read
+    MEMORY_BARRIER();
+    ring->head_idx = next_idx(ring, head_idx);
+    return SUCCESS;
+}
+
+bool spsc_ring_is_empty(spsc_ring_t* ring)
+{
+    return ring->head_idx == ring->tail_idx;
+}
@@ -31,18 +31,54 @@
 #endif
 
 
-#ifdef NODE_GLOBALS
-    #warning Default Timer implementation used when NODE_GLOBALS is active. Are you sure this is what you want ??
-#endif
-
+// with NODE_GLOBALS all the state of the timer is per node, the hw timer itself is the one of the (simulated)
+// platform of the current node
 #define HW_TIMER_ID 0
 
 #define COUNTER_OVERFLOW_INCREASE (UINT32_C(1) << (8*sizeof(hwtimer_tick_t)))
 
-static timer_event NGDEF(timers)[FRAMEWORK_TIMER_STACK_SIZE];
+#if PLATFORM_NUM_TIMERS > 1
+// the second hw timer is reserved for the events of timer_post_precise_task_prio(), it runs at the frequency of the
+// first one, which keeps the time of the framework timer
+#define PRECISE_HW_TIMER_ID 1
+// a shorter delay is posted on the framework timer, the compare could be written after the counter passed it
+#define PRECISE_MIN_DELAY 2
+#endif
+
+#if FRAMEWORK_TIMER_STACK_SIZE >= 255
+    #error "FRAMEWORK_TIMER_STACK_SIZE should be smaller than 255"
+#endif
+
+//the events keep their fire time on the 64-bit counter (see timer_get_counter_value64()), which does not wrap
+typedef struct
+{
+    task_t f;
+    uint64_t next_event;
+    uint8_t priority;
+    timer_tick_t period;
+    timer_tick_t slack;
+} timer_entry_t;
+
+static timer_entry_t NGDEF(timers)[FRAMEWORK_TIMER_STACK_SIZE];
+//the events are kept in a binary min-heap ordered on next_event. NG(heap) is a permutation of
+//all indices of NG(timers): the first NG(heap_size) entries form the heap, the others are free.
+//NG(heap_pos) maps every index of NG(timers) to its position in NG(heap)
+static uint8_t NGDEF(heap)[FRAMEWORK_TIMER_STACK_SIZE];
+static uint8_t NGDEF(heap_pos)[FRAMEWORK_TIMER_STACK_SIZE];
+static uint8_t NGDEF(heap_size);
 static volatile timer_tick_t NGDEF(next_event);
+//the time at which the hw timer should wake us up, this is later than the time of
+//NG(next_event) when the slack of the upcoming events allows it
+static volatile uint64_t NGDEF(next_wakeup);
 static volatile bool NGDEF(hw_event_scheduled);
-static volatile timer_tick_t NGDEF(timer_offset);
+//the ticks counted by the hw timer before its last overflow
+static volatile uint64_t NGDEF(timer_offset);
+static pool_stats_t NGDEF(pool_stats);
+#ifdef PRECISE_HW_TIMER_ID
+static volatile task_t NGDEF(precise_task);
+static uint8_t NGDEF(precise_priority);
+static uint64_t NGDEF(precise_fire_time);
+#endif
 enum
 {
     NO_EVENT = FRAMEWORK_TIMER_STACK_SIZE,
@@ -50,96 +86,245 @@ enum
 
 static void timer_overflow();
 static void timer_fired();
+#ifdef PRECISE_HW_TIMER_ID
+static void precise_timer_fired();
+#endif
 
 __LINK_C void timer_init()
 {
     for(uint32_t i = 0; i < FRAMEWORK_TIMER_STACK_SIZE; i++)
+    {
 	NG(timers)[i].f = 0x0;
+	NG(heap)[i] = i;
+	NG(heap_pos)[i] = i;
+    }
 
+    NG(heap_size) = 0;
     NG(next_event) = NO_EVENT;
+    NG(next_wakeup) = 0;
     NG(timer_offset) = 0;
     NG(hw_event_scheduled) = false;
+    pool_stats_init(&NG(pool_stats), FRAMEWORK_TIMER_STACK_SIZE);
 
     error_t err = hw_timer_init(HW_TIMER_ID, TIMER_RESOLUTION, &timer_fired, &timer_overflow);
     assert(err == SUCCESS);
+#ifdef PRECISE_HW_TIMER_ID
+    NG(precise_task) = 0x0;
+    err = hw_timer_init(PRECISE_HW_TIMER_ID, TIMER_RESOLUTION, &precise_timer_fired, 0x0);
+    assert(err == SUCCESS);
+#endif
+
+}
+
+//the fire time on the 64-bit counter of a time of timer_get_counter_value(). The 32-bit time is taken as the
+//nearest one: within 2^31 ticks before or after the current time
+static uint64_t to_counter64(timer_tick_t time)
+{
+    uint64_t now = timer_get_counter_value64();
+    return now + (int32_t)(time - (timer_tick_t)now);
+}
 
+//all heap functions below should only be called from an atomic context
+static inline bool fires_before(uint8_t a, uint8_t b)
+{
+    return NG(timers)[a].next_event < NG(timers)[b].next_event;
+}
+
+static void heap_swap(uint8_t pos_a, uint8_t pos_b)
+{
+    uint8_t a = NG(heap)[pos_a];
+    NG(heap)[pos_a] = NG(heap)[pos_b];
+    NG(heap)[pos_b] = a;
+    NG(heap_pos)[NG(heap)[pos_a]] = pos_a;
+    NG(heap_pos)[NG(heap)[pos_b]] = pos_b;
 }
 
+static void heap_sift_up(uint8_t pos)
+{
+    while(pos > 0 && fires_before(NG(heap)[pos], NG(heap)[(pos - 1) / 2]))
+    {
+	heap_swap(pos, (pos - 1) / 2);
+	pos = (pos - 1) / 2;
+    }
+}
+
+static void heap_sift_down(uint8_t pos)
+{
+    while(true)
+    {
+	uint8_t first = pos;
+	uint8_t child = 2 * pos + 1;
+	if(child < NG(heap_size) && fires_before(NG(heap)[child], NG(heap)[first]))
+	    first = child;
+	if(child + 1 < NG(heap_size) && fires_before(NG(heap)[child + 1], NG(heap)[first]))
+	    first = child + 1;
+	if(first == pos)
+	    break;
+	heap_swap(pos, first);
+	pos = first;
+    }
+}
+
+static void heap_update(uint8_t event)
+{
+    heap_sift_up(NG(heap_pos)[event]);
+    heap_sift_down(NG(heap_pos)[event]);
+}
+
+static void heap_remove(uint8_t event)
+{
+    uint8_t pos = NG(heap_pos)[event];
+    NG(timers)[event].f = 0x0;
+    //move the last event of the heap in the freed position, the removed event
+    //ends up at the start of the free area
+    NG(heap_size)--;
+    pool_stats_set_in_use(&NG(pool_stats), NG(heap_size));
+    heap_swap(pos, NG(heap_size));
+    if(pos < NG(heap_size))
+	heap_update(NG(heap)[pos]);
+}
+
+static uint8_t find_event(task_t task)
+{
+    for(uint8_t i = 0; i < NG(heap_size); i++)
+	if(NG(timers)[NG(heap)[i]].f == task)
+	    return NG(heap)[i];
+    return NO_EVENT;
+}
+
+#ifdef PRECISE_HW_TIMER_ID
+//should only be called from an atomic context
+static bool cancel_precise_task(task_t task)
+{
+    if(NG(precise_task) != task)
+	return false;
+
+    hw_timer_cancel(PRECISE_HW_TIMER_ID);
+    NG(precise_task) = 0x0;
+    return true;
+}
+
+static void precise_timer_fired()
+{
+    task_t task = NG(precise_task);
+    NG(precise_task) = 0x0;
+    if(task != 0x0)
+	sched_post_task_prio(task, NG(precise_priority));
+}
+#else
+static inline bool cancel_precise_task(task_t task) { return false; }
+#endif
+
 static void configure_next_event();
-__LINK_C error_t timer_post_task_prio(task_t task, timer_tick_t fire_time, uint8_t priority)
+static error_t post_task(task_t task, timer_tick_t time, uint8_t priority, timer_tick_t period, timer_tick_t slack)
 {
-    error_t status = ENOMEM;
+    error_t status = SUCCESS;
     if (priority > MIN_PRIORITY)
         return EINVAL;
 
-    DPRINT("fire_time  <%lu>" , fire_time);
+    DPRINT("fire_time  <%lu>" , time);
 
     start_atomic();
-    uint32_t empty_index = FRAMEWORK_TIMER_STACK_SIZE;
-    for (uint32_t i = 0; i < FRAMEWORK_TIMER_STACK_SIZE; i++)
+    uint64_t fire_time = to_counter64(time);
+    //posting a task on the framework timer replaces its precise event
+    cancel_precise_task(task);
+    uint8_t event = find_event(task);
+    if(event != NO_EVENT)
     {
-        if (NG(timers)[i].f == 0x0 && empty_index == FRAMEWORK_TIMER_STACK_SIZE)
-        {
-            empty_index = i;
-        }
-        else if (NG(timers)[i].f == task)
-        {
-            // it is allowed to update only the fire time
-            if (NG(timers)[i].priority == priority)
-            {
-                NG(timers)[empty_index].next_event = fire_time;
-                goto config;
-            }
-            else
-            //for now: do not allow an event to be scheduled more than once
-            //otherwise we risk having the same task being scheduled twice and only executed once
-            //because the scheduler disallows the same task to be scheduled multiple times
-                status = EALREADY;
-            break;
-        }
+	// it is allowed to update only the fire time
+	//for now: do not allow an event to be scheduled more than once
+	//otherwise we risk having the same task being scheduled twice and only executed once
+	//because the scheduler disallows the same task to be scheduled multiple times
+	if(NG(timers)[event].priority != priority)
+	    status = EALREADY;
+	else
+	{
+	    NG(timers)[event].next_event = fire_time;
+	    NG(timers)[event].period = period;
+	    NG(timers)[event].slack = slack;
+	    heap_update(event);
+	}
     }
-
-    if (status != EALREADY && empty_index != FRAMEWORK_TIMER_STACK_SIZE)
+    else if(NG(heap_size) < FRAMEWORK_TIMER_STACK_SIZE)
     {
-        NG(timers)[empty_index].f = task;
-        NG(timers)[empty_index].next_event = fire_time;
-        NG(timers)[empty_index].priority = priority;
+	event = NG(heap)[NG(heap_size)];
+	NG(heap_size)++;
+	pool_stats_set_in_use(&NG(pool_stats), NG(heap_size));
+	NG(timers)[event].f = task;
+	NG(timers)[event].next_event = fire_time;
+	NG(timers)[event].priority = priority;
+	NG(timers)[event].period = period;
+	NG(timers)[event].slack = slack;
+	heap_sift_up(NG(heap_pos)[event]);
     }
     else
-        goto end;
+    {
+	status = ENOMEM;
+	pool_stats_alloc_failed(&NG(pool_stats));
+    }
 
-config:
+    //reconfigure when the first event changed, when the first event itself was moved
+    //or when this event should fire before the currently scheduled wake-up
+    if(status == SUCCESS && (NG(next_event) != NG(heap)[0] || NG(next_event) == event ||
+			     fire_time + slack < NG(next_wakeup)))
+	configure_next_event();
 
-    //if there is no event scheduled, this event will run before the next scheduled event
-    {
-        bool do_config = NG(next_event) == NO_EVENT;
+    end_atomic();
+    return status;
+}
 
-        if (!do_config)
-        {
-            uint32_t counter = timer_get_counter_value();
+__LINK_C error_t timer_post_task_prio(task_t task, timer_tick_t fire_time, uint8_t priority)
+{
+    return post_task(task, fire_time, priority, 0, 0);
+}
 
-            DPRINT("timer_post_task_prio counter value <%lu>" , counter);
+__LINK_C error_t timer_post_task_with_slack(task_t task, timer_tick_t fire_time, timer_tick_t slack, uint8_t priority)
+{
+    return post_task(task, fire_time, priority, 0, slack);
+}
 
-            //if the new event should fire sooner than the old event --> trigger reconfig
-            //this is done using signed ints (compared to the current counter)
-            //to ensure propper handling of timer overflows
-            int32_t next_fire_delay = ((int32_t)fire_time) - ((int32_t)counter);
+__LINK_C error_t timer_post_precise_task_prio(task_t task, timer_tick_t time, uint8_t priority)
+{
+#ifdef PRECISE_HW_TIMER_ID
+    if (priority > MIN_PRIORITY)
+        return EINVAL;
 
-            DPRINT("next_fire_delay <%lu>" , next_fire_delay);
+    bool posted = false;
+    start_atomic();
+    uint64_t fire_time = to_counter64(time);
+    uint64_t now = timer_get_counter_value64();
+    if((NG(precise_task) == 0x0 || NG(precise_task) == task) && find_event(task) == NO_EVENT &&
+       fire_time >= now + PRECISE_MIN_DELAY && fire_time < now + COUNTER_OVERFLOW_INCREASE)
+    {
+	hwtimer_tick_t delay = fire_time - now;
+	NG(precise_task) = task;
+	NG(precise_priority) = priority;
+	NG(precise_fire_time) = fire_time;
+	hw_timer_schedule_delay(PRECISE_HW_TIMER_ID, (hwtimer_tick_t)delay);
+	posted = true;
+    }
+    end_atomic();
+    if(posted)
+	return SUCCESS;
+#endif
+    //without a free precise timer the event waits on the framework timer
+    return post_task(task, time, priority, 0, 0);
+}
 
-            int32_t old_fire_delay = ((int32_t)NG(timers)[NG(next_event)].next_event) - ((int32_t)counter);
-            do_config = next_fire_delay < old_fire_delay;
-        }
+__LINK_C error_t timer_post_periodic_task(task_t task, timer_tick_t period, uint8_t priority)
+{
+    if(period == 0)
+	return EINVAL;
 
-        if (do_config)
-            configure_next_event();
+    return post_task(task, timer_get_counter_value() + period, priority, period, 0);
+}
 
-        status = SUCCESS;
-    }
+__LINK_C error_t timer_post_periodic_task_at(task_t task, timer_tick_t time, timer_tick_t period, uint8_t priority)
+{
+    if(period == 0)
+	return EINVAL;
 
-end:
-    end_atomic();
-    return status;
+    return post_task(task, time, priority, period, 0);
 }
 
 __LINK_C error_t timer_cancel_task(task_t task)
@@ -147,19 +332,18 @@ __LINK_C error_t timer_cancel_task(task_t task)
     error_t status = EALREADY;
     
     start_atomic();
+    if(cancel_precise_task(task))
+	status = SUCCESS;
 
-    for(uint32_t i = 0; i < FRAMEWORK_TIMER_STACK_SIZE; i++)
+    uint8_t event = find_event(task);
+    if(event != NO_EVENT)
     {
-      if(NG(timers)[i].f == task)
-      {
-        NG(timers)[i].f = 0x0;
-        //if we were the first event to fire --> trigger a reconfiguration
-        if(NG(next_event) == i)
-          configure_next_event();
-
-        status = SUCCESS;
-        break;
-      }
+	heap_remove(event);
+	//if we were the first event to fire --> trigger a reconfiguration
+	if(NG(next_event) == event)
+	    configure_next_event();
+
+	status = SUCCESS;
     }
     end_atomic();
 
@@ -168,26 +352,59 @@ __LINK_C error_t timer_cancel_task(task_t task)
 
 __LINK_C bool timer_is_task_scheduled(task_t task)
 {
-    bool present = false;
+    start_atomic();
+    bool present = find_event(task) != NO_EVENT;
+#ifdef PRECISE_HW_TIMER_ID
+    present = present || NG(precise_task) == task;
+#endif
+    end_atomic();
+
+    return present;
+}
+
+//the ticks left until a fire time, 0 when it passed and at most the range of timer_tick_t
+static timer_tick_t get_delay(uint64_t fire_time, uint64_t now)
+{
+    if(fire_time <= now)
+        return 0;
+
+    return (fire_time - now > UINT32_MAX) ? UINT32_MAX : (timer_tick_t)(fire_time - now);
+}
+
+__LINK_C bool timer_get_next_event_delay(timer_tick_t* delay)
+{
+    bool pending = false;
 
     start_atomic();
+    uint64_t now = timer_get_counter_value64();
+    if(NG(next_event) != NO_EVENT)
+    {
+        *delay = get_delay(NG(next_wakeup), now);
+        pending = true;
+    }
+#ifdef PRECISE_HW_TIMER_ID
+    if(NG(precise_task) != 0x0)
+    {
+        timer_tick_t precise_delay = get_delay(NG(precise_fire_time), now);
+        if(!pending || precise_delay < *delay)
+            *delay = precise_delay;
+
+        pending = true;
+    }
+#endif
+    end_atomic();
 
-     for (uint32_t i = 0; i < FRAMEWORK_TIMER_STACK_SIZE; i++)
-     {
-       if (NG(timers)[i].f == task)
-       {
-          present = true;
-          break;
-       }
-     }
-     end_atomic();
-
-     return present;
+    return pending;
 }
 
 __LINK_C timer_tick_t timer_get_counter_value()
 {
-	timer_tick_t counter;
+    return (timer_tick_t)timer_get_counter_value64();
+}
+
+__LINK_C uint64_t timer_get_counter_value64()
+{
+	uint64_t counter;
     start_atomic();
 	counter = NG(timer_offset) + hw_timer_getvalue(HW_TIMER_ID);
 	//increase the counter with COUNTER_OVERFLOW_INCREASE
@@ -200,122 +417,117 @@ __LINK_C timer_tick_t timer_get_counter_value()
     return counter;
 }
 
-static uint32_t get_next_event()
+static void expire_event(uint8_t event)
 {
     //this function should only be called from an atomic context
-    int32_t min_delay;
-    uint32_t next_fire_event = NO_EVENT;
-    uint32_t counter = timer_get_counter_value();
-
-    for(uint32_t i = 0; i < FRAMEWORK_TIMER_STACK_SIZE; i++)
+    sched_post_task_prio(NG(timers)[event].f, NG(timers)[event].priority);
+    if(NG(timers)[event].period == 0)
+	heap_remove(event);
+    else
     {
-    	if(NG(timers)[i].f == 0x0)
-    		continue;
-    	//trick borrowed from AODV: by using signed integers in this way
-    	//we know that if the event has already passed delay_ticks will be < 0
-    	// --> events are sorted from past -> future regardless of any (pending) overflows
-    	int32_t delay_ticks = ((int32_t)NG(timers)[i].next_event) - ((int32_t)counter);
-    	if(next_fire_event == NO_EVENT || delay_ticks < min_delay)
-		{
-    		min_delay = delay_ticks;
-			next_fire_event = i;
-		}
+	//reschedule from the previous deadline so the period does not drift
+	NG(timers)[event].next_event += NG(timers)[event].period;
+	heap_update(event);
     }
-    return next_fire_event;
 }
 
-static void configure_next_event()
+static void post_due_events()
 {
     //this function should only be called from an atomic context
-	timer_tick_t next_fire_time;
-    do
-    {
-		//find the next event that has not yet passed, and schedule
-		//the 'late' events while we're at it
-		NG(next_event) = get_next_event();
-
-		if(NG(next_event) != NO_EVENT)
-		{
-			next_fire_time = NG(timers)[NG(next_event)].next_event;
-			if ( (((int32_t)next_fire_time) - ((int32_t)timer_get_counter_value())) <= 0 )
-			{
-				sched_post_task_prio(NG(timers)[NG(next_event)].f, NG(timers)[NG(next_event)].priority);
-				NG(timers)[NG(next_event)].f = 0x0;
-			}
-		}
-    }
-    while(NG(next_event) != NO_EVENT && ( (((int32_t)next_fire_time) - ((int32_t)timer_get_counter_value())) <= 0  ) );
+    //hand every event that is due to the scheduler in one pass
+    uint64_t counter = timer_get_counter_value64();
+    while(NG(heap_size) > 0 && NG(timers)[NG(heap)[0]].next_event <= counter)
+	expire_event(NG(heap)[0]);
+}
 
-    //at this point NG(next_event) is eiter equal to NO_EVENT (no tasks left)
-    //or we have the next event we can schedule
-    if(NG(next_event) == NO_EVENT)
-    {
-		//cancel the timer in case it is still running (can happen if we're called from timer_cancel_event)
-		NG(hw_event_scheduled) = false;
-		hw_timer_cancel(HW_TIMER_ID);
-    }
-    else
+static void narrow_wakeup(uint8_t pos, uint64_t* wakeup)
+{
+    //every event that may fire before *wakeup limits the wake-up to its own deadline.
+    //Thanks to the heap ordering we only have to visit the events inside the window
+    if(pos >= NG(heap_size))
+	return;
+
+    timer_entry_t* event = &NG(timers)[NG(heap)[pos]];
+    if(event->next_event > *wakeup)
+	return;
+
+    if(event->next_event + event->slack < *wakeup)
+	*wakeup = event->next_event + event->slack;
+
+    narrow_wakeup(2 * pos + 1, wakeup);
+    narrow_wakeup(2 * pos + 2, wakeup);
+}
+
+static void configure_next_event()
+{
+    //this function should only be called from an atomic context
+    //the HW timer is only programmed once, after all late events have been posted
+    uint64_t next_fire_time;
+    while(true)
     {
-		//calculate schedule time relative to current time rather than
-		//latest overflow time, to counteract any delays in updating counter_offset
-		//(eg when we're scheduling an event from an interrupt and thereby delaying
-		//the updating of counter_offset)
-    	timer_tick_t fire_delay = (next_fire_time - timer_get_counter_value());
-		//if the timer should fire in less ticks than supported by the HW timer --> schedule it
-		//(otherwise it is scheduled from timer_overflow when needed)
-		if(fire_delay < COUNTER_OVERFLOW_INCREASE)
-		{
-			NG(hw_event_scheduled) = true;
-			hw_timer_schedule_delay(HW_TIMER_ID, (hwtimer_tick_t)fire_delay);
-#ifndef NDEBUG	    
-			//check that we didn't try to schedule a timer in the past
-			//normally this shouldn't happen but it IS theoretically possible...
-			fire_delay = (next_fire_time - timer_get_counter_value());
-			//fire_delay should be in [0,COUNTER_OVERFLOW_INCREASE]. if this is not the case, it is because timer_get_counter() is
-			//now larger than next_fire_event, which means we 'missed' the event
-			assert(((int32_t)fire_delay) > 0);
-#endif
-		}
-		else
-		{
-			//set hw_event_scheduled explicitly to false to allow timer_overflow
-			//to schedule the event when needed
-			NG(hw_event_scheduled) = false;
-		}
+	post_due_events();
+	NG(next_event) = NG(heap_size) > 0 ? NG(heap)[0] : NO_EVENT;
+	if(NG(next_event) == NO_EVENT)
+	{
+	    //cancel the timer in case it is still running (can happen if we're called from timer_cancel_event)
+	    NG(hw_event_scheduled) = false;
+	    hw_timer_cancel(HW_TIMER_ID);
+	    return;
+	}
+
+	//calculate schedule time relative to current time rather than
+	//latest overflow time, to counteract any delays in updating counter_offset
+	//(eg when we're scheduling an event from an interrupt and thereby delaying
+	//the updating of counter_offset)
+	next_fire_time = NG(timers)[NG(next_event)].next_event + NG(timers)[NG(next_event)].slack;
+	narrow_wakeup(0, &next_fire_time);
+	NG(next_wakeup) = next_fire_time;
+	uint64_t fire_delay = get_delay(next_fire_time, timer_get_counter_value64());
+	//if the timer should fire in less ticks than supported by the HW timer --> schedule it
+	//(otherwise it is scheduled from timer_overflow when needed)
+	if(fire_delay >= COUNTER_OVERFLOW_INCREASE)
+	{
+	    //set hw_event_scheduled explicitly to false to allow timer_overflow
+	    //to schedule the event when needed
+	    NG(hw_event_scheduled) = false;
+	    return;
+	}
+
+	NG(hw_event_scheduled) = true;
+	hw_timer_schedule_delay(HW_TIMER_ID, (hwtimer_tick_t)fire_delay);
+	//if the counter reached the fire time while the HW timer was being programmed the
+	//compare match may be missed: post the event ourselves instead of waiting for it
+	if(next_fire_time > timer_get_counter_value64())
+	    return;
     }
 }
 static void timer_overflow()
 {
     NG(timer_offset) += COUNTER_OVERFLOW_INCREASE;
-    if(NG(next_event) != NO_EVENT && 		//there is an event scheduled at THIS timer level
-	(!NG(hw_event_scheduled)) &&		//but NOT at the hw timer level
-		NG(timers)[NG(next_event)].next_event <= (NG(timer_offset) + COUNTER_OVERFLOW_INCREASE) //and the next trigger will happen before the next overflow
-	)
-    {
-		//normally this shouldn't happen. Put an assert here just to make sure
-		assert(NG(timers)[NG(next_event)].next_event >= NG(timer_offset));
-		timer_tick_t fire_time = (NG(timers)[NG(next_event)].next_event - NG(timer_offset));
-
-		//fire time already passed
-		if(fire_time <= hw_timer_getvalue(HW_TIMER_ID))
-			timer_fired();
-		else
-		{
-			NG(hw_event_scheduled) = true;
-			hw_timer_schedule(HW_TIMER_ID, fire_time);
-			//again: this should normally not happen: (but it's possible in theory)
-			//so: add an assert to make sure. If it ever triggers,
-			//we'll have to insert a workaround
-			assert(fire_time >= hw_timer_getvalue(HW_TIMER_ID));
-		}
-    }
+    //an event beyond the range of the HW timer is scheduled from the overflow before it, or posted when it is late
+    if(NG(next_event) != NO_EVENT && !NG(hw_event_scheduled) &&
+       NG(next_wakeup) < NG(timer_offset) + COUNTER_OVERFLOW_INCREASE)
+	configure_next_event();
 }
 
 static void timer_fired()
 {
     assert(NG(next_event) != NO_EVENT);
     assert(NG(timers)[NG(next_event)].f != 0x0);
-    sched_post_task_prio(NG(timers)[NG(next_event)].f, NG(timers)[NG(next_event)].priority);
-    NG(timers)[NG(next_event)].f = 0x0;
+    expire_event(NG(next_event));
     configure_next_event();
 }
+
+__LINK_C void timer_get_stats(pool_stats_t* stats)
+{
+    start_atomic();
+    *stats = NG(pool_stats);
+    end_atomic();
+}
+
+__LINK_C void timer_reset_stats()
+{
+    start_atomic();
+    pool_stats_reset(&NG(pool_stats));
+    end_atomic();
+}
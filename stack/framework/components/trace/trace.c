@@ -0,0 +1,113 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file trace.c
+ *
+ */
+
+#include "trace.h"
+#include "errors.h"
+#include "ng.h"
+#include "timer.h"
+#include "hwatomic.h"
+
+#include <stdio.h>
+
+#ifdef FRAMEWORK_TRACE_ENABLED
+
+static trace_record_t NGDEF(_trace_records)[FRAMEWORK_TRACE_SIZE];
+#define trace_records NG(_trace_records)
+
+// the index of the record to write next, the oldest record once the trace wrapped around
+static uint16_t NGDEF(_trace_next);
+#define trace_next NG(_trace_next)
+
+static uint16_t NGDEF(_trace_count);
+#define trace_count NG(_trace_count)
+
+__LINK_C void trace_record(log_stack_layer_t layer, uint8_t event, uint8_t dialog_id, uint8_t transaction_id,
+                           uint16_t arg1, uint16_t arg2)
+{
+    timer_tick_t timestamp = timer_get_counter_value();
+
+    start_atomic();
+    trace_record_t* record = &trace_records[trace_next];
+    trace_next++;
+    if(trace_next == FRAMEWORK_TRACE_SIZE)
+        trace_next = 0;
+
+    if(trace_count < FRAMEWORK_TRACE_SIZE)
+        trace_count++;
+
+    record->timestamp = timestamp;
+    record->layer = layer;
+    record->event = event;
+    record->dialog_id = dialog_id;
+    record->transaction_id = transaction_id;
+    record->arg1 = arg1;
+    record->arg2 = arg2;
+    end_atomic();
+}
+
+__LINK_C uint16_t trace_get_record_count()
+{
+    return trace_count;
+}
+
+__LINK_C error_t trace_get_record(uint16_t index, trace_record_t* record)
+{
+    error_t err = SUCCESS;
+    start_atomic();
+    if(index >= trace_count)
+        err = ESIZE;
+    else
+    {
+        // the oldest record is at trace_next once the trace is full, at 0 before
+        uint16_t first = (trace_count == FRAMEWORK_TRACE_SIZE) ? trace_next : 0;
+        *record = trace_records[(first + index) % FRAMEWORK_TRACE_SIZE];
+    }
+
+    end_atomic();
+    return err;
+}
+
+__LINK_C void trace_dump()
+{
+    // the records are copied one at a time, so every event recorded meanwhile in a full trace skips one record.
+    // Dump the trace while the traced code is idle
+    trace_record_t record;
+    printf("\n\rtime\tlayer\tevent\tdialog\ttrans\targ1\targ2");
+    for(uint16_t i = 0; trace_get_record(i, &record) == SUCCESS; i++)
+    {
+        printf("\n\r%lu\t%d\t%d\t%d\t%d\t%d\t%d", (unsigned long)record.timestamp, record.layer, record.event,
+               record.dialog_id, record.transaction_id, record.arg1, record.arg2);
+    }
+
+    printf("\n\r");
+    fflush(stdout);
+}
+
+__LINK_C void trace_reset()
+{
+    start_atomic();
+    trace_next = 0;
+    trace_count = 0;
+    end_atomic();
+}
+
+#endif //FRAMEWORK_TRACE_ENABLED
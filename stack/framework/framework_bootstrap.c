@@ -24,21 +24,23 @@
 #include "console.h"
 
 void bootstrap();
+//the user bootstrap function
+SCHED_REGISTER_TASK(bootstrap);
+
 void __framework_bootstrap()
 {
     //initialise the scheduler & timers
     scheduler_init();
     timer_init();
-    //initialise libc RNG with the unique device id
+    //seed the RNG with the unique device id
     set_rng_seed(hw_get_unique_id());
     //reset the log counter
     log_counter_reset();
+    log_init();
 
 #ifdef FRAMEWORK_CONSOLE_ENABLED
     console_init();
 #endif
 
-    //register the user bootstrap function();
-    sched_register_task(&bootstrap);
     sched_post_task(&bootstrap);
 }
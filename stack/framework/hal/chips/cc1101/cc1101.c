@@ -39,17 +39,19 @@
 
 #include "log.h"
 #include "hwradio.h"
+#include "hwatomic.h"
 #include "hwsystem.h"
 #include "hwdebug.h"
+#include "energy.h"
 
 #include "cc1101.h"
 #include "cc1101_interface.h"
 #include "cc1101_constants.h"
 #include "cc1101_registers.h"
 
-#include "pn9.h"
 #include "fec.h"
-#include "crc.h"
+#include "phy_coding.h"
+#include "ramfunc.h"
 
 // turn on/off the debug prints
 #if defined(FRAMEWORK_LOG_ENABLED) && defined(FRAMEWORK_PHY_LOG_ENABLED)
@@ -70,7 +72,7 @@ static bool has_hardware_crc = false;
 
 #define RSSI_OFFSET 74
 
-#if DEBUG_PIN_NUM >= 2
+#if DEBUG_PIN_NUM >= 2 && !defined(FRAMEWORK_DEBUG_PROBES_ENABLED)
     #define DEBUG_TX_START() hw_debug_set(0);
     #define DEBUG_TX_END() hw_debug_clr(0);
     #define DEBUG_RX_START() hw_debug_set(1);
@@ -96,6 +98,8 @@ static release_packet_callback_t release_packet_callback;
 static rx_packet_callback_t rx_packet_callback;
 static tx_packet_callback_t tx_packet_callback;
 static rssi_valid_callback_t rssi_valid_callback;
+static cca_callback_t cca_callback;
+static rx_header_filter_callback_t rx_header_filter_callback;
 
 static hw_radio_state_t current_state;
 static hw_radio_packet_t* current_packet;
@@ -107,6 +111,7 @@ static channel_id_t current_channel_id = {
 };
 
 static syncword_class_t current_syncword_class = PHY_SYNCWORD_CLASS0;
+static timer_tick_t rx_sync_timestamp;
 static eirp_t current_eirp = 0;
 
 static bool should_rx_after_tx_completed = false;
@@ -114,10 +119,34 @@ static hw_rx_cfg_t pending_rx_cfg;
 
 static bool writeRemainingDataFlag = false;
 static bool endOfPacket = false;
-static uint8_t bytesLeft;
+static uint16_t bytesLeft;
 static uint8_t *BufferIndex;
+// a foreground FEC frame is decoded per FIFO chunk while it is received, instead of storing the encoded frame
+static bool rx_fec_decoding = false;
+static uint8_t rx_fec_chunk[FIFO_SIZE];
+static bool rx_header_pending = false; // see end_of_packet_isr()
+// the frame is decoded and its CRC calculated as its bytes are read, see start_rx_decoding()
+static phy_decoder_t rx_decoder;
+// background frames have no length byte, they are stored after the length field of the packet
+static uint8_t rx_data_offset;
 static uint8_t iterations;
 
+static hw_radio_stats_t stats;
+
+// the duration of one byte on air in us per channel class, the FIFO levels beyond the thresholds are converted into
+// ISR latencies with it (see hw_radio_stats_t)
+static const uint16_t byte_duration_us[4] = { 833, 144, 144, 48 };
+// the TX FIFO threshold interrupt fires when the TX FIFO drains below this level, see FIFOTHR in radio_init()
+#define TX_FIFO_THRESHOLD_LEVEL (FIFO_SIZE - AVAILABLE_BYTES_IN_TX_FIFO)
+
+static void add_isr_latency(int16_t late_bytes)
+{
+    if (late_bytes < 0)
+        late_bytes = 0;
+
+    hw_radio_stats_add_isr_latency(&stats, late_bytes * byte_duration_us[current_channel_id.channel_header.ch_class]);
+}
+
 const uint16_t sync_word_value[2][4] = {
     { 0xE6D0, 0x0000, 0xF498, 0x0000 },
     { 0x0B67, 0x0000, 0x192F, 0x0000 }
@@ -141,8 +170,20 @@ const uint8_t bg_timeout[4] = {
 };
 
 static void start_rx(hw_rx_cfg_t const* rx_cfg);
+static bool read_rx_header();
+static void flush_rx_frame();
+static void capture_calibration(bool completed);
+static void report_rssi();
+static void report_cca();
+static int16_t radio_get_rssi();
+
+// the RSSI is valid about 200 us after entering RX (see DN505), the first tick of a delay can be a partial one
+#define RSSI_VALID_DELAY (((200 * TIMER_TICKS_PER_SEC) + 999999) / 1000000 + 1)
 
-static RF_SETTINGS rf_settings = {
+#define RADIO_MDMCFG2_VALUE (RADIO_MDMCFG2_DEM_DCFILT_ON | RADIO_MDMCFG2_MOD_FORMAT_GFSK | RADIO_MDMCFG2_SYNC_MODE_16in16CS)
+
+// constant, so the fields used after the initialisation are folded into the code
+static const RF_SETTINGS rf_settings = {
    RADIO_GDO2_VALUE,               // IOCFG2    GDO2 output pin configuration.
    RADIO_GDO1_VALUE,               // IOCFG1    GDO1 output pin configuration.
    RADIO_GDO0_VALUE,               // IOCFG0    GDO0 output pin configuration.
@@ -161,7 +202,7 @@ static RF_SETTINGS rf_settings = {
    RADIO_FREQ0(RADIO_FREQ_433_NORMAL_RATE),   // FREQ0     Frequency control word, low byte.
    RADIO_MDMCFG4_NORMAL_RATE,
    RADIO_MDMCFG3_DRATE_M_NORMAL_RATE,         // MDMCFG3   Modem configuration.
-   RADIO_MDMCFG2_DEM_DCFILT_ON | RADIO_MDMCFG2_MOD_FORMAT_GFSK | RADIO_MDMCFG2_SYNC_MODE_16in16CS,   // MDMCFG2   Modem configuration.
+   RADIO_MDMCFG2_VALUE,            // MDMCFG2   Modem configuration.
    RADIO_MDMCFG1_NUM_PREAMBLE_4B | RADIO_MDMCFG1_CHANSPC_E_NORMAL_RATE,   // MDMCFG1   Modem configuration.
    RADIO_MDMCFG0_CHANSPC_M_NORMAL_RATE,       // MDMCFG0   Modem configuration.
    RADIO_DEVIATN_NORMAL_RATE,   // DEVIATN   Modem deviation setting (when FSK modulation is enabled).
@@ -185,13 +226,103 @@ static RF_SETTINGS rf_settings = {
    RADIO_FSCAL0(31)               // FSCAL0    Frequency synthesizer calibration.
 };
 
+/*
+ * The background sniff uses Wake-On-Radio: the radio wakes up every EVENT0 period and listens during the RX
+ * timeout, which is EVENT0 / 2^(RX_TIME + 3) with WOR_RES = 0. It goes back to sleep when no carrier is sensed
+ * or when no sync word is found before the timeout.
+ */
+#define WOR_EVENT0_UNIT_NS 28846 // 750 / f_xosc with WOR_RES = 0 and a 26 MHz crystal
+
+// the typical RSSI at which the carrier sense is asserted with CARRIER_SENSE_ABS_THR = 0 and the configured AGC targets
+#define CS_ABS_THR_RSSI -93
+
+static bool sniff_enabled = false;
+static int16_t scan_rssi = HW_RSSI_INVALID; // sampled by a background scan terminated right away, until RX or TX
+static bool cca_threshold_set = false; // the carrier sense threshold of a CCA is in AGCCTRL1, see radio_cca()
+static bool advertising = false; // see fill_advertising_fifo()
+static uint8_t sniff_mcsm2;
+static uint8_t sniff_agcctrl1;
+static uint16_t sniff_event0;
+
+static void start_wor()
+{
+    uint8_t regs[] = {
+        MCSM2, sniff_mcsm2,
+        AGCCTRL1, sniff_agcctrl1,
+        WOREVT1, RADIO_WOREVT1_EVENT0_HI(sniff_event0 >> 8),
+        WOREVT0, RADIO_WOREVT0_EVENT0_LO(sniff_event0 & 0xFF),
+        WORCTRL, RADIO_WORCTRL_EVENT1_TIMEOUT48 | RADIO_WORCTRL_RC_CAL | RADIO_WORCTRL_WOR_RES_29us
+    };
+
+    cc1101_interface_write_regs(regs, sizeof(regs) / 2);
+
+    current_state = HW_RADIO_STATE_RX;
+    energy_radio_state_changed(ENERGY_RADIO_RX, 0);
+    sniff_enabled = true;
+
+    // the MCU is only interrupted at the end of a received background frame
+    c1101_interface_set_edge_interrupt(CC1101_GDO0, GPIO_FALLING_EDGE);
+    cc1101_interface_set_interrupts_enabled(CC1101_GDO0, true);
+
+    cc1101_interface_strobe(RF_SWORRST);
+    cc1101_interface_strobe(RF_SWOR);
+}
+
+// leaves WOR and restores the settings used by the other radio operations
+static void stop_sniff()
+{
+    if (!sniff_enabled)
+        return;
+
+    sniff_enabled = false;
+    cc1101_interface_strobe(RF_SIDLE);
+    const uint8_t regs[] = { MCSM2, rf_settings.mcsm2, AGCCTRL1, rf_settings.agcctrl1, WORCTRL, rf_settings.worctrl };
+    cc1101_interface_write_regs(regs, sizeof(regs) / 2);
+}
+
+// cancels a CCA in progress and restores the carrier sense threshold of the other radio operations
+static void stop_cca()
+{
+    cca_callback = NULL;
+    timer_cancel_task(&report_cca);
+    if (!cca_threshold_set)
+        return;
+
+    cca_threshold_set = false;
+    cc1101_interface_write_single_reg(AGCCTRL1, rf_settings.agcctrl1);
+}
+
+// another radio operation interrupts the frame being received after its sync word, the packet it was read into is released
+static void abandon_rx_frame()
+{
+    if (current_state != HW_RADIO_STATE_RX || !(rx_header_pending || endOfPacket))
+        return;
+
+    stats.sync_without_packet++;
+    rx_header_pending = false;
+    rx_fec_decoding = false;
+    if (endOfPacket)
+    {
+        endOfPacket = false;
+        release_packet_callback(current_packet);
+    }
+}
+
 static void switch_to_idle_mode()
 {
     DPRINT("Switching to HW_RADIO_STATE_IDLE");
+    abandon_rx_frame();
+    timer_cancel_task(&report_rssi);
+    stop_cca();
+    capture_calibration(false);
+    stop_sniff();
+    advertising = false;
+    rx_header_pending = false;
     //Flush FIFOs and go to sleep, ensure interrupts are disabled
     cc1101_interface_set_interrupts_enabled(CC1101_GDO0, false);
     cc1101_interface_set_interrupts_enabled(CC1101_GDO2, false);
     current_state = HW_RADIO_STATE_IDLE;
+    energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
     cc1101_interface_strobe(RF_SFRX); // TODO cc1101 datasheet : Only issue SFRX in IDLE or RXFIFO_OVERFLOW states
     cc1101_interface_strobe(RF_SFTX); // TODO cc1101 datasheet : Only issue SFTX in IDLE or TXFIFO_UNDERFLOW states.
     cc1101_interface_strobe(RF_SIDLE);
@@ -224,15 +355,235 @@ static void ensure_settling_and_calibration_done()
     }
 }
 
-static void fifo_threshold_isr()
+/*
+ * The advertising engine streams the background frames of a D7AAdvP flooding back-to-back from the TX FIFO
+ * threshold ISR. The frames and their decreasing ETA are computed upfront from the number of bytes sent
+ * before them, for the exact data rate. A small ring holds the encoded frames ahead of the FIFO, a slot is
+ * encoded again with a next frame as soon as it is written to the FIFO.
+ * The whole flooding is a single infinite length packet: the preamble and the sync word of the first frame
+ * are inserted by the transceiver, those of the next frames are part of the ring frames.
+ */
+#define ADV_RING_SIZE 4
+#define ADV_FRAME_MAX_SIZE (PREAMBLE_HI_RATE_CLASS + 2 + 16) // preamble, sync word and the FEC encoded frame
+
+// the duration of one byte on air in timer ticks, in 16.16 fixed point
+#define ADV_BYTE_DURATION(bitrate) ((uint32_t)(((((uint64_t)8 * TIMER_TICKS_PER_SEC) << 16) + (bitrate) - 1) / (bitrate)))
+
+static const uint32_t adv_byte_duration[4] = {
+    ADV_BYTE_DURATION(9600),
+    ADV_BYTE_DURATION(55555), // RFU
+    ADV_BYTE_DURATION(55555),
+    ADV_BYTE_DURATION(166667)
+};
+
+static uint8_t adv_frames[ADV_RING_SIZE][ADV_FRAME_MAX_SIZE];
+static uint8_t adv_payload[BACKGROUND_FRAME_LENGTH];
+static uint8_t adv_header_len;  // preamble and sync word
+static uint8_t adv_frame_len;   // on air, including the preamble and the sync word
+static uint16_t adv_frame_count;
+static uint16_t adv_prepared_count;
+static uint16_t adv_written_count;
+static uint8_t adv_frame_offset; // the next byte of the frame being written to the FIFO
+static uint32_t adv_padding_len;
+static uint32_t adv_total_len;   // on air
+
+static void encode_advertising_frame(uint16_t index)
+{
+    uint8_t* frame = adv_frames[index % ADV_RING_SIZE];
+    uint8_t* payload = frame + adv_header_len;
+
+    // the ETA of a frame is the time left after its end, the ETA is transmitted in Ti
+    uint64_t bytes_left = adv_total_len - (uint32_t)(index + 1) * adv_frame_len;
+    timer_tick_t eta = (bytes_left * adv_byte_duration[current_channel_id.channel_header.ch_class] + 0xFFFF) >> 16;
+
+    memcpy(payload, adv_payload, BACKGROUND_FRAME_LENGTH);
+    uint16_t swap_eta = __builtin_bswap16(TIMER_TICKS_TO_TI(eta));
+    memcpy(&payload[2], &swap_eta, sizeof(uint16_t));
+
+    // the packet handler is disabled during the advertising, the frames are whitened in SW as well
+    uint8_t stages = PHY_STAGE_CRC | PHY_STAGE_PN9;
+    if (current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+        stages |= PHY_STAGE_FEC;
+
+    phy_encode_frame(stages, payload, BACKGROUND_FRAME_LENGTH);
+}
+
+static void prepare_advertising(uint8_t* payload, timer_tick_t eta)
 {
+    // the payload is copied so the upper layer can reuse the packet during the advertising
+    memcpy(adv_payload, payload, BACKGROUND_FRAME_LENGTH);
+
+    uint8_t preamble_len = (current_channel_id.channel_header.ch_class == PHY_CLASS_HI_RATE ? PREAMBLE_HI_RATE_CLASS : PREAMBLE_LOW_RATE_CLASS);
+    uint8_t encoded_len = BACKGROUND_FRAME_LENGTH;
+    if (current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+        encoded_len = fec_calculated_decoded_length(BACKGROUND_FRAME_LENGTH);
+
+    adv_header_len = preamble_len + 2;
+    adv_frame_len = adv_header_len + encoded_len;
+
+    // fill the advertising period with whole frames, the remainder is padded with preamble symbols
+    // in order to guarantee no silence period before the foreground frame
+    adv_total_len = ((uint64_t)eta << 16) / adv_byte_duration[current_channel_id.channel_header.ch_class];
+    if (adv_total_len < adv_frame_len)
+        adv_total_len = adv_frame_len;
+
+    adv_frame_count = adv_total_len / adv_frame_len;
+    adv_padding_len = adv_total_len - (uint32_t)adv_frame_count * adv_frame_len;
+
+    // the flooding is terminated as a fixed length packet of (length mod 256) bytes, which cannot be 0
+    if ((adv_total_len - adv_header_len) % 256 == 0)
+    {
+        adv_padding_len++;
+        adv_total_len++;
+    }
+
+    uint16_t sync_word = __builtin_bswap16(sync_word_value[current_syncword_class][current_channel_id.channel_header.ch_coding]);
+    for (uint8_t i = 0; i < ADV_RING_SIZE; i++)
+    {
+        memset(adv_frames[i], 0xAA, preamble_len); // preamble length is given in number of bytes
+        memcpy(&adv_frames[i][preamble_len], &sync_word, 2);
+    }
+
+    adv_prepared_count = 0;
+    while (adv_prepared_count < ADV_RING_SIZE && adv_prepared_count < adv_frame_count)
+        encode_advertising_frame(adv_prepared_count++);
+
+    adv_written_count = 0;
+    adv_frame_offset = adv_header_len; // the transceiver inserts the preamble and sync word of the first frame
+    advertising = true;
+}
+
+// bytes_in_fifo is the TXBYTES status register
+static void fill_advertising_fifo(uint8_t bytes_in_fifo)
+{
+    uint8_t available = FIFO_SIZE - (bytes_in_fifo & 0x7F);
+
+    while (available > 0 && adv_written_count < adv_frame_count)
+    {
+        uint8_t len = adv_frame_len - adv_frame_offset;
+        if (len > available)
+            len = available;
+
+        cc1101_interface_write_burst_reg(TXFIFO, &adv_frames[adv_written_count % ADV_RING_SIZE][adv_frame_offset], len);
+        available -= len;
+        adv_frame_offset += len;
+        if (adv_frame_offset == adv_frame_len)
+        {
+            adv_written_count++;
+            adv_frame_offset = 0;
+            if (adv_prepared_count < adv_frame_count)
+                encode_advertising_frame(adv_prepared_count++);
+        }
+    }
+
+    uint8_t preamble[16];
+    memset(preamble, 0xAA, sizeof(preamble));
+    while (available > 0 && adv_written_count == adv_frame_count && adv_padding_len > 0)
+    {
+        uint8_t len = available < sizeof(preamble) ? available : sizeof(preamble);
+        if (len > adv_padding_len)
+            len = adv_padding_len;
+
+        cc1101_interface_write_burst_reg(TXFIFO, preamble, len);
+        available -= len;
+        adv_padding_len -= len;
+    }
+
+    if (adv_written_count == adv_frame_count && adv_padding_len == 0)
+    {
+        // all the bytes are in the FIFO, switch to fixed length mode so the transceiver ends the packet
+        DPRINT("Last advertising bytes in the FIFO");
+        uint8_t regs[] = { PKTLEN, (adv_total_len - adv_header_len) % 256, PKTCTRL0, RADIO_PKTCTRL0_LENGTH_FIXED };
+        cc1101_interface_write_regs(regs, sizeof(regs) / 2);
+        c1101_interface_set_edge_interrupt(CC1101_GDO0, GPIO_FALLING_EDGE);
+        cc1101_interface_set_interrupts_enabled(CC1101_GDO0, true);
+    }
+    else
+    {
+        c1101_interface_set_edge_interrupt(CC1101_GDO2, GPIO_FALLING_EDGE);
+        cc1101_interface_set_interrupts_enabled(CC1101_GDO2, true);
+    }
+}
+
+// starts decoding a frame of frame_length bytes (the length byte excluded) of encoded_length bytes, into current_packet->data
+// from offset on. The packet handler dewhitens the frame, the CRC is always checked in SW (see radio_get_capabilities()).
+static void start_rx_decoding(uint8_t offset, uint8_t frame_length, uint16_t encoded_length, bool fec)
+{
+    rx_data_offset = offset;
+    phy_decoder_init(&rx_decoder, fec ? PHY_STAGE_CRC | PHY_STAGE_FEC : PHY_STAGE_CRC, current_packet->data + offset,
+                     frame_length + 1 - offset, encoded_length);
+}
+
+// decodes the bytes of a frame without FEC read into current_packet->data up to end, which are complete
+static void update_rx_decoding(uint8_t* end)
+{
+    phy_decoder_update(&rx_decoder, end - current_packet->data - rx_data_offset);
+}
+
+__HOT_RAMFUNC static void fifo_threshold_isr()
+{
+    // the FIFO level tells how long the interrupt waited for its handler. The SPI interface reads the status registers
+    // until two reads match (see the CC1101 Errata Note), so a frame is not dropped on a wrong overflow flag.
+    uint8_t fifo_bytes = 0;
+    if (current_state == HW_RADIO_STATE_TX)
+    {
+        fifo_bytes = cc1101_interface_read_single_reg(TXBYTES);
+        if (fifo_bytes & 0x80)
+        {
+            DPRINT("TX FIFO underflow %x", fifo_bytes);
+            stats.tx_fifo_underflows++;
+        }
+        else
+            add_isr_latency(TX_FIFO_THRESHOLD_LEVEL - fifo_bytes);
+    }
+
+    if (advertising && current_state == HW_RADIO_STATE_TX)
+    {
+        fill_advertising_fifo(fifo_bytes);
+        return;
+    }
+
     switch(current_state)
     {
         case HW_RADIO_STATE_RX: ;
+            fifo_bytes = cc1101_interface_read_single_reg(RXBYTES);
+            if (fifo_bytes & 0x80)
+            {
+                // the frame is lost, restarting RX flushes it from the FIFO
+                DPRINT("RX FIFO overflow");
+                stats.rx_fifo_overflows++;
+                if (endOfPacket)
+                    release_packet_callback(current_packet);
+
+                flush_rx_frame();
+                break;
+            }
+
+            add_isr_latency(fifo_bytes - (rx_header_pending ? 4 : BYTES_IN_RX_FIFO));
+
+            // the lowered threshold signals that the header is in the FIFO, see end_of_packet_isr()
+            if (rx_header_pending)
+            {
+                read_rx_header();
+                break;
+            }
+
             // Do not empty the FIFO (See the CC1100 or 2500 Errata Note)
-            cc1101_interface_read_burst_reg(RXFIFO, BufferIndex, (BYTES_IN_RX_FIFO - 1));
+            if (rx_fec_decoding)
+            {
+                cc1101_interface_read_burst_reg(RXFIFO, rx_fec_chunk, (BYTES_IN_RX_FIFO - 1));
+                phy_decoder_feed(&rx_decoder, rx_fec_chunk, (BYTES_IN_RX_FIFO - 1));
+            }
+            else
+            {
+                // the burst completes while the frame is received, the burst before is complete once this one started,
+                // its bytes are added to the CRC meanwhile
+                cc1101_interface_read_burst_reg_async(RXFIFO, BufferIndex, (BYTES_IN_RX_FIFO - 1));
+                update_rx_decoding(BufferIndex);
+                BufferIndex += (BYTES_IN_RX_FIFO - 1);
+            }
+
             bytesLeft -= (BYTES_IN_RX_FIFO - 1);
-            BufferIndex += (BYTES_IN_RX_FIFO - 1);
 
             //c1101_interface_set_edge_interrupt(CC1101_GDO2, GPIO_RISING_EDGE);
             cc1101_interface_set_interrupts_enabled(CC1101_GDO2, true);
@@ -242,14 +593,14 @@ static void fifo_threshold_isr()
             if (writeRemainingDataFlag)
             {
                 // We have space enough in the FIFO to write the remaining data
-                cc1101_interface_write_burst_reg(TXFIFO, BufferIndex, bytesLeft);
+                cc1101_interface_write_burst_reg_async(TXFIFO, BufferIndex, bytesLeft);
                 // Wait end of packet transmission
                 c1101_interface_set_edge_interrupt(CC1101_GDO0, GPIO_FALLING_EDGE);
                 cc1101_interface_set_interrupts_enabled(CC1101_GDO0, true);
             }
             else
             {
-                cc1101_interface_write_burst_reg(TXFIFO, BufferIndex, AVAILABLE_BYTES_IN_TX_FIFO);
+                cc1101_interface_write_burst_reg_async(TXFIFO, BufferIndex, AVAILABLE_BYTES_IN_TX_FIFO);
 
                 BufferIndex += AVAILABLE_BYTES_IN_TX_FIFO;
                 bytesLeft -= AVAILABLE_BYTES_IN_TX_FIFO;
@@ -265,88 +616,172 @@ static void fifo_threshold_isr()
     }
 }
 
-static void end_of_packet_isr()
+// flushes the frame being received from the FIFO, its packet is not allocated or already released
+static void flush_rx_frame()
+{
+    endOfPacket = false;
+    rx_header_pending = false;
+    rx_fec_decoding = false;
+    bool sniffing = sniff_enabled;
+    switch_to_idle_mode();
+
+    // a foreground scan and a background sniff remain active, a background scan ends with the dropped frame
+    if(sniffing)
+        start_wor();
+    else if(current_syncword_class != PHY_SYNCWORD_CLASS0)
+        start_rx(&(hw_rx_cfg_t){ .channel_id = current_channel_id, .syncword_class = current_syncword_class });
+}
+
+static void discard_rx_packet()
+{
+    // no packet buffer available or the frame was filtered
+    DPRINT("dropping RX packet");
+    stats.aborted_frames++;
+    flush_rx_frame();
+}
+
+// reads the length and the header of a foreground frame, once its first 4 bytes are in the RX FIFO.
+// Returns false when the frame is dropped.
+static bool read_rx_header()
+{
+    rx_header_pending = false;
+    cc1101_interface_write_single_reg(FIFOTHR, RADIO_FIFOTHR_FIFO_THR_45_20);
+
+    uint8_t buffer[4];
+    cc1101_interface_read_burst_reg(RXFIFO, buffer, 4);
+
+    // the header bytes are decoded for the filter, 4 FEC encoded bytes hold 2 decoded bytes
+    uint16_t packet_len;
+    uint8_t* header = buffer;
+    uint8_t header_len = 4;
+    uint8_t fec_buffer[4];
+    rx_fec_decoding = (current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9);
+    if (rx_fec_decoding)
+    {
+        memcpy(fec_buffer, buffer, 4);
+        fec_decode_packet(fec_buffer, 4, 4);
+        packet_len = fec_calculated_decoded_length(fec_buffer[0]+1);
+        DPRINT("RX Packet Length: %d / %d", fec_buffer[0], packet_len);
+        header = fec_buffer;
+        header_len = 2;
+    }
+    else
+    {
+        packet_len = buffer[0] + 1;
+    }
+
+    if(rx_header_filter_callback != NULL && !rx_header_filter_callback(header, header_len))
+    {
+        discard_rx_packet();
+        return false;
+    }
+
+    // only the decoded frame is stored when decoding on the fly
+    current_packet = alloc_packet_callback(rx_fec_decoding ? fec_buffer[0] + 1 : packet_len);
+    if(current_packet == NULL)
+    {
+        discard_rx_packet();
+        return false;
+    }
+
+    start_rx_decoding(0, header[0], packet_len, rx_fec_decoding);
+    phy_decoder_feed(&rx_decoder, buffer, 4);
+
+    bytesLeft = packet_len - 4;
+    BufferIndex = current_packet->data + 4;
+    endOfPacket = true;
+
+    if (bytesLeft < FIFO_SIZE)
+    {
+        // Disable interrupt on threshold since it is room for the whole packet in the FIFO
+        cc1101_interface_set_interrupts_enabled(CC1101_GDO2, false);
+    }
+    else
+    {
+        // Asserts when RX FIFO is filled at or above the RX FIFO threshold.
+        c1101_interface_set_edge_interrupt(CC1101_GDO2, GPIO_RISING_EDGE);
+        cc1101_interface_set_interrupts_enabled(CC1101_GDO2, true);
+    }
+
+    return true;
+}
+
+__HOT_RAMFUNC static void end_of_packet_isr()
 {
     DPRINT("end of packet ISR");
     switch(current_state)
     {
         case HW_RADIO_STATE_RX: ;
-            uint8_t packet_len = 0;
+            uint16_t packet_len = 0;
+
+            // the first interrupt of a foreground frame signals its sync word, a background frame only interrupts
+            // at its end
+            if (!endOfPacket && !rx_header_pending)
+                rx_sync_timestamp = timer_get_counter_value();
 
             if (current_syncword_class == PHY_SYNCWORD_CLASS0)
             {
                 DPRINT("BG packet received!");
-                uint8_t packet_len;
                 if (current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
                     packet_len = fec_calculated_decoded_length(BACKGROUND_FRAME_LENGTH);
                 else
                     packet_len = BACKGROUND_FRAME_LENGTH;
 
                 current_packet = alloc_packet_callback(packet_len);
+                if(current_packet == NULL)
+                {
+                    discard_rx_packet();
+                    break;
+                }
+
                 current_packet->length = BACKGROUND_FRAME_LENGTH;
+                // a FEC coded background frame is decoded at its end, in place
+                start_rx_decoding(1, BACKGROUND_FRAME_LENGTH, packet_len,
+                                  current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9);
                 bytesLeft = packet_len;
                 BufferIndex = current_packet->data + 1;
+                rx_fec_decoding = false;
                 endOfPacket = true;
             }
 
-            if (!endOfPacket)
+            if (!endOfPacket && !rx_header_pending)
             {
                 // After the sync word is received one needs to wait some time before there will be any data
-                // in the FIFO. In addition, the FIFO should not be emptied
+                // in the FIFO. Instead of polling RXBYTES the RX FIFO threshold is lowered to the 4 header bytes,
+                // the header is read from the FIFO threshold ISR. In addition, the FIFO should not be emptied
                 // (See the CC1100 or 2500 Errata Note) before the whole packet has been received.
-                uint8_t rx_bytes = 0;
-                do
-                {
-                    cc1101_interface_read_burst_reg(RXBYTES, &rx_bytes, 1);
-                    rx_bytes = rx_bytes & 0x7F;
-                } while (rx_bytes < 4);  // TODO counter to avoid a dead lock
-
-                uint8_t buffer[4];
-                cc1101_interface_read_burst_reg(RXFIFO, buffer, 4);
-
-                if (current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
-                {
-                    uint8_t fec_buffer[4];
-                    memcpy(fec_buffer, buffer, 4);
-                    fec_decode_packet(fec_buffer, 4, 4);
-                    packet_len = fec_calculated_decoded_length(fec_buffer[0]+1);
-                    DPRINT("RX Packet Length: %d / %d", fec_buffer[0], packet_len);
-                }
-                else
-                {
-                    packet_len = buffer[0] + 1;
-                }
+                rx_header_pending = true;
+                cc1101_interface_write_single_reg(FIFOTHR, RADIO_FIFOTHR_FIFO_THR_61_4);
+                c1101_interface_set_edge_interrupt(CC1101_GDO2, GPIO_RISING_EDGE);
+                cc1101_interface_set_interrupts_enabled(CC1101_GDO2, true);
 
-                current_packet = alloc_packet_callback(packet_len);
-                memcpy(current_packet->data, buffer, 4);
+                // Enables external interrupt on falling edge (packet received)
+                c1101_interface_set_edge_interrupt(CC1101_GDO0, GPIO_FALLING_EDGE);
+                cc1101_interface_set_interrupts_enabled(CC1101_GDO0, true);
 
-                bytesLeft = packet_len - 4;
-                BufferIndex = current_packet->data + 4;
-                endOfPacket = true;
+                // no edge occurs when the threshold was already reached before enabling the interrupt
+                uint8_t rx_bytes = 0;
+                cc1101_interface_read_burst_reg(RXBYTES, &rx_bytes, 1);
+                if ((rx_bytes & 0x7F) >= 4)
+                    read_rx_header();
+            }
+            else if (endOfPacket || read_rx_header()) // the frame can end before its header was read
+            {   // End of Packet
+                capture_calibration(true);
 
-                if (bytesLeft < FIFO_SIZE)
+                if (rx_fec_decoding)
                 {
-                    // Disable interrupt on threshold since it is room for the whole packet in the FIFO
-                    cc1101_interface_set_interrupts_enabled(CC1101_GDO2, false);
-                    if (bytesLeft <= rx_bytes)
-                        goto end_of_packet;
+                    // only the tail of the frame remains to be decoded
+                    cc1101_interface_read_burst_reg(RXFIFO, rx_fec_chunk, bytesLeft);
+                    phy_decoder_feed(&rx_decoder, rx_fec_chunk, bytesLeft);
                 }
                 else
                 {
-                    // Asserts when RX FIFO is filled at or above the RX FIFO threshold.
-                    c1101_interface_set_edge_interrupt(CC1101_GDO2, GPIO_RISING_EDGE);
-                    cc1101_interface_set_interrupts_enabled(CC1101_GDO2, true);
+                    cc1101_interface_read_burst_reg(RXFIFO, BufferIndex, bytesLeft);
+                    if (current_channel_id.channel_header.ch_coding != PHY_CODING_FEC_PN9)
+                        update_rx_decoding(BufferIndex + bytesLeft);
                 }
 
-                // Enables external interrupt on falling edge (packet received)
-                c1101_interface_set_edge_interrupt(CC1101_GDO0, GPIO_FALLING_EDGE);
-                cc1101_interface_set_interrupts_enabled(CC1101_GDO0, true);
-            }
-            else
-            {   // End of Packet
-end_of_packet:
-
-                cc1101_interface_read_burst_reg(RXFIFO, BufferIndex, bytesLeft);
                 endOfPacket = false;
 
                 // fill rx_meta
@@ -354,48 +789,67 @@ end_of_packet:
                 current_packet->rx_meta.lqi = cc1101_interface_read_single_reg(RXFIFO) & 0x7F;
                  memcpy(&(current_packet->rx_meta.rx_cfg.channel_id), &current_channel_id, sizeof(channel_id_t));
                 current_packet->rx_meta.rx_cfg.syncword_class = current_syncword_class;
-                current_packet->rx_meta.crc_status = HW_CRC_UNAVAILABLE; // TODO
                 current_packet->rx_meta.timestamp = timer_get_counter_value();
+                current_packet->rx_meta.sync_offset = current_packet->rx_meta.timestamp - rx_sync_timestamp;
 
-                DEBUG_RX_END();
-                if (current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
-                {
-                    if (current_syncword_class == PHY_SYNCWORD_CLASS0)
-                        fec_decode_packet(current_packet->data + 1, packet_len, packet_len);
-                    else
-                    {
-                        packet_len = (BufferIndex + bytesLeft) - current_packet->data;
-                        fec_decode_packet(current_packet->data, packet_len, packet_len);
-                    }
-                }
+                // the background sniff stops at the received frame
+                if (sniff_enabled)
+                    switch_to_idle_mode();
 
-                if(rx_packet_callback != NULL) // TODO this can happen while doing CCA but we should not be interrupting here (disable packet handler?)
-                    rx_packet_callback(current_packet);
-                else
-                    release_packet_callback(current_packet);
-
-                // check still in RX, could be modified by upper layer while in callback
+                DEBUG_RX_END();
+                if (rx_fec_decoding)
+                    rx_fec_decoding = false;
+                else if ((current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+                         && (current_syncword_class == PHY_SYNCWORD_CLASS0))
+                    phy_decoder_feed(&rx_decoder, current_packet->data + 1, packet_len);
+
+                // the CRC was calculated while the frame was read
+                current_packet->rx_meta.crc_status = phy_decoder_finish(&rx_decoder) ? HW_CRC_VALID : HW_CRC_INVALID;
+                if (current_packet->rx_meta.crc_status == HW_CRC_INVALID)
+                    stats.crc_failures++;
+
+                // the transceiver stays in RX after the frame (RXOFF_MODE_RX), the sync word interrupt is re-armed before
+                // handing over the packet so frames received back-to-back, like the responses to a broadcast request,
+                // are not lost. The next frame is read into a new packet, allocated when its header is read.
                 if ((current_state == HW_RADIO_STATE_RX) && (current_syncword_class != PHY_SYNCWORD_CLASS0))
                 {
-                    uint8_t status = (cc1101_interface_strobe(RF_SNOP) & 0xF0);
-                    if(status == 0x60) // RX overflow
+                    uint8_t status = (cc1101_interface_strobe(RF_SNOP) & CC1101_STATUS_STATE_MASK);
+                    if(status == CC1101_STATUS_STATE_RXFIFO_OVERFLOW)
                     {
+                        // the flush leaves the overflow state for IDLE, the strobes are executed in order
+                        // so there is no need to wait for the state transitions
+                        stats.rx_fifo_overflows++;
                         cc1101_interface_strobe(RF_SFRX);
-                        while(cc1101_interface_strobe(RF_SNOP) != 0x0F); // wait until in idle state
                         cc1101_interface_strobe(RF_SRX);
-                        while(cc1101_interface_strobe(RF_SNOP) != 0x1F); // wait until in RX state
                     }
 
                     c1101_interface_set_edge_interrupt(CC1101_GDO0, GPIO_RISING_EDGE);
                     cc1101_interface_set_interrupts_enabled(CC1101_GDO0, true);
-                    assert(cc1101_interface_strobe(RF_SNOP) == 0x1F); // expect to be in RX mode
                 }
+
+                // the upper layer can leave RX from the callback
+                if(rx_packet_callback != NULL) // TODO this can happen while doing CCA but we should not be interrupting here (disable packet handler?)
+                    rx_packet_callback(current_packet);
+                else
+                    release_packet_callback(current_packet);
             }
             break;
         case HW_RADIO_STATE_TX:
           DEBUG_TX_END();
 
           writeRemainingDataFlag = false;
+          capture_calibration(true);
+
+          if (advertising)
+          {
+              // go idle first, the foreground frame can be sent from the callback
+              DPRINT("End AdvP @ %i", timer_get_counter_value());
+              switch_to_idle_mode();
+              if(tx_packet_callback != 0)
+                  tx_packet_callback(current_packet);
+
+              break;
+          }
 
           if(tx_packet_callback != 0)
           {
@@ -413,6 +867,21 @@ end_of_packet:
     }
 }
 
+// the interrupt handlers as registered, with the radio ISR probe around them
+static void probed_end_of_packet_isr()
+{
+    DEBUG_PROBE_SET(RADIO_ISR);
+    end_of_packet_isr();
+    DEBUG_PROBE_CLR(RADIO_ISR);
+}
+
+static void probed_fifo_threshold_isr()
+{
+    DEBUG_PROBE_SET(RADIO_ISR);
+    fifo_threshold_isr();
+    DEBUG_PROBE_CLR(RADIO_ISR);
+}
+
 static inline void wait_for_chip_state(cc1101_chipstate_t expected_state)
 {
     uint8_t chipstate;
@@ -421,6 +890,126 @@ static inline void wait_for_chip_state(cc1101_chipstate_t expected_state)
     } while (chipstate != expected_state);
 }
 
+/*
+ * The FREQ2 - DEVIATN registers of each supported band and channel class, written in a single burst.
+ * The coding only changes PKTCTRL0, so the register sets of the codings of a band and class are the same.
+ */
+typedef struct
+{
+    uint8_t freq2;
+    uint8_t freq1;
+    uint8_t freq0;
+    uint8_t mdmcfg4;
+    uint8_t mdmcfg3;
+    uint8_t mdmcfg2;
+    uint8_t mdmcfg1;
+    uint8_t mdmcfg0;
+    uint8_t deviatn;
+} channel_register_set_t;
+
+static const channel_register_set_t register_set_433_normal_rate = {
+    .freq2 = RADIO_FREQ2(RADIO_FREQ_433_NORMAL_RATE),
+    .freq1 = RADIO_FREQ1(RADIO_FREQ_433_NORMAL_RATE),
+    .freq0 = RADIO_FREQ0(RADIO_FREQ_433_NORMAL_RATE),
+    .mdmcfg4 = RADIO_MDMCFG4_NORMAL_RATE,
+    .mdmcfg3 = RADIO_MDMCFG3_DRATE_M_NORMAL_RATE,
+    .mdmcfg2 = RADIO_MDMCFG2_VALUE,
+    .mdmcfg1 = RADIO_MDMCFG1_NUM_PREAMBLE_4B | RADIO_MDMCFG1_CHANSPC_E_NORMAL_RATE,
+    .mdmcfg0 = RADIO_MDMCFG0_CHANSPC_M_NORMAL_RATE,
+    .deviatn = RADIO_DEVIATN_NORMAL_RATE
+};
+
+static const channel_register_set_t register_set_433_lo_rate = {
+    .freq2 = RADIO_FREQ2(RADIO_FREQ_433_LO_RATE),
+    .freq1 = RADIO_FREQ1(RADIO_FREQ_433_LO_RATE),
+    .freq0 = RADIO_FREQ0(RADIO_FREQ_433_LO_RATE),
+    .mdmcfg4 = RADIO_MDMCFG4_LOW_RATE,
+    .mdmcfg3 = RADIO_MDMCFG3_DRATE_M_LOW_RATE,
+    .mdmcfg2 = RADIO_MDMCFG2_VALUE,
+    .mdmcfg1 = RADIO_MDMCFG1_NUM_PREAMBLE_4B | RADIO_MDMCFG1_CHANSPC_E_LO_RATE,
+    .mdmcfg0 = RADIO_MDMCFG0_CHANSPC_M_LO_RATE,
+    .deviatn = RADIO_DEVIATN_LOW_RATE
+};
+
+static const channel_register_set_t register_set_868_normal_rate = {
+    .freq2 = RADIO_FREQ2(RADIO_FREQ_868_NORMAL_RATE),
+    .freq1 = RADIO_FREQ1(RADIO_FREQ_868_NORMAL_RATE),
+    .freq0 = RADIO_FREQ0(RADIO_FREQ_868_NORMAL_RATE),
+    .mdmcfg4 = RADIO_MDMCFG4_NORMAL_RATE,
+    .mdmcfg3 = RADIO_MDMCFG3_DRATE_M_NORMAL_RATE,
+    .mdmcfg2 = RADIO_MDMCFG2_VALUE,
+    .mdmcfg1 = RADIO_MDMCFG1_NUM_PREAMBLE_4B | RADIO_MDMCFG1_CHANSPC_E_NORMAL_RATE,
+    .mdmcfg0 = RADIO_MDMCFG0_CHANSPC_M_NORMAL_RATE,
+    .deviatn = RADIO_DEVIATN_NORMAL_RATE
+};
+
+/*
+ * The FSCAL3 - FSCAL1 results of the channels calibrated last, restored when switching back to one of these
+ * channels instead of calibrating again (see DN505). The autocalibration from idle keeps refreshing the results
+ * of the active channel, which are stored again when it is calibrated after a cache miss.
+ */
+#define FSCAL_CACHE_SIZE 8
+
+typedef struct
+{
+    uint8_t ch_freq_band;
+    uint8_t ch_class;
+    uint16_t center_freq_index;
+    uint8_t fscal[3];
+} fscal_cache_entry_t;
+
+static fscal_cache_entry_t fscal_cache[FSCAL_CACHE_SIZE];
+static uint8_t fscal_cache_count = 0;
+static uint8_t fscal_cache_next = 0;
+
+/*
+ * On a cache miss the CPU does not wait for a manual calibration, the transceiver calibrates on its way from
+ * IDLE to RX or TX instead. The result is added to the cache once the calibration is known to be done.
+ */
+static fscal_cache_entry_t fscal_pending;
+static bool fscal_capture_pending = false;
+
+static void capture_calibration(bool completed)
+{
+    if(!fscal_capture_pending)
+        return;
+
+    fscal_capture_pending = false;
+    cc1101_interface_write_single_reg(MCSM0, rf_settings.mcsm0);
+
+    // the calibration is done once RX or TX is reached, the later states are numbered higher
+    if(!completed && cc1101_interface_read_single_reg(MARCSTATE) < CC1101_CHIPSTATE_RX)
+        return;
+
+    cc1101_interface_read_burst_reg(FSCAL3, fscal_pending.fscal, sizeof(fscal_pending.fscal));
+    memcpy(&fscal_cache[fscal_cache_next], &fscal_pending, sizeof(fscal_cache_entry_t));
+
+    fscal_cache_next = (fscal_cache_next + 1) % FSCAL_CACHE_SIZE;
+    if(fscal_cache_count < FSCAL_CACHE_SIZE)
+        fscal_cache_count++;
+}
+
+static void calibrate_channel(const channel_id_t* channel_id)
+{
+    for(uint8_t i = 0; i < fscal_cache_count; i++)
+    {
+        fscal_cache_entry_t* entry = &fscal_cache[i];
+        if(entry->ch_freq_band == channel_id->channel_header.ch_freq_band
+           && entry->ch_class == channel_id->channel_header.ch_class
+           && entry->center_freq_index == channel_id->center_freq_index)
+        {
+            cc1101_interface_write_burst_reg(FSCAL3, entry->fscal, sizeof(entry->fscal));
+            return;
+        }
+    }
+
+    fscal_pending.ch_freq_band = channel_id->channel_header.ch_freq_band;
+    fscal_pending.ch_class = channel_id->channel_header.ch_class;
+    fscal_pending.center_freq_index = channel_id->center_freq_index;
+    fscal_capture_pending = true;
+    cc1101_interface_write_single_reg(MCSM0, (rf_settings.mcsm0 & ~RADIO_MCSM0_FS_AUTOCAL_MASK) | RADIO_MCSM0_FS_AUTOCAL_FROMIDLE);
+}
+
 static void configure_channel(const channel_id_t* channel_id)
 {
     //Update the PKTCTRL0 register since this register may be changed by background scan
@@ -434,116 +1023,100 @@ static void configure_channel(const channel_id_t* channel_id)
     }
     else if (channel_id->channel_header.ch_coding == PHY_CODING_PN9)
     {
-        if (has_hardware_crc)
-            cc1101_interface_write_single_reg(PKTCTRL0, RADIO_PKTCTRL0_WHITE_DATA | RADIO_PKTCTRL0_CRC | RADIO_PKTCTRL0_LENGTH_VAR);
-        else
-            cc1101_interface_write_single_reg(PKTCTRL0, RADIO_PKTCTRL0_WHITE_DATA | RADIO_PKTCTRL0_LENGTH_VAR);
+        uint8_t regs[] = {
+            PKTCTRL0, has_hardware_crc ? RADIO_PKTCTRL0_WHITE_DATA | RADIO_PKTCTRL0_CRC | RADIO_PKTCTRL0_LENGTH_VAR
+                                       : RADIO_PKTCTRL0_WHITE_DATA | RADIO_PKTCTRL0_LENGTH_VAR,
+            PKTLEN, RADIO_PKTLEN
+        };
 
-        cc1101_interface_write_single_reg(PKTLEN, RADIO_PKTLEN);
+        cc1101_interface_write_regs(regs, sizeof(regs) / 2);
      }
      else
      {
          // Receive the raw data as is.
-         cc1101_interface_write_single_reg(PKTCTRL0, RADIO_PKTCTRL0_LENGTH_INF);
-         cc1101_interface_write_single_reg(PKTLEN, RADIO_PKTLEN);
+         const uint8_t regs[] = { PKTCTRL0, RADIO_PKTCTRL0_LENGTH_INF, PKTLEN, RADIO_PKTLEN };
+         cc1101_interface_write_regs(regs, sizeof(regs) / 2);
          DPRINT("Raw data applied !");
      }
 
-    // only change settings if channel_id changed compared to current config
-    if(!hw_radio_channel_ids_equal(channel_id, &current_channel_id))
+    // only change settings if channel_id changed compared to current config, the coding is applied above
+    if(channel_id->channel_header.ch_class == current_channel_id.channel_header.ch_class
+       && channel_id->channel_header.ch_freq_band == current_channel_id.channel_header.ch_freq_band
+       && channel_id->center_freq_index == current_channel_id.center_freq_index)
     {
-        // TODO assert valid center freq index
+        current_channel_id.channel_header.ch_coding = channel_id->channel_header.ch_coding;
+        return;
+    }
+
+    // TODO assert valid center freq index
+
+    capture_calibration(false); // of the previous channel, before it is interrupted
+    cc1101_interface_strobe(RF_SIDLE); // we need to be in IDLE state before starting calibration
+    wait_for_chip_state(CC1101_CHIPSTATE_IDLE);
 
-        cc1101_interface_strobe(RF_SIDLE); // we need to be in IDLE state before starting calibration
-        wait_for_chip_state(CC1101_CHIPSTATE_IDLE);
-        
-        memcpy(&current_channel_id, channel_id, sizeof(channel_id_t)); // cache new settings
+    bool band_or_class_changed = channel_id->channel_header.ch_class != current_channel_id.channel_header.ch_class
+            || channel_id->channel_header.ch_freq_band != current_channel_id.channel_header.ch_freq_band;
 
-        // TODO preamble size depends on channel class
+    memcpy(&current_channel_id, channel_id, sizeof(channel_id_t)); // cache new settings
 
-        // set freq band
-        DPRINT("Set frequency band index: %d", channel_id->channel_header.ch_freq_band);
+    // TODO preamble size depends on channel class
 
-        // TODO validate
-        switch(channel_id->channel_header.ch_freq_band)
+    // set freq band
+    DPRINT("Set frequency band index: %d", channel_id->channel_header.ch_freq_band);
+
+    // TODO validate
+    uint8_t channr = 0;
+    const channel_register_set_t* register_set = NULL;
+    switch(channel_id->channel_header.ch_freq_band)
+    {
+    // TODO calculate depending on rate and channr
+    case PHY_BAND_433:
+        if(channel_id->channel_header.ch_class == PHY_CLASS_NORMAL_RATE)
+        {
+            register_set = &register_set_433_normal_rate;
+            assert(channel_id->center_freq_index % 8 == 0 && channel_id->center_freq_index <= 56);
+            channr = channel_id->center_freq_index / 8;
+        }
+        else if(channel_id->channel_header.ch_class == PHY_CLASS_LO_RATE)
+        {
+            // TODO using channel spacing to switch channels is not accurate here since min value for spacing is 25.39 kHz instead
+            // of 25 Khz resulting in a big offset after x channels ... change center freq instead
+            register_set = &register_set_433_lo_rate;
+            assert(channel_id->center_freq_index <= 68);
+            channr = channel_id->center_freq_index;
+        }
+        else if(channel_id->channel_header.ch_class == PHY_CLASS_HI_RATE)
         {
-        // TODO calculate depending on rate and channr
-        case PHY_BAND_433:
-            if(channel_id->channel_header.ch_class == PHY_CLASS_NORMAL_RATE)
-            {
-                cc1101_interface_write_single_reg(FREQ2, RADIO_FREQ2(RADIO_FREQ_433_NORMAL_RATE));
-                cc1101_interface_write_single_reg(FREQ1, RADIO_FREQ1(RADIO_FREQ_433_NORMAL_RATE));
-                cc1101_interface_write_single_reg(FREQ0, RADIO_FREQ0(RADIO_FREQ_433_NORMAL_RATE));
-                assert(channel_id->center_freq_index % 8 == 0 && channel_id->center_freq_index <= 56);
-                DPRINT("Set channel freq index: %d", channel_id->center_freq_index);
-                cc1101_interface_write_single_reg(CHANNR, channel_id->center_freq_index / 8);
-            }
-            else if(channel_id->channel_header.ch_class == PHY_CLASS_LO_RATE)
-            {
-                cc1101_interface_write_single_reg(FREQ2, RADIO_FREQ2(RADIO_FREQ_433_LO_RATE));
-                cc1101_interface_write_single_reg(FREQ1, RADIO_FREQ1(RADIO_FREQ_433_LO_RATE));
-                cc1101_interface_write_single_reg(FREQ0, RADIO_FREQ0(RADIO_FREQ_433_LO_RATE));
-                assert(channel_id->center_freq_index <= 68);
-                DPRINT("Set channel freq index: %d", channel_id->center_freq_index);
-                cc1101_interface_write_single_reg(CHANNR, channel_id->center_freq_index);
-            }
-            else if(channel_id->channel_header.ch_class == PHY_CLASS_HI_RATE)
-            {
-                assert(false);
-            }
-            break;
-        case PHY_BAND_868:
-            if(channel_id->channel_header.ch_class == PHY_CLASS_NORMAL_RATE)
-            {
-                cc1101_interface_write_single_reg(FREQ2, RADIO_FREQ2(RADIO_FREQ_868_NORMAL_RATE));
-                cc1101_interface_write_single_reg(FREQ1, RADIO_FREQ1(RADIO_FREQ_868_NORMAL_RATE));
-                cc1101_interface_write_single_reg(FREQ0, RADIO_FREQ0(RADIO_FREQ_868_NORMAL_RATE));
-                assert(channel_id->center_freq_index % 8 == 0 && channel_id->center_freq_index <= 272); // TODO should be 270?
-                DPRINT("Set channel freq index: %d", channel_id->center_freq_index);
-                cc1101_interface_write_single_reg(CHANNR, channel_id->center_freq_index / 8);
-            }
-            else
-                assert(false);
-            // TODO lo-rate and hi-rate
-            break;
-        case PHY_BAND_915:
             assert(false);
-//            WriteSingleReg(RADIO_FREQ2, (uint8_t)(RADIO_FREQ_915>>16 & 0xFF));
-//            WriteSingleReg(RADIO_FREQ1, (uint8_t)(RADIO_FREQ_915>>8 & 0xFF));
-//            WriteSingleReg(RADIO_FREQ0, (uint8_t)(RADIO_FREQ_915 & 0xFF));
-            break;
         }
-
-        // set modulation, symbol rate, channel spacing and deviation
-        switch(channel_id->channel_header.ch_class)
+        break;
+    case PHY_BAND_868:
+        if(channel_id->channel_header.ch_class == PHY_CLASS_NORMAL_RATE)
         {
-            case PHY_CLASS_NORMAL_RATE:
-                // TODO validate
-                cc1101_interface_write_single_reg(MDMCFG3, RADIO_MDMCFG3_DRATE_M_NORMAL_RATE);
-                cc1101_interface_write_single_reg(MDMCFG4, RADIO_MDMCFG4_NORMAL_RATE);
-                cc1101_interface_write_single_reg(DEVIATN, RADIO_DEVIATN_NORMAL_RATE);
-                cc1101_interface_write_single_reg(MDMCFG1, RADIO_MDMCFG1_NUM_PREAMBLE_4B | RADIO_MDMCFG1_CHANSPC_E_NORMAL_RATE);
-                cc1101_interface_write_single_reg(MDMCFG0, RADIO_MDMCFG0_CHANSPC_M_NORMAL_RATE);
-                break;
-            case PHY_CLASS_LO_RATE:
-                cc1101_interface_write_single_reg(MDMCFG3, RADIO_MDMCFG3_DRATE_M_LOW_RATE);
-                cc1101_interface_write_single_reg(MDMCFG4, RADIO_MDMCFG4_LOW_RATE);
-                cc1101_interface_write_single_reg(DEVIATN, RADIO_DEVIATN_LOW_RATE);
-                // TODO using channel spacing to switch channels is not accurate here since min value for spacing is 25.39 kHz instead
-                // of 25 Khz resulting in a big offset after x channels ... change center freq instead
-                cc1101_interface_write_single_reg(MDMCFG1, RADIO_MDMCFG1_NUM_PREAMBLE_4B | RADIO_MDMCFG1_CHANSPC_E_LO_RATE);
-                cc1101_interface_write_single_reg(MDMCFG0, RADIO_MDMCFG0_CHANSPC_M_LO_RATE);
-
-            break;
-            default:
-                assert(false);
-                // TODO: other classes
+            register_set = &register_set_868_normal_rate;
+            assert(channel_id->center_freq_index % 8 == 0 && channel_id->center_freq_index <= 272); // TODO should be 270?
+            channr = channel_id->center_freq_index / 8;
         }
-
-        cc1101_interface_strobe(RF_SCAL); // TODO use autocalibration instead of manual?
-        wait_for_chip_state(CC1101_CHIPSTATE_IDLE);
+        else
+            assert(false);
+        // TODO lo-rate and hi-rate
+        break;
+    case PHY_BAND_915:
+        assert(false);
+//        WriteSingleReg(RADIO_FREQ2, (uint8_t)(RADIO_FREQ_915>>16 & 0xFF));
+//        WriteSingleReg(RADIO_FREQ1, (uint8_t)(RADIO_FREQ_915>>8 & 0xFF));
+//        WriteSingleReg(RADIO_FREQ0, (uint8_t)(RADIO_FREQ_915 & 0xFF));
+        break;
     }
 
+    // set frequency, modulation, symbol rate, channel spacing and deviation
+    if(band_or_class_changed)
+        cc1101_interface_write_burst_reg(FREQ2, (uint8_t*)register_set, sizeof(channel_register_set_t));
+
+    DPRINT("Set channel freq index: %d", channel_id->center_freq_index);
+    cc1101_interface_write_single_reg(CHANNR, channr);
+
+    calibrate_channel(channel_id);
 }
 
 static void configure_eirp(const eirp_t eirp)
@@ -576,27 +1149,42 @@ static void configure_syncword(syncword_class_t syncword_class, phy_coding_t ch_
         uint16_t sync_word = sync_word_value[syncword_class][ch_coding];
 
         DPRINT("sync_word = %04x", sync_word);
-        cc1101_interface_write_single_reg(SYNC0, sync_word & 0xFF);
-        cc1101_interface_write_single_reg(SYNC1, sync_word >> 8);
+        uint8_t regs[] = { SYNC0, sync_word & 0xFF, SYNC1, sync_word >> 8 };
+        cc1101_interface_write_regs(regs, sizeof(regs) / 2);
     }
 }
 
-error_t hw_radio_init(alloc_packet_callback_t alloc_packet_cb,
+static void radio_set_rx_header_filter(rx_header_filter_callback_t rx_header_filter_cb)
+{
+    rx_header_filter_callback = rx_header_filter_cb;
+}
+
+static uint8_t radio_get_capabilities()
+{
+    // the CRC-16 of the packet handler uses the x^16 + x^15 + x^2 + 1 polynomial instead of the CCITT one of D7A,
+    // the CRC is generated and checked with the SW coding of the frames instead
+    return HW_RADIO_CAP_CRC | HW_RADIO_CAP_CRC_BACKGROUND | HW_RADIO_CAP_CRC_FEC;
+}
+
+static error_t radio_init(alloc_packet_callback_t alloc_packet_cb,
                       release_packet_callback_t release_packet_cb)
 {
     alloc_packet_callback = alloc_packet_cb;
     release_packet_callback = release_packet_cb;
 
     current_state = HW_RADIO_STATE_IDLE;
+    energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
 
     sched_register_task(&switch_to_idle_mode);
+    sched_register_task(&report_rssi);
+    sched_register_task(&report_cca);
 
-    cc1101_interface_init(&end_of_packet_isr, &fifo_threshold_isr);
+    cc1101_interface_init(&probed_end_of_packet_isr, &probed_fifo_threshold_isr);
     cc1101_interface_reset_radio_core();
     cc1101_interface_write_rfsettings(&rf_settings);
 
     DPRINT("RF settings:");
-    uint8_t* p = (uint8_t*) &rf_settings;
+    const uint8_t* p = (const uint8_t*) &rf_settings;
     uint8_t i;
     for(i = 0; i < sizeof(RF_SETTINGS); i++)
     {
@@ -607,20 +1195,64 @@ error_t hw_radio_init(alloc_packet_callback_t alloc_packet_cb,
     configure_channel(&current_channel_id);
     configure_eirp(current_eirp);
     configure_syncword(current_syncword_class, current_channel_id.channel_header.ch_coding);
-    cc1101_interface_write_single_reg(FIFOTHR, 0x04);
+    cc1101_interface_write_single_reg(FIFOTHR, RADIO_FIFOTHR_FIFO_THR_45_20);
     // FIFO_THR = 4
     // 45 bytes in TX FIFO (19 available spaces)
     // 20 bytes in the RX FIFO
     // If this threshold is changed, AVAILABLE_BYTES_IN_TX_FIFO
     // and BYTES_RX_FIFO must be updated
 
-    cc1101_interface_strobe(RF_SCAL); // TODO use autocalibration instead of manual?
-    wait_for_chip_state(CC1101_CHIPSTATE_IDLE);
+    // the boot does not wait for a manual calibration, the synthesizer calibrates on the first transition to RX or TX
+    calibrate_channel(&current_channel_id);
+
+    return SUCCESS;
+}
+
+static void report_rssi()
+{
+    // the RX callbacks may have changed meanwhile
+    if(current_state != HW_RADIO_STATE_RX || rssi_valid_callback == NULL)
+        return;
+
+    uint8_t status = cc1101_interface_strobe(RF_SNOP) & CC1101_STATUS_STATE_MASK;
+    if(status == CC1101_STATUS_STATE_CALIBRATE || status == CC1101_STATUS_STATE_SETTLING)
+    {
+        assert(timer_post_task_delay(&report_rssi, 1) == SUCCESS);
+        return;
+    }
+
+    rssi_valid_callback(radio_get_rssi());
+}
+
+// the carrier sense of the radio decides, once the RSSI is valid
+static void report_cca()
+{
+    if(current_state != HW_RADIO_STATE_RX || cca_callback == NULL)
+        return;
+
+    uint8_t status = cc1101_interface_strobe(RF_SNOP) & CC1101_STATUS_STATE_MASK;
+    if(status == CC1101_STATUS_STATE_CALIBRATE || status == CC1101_STATUS_STATE_SETTLING)
+    {
+        assert(timer_post_task_delay(&report_cca, 1) == SUCCESS);
+        return;
+    }
+
+    bool carrier_sensed = cc1101_interface_read_single_reg(PKTSTATUS) & RADIO_PKTSTATUS_CS;
+    int16_t rssi = radio_get_rssi();
+    cca_callback_t cca_cb = cca_callback;
+    stop_cca();
+    cca_cb(!carrier_sensed, rssi);
 }
 
 static void start_rx(hw_rx_cfg_t const* rx_cfg)
 {
+    abandon_rx_frame();
+    timer_cancel_task(&report_rssi);
+    stop_cca();
+    stop_sniff();
+    scan_rssi = HW_RSSI_INVALID;
     current_state = HW_RADIO_STATE_RX;
+    energy_radio_state_changed(ENERGY_RADIO_RX, 0);
 
 //    uint8_t status = 0x80;
 //
@@ -632,28 +1264,32 @@ static void start_rx(hw_rx_cfg_t const* rx_cfg)
 
     configure_channel(&(rx_cfg->channel_id));
     configure_syncword(rx_cfg->syncword_class, rx_cfg->channel_id.channel_header.ch_coding);
-    cc1101_interface_write_single_reg(PKTLEN, 0xFF);
-    // Associated to the RX FIFO: Asserts when RX FIFO is filled at or above the
+    // IOCFG2 0x00 is associated to the RX FIFO: Asserts when RX FIFO is filled at or above the
     // RX FIFO threshold. De-asserts when RX FIFO is drained below the same threshold
-    cc1101_interface_write_single_reg(IOCFG2, 0x00);
+    const uint8_t regs[] = { PKTLEN, 0xFF, IOCFG2, 0x00 };
+    cc1101_interface_write_regs(regs, sizeof(regs) / 2);
 
     // cc1101_interface_strobe(RF_SFRX); TODO only when in idle or overflow state
 
     DPRINT("START FG scan @ %i", timer_get_counter_value());
 
+    // the strobe is only ignored while the crystal oscillator starts after SLEEP, the calibration and the
+    // settling which follow are not waited for
     uint8_t status;
     uint8_t counter = 0;
     do
     {
         status = cc1101_interface_strobe(RF_SRX);
-        if(status == 0x6F)
-        {
-            // RX FIFO overflow, flush first
-            cc1101_interface_strobe(RF_SFRX);
-        }
-
         assert(counter++ < 100); // TODO measure value in normal case
-    } while(status != 0x1F);
+    } while(status & CC1101_STATUS_CHIP_RDYN);
+
+    if((status & CC1101_STATUS_STATE_MASK) == CC1101_STATUS_STATE_RXFIFO_OVERFLOW)
+    {
+        // RX FIFO overflow, flush first
+        stats.rx_fifo_overflows++;
+        cc1101_interface_strobe(RF_SFRX);
+        cc1101_interface_strobe(RF_SRX);
+    }
 
     DEBUG_RX_START();
     if(rx_packet_callback != 0) // when rx callback not set we ignore received packets
@@ -669,15 +1305,11 @@ static void start_rx(hw_rx_cfg_t const* rx_cfg)
     if(rssi_valid_callback != 0)
     {
         // TODO calculate/predict rssi response time (see DN505)
-        // and wait until valid. For now we wait 200 us.
-
-        hw_busy_wait(200);
-        ensure_settling_and_calibration_done();
-        rssi_valid_callback(hw_radio_get_rssi());
+        assert(timer_post_task_delay(&report_rssi, RSSI_VALID_DELAY) == SUCCESS);
     }
 }
 
-error_t hw_radio_set_rx(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, rssi_valid_callback_t rssi_valid_cb)
+static error_t radio_set_rx(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, rssi_valid_callback_t rssi_valid_cb)
 {
     if(rx_cb != NULL)
     {
@@ -705,12 +1337,11 @@ error_t hw_radio_set_rx(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, r
     return SUCCESS;
 }
 
-error_t hw_radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, int16_t rssi_thr)
+// configures the channel and the packet handler for receiving background frames
+static void configure_background_rx(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb)
 {
     uint8_t packet_len;
 
-    DPRINT("START BG scan @ %i", timer_get_counter_value());
-
     if(rx_cb != NULL)
     {
         assert(alloc_packet_callback != NULL);
@@ -721,20 +1352,30 @@ error_t hw_radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_call
     // We should not initiate a background scan before TX is completed
     assert(current_state != HW_RADIO_STATE_TX);
 
+    stop_cca();
+    stop_sniff();
+    scan_rssi = HW_RSSI_INVALID;
     current_state = HW_RADIO_STATE_RX;
+    energy_radio_state_changed(ENERGY_RADIO_RX, 0);
 
     configure_syncword(rx_cfg->syncword_class, rx_cfg->channel_id.channel_header.ch_coding);
     configure_channel(&(rx_cfg->channel_id));
 
-    cc1101_interface_write_single_reg(PKTCTRL0, RADIO_PKTCTRL0_WHITE_DATA | RADIO_PKTCTRL0_LENGTH_FIXED);
-
     if (current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
         packet_len = fec_calculated_decoded_length(BACKGROUND_FRAME_LENGTH);
     else
         packet_len = BACKGROUND_FRAME_LENGTH;
 
-    cc1101_interface_write_single_reg(PKTLEN, packet_len);
+    uint8_t regs[] = { PKTCTRL0, RADIO_PKTCTRL0_WHITE_DATA | RADIO_PKTCTRL0_LENGTH_FIXED, PKTLEN, packet_len };
+    cc1101_interface_write_regs(regs, sizeof(regs) / 2);
     DPRINT("packet length %d", packet_len);
+}
+
+static error_t radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, int16_t rssi_thr)
+{
+    DPRINT("START BG scan @ %i", timer_get_counter_value());
+
+    configure_background_rx(rx_cfg, rx_cb);
 
     DEBUG_RX_START();
 
@@ -747,6 +1388,7 @@ error_t hw_radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_call
         {
             // RX FIFO overflow, flush first
             DPRINT("RX FIFO overflow");
+            stats.rx_fifo_overflows++;
             cc1101_interface_strobe(RF_SFRX);
         }
 
@@ -756,11 +1398,12 @@ error_t hw_radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_call
     // Fast RX termination if no carrier is detected
     ensure_settling_and_calibration_done();
 
-    int16_t rssi = hw_radio_get_rssi();
+    int16_t rssi = radio_get_rssi();
     if (rssi <= rssi_thr)
     {
         DPRINT("FAST RX termination RSSI %i limit %i", rssi, rssi_thr);
         switch_to_idle_mode();
+        scan_rssi = rssi;
         DEBUG_RX_END();
         return FAIL;
     }
@@ -776,18 +1419,86 @@ error_t hw_radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_call
     return SUCCESS;
 }
 
-error_t hw_radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb)
+static error_t radio_start_background_sniff(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb,
+                                        int16_t rssi_thr, timer_tick_t period)
+{
+    uint64_t event0 = ((uint64_t)period * 1000000000 / TIMER_TICKS_PER_SEC) / WOR_EVENT0_UNIT_NS;
+    if (event0 == 0 || event0 > 0xFFFF)
+        return ESIZE;
+
+    // the RX timeout has to cover To, to find the sync word of the next frame of an ongoing advertising
+    uint64_t to_ns = (uint64_t)bg_timeout[rx_cfg->channel_id.channel_header.ch_class] * 1000000000 / TIMER_TICKS_PER_SEC;
+    int8_t rx_time = 6;
+    while (rx_time >= 0 && ((event0 * WOR_EVENT0_UNIT_NS) >> (rx_time + 3)) < to_ns)
+        rx_time--;
+
+    if (rx_time < 0)
+        return ESIZE;
+
+    DPRINT("START BG sniff EVENT0 %i RX_TIME %i", (uint16_t)event0, rx_time);
+
+    configure_background_rx(rx_cfg, rx_cb);
+
+    // the carrier sense threshold can only be set in steps of 1 dB from -8 to +7 dB around the reference level
+    int16_t cs_thr = rssi_thr - CS_ABS_THR_RSSI;
+    if (cs_thr < -8)
+        cs_thr = -8;
+    else if (cs_thr > 7)
+        cs_thr = 7;
+
+    sniff_agcctrl1 = (rf_settings.agcctrl1 & 0xF0) | (cs_thr & 0x0F);
+    sniff_mcsm2 = RADIO_MCSM2_RX_TIME_RSSI | RADIO_MCSM2_RX_TIME(rx_time);
+    sniff_event0 = event0;
+
+    cc1101_interface_strobe(RF_SIDLE);
+    wait_for_chip_state(CC1101_CHIPSTATE_IDLE);
+    start_wor();
+    DEBUG_RX_START();
+
+    return SUCCESS;
+}
+
+static error_t radio_cca(hw_rx_cfg_t const* rx_cfg, int16_t rssi_thr, cca_callback_t cca_cb)
+{
+    if(current_state == HW_RADIO_STATE_TX)
+        return EBUSY;
+
+    // the carrier sense threshold can only be set in steps of 1 dB from -8 to +7 dB around the reference level, the
+    // upper layer compares the RSSI itself for the other thresholds
+    int16_t cs_thr = rssi_thr - CS_ABS_THR_RSSI;
+    if (cs_thr < -8 || cs_thr > 7)
+        return ESIZE;
+
+    rx_packet_callback = NULL;
+    rssi_valid_callback = NULL;
+    start_rx(rx_cfg);
+
+    cc1101_interface_write_single_reg(AGCCTRL1, (rf_settings.agcctrl1 & 0xF0) | (cs_thr & 0x0F));
+    cca_threshold_set = true;
+    cca_callback = cca_cb;
+    assert(timer_post_task_delay(&report_cca, RSSI_VALID_DELAY) == SUCCESS);
+    return SUCCESS;
+}
+
+static error_t radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb)
 {
     // TODO error handling EINVAL, ESIZE, EOFF
     if(current_state == HW_RADIO_STATE_TX)
         return EBUSY;
 
+    stop_cca();
+
     assert(packet->length < PACKET_MAX_SIZE);
 
+    // a background sniff is not resumed after the transmission
+    if(sniff_enabled)
+        switch_to_idle_mode();
+
     tx_packet_callback = tx_cb;
 
     if(current_state == HW_RADIO_STATE_RX)
     {
+        abandon_rx_frame();
         pending_rx_cfg.channel_id = current_channel_id;
         pending_rx_cfg.syncword_class = current_syncword_class;
         should_rx_after_tx_completed = true;
@@ -799,7 +1510,9 @@ error_t hw_radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_
                                                 // polling for this seems to take 50-200us after a quick test, not sure why yet
     }
 
+    scan_rssi = HW_RSSI_INVALID;
     current_state = HW_RADIO_STATE_TX;
+    energy_radio_state_changed(ENERGY_RADIO_TX, packet->tx_meta.tx_cfg.eirp);
     current_packet = packet;
 
     configure_channel((channel_id_t*)&(current_packet->tx_meta.tx_cfg.channel_id));
@@ -807,14 +1520,26 @@ error_t hw_radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_
     configure_syncword(current_packet->tx_meta.tx_cfg.syncword_class,
                        current_packet->tx_meta.tx_cfg.channel_id.channel_header.ch_coding);
 
+    // the CRC and the FEC are applied in SW, the packet handler whitens the frame
+    bool fec = current_packet->tx_meta.tx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9;
+    uint16_t tx_length = phy_encode_frame(fec ? PHY_STAGE_CRC | PHY_STAGE_FEC : PHY_STAGE_CRC, packet->data,
+                                          packet->length + 1);
+    if (fec)
+    {
+        // sent in fixed packet length mode. The receivers read fec_calculated_decoded_length() bytes, the terminator
+        // block which follows for frames of odd length is not sent so the frame fits the 8 bit PKTLEN.
+        tx_length = fec_calculated_decoded_length(packet->length + 1);
+        cc1101_interface_write_single_reg(PKTLEN, tx_length);
+    }
+
     // Associated to the TX FIFO: Asserts when the TX FIFO is filled above TXFIFO_THR.
     // De-asserts when the TX FIFO is below TXFIFO_THR.
     cc1101_interface_write_single_reg(IOCFG2, 0x02);
 
     // The entire packet can be written at once
-    if (packet->length < FIFO_SIZE)
+    if (tx_length <= FIFO_SIZE)
     {
-        cc1101_interface_write_burst_reg(TXFIFO, packet->data, packet->length + 1);
+        cc1101_interface_write_burst_reg(TXFIFO, packet->data, tx_length);
 
         c1101_interface_set_edge_interrupt(CC1101_GDO0, GPIO_FALLING_EDGE);
         cc1101_interface_set_interrupts_enabled(CC1101_GDO0, true);
@@ -824,7 +1549,7 @@ error_t hw_radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_
     }
     else
     {   // The TX FIFO needs to be re-filled several times
-        DPRINT("Data to TX Fifo (First part of %d bytes):", packet->length + 1);
+        DPRINT("Data to TX Fifo (First part of %d bytes):", tx_length);
         DPRINT_DATA(packet->data, FIFO_SIZE);
 
         cc1101_interface_write_burst_reg(TXFIFO, packet->data, FIFO_SIZE); // Fill up the TX FIFO
@@ -832,7 +1557,7 @@ error_t hw_radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_
         DEBUG_TX_START();
         DEBUG_RX_END();
 
-        bytesLeft = packet->length + 1 - FIFO_SIZE;
+        bytesLeft = tx_length - FIFO_SIZE;
         BufferIndex = packet->data + FIFO_SIZE;
         iterations = (bytesLeft / AVAILABLE_BYTES_IN_TX_FIFO);
         if (!iterations)
@@ -846,30 +1571,25 @@ error_t hw_radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_
     return SUCCESS;
 }
 
-error_t hw_radio_send_background_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb,
-                                        uint16_t eta, uint16_t tx_duration)
+static error_t radio_send_background_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb,
+                                        timer_tick_t eta, uint16_t tx_duration)
 {
-    uint8_t adv_packet[20];  // 6 bytes preamble (PREAMBLE_HI_RATE_CLASS) + 2 bytes SYNC word + 12 bytes max for a background frame FEC encoded
-    uint8_t *packet_payload;
-    uint8_t payload_len = packet->length;
-    uint8_t *tx_packet;
-    uint8_t tx_len;
-    uint16_t crc, swap_eta;
-    uint8_t bytes_in_fifo;
-    bool fifo_filled = false;
-    timer_tick_t start_time;
-    timer_tick_t stop_time = eta;
-
     // TODO error handling EINVAL, ESIZE, EOFF
     if(current_state == HW_RADIO_STATE_TX)
         return EBUSY;
 
-    assert(packet->length < PACKET_MAX_SIZE);
+    assert(packet->length == BACKGROUND_FRAME_LENGTH);
+    stop_cca();
+
+    // a background sniff is not resumed after the transmission
+    if(sniff_enabled)
+        switch_to_idle_mode();
 
     tx_packet_callback = tx_cb;
 
     if(current_state == HW_RADIO_STATE_RX)
     {
+        abandon_rx_frame();
         pending_rx_cfg.channel_id = current_channel_id;
         pending_rx_cfg.syncword_class = current_syncword_class;
         should_rx_after_tx_completed = true;
@@ -880,6 +1600,7 @@ error_t hw_radio_send_background_packet(hw_radio_packet_t* packet, tx_packet_cal
         wait_for_chip_state(CC1101_CHIPSTATE_IDLE); // TODO reading state sometimes returns illegal values such as 0x1F.
                                                     // polling for this seems to take 50-200us after a quick test, not sure why yet
         current_state = HW_RADIO_STATE_IDLE;
+        energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
     }
 
     current_packet = packet;
@@ -889,151 +1610,39 @@ error_t hw_radio_send_background_packet(hw_radio_packet_t* packet, tx_packet_cal
     configure_channel((channel_id_t*)&(current_packet->tx_meta.tx_cfg.channel_id));
     configure_eirp(current_packet->tx_meta.tx_cfg.eirp);
 
-    // During the advertising flooding, use the infinite packet length mode and disable the hardware PN9/FEC/CRC
-    cc1101_interface_write_single_reg(PKTCTRL0, RADIO_PKTCTRL0_LENGTH_INF);
-    cc1101_interface_write_single_reg(PKTLEN, 0xFF);
-
-    // Prepare the subsequent background frames which include the preamble and the sync word
-    uint8_t preamble_len = (current_channel_id.channel_header.ch_class ==  PHY_CLASS_HI_RATE ? PREAMBLE_HI_RATE_CLASS : PREAMBLE_LOW_RATE_CLASS);
-    memset(adv_packet, 0xAA, preamble_len); // preamble length is given in number of bytes
-    uint16_t sync_word = __builtin_bswap16(sync_word_value[current_syncword_class][current_channel_id.channel_header.ch_coding]);
-    memcpy(&adv_packet[preamble_len], &sync_word, 2);
-    packet_payload = adv_packet + preamble_len + 2;
-    memcpy(packet_payload, current_packet->data + 1, payload_len); // The length byte is not included in the background payload
-
-    DPRINT("Original payload: %d", payload_len);
-    DPRINT_DATA(packet_payload, payload_len);
-
-    if (current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
-    {
-        tx_len = fec_encode(packet_payload, payload_len);
-        pn9_encode(packet_payload, tx_len);
-    }
-    else
-    {
-        pn9_encode(packet_payload, payload_len);
-        tx_len = payload_len;
-    }
-
-    // For the first advertising frame, transmit directly the payload since the preamble and the sync word are directly managed by the xcv
-    tx_packet = packet_payload;
-    DPRINT("Transmit packet: %d", tx_len);
-    DPRINT_DATA(tx_packet, tx_len);
-
-    // Fill the FIFO with the first BG frame (preamble and sync word are appended by the transceiver)
-    cc1101_interface_write_burst_reg(TXFIFO, tx_packet, tx_len); // Fill up the TX FIFO
-
-    // for the next advertising frame, insert the preamble and the SYNC word
-    tx_packet = adv_packet;
-    tx_len += preamble_len + 2;
-
-    while (eta > tx_duration)
-    {
-        // start Tx when the FIFO is almost full
-        if ((current_state != HW_RADIO_STATE_TX) && (fifo_filled))
-        {
-            current_state = HW_RADIO_STATE_TX;
-            DEBUG_TX_START();
-            DEBUG_RX_END();
-
-            start_time = timer_get_counter_value();
-            stop_time += start_time;
-            DPRINT("Start transmitting @ %i stop @ %i", start_time, stop_time);
-            cc1101_interface_strobe(RF_STX);
-        }
-
-        /*
-         * Build the next advertising frame.
-         * In order to flood the channel with advertising frames without discontinuity,
-         * the FIFO is refilled with the next frames within the same TX.
-         * For that, the preamble and the sync word are explicitly inserted before each
-         * subsequent advertising frame.
-         */
-
-        // first recover the initial payload
-        memcpy(packet_payload, current_packet->data + 1, payload_len);
-
-        // update eta
-        if (fifo_filled)
-            eta = stop_time - timer_get_counter_value();
-        else
-            eta -= tx_duration;
-
-        swap_eta = __builtin_bswap16(eta);
-        memcpy(&packet_payload[2], &swap_eta, sizeof(uint16_t));
-
-        // update the CRC
-        crc = __builtin_bswap16(crc_calculate(packet_payload, 4));
-        memcpy(&packet_payload[4], &crc, 2);
-
-        if (current_channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
-        {
-            pn9_encode(packet_payload, fec_encode(packet_payload, payload_len));
-        }
-        else
-        {
-            pn9_encode(packet_payload, payload_len);
-        }
+    // During the advertising flooding, use the infinite packet length mode and disable the hardware PN9/FEC/CRC.
+    // IOCFG2 0x02 is associated to the TX FIFO: Asserts when the TX FIFO is filled above TXFIFO_THR.
+    // De-asserts when the TX FIFO is below TXFIFO_THR.
+    const uint8_t regs[] = { PKTCTRL0, RADIO_PKTCTRL0_LENGTH_INF, PKTLEN, 0xFF, IOCFG2, 0x02 };
+    cc1101_interface_write_regs(regs, sizeof(regs) / 2);
 
-        // wait for some space available in the TX FIFO
-        do
-        {
-            cc1101_interface_read_burst_reg(TXBYTES, &bytes_in_fifo, 1);
-            if (bytes_in_fifo & 0x80)
-                DPRINT("TX FIFO underflow %x", bytes_in_fifo);
-            bytes_in_fifo = bytes_in_fifo & 0x7F;
-        } while (FIFO_SIZE - bytes_in_fifo < tx_len);
-
-        if ((FIFO_SIZE - bytes_in_fifo) < (tx_len * 2))
-            fifo_filled = true;
-
-        //DPRINT("Transmit packet: %d", tx_len);
-        //DPRINT_DATA(tx_packet, tx_len);
-        //DPRINT("ETA %d", eta);
-        cc1101_interface_write_burst_reg(TXFIFO, tx_packet, tx_len); // Fill up the TX FIFO
-     }
+    prepare_advertising(current_packet->data + 1, eta); // The length byte is not included in the background payload
 
-    /*
-     * When no more advertising background frames can be fully transmitted before
-     * the start of D7ANP, the last background frame is extended by padding preamble
-     * symbols after the end of the background packet, in order to guarantee no silence period.
-     */
-    if (eta)
-    {
-        preamble_len = eta / (tx_duration / tx_len);
-        DPRINT("Add preamble_bytes: %d", preamble_len);
-        memset(tx_packet, 0xAA, preamble_len);
-
-        do
-        {
-            cc1101_interface_read_burst_reg(TXBYTES, &bytes_in_fifo, 1);
-            bytes_in_fifo = bytes_in_fifo & 0x7F;
-        } while (FIFO_SIZE - bytes_in_fifo < preamble_len);
-        cc1101_interface_write_burst_reg(TXFIFO, tx_packet, preamble_len); // Fill up the TX FIFO
-    }
+    // the first frames are in the FIFO before starting, the FIFO threshold ISR streams the others
+    uint8_t bytes_in_fifo;
+    cc1101_interface_read_burst_reg(TXBYTES, &bytes_in_fifo, 1);
+    fill_advertising_fifo(bytes_in_fifo);
 
-    /* wait FIFO empty before calling the callback */
-    if(tx_packet_callback != 0)
-    {
-        do
-        {
-            cc1101_interface_read_burst_reg(TXBYTES, &bytes_in_fifo, 1);
-            bytes_in_fifo = bytes_in_fifo & 0x7F;
-        } while (bytes_in_fifo);
-        DPRINT("End AdvP @ %i", timer_get_counter_value());
-        switch_to_idle_mode();        
-        tx_packet_callback(current_packet);
-    }
+    scan_rssi = HW_RSSI_INVALID;
+    current_state = HW_RADIO_STATE_TX;
+    energy_radio_state_changed(ENERGY_RADIO_TX, packet->tx_meta.tx_cfg.eirp);
+    DEBUG_TX_START();
+    DEBUG_RX_END();
+    DPRINT("Start advertising @ %i, %i frames", timer_get_counter_value(), adv_frame_count);
+    cc1101_interface_strobe(RF_STX);
 
     return SUCCESS;
 }
 
-int16_t hw_radio_get_rssi()
+static int16_t radio_get_rssi()
 {
+    if (current_state == HW_RADIO_STATE_IDLE)
+        return scan_rssi;
+
     return convert_rssi(cc1101_interface_read_single_reg(RSSI));
 }
 
-error_t hw_radio_set_idle()
+static error_t radio_set_idle()
 {
     // if we are currently transmitting wait until TX completed before entering IDLE
     // we return now and go into IDLE when TX is completed
@@ -1050,3 +1659,33 @@ error_t hw_radio_set_idle()
 
     return SUCCESS;
 }
+
+static void radio_get_stats(hw_radio_stats_t* radio_stats)
+{
+    start_atomic();
+    *radio_stats = stats;
+    end_atomic();
+}
+
+static void radio_clear_stats()
+{
+    start_atomic();
+    memset(&stats, 0, sizeof(stats));
+    end_atomic();
+}
+
+const hw_radio_t cc1101_radio = {
+    .init = &radio_init,
+    .set_rx_header_filter = &radio_set_rx_header_filter,
+    .get_capabilities = &radio_get_capabilities,
+    .set_idle = &radio_set_idle,
+    .set_rx = &radio_set_rx,
+    .send_packet = &radio_send_packet,
+    .send_background_packet = &radio_send_background_packet,
+    .start_background_scan = &radio_start_background_scan,
+    .start_background_sniff = &radio_start_background_sniff,
+    .cca = &radio_cca,
+    .get_rssi = &radio_get_rssi,
+    .get_stats = &radio_get_stats,
+    .clear_stats = &radio_clear_stats,
+};
@@ -127,10 +127,18 @@
 typedef enum {
     CC1101_CHIPSTATE_SLEEP  = 0,
     CC1101_CHIPSTATE_IDLE   = 1,
+    CC1101_CHIPSTATE_RX     = 13,
     CC1101_CHIPSTATE_TX     = 19
     // TODO other states not used for now
 } cc1101_chipstate_t;
 
+// The chip status byte returned for each SPI header byte
+#define CC1101_STATUS_CHIP_RDYN             0x80    // the crystal oscillator does not run yet
+#define CC1101_STATUS_STATE_MASK            0x70
+#define CC1101_STATUS_STATE_CALIBRATE       0x40
+#define CC1101_STATUS_STATE_SETTLING        0x50
+#define CC1101_STATUS_STATE_RXFIFO_OVERFLOW 0x60
+
 typedef enum {
     CC1101_GDO0 = 0,
     CC1101_GDO1 = 1,
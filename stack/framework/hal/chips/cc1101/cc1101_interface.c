@@ -45,8 +45,11 @@ extern uint8_t _c1101_interface_strobe(uint8_t);
 extern uint8_t _c1101_interface_reset_radio_core();
 extern uint8_t _c1101_interface_read_single_reg(uint8_t);
 extern void _c1101_interface_write_single_reg(uint8_t, uint8_t);
+extern void _c1101_interface_write_regs(const uint8_t*, uint8_t);
 extern void _c1101_interface_read_burst_reg(uint8_t, uint8_t*, uint8_t);
 extern void _c1101_interface_write_burst_reg(uint8_t, uint8_t*, uint8_t);
+extern void _c1101_interface_read_burst_reg_async(uint8_t, uint8_t*, uint8_t);
+extern void _c1101_interface_write_burst_reg_async(uint8_t, uint8_t*, uint8_t);
 extern void _c1101_interface_write_single_patable(uint8_t);
 extern void _c1101_interface_write_burst_patable(uint8_t*, uint8_t);
 
@@ -108,8 +111,9 @@ void cc1101_interface_reset_radio_core(void)
 // @param       RF_SETTINGS* rfsettings  Pointer to the structure that holds the rf settings
 // @return      none
 // *****************************************************************************
-void cc1101_interface_write_rfsettings(RF_SETTINGS *rfsettings)
+void cc1101_interface_write_rfsettings(const RF_SETTINGS *rfsettings)
 {
+    // the burst write only reads the buffer
     cc1101_interface_write_burst_reg(IOCFG2, (unsigned char*) rfsettings, sizeof(RF_SETTINGS));
 }
 
@@ -138,6 +142,19 @@ void cc1101_interface_write_single_reg(uint8_t addr, uint8_t value)
     DPRINT("WRITE SREG 0x%02X @0x%02X", value, addr);
 }
 
+// *****************************************************************************
+// @fn          WriteRegs
+// @brief       Write a number of radio registers in a single access
+// @param       unsigned char *regs     The address and the value of each register
+// @param       unsigned char count     Number of registers to be written
+// @return      none
+// *****************************************************************************
+void cc1101_interface_write_regs(const uint8_t* regs, uint8_t count)
+{
+    _c1101_interface_write_regs(regs, count);
+    DPRINT("WRITE REGS %u register(s) @0x%02X", count, regs[0]);
+}
+
 // *****************************************************************************
 // @fn          ReadBurstReg
 // @brief       Read multiple bytes to the radio registers
@@ -168,6 +185,36 @@ void cc1101_interface_write_burst_reg(uint8_t addr, uint8_t* buffer, uint8_t cou
     DPRINT("WRITE BREG %u Byte(s) @0x%02X", count, addr);
 }
 
+// *****************************************************************************
+// @fn          ReadBurstRegAsync
+// @brief       Start reading multiple bytes from the radio registers, the buffer
+//              is filled before the next access to the radio completes
+// @param       unsigned char addr      Beginning address of burst read
+// @param       unsigned char *buffer   Pointer to data table
+// @param       unsigned char count     Number of bytes to be read
+// @return      none
+// *****************************************************************************
+void cc1101_interface_read_burst_reg_async(uint8_t addr, uint8_t* buffer, uint8_t count)
+{
+    _c1101_interface_read_burst_reg_async(addr, buffer, count);
+    DPRINT("READ BREG ASYNC %u Byte(s) @0x%02X", count, addr);
+}
+
+// *****************************************************************************
+// @fn          WriteBurstRegAsync
+// @brief       Start writing multiple bytes to the radio registers, the buffer
+//              is read until the next access to the radio completes
+// @param       unsigned char addr      Beginning address of burst write
+// @param       unsigned char *buffer   Pointer to data table
+// @param       unsigned char count     Number of bytes to be written
+// @return      none
+// *****************************************************************************
+void cc1101_interface_write_burst_reg_async(uint8_t addr, uint8_t* buffer, uint8_t count)
+{
+    _c1101_interface_write_burst_reg_async(addr, buffer, count);
+    DPRINT("WRITE BREG ASYNC %u Byte(s) @0x%02X", count, addr);
+}
+
 // *****************************************************************************
 // @fn          WritePATable
 // @brief       Write data to power table
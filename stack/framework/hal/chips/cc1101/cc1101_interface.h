@@ -98,11 +98,16 @@ void cc1101_interface_set_interrupts_enabled(cc1101_gdOx_t gdOx, bool enabled);
 void c1101_interface_set_edge_interrupt(cc1101_gdOx_t gdOx, uint8_t edge);
 uint8_t cc1101_interface_strobe(uint8_t strobe_command);
 void cc1101_interface_reset_radio_core(void);
-void cc1101_interface_write_rfsettings(RF_SETTINGS* rfsettings);
+void cc1101_interface_write_rfsettings(const RF_SETTINGS* rfsettings);
 uint8_t cc1101_interface_read_single_reg(uint8_t addr);
 void cc1101_interface_write_single_reg(uint8_t addr, uint8_t value);
+// writes count registers of arbitrary addresses in a single access, regs holds the address and the value of each
+void cc1101_interface_write_regs(const uint8_t* regs, uint8_t count);
 void cc1101_interface_read_burst_reg(uint8_t addr, uint8_t* buffer, uint8_t count);
 void cc1101_interface_write_burst_reg(uint8_t addr, uint8_t* buffer, uint8_t count);
+// the asynchronous variants may access the buffer until the next access to the transceiver, which waits for the burst to complete
+void cc1101_interface_read_burst_reg_async(uint8_t addr, uint8_t* buffer, uint8_t count);
+void cc1101_interface_write_burst_reg_async(uint8_t addr, uint8_t* buffer, uint8_t count);
 void cc1101_interface_write_single_patable(uint8_t value);
 void cc1101_interface_write_burst_patable(uint8_t* buffer, uint8_t count);
 
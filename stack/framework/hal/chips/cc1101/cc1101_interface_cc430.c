@@ -100,8 +100,46 @@
 #define RFIFG_FLAG_AllNegativeEdge  0xFFFF
 #define RFIFG_FLANK_AllNegativeEdge 0xFFFF
 
+// the DMA triggers of the radio core interface (see the DMA trigger assignments of the CC430 datasheet): RFRXIFG when
+// a byte of an instruction can be read from RF1ADOUT, RFTXIFG when the next byte can be written to RF1ADIN
+#define DMA_TRIGGER_RFRXIFG 14
+#define DMA_TRIGGER_RFTXIFG 15
+
 static end_of_packet_isr_t end_of_packet_isr_callback;
 
+// the burst of the asynchronous variants (on DMA channel 0) completes before the next access to the radio core. The
+// last byte of a burst read is read by the CPU from RF1ADOUT0B, which does not start another read
+static bool burst_pending = false;
+static uint8_t* burst_last_byte = NULL;
+
+static void wait_burst_done()
+{
+    if(!burst_pending)
+        return;
+
+    while(DMA0CTL & DMAEN);
+    if(burst_last_byte != NULL)
+    {
+        RADIO_DOUT_READY_WAIT();
+        *burst_last_byte = RF1ADOUT0B;
+        burst_last_byte = NULL;
+    }
+
+    burst_pending = false;
+}
+
+static void start_burst_dma(uint8_t trigger, volatile void* source, volatile void* destination, uint16_t size,
+                            uint16_t increments)
+{
+    DMACTL0 = (DMACTL0 & 0xFF00) | trigger; // DMA0TSEL is the low byte
+    __data16_write_addr((unsigned short)&DMA0SA, (unsigned long)source);
+    __data16_write_addr((unsigned short)&DMA0DA, (unsigned long)destination);
+    DMA0SZ = size;
+    // single transfers of bytes on the rising edge of the trigger
+    DMA0CTL = DMADT_0 | increments | DMASRCBYTE | DMADSTBYTE | DMAEN;
+    burst_pending = true;
+}
+
 void no_interrupt_isr()
 {
 	assert(0); // should not happen, probably interrupt enabled unnecessary
@@ -205,6 +243,7 @@ void _c1101_interface_set_edge_interrupt(cc1101_gdOx_t gdOx, uint8_t edge)
 
 uint8_t _c1101_interface_strobe(uint8_t strobe)
 {
+    wait_burst_done();
     uint16_t int_state;
     uint8_t strobe_tmp = strobe & 0x7F;
     ENTER_CRITICAL_SECTION(int_state);
@@ -244,6 +283,7 @@ uint8_t _c1101_interface_reset_radio_core()
 
 uint8_t _c1101_interface_read_single_reg(uint8_t addr)
 {
+    wait_burst_done();
     uint8_t value;
     uint16_t int_state;
 
@@ -265,6 +305,7 @@ uint8_t _c1101_interface_read_single_reg(uint8_t addr)
 
 void _c1101_interface_write_single_reg(uint8_t addr, uint8_t value)
 {
+    wait_burst_done();
     uint16_t int_state;
 
     ENTER_CRITICAL_SECTION(int_state);
@@ -277,6 +318,7 @@ void _c1101_interface_write_single_reg(uint8_t addr, uint8_t value)
 
 void _c1101_interface_read_burst_reg(uint8_t addr, uint8_t* buffer, uint8_t count)
 {
+    wait_burst_done();
     uint8_t i;
     uint16_t int_state;
 
@@ -297,6 +339,7 @@ void _c1101_interface_read_burst_reg(uint8_t addr, uint8_t* buffer, uint8_t coun
 
 void _c1101_interface_write_burst_reg(uint8_t addr, uint8_t* buffer, uint8_t count)
 {
+    wait_burst_done();
     uint8_t i;
     uint16_t int_state;
 
@@ -313,8 +356,61 @@ void _c1101_interface_write_burst_reg(uint8_t addr, uint8_t* buffer, uint8_t cou
     EXIT_CRITICAL_SECTION(int_state);
 }
 
+// the instructions of the radio core have no chip select to batch, the registers are written one by one
+void _c1101_interface_write_regs(const uint8_t* regs, uint8_t count)
+{
+    for(uint8_t i = 0; i < count; i++)
+        _c1101_interface_write_single_reg(regs[2 * i], regs[2 * i + 1]);
+}
+
+// the bytes of the burst are moved by the DMA, triggered by the radio core interface, while the CPU runs on. The burst
+// instruction is issued with interrupts disabled as in the synchronous variants, the DMA is not interrupted
+void _c1101_interface_read_burst_reg_async(uint8_t addr, uint8_t* buffer, uint8_t count)
+{
+    if(count < 2)
+    {
+        _c1101_interface_read_burst_reg(addr, buffer, count);
+        return;
+    }
+
+    uint16_t int_state;
+    wait_burst_done();
+    ENTER_CRITICAL_SECTION(int_state);
+
+    // reading RF1ADOUT1B starts the read of the next byte, the DMA is triggered by each one but the last
+    start_burst_dma(DMA_TRIGGER_RFRXIFG, &RF1ADOUT1B, buffer, count - 1, DMASRCINCR_0 | DMADSTINCR_3);
+    burst_last_byte = buffer + count - 1;
+
+    RADIO_INST_READY_WAIT();
+    RF1AINSTR1B = RF_REGRD | addr;
+
+    EXIT_CRITICAL_SECTION(int_state);
+}
+
+void _c1101_interface_write_burst_reg_async(uint8_t addr, uint8_t* buffer, uint8_t count)
+{
+    if(count < 2)
+    {
+        _c1101_interface_write_burst_reg(addr, buffer, count);
+        return;
+    }
+
+    uint16_t int_state;
+    wait_burst_done();
+    ENTER_CRITICAL_SECTION(int_state);
+
+    // the first byte goes with the instruction, the DMA writes the others as the radio core takes them
+    start_burst_dma(DMA_TRIGGER_RFTXIFG, buffer + 1, &RF1ADINB, count - 1, DMASRCINCR_3 | DMADSTINCR_0);
+
+    RADIO_INST_READY_WAIT();
+    RF1AINSTRW = ((RF_REGWR | addr) << 8) + buffer[0];
+
+    EXIT_CRITICAL_SECTION(int_state);
+}
+
 void _c1101_interface_write_single_patable(uint8_t value)
 {
+    wait_burst_done();
     uint16_t int_state;
 
     ENTER_CRITICAL_SECTION(int_state);
@@ -330,6 +426,7 @@ void _c1101_interface_write_single_patable(uint8_t value)
 
 void _c1101_interface_write_burst_patable(uint8_t* buffer, uint8_t count)
 {
+    wait_burst_done();
     uint8_t i;
     uint16_t int_state;
 
@@ -107,6 +107,7 @@ void _c1101_interface_set_edge_interrupt(cc1101_gdOx_t gdOx, uint8_t edge)
 
 uint8_t _c1101_interface_strobe(uint8_t strobe)
 {
+    spi_wait_exchange_done(spi_slave);
     spi_select(spi_slave);
     uint8_t statusByte = spi_exchange_byte(spi_slave, strobe & 0x3F);
     spi_deselect(spi_slave);
@@ -116,6 +117,7 @@ uint8_t _c1101_interface_strobe(uint8_t strobe)
 
 uint8_t _c1101_interface_reset_radio_core()
 {
+    spi_wait_exchange_done(spi_slave);
     spi_deselect(spi_slave);
     hw_busy_wait(30);
     spi_select(spi_slave);
@@ -130,12 +132,15 @@ uint8_t _c1101_interface_reset_radio_core()
 
 static uint8_t readreg(uint8_t addr)
 {
+    uint8_t _addr = (addr & 0x3F) | READ_SINGLE;
+    uint8_t val;
+    // the received byte of the header is the status, the value is received while sending a dummy byte
+    spi_transfer_t transfers[] = {
+        { .TxData = &_addr, .RxData = NULL, .length = 1 },
+        { .TxData = NULL, .RxData = &val, .length = 1 }
+    };
 
-    spi_select(spi_slave);
-    spi_exchange_byte(spi_slave, (addr & 0x3F) | READ_SINGLE);
-    // send dummy byte to receive reply
-    uint8_t val = spi_exchange_byte(spi_slave, 0);
-    spi_deselect(spi_slave);
+    spi_exchange_batch(spi_slave, transfers, 2);
 
     DPRINT("READ REG 0x%02X @0x%02X", val, addr);
 
@@ -144,6 +149,7 @@ static uint8_t readreg(uint8_t addr)
 
 static uint8_t readstatus(uint8_t addr)
 {
+    spi_wait_exchange_done(spi_slave);
     uint8_t ret, ret2, data, data2;
     uint8_t _addr = (addr & 0x3F) | READ_BURST;
     spi_select(spi_slave);
@@ -180,28 +186,67 @@ uint8_t _c1101_interface_read_single_reg(uint8_t addr)
 
 void _c1101_interface_write_single_reg(uint8_t addr, uint8_t value)
 {
-    spi_select(spi_slave);
-    spi_exchange_byte(spi_slave, (addr & 0x3F));
-    spi_exchange_byte(spi_slave, value);
-    spi_deselect(spi_slave);
+    uint8_t data[2] = { addr & 0x3F, value };
+    spi_transfer_t transfer = { .TxData = data, .RxData = NULL, .length = sizeof(data) };
+    spi_exchange_batch(spi_slave, &transfer, 1);
+}
+
+// the CC1101 accepts the header of the next single access right after the value of the previous one, the registers
+// are written while the chip remains selected
+void _c1101_interface_write_regs(const uint8_t* regs, uint8_t count)
+{
+    for(uint8_t i = 0; i < count; i++)
+        assert((regs[2 * i] & ~0x3F) == 0); // a write of a single register
+
+    // the exchange only reads the buffer
+    spi_transfer_t transfer = { .TxData = (uint8_t*) regs, .RxData = NULL, .length = 2 * count };
+    spi_exchange_batch(spi_slave, &transfer, 1);
 }
 
 void _c1101_interface_read_burst_reg(uint8_t addr, uint8_t* buffer, uint8_t count)
 {
+    uint8_t _addr = (addr & 0x3F) | READ_BURST;
+    spi_transfer_t transfers[] = {
+        { .TxData = &_addr, .RxData = NULL, .length = 1 },
+        { .TxData = NULL, .RxData = buffer, .length = count }
+    };
+
+    spi_exchange_batch(spi_slave, transfers, 2);
+}
+
+void _c1101_interface_write_burst_reg(uint8_t addr, uint8_t* buffer, uint8_t count)
+{
+    uint8_t _addr = (addr & 0x3F) | WRITE_BURST;
+    spi_transfer_t transfers[] = {
+        { .TxData = &_addr, .RxData = NULL, .length = 1 },
+        { .TxData = buffer, .RxData = NULL, .length = count }
+    };
+
+    spi_exchange_batch(spi_slave, transfers, 2);
+}
+
+// the slave is deselected once the asynchronous burst completed
+static void burst_done(spi_slave_handle_t* slave)
+{
+    spi_deselect(slave);
+}
+
+void _c1101_interface_read_burst_reg_async(uint8_t addr, uint8_t* buffer, uint8_t count)
+{
+    spi_wait_exchange_done(spi_slave);
     uint8_t _addr = (addr & 0x3F) | READ_BURST;
     spi_select(spi_slave);
     spi_exchange_byte(spi_slave, _addr);
-    spi_exchange_bytes(spi_slave,  NULL, buffer, count );
-    spi_deselect(spi_slave);
+    spi_exchange_bytes_async(spi_slave, NULL, buffer, count, &burst_done);
 }
 
-void _c1101_interface_write_burst_reg(uint8_t addr, uint8_t* buffer, uint8_t count)
+void _c1101_interface_write_burst_reg_async(uint8_t addr, uint8_t* buffer, uint8_t count)
 {
+    spi_wait_exchange_done(spi_slave);
     uint8_t _addr = (addr & 0x3F) | WRITE_BURST;
     spi_select(spi_slave);
     spi_exchange_byte(spi_slave, _addr);
-    spi_exchange_bytes(spi_slave,  buffer, NULL, count );
-    spi_deselect(spi_slave);
+    spi_exchange_bytes_async(spi_slave, buffer, NULL, count, &burst_done);
 }
 
 void _c1101_interface_write_single_patable(uint8_t value)
@@ -142,12 +142,20 @@ RFIFG15 Positive edge: WOR event 1
 #define RADIO_GDO0_VALUE                0x06 			// IOCFG0.GDO0_CFG - asserts when sync word has been sent/received,
 														// de-asserts at end of packet
 
+// PKTSTATUS
+#define RADIO_PKTSTATUS_CRC_OK          (1 << 7)
+#define RADIO_PKTSTATUS_CS              (1 << 6)        // PKTSTATUS.CS carrier sense, RSSI above the AGCCTRL1 threshold
+#define RADIO_PKTSTATUS_PQT_REACHED     (1 << 5)
+#define RADIO_PKTSTATUS_CCA             (1 << 4)
+#define RADIO_PKTSTATUS_SFD             (1 << 3)
+
 // FIFO THR
 #define RADIO_FIFOTHR_CLOSE_IN_RX_0db   (0 << 4)
 #define RADIO_FIFOTHR_CLOSE_IN_RX_6db   (1 << 4)
 #define RADIO_FIFOTHR_CLOSE_IN_RX_12db  (2 << 4)
 #define RADIO_FIFOTHR_CLOSE_IN_RX_18db  (3 << 4)
 #define RADIO_FIFOTHR_FIFO_THR_61_4     (0)             // FIFOTHR.FIFO_THR 61B TX /  4B RX
+#define RADIO_FIFOTHR_FIFO_THR_45_20    (4)             // FIFOTHR.FIFO_THR 45B TX / 20B RX
 #define RADIO_FIFOTHR_FIFO_THR_33_32    (7)             // FIFOTHR.FIFO_THR 33B TX / 32B RX
 #define RADIO_FIFOTHR_FIFO_THR_17_48    (11)             // FIFOTHR.FIFO_THR 17B TX / 48B RX
 #define RADIO_FIFOTHR_FIFO_THR_1_64     (15)            // FIFOTHR.FIFO_THR  1B TX / 64B RX
@@ -288,6 +296,7 @@ RFIFG15 Positive edge: WOR event 1
 #define RADIO_MCSM0_FS_AUTOCAL_FROMIDLE   (1 << 4)    // MCSM0.AUTOCAL
 #define RADIO_MCSM0_FS_AUTOCAL_TOIDLE     (2 << 4)    // MCSM0.AUTOCAL
 #define RADIO_MCSM0_FS_AUTOCAL_4THIDLE    (3 << 4)    // MCSM0.AUTOCAL
+#define RADIO_MCSM0_FS_AUTOCAL_MASK       (3 << 4)    // MCSM0.AUTOCAL
 #define RADIO_MCSM0_PI_CTRL_EN            (1 << 1)    // Enables the pin radio control option
 #define RADIO_XOSX_FORCE_ON               (1)         // Force the RF XT2 oscillator to stay on in the SLEEP state.
 
@@ -393,6 +402,7 @@ RFIFG15 Positive edge: WOR event 1
 #define RADIO_WORCTRL_EVENT1_TIMEOUT24     (5<<4)
 #define RADIO_WORCTRL_EVENT1_TIMEOUT32     (6<<4)
 #define RADIO_WORCTRL_EVENT1_TIMEOUT48     (7<<4)
+#define RADIO_WORCTRL_RC_CAL               (1<<3)
 #define RADIO_WORCTRL_WOR_RES_29us         (0)
 #define RADIO_WORCTRL_WOR_RES_920us        (1)
 #define RADIO_WORCTRL_WOR_RES_32ms         (2)
@@ -16,17 +16,54 @@
  * limitations under the License.
  */
 
+#include <stdint.h>
+
 #include "hwatomic.h"
 #include <msp430.h>
 
-// TODO nested critical sections not yet supported
+static volatile uint16_t nesting = 0;
+static atomic_state_t saved_state;
 
-void start_atomic()
+atomic_state_t start_atomic_save()
 {
+    atomic_state_t state = __get_interrupt_state();
     __disable_interrupt();
+    return state;
+}
+
+void end_atomic_restore(atomic_state_t state)
+{
+    __set_interrupt_state(state);
+}
+
+void start_atomic()
+{
+    // the state is saved by the outer section only, the interrupts stay disabled for the ones it contains
+    atomic_state_t state = start_atomic_save();
+    if(nesting++ == 0)
+        saved_state = state;
 }
 
 void end_atomic()
 {
-    __enable_interrupt();
+    if(nesting > 0 && --nesting == 0)
+        end_atomic_restore(saved_state);
+}
+
+uint32_t atomic_set_bits(volatile uint32_t* word, uint32_t bits)
+{
+    atomic_state_t state = start_atomic_save();
+    uint32_t value = *word;
+    *word = value | bits;
+    end_atomic_restore(state);
+    return value;
+}
+
+uint32_t atomic_clear_bits(volatile uint32_t* word, uint32_t bits)
+{
+    atomic_state_t state = start_atomic_save();
+    uint32_t value = *word;
+    *word = value & ~bits;
+    end_atomic_restore(state);
+    return value;
 }
@@ -0,0 +1,65 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The crc component on the CRC16 module of the CC430, which overrides the lookup tables of components/crc. The module
+ * implements the CRC-CCITT polynomial (0x1021): the bytes written to CRCDIRB are processed MSB first, as in the D7A CRC,
+ * and CRCINIRES holds the CRC register. The module is shared, a calculation runs with interrupts disabled so a CRC
+ * calculated in an interrupt does not corrupt it.
+ */
+
+#include <stdint.h>
+#include <msp430.h>
+
+#include "crc.h"
+
+#define CRC_INITIAL_VALUE 0xFFFF
+
+uint16_t crc16_init()
+{
+    return CRC_INITIAL_VALUE;
+}
+
+uint16_t crc16_update(uint16_t crc, const uint8_t* data, uint16_t length)
+{
+    uint16_t int_state = __get_interrupt_state();
+    __disable_interrupt();
+
+    CRCINIRES = crc;
+    for(; length > 0; length--)
+        CRCDIRB_L = *data++;
+
+    crc = CRCINIRES;
+    __set_interrupt_state(int_state);
+    return crc;
+}
+
+uint16_t crc16_final(uint16_t crc)
+{
+    return crc; // no final XOR
+}
+
+uint16_t crc_calculate(const uint8_t* data, uint16_t length)
+{
+    return crc16_final(crc16_update(crc16_init(), data, length));
+}
+
+uint16_t crc_update(uint16_t crc, const uint8_t* data, uint16_t length)
+{
+    return crc16_update(crc, data, length);
+}
@@ -38,3 +38,32 @@ void end_atomic()
     cpu_int_enable();
 }
 
+// the state of the interrupts is not read back, the sections are not nested
+atomic_state_t start_atomic_save()
+{
+    cpu_int_disable();
+    return 0;
+}
+
+void end_atomic_restore(atomic_state_t state)
+{
+    cpu_int_enable();
+}
+
+uint32_t atomic_set_bits(volatile uint32_t* word, uint32_t bits)
+{
+    atomic_state_t state = start_atomic_save();
+    uint32_t value = *word;
+    *word = value | bits;
+    end_atomic_restore(state);
+    return value;
+}
+
+uint32_t atomic_clear_bits(volatile uint32_t* word, uint32_t bits)
+{
+    atomic_state_t state = start_atomic_save();
+    uint32_t value = *word;
+    *word = value & ~bits;
+    end_atomic_restore(state);
+    return value;
+}
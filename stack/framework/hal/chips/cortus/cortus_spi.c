@@ -190,3 +190,26 @@ void spi_exchange_bytes(spi_slave_handle_t* slave,
     }
   }
 }
+
+void spi_exchange_batch(spi_slave_handle_t* slave, const spi_transfer_t* transfers, uint8_t count) {
+  spi_wait_exchange_done(slave);
+  spi_select(slave);
+  for(uint8_t i = 0; i < count; i++)
+    spi_exchange_bytes(slave, transfers[i].TxData, transfers[i].RxData, transfers[i].length);
+
+  spi_deselect(slave);
+}
+
+// no DMA, the bytes are exchanged before returning
+void spi_exchange_bytes_async(spi_slave_handle_t* slave,
+                              uint8_t* TxData, uint8_t* RxData, size_t length,
+                              spi_exchange_done_callback_t done_cb)
+{
+  spi_exchange_bytes(slave, TxData, RxData, length);
+  if(done_cb != NULL) {
+    done_cb(slave);
+  }
+}
+
+void spi_wait_exchange_done(spi_slave_handle_t* slave) {
+}
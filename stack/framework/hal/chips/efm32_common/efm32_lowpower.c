@@ -0,0 +1,45 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file efm32_lowpower.c
+ *
+ * The low power modes shared by the EFM32 and EZR32 chips, the energy modes of their EMU are the same. The chip
+ * directories add this file to their object library.
+ */
+
+#include "hwsystem.h"
+#include "platform.h"
+
+uint32_t hw_get_lowpower_mode_wakeup_latency(uint8_t mode)
+{
+    // the RTC keeps running in EM1 and EM2, in EM3 and EM4 only GPIO interrupts can wake us up.
+    // When running on the HFXO EMU_EnterEM2() restores (and waits for) the crystal on wake-up
+    switch(mode)
+    {
+	case 0:
+	    return 0;
+	case 1:
+#ifdef HW_USE_HFXO
+	    return 1000;
+#else
+	    return 10;
+#endif
+	default:
+	    return HW_LOWPOWER_NO_TIMER_WAKEUP;
+    }
+}
@@ -37,10 +37,16 @@
 #include "em_emu.h"
 #include "em_int.h"
 
+#include "hwatomic.h"
 #include "hwgpio.h"
 #include "hwspi.h"
 
 #include "platform.h"
+#include "hal_defs.h"
+
+#ifdef HAL_SPI_USE_DMA
+#include "dmactrl.h"
+#endif
 
 #define USARTS    3
 #define LOCATIONS 2
@@ -53,7 +59,7 @@ typedef struct {
 } spi_pins_t;
 
 // TODO to be completed with all documented locations
-static spi_pins_t location[USARTS][LOCATIONS] = {
+static const spi_pins_t location[USARTS][LOCATIONS] = {
   {
     // USART 0
     {
@@ -128,7 +134,7 @@ static spi_usart_t usart[USARTS] = {
 // private implementation of handle structs
 struct spi_handle {
   spi_usart_t*        usart;
-  spi_pins_t*         pins;
+  const spi_pins_t*   pins;
   uint32_t            baudrate;
   uint8_t             databits;
   bool                msbf;
@@ -340,3 +346,154 @@ void spi_exchange_bytes(spi_slave_handle_t* slave,
     }
   }
 }
+
+void spi_exchange_batch(spi_slave_handle_t* slave, const spi_transfer_t* transfers, uint8_t count) {
+  spi_wait_exchange_done(slave);
+  spi_select(slave);
+  for(uint8_t i = 0; i < count; i++)
+    spi_exchange_bytes(slave, transfers[i].TxData, transfers[i].RxData, transfers[i].length);
+
+  spi_deselect(slave);
+}
+
+#ifdef HAL_SPI_USE_DMA
+
+// channels 0 and 1 are left to the USB CDC driver of the kit drivers (cdc.c), a platform can move the SPI channels
+#ifndef SPI_DMA_CHANNEL_RX
+#define SPI_DMA_CHANNEL_RX 2
+#endif
+#ifndef SPI_DMA_CHANNEL_TX
+#define SPI_DMA_CHANNEL_TX 3
+#endif
+
+// the DMA requests of the USARTs, indexed like usart[]
+static const uint32_t dma_req_rx[USARTS] = { DMAREQ_USART0_RXDATAV, DMAREQ_USART1_RXDATAV, DMAREQ_USART2_RXDATAV };
+static const uint32_t dma_req_tx[USARTS] = { DMAREQ_USART0_TXBL, DMAREQ_USART1_TXBL, DMAREQ_USART2_TXBL };
+
+static spi_slave_handle_t*          async_slave = NULL;
+static spi_exchange_done_callback_t async_done_cb;
+static uint8_t                      dma_dummy; // sent when there is no TX buffer, receives the bytes when there is no RX buffer
+static DMA_CB_TypeDef               dma_rx_cb;
+static bool                         dma_initialized = false;
+
+// called from the DMA interrupt or from spi_wait_exchange_done(), the callback is only called by the first
+static void complete_async_exchange(void) {
+  atomic_state_t state = start_atomic_save();
+  spi_slave_handle_t* slave = async_slave;
+  async_slave = NULL;
+  end_atomic_restore(state);
+
+  if(slave != NULL && async_done_cb != NULL) {
+    async_done_cb(slave);
+  }
+}
+
+static void dma_rx_done(unsigned int channel, bool primary, void* user) {
+  complete_async_exchange();
+}
+
+static void init_dma(void) {
+  CMU_ClockEnable(cmuClock_DMA, true);
+
+  // the DMA controller may be initialized already by another driver
+  if( ! (DMA->STATUS & DMA_STATUS_EN) ) {
+    DMA_Init_TypeDef dma_init = {
+      .hprot        = 0,
+      .controlBlock = dmaControlBlock
+    };
+    DMA_Init(&dma_init);
+  }
+
+  dma_rx_cb = (DMA_CB_TypeDef){
+    .cbFunc  = dma_rx_done,
+    .userPtr = NULL
+  };
+
+  dma_initialized = true;
+}
+
+// the RX channel completes last, after the last byte was shifted out, so the slave can be deselected in done_cb
+void spi_exchange_bytes_async(spi_slave_handle_t* slave,
+                              uint8_t* TxData, uint8_t* RxData, size_t length,
+                              spi_exchange_done_callback_t done_cb)
+{
+  assert(async_slave == NULL);
+  assert(TxData != NULL || RxData != NULL);
+  assert(length > 0 && length <= (_DMA_CTRL_N_MINUS_1_MASK >> _DMA_CTRL_N_MINUS_1_SHIFT) + 1);
+
+  if( ! dma_initialized ) {
+    init_dma();
+  }
+
+  USART_TypeDef* channel = slave->spi->usart->channel;
+  uint8_t idx = slave->spi->usart - usart;
+
+  DMA_CfgChannel_TypeDef rx_channel = {
+    .highPri   = true, // the RX buffer is only one byte deep
+    .enableInt = true,
+    .select    = dma_req_rx[idx],
+    .cb        = &dma_rx_cb
+  };
+  DMA_CfgChannel(SPI_DMA_CHANNEL_RX, &rx_channel);
+
+  DMA_CfgDescr_TypeDef rx_descr = {
+    .dstInc  = RxData != NULL ? dmaDataInc1 : dmaDataIncNone,
+    .srcInc  = dmaDataIncNone,
+    .size    = dmaDataSize1,
+    .arbRate = dmaArbitrate1,
+    .hprot   = 0
+  };
+  DMA_CfgDescr(SPI_DMA_CHANNEL_RX, true, &rx_descr);
+
+  DMA_CfgChannel_TypeDef tx_channel = {
+    .highPri   = false,
+    .enableInt = false,
+    .select    = dma_req_tx[idx],
+    .cb        = NULL
+  };
+  DMA_CfgChannel(SPI_DMA_CHANNEL_TX, &tx_channel);
+
+  DMA_CfgDescr_TypeDef tx_descr = {
+    .dstInc  = dmaDataIncNone,
+    .srcInc  = TxData != NULL ? dmaDataInc1 : dmaDataIncNone,
+    .size    = dmaDataSize1,
+    .arbRate = dmaArbitrate1,
+    .hprot   = 0
+  };
+  DMA_CfgDescr(SPI_DMA_CHANNEL_TX, true, &tx_descr);
+
+  async_done_cb = done_cb;
+  async_slave   = slave;
+  dma_dummy     = 0;
+
+  channel->CMD = USART_CMD_CLEARRX;
+  DMA_ActivateBasic(SPI_DMA_CHANNEL_RX, true, false,
+                    RxData != NULL ? RxData : &dma_dummy, (void*)&channel->RXDATA, length - 1);
+  DMA_ActivateBasic(SPI_DMA_CHANNEL_TX, true, false,
+                    (void*)&channel->TXDATA, TxData != NULL ? TxData : &dma_dummy, length - 1);
+}
+
+void spi_wait_exchange_done(spi_slave_handle_t* slave) {
+  if( async_slave != slave ) { return; }
+
+  while( DMA_ChannelEnabled(SPI_DMA_CHANNEL_RX) );
+  complete_async_exchange();
+}
+
+#else
+
+// without DMA the bytes are exchanged before returning
+void spi_exchange_bytes_async(spi_slave_handle_t* slave,
+                              uint8_t* TxData, uint8_t* RxData, size_t length,
+                              spi_exchange_done_callback_t done_cb)
+{
+  spi_exchange_bytes(slave, TxData, RxData, length);
+  if(done_cb != NULL) {
+    done_cb(slave);
+  }
+}
+
+void spi_wait_exchange_done(spi_slave_handle_t* slave) {
+}
+
+#endif // HAL_SPI_USE_DMA
@@ -62,7 +62,7 @@ typedef struct {
 
 // configuration of uart/location mapping to tx and rx pins
 // TODO to be completed with all documented locations
-static uart_pins_t location[UARTS][LOCATIONS] = {
+static const uart_pins_t location[UARTS][LOCATIONS] = {
   {
     // UART 0
     {
@@ -174,7 +174,7 @@ struct uart_handle {
   USART_TypeDef*       channel;
   CMU_Clock_TypeDef    clock;
   uart_irq_t           irq;
-  uart_pins_t*         pins;
+  const uart_pins_t*   pins;
   uint32_t             baudrate;
 };
 
@@ -29,9 +29,14 @@
 
 #include "em_adc.h"
 #include "em_cmu.h"
+#include "em_dma.h"
+#include "em_prs.h"
+#include "em_timer.h"
+#include "dmactrl.h"
 
 #include "platform.h"
 #include "log.h"
+#include "scheduler.h"
 
 /***************************************************************************//**
  * @brief
@@ -230,59 +235,60 @@ void adc_calibrate()
 }
 
 
-void adc_init(ADC_Reference reference, ADC_Input input, uint32_t adc_frequency)
+static ADC_Ref_TypeDef get_reference(ADC_Reference reference)
 {
-	// Initialises clocks
-	CMU_ClockEnable(cmuClock_HFPER, true);
-	CMU_ClockEnable(cmuClock_ADC0, true);
-
-	/* Base the ADC configuration on the default setup. */
-	ADC_Init_TypeDef init = ADC_INIT_DEFAULT;
-	ADC_InitSingle_TypeDef sInit = ADC_INITSINGLE_DEFAULT;
-
-	/* Initialize timebases */
-	init.timebase = ADC_TimebaseCalc(0);
-	init.prescale = ADC_PrescaleCalc(adc_frequency,0);
-	ADC_Init(ADC0, &init);
-
 	switch (reference)
 	{
 	/** Internal 1.25V reference. */
 	case adcReference1V25:
-		sInit.reference = adcRef1V25;
-		break;
+		return adcRef1V25;
 
 	/** Internal 2.5V reference. */
 	case adcReference2V5:
-		sInit.reference = adcRef2V5;
-		break;
+		return adcRef2V5;
 
 	/** Buffered VDD. */
 	case adcReferenceVDD:
-		sInit.reference = adcRefVDD;
-		break;
+		return adcRefVDD;
 
 	/** Internal differential 5V reference. */
 	case adcReference5VDIFF:
-		sInit.reference = adcRef5VDIFF;
-		break;
+		return adcRef5VDIFF;
 
 	/** Single ended ext. ref. from 1 pin. */
 	case adcReferenceExtSingle:
-		sInit.reference = adcRefExtSingle;
-		break;
+		return adcRefExtSingle;
 
 	/** Differential ext. ref. from 2 pins */
 	case adcReference2xExtDiff:
-		sInit.reference = adcRef2xExtDiff;
-		break;
+		return adcRef2xExtDiff;
 
 	/** Unbuffered 2xVDD. */
 	case adcReference2xVDD:
-		sInit.reference = adcRef2xVDD;
-		break;
+		return adcRef2xVDD;
 	}
 
+	assert(false);
+	return adcRef1V25;
+}
+
+void adc_init(ADC_Reference reference, ADC_Input input, uint32_t adc_frequency)
+{
+	// Initialises clocks
+	CMU_ClockEnable(cmuClock_HFPER, true);
+	CMU_ClockEnable(cmuClock_ADC0, true);
+
+	/* Base the ADC configuration on the default setup. */
+	ADC_Init_TypeDef init = ADC_INIT_DEFAULT;
+	ADC_InitSingle_TypeDef sInit = ADC_INITSINGLE_DEFAULT;
+
+	/* Initialize timebases */
+	init.timebase = ADC_TimebaseCalc(0);
+	init.prescale = ADC_PrescaleCalc(adc_frequency,0);
+	ADC_Init(ADC0, &init);
+
+	sInit.reference = get_reference(reference);
+
 	switch (input)
 		{
 			/** Temperature reference. */
@@ -340,3 +346,163 @@ void adc_clear_interrupt()
 	ADC_IntClear(ADC0, ADC_IFC_SINGLEOF);
 }
 
+// the scans are triggered by the overflows of the timer, routed to the ADC through the PRS channel
+#define ADC_SCAN_TIMER       TIMER0
+#define ADC_SCAN_TIMER_CLOCK cmuClock_TIMER0
+#define ADC_SCAN_PRS_CHANNEL 0
+#ifndef ADC_DMA_CHANNEL
+#define ADC_DMA_CHANNEL      4 // channels 0 and 1 are left to the USB CDC driver, 2 and 3 to the SPI driver
+#endif
+
+static uint8_t                  scan_channel_count = 0;
+static uint16_t*                scan_buffer = NULL;
+static uint16_t                 scan_count;
+static adc_scan_done_callback_t scan_done_cb;
+static uint8_t                  scan_low_power_mode;
+static task_handle_t            scan_done_handle;
+static bool                     scan_done_registered = false;
+static DMA_CB_TypeDef           dma_cb;
+static bool                     dma_initialized = false;
+
+static void scan_done()
+{
+	uint16_t* buffer = scan_buffer;
+	if (buffer == NULL)
+		return; // stopped meanwhile
+
+	scan_buffer = NULL;
+	sched_set_low_power_mode(scan_low_power_mode);
+	if (scan_done_cb != NULL)
+		scan_done_cb(buffer, scan_count);
+}
+
+static void dma_done(unsigned int channel, bool primary, void* user)
+{
+	TIMER_Enable(ADC_SCAN_TIMER, false);
+	sched_post_handle_from_isr(scan_done_handle, DEFAULT_PRIORITY);
+}
+
+static void init_dma()
+{
+	CMU_ClockEnable(cmuClock_DMA, true);
+
+	// the DMA controller may be initialized already by another driver
+	if (!(DMA->STATUS & DMA_STATUS_EN))
+	{
+		DMA_Init_TypeDef dma_init = {
+			.hprot        = 0,
+			.controlBlock = dmaControlBlock
+		};
+		DMA_Init(&dma_init);
+	}
+
+	dma_cb = (DMA_CB_TypeDef){
+		.cbFunc  = dma_done,
+		.userPtr = NULL
+	};
+
+	dma_initialized = true;
+}
+
+void adc_init_scan(ADC_Reference reference, uint8_t channels, uint32_t adc_frequency)
+{
+	assert(channels != 0);
+	assert(scan_buffer == NULL);
+
+	CMU_ClockEnable(cmuClock_HFPER, true);
+	CMU_ClockEnable(cmuClock_ADC0, true);
+	CMU_ClockEnable(cmuClock_PRS, true);
+	CMU_ClockEnable(ADC_SCAN_TIMER_CLOCK, true);
+
+	ADC_Init_TypeDef init = ADC_INIT_DEFAULT;
+	init.timebase = ADC_TimebaseCalc(0);
+	init.prescale = ADC_PrescaleCalc(adc_frequency, 0);
+	ADC_Init(ADC0, &init);
+
+	ADC_InitScan_TypeDef scanInit = ADC_INITSCAN_DEFAULT;
+	scanInit.reference = get_reference(reference);
+	scanInit.input     = (uint32_t)channels << _ADC_SCANCTRL_INPUTMASK_SHIFT;
+	scanInit.prsSel    = (ADC_PRSSEL_TypeDef)ADC_SCAN_PRS_CHANNEL;
+	scanInit.prsEnable = true;
+	ADC_InitScan(ADC0, &scanInit);
+
+	PRS_SourceSignalSet(ADC_SCAN_PRS_CHANNEL, PRS_CH_CTRL_SOURCESEL_TIMER0, PRS_CH_CTRL_SIGSEL_TIMER0OF, prsEdgeOff);
+
+	scan_channel_count = __builtin_popcount(channels);
+}
+
+error_t adc_scan_start(uint16_t* buffer, uint16_t count, uint32_t sample_rate, adc_scan_done_callback_t done_cb)
+{
+	assert(scan_channel_count > 0); // adc_init_scan() should be called first
+	if (scan_buffer != NULL)
+		return EALREADY;
+
+	if (count == 0 || count % scan_channel_count != 0 || count > (_DMA_CTRL_N_MINUS_1_MASK >> _DMA_CTRL_N_MINUS_1_SHIFT) + 1)
+		return EINVAL;
+
+	// the prescaler of the timer is a power of 2, the smallest one for which the period fits the 16 bit counter
+	uint32_t ticks = sample_rate > 0 ? CMU_ClockFreqGet(ADC_SCAN_TIMER_CLOCK) / sample_rate : 0;
+	uint8_t prescale = timerPrescale1;
+	while ((ticks >> prescale) > 0x10000 && prescale < timerPrescale1024)
+		prescale++;
+
+	if ((ticks >> prescale) == 0 || (ticks >> prescale) > 0x10000)
+		return EINVAL;
+
+	// registered on first use, adc_init_scan() may be called before the scheduler is initialized
+	if (!scan_done_registered)
+	{
+		error_t err = sched_register_task_handle(&scan_done, &scan_done_handle);
+		assert(err == SUCCESS);
+		scan_done_registered = true;
+	}
+
+	if (!dma_initialized)
+		init_dma();
+
+	TIMER_Init_TypeDef timer_init = TIMER_INIT_DEFAULT;
+	timer_init.enable   = false;
+	timer_init.prescale = (TIMER_Prescale_TypeDef)prescale;
+	TIMER_Init(ADC_SCAN_TIMER, &timer_init);
+	TIMER_TopSet(ADC_SCAN_TIMER, (ticks >> prescale) - 1);
+	TIMER_CounterSet(ADC_SCAN_TIMER, 0);
+
+	scan_buffer  = buffer;
+	scan_count   = count;
+	scan_done_cb = done_cb;
+	scan_low_power_mode = sched_get_low_power_mode();
+	sched_set_low_power_mode(0); // EM1
+
+	ADC_DataScanGet(ADC0); // drops a result of a previous scan
+	DMA_CfgChannel_TypeDef channel = {
+		.highPri   = false,
+		.enableInt = true,
+		.select    = DMAREQ_ADC0_SCAN,
+		.cb        = &dma_cb
+	};
+	DMA_CfgChannel(ADC_DMA_CHANNEL, &channel);
+
+	DMA_CfgDescr_TypeDef descr = {
+		.dstInc  = dmaDataInc2,
+		.srcInc  = dmaDataIncNone,
+		.size    = dmaDataSize2,
+		.arbRate = dmaArbitrate1,
+		.hprot   = 0
+	};
+	DMA_CfgDescr(ADC_DMA_CHANNEL, true, &descr);
+	DMA_ActivateBasic(ADC_DMA_CHANNEL, true, false, buffer, (void*)&ADC0->SCANDATA, count - 1);
+	TIMER_Enable(ADC_SCAN_TIMER, true);
+	return SUCCESS;
+}
+
+void adc_scan_stop()
+{
+	TIMER_Enable(ADC_SCAN_TIMER, false);
+	if (scan_buffer == NULL)
+		return;
+
+	DMA_ChannelEnable(ADC_DMA_CHANNEL, false);
+	sched_cancel_handle(scan_done_handle);
+	scan_buffer = NULL;
+	sched_set_low_power_mode(scan_low_power_mode);
+}
@@ -22,15 +22,55 @@
  *
  */
 
+#include <stdint.h>
+
 #include "hwatomic.h"
-#include "em_int.h"
+#include "em_device.h"
+
+static volatile uint32_t nesting = 0;
+static atomic_state_t saved_state;
+
+atomic_state_t start_atomic_save()
+{
+	atomic_state_t state = __get_PRIMASK();
+	__disable_irq();
+	return state;
+}
+
+void end_atomic_restore(atomic_state_t state)
+{
+	if(!state)
+		__enable_irq();
+}
 
 void start_atomic()
 {
-	INT_Disable();
+	// the state is saved by the outer section only, the interrupts stay masked for the ones it contains
+	atomic_state_t state = start_atomic_save();
+	if(nesting++ == 0)
+		saved_state = state;
 }
 
 void end_atomic()
 {
-	INT_Enable();
+	if(nesting > 0 && --nesting == 0)
+		end_atomic_restore(saved_state);
+}
+
+uint32_t atomic_set_bits(volatile uint32_t* word, uint32_t bits)
+{
+	atomic_state_t state = start_atomic_save();
+	uint32_t value = *word;
+	*word = value | bits;
+	end_atomic_restore(state);
+	return value;
+}
+
+uint32_t atomic_clear_bits(volatile uint32_t* word, uint32_t bits)
+{
+	atomic_state_t state = start_atomic_save();
+	uint32_t value = *word;
+	*word = value & ~bits;
+	end_atomic_restore(state);
+	return value;
 }
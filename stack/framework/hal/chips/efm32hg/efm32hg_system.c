@@ -60,6 +60,14 @@ void hw_enter_lowpower_mode(uint8_t mode)
     }
 }
 
+void hw_get_stack_region(uint32_t** limit, uint32_t** top)
+{
+    // the symbols of the linker script, the stack grows down from __StackTop to __StackLimit
+    extern uint32_t __StackLimit, __StackTop;
+    *limit = &__StackLimit;
+    *top = &__StackTop;
+}
+
 uint64_t hw_get_unique_id()
 {
     return SYSTEM_GetUnique();
@@ -16,21 +16,79 @@
  * limitations under the License.
  */
 
-/*! \file efm32hg_atomic.c
+/*! \file efm32lg_atomic.c
  *
  *  \author daniel.vandenakker@uantwerpen.be
  *
  */
 
+#include <stdint.h>
+
 #include "hwatomic.h"
-#include "em_int.h"
+#include "em_device.h"
+#include "hal_defs.h"
+
+#ifdef HAL_ATOMIC_USE_BASEPRI
+// the interrupts of this priority and of the lower ones are masked (INT_PRIO_STACK of efm32lg_mcu.c)
+#define ATOMIC_MASKED_PRIORITY 1
+#define ATOMIC_BASEPRI (ATOMIC_MASKED_PRIORITY << (8 - __NVIC_PRIO_BITS))
+#endif
+
+static volatile uint32_t nesting = 0;
+static atomic_state_t saved_state;
+
+atomic_state_t start_atomic_save()
+{
+#ifdef HAL_ATOMIC_USE_BASEPRI
+	atomic_state_t state = __get_BASEPRI();
+	if(state == 0 || state > ATOMIC_BASEPRI)
+		__set_BASEPRI(ATOMIC_BASEPRI);
+#else
+	atomic_state_t state = __get_PRIMASK();
+	__disable_irq();
+#endif
+	return state;
+}
+
+void end_atomic_restore(atomic_state_t state)
+{
+#ifdef HAL_ATOMIC_USE_BASEPRI
+	__set_BASEPRI(state);
+#else
+	if(!state)
+		__enable_irq();
+#endif
+}
 
 void start_atomic()
 {
-	INT_Disable();
+	// the state is saved by the outer section only, the interrupts stay masked for the ones it contains
+	atomic_state_t state = start_atomic_save();
+	if(nesting++ == 0)
+		saved_state = state;
 }
 
 void end_atomic()
 {
-	INT_Enable();
+	if(nesting > 0 && --nesting == 0)
+		end_atomic_restore(saved_state);
+}
+
+uint32_t atomic_set_bits(volatile uint32_t* word, uint32_t bits)
+{
+	// an interrupt between the load and the store clears the exclusive monitor, the update is retried then
+	uint32_t value;
+	do
+		value = __LDREXW(word);
+	while(__STREXW(value | bits, word) != 0);
+	return value;
+}
+
+uint32_t atomic_clear_bits(volatile uint32_t* word, uint32_t bits)
+{
+	uint32_t value;
+	do
+		value = __LDREXW(word);
+	while(__STREXW(value & ~bits, word) != 0);
+	return value;
 }
@@ -12,12 +12,17 @@
 
 #include "hwgpio.h"
 #include "hwi2c.h"
+#include "scheduler.h"
 
 #include "platform.h"
+#include "efm32lg_mcu.h"
 
 // TODO use other ways to avoid long polling
 #define I2C_POLLING  100000
 
+// the transfers of a bus which can be queued by i2c_*_async()
+#define I2C_QUEUE_SIZE 4
+
 #define I2CS       2
 #define LOCATIONS  5
 
@@ -34,7 +39,7 @@ typedef struct {
 }
 
 // TODO to be completed with all documented locations
-static i2c_pins_t location[I2CS][LOCATIONS] = {
+static const i2c_pins_t location[I2CS][LOCATIONS] = {
   {
     // I2C 0
     {
@@ -87,23 +92,37 @@ static i2c_pins_t location[I2CS][LOCATIONS] = {
   }
 };
 
+typedef struct {
+  I2C_TransferSeq_TypeDef      seq;
+  i2c_transfer_done_callback_t done_cb;
+  void*                        arg;
+} i2c_transaction_t;
+
 typedef struct i2c_handle {
   uint8_t           idx;
   I2C_TypeDef*      channel;
   CMU_Clock_TypeDef clock;
-  i2c_pins_t*       pins;
+  IRQn_Type         irq;
+  const i2c_pins_t* pins;
+  // the queued transfers, the first one is ongoing. Only the result is written by the interrupt handler.
+  i2c_transaction_t queue[I2C_QUEUE_SIZE];
+  uint8_t           queue_head;
+  uint8_t           queue_count;
+  volatile int8_t   result;
 } i2c_handle_t;
 
 static i2c_handle_t handle[I2CS] = {
   {
     .idx     = 0,
     .channel = I2C0,
-    .clock   = cmuClock_I2C0
+    .clock   = cmuClock_I2C0,
+    .irq     = I2C0_IRQn
   },
   {
     .idx     = 1,
     .channel = I2C1,
-    .clock   = cmuClock_I2C1
+    .clock   = cmuClock_I2C1,
+    .irq     = I2C1_IRQn
   }  
 };
 
@@ -148,6 +167,9 @@ i2c_handle_t* i2c_init(uint8_t idx, uint8_t pins) {
 int8_t _perform_i2c_transfer(i2c_handle_t* i2c, I2C_TransferSeq_TypeDef msg) {
   int16_t rtry = 0;
 
+  // the interrupt of the bus would continue the transfer as well
+  assert(i2c->queue_count == 0);
+
    // start I2C write transaction
   I2C_TransferReturn_TypeDef ret = I2C_TransferInit(i2c->channel, &msg);
 
@@ -195,3 +217,130 @@ int8_t i2c_write_read(i2c_handle_t* i2c, uint8_t to, uint8_t* payload, int lengt
 	  .buf[1].len  = receive_length,
 	});
 }
+
+static task_handle_t async_done_handle;
+static bool          async_done_registered = false;
+
+// called from the interrupt handler, the completion is handled by async_transfer_done()
+static void complete_async_transfer(i2c_handle_t* i2c, int8_t result) {
+  i2c->result = result;
+  sched_post_handle_from_isr(async_done_handle, DEFAULT_PRIORITY);
+}
+
+static void start_async_transfer(i2c_handle_t* i2c) {
+  i2c->result = i2cTransferInProgress;
+  // enables the interrupts of the bus which continue the transfer from here on
+  I2C_TransferReturn_TypeDef ret = I2C_TransferInit(i2c->channel, &i2c->queue[i2c->queue_head].seq);
+  if(ret != i2cTransferInProgress) {
+    complete_async_transfer(i2c, ret);
+    return;
+  }
+
+  NVIC_EnableIRQ(i2c->irq);
+}
+
+static void continue_async_transfer(i2c_handle_t* i2c) {
+  I2C_TransferReturn_TypeDef ret = I2C_Transfer(i2c->channel);
+  if(ret != i2cTransferInProgress) {
+    complete_async_transfer(i2c, ret);
+  }
+}
+
+static void async_transfer_done() {
+  for(uint8_t idx = 0; idx < I2CS; idx++) {
+    i2c_handle_t* i2c = &handle[idx];
+    if(i2c->queue_count == 0 || i2c->result == i2cTransferInProgress) {
+      continue;
+    }
+
+    // the next transfer is started before the callback, which may queue another one
+    i2c_transaction_t done = i2c->queue[i2c->queue_head];
+    int8_t result = i2c->result;
+    i2c->queue_head = (i2c->queue_head + 1) % I2C_QUEUE_SIZE;
+    i2c->queue_count--;
+    if(i2c->queue_count > 0) {
+      start_async_transfer(i2c);
+    } else {
+      // the synchronous transfers poll the bus
+      NVIC_DisableIRQ(i2c->irq);
+      NVIC_ClearPendingIRQ(i2c->irq);
+    }
+
+    if(done.done_cb != NULL) {
+      done.done_cb(i2c, result, done.arg);
+    }
+  }
+}
+
+static error_t queue_async_transfer(i2c_handle_t* i2c, I2C_TransferSeq_TypeDef seq,
+                                    i2c_transfer_done_callback_t done_cb, void* arg)
+{
+  // registered on first use, i2c_init() may be called before the scheduler is initialized
+  if(!async_done_registered) {
+    error_t err = sched_register_task_handle(&async_transfer_done, &async_done_handle);
+    assert(err == SUCCESS);
+    async_done_registered = true;
+  }
+
+  if(i2c->queue_count == I2C_QUEUE_SIZE) {
+    return ENOMEM;
+  }
+
+  i2c->queue[(i2c->queue_head + i2c->queue_count) % I2C_QUEUE_SIZE] = (i2c_transaction_t) {
+    .seq     = seq,
+    .done_cb = done_cb,
+    .arg     = arg
+  };
+  i2c->queue_count++;
+  if(i2c->queue_count == 1) {
+    start_async_transfer(i2c);
+  }
+
+  return SUCCESS;
+}
+
+error_t i2c_write_async(i2c_handle_t* i2c, uint8_t to, uint8_t* payload, int length,
+                        i2c_transfer_done_callback_t done_cb, void* arg)
+{
+  return queue_async_transfer(i2c, (I2C_TransferSeq_TypeDef) {
+    .addr        = to,
+    .flags       = I2C_FLAG_WRITE,
+    .buf[0].data = payload,
+    .buf[0].len  = length,
+  }, done_cb, arg);
+}
+
+error_t i2c_read_async(i2c_handle_t* i2c, uint8_t to, uint8_t* payload, int length,
+                       i2c_transfer_done_callback_t done_cb, void* arg)
+{
+  return queue_async_transfer(i2c, (I2C_TransferSeq_TypeDef) {
+    .addr        = to,
+    .flags       = I2C_FLAG_READ,
+    .buf[0].data = payload,
+    .buf[0].len  = length,
+  }, done_cb, arg);
+}
+
+error_t i2c_write_read_async(i2c_handle_t* i2c, uint8_t to, uint8_t* payload, int length,
+                             uint8_t* receive, int receive_length,
+                             i2c_transfer_done_callback_t done_cb, void* arg)
+{
+  return queue_async_transfer(i2c, (I2C_TransferSeq_TypeDef) {
+    .addr        = to,
+    .flags       = I2C_FLAG_WRITE_READ,
+    .buf[0].data = payload,
+    .buf[0].len  = length,
+    .buf[1].data = receive,
+    .buf[1].len  = receive_length,
+  }, done_cb, arg);
+}
+
+INT_HANDLER(I2C0_IRQHandler)
+{
+  continue_async_transfer(&handle[0]);
+}
+
+INT_HANDLER(I2C1_IRQHandler)
+{
+  continue_async_transfer(&handle[1]);
+}
@@ -27,6 +27,10 @@
 #include "em_cmu.h"
 #include "em_chip.h"
 #include "platform.h"
+#include "hal_defs.h"
+
+// the priority of all the interrupts of the stack, masked by the critical sections (see hwatomic.h)
+#define INT_PRIO_STACK 1
 
 
 void __efm32lg_mcu_init()
@@ -48,6 +52,14 @@ void __efm32lg_mcu_init()
     CMU_ClockSelectSet(cmuClock_HF, cmuSelect_HFRCO);
 #endif
 
+#ifdef HAL_ATOMIC_USE_BASEPRI
+    // the interrupts left at the highest priority (0) are not masked by the critical sections, none by default
+    NVIC_SetPriorityGrouping(0); // only use preempt priorities, no subpriorities
+    NVIC_SetPriority(SysTick_IRQn, INT_PRIO_STACK);
+    for(int irq = 0; irq <= EMU_IRQn; irq++)
+        NVIC_SetPriority((IRQn_Type) irq, INT_PRIO_STACK);
+#endif
+
     uint32_t hf = CMU_ClockFreqGet(cmuClock_HF);
 }
 
@@ -0,0 +1,45 @@
+/***************************************************************************//**
+ * @file
+ * @brief DMA control data block.
+ * @version 3.20.5
+ ******************************************************************************
+ * @section License
+ * <b>(C) Copyright 2014 Silicon Labs, http://www.silabs.com</b>
+ *******************************************************************************
+ *
+ * This file is licensed under the Silabs License Agreement. See the file
+ * "Silabs_License_Agreement.txt" for details. Before using this software for
+ * any purpose, you must agree to the terms of that agreement.
+ *
+ ******************************************************************************/
+
+
+
+
+#ifndef __DMACTRL_H
+#define __DMACTRL_H
+
+/***************************************************************************//**
+ * @addtogroup Drivers
+ * @{
+ ******************************************************************************/
+
+/***************************************************************************//**
+ * @addtogroup DmaCtrl
+ * @{
+ ******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern DMA_DESCRIPTOR_TypeDef dmaControlBlock[];
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} (end group DmaCtrl) */
+/** @} (end group Drivers) */
+
+#endif /* __DMACTRL_H */
@@ -0,0 +1,63 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file ezr32lg_flash.c
+ *
+ *  \brief Internal flash driver on top of the emlib MSC
+ */
+
+#include "hwflash.h"
+#include "errors.h"
+#include "em_device.h"
+#include "em_msc.h"
+#include <string.h>
+#include <assert.h>
+
+uint32_t hw_flash_get_size()
+{
+    return FLASH_SIZE;
+}
+
+uint32_t hw_flash_get_page_size()
+{
+    return FLASH_PAGE_SIZE;
+}
+
+error_t hw_flash_erase_page(uint32_t address)
+{
+    assert(address % FLASH_PAGE_SIZE == 0 && address < FLASH_SIZE);
+    MSC_Init();
+    MSC_Status_TypeDef status = MSC_ErasePage((uint32_t*) address);
+    MSC_Deinit();
+    return status == mscReturnOk ? SUCCESS : FAIL;
+}
+
+error_t hw_flash_write(uint32_t address, const void* data, uint16_t length)
+{
+    assert(address % 4 == 0 && length % 4 == 0 && address + length <= FLASH_SIZE);
+    MSC_Init();
+    MSC_Status_TypeDef status = MSC_WriteWord((uint32_t*) address, data, length);
+    MSC_Deinit();
+    return status == mscReturnOk ? SUCCESS : FAIL;
+}
+
+void hw_flash_read(uint32_t address, void* data, uint16_t length)
+{
+    // the flash is memory mapped
+    memcpy(data, (const void*) address, length);
+}
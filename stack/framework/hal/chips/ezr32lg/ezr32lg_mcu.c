@@ -28,6 +28,8 @@
 #include "em_chip.h"
 #include "platform.h"
 
+// both priorities are masked by the critical sections with HAL_ATOMIC_USE_BASEPRI (see hwatomic.h), only the
+// interrupts of priority 0 are not, none by default
 #define INT_PRIO_HIGH 1
 #define INT_PRIO_LOW 2
 
@@ -35,11 +35,17 @@
 #include "em_emu.h"
 #include "em_int.h"
 
+#include "hwatomic.h"
 #include "hwgpio.h"
 #include "hwspi.h"
 
 #include "debug.h"
 #include "platform.h"
+#include "hal_defs.h"
+
+#ifdef HAL_SPI_USE_DMA
+#include <dmadrv.h>
+#endif
 
 #define USARTS    3 // only 1 and 2 available
 #define LOCATIONS 3 // only 1 and (2) available
@@ -58,7 +64,7 @@ typedef struct {
  .clk      = { .port = 0,         .pin =  0 }    \
 }
 
-static spi_pins_t location[USARTS][LOCATIONS] = {
+static const spi_pins_t location[USARTS][LOCATIONS] = {
   {
     // USART0
     UNDEFINED_LOCATION, // LOC0
@@ -121,7 +127,7 @@ static spi_usart_t usart[USARTS] = {
 // private implementation of handle structs
 struct spi_handle {
   spi_usart_t*        usart;
-  spi_pins_t*         pins;
+  const spi_pins_t*   pins;
   uint32_t            baudrate;
   uint8_t             databits;
   bool                msbf;
@@ -333,3 +339,121 @@ void spi_exchange_bytes(spi_slave_handle_t* slave,
     }
   }
 }
+
+void spi_exchange_batch(spi_slave_handle_t* slave, const spi_transfer_t* transfers, uint8_t count) {
+  spi_wait_exchange_done(slave);
+  spi_select(slave);
+  for(uint8_t i = 0; i < count; i++)
+    spi_exchange_bytes(slave, transfers[i].TxData, transfers[i].RxData, transfers[i].length);
+
+  spi_deselect(slave);
+}
+
+#ifdef HAL_SPI_USE_DMA
+
+// the DMA requests of the USARTs, indexed like usart[]
+static const DMADRV_PeripheralSignal_t dma_req_rx[USARTS] = {
+  dmadrvPeripheralSignal_USARTRF0_RXDATAV,
+  dmadrvPeripheralSignal_USART1_RXDATAV,
+  dmadrvPeripheralSignal_USART2_RXDATAV
+};
+static const DMADRV_PeripheralSignal_t dma_req_tx[USARTS] = {
+  dmadrvPeripheralSignal_USARTRF0_TXBL,
+  dmadrvPeripheralSignal_USART1_TXBL,
+  dmadrvPeripheralSignal_USART2_TXBL
+};
+
+static spi_slave_handle_t*          async_slave = NULL;
+static spi_exchange_done_callback_t async_done_cb;
+static uint8_t                      dma_dummy; // sent when there is no TX buffer, receives the bytes when there is no RX buffer
+static unsigned int                 dma_channel_rx;
+static unsigned int                 dma_channel_tx;
+static bool                         dma_initialized = false;
+
+// called from the DMA interrupt or from spi_wait_exchange_done(), the callback is only called by the first
+static void complete_async_exchange(void) {
+  atomic_state_t state = start_atomic_save();
+  spi_slave_handle_t* slave = async_slave;
+  async_slave = NULL;
+  end_atomic_restore(state);
+
+  if(slave != NULL && async_done_cb != NULL) {
+    async_done_cb(slave);
+  }
+}
+
+static bool dma_rx_done(unsigned int channel, unsigned int sequenceNo, void* user) {
+  complete_async_exchange();
+  return true;
+}
+
+static void init_dma(void) {
+  // DMADRV is used for allocating the channels, since the UART and ezradio drivers use it as well
+  Ecode_t e = DMADRV_Init();
+  assert(e == ECODE_EMDRV_DMADRV_OK || e == ECODE_EMDRV_DMADRV_ALREADY_INITIALIZED);
+
+  e = DMADRV_AllocateChannel(&dma_channel_rx, NULL); assert(e == ECODE_EMDRV_DMADRV_OK);
+  e = DMADRV_AllocateChannel(&dma_channel_tx, NULL); assert(e == ECODE_EMDRV_DMADRV_OK);
+
+  dma_initialized = true;
+}
+
+// the RX channel completes last, after the last byte was shifted out, so the slave can be deselected in done_cb
+void spi_exchange_bytes_async(spi_slave_handle_t* slave,
+                              uint8_t* TxData, uint8_t* RxData, size_t length,
+                              spi_exchange_done_callback_t done_cb)
+{
+  assert(async_slave == NULL);
+  assert(TxData != NULL || RxData != NULL);
+  assert(length > 0 && length <= DMADRV_MAX_XFER_COUNT);
+
+  if( ! dma_initialized ) {
+    init_dma();
+  }
+
+  USART_TypeDef* channel = slave->spi->usart->channel;
+  uint8_t idx = slave->spi->usart - usart;
+
+  async_done_cb = done_cb;
+  async_slave   = slave;
+  dma_dummy     = 0;
+
+  channel->CMD = USART_CMD_CLEARRX;
+  Ecode_t e = DMADRV_PeripheralMemory(dma_channel_rx, dma_req_rx[idx],
+                                      RxData != NULL ? RxData : &dma_dummy, (void*)&channel->RXDATA,
+                                      RxData != NULL, length, dmadrvDataSize1, dma_rx_done, NULL);
+  assert(e == ECODE_EMDRV_DMADRV_OK);
+  e = DMADRV_MemoryPeripheral(dma_channel_tx, dma_req_tx[idx],
+                              (void*)&channel->TXDATA, TxData != NULL ? TxData : &dma_dummy,
+                              TxData != NULL, length, dmadrvDataSize1, NULL, NULL);
+  assert(e == ECODE_EMDRV_DMADRV_OK);
+}
+
+void spi_wait_exchange_done(spi_slave_handle_t* slave) {
+  if( async_slave != slave ) { return; }
+
+  bool active = true;
+  while( active ) {
+    DMADRV_TransferActive(dma_channel_rx, &active);
+  }
+
+  complete_async_exchange();
+}
+
+#else
+
+// without DMA the bytes are exchanged before returning
+void spi_exchange_bytes_async(spi_slave_handle_t* slave,
+                              uint8_t* TxData, uint8_t* RxData, size_t length,
+                              spi_exchange_done_callback_t done_cb)
+{
+  spi_exchange_bytes(slave, TxData, RxData, length);
+  if(done_cb != NULL) {
+    done_cb(slave);
+  }
+}
+
+void spi_wait_exchange_done(spi_slave_handle_t* slave) {
+}
+
+#endif // HAL_SPI_USE_DMA
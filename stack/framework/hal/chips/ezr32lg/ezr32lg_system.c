@@ -61,6 +61,14 @@ void hw_enter_lowpower_mode(uint8_t mode)
     }
 }
 
+void hw_get_stack_region(uint32_t** limit, uint32_t** top)
+{
+    // the symbols of the linker script, the stack grows down from __StackTop to __StackLimit
+    extern uint32_t __StackLimit, __StackTop;
+    *limit = &__StackLimit;
+    *top = &__StackTop;
+}
+
 uint64_t hw_get_unique_id()
 {
     return SYSTEM_GetUnique();
@@ -74,9 +82,10 @@ void hw_busy_wait(int16_t microseconds)
 
     CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
     DWT->CTRL        |= 1;
-    DWT->CYCCNT       = 0;
 
-    while (DWT->CYCCNT < counter) ;
+    // the counter is not reset, it also times the benchmarks of bench.h
+    uint32_t start = DWT->CYCCNT;
+    while (DWT->CYCCNT - start < counter) ;
 }
 
 void hw_reset()
@@ -28,6 +28,7 @@
 
 #include "em_cmu.h"
 #include "em_rtc.h"
+#include "em_letimer.h"
 #include "em_int.h"
 
 #include "hwtimer.h"
@@ -64,6 +65,104 @@ void startOscForRtc(uint8_t freq)
 static timer_callback_t compare_f = 0x0;
 static timer_callback_t overflow_f = 0x0;
 static bool timer_inited = false;
+
+// the timer 1 is LETIMER0, clocked from the LFA clock selected for the RTC (timer 0, which should be initialised
+// first) with the same prescaler, so both run at the same frequency. The LETIMER counts down, its value and its
+// compare are mirrored so it counts up like the RTC
+#define LETIMER_TIMER_ID 1
+#define LETIMER_TOP 0xFFFF
+
+static timer_callback_t letimer_compare_f = 0x0;
+static timer_callback_t letimer_overflow_f = 0x0;
+static bool letimer_inited = false;
+
+static error_t letimer_init(uint8_t frequency, timer_callback_t compare_callback, timer_callback_t overflow_callback)
+{
+    if(letimer_inited)
+        return EALREADY;
+    if(!timer_inited)
+        return EOFF;
+
+    start_atomic();
+        letimer_compare_f = compare_callback;
+        letimer_overflow_f = overflow_callback;
+        letimer_inited = true;
+
+        CMU_ClockEnable(cmuClock_LETIMER0, true);
+        CMU_ClockDivSet(cmuClock_LETIMER0, frequency == HWTIMER_FREQ_1MS ? cmuClkDiv_32 : cmuClkDiv_1);
+
+        LETIMER_Init_TypeDef letimerInit = LETIMER_INIT_DEFAULT;
+        letimerInit.enable = false;
+        letimerInit.comp0Top = false;   /* the counter wraps from 0 to 0xFFFF */
+        letimerInit.repMode = letimerRepeatFree;
+        LETIMER_Init(LETIMER0, &letimerInit);
+
+        LETIMER_IntDisable(LETIMER0, LETIMER_IEN_UF | LETIMER_IEN_COMP0 | LETIMER_IEN_COMP1);
+        LETIMER_IntClear(LETIMER0, LETIMER_IFC_UF | LETIMER_IFC_COMP0 | LETIMER_IFC_COMP1);
+        LETIMER_IntEnable(LETIMER0, LETIMER_IEN_UF);
+
+        NVIC_EnableIRQ(LETIMER0_IRQn);
+        LETIMER_Enable(LETIMER0, true);
+    end_atomic();
+    return SUCCESS;
+}
+
+static hwtimer_tick_t letimer_getvalue()
+{
+    if(!letimer_inited)
+        return 0;
+
+    return (hwtimer_tick_t)(LETIMER_TOP - LETIMER_CounterGet(LETIMER0));
+}
+
+static error_t letimer_schedule(hwtimer_tick_t tick)
+{
+    if(!letimer_inited)
+        return EOFF;
+
+    start_atomic();
+        LETIMER_IntDisable(LETIMER0, LETIMER_IEN_COMP1);
+        LETIMER_CompareSet(LETIMER0, 1, LETIMER_TOP - tick);
+        LETIMER_IntClear(LETIMER0, LETIMER_IFC_COMP1);
+        LETIMER_IntEnable(LETIMER0, LETIMER_IEN_COMP1);
+    end_atomic();
+    return SUCCESS;
+}
+
+static error_t letimer_cancel()
+{
+    if(!letimer_inited)
+        return EOFF;
+
+    start_atomic();
+        LETIMER_IntDisable(LETIMER0, LETIMER_IEN_COMP1);
+        LETIMER_IntClear(LETIMER0, LETIMER_IFC_COMP1);
+    end_atomic();
+    return SUCCESS;
+}
+
+static error_t letimer_counter_reset()
+{
+    if(!letimer_inited)
+        return EOFF;
+
+    start_atomic();
+        letimer_cancel();
+        // the counter restarts from 0, which reads as LETIMER_TOP until the next tick
+        LETIMER0->CMD = LETIMER_CMD_CLEAR;
+        LETIMER_IntClear(LETIMER0, LETIMER_IFC_UF);
+    end_atomic();
+    return SUCCESS;
+}
+
+static bool letimer_is_flag_pending(uint32_t flag)
+{
+    start_atomic();
+        bool is_pending = !!((LETIMER_IntGet(LETIMER0) & LETIMER0->IEN) & flag);
+    end_atomic();
+    return is_pending;
+}
+
 /**************************************************************************//**
  * @brief Enables LFACLK and selects LFXO as clock source for RTC.
  *        Sets up the RTC to count at 1024 Hz.
@@ -75,6 +174,8 @@ error_t hw_timer_init(hwtimer_id_t timer_id, uint8_t frequency, timer_callback_t
 {
     if(timer_id >= HWTIMER_NUM)
     	return ESIZE;
+    if(timer_id == LETIMER_TIMER_ID)
+    	return letimer_init(frequency, compare_callback, overflow_callback);
     if(timer_inited)
     	return EALREADY;
     if(frequency != HWTIMER_FREQ_1MS && frequency != HWTIMER_FREQ_32K)
@@ -114,6 +215,8 @@ error_t hw_timer_init(hwtimer_id_t timer_id, uint8_t frequency, timer_callback_t
 
 hwtimer_tick_t hw_timer_getvalue(hwtimer_id_t timer_id)
 {
+	if(timer_id == LETIMER_TIMER_ID)
+		return letimer_getvalue();
 	if(timer_id >= HWTIMER_NUM || (!timer_inited))
 		return 0;
 	else
@@ -127,6 +230,8 @@ error_t hw_timer_schedule(hwtimer_id_t timer_id, hwtimer_tick_t tick )
 {
 	if(timer_id >= HWTIMER_NUM)
 		return ESIZE;
+	if(timer_id == LETIMER_TIMER_ID)
+		return letimer_schedule(tick);
 	if(!timer_inited)
 		return EOFF;
 
@@ -142,6 +247,8 @@ error_t hw_timer_cancel(hwtimer_id_t timer_id)
 {
 	if(timer_id >= HWTIMER_NUM)
 		return ESIZE;
+	if(timer_id == LETIMER_TIMER_ID)
+		return letimer_cancel();
 	if(!timer_inited)
 		return EOFF;
 
@@ -155,6 +262,8 @@ error_t hw_timer_counter_reset(hwtimer_id_t timer_id)
 {
 	if(timer_id >= HWTIMER_NUM)
 		return ESIZE;
+	if(timer_id == LETIMER_TIMER_ID)
+		return letimer_counter_reset();
 	if(!timer_inited)
 		return EOFF;
 
@@ -171,6 +280,8 @@ bool hw_timer_is_overflow_pending(hwtimer_id_t timer_id)
 {
     if(timer_id >= HWTIMER_NUM)
 	return false;
+    if(timer_id == LETIMER_TIMER_ID)
+	return letimer_is_flag_pending(LETIMER_IF_UF);
     start_atomic();
 	//COMP0 is used to limit thc RTC to 16 bits -> use this one to check
 	bool is_pending = !!((RTC_IntGet() & RTC->IEN) & RTC_IFS_COMP0);
@@ -181,6 +292,8 @@ bool hw_timer_is_interrupt_pending(hwtimer_id_t timer_id)
 {
     if(timer_id >= HWTIMER_NUM)
 	return false;
+    if(timer_id == LETIMER_TIMER_ID)
+	return letimer_is_flag_pending(LETIMER_IF_COMP1);
 
     start_atomic();
 	bool is_pending = !!((RTC_IntGet() & RTC->IEN) & RTC_IFS_COMP1);
@@ -208,3 +321,18 @@ INT_HANDLER(RTC_IRQHandler)
 			compare_f();
 	}
 }
+
+INT_HANDLER(LETIMER0_IRQHandler)
+{
+	uint32_t flags = (LETIMER_IntGet(LETIMER0) & LETIMER0->IEN);
+	LETIMER_IntClear(LETIMER0, LETIMER_IFC_UF | LETIMER_IFC_COMP1);
+
+	if((flags & LETIMER_IF_UF) && (letimer_overflow_f != 0x0))
+		letimer_overflow_f();
+	if((flags & LETIMER_IF_COMP1))
+	{
+		LETIMER_IntDisable(LETIMER0, LETIMER_IEN_COMP1);
+		if(letimer_compare_f != 0x0)
+			letimer_compare_f();
+	}
+}
@@ -68,7 +68,7 @@ typedef struct {
 
 // configuration of uart/location mapping to tx and rx pins
 // TODO to be completed with all documented locations
-static uart_pins_t location[UARTS][LOCATIONS] = {
+static const uart_pins_t location[UARTS][LOCATIONS] = {
   {
     // 0: UART 0
     {
@@ -155,10 +155,11 @@ struct uart_handle {
   USART_TypeDef*       channel;
   CMU_Clock_TypeDef    clock;
   uart_irq_t           irq;
-  uart_pins_t*         pins;
+  const uart_pins_t*   pins;
 #ifdef HAL_UART_USE_DMA_TX
   unsigned int         dma_channel_tx;
   DMADRV_PeripheralSignal_t dma_req_signal_tx;
+  uart_tx_done_callback_t tx_done_cb;
 #endif
 };
 
@@ -329,6 +330,73 @@ void uart_send_bytes(uart_handle_t* uart, void const *data, size_t length) {
 #endif // PLATFORM_USE_USB_CDC
 }
 
+#ifdef HAL_UART_USE_DMA_TX
+#ifdef PLATFORM_USE_USB_CDC
+#define CDC_EP_DATA_IN 0x81
+#define CDC_TX_BUFFER_SIZE 256 // the console fifo is transmitted in one bulk transfer, split up in packets by the USB stack
+
+// the USB DMA needs a word aligned buffer, the data is copied so the caller can pass any buffer
+STATIC_UBUF(cdc_tx_buffer, CDC_TX_BUFFER_SIZE);
+static uart_handle_t* cdc_tx_uart;
+
+static int cdc_tx_done(USB_Status_TypeDef status, uint32_t xferred, uint32_t remaining) {
+  uart_tx_done_callback_t tx_done_cb = cdc_tx_uart->tx_done_cb;
+  cdc_tx_uart->tx_done_cb = NULL;
+  if(tx_done_cb != NULL)
+    tx_done_cb(cdc_tx_uart);
+
+  return USB_STATUS_OK;
+}
+#else
+static bool dma_tx_done(unsigned int channel, unsigned int sequence_no, void* user_param) {
+  uart_handle_t* uart = (uart_handle_t*) user_param;
+  uart_tx_done_callback_t tx_done_cb = uart->tx_done_cb;
+  uart->tx_done_cb = NULL;
+  if(tx_done_cb != NULL)
+    tx_done_cb(uart);
+
+  return true;
+}
+#endif
+
+error_t uart_send_bytes_async(uart_handle_t* uart, void const *data, size_t length, uart_tx_done_callback_t tx_done_cb) {
+#ifdef PLATFORM_USE_USB_CDC
+  // everything queued while the previous transfer was ongoing is sent in a single transfer, instead of a write of each chunk
+  if(USBD_EpIsBusy(CDC_EP_DATA_IN))
+    return EBUSY;
+
+  assert(length <= CDC_TX_BUFFER_SIZE);
+  memcpy(cdc_tx_buffer, data, length);
+  cdc_tx_uart = uart;
+  uart->tx_done_cb = tx_done_cb;
+  if(USBD_Write(CDC_EP_DATA_IN, cdc_tx_buffer, length, &cdc_tx_done) != USB_STATUS_OK) {
+    // not connected to a host (yet), the output is dropped instead of stalling the caller
+    uart->tx_done_cb = NULL;
+    tx_done_cb(uart);
+  }
+#else
+  bool active;
+  DMADRV_TransferActive(uart->dma_channel_tx, &active);
+  if(active)
+    return EBUSY;
+
+  uart->tx_done_cb = tx_done_cb;
+  Ecode_t e = DMADRV_MemoryPeripheral(
+        uart->dma_channel_tx,
+        uart->dma_req_signal_tx,
+        (void*)&uart->channel->TXDATA,
+        (void*)data,
+        true,
+        length,
+        dmadrvDataSize1,
+        &dma_tx_done,
+        uart);
+  assert(e == ECODE_EMDRV_DMADRV_OK);
+#endif
+  return SUCCESS;
+}
+#endif // HAL_UART_USE_DMA_TX
+
 void uart_send_string(uart_handle_t* uart, const char *string) {
 	uart_send_bytes(uart, string, strnlen(string, 100));
 }
@@ -21,7 +21,8 @@
 #include <ezr32lg_pins.h>
 #include "hwgpio.h"
 
-#define PLATFORM_NUM_TIMERS 1
+// the RTC and LETIMER0, the second is used by the framework for its precise events
+#define PLATFORM_NUM_TIMERS 2
 
 /* \brief Implementation of hw_gpio_configure_pin for the EZR32WG MCU
  *
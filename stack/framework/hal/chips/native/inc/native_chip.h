@@ -0,0 +1,52 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file native_chip.h
+ *
+ *  The host side hooks of the native chip, for the programs driving the framework themselves (fuzzers,
+ *  benchmarks) instead of through scheduler_run().
+ */
+
+#ifndef __NATIVE_CHIP_H_
+#define __NATIVE_CHIP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "link_c.h"
+
+/*! \brief Jumps the virtual time to the next timer event (compare or overflow) and fires it
+ *
+ * This is how the native chip sleeps, hw_enter_lowpower_mode() calls it.
+ */
+__LINK_C void __native_timer_fire_next_event();
+
+/*! \brief Advances the virtual time by the given delay, the timer events reached meanwhile fire, as hw_busy_wait() does */
+__LINK_C void __native_timer_busy_wait(uint32_t microseconds);
+
+/*! \brief The virtual time elapsed since the timer was initialised, in ticks of the timer */
+__LINK_C uint64_t native_timer_get_elapsed_ticks();
+
+/*! \brief Set the identifier returned by hw_get_unique_id(), to run several nodes on one host */
+__LINK_C void native_set_unique_id(uint64_t id);
+
+/*! \brief Receives the bytes on the UART, the RX callback is called for each byte as by the RX interrupt */
+__LINK_C void native_uart_receive(uint8_t idx, const uint8_t* data, size_t length);
+
+#endif
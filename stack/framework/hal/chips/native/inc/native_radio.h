@@ -0,0 +1,56 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file native_radio.h
+ *
+ *  The simulated transceiver of the native chip. The frames are exchanged unencoded, the CRC included: the
+ *  upper layers see the frames as a real radio driver without hardware CRC delivers them.
+ */
+
+#ifndef __NATIVE_RADIO_H_
+#define __NATIVE_RADIO_H_
+
+#include <stdint.h>
+
+#include "hwradio.h"
+#include "link_c.h"
+
+/*! \brief Callback called with every transmitted frame, before the tx callback of the upper layer */
+typedef void (*native_radio_tx_hook_t)(hw_radio_packet_t* packet);
+
+/*! \brief Set the tx hook, 0x0 drops the transmitted frames */
+__LINK_C void native_radio_set_tx_hook(native_radio_tx_hook_t tx_hook);
+
+/*! \brief Receive a frame, as the radio does at the end of a frame on the channel it listens to
+ *
+ * Like the ISR of a radio driver this calls the rx callback of the upper layer directly.
+ *
+ * \param frame		The bytes of the frame following its length byte, background frames have no length byte
+ * \param length	The number of bytes of the frame
+ * \param rssi		The RSSI the frame was received with
+ *
+ * \return error_t	SUCCESS	if the frame was delivered to the upper layer
+ *			EOFF	if the radio is not receiving
+ *			FAIL	if the rx header filter rejected the frame or no packet buffer could be allocated
+ */
+__LINK_C error_t native_radio_receive(uint8_t const* frame, uint8_t length, int16_t rssi);
+
+/*! \brief Set the RSSI measured on the channel when no frame is received, for the CCA and the background scans */
+__LINK_C void native_radio_set_channel_rssi(int16_t rssi);
+
+#endif
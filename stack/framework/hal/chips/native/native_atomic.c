@@ -0,0 +1,51 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file native_atomic.c
+ *
+ *  The host program has no interrupts, the 'interrupts' of the native chip are raised from the main loop.
+ */
+
+#include "hwatomic.h"
+
+void start_atomic()
+{
+}
+
+void end_atomic()
+{
+}
+
+atomic_state_t start_atomic_save()
+{
+    return 0;
+}
+
+void end_atomic_restore(atomic_state_t state)
+{
+}
+
+uint32_t atomic_set_bits(volatile uint32_t* word, uint32_t bits)
+{
+    return __atomic_fetch_or(word, bits, __ATOMIC_SEQ_CST);
+}
+
+uint32_t atomic_clear_bits(volatile uint32_t* word, uint32_t bits)
+{
+    return __atomic_fetch_and(word, ~bits, __ATOMIC_SEQ_CST);
+}
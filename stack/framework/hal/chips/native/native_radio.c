@@ -0,0 +1,332 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file native_radio.c
+ *
+ *  A transceiver which is always ready: the transmissions take as long as the frames take on air, in virtual
+ *  time, and the frames are received through native_radio_receive().
+ */
+
+#include <string.h>
+
+#include "debug.h"
+#include "hwradio.h"
+#include "timer.h"
+#include "scheduler.h"
+#include "energy.h"
+#include "native_radio.h"
+
+// the channel is clear by default
+#define DEFAULT_CHANNEL_RSSI -140
+
+typedef enum
+{
+    HW_RADIO_STATE_IDLE,
+    HW_RADIO_STATE_TX,
+    HW_RADIO_STATE_RX
+} hw_radio_state_t;
+
+static alloc_packet_callback_t alloc_packet_callback;
+static release_packet_callback_t release_packet_callback;
+static rx_packet_callback_t rx_packet_callback;
+static tx_packet_callback_t tx_packet_callback;
+static rssi_valid_callback_t rssi_valid_callback;
+static cca_callback_t cca_callback;
+static int16_t cca_threshold;
+static rx_header_filter_callback_t rx_header_filter_callback;
+static native_radio_tx_hook_t tx_hook;
+
+static hw_radio_state_t current_state;
+static hw_rx_cfg_t current_rx_cfg;
+static bool should_rx_after_tx_completed = false;
+static hw_radio_packet_t* current_packet;
+static int16_t channel_rssi = DEFAULT_CHANNEL_RSSI;
+static int16_t scan_rssi = HW_RSSI_INVALID; // sampled by a background scan terminated right away, until RX or TX
+// there is no FIFO nor CRC, only the dropped frames are counted
+static hw_radio_stats_t stats;
+
+static uint32_t get_bitrate(phy_channel_class_t ch_class)
+{
+    switch(ch_class)
+    {
+        case PHY_CLASS_LO_RATE:
+            return 9600;
+        case PHY_CLASS_HI_RATE:
+            return 166667;
+        default:
+            return 55555;
+    }
+}
+
+static void report_rssi()
+{
+    // the RX callbacks may have changed meanwhile
+    if(current_state != HW_RADIO_STATE_RX || rssi_valid_callback == NULL)
+        return;
+
+    rssi_valid_callback(channel_rssi);
+}
+
+static void report_cca()
+{
+    // cancelled when the radio was used meanwhile
+    if(current_state != HW_RADIO_STATE_RX || cca_callback == NULL)
+        return;
+
+    cca_callback_t cca_cb = cca_callback;
+    cca_callback = NULL;
+    cca_cb(channel_rssi <= cca_threshold, channel_rssi);
+}
+
+static void start_rx(hw_rx_cfg_t const* rx_cfg)
+{
+    cca_callback = NULL;
+    scan_rssi = HW_RSSI_INVALID;
+    current_rx_cfg = *rx_cfg;
+    current_state = HW_RADIO_STATE_RX;
+    energy_radio_state_changed(ENERGY_RADIO_RX, 0);
+    if(rssi_valid_callback != NULL)
+        sched_post_task(&report_rssi);
+}
+
+static void transmission_completed()
+{
+    if(current_state != HW_RADIO_STATE_TX)
+        return; // the transmission was aborted by radio_set_idle()
+
+    current_state = HW_RADIO_STATE_IDLE;
+    energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
+    current_packet->tx_meta.timestamp = timer_get_counter_value();
+    if(tx_hook != NULL)
+        tx_hook(current_packet);
+
+    if(tx_packet_callback != NULL)
+        tx_packet_callback(current_packet);
+
+    if(should_rx_after_tx_completed && current_state == HW_RADIO_STATE_IDLE)
+        start_rx(&current_rx_cfg);
+}
+
+static void start_tx(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb, timer_tick_t duration)
+{
+    cca_callback = NULL;
+    scan_rssi = HW_RSSI_INVALID;
+    should_rx_after_tx_completed = current_state == HW_RADIO_STATE_RX;
+    tx_packet_callback = tx_cb;
+    current_packet = packet;
+    current_state = HW_RADIO_STATE_TX;
+    energy_radio_state_changed(ENERGY_RADIO_TX, packet->tx_meta.tx_cfg.eirp);
+    assert(timer_post_task_delay(&transmission_completed, duration) == SUCCESS);
+}
+
+static error_t radio_init(alloc_packet_callback_t alloc_packet_cb,
+                          release_packet_callback_t release_packet_cb)
+{
+    alloc_packet_callback = alloc_packet_cb;
+    release_packet_callback = release_packet_cb;
+    current_state = HW_RADIO_STATE_IDLE;
+    energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
+
+    sched_register_task(&report_rssi);
+    sched_register_task(&report_cca);
+    sched_register_task(&transmission_completed);
+    return SUCCESS;
+}
+
+static void radio_set_rx_header_filter(rx_header_filter_callback_t rx_header_filter_cb)
+{
+    rx_header_filter_callback = rx_header_filter_cb;
+}
+
+static uint8_t radio_get_capabilities()
+{
+    return 0;
+}
+
+static error_t radio_set_idle()
+{
+    if(current_state == HW_RADIO_STATE_TX)
+    {
+        // the transmission completes, without callback and without resuming the RX
+        should_rx_after_tx_completed = false;
+        tx_packet_callback = NULL;
+        return SUCCESS;
+    }
+
+    cca_callback = NULL;
+    current_state = HW_RADIO_STATE_IDLE;
+    energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
+    return SUCCESS;
+}
+
+static error_t radio_set_rx(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, rssi_valid_callback_t rssi_valid_cb)
+{
+    rx_packet_callback = rx_cb;
+    rssi_valid_callback = rssi_valid_cb;
+    if(current_state == HW_RADIO_STATE_TX)
+    {
+        // RX starts when the transmission completed
+        current_rx_cfg = *rx_cfg;
+        should_rx_after_tx_completed = true;
+        return SUCCESS;
+    }
+
+    start_rx(rx_cfg);
+    return SUCCESS;
+}
+
+static error_t radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb)
+{
+    if(current_state == HW_RADIO_STATE_TX)
+        return EBUSY;
+
+    uint32_t bitrate = get_bitrate(packet->tx_meta.tx_cfg.channel_id.channel_header.ch_class);
+    uint16_t length = packet->length + 1;
+    if(packet->tx_meta.tx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+        length *= 2;
+
+    start_tx(packet, tx_cb, ((uint64_t)length * 8 * TIMER_TICKS_PER_SEC + bitrate - 1) / bitrate);
+    return SUCCESS;
+}
+
+static error_t radio_send_background_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb,
+                                            timer_tick_t eta, uint16_t tx_duration)
+{
+    if(current_state == HW_RADIO_STATE_TX)
+        return EBUSY;
+
+    // the advertising lasts until the foreground frame, which starts at the ETA
+    start_tx(packet, tx_cb, eta);
+    return SUCCESS;
+}
+
+static error_t radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, int16_t rssi_thr)
+{
+    rx_packet_callback = rx_cb;
+    rssi_valid_callback = NULL;
+    // a background frame is only received when it is injected with native_radio_receive() before the scan ends,
+    // which it does right away without a carrier on the channel
+    if(channel_rssi <= rssi_thr)
+    {
+        current_state = HW_RADIO_STATE_IDLE;
+        energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
+        scan_rssi = channel_rssi;
+        return FAIL;
+    }
+
+    start_rx(rx_cfg);
+    return SUCCESS;
+}
+
+static error_t radio_start_background_sniff(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb,
+                                            int16_t rssi_thr, timer_tick_t period)
+{
+    // the scans are not offloaded to the radio, the upper layer schedules them itself
+    return FAIL;
+}
+
+static error_t radio_cca(hw_rx_cfg_t const* rx_cfg, int16_t rssi_thr, cca_callback_t cca_cb)
+{
+    if(current_state == HW_RADIO_STATE_TX)
+        return EBUSY;
+
+    rx_packet_callback = NULL;
+    rssi_valid_callback = NULL;
+    start_rx(rx_cfg);
+    cca_callback = cca_cb;
+    cca_threshold = rssi_thr;
+    sched_post_task(&report_cca);
+    return SUCCESS;
+}
+
+static int16_t radio_get_rssi()
+{
+    if(current_state == HW_RADIO_STATE_IDLE)
+        return scan_rssi;
+
+    return current_state == HW_RADIO_STATE_RX ? channel_rssi : HW_RSSI_INVALID;
+}
+
+error_t native_radio_receive(uint8_t const* frame, uint8_t length, int16_t rssi)
+{
+    if(current_state != HW_RADIO_STATE_RX || rx_packet_callback == NULL)
+        return EOFF;
+
+    uint8_t header[5] = { length };
+    memcpy(header + 1, frame, length < 4 ? length : 4);
+    if(current_rx_cfg.syncword_class != PHY_SYNCWORD_CLASS0 && rx_header_filter_callback != NULL
+       && !rx_header_filter_callback(header, 1 + (length < 4 ? length : 4)))
+    {
+        stats.aborted_frames++;
+        return FAIL;
+    }
+
+    hw_radio_packet_t* packet = alloc_packet_callback(length + 1);
+    if(packet == NULL)
+    {
+        stats.aborted_frames++;
+        return FAIL;
+    }
+
+    packet->length = length;
+    memcpy(packet->data + 1, frame, length);
+    packet->rx_meta.timestamp = timer_get_counter_value();
+    packet->rx_meta.rx_cfg = current_rx_cfg;
+    packet->rx_meta.rssi = rssi;
+    packet->rx_meta.lqi = 0;
+    packet->rx_meta.crc_status = HW_CRC_UNAVAILABLE;
+    packet->rx_meta.sync_offset = 0;
+    rx_packet_callback(packet);
+    return SUCCESS;
+}
+
+void native_radio_set_tx_hook(native_radio_tx_hook_t hook)
+{
+    tx_hook = hook;
+}
+
+void native_radio_set_channel_rssi(int16_t rssi)
+{
+    channel_rssi = rssi;
+}
+
+static void radio_get_stats(hw_radio_stats_t* radio_stats)
+{
+    *radio_stats = stats;
+}
+
+static void radio_clear_stats()
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+const hw_radio_t native_radio = {
+    .init = &radio_init,
+    .set_rx_header_filter = &radio_set_rx_header_filter,
+    .get_capabilities = &radio_get_capabilities,
+    .set_idle = &radio_set_idle,
+    .set_rx = &radio_set_rx,
+    .send_packet = &radio_send_packet,
+    .send_background_packet = &radio_send_background_packet,
+    .start_background_scan = &radio_start_background_scan,
+    .start_background_sniff = &radio_start_background_sniff,
+    .cca = &radio_cca,
+    .get_rssi = &radio_get_rssi,
+    .get_stats = &radio_get_stats,
+    .clear_stats = &radio_clear_stats,
+};
@@ -0,0 +1,71 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file native_system.c
+ *
+ */
+
+#include <stdlib.h>
+
+#include "hwsystem.h"
+#include "native_chip.h"
+
+static uint64_t unique_id = 0x4E41544956450001; // "NATIVE" 1
+
+void hw_enter_lowpower_mode(uint8_t mode)
+{
+    // sleeping takes no time on the host, the virtual time jumps to the next timer event
+    __native_timer_fire_next_event();
+}
+
+uint32_t hw_get_lowpower_mode_wakeup_latency(uint8_t mode)
+{
+    return 0;
+}
+
+uint64_t hw_get_unique_id()
+{
+    return unique_id;
+}
+
+void native_set_unique_id(uint64_t id)
+{
+    unique_id = id;
+}
+
+void hw_busy_wait(int16_t microseconds)
+{
+    if(microseconds > 0)
+        __native_timer_busy_wait(microseconds);
+}
+
+void hw_reset()
+{
+    // there is no program to restart, the host program ends instead
+    exit(0);
+}
+
+float hw_get_internal_temperature()
+{
+    return 20;
+}
+
+uint32_t hw_get_battery()
+{
+    return 3000;
+}
@@ -0,0 +1,188 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file native_timer.c
+ *
+ *  A 16 bit timer counting in virtual time: the counter only advances when the chip sleeps, it then jumps to
+ *  the next compare or overflow and fires it. Runs are reproducible and a second of timer events takes no
+ *  time on the host.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hwtimer.h"
+#include "native_chip.h"
+
+#define COUNTER_PERIOD ((uint32_t)UINT16_MAX + 1)
+
+static timer_callback_t compare_f = 0x0;
+static timer_callback_t overflow_f = 0x0;
+static bool timer_inited = false;
+static bool compare_scheduled = false;
+static hwtimer_tick_t compare_value;
+static hwtimer_tick_t counter;
+static uint64_t elapsed_ticks;
+static uint32_t ticks_per_sec;
+static uint64_t busy_wait_fraction; // the part of a tick busy waited for so far, in millionths of a tick
+
+error_t hw_timer_init(hwtimer_id_t timer_id, uint8_t frequency, timer_callback_t compare_callback, timer_callback_t overflow_callback)
+{
+    if(timer_id >= HWTIMER_NUM)
+        return ESIZE;
+    if(timer_inited)
+        return EALREADY;
+    if(frequency != HWTIMER_FREQ_1MS && frequency != HWTIMER_FREQ_32K)
+        return EINVAL;
+
+    compare_f = compare_callback;
+    overflow_f = overflow_callback;
+    compare_scheduled = false;
+    counter = 0;
+    elapsed_ticks = 0;
+    ticks_per_sec = frequency == HWTIMER_FREQ_1MS ? HWTIMER_TICKS_1MS : HWTIMER_TICKS_32K;
+    timer_inited = true;
+    return SUCCESS;
+}
+
+hwtimer_tick_t hw_timer_getvalue(hwtimer_id_t timer_id)
+{
+    if(timer_id >= HWTIMER_NUM || (!timer_inited))
+        return 0;
+
+    return counter;
+}
+
+error_t hw_timer_schedule(hwtimer_id_t timer_id, hwtimer_tick_t tick)
+{
+    if(timer_id >= HWTIMER_NUM)
+        return ESIZE;
+    if(!timer_inited)
+        return EOFF;
+
+    compare_value = tick;
+    compare_scheduled = true;
+    return SUCCESS;
+}
+
+error_t hw_timer_cancel(hwtimer_id_t timer_id)
+{
+    if(timer_id >= HWTIMER_NUM)
+        return ESIZE;
+    if(!timer_inited)
+        return EOFF;
+
+    compare_scheduled = false;
+    return SUCCESS;
+}
+
+error_t hw_timer_counter_reset(hwtimer_id_t timer_id)
+{
+    if(timer_id >= HWTIMER_NUM)
+        return ESIZE;
+    if(!timer_inited)
+        return EOFF;
+
+    compare_scheduled = false;
+    counter = 0;
+    return SUCCESS;
+}
+
+// the events fire as soon as the virtual time reaches them, so they are never pending
+bool hw_timer_is_overflow_pending(hwtimer_id_t timer_id)
+{
+    return false;
+}
+
+bool hw_timer_is_interrupt_pending(hwtimer_id_t timer_id)
+{
+    return false;
+}
+
+// the ticks until the next event, the compare (true) or the overflow, the overflow goes first when both coincide and the
+// compare follows it, as both interrupts are pending at once then
+static uint32_t get_next_event_delay(bool* is_compare)
+{
+    uint32_t to_overflow = COUNTER_PERIOD - counter;
+    // as with the hardware timers, a compare value equal to the counter only fires after the counter looped around
+    uint32_t to_compare = (hwtimer_tick_t)(compare_value - counter);
+    if(to_compare == 0)
+        to_compare = COUNTER_PERIOD;
+
+    *is_compare = compare_scheduled && to_compare < to_overflow;
+    return *is_compare ? to_compare : to_overflow;
+}
+
+void __native_timer_fire_next_event()
+{
+    if(!timer_inited)
+        return;
+
+    bool is_compare;
+    uint32_t delay = get_next_event_delay(&is_compare);
+    counter += delay;
+    elapsed_ticks += delay;
+    if(is_compare)
+    {
+        // the timer fires once
+        compare_scheduled = false;
+        if(compare_f)
+            compare_f();
+    }
+    else
+    {
+        bool compare_coincides = compare_scheduled && compare_value == counter;
+        if(overflow_f)
+            overflow_f();
+
+        // unless the overflow handler rescheduled or cancelled the compare
+        if(compare_coincides && compare_scheduled && compare_value == counter)
+        {
+            compare_scheduled = false;
+            if(compare_f)
+                compare_f();
+        }
+    }
+}
+
+void __native_timer_busy_wait(uint32_t microseconds)
+{
+    if(!timer_inited)
+        return;
+
+    busy_wait_fraction += (uint64_t)microseconds * ticks_per_sec;
+    uint32_t ticks = busy_wait_fraction / 1000000;
+    busy_wait_fraction %= 1000000;
+
+    // the timer interrupts are not blocked by a busy wait
+    bool is_compare;
+    uint32_t delay;
+    while((delay = get_next_event_delay(&is_compare)) <= ticks)
+    {
+        ticks -= delay;
+        __native_timer_fire_next_event();
+    }
+
+    counter += ticks;
+    elapsed_ticks += ticks;
+}
+
+uint64_t native_timer_get_elapsed_ticks()
+{
+    return elapsed_ticks;
+}
@@ -25,8 +25,8 @@
  * Currently implemented for 26 MHZ RF Xtal
  * TODO: SYNTH_LPFILTx is dependent on hardware define in platform
  *
- * TODO: PKT_RX_THRESHOLD -> IRQ when Rx fifo almost full
- * TODO: PKT_TX_THRESHOLD
+ * Frames longer than the FIFO are streamed: the RX FIFO is read on the RX FIFO almost full interrupt
+ * (PKT_RX_THRESHOLD) and the TX FIFO is refilled on the TX FIFO almost empty interrupt (PKT_TX_THRESHOLD).
  */
 
 #include "debug.h"
@@ -34,18 +34,25 @@
 
 #include "log.h"
 #include "hwradio.h"
+#include "hwatomic.h"
 #include "hwsystem.h"
 #include "hwdebug.h"
+#include "energy.h"
 #include "types.h"
 #include "si4460.h"
 #include "si4460_interface.h"
 #include "si4460_registers.h"
 #include "ezradio_cmd.h"
+#include "ezradio_prop.h"
 #include "ezradio_api_lib.h"
 #include "em_device.h"
 #include "gpiointerrupt.h"
 #include "ezradio_hal.h"
 #include "fec.h"
+#include "phy_coding.h"
+#include "ramfunc.h"
+#include "scheduler.h"
+#include "timer.h"
 
 
 #if defined(FRAMEWORK_LOG_ENABLED) && defined(FRAMEWORK_PHY_LOG_ENABLED)
@@ -59,7 +66,7 @@
 
 #define RSSI_OFFSET 64 // if this is changed also change radio register 0x20,0x4e
 
-#if DEBUG_PIN_NUM >= 2
+#if DEBUG_PIN_NUM >= 2 && !defined(FRAMEWORK_DEBUG_PROBES_ENABLED)
     #define DEBUG_TX_START() hw_debug_set(0);
     #define DEBUG_TX_END() hw_debug_clr(0);
     #define DEBUG_RX_START() hw_debug_set(1);
@@ -71,6 +78,27 @@
     #define DEBUG_RX_END()
 #endif
 
+// the period during which a background scan waits for a sync word, in timer ticks
+#define To_CLASS_LO_RATE 22 // (12(FEC encode payload) + 2 (SYNC) + 8 (Max preamble)) / 1 byte/tick
+#define To_CLASS_NORMAL_RATE 4 // (12(FEC encode payload) + 2 (SYNC) + 8 (Max preamble)) / 6 bytes/tick
+#define To_CLASS_HI_RATE 2 // (12(FEC encode payload) + 2 (SYNC) + 16 (Max preamble)) / 20 bytes/tick
+
+static const uint8_t bg_timeout[4] = {
+    To_CLASS_LO_RATE,
+    0, // RFU
+    To_CLASS_NORMAL_RATE,
+    To_CLASS_HI_RATE
+};
+
+// the 32 kHz wake up timer runs in units of 4 / 32768 s, scaled by 2^WUT_R
+#define WUT_UNITS_PER_SEC (32768 / 4)
+
+// the RSSI is latched at preamble detection, see RF_SET_PROPERTY_MODEM_RSSI_CONTROL
+#define MODEM_RSSI_CONTROL_VALUE 0x09
+
+// the RSSI is valid about 200 us after entering RX, the first tick of a delay can be a partial one
+#define RSSI_VALID_DELAY (((200 * TIMER_TICKS_PER_SEC) + 999999) / 1000000 + 1)
+
 #ifdef HAL_RADIO_USE_HW_CRC
 static bool has_hardware_crc = true;
 #else
@@ -92,9 +120,11 @@ typedef enum
 
 static alloc_packet_callback_t alloc_packet_callback;
 static release_packet_callback_t release_packet_callback;
+static rx_header_filter_callback_t rx_header_filter_callback;
 static rx_packet_callback_t rx_packet_callback;
 static tx_packet_callback_t tx_packet_callback;
 static rssi_valid_callback_t rssi_valid_callback;
+static cca_callback_t cca_callback;
 static hw_radio_state_t current_state;
 static hw_radio_packet_t* current_packet;
 static channel_id_t current_channel_id = {
@@ -109,16 +139,59 @@ static eirp_t current_eirp = 0;
 
 static bool should_rx_after_tx_completed = false;
 static uint16_t tx_fifo_data_length = 0;
+static uint16_t tx_data_length = 0;
 static uint16_t rx_fifo_data_lenght = 0;
 static uint16_t expected_data_length = 0;
+// a FEC frame is decoded per FIFO chunk while it is received, the packet buffer only holds the decoded frame
+static bool rx_fec_decoding = false;
+// background frames have no length byte, they are stored after the length field of the packet
+static uint8_t rx_data_offset = 0;
+// the frame is decoded and, without hardware CRC check, its CRC calculated as its bytes are read, see read_rx_fifo()
+static phy_decoder_t rx_decoder;
+static bool rx_crc_check = false;
+
+static bool sniff_enabled = false;
+static int16_t scan_rssi = HW_RSSI_INVALID; // sampled by a background scan terminated right away, until RX or TX
+
+/*
+ * The advertising sends the background frames one by one, each next frame is started from the packet sent
+ * interrupt of the previous one with its ETA computed from the end of the advertising period. The Si4460
+ * cannot stream frames back-to-back within a single packet like the CC1101 driver does, since the packet
+ * handler whitens the whole packet, so the transceiver turnaround separates the frames.
+ */
+static bool advertising = false;
+static uint8_t adv_payload[BACKGROUND_FRAME_LENGTH];
+static uint8_t adv_frame[16]; // fec_calculated_decoded_length(BACKGROUND_FRAME_LENGTH)
+static timer_tick_t adv_end;
+static uint16_t adv_tx_duration;
+
+// the packet handler interrupts enabled by the radio configuration, see RF_SET_PROPERTY_INT_CTL_PH_ENABLE
+#define PH_INT_ENABLE (EZRADIO_PROP_INT_CTL_PH_ENABLE_PACKET_SENT_EN_BIT | EZRADIO_PROP_INT_CTL_PH_ENABLE_PACKET_RX_EN_BIT \
+    | EZRADIO_PROP_INT_CTL_PH_ENABLE_CRC_ERROR_EN_BIT | EZRADIO_PROP_INT_CTL_PH_ENABLE_RX_FIFO_ALMOST_FULL_EN_BIT)
 
 static hw_rx_cfg_t current_rx_cfg = {0x0000, PHY_SYNCWORD_CLASS0};
 static syncword_class_t current_syncword_class = PHY_SYNCWORD_CLASS0;
+static timer_tick_t rx_sync_timestamp;
+static bool rx_sync_pending = false; // a sync word was detected, the frame is not completed or dropped yet
+
+static hw_radio_stats_t stats;
+
+// the duration of one byte on air in us per channel class, the FIFO levels beyond the thresholds are converted into
+// ISR latencies with it (see hw_radio_stats_t)
+static const uint16_t byte_duration_us[4] = { 833, 144, 144, 48 };
+// the FIFO thresholds of the radio configuration, see RF_SET_PROPERTY_PKT_TX_THRESHOLD and RF_SET_PROPERTY_PKT_RX_THRESHOLD:
+// the TX FIFO almost empty interrupt fires once this many bytes are free, the RX FIFO almost full one once this many
+// bytes are received
+#define TX_FIFO_THRESHOLD 0x30
+#define RX_FIFO_THRESHOLD 0x10
 
 static inline int16_t convert_rssi(uint8_t rssi_raw);
 static void start_rx(hw_rx_cfg_t const* rx_cfg);
 static void ezradio_int_callback();
 static void report_rssi();
+static void report_cca();
+static int16_t radio_get_rssi();
+static void advertising_terminated();
 
 //TODO validate the energy efficiency when power amplifier is disabled
 static int8_t eirp_lookup[10]     = {16.7, 12.9, 10.2, 8.05, 6.25, 3.7, 0.4, -2.95, -5.55, -15.4};
@@ -133,26 +206,28 @@ static void configure_channel(const channel_id_t* channel_id)
 {
 
 	// only change settings if channel_id changed compared to current config
-	// TODO: check if only channel number changes
+	// the coding only selects the CRC, it does not require the modem and synthesizer to be reconfigured
+	if (channel_id->channel_header.ch_coding != current_channel_id.channel_header.ch_coding)
+	{
+		if (has_hardware_crc && channel_id->channel_header.ch_coding != PHY_CODING_FEC_PN9)
+		{
+			// use HW CRC
+			ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_LEN_ADJUST_HW_CRC);
+			ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_FIELD_1_CRC_CONFIG_HW_CRC);
+			ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_FIELD_2_CRC_CONFIG_HW_CRC);
+		} else {
+			// use SW CRC
+			ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_LEN_ADJUST_SW_CRC);
+			ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_FIELD_1_CRC_CONFIG_SW_CRC);
+			ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_FIELD_2_CRC_CONFIG_SW_CRC);
+		}
+
+		current_channel_id.channel_header.ch_coding = channel_id->channel_header.ch_coding;
+	}
 
 	if((channel_id->channel_header_raw != current_channel_id.channel_header_raw))
 	{
 		DPRINT("configure_channel: %s", byte_to_binary(channel_id->channel_header_raw));
-		if (channel_id->channel_header.ch_coding != current_channel_id.channel_header.ch_coding)
-		{
-			if (has_hardware_crc && channel_id->channel_header.ch_coding != PHY_CODING_FEC_PN9)
-			{
-				// use HW CRC
-				ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_LEN_ADJUST_HW_CRC);
-				ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_FIELD_1_CRC_CONFIG_HW_CRC);
-				ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_FIELD_2_CRC_CONFIG_HW_CRC);
-			} else {
-				// use SW CRC
-				ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_LEN_ADJUST_SW_CRC);
-				ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_FIELD_1_CRC_CONFIG_SW_CRC);
-				ezradio_set_property(RADIO_CONFIG_SET_PROPERTY_PKT_FIELD_2_CRC_CONFIG_SW_CRC);
-			}
-		}
 		// TODO assert valid center freq index
 
 		memcpy(&current_channel_id, channel_id, sizeof(channel_id_t)); // cache new settings
@@ -460,16 +535,78 @@ static void configure_syncword_class(syncword_class_t syncword_class, phy_coding
 	}
 }
 
+static void stop_sniff()
+{
+	if (!sniff_enabled)
+		return;
+
+	// the RSSI threshold is only checked when sniffing, the 32 kHz oscillator is only needed by the wake up timer
+	ezradio_set_property(EZRADIO_PROP_GRP_ID_GLOBAL, 1, EZRADIO_PROP_GRP_INDEX_GLOBAL_WUT_CONFIG, 0x00);
+	ezradio_set_property(EZRADIO_PROP_GRP_ID_MODEM, 1, EZRADIO_PROP_GRP_INDEX_MODEM_RSSI_CONTROL, MODEM_RSSI_CONTROL_VALUE);
+	ezradio_set_property(EZRADIO_PROP_GRP_ID_GLOBAL, 1, EZRADIO_PROP_GRP_INDEX_GLOBAL_CLK_CFG, 0x00);
+	sniff_enabled = false;
+}
+
+static void stop_cca()
+{
+	cca_callback = NULL;
+	timer_cancel_task(&report_cca);
+}
+
+static void add_isr_latency(int16_t late_bytes)
+{
+	if (late_bytes < 0)
+		late_bytes = 0;
+
+	hw_radio_stats_add_isr_latency(&stats, late_bytes * byte_duration_us[current_channel_id.channel_header.ch_class]);
+}
+
+// the frame being received after its sync word is interrupted by another radio operation
+static void abandon_rx_frame()
+{
+	if (current_state == HW_RADIO_STATE_RX && rx_sync_pending)
+		stats.sync_without_packet++;
+
+	rx_sync_pending = false;
+}
+
 static void switch_to_idle_mode()
 {
+	abandon_rx_frame();
+	timer_cancel_task(&switch_to_idle_mode);
+	timer_cancel_task(&report_rssi);
+	stop_cca();
+	stop_sniff();
+	advertising = false;
 	if (current_state == HW_RADIO_STATE_IDLE)
 		return;
 
 	ezradio_change_state(EZRADIO_CMD_CHANGE_STATE_ARG_NEXT_STATE1_NEW_STATE_ENUM_SLEEP);
 	current_state = HW_RADIO_STATE_IDLE;
+	energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
+}
+
+static void radio_set_rx_header_filter(rx_header_filter_callback_t rx_header_filter_cb)
+{
+	rx_header_filter_callback = rx_header_filter_cb;
+}
+
+static uint8_t radio_get_capabilities()
+{
+	// the CRC which the packet handler does not generate is added with the SW coding, see get_coding_stages()
+	return HW_RADIO_CAP_CRC | HW_RADIO_CAP_CRC_BACKGROUND | HW_RADIO_CAP_CRC_FEC;
 }
 
-error_t hw_radio_init(alloc_packet_callback_t alloc_packet_cb,
+// the coding applied in SW, the packet handler whitens the frames and generates the CRC of the frames which are not FEC coded
+static uint8_t get_coding_stages(phy_coding_t ch_coding)
+{
+	if (ch_coding == PHY_CODING_FEC_PN9)
+		return PHY_STAGE_CRC | PHY_STAGE_FEC;
+
+	return has_hardware_crc ? 0 : PHY_STAGE_CRC;
+}
+
+static error_t radio_init(alloc_packet_callback_t alloc_packet_cb,
                       release_packet_callback_t release_packet_cb)
 {
 	/* EZRadio response structure union */
@@ -479,6 +616,12 @@ error_t hw_radio_init(alloc_packet_callback_t alloc_packet_cb,
 	release_packet_callback = release_packet_cb;
 
 	current_state = HW_RADIO_STATE_UNKOWN;
+	energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
+
+	sched_register_task(&switch_to_idle_mode);
+	sched_register_task(&advertising_terminated);
+	sched_register_task(&report_rssi);
+	sched_register_task(&report_cca);
 
 
 	/* Initialize EZRadio device. */
@@ -504,7 +647,10 @@ error_t hw_radio_init(alloc_packet_callback_t alloc_packet_cb,
 	DPRINT("INIT ezradioResetTRxFifo");
 	ezradioResetTRxFifo();
 
-
+	// the sync word detection interrupts in addition to the packet handler, to timestamp received frames
+	ezradio_set_property(EZRADIO_PROP_GRP_ID_INT_CTL, 3, EZRADIO_PROP_GRP_INDEX_INT_CTL_ENABLE,
+	                     EZRADIO_PROP_INT_CTL_ENABLE_PH_INT_STATUS_EN_BIT | EZRADIO_PROP_INT_CTL_ENABLE_MODEM_INT_STATUS_EN_BIT,
+	                     PH_INT_ENABLE, EZRADIO_PROP_INT_CTL_MODEM_ENABLE_SYNC_DETECT_EN_BIT);
 
 	// configure default channel, eirp and syncword
 	configure_channel(&current_channel_id);
@@ -512,9 +658,11 @@ error_t hw_radio_init(alloc_packet_callback_t alloc_packet_cb,
 	configure_syncword_class(current_rx_cfg.syncword_class, current_channel_id.channel_header.ch_coding);
 
 	switch_to_idle_mode();
+
+	return SUCCESS;
 }
 
-error_t hw_radio_set_rx(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, rssi_valid_callback_t rssi_valid_cb)
+static error_t radio_set_rx(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, rssi_valid_callback_t rssi_valid_cb)
 {
 	DPRINT("hw_radio_set_rx rx_cb %p rssi_valid_cb %p", rx_cb, rssi_valid_cb);
 	if(rx_cb != NULL)
@@ -553,43 +701,210 @@ error_t hw_radio_set_rx(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, r
 	return SUCCESS;
 }
 
-error_t hw_radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb,
+static void configure_background_rx(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb)
+{
+	if(rx_cb != NULL)
+	{
+		assert(alloc_packet_callback != NULL);
+		assert(release_packet_callback != NULL);
+	}
+
+	// We should not initiate a background scan before TX is completed
+	assert(current_state != HW_RADIO_STATE_TX);
+
+	rx_packet_callback = rx_cb;
+	rssi_valid_callback = NULL;
+	memcpy(&current_rx_cfg, rx_cfg, sizeof(hw_rx_cfg_t));
+	start_rx(rx_cfg);
+}
+
+static uint8_t rssi_to_register_value(int16_t rssi)
+{
+	// the inverse of convert_rssi()
+	int16_t value = (rssi + 70 + RSSI_OFFSET) * 2;
+	if (value < 0)
+		return 0;
+
+	return value > 0xFF ? 0xFF : value;
+}
+
+static error_t radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb,
                                                 int16_t rssi_thr)
 {
-  assert(false);
-  // TODO implement this
+	DPRINT("START BG scan @ %i", timer_get_counter_value());
+
+	configure_background_rx(rx_cfg, rx_cb);
+
+	// Fast RX termination if no carrier is detected
+	// TODO calculate/predict rssi response time and wait until valid. For now we wait 200 us.
+	hw_busy_wait(200);
+	int16_t rssi = radio_get_rssi();
+	if (rssi <= rssi_thr)
+	{
+		DPRINT("FAST RX termination RSSI %i limit %i", rssi, rssi_thr);
+		switch_to_idle_mode();
+		scan_rssi = rssi;
+		DEBUG_RX_END();
+		return FAIL;
+	}
+
+	// the device has a period of To to successfully detect the sync word
+	assert(timer_post_task_delay(&switch_to_idle_mode, bg_timeout[current_channel_id.channel_header.ch_class]) == SUCCESS);
+
+	return SUCCESS;
 }
 
-error_t hw_radio_send_background_packet(hw_radio_packet_t* packet,
-                                        tx_packet_callback_t tx_callback,
-                                        uint16_t eta, uint16_t tx_duration)
+static error_t radio_start_background_sniff(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb,
+                                        int16_t rssi_thr, timer_tick_t period)
+{
+	// the low duty cycle mode wakes up every 4 * WUT_M * 2^WUT_R / 32768 s and listens during the To of
+	// a background scan, 4 * WUT_LDC * 2^WUT_R / 32768 s
+	uint64_t wut_m = ((uint64_t)period * WUT_UNITS_PER_SEC) / TIMER_TICKS_PER_SEC;
+	uint8_t wut_r = 0;
+	while (wut_m > 0xFFFF && wut_r < EZRADIO_PROP_GLOBAL_WUT_R_WUT_R_MAX)
+	{
+		wut_m >>= 1;
+		wut_r++;
+	}
+
+	uint32_t wut_ldc = ((((uint64_t)bg_timeout[rx_cfg->channel_id.channel_header.ch_class] * WUT_UNITS_PER_SEC)
+	                    / TIMER_TICKS_PER_SEC) + (1 << wut_r) - 1) >> wut_r;
+	if (wut_ldc == 0)
+		wut_ldc = 1;
+
+	if (wut_m == 0 || wut_m > 0xFFFF || wut_ldc > 0xFF || wut_ldc >= wut_m)
+		return ESIZE;
+
+	DPRINT("START BG sniff @ %i, WUT_M %i WUT_R %i WUT_LDC %i", timer_get_counter_value(),
+	       (uint16_t)wut_m, wut_r, (uint8_t)wut_ldc);
+
+	configure_background_rx(rx_cfg, rx_cb);
+
+	// the RSSI latched at preamble detection is compared to the threshold, below it the radio sleeps again
+	ezradio_set_property(EZRADIO_PROP_GRP_ID_MODEM, 1, EZRADIO_PROP_GRP_INDEX_MODEM_RSSI_THRESH, rssi_to_register_value(rssi_thr));
+	ezradio_set_property(EZRADIO_PROP_GRP_ID_MODEM, 1, EZRADIO_PROP_GRP_INDEX_MODEM_RSSI_CONTROL,
+	                     MODEM_RSSI_CONTROL_VALUE | EZRADIO_PROP_MODEM_RSSI_CONTROL_CHECK_THRESH_AT_LATCH_BIT);
+
+	// the low duty cycle mode repeats the RX state entered by START_RX, clocked by the 32 kHz RC oscillator
+	ezradio_set_property(EZRADIO_PROP_GRP_ID_GLOBAL, 1, EZRADIO_PROP_GRP_INDEX_GLOBAL_CLK_CFG, 0x01);
+	ezradio_set_property(EZRADIO_PROP_GRP_ID_GLOBAL, 4, EZRADIO_PROP_GRP_INDEX_GLOBAL_WUT_M,
+	                     (uint8_t)(wut_m >> 8), (uint8_t)wut_m,
+	                     EZRADIO_PROP_GLOBAL_WUT_R_WUT_SLEEP_BIT | wut_r, (uint8_t)wut_ldc);
+	ezradio_set_property(EZRADIO_PROP_GRP_ID_GLOBAL, 1, EZRADIO_PROP_GRP_INDEX_GLOBAL_WUT_CONFIG,
+	                     (EZRADIO_PROP_GLOBAL_WUT_CONFIG_WUT_LDC_EN_ENUM_RX_LDC << EZRADIO_PROP_GLOBAL_WUT_CONFIG_WUT_LDC_EN_LSB)
+	                     | EZRADIO_PROP_GLOBAL_WUT_CONFIG_WUT_EN_BIT | EZRADIO_PROP_GLOBAL_WUT_CONFIG_CAL_EN_BIT);
+	sniff_enabled = true;
+
+	return SUCCESS;
+}
+
+static void send_advertising_frame()
 {
-  assert(false);
-  // TODO implement this
+	// the ETA of a frame is the time left after its end, the ETA is transmitted in Ti
+	int32_t eta = (int32_t)(adv_end - timer_get_counter_value()) - adv_tx_duration;
+	if (eta < 0)
+		eta = 0;
+
+	memcpy(adv_frame, adv_payload, BACKGROUND_FRAME_LENGTH);
+	uint16_t swap_eta = __builtin_bswap16(TIMER_TICKS_TO_TI(eta));
+	memcpy(&adv_frame[2], &swap_eta, sizeof(uint16_t));
+
+	uint8_t stages = get_coding_stages(current_channel_id.channel_header.ch_coding);
+	uint16_t data_length = phy_encode_frame(stages, adv_frame, BACKGROUND_FRAME_LENGTH);
+	if (!(stages & PHY_STAGE_CRC))
+		data_length -= 2; // generated by the packet handler
+
+	tx_data_length = data_length;
+	tx_fifo_data_length = data_length;
+	ezradioStartTx(adv_frame, ez_channel_id, false, data_length);
+}
+
+static void advertising_terminated()
+{
+	DPRINT("End of advertising @ %i", timer_get_counter_value());
+	DEBUG_TX_END();
+	switch_to_idle_mode();
+
+	if(tx_packet_callback != 0)
+	{
+		current_packet->tx_meta.timestamp = timer_get_counter_value();
+		tx_packet_callback(current_packet);
+	}
 }
 
-error_t hw_radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb)
+static error_t radio_send_background_packet(hw_radio_packet_t* packet,
+                                        tx_packet_callback_t tx_callback,
+                                        timer_tick_t eta, uint16_t tx_duration)
 {
 	// TODO error handling EINVAL, ESIZE, EOFF
 	if(current_state == HW_RADIO_STATE_TX)
 		return EBUSY;
 
-	uint8_t data_length = packet->length + 1;
+	assert(packet->length == BACKGROUND_FRAME_LENGTH);
 
-	if (packet->tx_meta.tx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
-	{
+	// a background sniff is not resumed after the transmission
+	stop_sniff();
 
-		DPRINT("Original packet: %d", data_length);
-		DPRINT_DATA(packet->data, data_length);
+	tx_packet_callback = tx_callback;
+	current_packet = packet;
+	scan_rssi = HW_RSSI_INVALID;
+	current_state = HW_RADIO_STATE_TX;
+	energy_radio_state_changed(ENERGY_RADIO_TX, packet->tx_meta.tx_cfg.eirp);
 
-		data_length = fec_encode(packet->data, data_length);
-		DPRINT("Encoded packet: %d", data_length);
-		DPRINT_DATA(packet->data, data_length);
+	configure_channel((channel_id_t*)&(packet->tx_meta.tx_cfg.channel_id));
+	configure_eirp(packet->tx_meta.tx_cfg.eirp);
+	configure_syncword_class(packet->tx_meta.tx_cfg.syncword_class, packet->tx_meta.tx_cfg.channel_id.channel_header.ch_coding);
 
-	} else {
-		if (has_hardware_crc)
-			data_length -= 2;
-	}
+	// the payload is copied so the upper layer can reuse the packet during the advertising
+	memcpy(adv_payload, packet->data + 1, BACKGROUND_FRAME_LENGTH);  // The length byte is not included in the background payload
+	adv_end = timer_get_counter_value() + eta;
+	adv_tx_duration = tx_duration;
+	advertising = true;
+
+	DEBUG_TX_START();
+	DEBUG_RX_END();
+	DPRINT("Start advertising @ %i", timer_get_counter_value());
+	send_advertising_frame();
+
+	return SUCCESS;
+}
+
+static error_t radio_cca(hw_rx_cfg_t const* rx_cfg, int16_t rssi_thr, cca_callback_t cca_cb)
+{
+	if(current_state == HW_RADIO_STATE_TX)
+		return EBUSY;
+
+	rx_packet_callback = NULL;
+	rssi_valid_callback = NULL;
+	memcpy(&current_rx_cfg, rx_cfg, sizeof(hw_rx_cfg_t));
+	start_rx(rx_cfg);
+	// the modem compares the current RSSI with the threshold continuously, the sniff sets its own threshold
+	ezradio_set_property(EZRADIO_PROP_GRP_ID_MODEM, 1, EZRADIO_PROP_GRP_INDEX_MODEM_RSSI_THRESH, rssi_to_register_value(rssi_thr));
+	cca_callback = cca_cb;
+	assert(timer_post_task_delay(&report_cca, RSSI_VALID_DELAY) == SUCCESS);
+	return SUCCESS;
+}
+
+static error_t radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb)
+{
+	// TODO error handling EINVAL, ESIZE, EOFF
+	if(current_state == HW_RADIO_STATE_TX)
+		return EBUSY;
+
+	stop_sniff();
+	stop_cca();
+
+	uint16_t data_length = packet->length + 1;
+	DPRINT("Original packet: %d", data_length);
+	DPRINT_DATA(packet->data, data_length);
+
+	uint8_t stages = get_coding_stages(packet->tx_meta.tx_cfg.channel_id.channel_header.ch_coding);
+	data_length = phy_encode_frame(stages, packet->data, data_length);
+	if (!(stages & PHY_STAGE_CRC))
+		data_length -= 2; // generated by the packet handler
+
+	DPRINT("Encoded packet: %d", data_length);
+	DPRINT_DATA(packet->data, data_length);
 
 	tx_packet_callback = tx_cb;
 
@@ -600,7 +915,9 @@ error_t hw_radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_
 		should_rx_after_tx_completed = true;
 	}
 
+	scan_rssi = HW_RSSI_INVALID;
 	current_state = HW_RADIO_STATE_TX;
+	energy_radio_state_changed(ENERGY_RADIO_TX, packet->tx_meta.tx_cfg.eirp);
 	current_packet = packet;
 
 
@@ -617,7 +934,14 @@ error_t hw_radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_
 	DEBUG_TX_START();
 	DEBUG_RX_END();
 
-	ezradioStartTx(packet, ez_channel_id, should_rx_after_tx_completed, data_length);
+	// the remainder of a frame longer than the FIFO is written from the TX FIFO almost empty interrupt
+	tx_data_length = data_length;
+	tx_fifo_data_length = data_length > EZRADIO_FIFO_SIZE ? EZRADIO_FIFO_SIZE : data_length;
+	if (tx_fifo_data_length < tx_data_length)
+		ezradio_set_property(EZRADIO_PROP_GRP_ID_INT_CTL, 1, EZRADIO_PROP_GRP_INDEX_INT_CTL_PH_ENABLE,
+		                     PH_INT_ENABLE | EZRADIO_PROP_INT_CTL_PH_ENABLE_TX_FIFO_ALMOST_EMPTY_EN_BIT);
+
+	ezradioStartTx(packet->data, ez_channel_id, should_rx_after_tx_completed, data_length);
 	return SUCCESS;
 }
 
@@ -642,8 +966,11 @@ void hw_radio_continuous_tx(hw_tx_cfg_t const* tx_cfg, bool continuous_wave){
 }
 
 
-int16_t hw_radio_get_rssi()
+static int16_t radio_get_rssi()
 {
+    if (current_state == HW_RADIO_STATE_IDLE)
+        return scan_rssi;
+
     ezradio_cmd_reply_t ezradioReply;
     ezradio_get_modem_status(0, &ezradioReply);
 
@@ -666,7 +993,7 @@ int16_t hw_radio_get_latched_rssi()
 	return convert_rssi(ezradioReply.FRR_D_READ.FRR_D_VALUE);
 }
 
-error_t hw_radio_set_idle()
+static error_t radio_set_idle()
 {
 	// if we are currently transmitting wait until TX completed before entering IDLE
 	// we return now and go into IDLE when TX is completed
@@ -686,9 +1013,33 @@ error_t hw_radio_poweroff()
 {
 	ezradio_hal_AssertShutdown();
 	current_state = HW_RADIO_STATE_OFF;
+	energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
 	return SUCCESS;
 }
 
+static void report_rssi()
+{
+	// the RX callbacks may have changed meanwhile
+	if (current_state != HW_RADIO_STATE_RX || rssi_valid_callback == NULL)
+		return;
+
+	rssi_valid_callback(radio_get_rssi());
+}
+
+// the RSSI threshold comparison of the modem decides
+static void report_cca()
+{
+	if (current_state != HW_RADIO_STATE_RX || cca_callback == NULL)
+		return;
+
+	ezradio_cmd_reply_t ezradioReply;
+	ezradio_get_modem_status(0, &ezradioReply);
+	bool above_threshold = ezradioReply.GET_MODEM_STATUS.MODEM_STATUS & EZRADIO_CMD_GET_MODEM_STATUS_REP_MODEM_STATUS_RSSI_BIT;
+	cca_callback_t cca_cb = cca_callback;
+	cca_callback = NULL;
+	cca_cb(!above_threshold, convert_rssi(ezradioReply.GET_MODEM_STATUS.CURR_RSSI));
+}
+
 static void start_rx(hw_rx_cfg_t const* rx_cfg)
 {
 	DPRINT("start_rx");
@@ -696,29 +1047,44 @@ static void start_rx(hw_rx_cfg_t const* rx_cfg)
 	if (current_state == HW_RADIO_STATE_OFF)
 		ezradio_hal_DeassertShutdown();
 
+    abandon_rx_frame();
+    stop_sniff();
+    stop_cca();
+    timer_cancel_task(&switch_to_idle_mode);
+    scan_rssi = HW_RSSI_INVALID;
     current_state = HW_RADIO_STATE_RX;
+    energy_radio_state_changed(ENERGY_RADIO_RX, 0);
 
     configure_channel(&(rx_cfg->channel_id));
     configure_syncword_class(rx_cfg->syncword_class, rx_cfg->channel_id.channel_header.ch_coding);
 
     rx_fifo_data_lenght = 0;
-    if (rx_cfg->channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+    rx_fec_decoding = false;
+    rx_data_offset = 0;
+    if (rx_cfg->syncword_class == PHY_SYNCWORD_CLASS0)
     {
-    	ezradioStartRx(ez_channel_id, false);
+    	// background frames have a fixed length
+    	if (rx_cfg->channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+    		ezradioStartRx(ez_channel_id, fec_calculated_decoded_length(BACKGROUND_FRAME_LENGTH), false);
+    	else
+    		ezradioStartRx(ez_channel_id, has_hardware_crc ? BACKGROUND_FRAME_LENGTH - 2 : BACKGROUND_FRAME_LENGTH, false);
+    }
+    else if (rx_cfg->channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+    {
+    	ezradioStartRx(ez_channel_id, 0xFF, false);
     } else {
-
-    	ezradioStartRx(ez_channel_id, true);
+    	// the packet handler ends the frame, the radio then re-enters RX right away, see ezradio_handle_end_of_packet()
+    	ezradioStartRx(ez_channel_id, 0, true);
     }
 
     DEBUG_RX_START();
 
 
+    timer_cancel_task(&report_rssi);
     if(rssi_valid_callback != 0)
     {
-      // TODO calculate/predict rssi response time and wait until valid. For now we wait 200 us.
-
-      hw_busy_wait(200);
-      rssi_valid_callback(hw_radio_get_rssi());
+      // TODO calculate/predict rssi response time
+      assert(timer_post_task_delay(&report_rssi, RSSI_VALID_DELAY) == SUCCESS);
     }
 }
 
@@ -727,6 +1093,56 @@ static inline int16_t convert_rssi(uint8_t rssi_raw)
     return ((int16_t)(rssi_raw >> 1)) - (70 + RSSI_OFFSET);
 }
 
+__HOT_RAMFUNC static void fill_tx_fifo()
+{
+	ezradio_cmd_reply_t radioReplyLocal;
+	ezradio_fifo_info(0, &radioReplyLocal);
+	DPRINT("TX FIFO Space: %d", radioReplyLocal.FIFO_INFO.TX_FIFO_SPACE);
+	add_isr_latency(radioReplyLocal.FIFO_INFO.TX_FIFO_SPACE - TX_FIFO_THRESHOLD);
+
+	uint16_t length = tx_data_length - tx_fifo_data_length;
+	if (length > radioReplyLocal.FIFO_INFO.TX_FIFO_SPACE)
+		length = radioReplyLocal.FIFO_INFO.TX_FIFO_SPACE;
+
+	ezradio_write_tx_fifo(length, &(current_packet->data[tx_fifo_data_length]));
+	tx_fifo_data_length += length;
+	DPRINT("%d added -> %d", length, tx_fifo_data_length);
+
+	if (tx_fifo_data_length == tx_data_length)
+		ezradio_set_property(EZRADIO_PROP_GRP_ID_INT_CTL, 1, EZRADIO_PROP_GRP_INDEX_INT_CTL_PH_ENABLE, PH_INT_ENABLE);
+}
+
+// starts decoding a frame of frame_length bytes (the length byte excluded) into rx_packet->data from rx_data_offset on,
+// expected_data_length bytes are read
+static void start_rx_decoding(uint8_t frame_length)
+{
+	uint8_t stages = get_coding_stages(current_rx_cfg.channel_id.channel_header.ch_coding);
+	rx_crc_check = stages & PHY_STAGE_CRC;
+	phy_decoder_init(&rx_decoder, stages, rx_packet->data + rx_data_offset, frame_length + 1 - rx_data_offset,
+	                 expected_data_length);
+}
+
+__HOT_RAMFUNC static void read_rx_fifo(uint16_t length)
+{
+	// never read beyond the frame, bytes which follow belong to a next frame
+	if (length > expected_data_length - rx_fifo_data_lenght)
+		length = expected_data_length - rx_fifo_data_lenght;
+
+	if (rx_fec_decoding)
+	{
+		uint8_t chunk[EZRADIO_FIFO_SIZE];
+		ezradio_read_rx_fifo(length, chunk);
+		phy_decoder_feed(&rx_decoder, chunk, length);
+		rx_fifo_data_lenght += length;
+	}
+	else
+	{
+		ezradio_read_rx_fifo(length, &(rx_packet->data[rx_data_offset + rx_fifo_data_lenght]));
+		rx_fifo_data_lenght += length;
+		phy_decoder_update(&rx_decoder, rx_fifo_data_lenght);
+	}
+}
+
 static void ezradio_handle_end_of_packet()
 {
 	// fill rx_meta
@@ -734,44 +1150,83 @@ static void ezradio_handle_end_of_packet()
   rx_packet->rx_meta.lqi = 0;
   rx_packet->rx_meta.rx_cfg.syncword_class = current_syncword_class;
 	memcpy(&(rx_packet->rx_meta.rx_cfg.channel_id), &current_channel_id, sizeof(channel_id_t));
-	if (has_hardware_crc && current_rx_cfg.channel_id.channel_header.ch_coding != PHY_CODING_FEC_PN9)
+	if (!rx_crc_check)
 		rx_packet->rx_meta.crc_status = HW_CRC_VALID;
 	else
-		rx_packet->rx_meta.crc_status = HW_CRC_UNAVAILABLE;
+		rx_packet->rx_meta.crc_status = phy_decoder_finish(&rx_decoder) ? HW_CRC_VALID : HW_CRC_INVALID; // complete once the frame is read
+
+	if (rx_packet->rx_meta.crc_status == HW_CRC_INVALID)
+		stats.crc_failures++;
+
+	rx_sync_pending = false;
 
 	rx_packet->rx_meta.timestamp = timer_get_counter_value();
+	rx_packet->rx_meta.sync_offset = rx_packet->rx_meta.timestamp - rx_sync_timestamp;
 	//memcpy((void*)rx_packet->rx_meta.rx_cfg, (void*)&current_rx_cfg, sizeof(hw_rx_metadata_t));
 
 	ezradio_fifo_info(EZRADIO_CMD_FIFO_INFO_ARG_FIFO_RX_BIT, NULL);
 
-	DPRINT_DATA(rx_packet->data, expected_data_length);
+	rx_fec_decoding = false;
+	DPRINT_DATA(rx_packet->data, rx_packet->length + 1);
+
+	DEBUG_RX_END();
 
-	if (current_rx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+	// a foreground frame ended by the packet handler is followed by RX on the same channel already, so frames received
+	// back-to-back, like the responses to a broadcast request, are not lost while the packet is handed over. The next
+	// frame is read into a new packet, allocated at its first FIFO interrupt.
+	bool rx_rearmed = current_state == HW_RADIO_STATE_RX && current_rx_cfg.syncword_class != PHY_SYNCWORD_CLASS0
+	                  && current_rx_cfg.channel_id.channel_header.ch_coding != PHY_CODING_FEC_PN9;
+	if (rx_rearmed)
 	{
-		fec_decode_packet(rx_packet->data, expected_data_length, expected_data_length);
-		//assert length and data[0] can only differ 1
+		rx_fifo_data_lenght = 0;
+		rx_data_offset = 0;
 	}
 
-	DEBUG_RX_END();
-
 //					if(rx_packet_callback != NULL) // TODO this can happen while doing CCA but we should not be interrupting here (disable packet handler?)
 	rx_packet_callback(rx_packet);
 //					else
 //						release_packet_callback(packet);
 
-	if(current_state == HW_RADIO_STATE_RX)
+	// a background scan or sniff ends with the received frame
+	if(current_state == HW_RADIO_STATE_RX && current_rx_cfg.syncword_class == PHY_SYNCWORD_CLASS0)
+		switch_to_idle_mode();
+	else if(current_state == HW_RADIO_STATE_RX && !rx_rearmed)
 	{
 		start_rx(&current_rx_cfg);
 	}
 }
 
-static void ezradio_int_callback()
+__HOT_RAMFUNC static void process_interrupt()
 {
 	//DPRINT("ezradio ISR");
 
+	// sampled before accessing the radio, the interrupt is the closest to the event it signals
+	timer_tick_t isr_timestamp = timer_get_counter_value();
+
 	ezradio_cmd_reply_t ezradioReply;
 	ezradio_cmd_reply_t radioReplyLocal;
 	ezradio_get_int_status(0x0, 0x0, 0x0, &ezradioReply);
+
+	if ((ezradioReply.GET_INT_STATUS.INT_PEND & EZRADIO_CMD_GET_INT_STATUS_REP_INT_PEND_MODEM_INT_PEND_BIT)
+	    && (ezradioReply.GET_INT_STATUS.MODEM_PEND & EZRADIO_CMD_GET_INT_STATUS_REP_MODEM_PEND_SYNC_DETECT_PEND_BIT))
+	{
+		// the frame of the previous sync word was not completed, the packet handler did not find a valid frame
+		if (rx_sync_pending)
+			stats.sync_without_packet++;
+
+		rx_sync_timestamp = isr_timestamp;
+		rx_sync_pending = true;
+	}
+
+	// the FIFO error does not interrupt (see RF_SET_PROPERTY_INT_CTL_CHIP_ENABLE), it is still latched in CHIP_PEND and
+	// counted at the next interrupt
+	if (ezradioReply.GET_INT_STATUS.CHIP_PEND & EZRADIO_CMD_GET_INT_STATUS_REP_CHIP_PEND_FIFO_UNDERFLOW_OVERFLOW_ERROR_PEND_BIT)
+	{
+		if (current_state == HW_RADIO_STATE_TX)
+			stats.tx_fifo_underflows++;
+		else
+			stats.rx_fifo_overflows++;
+	}
 	//ezradio_frr_a_read(3, &ezradioReply);
 
 	//DPRINT(" - INT_PEND     %s", byte_to_binary(ezradioReply.FRR_A_READ.FRR_A_VALUE));
@@ -804,33 +1259,89 @@ static void ezradio_int_callback()
 						ezradio_fifo_info(0, &radioReplyLocal);
 
 						DPRINT("RX ISR packetLength: %d", radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT);
+						if (!(ezradioReply.GET_INT_STATUS.PH_STATUS & EZRADIO_CMD_GET_INT_STATUS_REP_PH_STATUS_PACKET_RX_BIT)
+						    && (ezradioReply.GET_INT_STATUS.PH_PEND & EZRADIO_CMD_GET_INT_STATUS_REP_PH_PEND_RX_FIFO_ALMOST_FULL_PEND_BIT))
+							add_isr_latency(radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT - RX_FIFO_THRESHOLD);
 
 						if (rx_fifo_data_lenght == 0)
 						{
 							DPRINT("RX FIFO: %d", radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT);
-							uint8_t buffer[4];
-							ezradio_read_rx_fifo(4, buffer);
-							if (current_rx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+							if (current_rx_cfg.syncword_class == PHY_SYNCWORD_CLASS0)
 							{
+								// a background frame has a fixed length and no length byte, it is not filtered
+								rx_fec_decoding = (current_rx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9);
+								expected_data_length = rx_fec_decoding ? fec_calculated_decoded_length(BACKGROUND_FRAME_LENGTH) : BACKGROUND_FRAME_LENGTH;
+								if (!rx_fec_decoding && has_hardware_crc)
+									expected_data_length -= 2;
+
+								rx_packet = alloc_packet_callback(BACKGROUND_FRAME_LENGTH + 1);
+								if (rx_packet == NULL)
+								{
+									DPRINT("no buffer available, dropping RX packet");
+									stats.aborted_frames++;
+									rx_sync_pending = false;
+									switch_to_idle_mode();
+									return;
+								}
+
+								rx_packet->length = BACKGROUND_FRAME_LENGTH;
+								rx_data_offset = 1;
+								start_rx_decoding(BACKGROUND_FRAME_LENGTH);
+							}
+							else
+							{
+								uint8_t buffer[4];
+								ezradio_read_rx_fifo(4, buffer);
+
+								// the header bytes are decoded for the filter, 4 FEC encoded bytes hold 2 decoded bytes
+								uint8_t* header = buffer;
+								uint8_t header_len = 4;
 								uint8_t fec_buffer[4];
-								memcpy(fec_buffer, buffer, 4);
-								fec_decode_packet(fec_buffer, 4, 4);
-								expected_data_length = fec_calculated_decoded_length(fec_buffer[0]+1);
-								DPRINT("RX Packet Length: %d / %d", fec_buffer[0], expected_data_length);
-							} else {
-								expected_data_length = buffer[0] + 1;
+								rx_fec_decoding = (current_rx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9);
+								if (rx_fec_decoding)
+								{
+									memcpy(fec_buffer, buffer, 4);
+									fec_decode_packet(fec_buffer, 4, 4);
+									expected_data_length = fec_calculated_decoded_length(fec_buffer[0]+1);
+									DPRINT("RX Packet Length: %d / %d", fec_buffer[0], expected_data_length);
+									header = fec_buffer;
+									header_len = 2;
+								} else {
+									expected_data_length = buffer[0] + 1;
+								}
+
+								if (rx_header_filter_callback != NULL && !rx_header_filter_callback(header, header_len))
+								{
+									// restarting RX flushes the frame from the FIFO
+									DPRINT("frame filtered, dropping RX packet");
+									stats.aborted_frames++;
+									rx_sync_pending = false;
+									start_rx(&current_rx_cfg);
+									return;
+								}
+								rx_packet = alloc_packet_callback(rx_fec_decoding ? fec_buffer[0] + 1 : expected_data_length);
+								if (rx_packet == NULL)
+								{
+									// no packet buffer available, restarting RX flushes the frame from the FIFO
+									DPRINT("no buffer available, dropping RX packet");
+									stats.aborted_frames++;
+									rx_sync_pending = false;
+									start_rx(&current_rx_cfg);
+									return;
+								}
+
+								start_rx_decoding(header[0]);
+								phy_decoder_feed(&rx_decoder, buffer, 4);
+								rx_fifo_data_lenght += 4;
+								radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT-=4;
 							}
-							rx_packet = alloc_packet_callback(expected_data_length);
-							memcpy(rx_packet->data, buffer, 4);
-							rx_fifo_data_lenght += 4;
-							radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT-=4;
 						}
 
 						if (ezradioReply.GET_INT_STATUS.PH_STATUS & EZRADIO_CMD_GET_INT_STATUS_REP_PH_STATUS_PACKET_RX_BIT)
 						{
 
 							/* Read out the RX FIFO content. */
-							ezradio_read_rx_fifo(radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT, &(rx_packet->data[rx_fifo_data_lenght]));
+							read_rx_fifo(radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT);
 							//ezradio_read_rx_fifo(radioReplyLocal2.PACKET_INFO.LENGTH, packet->data);
 
 							ezradio_handle_end_of_packet();
@@ -843,8 +1354,7 @@ static void ezradio_int_callback()
 							{
 								DPRINT("RX FIFO: %d", radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT);
 								/* Read out the FIFO Count bytes of RX FIFO */
-								ezradio_read_rx_fifo(radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT, &(rx_packet->data[rx_fifo_data_lenght]));
-								rx_fifo_data_lenght += radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT;
+								read_rx_fifo(radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT);
 								//DPRINT("%d of %d bytes collected", rx_fifo_data_lenght, rx_packet->data[0]+1);
 								ezradio_fifo_info(0, &radioReplyLocal);
 
@@ -855,7 +1365,7 @@ static void ezradio_int_callback()
 								}
 							}
 
-							ezradio_int_callback();
+							process_interrupt();
 
 							return;
 						}
@@ -866,6 +1376,8 @@ static void ezradio_int_callback()
 				//} else if ( ezradioReply.FRR_A_READ.FRR_B_VALUE & EZRADIO_CMD_GET_INT_STATUS_REP_PH_STATUS_CRC_ERROR_BIT)
 				{
 					DPRINT("- PACKET_RX CRC_ERROR IRQ");
+					stats.crc_failures++;
+					rx_sync_pending = false;
 					/* Check how many bytes we received. */
 					ezradio_fifo_info(0, &radioReplyLocal);
 					DPRINT("RX ISR packetLength: %d", radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT);
@@ -876,6 +1388,13 @@ static void ezradio_int_callback()
 					if (rx_fifo_data_lenght == 0)
 					{
 						rx_packet = alloc_packet_callback(radioReplyLocal.FIFO_INFO.RX_FIFO_COUNT);
+						if (rx_packet == NULL)
+						{
+							DPRINT("no buffer available, dropping RX packet");
+							stats.aborted_frames++;
+							start_rx(&current_rx_cfg);
+							return;
+						}
 					}
 
 					/* Read out the RX FIFO content. */
@@ -912,11 +1431,26 @@ static void ezradio_int_callback()
 				//if (ezradioReply.FRR_A_READ.FRR_C_VALUE & EZRADIO_CMD_GET_INT_STATUS_REP_PH_PEND_PACKET_SENT_PEND_BIT)
 				{
 					DPRINT("PACKET_SENT IRQ");
+					if (advertising)
+					{
+						// the next frame is only sent when it ends before the foreground frame, the
+						// foreground frame is only sent at the announced ETA
+						timer_tick_t now = timer_get_counter_value();
+						if ((int32_t)(adv_end - now) >= (int32_t)adv_tx_duration)
+							send_advertising_frame();
+						else if ((int32_t)(adv_end - now) > 0)
+							assert(timer_post_task_delay(&advertising_terminated, adv_end - now) == SUCCESS);
+						else
+							advertising_terminated();
+
+						return;
+					}
+
 					DEBUG_TX_END();
 
 					if(tx_packet_callback != 0)
           {
-              current_packet->tx_meta.timestamp = timer_get_counter_value();
+              current_packet->tx_meta.timestamp = isr_timestamp;
               DPRINT_DATA(current_packet->data, current_packet->length);
               tx_packet_callback(current_packet);
           }
@@ -926,6 +1460,10 @@ static void ezradio_int_callback()
           */
           switch_to_idle_mode();
 
+				} else if (ezradioReply.GET_INT_STATUS.PH_PEND & EZRADIO_CMD_GET_INT_STATUS_REP_PH_PEND_TX_FIFO_ALMOST_EMPTY_PEND_BIT)
+				{
+					DPRINT(" - TX FIFO Almost empty IRQ ");
+					fill_tx_fifo();
 //				} else if (ezradioReply.FRR_A_READ.FRR_C_VALUE & EZRADIO_CMD_GET_INT_STATUS_REP_PH_PEND_TX_FIFO_ALMOST_EMPTY_PEND_BIT)
 //				{
 //					DPRINT(" - TX FIFO Almost empty IRQ ");
@@ -998,3 +1536,39 @@ static void ezradio_int_callback()
 
 }
 
+__HOT_RAMFUNC static void ezradio_int_callback()
+{
+	DEBUG_PROBE_SET(RADIO_ISR);
+	process_interrupt();
+	DEBUG_PROBE_CLR(RADIO_ISR);
+}
+
+static void radio_get_stats(hw_radio_stats_t* radio_stats)
+{
+	start_atomic();
+	*radio_stats = stats;
+	end_atomic();
+}
+
+static void radio_clear_stats()
+{
+	start_atomic();
+	memset(&stats, 0, sizeof(stats));
+	end_atomic();
+}
+
+const hw_radio_t si4460_radio = {
+	.init = &radio_init,
+	.set_rx_header_filter = &radio_set_rx_header_filter,
+	.get_capabilities = &radio_get_capabilities,
+	.set_idle = &radio_set_idle,
+	.set_rx = &radio_set_rx,
+	.send_packet = &radio_send_packet,
+	.send_background_packet = &radio_send_background_packet,
+	.start_background_scan = &radio_start_background_scan,
+	.start_background_sniff = &radio_start_background_sniff,
+	.cca = &radio_cca,
+	.get_rssi = &radio_get_rssi,
+	.get_stats = &radio_get_stats,
+	.clear_stats = &radio_clear_stats,
+};
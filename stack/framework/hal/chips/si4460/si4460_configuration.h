@@ -141,7 +141,7 @@
 #define RF_SET_PROPERTY_PKT_LEN_ADJUST 0x11, 0x12, 0x01, 0x0A, 0x00
 #endif
 
-#define RF_SET_PROPERTY_PKT_TX_THRESHOLD 0x11, 0x12, 0x01, 0x0B, 0x05 //0x30
+#define RF_SET_PROPERTY_PKT_TX_THRESHOLD 0x11, 0x12, 0x01, 0x0B, 0x30
 
 #define RF_SET_PROPERTY_PKT_RX_THRESHOLD 0x11, 0x12, 0x01, 0x0C, 0x10 //0x30
 
@@ -124,7 +124,12 @@ void ezradioResetTRxFifo(void)
 }
 
 
-Ecode_t ezradioStartRx(uint8_t channel, bool packet_handler)
+/*
+ * With a rx_length of 0 the packet handler finds the end of packet and checks the CRC using the length field,
+ * otherwise rx_length bytes are received without CRC check (direct RX mode, used for FEC and background frames).
+ * With rx_after the radio re-enters RX by itself after a valid packet, on the same channel.
+ */
+Ecode_t ezradioStartRx(uint8_t channel, uint8_t rx_length, bool rx_after)
 {
 	ezradio_get_int_status(0u, 0u, 0u, NULL);
 
@@ -132,27 +137,13 @@ Ecode_t ezradioStartRx(uint8_t channel, bool packet_handler)
 
 	// reset length of first field (can be corrupted by TX)
 	ezradio_set_property(0x12, 0x02, 0x0D, 0x00, 0x01);
-	if (packet_handler)
-	{
-		// packet handler mode: end of packet and CRC
-		ezradio_set_property(0x12, 0x01, 0x06, 0x02);
-		ezradio_start_rx(channel, 0u, 0u,
-				  EZRADIO_CMD_START_RX_ARG_NEXT_STATE1_RXTIMEOUT_STATE_ENUM_NOCHANGE,
-				  //EZRADIO_CMD_START_RX_ARG_NEXT_STATE2_RXVALID_STATE_ENUM_RX,
-				  EZRADIO_CMD_START_RX_ARG_NEXT_STATE2_RXVALID_STATE_ENUM_READY,
-				  //EZRADIO_CMD_START_RX_ARG_NEXT_STATE3_RXINVALID_STATE_ENUM_RX,
-				  EZRADIO_CMD_START_RX_ARG_NEXT_STATE3_RXINVALID_STATE_ENUM_READY);
-	} else {
-		// Direct RX mode - used in FEC: no end of packet, no CRC
-		ezradio_set_property(0x12, 0x01, 0x06, 0x2);
-
-		ezradio_start_rx(channel, 0u, 0xFF,
-				  EZRADIO_CMD_START_RX_ARG_NEXT_STATE1_RXTIMEOUT_STATE_ENUM_NOCHANGE,
-				  //EZRADIO_CMD_START_RX_ARG_NEXT_STATE2_RXVALID_STATE_ENUM_RX,
-				  EZRADIO_CMD_START_RX_ARG_NEXT_STATE2_RXVALID_STATE_ENUM_READY,
-				  //EZRADIO_CMD_START_RX_ARG_NEXT_STATE3_RXINVALID_STATE_ENUM_RX,
-				  EZRADIO_CMD_START_RX_ARG_NEXT_STATE3_RXINVALID_STATE_ENUM_READY);
-	}
+	ezradio_set_property(0x12, 0x01, 0x06, 0x02);
+	ezradio_start_rx(channel, 0u, rx_length,
+			  EZRADIO_CMD_START_RX_ARG_NEXT_STATE1_RXTIMEOUT_STATE_ENUM_NOCHANGE,
+			  rx_after ? EZRADIO_CMD_START_RX_ARG_NEXT_STATE2_RXVALID_STATE_ENUM_RX
+			           : EZRADIO_CMD_START_RX_ARG_NEXT_STATE2_RXVALID_STATE_ENUM_READY,
+			  //EZRADIO_CMD_START_RX_ARG_NEXT_STATE3_RXINVALID_STATE_ENUM_RX,
+			  EZRADIO_CMD_START_RX_ARG_NEXT_STATE3_RXINVALID_STATE_ENUM_READY);
 
   /* Start Receiving packet, channel 0, START immediately, Packet n bytes long */
 	//timeout: nochange
@@ -164,7 +155,11 @@ Ecode_t ezradioStartRx(uint8_t channel, bool packet_handler)
     return ECODE_OK;
 }
 
-Ecode_t ezradioStartTx(hw_radio_packet_t* packet, uint8_t channel_id, bool rx_after, uint8_t data_lenght)
+/*
+ * Only the first EZRADIO_FIFO_SIZE bytes are written to the TX FIFO, the remainder of a longer frame is
+ * streamed by the caller on the TX FIFO almost empty interrupt.
+ */
+Ecode_t ezradioStartTx(uint8_t* data, uint8_t channel_id, bool rx_after, uint16_t data_lenght)
 {
 	ezradio_cmd_reply_t ezradioReply;
 
@@ -186,28 +181,16 @@ Ecode_t ezradioStartTx(hw_radio_packet_t* packet, uint8_t channel_id, bool rx_af
 	ezradio_fifo_info(EZRADIO_CMD_FIFO_INFO_ARG_FIFO_TX_BIT, NULL);
 
 	uint16_t chunck_lenght = data_lenght;
-	if (chunck_lenght > 64) chunck_lenght = 64;
+	if (chunck_lenght > EZRADIO_FIFO_SIZE) chunck_lenght = EZRADIO_FIFO_SIZE;
 
 	/* Fill the TX fifo with data, CRC is added by HW*/
-	ezradio_write_tx_fifo(chunck_lenght, packet->data);
+	ezradio_write_tx_fifo(chunck_lenght, data);
 
 	/* Start sending packet*/
 	// RX state or idle state
 	uint8_t next_state = rx_after ? 8 << 4 : 1 << 4;
 	ezradio_start_tx(channel_id, next_state,  data_lenght);
 
-
-	while (chunck_lenght < data_lenght)
-	{
-		ezradio_fifo_info(0, &ezradioReply);
-		DPRINT("TX FIFO Space: %d", ezradioReply.FIFO_INFO.TX_FIFO_SPACE);
-		uint16_t new_length = data_lenght - chunck_lenght;
-		if (new_length > ezradioReply.FIFO_INFO.TX_FIFO_SPACE) new_length = ezradioReply.FIFO_INFO.TX_FIFO_SPACE;
-		ezradio_write_tx_fifo(new_length, &(packet->data[chunck_lenght]));
-		chunck_lenght += new_length;
-		DPRINT ("%d added -> %d", chunck_lenght, data_lenght);
-	}
-
 	return ECODE_EMDRV_EZRADIODRV_OK;
 }
 
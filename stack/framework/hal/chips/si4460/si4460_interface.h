@@ -53,12 +53,14 @@ extern "C" {
 #define ECODE_EMDRV_EZRADIODRV_TRANSMIT_FAILED          		( ECODE_EMDRV_EZRADIODRV_TRANSMIT_PLUGIN_BASE | 0x00000001 )   ///< Unable to start transmission.
 
 
+#define EZRADIO_FIFO_SIZE 64
+
 typedef void (*ezradio_int_callback_t)();
 
 void ezradioInit(ezradio_int_callback_t cb);
 void ezradioResetTRxFifo(void);
-Ecode_t ezradioStartRx(uint8_t channel, bool packet_handler);
-Ecode_t ezradioStartTx(hw_radio_packet_t* packet, uint8_t channel_id, bool rx_after, uint8_t data_length);
+Ecode_t ezradioStartRx(uint8_t channel, uint8_t rx_length, bool rx_after);
+Ecode_t ezradioStartTx(uint8_t* data, uint8_t channel_id, bool rx_after, uint16_t data_length);
 Ecode_t ezradioStartTxUnmodelated(uint8_t channel_id);
 
 const char *byte_to_binary(uint8_t x);
@@ -30,6 +30,7 @@
 #include "platform.h"
 
 #include "types.h"
+#include "errors.h"
 #include "link_c.h"
 
 // TODO refactor: is now tied to EFM32, either make more generic or just use emlib directly
@@ -100,6 +101,37 @@ __LINK_C uint32_t adc_read_single();
  */
 __LINK_C void adc_clear_interrupt();
 
+/*! \brief Called from a task of the scheduler once the buffer given to adc_scan_start() is filled
+ * 	\param samples the buffer, holding the results of the scans one after the other
+ * 	\param count the number of samples
+ */
+typedef void (*adc_scan_done_callback_t)(uint16_t* samples, uint16_t count);
+
+/*! \brief Initialises the scan mode of the ADC, which converts several single ended inputs one after the other
+ * 	\param reference selects the reference voltage used by the ADC
+ * 	\param channels the mask of the input channels to scan, bit n selects channel n. The channels are converted in
+ * 	ascending order
+ */
+__LINK_C void adc_init_scan(ADC_Reference reference, uint8_t channels, uint32_t adc_frequency);
+
+/*! \brief Starts sampling the channels of adc_init_scan() at sample_rate scans per second
+ * 	A hardware timer triggers the scans through the PRS and the DMA moves the results to the buffer, so the CPU is
+ * 	free (or sleeping) meanwhile. Since the timer and the DMA stop in EM2 the low power mode of the scheduler is
+ * 	limited to EM1 until the sampling completed or is stopped.
+ * 	\param buffer receives the samples, it should remain valid until done_cb is called
+ * 	\param count the number of samples, a multiple of the number of channels and at most 1024
+ * 	\param sample_rate the number of scans per second
+ * 	\param done_cb called once count samples are in the buffer
+ * 	\return SUCCESS if the sampling started, EALREADY if sampling is ongoing, EINVAL if the count or the sample
+ * 	rate is not supported
+ */
+__LINK_C error_t adc_scan_start(uint16_t* buffer, uint16_t count, uint32_t sample_rate,
+                                adc_scan_done_callback_t done_cb);
+
+/*! \brief Stops the sampling started by adc_scan_start(), the callback is not called
+ */
+__LINK_C void adc_scan_stop();
+
 #endif // __ADC_H__
 
 /** @}*/
@@ -54,12 +54,35 @@
  *    }
  * \endcode
  *
+ * start_atomic_save() and end_atomic_restore() delimit a critical section as well, the state of the interrupts is
+ * returned to the caller and restored at the end of the section instead of being counted. They nest with each other
+ * and with start_atomic() and end_atomic() in any order, as long as the sections are left in the reverse order:
+ *
+ * \code{.c}
+ *    atomic_state_t state = start_atomic_save();
+ *    ...
+ *    end_atomic_restore(state);
+ * \endcode
+ *
+ * With HAL_ATOMIC_USE_BASEPRI, the Cortex-M3/M4 chips only mask the interrupts of the priority of the stack by
+ * raising BASEPRI instead of disabling all the interrupts: the interrupts configured with a higher priority
+ * (a lower value, see the mcu init of the chip) keep being served during the critical sections. Such an interrupt
+ * handler is not synchronized with the critical sections, so it must not use anything of the stack and framework
+ * (scheduler, timers, queues, callbacks into the layers), only data shared with the code of the stack through
+ * single writer variables, lock free buffers, atomic_set_bits() or sched_post_handle_from_isr(). All the interrupts of the drivers in this tree use the stack, they
+ * keep the priority of the stack.
+ *
  * */
 #ifndef __HW_ATOMIC_H_
 #define __HW_ATOMIC_H_
 
+#include <stdint.h>
+
 #include "link_c.h"
 
+/*! \brief The state of the interrupts saved by start_atomic_save() */
+typedef uint32_t atomic_state_t;
+
 /*! \brief Start an atomic section
  *
  * See the documentation for this file for more information on the definition
@@ -76,6 +99,43 @@ __LINK_C void start_atomic();
  */
 __LINK_C void end_atomic();
 
+/*! \brief Start an atomic section, returning the state of the interrupts to restore at its end
+ *
+ * Unlike start_atomic() the section is not counted, so it can be entered from any context, including an
+ * interrupt handler.
+ *
+ */
+__LINK_C atomic_state_t start_atomic_save();
+
+/*! \brief End an atomic section started by start_atomic_save(), restoring the state of the interrupts
+ *
+ * \param state	the state returned by the matching start_atomic_save()
+ *
+ */
+__LINK_C void end_atomic_restore(atomic_state_t state);
+
+/*! \brief Set bits of a word atomically, with respect to the interrupts
+ *
+ * The Cortex-M3/M4 chips use exclusive accesses (LDREX/STREX) instead of a critical section, so the bits can be set
+ * from an interrupt handler of any priority, including the ones above the critical sections of HAL_ATOMIC_USE_BASEPRI.
+ * The other chips use a short critical section.
+ *
+ * \param word	the word to update
+ * \param bits	the bits to set
+ * \return the value of the word before the update
+ *
+ */
+__LINK_C uint32_t atomic_set_bits(volatile uint32_t* word, uint32_t bits);
+
+/*! \brief Clear bits of a word atomically, with respect to the interrupts, see atomic_set_bits()
+ *
+ * \param word	the word to update
+ * \param bits	the bits to clear
+ * \return the value of the word before the update
+ *
+ */
+__LINK_C uint32_t atomic_clear_bits(volatile uint32_t* word, uint32_t bits);
+
 #endif //__HW_ATOMIC_H_
 
 /** @}*/
\ No newline at end of file
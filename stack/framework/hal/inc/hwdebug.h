@@ -39,6 +39,7 @@
 #include "types.h"
 #include "link_c.h"
 #include "platform.h"
+#include "framework_defs.h"
 
 #if DEBUG_PIN_NUM > 0
     #define DEBUG_PIN_SET(pin) hw_debug_set(pin)
@@ -50,6 +51,49 @@
     #define DEBUG_PIN_TOGGLE(pin) ((void)0)
 #endif
 
+/*! \brief The probe points of the stack, to measure its timing with a logic analyzer
+ *
+ * A probe sets its debug pin when the stack enters a hot path and clears it when it leaves, with DEBUG_PROBE_SET(name)
+ * and DEBUG_PROBE_CLR(name). The probes are:
+ *
+ * - RADIO_ISR: the interrupt handlers of the radio driver
+ * - PACKET_DISASSEMBLE: packet_disassemble(), the parsing of a received frame up to the network layer
+ * - CCM: the AES-CCM encryption and decryption of a secured frame
+ * - CSMA_CA: the steps of execute_csma_ca() in the DLL
+ * - TASK: each task or deferred call run by the scheduler
+ * - SLEEP: the low power mode entered by scheduler_run()
+ *
+ * The probes are compiled out unless they are selected by the FRAMEWORK_DEBUG_PROBES cmake option, the n-th
+ * selected probe drives debug pin n. This gives the same pin assignment on each platform for a given selection,
+ * a probe beyond DEBUG_PIN_NUM is left out.
+ */
+#ifndef FRAMEWORK_DEBUG_PROBE_RADIO_ISR
+    #define FRAMEWORK_DEBUG_PROBE_RADIO_ISR 0xFF
+#endif
+#ifndef FRAMEWORK_DEBUG_PROBE_PACKET_DISASSEMBLE
+    #define FRAMEWORK_DEBUG_PROBE_PACKET_DISASSEMBLE 0xFF
+#endif
+#ifndef FRAMEWORK_DEBUG_PROBE_CCM
+    #define FRAMEWORK_DEBUG_PROBE_CCM 0xFF
+#endif
+#ifndef FRAMEWORK_DEBUG_PROBE_CSMA_CA
+    #define FRAMEWORK_DEBUG_PROBE_CSMA_CA 0xFF
+#endif
+#ifndef FRAMEWORK_DEBUG_PROBE_TASK
+    #define FRAMEWORK_DEBUG_PROBE_TASK 0xFF
+#endif
+#ifndef FRAMEWORK_DEBUG_PROBE_SLEEP
+    #define FRAMEWORK_DEBUG_PROBE_SLEEP 0xFF
+#endif
+
+#if DEBUG_PIN_NUM > 0
+    #define DEBUG_PROBE_SET(probe) do { if(FRAMEWORK_DEBUG_PROBE_##probe < DEBUG_PIN_NUM) hw_debug_set(FRAMEWORK_DEBUG_PROBE_##probe); } while(0)
+    #define DEBUG_PROBE_CLR(probe) do { if(FRAMEWORK_DEBUG_PROBE_##probe < DEBUG_PIN_NUM) hw_debug_clr(FRAMEWORK_DEBUG_PROBE_##probe); } while(0)
+#else
+    #define DEBUG_PROBE_SET(probe) ((void)0)
+    #define DEBUG_PROBE_CLR(probe) ((void)0)
+#endif
+
 /*! \brief Initialise the debug pins of the platform
  *
  *  This function initialises the debug pins of the platform. This function is NOT part of the
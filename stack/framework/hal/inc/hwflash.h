@@ -0,0 +1,56 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file hwflash.h
+ * \addtogroup flash
+ * \ingroup HAL
+ * @{
+ * \brief Internal flash API, used to persist data across reboots
+ */
+
+#ifndef __HWFLASH_H__
+#define __HWFLASH_H__
+
+#include "types.h"
+#include "link_c.h"
+
+/*! \brief The size in bytes of the internal flash, which starts at address 0 */
+__LINK_C uint32_t hw_flash_get_size();
+
+/*! \brief The size in bytes of the smallest area which can be erased at once */
+__LINK_C uint32_t hw_flash_get_page_size();
+
+/*! \brief Erase the page starting at address, which should be page aligned
+ *
+ *  The erased page reads as 0xFF. The function blocks until the erase is done (about 20 ms).
+ */
+__LINK_C error_t hw_flash_erase_page(uint32_t address);
+
+/*! \brief Write length bytes of data to the erased flash at address
+ *
+ *  Both address and length should be a multiple of 4. Bits can only be cleared, so a word can only be written once
+ *  after an erase.
+ */
+__LINK_C error_t hw_flash_write(uint32_t address, const void* data, uint16_t length);
+
+/*! \brief Read length bytes from the flash at address into data */
+__LINK_C void hw_flash_read(uint32_t address, void* data, uint16_t length);
+
+#endif // __HWFLASH_H__
+
+/** @}*/
@@ -31,6 +31,7 @@
 #define I2C_H_
 
 #include "types.h"
+#include "errors.h"
 #include "link_c.h"
 
 // expose i2c_handle with unknown internals
@@ -42,5 +43,22 @@ __LINK_C int8_t        i2c_write(i2c_handle_t* i2c,      uint8_t address, uint8_
 __LINK_C int8_t        i2c_read(i2c_handle_t* i2c,       uint8_t address, uint8_t* rx_buffer, int length);
 __LINK_C int8_t        i2c_write_read(i2c_handle_t* i2c, uint8_t address, uint8_t* tx_buffer, int lengthtx, uint8_t* rx_buffer, int lengthrx);
 
+// called once an asynchronous transfer completed, from a task of the scheduler. The result is the one the synchronous
+// functions return: 0 when the transfer succeeded, a negative code of the chip otherwise.
+typedef void (*i2c_transfer_done_callback_t)(i2c_handle_t* i2c, int8_t result, void* arg);
+
+// queue a transfer and return before it completed, the transfers of a bus are driven by its interrupt one after the
+// other, so the drivers of several sensors on a bus can queue their transfers without waiting for each other. The
+// buffers should remain valid until done_cb is called. These are not to be called from interrupt handlers, and the
+// synchronous functions cannot be used on a bus with queued transfers. Returns SUCCESS or ENOMEM when the queue of the
+// bus is full. Implemented by the EFM32 and EZR32 chips.
+__LINK_C error_t       i2c_write_async(i2c_handle_t* i2c,      uint8_t address, uint8_t* tx_buffer, int length,
+                                       i2c_transfer_done_callback_t done_cb, void* arg);
+__LINK_C error_t       i2c_read_async(i2c_handle_t* i2c,       uint8_t address, uint8_t* rx_buffer, int length,
+                                      i2c_transfer_done_callback_t done_cb, void* arg);
+__LINK_C error_t       i2c_write_read_async(i2c_handle_t* i2c, uint8_t address, uint8_t* tx_buffer, int lengthtx,
+                                            uint8_t* rx_buffer, int lengthrx,
+                                            i2c_transfer_done_callback_t done_cb, void* arg);
+
 
 #endif
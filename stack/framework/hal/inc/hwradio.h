@@ -34,6 +34,7 @@
 #include "link_c.h"
 #include "errors.h"
 #include "hal_defs.h"
+#include "platform_defs.h"
 #include "timer.h"
 
 #define HW_RSSI_INVALID 0x7FFF
@@ -89,12 +90,15 @@ typedef enum
 } phy_preamble_min_length_t;
 
 /* \brief The channel header as defined in D7AP
+ *
+ * The fields are declared as uint8_t instead of the enum types, otherwise the header takes the size of an int
+ * on the ABIs which do not use short enums.
  */
 typedef struct
 {
-    phy_coding_t ch_coding: 2; 	/**< The 'coding' field in the channel header */
-    phy_channel_class_t ch_class: 2;  	/**< The 'class' field in the channel header */
-    phy_channel_band_t ch_freq_band: 3;	/**< The frequency 'band' field in the channel header */
+    uint8_t ch_coding: 2; 	/**< The 'coding' field in the channel header, see phy_coding_t */
+    uint8_t ch_class: 2;  	/**< The 'class' field in the channel header, see phy_channel_class_t */
+    uint8_t ch_freq_band: 3;	/**< The frequency 'band' field in the channel header, see phy_channel_band_t */
     uint8_t _rfu: 1;
 } phy_channel_header_t;
 
@@ -135,6 +139,19 @@ typedef enum
     HW_CRC_UNAVAILABLE = 2
 } hw_crc_t;
 
+/** \brief The processing offloaded by the radio driver, the flags returned by hw_radio_get_capabilities()
+ *
+ */
+typedef enum
+{
+    HW_RADIO_CAP_CRC = 1 << 0,              /**< The CRC of the foreground frames which are not FEC coded is
+                                              *  generated by hw_radio_send_packet() and checked on reception */
+    HW_RADIO_CAP_CRC_BACKGROUND = 1 << 1,   /**< The CRC of the background frames is generated by
+                                              *  hw_radio_send_background_packet() */
+    HW_RADIO_CAP_CRC_FEC = 1 << 2,          /**< The CRC of the FEC coded foreground frames is generated by
+                                              *  hw_radio_send_packet() and checked on reception */
+} hw_radio_capabilities_t;
+
 /** \brief type of the 'syncword class'
  *
  */
@@ -177,21 +194,25 @@ typedef struct
 
 /** \brief The metadata attached to a received packet.
  *
+ * The fields are ordered so each field is naturally aligned without padding in between, the struct is not packed
+ * since unaligned accesses fault on Cortex-M0.
  */
 typedef struct
 {
     timer_tick_t timestamp;	/**< The clock_tick of the framework timer at which the whole frame was received. */
     hw_rx_cfg_t rx_cfg;		/**< The 'RX Configuration' used to receive the packet. */
-    uint8_t lqi;			/**< The link quality indicator (LQI) reported by the radio for the received packet*/
     int16_t rssi;			/**< The Received signal strength (RSSI) reported by the radio for the received packet. */
-    uint8_t crc_status;		/**< The crc status of the packet
+    uint16_t lqi: 7;		/**< The link quality indicator (LQI) reported by the radio for the received packet*/
+    uint16_t crc_status: 2;	/**< The crc status of the packet
                              *
                              * HW_CRC_UNAVAILABLE 	if the driver does not support hardware crc checking
                              * HW_CRC_INVALID 	if the CRC was not valid
                              * HW_CRC_VALID	if the CRC was valid
                              */
-
-// TODO optimize struct for size. This was packed but resulted in alignment issues on Cortex-M0 so removed for now.
+    uint16_t _rfu: 7;
+    uint16_t sync_offset;	/**< The clock ticks elapsed between the interrupt of the radio at the detection of the sync word
+                             *   and timestamp, 0 when the radio only interrupts at the end of the frame.
+                             */
 } hw_rx_metadata_t;
 
 /** \brief The metadata an TX settings attached to a packet ready to be transmitted / that has been 
@@ -201,8 +222,6 @@ typedef struct
 {
     timer_tick_t timestamp;	/**< The clock_tick of the framework timer at which the whole frame is transmitted. */
     hw_tx_cfg_t tx_cfg;		/**< The 'TX Configuration' used to receive the packet. */
-
-// TODO optimize struct for size. This was packed but resulted in alignment issues on Cortex-M0 so removed for now.
 } hw_tx_metadata_t;
 
 /** \brief A PHY layer packet that can be sent / received over the air using the HW radio interface.
@@ -238,9 +257,18 @@ typedef struct
             uint8_t	data[];			/**< The packet data. data[0] overlaps with the 'length' field */
         };
     };
-    // TODO optimize struct for size. This was packed but resulted in alignment issues on Cortex-M0 so removed for now.
 } hw_radio_packet_t;
 
+// the packet structs are part of every packet in the packet queue, check they do not grow by accident on any platform
+#ifndef __cplusplus
+_Static_assert(sizeof(phy_channel_header_t) == 1, "phy_channel_header_t should be 1 byte");
+_Static_assert(sizeof(channel_id_t) == 4, "channel_id_t should be 4 bytes");
+_Static_assert(sizeof(hw_rx_cfg_t) == 6 && sizeof(hw_tx_cfg_t) == 6, "hw_rx_cfg_t and hw_tx_cfg_t should be 6 bytes");
+_Static_assert(sizeof(hw_rx_metadata_t) == 16, "hw_rx_metadata_t should be 16 bytes");
+_Static_assert(sizeof(hw_tx_metadata_t) == 12, "hw_tx_metadata_t should be 12 bytes");
+_Static_assert(offsetof(hw_radio_packet_t, data) == sizeof(hw_rx_metadata_t), "the packet data should directly follow the metadata");
+#endif
+
 /** \brief A convenience MACRO that calculates the minimum size of a buffer large enough to hold a single
  * hw_radio_packet_t of the specified length
  *
@@ -274,6 +302,19 @@ typedef struct
  */
 typedef hw_radio_packet_t* (*alloc_packet_callback_t)(uint8_t length);
 
+/** \brief Type definition for the rx_header_filter callback function.
+ *
+ * This callback is called by the PHY driver from an interrupt context with the first bytes of a received
+ * foreground frame, as soon as they are available and before a packet buffer is allocated for the frame. It
+ * allows the upper layer to reject frames which are not meant for it based on their header, the PHY driver then
+ * aborts the reception of the frame without allocating a buffer for it.
+ *
+ * \param header	The first bytes of the frame, starting with the length byte
+ * \param length	The number of header bytes available, this depends on the PHY driver and the coding
+ * \return bool		true if the frame should be received, false if it should be aborted
+ */
+typedef bool (*rx_header_filter_callback_t)(uint8_t const* header, uint8_t length);
+
 /** \brief definition of the callback used by the PHY driver to 'release' control of a previously allocated 
  *	   packet buffer.
  *
@@ -338,6 +379,120 @@ typedef void (*tx_packet_callback_t)(hw_radio_packet_t* packet);
  */
 typedef void (*rssi_valid_callback_t)(int16_t cur_rssi);
 
+/** \brief Type definition for the cca callback, see hw_radio_cca()
+ *
+ * \param channel_clear	true when the radio found the energy on the channel below the threshold of the CCA
+ * \param cur_rssi		The RSSI at the time of the decision, in dBm
+ *
+ * This function is called from an interrupt context and should therefore do as little processing as possible.
+ */
+typedef void (*cca_callback_t)(bool channel_clear, int16_t cur_rssi);
+
+/** \brief The health counters of a radio driver, see hw_radio_get_stats()
+ *
+ * They tell the frames lost on the link (CRC failures, syncs on noise or collisions) from the frames lost because the
+ * MCU did not keep up with the radio (FIFO overflows and underflows, a growing ISR latency). A driver which cannot
+ * observe an event leaves its counter at 0.
+ *
+ * The ISR latency is the delay between the interrupt of the radio and the moment its handler services the FIFO. The
+ * transceivers do not timestamp their interrupts, the latency is derived from the bytes which entered (RX) or left
+ * (TX) the FIFO beyond its threshold meanwhile, so it is only sampled on the FIFO threshold interrupts, in steps of
+ * the duration of a byte on air.
+ */
+typedef struct
+{
+    uint32_t rx_fifo_overflows;     /**< The frames lost to an overflow of the RX FIFO */
+    uint32_t tx_fifo_underflows;    /**< The transmissions during which the TX FIFO ran empty */
+    uint32_t aborted_frames;        /**< The frames dropped by the driver once their header was read, since they
+                                      *  were rejected by the rx_header_filter or no packet buffer was available */
+    uint32_t sync_without_packet;   /**< The sync words detected which were not followed by a complete frame, the
+                                      *  reception was interrupted by another radio operation or an error */
+    uint32_t crc_failures;          /**< The frames received with an invalid CRC */
+    uint32_t isr_latency_count;     /**< The number of ISR latency samples */
+    uint32_t isr_latency_max;       /**< The maximum ISR latency, in us */
+    uint64_t isr_latency_total;     /**< The sum of the ISR latencies in us, the average is total / count */
+} hw_radio_stats_t;
+
+/** \brief Add an ISR latency sample to the health counters, for the radio drivers
+ *
+ * \param stats		The health counters of the driver
+ * \param latency	The ISR latency, in us
+ */
+static inline void hw_radio_stats_add_isr_latency(hw_radio_stats_t* stats, uint32_t latency)
+{
+    stats->isr_latency_count++;
+    stats->isr_latency_total += latency;
+    if(latency > stats->isr_latency_max)
+        stats->isr_latency_max = latency;
+}
+
+/** \brief The operations of a radio instance, a transceiver driven by its radio driver.
+ *
+ * The hw_radio_* functions below operate on the default radio, the first instance returned by
+ * hw_radio_get_instance(). A platform with more transceivers, for instance a gateway with a 433 MHz and a
+ * 868 MHz radio, drives the other ones through their instance. The operations have the semantics of the
+ * hw_radio_* functions with the same name. A radio driver drives a single transceiver, so the transceivers
+ * of a platform use different radio chips.
+ */
+typedef struct
+{
+    error_t (*init)(alloc_packet_callback_t p_alloc, release_packet_callback_t p_free);
+    void (*set_rx_header_filter)(rx_header_filter_callback_t rx_header_filter_cb);
+    uint8_t (*get_capabilities)();
+    error_t (*set_idle)();
+    error_t (*set_rx)(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_callback, rssi_valid_callback_t rssi_callback);
+    error_t (*send_packet)(hw_radio_packet_t* packet, tx_packet_callback_t tx_callback);
+    error_t (*send_background_packet)(hw_radio_packet_t* packet, tx_packet_callback_t tx_callback,
+                                      timer_tick_t eta, uint16_t tx_duration);
+    error_t (*start_background_scan)(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, int16_t rssi_thr);
+    error_t (*start_background_sniff)(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb,
+                                      int16_t rssi_thr, timer_tick_t period);
+    error_t (*cca)(hw_rx_cfg_t const* rx_cfg, int16_t rssi_thr, cca_callback_t cca_cb);
+    int16_t (*get_rssi)();
+    void (*get_stats)(hw_radio_stats_t* stats);
+    void (*clear_stats)();
+} hw_radio_t;
+
+#ifdef USE_CC1101
+extern const hw_radio_t cc1101_radio;
+#endif
+#ifdef USE_SI4460
+extern const hw_radio_t si4460_radio;
+#endif
+#ifdef USE_NATIVE
+extern const hw_radio_t native_radio;
+#endif
+#ifdef PLATFORM_SIM
+extern const hw_radio_t sim_radio;
+#endif
+
+/** \brief Get a radio instance of the platform.
+ *
+ * \param index			The index of the radio, 0 is the default radio
+ *
+ * \return hw_radio_t const*	The radio instance, 0x0 if the platform has fewer radios
+ */
+static inline const hw_radio_t* hw_radio_get_instance(uint8_t index)
+{
+    static const hw_radio_t* const radios[] = {
+#ifdef USE_CC1101
+        &cc1101_radio,
+#endif
+#ifdef USE_SI4460
+        &si4460_radio,
+#endif
+#ifdef USE_NATIVE
+        &native_radio,
+#endif
+#ifdef PLATFORM_SIM
+        &sim_radio,
+#endif
+        NULL
+    };
+
+    return index < sizeof(radios) / sizeof(radios[0]) ? radios[index] : NULL;
+}
+
 /** \brief Initialize the radio driver.
  *
  * After initialization, the radio is in IDLE state. The RX must be explicitly enabled by a call to
@@ -358,7 +513,31 @@ typedef void (*rssi_valid_callback_t)(int16_t cur_rssi);
  * 							EALREADY if the radio driver was already initialised
  * 							FAIL	 if the radio driver could not be initialised
  */
-__LINK_C error_t hw_radio_init(alloc_packet_callback_t p_alloc, release_packet_callback_t p_free);
+static inline error_t hw_radio_init(alloc_packet_callback_t p_alloc, release_packet_callback_t p_free)
+{
+    return hw_radio_get_instance(0)->init(p_alloc, p_free);
+}
+
+/** \brief Set the callback used to filter the received foreground frames on their first bytes
+ *
+ * \param rx_header_filter_cb	The rx_header_filter_callback_t function, 0x0 receives all frames (the default)
+ */
+static inline void hw_radio_set_rx_header_filter(rx_header_filter_callback_t rx_header_filter_cb)
+{
+    hw_radio_get_instance(0)->set_rx_header_filter(rx_header_filter_cb);
+}
+
+/** \brief Get the processing offloaded by the radio driver
+ *
+ * The upper layers do not need to perform the processing offloaded by the driver on the transmitted frames.
+ * On reception, the result of the CRC check is reported in the crc_status of the hw_rx_metadata_t.
+ *
+ * \return uint8_t	The hw_radio_capabilities_t flags supported by the radio driver
+ */
+static inline uint8_t hw_radio_get_capabilities()
+{
+    return hw_radio_get_instance(0)->get_capabilities();
+}
 
 /** \brief Set the radio in the IDLE mode.
  *
@@ -381,7 +560,10 @@ __LINK_C error_t hw_radio_init(alloc_packet_callback_t p_alloc, release_packet_c
  *			EOFF if the radio is not yet initialised.
  *
  */
-__LINK_C error_t hw_radio_set_idle();
+static inline error_t hw_radio_set_idle()
+{
+    return hw_radio_get_instance(0)->set_idle();
+}
 
 /** \brief Check whether or not the radio is in IDLE mode.
  *
@@ -435,9 +617,12 @@ __LINK_C bool hw_radio_is_idle();
  *			EINVAL if the supplied rx_cfg contains invalid parameters.
  *			EOFF if the radio is not yet initialised.
  */
-__LINK_C error_t hw_radio_set_rx(hw_rx_cfg_t const* rx_cfg,
+static inline error_t hw_radio_set_rx(hw_rx_cfg_t const* rx_cfg,
 				 rx_packet_callback_t rx_callback,
-				 rssi_valid_callback_t rssi_callback);
+				 rssi_valid_callback_t rssi_callback)
+{
+    return hw_radio_get_instance(0)->set_rx(rx_cfg, rx_callback, rssi_callback);
+}
 
 /** \brief Check whether or not the radio is in RX mode.
  *
@@ -488,8 +673,11 @@ __LINK_C bool hw_radio_is_rx();
  *			ESIZE if the packet is either too long or too small
  *			EOFF if the radio has not yet been initialised
  */
-__LINK_C error_t hw_radio_send_packet(hw_radio_packet_t* packet,
-                                      tx_packet_callback_t tx_callback);
+static inline error_t hw_radio_send_packet(hw_radio_packet_t* packet,
+                                      tx_packet_callback_t tx_callback)
+{
+    return hw_radio_get_instance(0)->send_packet(packet, tx_callback);
+}
 
 /** \brief Initiate a background frame flooding until expiration of the advertising period
  *
@@ -505,6 +693,9 @@ __LINK_C error_t hw_radio_send_packet(hw_radio_packet_t* packet,
  * to this function, but is not completed until the supplied tx_packet_callback_t function is invoked by
  * the radio driver.
  *
+ * The background payload is copied by the driver, so the packet can be reused for the foreground frame during
+ * the advertising.
+ *
  * \param packet	A pointer to the start of the packet to be transmitted
  *
  * \param tx_callback	The tx_packet_callback_t function to call whenever the advertising period is terminated
@@ -512,15 +703,22 @@ __LINK_C error_t hw_radio_send_packet(hw_radio_packet_t* packet,
  *			*interrupt* context and therefore can only do minimal processing. If this
  *			parameter is 0x0, no callback will be made.
  *
+ * \param eta		The duration of the advertising period in timer ticks
+ *
+ * \param tx_duration	The duration of a single background frame in timer ticks
+ *
  * \return error_t	SUCCESS if the packet transmission has been successfully initiated.
  *			EINVAL if the tx_cfg parameter contains invalid settings
  *			EBUSY if another TX operation is already in progress
  *			ESIZE if the packet is either too long or too small
  *			EOFF if the radio has not yet been initialised
  */
-__LINK_C error_t hw_radio_send_background_packet(hw_radio_packet_t* packet,
+static inline error_t hw_radio_send_background_packet(hw_radio_packet_t* packet,
                                         tx_packet_callback_t tx_callback,
-                                        uint16_t eta, uint16_t tx_duration); 
+                                        timer_tick_t eta, uint16_t tx_duration)
+{
+    return hw_radio_get_instance(0)->send_background_packet(packet, tx_callback, eta, tx_duration);
+}
 
 /** \brief Start a background scan.
  *
@@ -537,11 +735,68 @@ __LINK_C error_t hw_radio_send_background_packet(hw_radio_packet_t* packet,
  *                 rssi_thr gives the signal strength threshold to detect a modulated signal
  *
  * \return error_t SUCCESS if the radio was put in background scan mode
- *                 EINVAL if the supplied rx_cfg contains invalid parameters.
- *                 EOFF if the radio is not yet initialised.
+ *                 FAIL if the scan stopped immediately because the RSSI did not exceed rssi_thr. The radio
+ *                 is idle again and hw_radio_get_rssi() returns the RSSI sampled by the scan until the next
+ *                 RX or TX operation, an idle channel sample the caller can use for its noise floor estimation.
  */
-__LINK_C error_t hw_radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb,
-                                                int16_t rssi_thr);
+static inline error_t hw_radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb,
+                                                int16_t rssi_thr)
+{
+    return hw_radio_get_instance(0)->start_background_scan(rx_cfg, rx_cb, rssi_thr);
+}
+
+/** \brief Start a background scan which is repeated by the radio itself.
+ *
+ * The radio wakes up every period to perform a background scan, like hw_radio_start_background_scan() does
+ * once, without involving the MCU (for instance using the Wake-On-Radio or low duty cycle mode of the radio).
+ * The MCU is only interrupted when a background frame is received, the sniffing stops at the received frame.
+ * Any other radio operation, including hw_radio_set_idle(), stops the sniffing as well.
+ *
+ * \param rx_cfg   The 'RX Configuration' used to receive the background packet.
+ *
+ * \param rx_cb    The rx_packet_callback_t function to call when a background packet is received, from an
+ *                 *interrupt* context.
+ *
+ * \param rssi_thr The signal strength threshold to detect a modulated signal. Radios which can only apply
+ *                 a coarse threshold approximate it.
+ *
+ * \param period   The period of the background scans, in timer ticks.
+ *
+ * \return error_t SUCCESS if the radio is sniffing
+ *                 ESIZE if the radio does not support this period
+ *                 FAIL if the radio does not support sniffing, the caller should schedule the background
+ *                 scans itself using hw_radio_start_background_scan()
+ */
+static inline error_t hw_radio_start_background_sniff(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb,
+                                                int16_t rssi_thr, timer_tick_t period)
+{
+    return hw_radio_get_instance(0)->start_background_sniff(rx_cfg, rx_cb, rssi_thr, period);
+}
+
+/** \brief Assess whether the channel is clear, with the carrier sense or RSSI threshold of the radio.
+ *
+ * The radio enters RX on the channel of rx_cfg, the received packets are dropped, and the radio compares the energy
+ * on the channel with rssi_thr itself once the RSSI is valid. The radio stays in RX on the channel afterwards, so
+ * a packet sent right after a clear channel assessment is transmitted without reconfiguring the radio.
+ *
+ * Like hw_radio_set_rx(), any other radio operation before the callback cancels the assessment.
+ *
+ * \param rx_cfg   The 'RX Configuration' of the channel to assess.
+ *
+ * \param rssi_thr The channel is clear when the RSSI does not exceed this threshold.
+ *
+ * \param cca_cb   The cca_callback_t function called with the outcome, from an *interrupt* context.
+ *
+ * \return error_t SUCCESS if the assessment is started
+ *                 EBUSY if a TX operation is in progress
+ *                 ESIZE if the radio cannot apply this threshold
+ *                 FAIL if the radio does not support this, the caller should compare the RSSI reported by the
+ *                 rssi_valid callback of hw_radio_set_rx() itself
+ */
+static inline error_t hw_radio_cca(hw_rx_cfg_t const* rx_cfg, int16_t rssi_thr, cca_callback_t cca_cb)
+{
+    return hw_radio_get_instance(0)->cca(rx_cfg, rssi_thr, cca_cb);
+}
 
 /**
  * \brief This function enables us for testing purposes to configure a device with a continuous wave or GFSK wave.
@@ -589,8 +844,32 @@ bool hw_radio_rssi_valid();
  *   -# Setting the required settings by calling hw_radio_set_rx
  *   -# Waiting for the rssi_valid callback to be invoked.
  *
+ * While the radio is idle, HW_RSSI_INVALID is returned, unless the last operation was a background scan which
+ * stopped immediately: the RSSI sampled by this scan is returned then, see hw_radio_start_background_scan().
+ *
  */
-__LINK_C int16_t hw_radio_get_rssi();
+static inline int16_t hw_radio_get_rssi()
+{
+    return hw_radio_get_instance(0)->get_rssi();
+}
+
+/** \brief Get the health counters of the radio driver.
+ *
+ * The counters accumulate from the initialisation of the driver or the last hw_radio_clear_stats() on.
+ *
+ * \param stats		The hw_radio_stats_t the counters are copied to
+ */
+static inline void hw_radio_get_stats(hw_radio_stats_t* stats)
+{
+    hw_radio_get_instance(0)->get_stats(stats);
+}
+
+/** \brief Reset the health counters of the radio driver to 0.
+ */
+static inline void hw_radio_clear_stats()
+{
+    hw_radio_get_instance(0)->clear_stats();
+}
 
 #endif //__HW_RADIO_H_
 
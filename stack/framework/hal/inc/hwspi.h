@@ -65,6 +65,35 @@ __LINK_C void                spi_exchange_bytes(spi_slave_handle_t* spi,
                                                 uint8_t *TxData,
                                                 uint8_t *RxData, size_t length);
 
+// a part of a batch, NULL TxData sends zeros and NULL RxData discards the received bytes
+typedef struct {
+    uint8_t* TxData;
+    uint8_t* RxData;
+    size_t   length;
+} spi_transfer_t;
+
+// selects the slave, exchanges the transfers one after the other and deselects the slave, so a run of short accesses
+// (like the header and the value of a register) costs a single chip select sequence. This waits for an asynchronous
+// exchange of the slave first and returns once the batch is exchanged.
+__LINK_C void                spi_exchange_batch(spi_slave_handle_t* spi,
+                                                const spi_transfer_t* transfers,
+                                                uint8_t count);
+
+// called once an asynchronous exchange completed, from interrupt context or from spi_wait_exchange_done()
+typedef void (*spi_exchange_done_callback_t)(spi_slave_handle_t* spi);
+
+// starts exchanging the bytes using DMA and returns before the exchange completed, the buffers should remain valid
+// until done_cb is called. At most one exchange can be ongoing. When HAL_SPI_USE_DMA is disabled or the chip has no
+// DMA support the bytes are exchanged before returning, and done_cb is called before returning as well.
+__LINK_C void                spi_exchange_bytes_async(spi_slave_handle_t* spi,
+                                                      uint8_t *TxData,
+                                                      uint8_t *RxData, size_t length,
+                                                      spi_exchange_done_callback_t done_cb);
+
+// busy waits until the asynchronous exchange of the slave (if any) completed, polling the DMA so this can be used
+// from an interrupt handler with a higher priority than the DMA interrupt
+__LINK_C void                spi_wait_exchange_done(spi_slave_handle_t* spi);
+
 #endif
 
 /** @}*/
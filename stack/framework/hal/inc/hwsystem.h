@@ -53,6 +53,36 @@
  */
 __LINK_C void hw_enter_lowpower_mode(uint8_t mode);
 
+/*! \brief Value returned by hw_get_lowpower_mode_wakeup_latency() for low power modes
+ * that are either not supported or in which the HW timers stop running.
+ */
+#define HW_LOWPOWER_NO_TIMER_WAKEUP 0xFFFFFFFF
+
+/*! \brief Get the time needed to wake up from the given low power mode
+ *
+ * This is used by the scheduler (when FRAMEWORK_SCHEDULER_LP_MODE_DYNAMIC is enabled) to
+ * select the deepest low power mode from which the MCU can still wake up in time for the
+ * next timer event. Platforms which do not support this are only required to implement it
+ * when this option is enabled.
+ *
+ * \param mode	The low power mode, as passed to hw_enter_lowpower_mode()
+ *
+ * \return uint32_t	The wake-up latency in microseconds, or HW_LOWPOWER_NO_TIMER_WAKEUP
+ *			if the mode is not supported or the HW timers can not wake up the MCU from it.
+ */
+__LINK_C uint32_t hw_get_lowpower_mode_wakeup_latency(uint8_t mode);
+
+/*! \brief Get the region of the main stack, which the tasks and the interrupt handlers share
+ *
+ * This is used by the scheduler (when FRAMEWORK_SCHEDULER_STACK_WATERMARK_ENABLED is enabled) to paint the stack at
+ * boot and find how deep it was used. Platforms which do not support this are only required to implement it when this
+ * option is enabled.
+ *
+ * \param limit	Pointer to store the lowest address of the stack
+ * \param top		Pointer to store the address the stack grows down from
+ */
+__LINK_C void hw_get_stack_region(uint32_t** limit, uint32_t** top);
+
 /*! \brief Get a 64-bit identifier that is unique to the device on which this function is called.
  *
  * The exact manner in which this ID is generated depends on the specific platform. In general however,
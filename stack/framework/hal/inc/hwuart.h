@@ -42,6 +42,9 @@ typedef struct uart_handle uart_handle_t;
 // callback handler for received byte
 typedef void (*uart_rx_inthandler_t)(uint8_t byte);
 
+// callback handler for a completed uart_send_bytes_async(), called from interrupt context
+typedef void (*uart_tx_done_callback_t)(uart_handle_t* uart);
+
 __LINK_C uart_handle_t* uart_init(uint8_t channel, uint32_t baudrate, uint8_t pins);
 __LINK_C bool           uart_disable(uart_handle_t* uart);
 __LINK_C bool           uart_enable(uart_handle_t* uart);
@@ -50,6 +53,11 @@ __LINK_C void           uart_send_byte(uart_handle_t* uart, uint8_t data);
 __LINK_C void           uart_send_bytes(uart_handle_t* uart, void const *data, size_t length);
 __LINK_C void           uart_send_string(uart_handle_t* uart, const char *string);
 
+// starts transmitting length bytes of data without blocking, data should remain valid until tx_done_cb is called.
+// Returns EBUSY while the previous transfer is ongoing. Only available on chips which define HAL_UART_USE_DMA_TX
+__LINK_C error_t        uart_send_bytes_async(uart_handle_t* uart, void const *data, size_t length,
+                                              uart_tx_done_callback_t tx_done_cb);
+
 __LINK_C error_t        uart_rx_interrupt_enable(uart_handle_t* uart);
 __LINK_C void           uart_rx_interrupt_disable(uart_handle_t* uart);
 
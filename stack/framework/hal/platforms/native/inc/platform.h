@@ -0,0 +1,52 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PLATFORM_H_
+#define __PLATFORM_H_
+
+#include "platform_defs.h"
+
+#ifndef PLATFORM_NATIVE
+    #error Mismatch between the configured platform and the actual platform. Expected PLATFORM_NATIVE to be defined
+#endif
+
+/********************
+ * LED DEFINITIONS *
+ *******************/
+
+// the LEDs are not shown, led_on() and friends are accepted and ignored
+#define HW_NUM_LEDS 2
+
+/********************
+ * UART DEFINITIONS *
+ *******************/
+
+// the console is written to stdout
+#define CONSOLE_UART        0
+#define CONSOLE_LOCATION    0
+#define CONSOLE_BAUDRATE    115200
+
+/**************************
+ * USERBUTTON DEFINITIONS *
+ *************************/
+
+#define NUM_USERBUTTONS 	0
+
+#define PLATFORM_NUM_TIMERS 1
+
+#endif
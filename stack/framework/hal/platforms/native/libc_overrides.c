@@ -0,0 +1,35 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hwsystem.h"
+
+//debug.h redirects assert() to __assert_func, which the C library of the host does not provide. The program
+//aborts so the fuzzers and debuggers catch the failed assertion
+void __assert_func( const char *file, int line, const char *func, const char *failedexpr)
+{
+#if defined FRAMEWORK_DEBUG_ASSERT_REBOOT // make sure this parameter is used also when including assert.h instead of debug.h
+    hw_reset();
+#endif
+
+    fprintf(stderr, "assertion \"%s\" failed: file \"%s\", line %d%s%s\n", failedexpr ? failedexpr : "", file ? file : "",
+            line, func ? ", function: " : "", func ? func : "");
+    abort();
+}
@@ -0,0 +1,40 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file native_leds.c
+ *
+ */
+
+#include "hwleds.h"
+#include "platform.h"
+
+void __led_init()
+{
+}
+
+void led_on(uint8_t led_nr)
+{
+}
+
+void led_off(uint8_t led_nr)
+{
+}
+
+void led_toggle(uint8_t led_nr)
+{
+}
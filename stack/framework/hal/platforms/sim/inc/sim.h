@@ -0,0 +1,68 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file sim.h
+ *
+ *  The simulated network of the 'sim' platform: every node runs the whole stack and the nodes share one virtual
+ *  time and one radio channel. The program runs the nodes one after the other, through the node globals (see
+ *  ng.h), and jumps the virtual time to the next event when all of them are idle, so a day of traffic takes as
+ *  long as the host needs to run the stacks.
+ *
+ *  A frame is received by the nodes listening on its channel during the whole frame, when it arrives above the
+ *  sensitivity and at least the capture threshold above every other frame overlapping it on the channel. The
+ *  path loss between two nodes follows a log-distance model of their positions.
+ */
+
+#ifndef __SIM_H_
+#define __SIM_H_
+
+#include <stdint.h>
+
+#include "link_c.h"
+
+typedef struct
+{
+    uint32_t transmissions;         /*!< Frames transmitted, foreground and background */
+    uint32_t receptions;            /*!< Frames received by a listening node */
+    uint32_t collisions;            /*!< Frames lost at a listening node because of an overlapping frame */
+    uint32_t too_weak;              /*!< Frames below the sensitivity at a listening node */
+    uint64_t airtime;               /*!< Time the frames were on air, in timer ticks, as channel load */
+} sim_channel_stats_t;
+
+/*! \brief The number of nodes of the simulation */
+__LINK_C uint16_t sim_get_node_count();
+
+/*! \brief The node the code runs for, from 0 to sim_get_node_count() - 1 */
+__LINK_C uint16_t sim_get_node_id();
+
+/*! \brief The virtual time since the start of the simulation, in ticks of the framework timer */
+__LINK_C uint64_t sim_get_time();
+
+/*! \brief Place the node, the coordinates are in meters */
+__LINK_C void sim_set_node_position(uint16_t node, double x, double y);
+
+/*! \brief Set the path loss model: the loss at 1 m (in dB) and the path loss exponent */
+__LINK_C void sim_set_path_loss_model(double reference_loss, double exponent);
+
+/*! \brief Set the sensitivity of the receivers (in dBm) and the capture threshold (in dB) */
+__LINK_C void sim_set_receiver(int16_t sensitivity, uint8_t capture_threshold);
+
+/*! \brief The statistics of the channel since the start of the simulation */
+__LINK_C void sim_get_channel_stats(sim_channel_stats_t* stats);
+
+#endif
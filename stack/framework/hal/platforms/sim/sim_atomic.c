@@ -0,0 +1,73 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file sim_atomic.c
+ *
+ *  The kernel fires the events of a node between its tasks only, which is what masking the interrupts does on
+ *  the hardware. The sections are counted per node to check they are balanced and left before the next event.
+ */
+
+#include "debug.h"
+#include "hwatomic.h"
+#include "ng.h"
+#include "sim_kernel.h"
+
+static uint8_t NGDEF(nesting);
+
+void start_atomic()
+{
+    assert(NG(nesting) < UINT8_MAX);
+    NG(nesting)++;
+}
+
+void end_atomic()
+{
+    assert(NG(nesting) > 0);
+    NG(nesting)--;
+}
+
+bool sim_atomic_is_active()
+{
+    return NG(nesting) > 0;
+}
+
+atomic_state_t start_atomic_save()
+{
+    start_atomic();
+    return 0;
+}
+
+void end_atomic_restore(atomic_state_t state)
+{
+    end_atomic();
+}
+
+// the events of a node are fired between its tasks, a plain update is atomic
+uint32_t atomic_set_bits(volatile uint32_t* word, uint32_t bits)
+{
+    uint32_t value = *word;
+    *word = value | bits;
+    return value;
+}
+
+uint32_t atomic_clear_bits(volatile uint32_t* word, uint32_t bits)
+{
+    uint32_t value = *word;
+    *word = value & ~bits;
+    return value;
+}
@@ -0,0 +1,247 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file sim_channel.c
+ *
+ *  The radio channel shared by the nodes. The transmissions are kept while they are on air and while they overlap
+ *  a transmission which is on air, which are the ones a receiver can be interfered with. The channels only interfere
+ *  with themselves, the adjacent channel rejection of the receivers is not modelled.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "ng.h"
+#include "sim.h"
+#include "sim_kernel.h"
+
+// the signal measured without transmissions on the channel, in dBm
+#define NOISE_FLOOR -120
+
+typedef struct
+{
+    uint32_t id;
+    uint16_t node;
+    bool delivered;
+    uint64_t start;
+    uint64_t end;
+    hw_tx_cfg_t tx_cfg;
+    uint8_t data[256]; // the length byte and the frame
+} transmission_t;
+
+static struct
+{
+    double x;
+    double y;
+} positions[NODE_GLOBALS_MAX_NODES];
+
+static double reference_loss = 40;
+static double path_loss_exponent = 3;
+static int16_t sensitivity = -100;
+static uint8_t capture_threshold = 6;
+static sim_channel_stats_t stats;
+
+static transmission_t* transmissions = NULL;
+static size_t transmission_count;
+static size_t transmission_capacity;
+static uint32_t next_id;
+
+static bool is_same_channel(channel_id_t const* a, channel_id_t const* b)
+{
+    return a->channel_header_raw == b->channel_header_raw && a->center_freq_index == b->center_freq_index;
+}
+
+static double get_received_power(transmission_t const* transmission, uint16_t node)
+{
+    double dx = positions[transmission->node].x - positions[node].x;
+    double dy = positions[transmission->node].y - positions[node].y;
+    double distance = sqrt(dx * dx + dy * dy);
+    if(distance < 1)
+        distance = 1;
+
+    return transmission->tx_cfg.eirp - reference_loss - 10 * path_loss_exponent * log10(distance);
+}
+
+static transmission_t* find_transmission(uint32_t id)
+{
+    for(size_t i = 0; i < transmission_count; i++)
+    {
+        if(transmissions[i].id == id)
+            return &transmissions[i];
+    }
+
+    return NULL;
+}
+
+static void remove_obsolete_transmissions()
+{
+    uint64_t oldest_start = sim_get_time();
+    for(size_t i = 0; i < transmission_count; i++)
+    {
+        if(!transmissions[i].delivered && transmissions[i].start < oldest_start)
+            oldest_start = transmissions[i].start;
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < transmission_count; i++)
+    {
+        if(!transmissions[i].delivered || transmissions[i].end > oldest_start)
+            transmissions[kept++] = transmissions[i];
+    }
+
+    transmission_count = kept;
+}
+
+uint32_t sim_channel_transmit(hw_tx_cfg_t const* tx_cfg, uint8_t const* data, uint64_t duration)
+{
+    remove_obsolete_transmissions();
+    if(transmission_count == transmission_capacity)
+    {
+        transmission_capacity = transmission_capacity ? 2 * transmission_capacity : 16;
+        transmissions = realloc(transmissions, transmission_capacity * sizeof(transmission_t));
+        assert(transmissions != NULL);
+    }
+
+    transmission_t* transmission = &transmissions[transmission_count++];
+    transmission->id = next_id++;
+    transmission->node = sim_get_node_id();
+    transmission->delivered = false;
+    transmission->start = sim_get_time();
+    transmission->end = transmission->start + duration;
+    transmission->tx_cfg = *tx_cfg;
+    memcpy(transmission->data, data, data[0] + 1);
+
+    stats.transmissions++;
+    stats.airtime += duration;
+    sim_kernel_post_event(transmission->node, SIM_EVENT_TRANSMISSION_END, transmission->end, transmission->id);
+    return transmission->id;
+}
+
+void sim_channel_abort(uint32_t id)
+{
+    transmission_t* transmission = find_transmission(id);
+    if(transmission == NULL || transmission->delivered)
+        return;
+
+    stats.airtime -= transmission->end - sim_get_time();
+    transmission->end = sim_get_time();
+    transmission->delivered = true;
+}
+
+// whether a frame overlapping the transmission is received within the capture threshold of its signal
+static bool is_interfered(transmission_t const* transmission, uint16_t node, double signal)
+{
+    for(size_t i = 0; i < transmission_count; i++)
+    {
+        transmission_t const* other = &transmissions[i];
+        if(other->id == transmission->id || other->node == node || other->start >= transmission->end
+           || other->end <= transmission->start
+           || !is_same_channel(&other->tx_cfg.channel_id, &transmission->tx_cfg.channel_id))
+            continue;
+
+        if(signal - get_received_power(other, node) < capture_threshold)
+            return true;
+    }
+
+    return false;
+}
+
+void sim_channel_deliver(uint32_t id)
+{
+    transmission_t* found = find_transmission(id);
+    if(found == NULL || found->delivered)
+        return; // aborted
+
+    found->delivered = true;
+    // the receivers may transmit from their RX callback, which can move the transmissions
+    transmission_t delivered = *found;
+    transmission_t const* transmission = &delivered;
+    for(uint16_t node = 0; node < sim_get_node_count(); node++)
+    {
+        if(node == transmission->node)
+            continue;
+
+        // only the selected nodes run their tasks, these are the receivers
+        set_node_global_id(node);
+        if(!sim_radio_is_listening(&transmission->tx_cfg.channel_id, transmission->tx_cfg.syncword_class,
+                                   transmission->start))
+            continue;
+
+        double signal = get_received_power(transmission, node);
+        if(signal < sensitivity)
+        {
+            stats.too_weak++;
+            continue;
+        }
+
+        if(is_interfered(transmission, node, signal))
+        {
+            stats.collisions++;
+            continue;
+        }
+
+        stats.receptions++;
+        sim_kernel_select_node(node);
+        sim_radio_receive(transmission->data, (int16_t)lround(signal));
+    }
+}
+
+int16_t sim_channel_get_rssi(channel_id_t const* channel_id)
+{
+    uint16_t node = sim_get_node_id();
+    double rssi = NOISE_FLOOR;
+    for(size_t i = 0; i < transmission_count; i++)
+    {
+        transmission_t const* transmission = &transmissions[i];
+        if(transmission->node == node || transmission->start > sim_get_time() || transmission->end <= sim_get_time()
+           || !is_same_channel(&transmission->tx_cfg.channel_id, channel_id))
+            continue;
+
+        double power = get_received_power(transmission, node);
+        if(power > rssi)
+            rssi = power;
+    }
+
+    return (int16_t)lround(rssi);
+}
+
+void sim_set_node_position(uint16_t node, double x, double y)
+{
+    assert(node < NODE_GLOBALS_MAX_NODES);
+    positions[node].x = x;
+    positions[node].y = y;
+}
+
+void sim_set_path_loss_model(double loss, double exponent)
+{
+    reference_loss = loss;
+    path_loss_exponent = exponent;
+}
+
+void sim_set_receiver(int16_t receiver_sensitivity, uint8_t receiver_capture_threshold)
+{
+    sensitivity = receiver_sensitivity;
+    capture_threshold = receiver_capture_threshold;
+}
+
+void sim_get_channel_stats(sim_channel_stats_t* channel_stats)
+{
+    *channel_stats = stats;
+}
@@ -0,0 +1,198 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file sim_kernel.c
+ *
+ *  The events of all the nodes are kept in one binary heap, ordered by time. Firing an event is the interrupt
+ *  of its node; the virtual time jumps from one event to the next, the idle periods take no time on the host.
+ */
+
+#include <stdlib.h>
+
+#include "bootstrap.h"
+#include "debug.h"
+#include "ng.h"
+#include "scheduler.h"
+#include "sim.h"
+#include "sim_kernel.h"
+
+typedef struct
+{
+    uint64_t time;
+    uint32_t sequence;
+    uint32_t tag;
+    uint16_t node;
+    uint8_t type;
+} event_t;
+
+static event_t* events = NULL;
+static size_t event_count;
+static size_t event_capacity;
+// the events of the same time and type fire in the order they were posted, so the runs are reproducible
+static uint32_t event_sequence;
+static uint64_t now;
+static uint16_t node_count;
+
+// the nodes which may have tasks pending, they run before the next event
+static uint16_t ready_nodes[NODE_GLOBALS_MAX_NODES];
+static bool is_ready[NODE_GLOBALS_MAX_NODES];
+static uint16_t ready_count;
+
+static bool fires_before(event_t const* a, event_t const* b)
+{
+    if(a->time != b->time)
+        return a->time < b->time;
+
+    if(a->type != b->type)
+        return a->type < b->type;
+
+    return (int32_t)(a->sequence - b->sequence) < 0;
+}
+
+static void swap_events(size_t a, size_t b)
+{
+    event_t event = events[a];
+    events[a] = events[b];
+    events[b] = event;
+}
+
+static void pop_event(event_t* event)
+{
+    *event = events[0];
+    events[0] = events[--event_count];
+    size_t pos = 0;
+    while(true)
+    {
+        size_t first = pos;
+        size_t left = 2 * pos + 1;
+        if(left < event_count && fires_before(&events[left], &events[first]))
+            first = left;
+
+        if(left + 1 < event_count && fires_before(&events[left + 1], &events[first]))
+            first = left + 1;
+
+        if(first == pos)
+            break;
+
+        swap_events(pos, first);
+        pos = first;
+    }
+}
+
+void sim_kernel_post_event(uint16_t node, sim_event_type_t type, uint64_t time, uint32_t tag)
+{
+    assert(node < node_count);
+    assert(time >= now);
+    if(event_count == event_capacity)
+    {
+        event_capacity = event_capacity ? 2 * event_capacity : 4 * NODE_GLOBALS_MAX_NODES;
+        events = realloc(events, event_capacity * sizeof(event_t));
+        assert(events != NULL);
+    }
+
+    size_t pos = event_count++;
+    events[pos] = (event_t){ .time = time, .sequence = event_sequence++, .tag = tag, .node = node, .type = type };
+    while(pos > 0 && fires_before(&events[pos], &events[(pos - 1) / 2]))
+    {
+        swap_events(pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+void sim_kernel_select_node(uint16_t node)
+{
+    assert(node < node_count);
+    set_node_global_id(node);
+    if(!is_ready[node])
+    {
+        is_ready[node] = true;
+        ready_nodes[ready_count++] = node;
+    }
+}
+
+static void run_ready_nodes()
+{
+    while(ready_count > 0)
+    {
+        uint16_t node = ready_nodes[--ready_count];
+        is_ready[node] = false;
+        set_node_global_id(node);
+        scheduler_run_pending_tasks();
+    }
+}
+
+void sim_kernel_init(uint16_t count, uint64_t boot_spread)
+{
+    assert(count > 0 && count <= NODE_GLOBALS_MAX_NODES);
+    node_count = count;
+    for(uint16_t node = 0; node < node_count; node++)
+        sim_kernel_post_event(node, SIM_EVENT_BOOT, now + (boot_spread ? (uint64_t)rand() % boot_spread : 0), 0);
+}
+
+bool sim_kernel_run(uint64_t end)
+{
+    run_ready_nodes();
+    while(event_count > 0 && events[0].time <= end)
+    {
+        event_t event;
+        pop_event(&event);
+        now = event.time;
+        sim_kernel_select_node(event.node);
+        // the interrupts are masked in the atomic sections, which never span a task
+        assert(!sim_atomic_is_active());
+        switch(event.type)
+        {
+            case SIM_EVENT_BOOT:
+                __framework_bootstrap();
+                break;
+            case SIM_EVENT_TIMER_OVERFLOW:
+            case SIM_EVENT_TIMER_COMPARE:
+                sim_timer_handle_event(event.type, event.tag);
+                break;
+            case SIM_EVENT_TRANSMISSION_END:
+                // the receivers get the frame when the transmitter completes it
+                sim_channel_deliver(event.tag);
+                sim_kernel_select_node(event.node);
+                sim_radio_transmission_completed(event.tag);
+                break;
+        }
+
+        run_ready_nodes();
+    }
+
+    if(event_count == 0)
+        return false;
+
+    now = end;
+    return true;
+}
+
+uint16_t sim_get_node_count()
+{
+    return node_count;
+}
+
+uint16_t sim_get_node_id()
+{
+    return get_node_global_id();
+}
+
+uint64_t sim_get_time()
+{
+    return now;
+}
@@ -0,0 +1,86 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file sim_kernel.h
+ *
+ *  The discrete event kernel shared by the simulated nodes. The events are kept in virtual time order and fired
+ *  in the context of their node, the tasks they post are run before the next event, so the nodes only run
+ *  between events, as the MCU of a node only runs between interrupts.
+ */
+
+#ifndef __SIM_KERNEL_H_
+#define __SIM_KERNEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hwradio.h"
+#include "link_c.h"
+
+// the order of the events at the same time: an overflow goes before a compare of the timer, as on the hardware timers
+typedef enum
+{
+    SIM_EVENT_BOOT,
+    SIM_EVENT_TIMER_OVERFLOW,
+    SIM_EVENT_TIMER_COMPARE,
+    SIM_EVENT_TRANSMISSION_END,
+} sim_event_type_t;
+
+/*! \brief Post an event for the node, the tag is passed to its handler to recognise events cancelled since */
+__LINK_C void sim_kernel_post_event(uint16_t node, sim_event_type_t type, uint64_t time, uint32_t tag);
+
+/*! \brief Make the node the current one (see set_node_global_id()), its pending tasks run after the current event */
+__LINK_C void sim_kernel_select_node(uint16_t node);
+
+/*! \brief Set the number of nodes and schedule their boot, spread over the given period from now */
+__LINK_C void sim_kernel_init(uint16_t node_count, uint64_t boot_spread);
+
+/*! \brief Run the nodes until the given time or until no events are left. Returns false when no events are left */
+__LINK_C bool sim_kernel_run(uint64_t end);
+
+/*! \brief Whether the current node is inside an atomic section */
+__LINK_C bool sim_atomic_is_active();
+
+__LINK_C void sim_timer_handle_event(sim_event_type_t type, uint32_t tag);
+
+/*! \brief Put a frame of the current node on the channel, the end of the transmission is posted to the node. Returns
+ *  the identifier of the transmission, which is the tag of the event
+ */
+__LINK_C uint32_t sim_channel_transmit(hw_tx_cfg_t const* tx_cfg, uint8_t const* data, uint64_t duration);
+
+/*! \brief Stop the transmission before its end, the frame is not received then */
+__LINK_C void sim_channel_abort(uint32_t id);
+
+/*! \brief Receive the transmission at the listening nodes, at its end */
+__LINK_C void sim_channel_deliver(uint32_t id);
+
+/*! \brief The strongest signal on the channel at the current node, in dBm */
+__LINK_C int16_t sim_channel_get_rssi(channel_id_t const* channel_id);
+
+/*! \brief Whether the current node received on the channel during the given period, without interruption */
+__LINK_C bool sim_radio_is_listening(channel_id_t const* channel_id, syncword_class_t syncword_class, uint64_t since);
+
+/*! \brief Receive the frame on the current node, the data starts with the length byte */
+__LINK_C void sim_radio_receive(uint8_t const* data, int16_t rssi);
+
+__LINK_C void sim_radio_transmission_completed(uint32_t id);
+
+/*! \brief Show or hide the output of the nodes */
+__LINK_C void sim_uart_set_enabled(bool enabled);
+
+#endif
@@ -0,0 +1,126 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file sim_main.c
+ *
+ *  Runs the application on every node of the simulated network, see sim.h.
+ *
+ *  usage: <application> [-n nodes] [-t seconds] [-b seconds] [-g meters] [-p file] [-l dB] [-e exponent]
+ *                       [-s dBm] [-c dB] [-q]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "timer.h"
+#include "sim.h"
+#include "sim_kernel.h"
+
+static void usage(char const* program)
+{
+    fprintf(stderr, "usage: %s [options]\n"
+            "  -n nodes     the number of nodes (default 2, at most %u)\n"
+            "  -t seconds   the time to simulate (default until no events are left)\n"
+            "  -b seconds   the period over which the nodes boot (default 0, all at once)\n"
+            "  -g meters    the distance between the nodes on the square grid they are placed on (default 10)\n"
+            "  -p file      the positions of the nodes, one 'x y' line in meters per node, instead of the grid\n"
+            "  -l dB        the path loss at 1 m (default 40)\n"
+            "  -e exponent  the path loss exponent (default 3)\n"
+            "  -s dBm       the sensitivity of the receivers (default -100)\n"
+            "  -c dB        the capture threshold of the receivers (default 6)\n"
+            "  -q           hide the output of the nodes\n", program, NODE_GLOBALS_MAX_NODES);
+}
+
+static void place_nodes(uint16_t node_count, double spacing, char const* positions)
+{
+    uint16_t columns = ceil(sqrt(node_count));
+    for(uint16_t node = 0; node < node_count; node++)
+        sim_set_node_position(node, (node % columns) * spacing, (node / columns) * spacing);
+
+    if(positions == NULL)
+        return;
+
+    FILE* file = fopen(positions, "r");
+    if(file == NULL)
+    {
+        perror(positions);
+        exit(-1);
+    }
+
+    double x, y;
+    for(uint16_t node = 0; node < node_count && fscanf(file, "%lf %lf", &x, &y) == 2; node++)
+        sim_set_node_position(node, x, y);
+
+    fclose(file);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long node_count = 2;
+    double duration = 0;
+    double boot_spread = 0;
+    double spacing = 10;
+    char const* positions = NULL;
+    double reference_loss = 40;
+    double exponent = 3;
+    int sensitivity = -100;
+    int capture_threshold = 6;
+    int option;
+    while((option = getopt(argc, argv, "n:t:b:g:p:l:e:s:c:q")) != -1)
+    {
+        switch(option)
+        {
+            case 'n': node_count = strtoul(optarg, NULL, 0); break;
+            case 't': duration = atof(optarg); break;
+            case 'b': boot_spread = atof(optarg); break;
+            case 'g': spacing = atof(optarg); break;
+            case 'p': positions = optarg; break;
+            case 'l': reference_loss = atof(optarg); break;
+            case 'e': exponent = atof(optarg); break;
+            case 's': sensitivity = atoi(optarg); break;
+            case 'c': capture_threshold = atoi(optarg); break;
+            case 'q': sim_uart_set_enabled(false); break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if(node_count == 0 || node_count > NODE_GLOBALS_MAX_NODES)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    // the logs also show up when the program is piped and killed
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    place_nodes(node_count, spacing, positions);
+    sim_set_path_loss_model(reference_loss, exponent);
+    sim_set_receiver(sensitivity, capture_threshold);
+    sim_kernel_init(node_count, boot_spread * TIMER_TICKS_PER_SEC);
+    sim_kernel_run(duration > 0 ? (uint64_t)(duration * TIMER_TICKS_PER_SEC) : UINT64_MAX);
+
+    sim_channel_stats_t stats;
+    sim_get_channel_stats(&stats);
+    printf("simulated %.3f s of %u nodes: %u transmissions (%.3f s on air), %u receptions, %u collisions, %u too weak\n",
+           (double)sim_get_time() / TIMER_TICKS_PER_SEC, sim_get_node_count(), stats.transmissions,
+           (double)stats.airtime / TIMER_TICKS_PER_SEC, stats.receptions, stats.collisions, stats.too_weak);
+    return 0;
+}
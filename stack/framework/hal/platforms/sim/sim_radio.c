@@ -0,0 +1,413 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file sim_radio.c
+ *
+ *  The transceiver of a node on the simulated channel. The frames are on air for their duration computed by the
+ *  data link layer, and the background frames are repeated until the end of the advertising, each with the ETA
+ *  of the foreground frame from its own end, as the Si4460 driver does.
+ */
+
+#include <string.h>
+
+#include "debug.h"
+#include "hwradio.h"
+#include "ng.h"
+#include "timer.h"
+#include "scheduler.h"
+#include "energy.h"
+#include "sim.h"
+#include "sim_kernel.h"
+
+// the airtime of the D7A frames, from the data link layer of the stack the nodes run (modules/d7ap)
+__LINK_C uint16_t dll_calculate_tx_duration(phy_channel_class_t channel_class, phy_coding_t ch_coding, uint8_t packet_length);
+
+// the RSSI is valid 200 us after the RX started, as the Si4460 driver waits for it. Measuring takes time, so a CSMA-CA
+// retrying on a busy channel advances in virtual time
+#define RSSI_VALID_DELAY ((timer_tick_t)((200 * (uint64_t)TIMER_TICKS_PER_SEC + 999999) / 1000000))
+
+typedef enum
+{
+    HW_RADIO_STATE_IDLE,
+    HW_RADIO_STATE_TX,
+    HW_RADIO_STATE_RX
+} hw_radio_state_t;
+
+static alloc_packet_callback_t NGDEF(alloc_packet_callback);
+static release_packet_callback_t NGDEF(release_packet_callback);
+static rx_packet_callback_t NGDEF(rx_packet_callback);
+static tx_packet_callback_t NGDEF(tx_packet_callback);
+static rssi_valid_callback_t NGDEF(rssi_valid_callback);
+static cca_callback_t NGDEF(cca_callback);
+static int16_t NGDEF(cca_threshold);
+static rx_header_filter_callback_t NGDEF(rx_header_filter_callback);
+
+static hw_radio_state_t NGDEF(current_state);
+static hw_rx_cfg_t NGDEF(current_rx_cfg);
+// the virtual time at which the radio started to listen with the current RX config
+static uint64_t NGDEF(rx_start);
+static bool NGDEF(background_scan);
+static int16_t NGDEF(scan_rssi); // sampled by a background scan terminated right away, until RX or TX
+static bool NGDEF(should_rx_after_tx_completed);
+static hw_radio_packet_t* NGDEF(current_packet);
+static uint32_t NGDEF(current_transmission);
+
+static bool NGDEF(advertising);
+static hw_tx_cfg_t NGDEF(adv_tx_cfg);
+static uint8_t NGDEF(adv_data)[1 + BACKGROUND_FRAME_LENGTH];
+static uint64_t NGDEF(adv_end);
+static uint16_t NGDEF(adv_tx_duration);
+
+// the simulated transceiver has no FIFO and the channel does not corrupt frames, only the dropped frames are counted
+static hw_radio_stats_t NGDEF(stats);
+
+static void report_rssi()
+{
+    // the RX callbacks may have changed meanwhile
+    if(NG(current_state) != HW_RADIO_STATE_RX || NG(rssi_valid_callback) == NULL)
+        return;
+
+    NG(rssi_valid_callback)(sim_channel_get_rssi(&NG(current_rx_cfg).channel_id));
+}
+
+// the threshold comparison of a radio, after the same delay as the RSSI
+static void report_cca()
+{
+    // cancelled when the radio was used meanwhile
+    if(NG(current_state) != HW_RADIO_STATE_RX || NG(cca_callback) == NULL)
+        return;
+
+    cca_callback_t cca_cb = NG(cca_callback);
+    NG(cca_callback) = NULL;
+    int16_t rssi = sim_channel_get_rssi(&NG(current_rx_cfg).channel_id);
+    cca_cb(rssi <= NG(cca_threshold), rssi);
+}
+
+static void cancel_cca()
+{
+    NG(cca_callback) = NULL;
+    timer_cancel_task(&report_cca);
+}
+
+static void start_rx(hw_rx_cfg_t const* rx_cfg)
+{
+    cancel_cca();
+    NG(scan_rssi) = HW_RSSI_INVALID;
+    NG(current_rx_cfg) = *rx_cfg;
+    NG(current_state) = HW_RADIO_STATE_RX;
+    energy_radio_state_changed(ENERGY_RADIO_RX, 0);
+    NG(rx_start) = sim_get_time();
+    if(NG(rssi_valid_callback) != NULL)
+        assert(timer_post_task_delay(&report_rssi, RSSI_VALID_DELAY) == SUCCESS);
+}
+
+static void switch_to_idle_mode()
+{
+    timer_cancel_task(&switch_to_idle_mode);
+    timer_cancel_task(&report_rssi);
+    cancel_cca();
+    NG(background_scan) = false;
+    NG(advertising) = false;
+    if(NG(current_state) == HW_RADIO_STATE_IDLE)
+        return;
+
+    NG(current_state) = HW_RADIO_STATE_IDLE;
+    energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
+}
+
+static void transmission_completed()
+{
+    NG(current_state) = HW_RADIO_STATE_IDLE;
+    energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
+    NG(current_packet)->tx_meta.timestamp = timer_get_counter_value();
+    if(NG(tx_packet_callback) != NULL)
+        NG(tx_packet_callback)(NG(current_packet));
+
+    if(NG(should_rx_after_tx_completed) && NG(current_state) == HW_RADIO_STATE_IDLE)
+        start_rx(&NG(current_rx_cfg));
+}
+
+static void advertising_terminated()
+{
+    if(!NG(advertising))
+        return;
+
+    NG(advertising) = false;
+    transmission_completed();
+}
+
+static void start_tx(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb)
+{
+    timer_cancel_task(&switch_to_idle_mode);
+    cancel_cca();
+    NG(background_scan) = false;
+    NG(scan_rssi) = HW_RSSI_INVALID;
+    NG(should_rx_after_tx_completed) = NG(current_state) == HW_RADIO_STATE_RX;
+    NG(tx_packet_callback) = tx_cb;
+    NG(current_packet) = packet;
+    NG(current_state) = HW_RADIO_STATE_TX;
+    energy_radio_state_changed(ENERGY_RADIO_TX, packet->tx_meta.tx_cfg.eirp);
+}
+
+static void send_advertising_frame()
+{
+    // the ETA of a frame is the time left after its end, the ETA is transmitted in Ti
+    int64_t eta = (int64_t)(NG(adv_end) - sim_get_time()) - NG(adv_tx_duration);
+    if(eta < 0)
+        eta = 0;
+
+    uint16_t swap_eta = __builtin_bswap16(TIMER_TICKS_TO_TI(eta));
+    memcpy(&NG(adv_data)[1 + 2], &swap_eta, sizeof(uint16_t));
+    NG(current_transmission) = sim_channel_transmit(&NG(adv_tx_cfg), NG(adv_data), NG(adv_tx_duration));
+}
+
+void sim_radio_transmission_completed(uint32_t id)
+{
+    if(NG(current_state) != HW_RADIO_STATE_TX || id != NG(current_transmission))
+        return; // aborted by radio_set_idle()
+
+    if(NG(advertising))
+    {
+        // the next frame is only sent when it ends before the foreground frame, which starts at the announced ETA
+        int64_t left = (int64_t)(NG(adv_end) - sim_get_time());
+        if(left >= NG(adv_tx_duration))
+            send_advertising_frame();
+        else if(left > 0)
+            assert(timer_post_task_delay(&advertising_terminated, left) == SUCCESS);
+        else
+            advertising_terminated();
+
+        return;
+    }
+
+    transmission_completed();
+}
+
+static error_t radio_init(alloc_packet_callback_t alloc_packet_cb,
+                          release_packet_callback_t release_packet_cb)
+{
+    NG(alloc_packet_callback) = alloc_packet_cb;
+    NG(release_packet_callback) = release_packet_cb;
+    NG(current_state) = HW_RADIO_STATE_IDLE;
+    NG(scan_rssi) = HW_RSSI_INVALID;
+    energy_radio_state_changed(ENERGY_RADIO_IDLE, 0);
+
+    sched_register_task(&report_rssi);
+    sched_register_task(&report_cca);
+    sched_register_task(&switch_to_idle_mode);
+    sched_register_task(&advertising_terminated);
+    return SUCCESS;
+}
+
+static void radio_set_rx_header_filter(rx_header_filter_callback_t rx_header_filter_cb)
+{
+    NG(rx_header_filter_callback) = rx_header_filter_cb;
+}
+
+static uint8_t radio_get_capabilities()
+{
+    return 0;
+}
+
+static error_t radio_set_idle()
+{
+    // a transmission stops right away, without callback and without resuming the RX
+    if(NG(current_state) == HW_RADIO_STATE_TX)
+    {
+        sim_channel_abort(NG(current_transmission));
+        timer_cancel_task(&advertising_terminated);
+    }
+
+    switch_to_idle_mode();
+    return SUCCESS;
+}
+
+static error_t radio_set_rx(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, rssi_valid_callback_t rssi_valid_cb)
+{
+    NG(rx_packet_callback) = rx_cb;
+    NG(rssi_valid_callback) = rssi_valid_cb;
+    if(NG(current_state) == HW_RADIO_STATE_TX)
+    {
+        // RX starts when the transmission completed
+        NG(current_rx_cfg) = *rx_cfg;
+        NG(should_rx_after_tx_completed) = true;
+        return SUCCESS;
+    }
+
+    timer_cancel_task(&switch_to_idle_mode);
+    NG(background_scan) = false;
+    start_rx(rx_cfg);
+    return SUCCESS;
+}
+
+static error_t radio_send_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb)
+{
+    if(NG(current_state) == HW_RADIO_STATE_TX)
+        return EBUSY;
+
+    start_tx(packet, tx_cb);
+    phy_channel_header_t const* channel_header = &packet->tx_meta.tx_cfg.channel_id.channel_header;
+    NG(current_transmission) = sim_channel_transmit(&packet->tx_meta.tx_cfg, packet->data,
+        dll_calculate_tx_duration(channel_header->ch_class, channel_header->ch_coding, packet->length + 1));
+    return SUCCESS;
+}
+
+static error_t radio_send_background_packet(hw_radio_packet_t* packet, tx_packet_callback_t tx_cb,
+                                            timer_tick_t eta, uint16_t tx_duration)
+{
+    if(NG(current_state) == HW_RADIO_STATE_TX)
+        return EBUSY;
+
+    assert(packet->length == BACKGROUND_FRAME_LENGTH);
+    start_tx(packet, tx_cb);
+    // the frame is copied so the upper layer can reuse the packet during the advertising
+    NG(adv_tx_cfg) = packet->tx_meta.tx_cfg;
+    memcpy(NG(adv_data), packet->data, sizeof(NG(adv_data)));
+    NG(adv_end) = sim_get_time() + eta;
+    NG(adv_tx_duration) = tx_duration;
+    NG(advertising) = true;
+    send_advertising_frame();
+    return SUCCESS;
+}
+
+static error_t radio_start_background_scan(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb, int16_t rssi_thr)
+{
+    // a background scan is not started before the transmission completed
+    assert(NG(current_state) != HW_RADIO_STATE_TX);
+
+    NG(rx_packet_callback) = rx_cb;
+    NG(rssi_valid_callback) = NULL;
+    start_rx(rx_cfg);
+    // fast RX termination without a carrier on the channel
+    int16_t rssi = sim_channel_get_rssi(&rx_cfg->channel_id);
+    if(rssi <= rssi_thr)
+    {
+        switch_to_idle_mode();
+        NG(scan_rssi) = rssi;
+        return FAIL;
+    }
+
+    // the scan lasts until the end of the next background frame, when it started during a frame on the channel
+    NG(background_scan) = true;
+    timer_tick_t timeout = 2 * dll_calculate_tx_duration(rx_cfg->channel_id.channel_header.ch_class,
+                                                         rx_cfg->channel_id.channel_header.ch_coding,
+                                                         BACKGROUND_FRAME_LENGTH);
+    assert(timer_post_task_delay(&switch_to_idle_mode, timeout) == SUCCESS);
+    return SUCCESS;
+}
+
+static error_t radio_start_background_sniff(hw_rx_cfg_t const* rx_cfg, rx_packet_callback_t rx_cb,
+                                            int16_t rssi_thr, timer_tick_t period)
+{
+    // the scans are not offloaded to the radio, the upper layer schedules them itself
+    return FAIL;
+}
+
+static error_t radio_cca(hw_rx_cfg_t const* rx_cfg, int16_t rssi_thr, cca_callback_t cca_cb)
+{
+    if(NG(current_state) == HW_RADIO_STATE_TX)
+        return EBUSY;
+
+    NG(rx_packet_callback) = NULL;
+    NG(rssi_valid_callback) = NULL;
+    timer_cancel_task(&switch_to_idle_mode);
+    NG(background_scan) = false;
+    start_rx(rx_cfg);
+    NG(cca_callback) = cca_cb;
+    NG(cca_threshold) = rssi_thr;
+    assert(timer_post_task_delay(&report_cca, RSSI_VALID_DELAY) == SUCCESS);
+    return SUCCESS;
+}
+
+static int16_t radio_get_rssi()
+{
+    if(NG(current_state) == HW_RADIO_STATE_IDLE)
+        return NG(scan_rssi);
+
+    if(NG(current_state) != HW_RADIO_STATE_RX)
+        return HW_RSSI_INVALID;
+
+    return sim_channel_get_rssi(&NG(current_rx_cfg).channel_id);
+}
+
+bool sim_radio_is_listening(channel_id_t const* channel_id, syncword_class_t syncword_class, uint64_t since)
+{
+    return NG(current_state) == HW_RADIO_STATE_RX && NG(rx_packet_callback) != NULL && NG(rx_start) <= since
+           && NG(current_rx_cfg).syncword_class == syncword_class
+           && NG(current_rx_cfg).channel_id.channel_header_raw == channel_id->channel_header_raw
+           && NG(current_rx_cfg).channel_id.center_freq_index == channel_id->center_freq_index;
+}
+
+void sim_radio_receive(uint8_t const* data, int16_t rssi)
+{
+    uint8_t length = data[0];
+    uint8_t header_length = 1 + (length < 4 ? length : 4);
+    if(NG(current_rx_cfg).syncword_class != PHY_SYNCWORD_CLASS0 && NG(rx_header_filter_callback) != NULL
+       && !NG(rx_header_filter_callback)(data, header_length))
+    {
+        NG(stats).aborted_frames++;
+        return;
+    }
+
+    hw_radio_packet_t* packet = NG(alloc_packet_callback)(length + 1);
+    if(packet == NULL)
+    {
+        NG(stats).aborted_frames++;
+        return;
+    }
+
+    memcpy(packet->data, data, length + 1);
+    packet->rx_meta.timestamp = timer_get_counter_value();
+    packet->rx_meta.rx_cfg = NG(current_rx_cfg);
+    packet->rx_meta.rssi = rssi;
+    packet->rx_meta.lqi = 0;
+    packet->rx_meta.crc_status = HW_CRC_UNAVAILABLE;
+    packet->rx_meta.sync_offset = 0;
+
+    // a background scan ends with the received frame
+    if(NG(background_scan))
+        switch_to_idle_mode();
+
+    NG(rx_packet_callback)(packet);
+}
+
+static void radio_get_stats(hw_radio_stats_t* stats)
+{
+    *stats = NG(stats);
+}
+
+static void radio_clear_stats()
+{
+    memset(&NG(stats), 0, sizeof(NG(stats)));
+}
+
+const hw_radio_t sim_radio = {
+    .init = &radio_init,
+    .set_rx_header_filter = &radio_set_rx_header_filter,
+    .get_capabilities = &radio_get_capabilities,
+    .set_idle = &radio_set_idle,
+    .set_rx = &radio_set_rx,
+    .send_packet = &radio_send_packet,
+    .send_background_packet = &radio_send_background_packet,
+    .start_background_scan = &radio_start_background_scan,
+    .start_background_sniff = &radio_start_background_sniff,
+    .cca = &radio_cca,
+    .get_rssi = &radio_get_rssi,
+    .get_stats = &radio_get_stats,
+    .clear_stats = &radio_clear_stats,
+};
@@ -0,0 +1,75 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file sim_system.c
+ *
+ *  The nodes sleep between their tasks, the kernel jumps the virtual time to the next event once all of them are
+ *  idle. A node has no time of its own, so a busy wait takes no virtual time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hwsystem.h"
+#include "hwwatchdog.h"
+#include "sim.h"
+
+#define UNIQUE_ID_BASE 0x53494D0000000000 // "SIM"
+
+void hw_enter_lowpower_mode(uint8_t mode)
+{
+}
+
+uint32_t hw_get_lowpower_mode_wakeup_latency(uint8_t mode)
+{
+    return 0;
+}
+
+uint64_t hw_get_unique_id()
+{
+    return UNIQUE_ID_BASE | sim_get_node_id();
+}
+
+void hw_busy_wait(int16_t microseconds)
+{
+}
+
+void hw_reset()
+{
+    // the nodes run in one program, which ends instead
+    fprintf(stderr, "node %u reset, ending the simulation\n", sim_get_node_id());
+    exit(0);
+}
+
+float hw_get_internal_temperature()
+{
+    return 20;
+}
+
+uint32_t hw_get_battery()
+{
+    return 3000;
+}
+
+void __watchdog_init()
+{
+}
+
+void hw_watchdog_feed()
+{
+}
@@ -0,0 +1,176 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file sim_timer.c
+ *
+ *  The 16 bit timers of a node count the virtual time of the kernel from the moment they are initialised, their
+ *  compare and overflow interrupts are events of the kernel. An event is recognised by the tag it was posted with, so an
+ *  event cancelled or rescheduled since is ignored when the kernel reaches it.
+ */
+
+#include "debug.h"
+#include "hwtimer.h"
+#include "ng.h"
+#include "timer.h"
+#include "sim.h"
+#include "sim_kernel.h"
+
+#define COUNTER_PERIOD ((uint32_t)UINT16_MAX + 1)
+
+typedef struct
+{
+    timer_callback_t compare_f;
+    timer_callback_t overflow_f;
+    bool inited;
+    bool compare_scheduled;
+    uint64_t compare_time;
+    uint32_t compare_tag;
+    // the virtual time at which the counter was 0, and the time of its next overflow
+    uint64_t counter_start;
+    uint64_t overflow_time;
+    uint32_t overflow_tag;
+} sim_timer_t;
+
+// all the timers count the virtual time, each from the moment it is initialised. The tags of their events identify
+// the timer as well: tag = sequence number * HWTIMER_NUM + timer id
+static sim_timer_t NGDEF(timers)[HWTIMER_NUM];
+
+static inline uint32_t next_tag(uint32_t* sequence, hwtimer_id_t timer_id)
+{
+    return ++(*sequence) * HWTIMER_NUM + timer_id;
+}
+
+static void schedule_overflow(hwtimer_id_t timer_id)
+{
+    sim_timer_t* timer = &NG(timers)[timer_id];
+    timer->overflow_time = timer->counter_start + COUNTER_PERIOD
+                           * ((sim_get_time() - timer->counter_start) / COUNTER_PERIOD + 1);
+    sim_kernel_post_event(sim_get_node_id(), SIM_EVENT_TIMER_OVERFLOW, timer->overflow_time,
+                          next_tag(&timer->overflow_tag, timer_id));
+}
+
+error_t hw_timer_init(hwtimer_id_t timer_id, uint8_t frequency, timer_callback_t compare_callback, timer_callback_t overflow_callback)
+{
+    if(timer_id >= HWTIMER_NUM)
+        return ESIZE;
+    sim_timer_t* timer = &NG(timers)[timer_id];
+    if(timer->inited)
+        return EALREADY;
+    // the virtual time of the kernel counts in ticks of the framework timer
+    if(frequency != TIMER_RESOLUTION)
+        return EINVAL;
+
+    timer->compare_f = compare_callback;
+    timer->overflow_f = overflow_callback;
+    timer->compare_scheduled = false;
+    timer->counter_start = sim_get_time();
+    timer->inited = true;
+    schedule_overflow(timer_id);
+    return SUCCESS;
+}
+
+hwtimer_tick_t hw_timer_getvalue(hwtimer_id_t timer_id)
+{
+    if(timer_id >= HWTIMER_NUM || (!NG(timers)[timer_id].inited))
+        return 0;
+
+    return (hwtimer_tick_t)(sim_get_time() - NG(timers)[timer_id].counter_start);
+}
+
+error_t hw_timer_schedule(hwtimer_id_t timer_id, hwtimer_tick_t tick)
+{
+    if(timer_id >= HWTIMER_NUM)
+        return ESIZE;
+    sim_timer_t* timer = &NG(timers)[timer_id];
+    if(!timer->inited)
+        return EOFF;
+
+    // as with the hardware timers, a compare value equal to the counter only fires after the counter looped around
+    uint32_t delay = (hwtimer_tick_t)(tick - hw_timer_getvalue(timer_id));
+    if(delay == 0)
+        delay = COUNTER_PERIOD;
+
+    timer->compare_time = sim_get_time() + delay;
+    timer->compare_scheduled = true;
+    sim_kernel_post_event(sim_get_node_id(), SIM_EVENT_TIMER_COMPARE, timer->compare_time,
+                          next_tag(&timer->compare_tag, timer_id));
+    return SUCCESS;
+}
+
+error_t hw_timer_cancel(hwtimer_id_t timer_id)
+{
+    if(timer_id >= HWTIMER_NUM)
+        return ESIZE;
+    sim_timer_t* timer = &NG(timers)[timer_id];
+    if(!timer->inited)
+        return EOFF;
+
+    timer->compare_scheduled = false;
+    timer->compare_tag++;
+    return SUCCESS;
+}
+
+error_t hw_timer_counter_reset(hwtimer_id_t timer_id)
+{
+    if(timer_id >= HWTIMER_NUM)
+        return ESIZE;
+    if(!NG(timers)[timer_id].inited)
+        return EOFF;
+
+    hw_timer_cancel(timer_id);
+    NG(timers)[timer_id].counter_start = sim_get_time();
+    schedule_overflow(timer_id);
+    return SUCCESS;
+}
+
+// the events of the same time may fire after other events of that time, until then they are pending
+bool hw_timer_is_overflow_pending(hwtimer_id_t timer_id)
+{
+    return timer_id < HWTIMER_NUM && NG(timers)[timer_id].inited && NG(timers)[timer_id].overflow_time <= sim_get_time();
+}
+
+bool hw_timer_is_interrupt_pending(hwtimer_id_t timer_id)
+{
+    return timer_id < HWTIMER_NUM && NG(timers)[timer_id].compare_scheduled
+           && NG(timers)[timer_id].compare_time <= sim_get_time();
+}
+
+void sim_timer_handle_event(sim_event_type_t type, uint32_t tag)
+{
+    hwtimer_id_t timer_id = tag % HWTIMER_NUM;
+    sim_timer_t* timer = &NG(timers)[timer_id];
+    if(type == SIM_EVENT_TIMER_OVERFLOW)
+    {
+        if(tag != timer->overflow_tag * HWTIMER_NUM + timer_id)
+            return;
+
+        schedule_overflow(timer_id);
+        if(timer->overflow_f)
+            timer->overflow_f();
+    }
+    else
+    {
+        if(tag != timer->compare_tag * HWTIMER_NUM + timer_id || !timer->compare_scheduled)
+            return;
+
+        // the timer fires once
+        timer->compare_scheduled = false;
+        if(timer->compare_f)
+            timer->compare_f();
+    }
+}
@@ -0,0 +1,98 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2017 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file sim_uart.c
+ *
+ *  The UARTs of the nodes write to stdout, each line prefixed with the node and the virtual time. Nothing is
+ *  received.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hwuart.h"
+#include "errors.h"
+#include "ng.h"
+#include "sim.h"
+#include "sim_kernel.h"
+
+struct uart_handle {
+  uint8_t  idx;
+  uint32_t baudrate;
+  uart_rx_inthandler_t rx_cb;
+};
+
+static uart_handle_t NGDEF(handle);
+static bool NGDEF(line_started);
+static bool enabled = true;
+
+uart_handle_t* uart_init(uint8_t idx, uint32_t baudrate, uint8_t pins) {
+  if(idx > 0)
+    return NULL;
+
+  NG(handle).baudrate = baudrate;
+  return &NG(handle);
+}
+
+bool uart_enable(uart_handle_t* uart) {
+  return true;
+}
+
+bool uart_disable(uart_handle_t* uart) {
+  return true;
+}
+
+void uart_send_byte(uart_handle_t* uart, uint8_t data) {
+  uart_send_bytes(uart, &data, 1);
+}
+
+void uart_send_bytes(uart_handle_t* uart, void const *data, size_t length) {
+  if(!enabled)
+    return;
+
+  for(char const* c = data; c < (char const*)data + length; c++) {
+    if(*c == '\r')
+      continue;
+
+    if(!NG(line_started))
+      printf("%3u %10" PRIu64 " ", sim_get_node_id(), sim_get_time());
+
+    putchar(*c);
+    NG(line_started) = *c != '\n';
+  }
+}
+
+void uart_send_string(uart_handle_t* uart, const char *string) {
+  uart_send_bytes(uart, string, strlen(string));
+}
+
+error_t uart_rx_interrupt_enable(uart_handle_t* uart) {
+  return SUCCESS;
+}
+
+void uart_rx_interrupt_disable(uart_handle_t* uart) {
+}
+
+void uart_set_rx_interrupt_callback(uart_handle_t* uart, uart_rx_inthandler_t rx_handler) {
+  uart->rx_cb = rx_handler;
+}
+
+void sim_uart_set_enabled(bool enable) {
+  enabled = enable;
+}
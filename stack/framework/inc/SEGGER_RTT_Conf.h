@@ -67,6 +67,8 @@ Revision: $Rev: 4351 $
   #include <intrinsics.h>
 #endif
 
+#include "framework_defs.h"
+
 /*********************************************************************
 *
 *       Defines, configurable
@@ -75,10 +77,16 @@ Revision: $Rev: 4351 $
 */
 
 #define SEGGER_RTT_MAX_NUM_UP_BUFFERS             (1)     // Max. number of up-buffers (T->H) available on this target    (Default: 3)
-#define SEGGER_RTT_MAX_NUM_DOWN_BUFFERS           (0)     // Max. number of down-buffers (H->T) available on this target  (Default: 3)
-
 #define BUFFER_SIZE_UP                            (2048)  // Size of the buffer for terminal output of target, up to host (Default: 1k)
+
+#ifdef FRAMEWORK_CONSOLE_ON_RTT
+// the console receives the shell commands and the ALP frames of the host on the terminal channel
+#define SEGGER_RTT_MAX_NUM_DOWN_BUFFERS           (1)     // Max. number of down-buffers (H->T) available on this target  (Default: 3)
+#define BUFFER_SIZE_DOWN                          (1024)  // Size of the buffer for terminal input to target from host (Usually keyboard input) (Default: 16)
+#else
+#define SEGGER_RTT_MAX_NUM_DOWN_BUFFERS           (0)     // Max. number of down-buffers (H->T) available on this target  (Default: 3)
 #define BUFFER_SIZE_DOWN                          (0)    // Size of the buffer for terminal input to target from host (Usually keyboard input) (Default: 16)
+#endif
 
 #define SEGGER_RTT_PRINTF_BUFFER_SIZE             (0)    // Size of buffer for RTT printf to bulk-send chars via RTT     (Default: 64)
 
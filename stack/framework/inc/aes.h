@@ -2,6 +2,8 @@
 #define _AES_H_
 
 #include <types.h>
+#include "hal_defs.h"
+#include "framework_defs.h"
 
 
 #define AES_BLOCK_SIZE 16
@@ -24,11 +26,37 @@
   #define CTR 1
 #endif
 
+/*! \brief The key and key schedule the AES functions operate on.
+ *
+ * The functions taking a context are reentrant, a context is expanded once per key by AES128_ctx_init() and can
+ * then be used for any number of operations. The functions without context operate on the default context set by
+ * AES128_init(). The round keys are not stored when the MCU has an AES accelerator (HAL_AES_USE_HW).
+ */
+typedef struct
+{
+    uint8_t key[AES_BLOCK_SIZE];
+#ifndef HAL_AES_USE_HW
+    uint8_t round_keys[176];
+#ifdef FRAMEWORK_AES_TTABLE
+    uint32_t round_key_words[44];
+#endif
+#endif
+#if defined(CBC) && CBC
+    const uint8_t *cbc_iv;
+#endif
+} aes_ctx_t;
+
+void AES128_ctx_init(aes_ctx_t *ctx, const uint8_t *key);
+
+// Sets the default context, the key is only expanded again when it differs from the previous one
 void AES128_init(const uint8_t *key);
+const aes_ctx_t *AES128_default_ctx();
 
 #if defined(ECB) && ECB
 
 // The two functions AES128_ECB_xxcrypt() do most of the work, and they expect inputs of 128 bit length.
+void AES128_ECB_encrypt_ctx(const aes_ctx_t *ctx, uint8_t *input, uint8_t *output);
+void AES128_ECB_decrypt_ctx(const aes_ctx_t *ctx, uint8_t *input, uint8_t *output);
 void AES128_ECB_encrypt(uint8_t *input, uint8_t *output);
 void AES128_ECB_decrypt(uint8_t *input, uint8_t *output);
 
@@ -37,12 +65,15 @@ void AES128_ECB_decrypt(uint8_t *input, uint8_t *output);
 
 #if defined(CBC) && CBC
 
+void AES128_CBC_encrypt_buffer_ctx(aes_ctx_t *ctx, uint8_t *output, uint8_t *input, uint32_t length, const uint8_t *iv);
+void AES128_CBC_decrypt_buffer_ctx(aes_ctx_t *ctx, uint8_t *output, uint8_t *input, uint32_t length, const uint8_t *iv);
 void AES128_CBC_encrypt_buffer(uint8_t *output, uint8_t *input, uint32_t length, const uint8_t *iv);
 void AES128_CBC_decrypt_buffer(uint8_t *output, uint8_t *input, uint32_t length, const uint8_t *iv);
 
 #endif // #if defined(CBC) && CBC
 
 #if defined(CTR) && CTR
+void AES128_CTR_encrypt_ctx(const aes_ctx_t *ctx, uint8_t *output, uint8_t *input, uint32_t length, uint8_t* ctr_blk);
 void AES128_CTR_encrypt(uint8_t *output, uint8_t *input, uint32_t length, uint8_t* ctr_blk);
 // Decryption is exactly the same operation as encryption
 
@@ -59,6 +90,8 @@ void AES128_CTR_encrypt(uint8_t *output, uint8_t *input, uint32_t length, uint8_
  * \param ctr_blk	128 bit initial counter block to be used for the CTR encryption.
  * \param auth_len	MIC length of 0, 4, 8 or 16 bytes are allowed
  */
+error_t AES128_CBC_MAC_ctx( const aes_ctx_t *ctx, uint8_t *auth, uint8_t *payload, uint8_t length, const uint8_t *iv,
+                            const uint8_t *add, uint8_t add_len, uint8_t auth_len );
 error_t AES128_CBC_MAC( uint8_t *auth, uint8_t *payload, uint8_t length, const uint8_t *iv,
                         const uint8_t *add, uint8_t add_len, uint8_t auth_len );
 
@@ -73,6 +106,9 @@ error_t AES128_CBC_MAC( uint8_t *auth, uint8_t *payload, uint8_t length, const u
  * \param ctr_blk	128 bit initial counter block to be used for the CTR encryption.
  * \param auth_len	MIC length of 0, 4, 8 or 16 bytes are allowed
  */
+error_t AES128_CCM_encrypt_ctx( const aes_ctx_t *ctx, uint8_t *payload, uint8_t length, const uint8_t *iv,
+                                const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
+                                uint8_t auth_len );
 error_t AES128_CCM_encrypt( uint8_t *payload, uint8_t length, const uint8_t *iv,
                             const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
                             uint8_t auth_len );
@@ -87,8 +123,45 @@ error_t AES128_CCM_encrypt( uint8_t *payload, uint8_t length, const uint8_t *iv,
  * \param ctr_blk	128 bit initial counter block to be used for the CTR encryption.
  * \param auth_len	MIC length of 0, 4, 8 or 16 bytes are allowed
  */
+error_t AES128_CCM_decrypt_ctx( const aes_ctx_t *ctx, uint8_t *payload, uint8_t length, const uint8_t *iv,
+                                const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
+                                const uint8_t *auth, uint8_t auth_len );
 error_t AES128_CCM_decrypt( uint8_t *payload, uint8_t length, const uint8_t *iv,
                             const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
                             const uint8_t *auth, uint8_t auth_len );
 
+/*! \brief The state of a CCM encryption or decryption executed by steps, see AES128_CCM_start_ctx() */
+typedef struct
+{
+    const aes_ctx_t *ctx;
+    uint8_t *payload;               /**< The next block to process */
+    uint8_t length;                 /**< The number of bytes left to process */
+    uint8_t *ctr_blk;
+    uint8_t tag[AES_BLOCK_SIZE];    /**< The CBC-MAC of the processed blocks */
+    uint8_t auth[AES_BLOCK_SIZE];   /**< The decrypted authentication tag, when decrypting */
+    uint8_t auth_len;
+    bool decrypt;
+} aes_ccm_t;
+
+/*! \brief Start a CCM encryption or decryption executed by steps, as done by AES128_CCM_encrypt_ctx() and
+ * AES128_CCM_decrypt_ctx() at once. This lets a long payload be processed by a job (see sched_post_job()).
+ *
+ * The payload, the counter block and the context should remain valid until AES128_CCM_finish(). The parameters are
+ * those of AES128_CCM_encrypt_ctx() and AES128_CCM_decrypt_ctx(), auth is only used for a decryption.
+ */
+error_t AES128_CCM_start_ctx( aes_ccm_t *ccm, const aes_ctx_t *ctx, bool decrypt, uint8_t *payload, uint8_t length,
+                              const uint8_t *iv, const uint8_t *add, uint8_t add_len, uint8_t *ctr_blk,
+                              const uint8_t *auth, uint8_t auth_len );
+
+/*! \brief Process up to the given number of blocks of the payload, returns true when blocks are left */
+bool AES128_CCM_step( aes_ccm_t *ccm, uint8_t blocks );
+
+/*! \brief Complete a CCM started by AES128_CCM_start_ctx(), once all blocks were processed
+ *
+ * An encryption appends the encrypted authentication tag to the payload, a decryption checks it.
+ *
+ * \return error_t	SUCCESS, or FAIL when the authentication tag of a decrypted payload does not match
+ */
+error_t AES128_CCM_finish( aes_ccm_t *ccm );
+
 #endif //_AES_H_
@@ -0,0 +1,127 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file bench.h
+ * \addtogroup bench
+ * \ingroup framework
+ * @{
+ * \brief Microbenchmarks of code sections on the target, aggregated per named probe.
+ *
+ * A probe is registered once with bench_register(), each run of the section between BENCH_START(probe) and
+ * BENCH_STOP(probe) is then added to the minimum, average and maximum of the probe. The sections are timed in core
+ * clock cycles with the DWT cycle counter on the ARMv7-M cores (Cortex-M3 and M4), in timer ticks on the other cores.
+ *
+ * Usage:
+ *
+ *     static bench_probe_id_t fec_probe;
+ *     fec_probe = bench_register("fec_encode");
+ *     ...
+ *     BENCH_START(fec_probe);
+ *     fec_encode(data, length);
+ *     BENCH_STOP(fec_probe);
+ *     ...
+ *     bench_report();
+ *
+ * The benchmarks are globally enabled or disabled by setting or clearing the 'FRAMEWORK_BENCH_ENABLED' CMake option,
+ * the macros are compiled out when disabled.
+ */
+#ifndef __BENCH_H_
+#define __BENCH_H_
+
+#include "link_c.h"
+#include "framework_defs.h"
+#include "types.h"
+#include "errors.h"
+
+/*! \brief The id of a registered probe */
+typedef uint8_t bench_probe_id_t;
+
+/*! \brief Returned by bench_register() when all FRAMEWORK_BENCH_PROBE_COUNT probes are registered, the sections of
+ *  this probe are not timed */
+#define BENCH_NO_PROBE 0xFF
+
+/*! \brief The aggregated runs of a probe, in the unit of bench_get_timestamp() */
+typedef struct
+{
+    const char* name;
+    uint32_t count;     /**< The number of runs */
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;     /**< The sum of the runs, the average is total / count */
+} bench_probe_t;
+
+#ifdef FRAMEWORK_BENCH_ENABLED
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+    // the DWT cycle counter, at its architectural address. It is enabled by bench_register()
+    #define BENCH_UNIT "cycles"
+    #define __BENCH_DWT_CYCCNT (*(volatile uint32_t*) 0xE0001004)
+
+    static inline uint32_t bench_get_timestamp() { return __BENCH_DWT_CYCCNT; }
+#else
+    #include "timer.h"
+
+    #define BENCH_UNIT "ticks"
+
+    static inline uint32_t bench_get_timestamp() { return timer_get_counter_value(); }
+#endif
+
+/*! \brief Start timing a section of probe, in the same block as the BENCH_STOP() of the section */
+#define BENCH_START(probe) uint32_t __bench_start_##probe = bench_get_timestamp()
+
+/*! \brief Stop timing the section of probe started by BENCH_START() and add the run to the probe */
+#define BENCH_STOP(probe) bench_add_run(probe, bench_get_timestamp() - __bench_start_##probe)
+
+/*! \brief Register a probe
+ *
+ * \param name  The name of the probe in the report, the string is not copied
+ * \return      The id of the probe, or BENCH_NO_PROBE when all FRAMEWORK_BENCH_PROBE_COUNT probes are registered
+ */
+__LINK_C bench_probe_id_t bench_register(const char* name);
+
+/*! \brief Add a run to a probe, as timed by BENCH_START() and BENCH_STOP()
+ *
+ * This can be called from interrupt context.
+ */
+__LINK_C void bench_add_run(bench_probe_id_t probe, uint32_t duration);
+
+/*! \brief Copy the aggregated runs of a probe
+ *
+ * \return  SUCCESS, or EINVAL if the probe is not registered
+ */
+__LINK_C error_t bench_get_probe(bench_probe_id_t probe, bench_probe_t* result);
+
+/*! \brief Print the minimum, average and maximum of each probe on the console */
+__LINK_C void bench_report();
+
+/*! \brief Discard the runs of all probes, the probes stay registered */
+__LINK_C void bench_reset();
+
+#else
+    #define BENCH_START(probe) ((void)0)
+    #define BENCH_STOP(probe) ((void)0)
+    #define bench_register(name) BENCH_NO_PROBE
+    #define bench_add_run(...) ((void)0)
+    #define bench_get_probe(...) EINVAL
+    #define bench_report() ((void)0)
+    #define bench_reset() ((void)0)
+#endif
+
+#endif /* __BENCH_H_ */
+
+/** @}*/
@@ -32,12 +32,15 @@
 #include "stdint.h"
 #include "stdbool.h"
 
+/*! The bits which are handled at once by the bitmap_word() based helpers */
+#define BITMAP_WORD_BITS 32
+
 /**
  * @brief Set a bit in the bitmap
  * @param bitmap    The bitmap. Note: the user is responsible for initializing this.
  * @param pos       The bit number to set. Note: the user is responsible for checking pos is not bigger then the bitmap itself
  */
-static inline void bitmap_set(uint8_t* bitmap, uint8_t pos)
+static inline void bitmap_set(uint8_t* bitmap, uint16_t pos)
 {
     bitmap[pos / 8] |= (1 << (pos & 7));
 }
@@ -47,7 +50,7 @@ static inline void bitmap_set(uint8_t* bitmap, uint8_t pos)
  * @param bitmap    The bitmap. Note: the user is responsible for initializing this.
  * @param pos       The bit number to clear. Note: the user is responsible for checking pos is not bigger then the bitmap itself
  */
-static inline void bitmap_clear(uint8_t* bitmap, uint8_t pos)
+static inline void bitmap_clear(uint8_t* bitmap, uint16_t pos)
 {
     bitmap[pos / 8] &= ~(1 << (pos & 7));
 }
@@ -57,11 +60,42 @@ static inline void bitmap_clear(uint8_t* bitmap, uint8_t pos)
  * @param bitmap    The bitmap. Note: the user is responsible for initializing this.
  * @param pos       The bit number to get. Note: the user is responsible for checking pos is not bigger then the bitmap itself
  */
-static bool bitmap_get(uint8_t* bitmap, uint8_t pos)
+static inline bool bitmap_get(const uint8_t* bitmap, uint16_t pos)
 {
     return bitmap[pos / 8] & (1 << (pos & 7))? true : false;
 }
 
+/**
+ * @brief           Get the bits of a word of the bitmap which equal 'flag'
+ *
+ * Bit n of the result corresponds to bit index * BITMAP_WORD_BITS + n of the bitmap. The bits beyond size are never
+ * set, whatever the flag, so the words of several bitmaps of the same size can be combined directly.
+ * @param bitmap    The bitmap
+ * @param flag      Determines if the set or the cleared bits of the bitmap are returned
+ * @param index     The word number, the word has to start before size
+ * @param size      The number of bits in the bitmap
+ * @return The matching bits of the word
+ */
+static inline uint32_t bitmap_word(const uint8_t* bitmap, bool flag, uint16_t index, uint16_t size)
+{
+    uint16_t pos = index * BITMAP_WORD_BITS;
+    uint16_t bits = size - pos < BITMAP_WORD_BITS ? size - pos : BITMAP_WORD_BITS;
+    const uint8_t* bytes = bitmap + pos / 8;
+
+    // assembled byte per byte, the bitmap is not aligned and the bytes beyond size are not accessed
+    uint32_t word = 0;
+    for(uint8_t i = 0; i * 8 < bits; i++)
+        word |= (uint32_t) bytes[i] << (i * 8);
+
+    if(!flag)
+        word = ~word;
+
+    if(bits < BITMAP_WORD_BITS)
+        word &= ((uint32_t) 1 << bits) - 1;
+
+    return word;
+}
+
 /**
  * @brief           Find the first occurance of 'flag' in the bitmap
  * @param bitmap    The bitmap to search
@@ -69,16 +103,34 @@ static bool bitmap_get(uint8_t* bitmap, uint8_t pos)
  * @param size      The max number of bits to search
  * @return The index of the first occurance of flag, or -1 when not found
  */
-static int8_t bitmap_search(uint8_t* bitmap, bool flag, uint8_t size)
+static inline int16_t bitmap_search(const uint8_t* bitmap, bool flag, uint16_t size)
 {
-    uint8_t i;
-    for(i = 0; i < size; i++)
-        if(bitmap_get(bitmap, i) == flag)
-            return i;
+    for(uint16_t index = 0; index * BITMAP_WORD_BITS < size; index++)
+    {
+        uint32_t word = bitmap_word(bitmap, flag, index, size);
+        if(word != 0)
+            return index * BITMAP_WORD_BITS + __builtin_ctzl(word);
+    }
 
     return -1;
 }
 
+/**
+ * @brief           Count the occurances of 'flag' in the bitmap
+ * @param bitmap    The bitmap to count
+ * @param flag      Determines if we count the 1 or the 0 bits
+ * @param size      The number of bits to count
+ * @return The number of bits equal to flag
+ */
+static inline uint16_t bitmap_count(const uint8_t* bitmap, bool flag, uint16_t size)
+{
+    uint16_t count = 0;
+    for(uint16_t index = 0; index * BITMAP_WORD_BITS < size; index++)
+        count += __builtin_popcountl(bitmap_word(bitmap, flag, index, size));
+
+    return count;
+}
+
 #endif // BITMAP_H
 
 /** @}*/
@@ -23,10 +23,72 @@
 #define COMPRESS_H_
 
 #include <stdbool.h>
-#include "math.h"
+#include <stdint.h>
 
-#define CT_DECOMPRESS(ct) (pow(4, ct >> 5) * (ct & 0b11111))
+/*
+ * Compressed Time format: a 3 bit exponent and a 5 bit mantissa, the value is mantissa * 4^exponent
+ * (mantissa << (2 * exponent)). The largest value, 0xFF, is 31 * 4^7.
+ */
+#define CT_MANTISSA_MAX 31
+#define CT_VALUE_MAX ((uint32_t)CT_MANTISSA_MAX << 14)
+
+/*! \brief Decompress a value in Compressed Time format */
+#define CT_DECOMPRESS(ct) ((uint32_t)((ct) & 0x1F) << (2 * (((ct) >> 5) & 0x07)))
+
+/*! \brief The smallest exponent which can hold value, for values known at build time (see CT_COMPRESS/CT_COMPRESS_CEIL) */
+#define CT_EXPONENT(value) ((value) <= ((uint32_t)CT_MANTISSA_MAX << 0) ? 0 : \
+                            (value) <= ((uint32_t)CT_MANTISSA_MAX << 2) ? 1 : \
+                            (value) <= ((uint32_t)CT_MANTISSA_MAX << 4) ? 2 : \
+                            (value) <= ((uint32_t)CT_MANTISSA_MAX << 6) ? 3 : \
+                            (value) <= ((uint32_t)CT_MANTISSA_MAX << 8) ? 4 : \
+                            (value) <= ((uint32_t)CT_MANTISSA_MAX << 10) ? 5 : \
+                            (value) <= ((uint32_t)CT_MANTISSA_MAX << 12) ? 6 : 7)
+
+/*! \brief Compress a constant value, rounded down. Values above CT_VALUE_MAX saturate to 0xFF. */
+#define CT_COMPRESS(value) ((value) > CT_VALUE_MAX ? 0xFF : \
+                            (uint8_t)((CT_EXPONENT(value) << 5) | ((uint32_t)(value) >> (2 * CT_EXPONENT(value)))))
+
+/*! \brief Compress a constant value, rounded up. Values above CT_VALUE_MAX saturate to 0xFF. */
+#define CT_COMPRESS_CEIL(value) ((value) > CT_VALUE_MAX ? 0xFF : \
+                                 (uint8_t)((CT_EXPONENT(value) << 5) | \
+                                           (((uint32_t)(value) + (1UL << (2 * CT_EXPONENT(value))) - 1) >> (2 * CT_EXPONENT(value)))))
+
+typedef enum
+{
+    COMPRESS_ROUND_DOWN,
+    COMPRESS_ROUND_UP,
+    COMPRESS_ROUND_NEAREST
+} compress_rounding_t;
+
+/*! \brief Compress a value in Compressed Time format, using the smallest exponent which can hold it
+ *
+ * Values above CT_VALUE_MAX saturate to 0xFF.
+ */
+uint8_t compress_data_rounded(uint32_t value, compress_rounding_t rounding);
 
-uint8_t compress_data(uint16_t value, bool ceil);
+/*! \brief Compress a value in Compressed Time format, rounded up when ceil is set and rounded down otherwise */
+uint8_t compress_data(uint32_t value, bool ceil);
+
+/*
+ * Delta coding of records of values, for the data of sensor files: every value of a record is coded as its difference
+ * to the same value in the previous record, zigzag mapped (0, -1, 1, -2, ... to 0, 1, 2, 3, ...) and written as a
+ * varint (7 bits per byte, least significant first, the MSB set on all bytes but the last). Slowly changing values
+ * take one byte. The first record is coded against a reference record, known to both ends for the file (by default
+ * all zeros).
+ */
+#define COMPRESS_VARINT_MAX_SIZE 5
+
+/*! \brief Delta code a record of count values against previous, which is updated to values
+ *
+ * Returns the number of bytes written to ptr, or 0 when the record does not fit in size bytes (previous is unchanged).
+ */
+uint8_t compress_delta_encode(int32_t* previous, const int32_t* values, uint8_t count, uint8_t* ptr, uint8_t size);
+
+/*! \brief Decode a record of count values coded against previous by compress_delta_encode(), previous is updated
+ *
+ * Returns the number of bytes read from ptr, or 0 when the record is truncated in the length bytes (previous is
+ * unchanged).
+ */
+uint8_t compress_delta_decode(int32_t* previous, const uint8_t* ptr, uint8_t length, int32_t* values, uint8_t count);
 
 #endif /* COMPRESS_H_ */
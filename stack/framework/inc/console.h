@@ -20,9 +20,25 @@ __LINK_C void console_disable(void);
 
 // the elementary console actions
 __LINK_C void console_print_byte(uint8_t byte);
-__LINK_C void console_print_bytes(uint8_t* bytes, uint8_t length);
+__LINK_C void console_print_bytes(uint8_t* bytes, uint16_t length);
 __LINK_C void console_print(char* string);
 
+// the output is buffered in a fifo of FRAMEWORK_CONSOLE_TX_BUFFER_SIZE bytes and transmitted by a task (or in the RTT up
+// buffer when FRAMEWORK_CONSOLE_ON_RTT, read by the J-Link). When the fifo is full the output of a print is dropped
+// completely (the default), or with blocking enabled the oldest output is first transmitted synchronously to make room,
+// so no byte is lost. Blocking waits for the UART (or the J-Link), it should not be enabled when printing from interrupt
+// or atomic context
+__LINK_C void console_set_tx_blocking(bool blocking);
+// the number of bytes dropped because the fifo was full, saturates at UINT32_MAX
+__LINK_C uint32_t console_get_tx_dropped_count();
+__LINK_C void console_reset_tx_dropped_count();
+// the output encoded in place: returns a contiguous area of length bytes of the fifo, to be completed by
+// console_tx_commit() with the number of bytes written. Nothing else should be printed meanwhile. Returns NULL when the
+// fifo has no such room (with blocking enabled, after transmitting the older output) or when FRAMEWORK_CONSOLE_ON_RTT,
+// the caller prints a copy instead then
+__LINK_C uint8_t* console_tx_reserve(uint16_t length);
+__LINK_C void console_tx_commit(uint16_t length);
+
 __LINK_C void console_set_rx_interrupt_callback(uart_rx_inthandler_t handler);
 __LINK_C void console_rx_interrupt_enable();
 
@@ -53,6 +69,11 @@ __LINK_C void console_rx_interrupt_enable();
 #define console_print_byte(...)                ((void)0)
 #define console_print_bytes(...)               ((void)0)
 #define console_print(...)                     ((void)0)
+#define console_set_tx_blocking(...)           ((void)0)
+#define console_get_tx_dropped_count()         0
+#define console_reset_tx_dropped_count()       ((void)0)
+#define console_tx_reserve(...)                NULL
+#define console_tx_commit(...)                 ((void)0)
 
 #define console_set_rx_interrupt_callback(...) ((void)0)
 #define console_rx_interrupt_enable()          ((void)0)
@@ -25,6 +25,20 @@
 
 #include <stdint.h>
 
-uint16_t crc_calculate(uint8_t* data, uint8_t length);
+/*
+ * The CRC-16 of D7A frames (polynomial 0x1021, initial value 0xffff, no final XOR). The lookup table (per nibble, per byte
+ * or slicing by 4 bytes) is selected with FRAMEWORK_CRC_TABLE.
+ *
+ * The incremental API keeps no state of its own, the CRC of data given in parts is
+ * crc16_final(crc16_update(crc16_update(crc16_init(), part1, length1), part2, length2)).
+ */
+uint16_t crc16_init();
+uint16_t crc16_update(uint16_t crc, const uint8_t* data, uint16_t length);
+uint16_t crc16_final(uint16_t crc);
+
+uint16_t crc_calculate(const uint8_t* data, uint16_t length);
+
+// continues crc over data following the data it was calculated over, starting from 0xffff gives the same result as crc_calculate()
+uint16_t crc_update(uint16_t crc, const uint8_t* data, uint16_t length);
 
 #endif /* CRC_H_ */
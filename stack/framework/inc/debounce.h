@@ -0,0 +1,81 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file debounce.h
+ * \addtogroup debounce
+ * \ingroup framework
+ * @{
+ * \brief Debounces the level of GPIO pins connected to contacts, like buttons or reed switches.
+ *
+ * The first edge of a bouncing contact disables the interrupt of the pin, the pin is sampled once its settle time
+ * elapsed and the interrupt is enabled again. The bounces therefore cost a single interrupt and a single timer
+ * event, and the callback of the pin is called once per change of the debounced level, from a task. An edge during
+ * the sampling starts a new settle time.
+ *
+ * The maximum number of debounced pins is set by the 'FRAMEWORK_DEBOUNCE_MAX_PINS' CMake option.
+ */
+#ifndef __DEBOUNCE_H_
+#define __DEBOUNCE_H_
+
+#include "link_c.h"
+#include "types.h"
+#include "errors.h"
+#include "hwgpio.h"
+#include "timer.h"
+
+/*! \brief Called from a task when the debounced level of a pin changed
+ *
+ * \param pin_id	The pin of which the level changed
+ * \param level		The debounced level of the pin
+ */
+typedef void (*debounce_callback_t)(pin_id_t pin_id, bool level);
+
+/*! \brief Start debouncing a GPIO pin
+ *
+ * The pin should be configured as an input by the platform, this function configures and enables its interrupt.
+ *
+ * \param pin_id	The pin to debounce
+ * \param event_mask	The changes to report: GPIO_RISING_EDGE, GPIO_FALLING_EDGE or both
+ * \param settle_time	The time the contact takes to settle after its first edge, in timer ticks
+ * \param callback	The function to call when the debounced level changed as selected by event_mask
+ *
+ * \return error_t	SUCCESS if the pin is debounced
+ *			EINVAL if the callback is NULL, the event_mask is not valid or the settle_time is 0
+ *			EALREADY if the pin is debounced already
+ *			ENOMEM if FRAMEWORK_DEBOUNCE_MAX_PINS pins are debounced already
+ *			The errors of hw_gpio_configure_interrupt() otherwise
+ */
+__LINK_C error_t debounce_register_pin(pin_id_t pin_id, uint8_t event_mask, timer_tick_t settle_time,
+                                       debounce_callback_t callback);
+
+/*! \brief Stop debouncing a GPIO pin, its interrupt is disabled
+ *
+ * \return error_t	SUCCESS if the pin is no longer debounced
+ *			EALREADY if the pin was not debounced
+ */
+__LINK_C error_t debounce_unregister_pin(pin_id_t pin_id);
+
+/*! \brief Get the debounced level of a pin, as last reported
+ *
+ * \return bool		The debounced level, false when the pin is not debounced
+ */
+__LINK_C bool debounce_get_level(pin_id_t pin_id);
+
+#endif // __DEBOUNCE_H_
+
+/** @}*/
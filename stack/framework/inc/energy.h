@@ -0,0 +1,103 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file energy.h
+ * \addtogroup energy
+ * \ingroup framework
+ * @{
+ * \brief Accounts the time spent in each state of the radio and of the MCU, to estimate the energy consumption.
+ *
+ * The radio drivers report their state changes, the scheduler reports the low power modes it enters. The time in
+ * each state is accumulated in timer ticks since the last reset, the energy follows from the currents of the
+ * hardware in these states. The time the MCU is active is the elapsed time minus the time spent in low power modes,
+ * the interrupts which wake the MCU up are accounted to the low power mode.
+ *
+ * The accounting is globally enabled or disabled by setting or clearing the 'FRAMEWORK_ENERGY_ACCOUNTING_ENABLED'
+ * CMake option.
+ */
+#ifndef __ENERGY_H_
+#define __ENERGY_H_
+
+#include "link_c.h"
+#include "framework_defs.h"
+#include "types.h"
+
+/*! \brief The low power modes accounted separately, deeper modes are accounted to the last one */
+#define ENERGY_LOWPOWER_MODE_COUNT 5
+
+/*! \brief The states of the radio as accounted */
+typedef enum
+{
+    ENERGY_RADIO_IDLE = 0,  /**< Neither receiving nor transmitting, the radio is idle, asleep or off */
+    ENERGY_RADIO_RX = 1,    /**< Receiving or listening for a frame */
+    ENERGY_RADIO_TX = 2     /**< Transmitting, accounted per EIRP as well */
+} energy_radio_state_t;
+
+/*! \brief The transmission time at an EIRP */
+typedef struct
+{
+    int8_t eirp;            /**< In dBm */
+    uint32_t time;          /**< In timer ticks */
+} energy_tx_time_t;
+
+/*! \brief The times spent in each state since the last reset, in timer ticks */
+typedef struct
+{
+    uint32_t elapsed;                                       /**< The time since the last reset */
+    uint32_t cpu_active;                                    /**< The time the MCU did not spend in a low power mode */
+    uint32_t cpu_sleep[ENERGY_LOWPOWER_MODE_COUNT];         /**< The time spent per low power mode */
+    uint32_t radio[3];                                      /**< The time spent per energy_radio_state_t */
+    uint8_t tx_eirp_count;                                  /**< The number of used entries in tx */
+    energy_tx_time_t tx[FRAMEWORK_ENERGY_TX_EIRP_COUNT];    /**< The TX time per EIRP, in the order in which
+                                                                 the EIRPs were first used. The EIRPs beyond
+                                                                 FRAMEWORK_ENERGY_TX_EIRP_COUNT are only accounted
+                                                                 in the total TX time */
+} energy_stats_t;
+
+#ifdef FRAMEWORK_ENERGY_ACCOUNTING_ENABLED
+
+/*! \brief Account a change of the state of the radio, to be called by the radio drivers
+ *
+ * This can be called from interrupt context.
+ *
+ * \param state     The new state
+ * \param eirp      The EIRP of the transmission, only used for ENERGY_RADIO_TX
+ */
+__LINK_C void energy_radio_state_changed(energy_radio_state_t state, int8_t eirp);
+
+/*! \brief Account the MCU entering a low power mode, to be called right before hw_enter_lowpower_mode() */
+__LINK_C void energy_cpu_sleep(uint8_t mode);
+
+/*! \brief Account the MCU returning from the low power mode entered after energy_cpu_sleep() */
+__LINK_C void energy_cpu_wakeup();
+
+/*! \brief Get the times spent in each state since the last reset, up to now */
+__LINK_C void energy_get_stats(energy_stats_t* stats);
+
+/*! \brief Restart the accounting from now, the radio keeps its current state */
+__LINK_C void energy_reset_stats();
+
+#else
+    #define energy_radio_state_changed(...) ((void)0)
+    #define energy_cpu_sleep(...) ((void)0)
+    #define energy_cpu_wakeup() ((void)0)
+#endif
+
+#endif /* __ENERGY_H_ */
+
+/** @}*/
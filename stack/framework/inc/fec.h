@@ -30,23 +30,92 @@ extern "C" {
 #include <stdbool.h>
 #include <stdint.h>
 
-typedef struct {
-	uint8_t cost;
-	uint16_t path;
-} VITERBIPATH;
+#define FEC_TRACEBACK_LENGTH 16 // symbols, the 2 decoded bytes of the path
 
+/*! \brief The state of the decoding of one frame, every frame decoded concurrently (by another radio) has its own decoder
+ *
+ * The path metrics of the 8 Viterbi states are packed a byte per state in 2 words (states 0-3 and 4-7, the lowest state in
+ * the LSB), the survivor paths are kept as one decision bit per state and symbol.
+ */
 typedef struct {
+	uint32_t metrics[2];
+	uint8_t decisions[FEC_TRACEBACK_LENGTH];
+	uint8_t symbol_count;
 	uint8_t path_size;
-	VITERBIPATH* old;
-	VITERBIPATH* new;
-	VITERBIPATH states1[8];
-	VITERBIPATH states2[8];
-} VITERBISTATE;
+	uint8_t* output;
+	uint8_t output_length;
+	uint16_t encoded_length;
+	uint8_t processed_bytes;
+	uint16_t fec_processed_bytes;
+	uint8_t pending_input[4]; // encoded bytes of an incremental decode which do not fill a 4 byte block yet
+	uint8_t pending_input_count;
+} fec_decoder_t;
+
+/*! \brief The state of the encoding of a frame given in parts, the encoded bytes are produced per 4 byte block */
+typedef struct {
+	uint8_t state;
+	uint8_t pending_input; // the first byte of a block of which the second one was not given yet
+	bool has_pending_input;
+} fec_encoder_t;
 
 //void print_array(uint8_t* buffer, uint8_t length);
 
+/*! \brief Encodes the data in place, the buffer should hold fec_calculate_encoded_length(nbytes) bytes
+ *
+ * \return	The number of encoded bytes
+ */
 uint16_t fec_encode(uint8_t *data, uint16_t nbytes);
+
+/*! \brief Encodes the input into the output buffer, which should hold fec_calculate_encoded_length(nbytes) bytes
+ *
+ * The encoder keeps no state between calls. The input may only overlap the end of the output, as done by fec_encode().
+ *
+ * \return	The number of encoded bytes
+ */
+uint16_t fec_encode_to(const uint8_t* input, uint16_t nbytes, uint8_t* output);
+
+/*! \brief Starts encoding a frame of which the bytes are supplied incrementally using fec_encoder_feed() */
+void fec_encoder_init(fec_encoder_t* encoder);
+
+/*! \brief Encodes the next bytes of the frame, a last odd byte is kept until the next call
+ *
+ * As for fec_encode_to(), the input may only overlap the end of the output.
+ *
+ * \return	The number of encoded bytes written to the output, a multiple of 4
+ */
+uint16_t fec_encoder_feed(fec_encoder_t* encoder, const uint8_t* input, uint16_t nbytes, uint8_t* output);
+
+/*! \brief Ends the frame with the trellis terminator, encoding a pending odd byte
+ *
+ * \return	The number of encoded bytes written to the output, 4 or 8
+ */
+uint16_t fec_encoder_finish(fec_encoder_t* encoder, uint8_t* output);
+
+/*! \brief The length of nbytes of data after FEC encoding, including the trellis terminator */
+uint16_t fec_calculate_encoded_length(uint16_t nbytes);
 uint8_t fec_decode_packet(uint8_t* data, uint8_t packet_length, uint8_t output_length);
+
+/*! \brief Starts decoding a frame of which the encoded bytes are supplied incrementally using fec_decoder_feed()
+ *
+ * \param output			The buffer receiving the decoded bytes, it may hold the bytes supplied later on
+ * \param output_length	The number of decoded bytes to write, bytes decoded beyond (like the trellis terminator) are dropped
+ * \param packet_length	The number of encoded bytes of the frame
+ */
+void fec_decoder_init(fec_decoder_t* decoder, uint8_t* output, uint8_t output_length, uint16_t packet_length);
+
+/*! \brief Decodes the next encoded bytes of the frame, for example the bytes read from the radio FIFO in an ISR
+ *
+ * The bytes are decoded per 4 byte block, the remainder is kept until the next call.
+ *
+ * \return	The number of decoded bytes written to the output buffer so far
+ */
+uint8_t fec_decoder_feed(fec_decoder_t* decoder, const uint8_t* data, uint8_t length);
+
+/*! \brief Ends the decoding of the frame
+ *
+ * \return	false when less than packet_length encoded bytes were fed, or a block of 4 bytes is incomplete
+ */
+bool fec_decoder_finish(fec_decoder_t* decoder);
 uint16_t fec_calculated_decoded_length(uint8_t packet_length);
 
 #ifdef __cplusplus
@@ -43,6 +43,20 @@ typedef struct {
     uint8_t* buffer;        /**< The buffer where the data is stored*/
 } fifo_t;
 
+/**
+ * @brief The state of a FIFO which is safe to use without start_atomic() between a single producer and a single consumer,
+ * for example an UART interrupt handler putting bytes and a task popping them.
+ *
+ * The head index is only written by the consumer and the tail index only by the producer. One byte of the buffer is kept free
+ * to distinguish a full from an empty FIFO.
+ **/
+typedef struct {
+    volatile uint16_t head_idx; /**< The offset in buffer to the head of the FIFO, only written by the consumer */
+    volatile uint16_t tail_idx; /**< The offset in buffer to the tail of the FIFO, only written by the producer */
+    uint16_t buffer_size;       /**< The size of the buffer, the FIFO can contain one byte less */
+    uint8_t* buffer;            /**< The buffer where the data is stored*/
+} spsc_fifo_t;
+
 /**
  * @brief Initializes the fifo.
  * @param fifo          Fifo state, initialized by this function
@@ -67,7 +81,7 @@ void fifo_init_filled(fifo_t *fifo, uint8_t *buffer, uint16_t filled_size, uint1
  * @param len   Number of bytes to put in the FIFO
  * @returns SUCCESS or ESIZE when data would overwrite head of FIFO
  */
-error_t fifo_put(fifo_t* fifo, uint8_t* data, uint16_t len);
+error_t fifo_put(fifo_t* fifo, const uint8_t* data, uint16_t len);
 
 /**
  * @brief Put byte in to the FIFO
@@ -83,7 +97,7 @@ error_t fifo_put_byte(fifo_t* fifo, uint8_t byte);
  * @param buffer    buffer to be filled
  * @param offset    offset starting from head
  * @param len       length in number of bytes to read
- * @returns SUCCESS or ESIZE when len > max_size or len > current size
+ * @returns SUCCESS or ESIZE when offset + len > current size
  */
 error_t fifo_peek(fifo_t* fifo, uint8_t* buffer, uint16_t offset, uint16_t len);
 
@@ -96,6 +110,33 @@ error_t fifo_peek(fifo_t* fifo, uint8_t* buffer, uint16_t offset, uint16_t len);
  */
 error_t fifo_pop(fifo_t* fifo, uint8_t* buffer, uint16_t len);
 
+/**
+ * @brief Returns the longest contiguous span of data at the head of the FIFO, so it can be parsed in place without copying.
+ * The span ends where the data wraps around the end of the buffer, call fifo_skip() afterwards with the number of bytes processed.
+ * @param fifo      Pointer to the fifo object
+ * @param data      Set to point to the head of the FIFO
+ * @return Number of bytes which can be read from data
+ */
+uint16_t fifo_get_contiguous_readable(fifo_t* fifo, uint8_t** data);
+
+/**
+ * @brief Returns the longest contiguous free span at the tail of the FIFO, so data can be encoded in place without copying.
+ * The span ends where the free space wraps around the end of the buffer, call fifo_commit() afterwards with the number of
+ * bytes written.
+ * @param fifo      Pointer to the fifo object
+ * @param data      Set to point to the tail of the FIFO
+ * @return Number of bytes which can be written to data
+ */
+uint16_t fifo_get_contiguous_writable(fifo_t* fifo, uint8_t** data);
+
+/**
+ * @brief Adds the bytes written in place at the tail of the FIFO, see fifo_get_contiguous_writable()
+ * @param fifo      Pointer to the fifo object
+ * @param len       number of bytes written
+ * @returns SUCCESS or ESIZE if len exceeds the contiguous free span
+ */
+error_t fifo_commit(fifo_t* fifo, uint16_t len);
+
 /**
  * @brief Skips bits from the FIFO
  * @param fifo      Pointer to the fifo object
@@ -124,6 +165,55 @@ uint16_t fifo_get_size(fifo_t* fifo);
  */
 bool fifo_is_full(fifo_t* fifo);
 
+/**
+ * @brief Initializes the single producer, single consumer fifo.
+ * @param fifo          Fifo state, initialized by this function
+ * @param buffer        The buffer used for the fifo
+ * @param buffer_size   The size of buffer, the FIFO can contain buffer_size - 1 bytes
+ */
+void spsc_fifo_init(spsc_fifo_t* fifo, uint8_t* buffer, uint16_t buffer_size);
+
+/**
+ * @brief Put bytes in to the FIFO, to be called by the producer only. The data is copied in at most two memcpy() chunks.
+ * @returns SUCCESS or ESIZE when there is not enough space left
+ */
+error_t spsc_fifo_put(spsc_fifo_t* fifo, uint8_t* data, uint16_t len);
+
+/**
+ * @brief Put byte in to the FIFO, to be called by the producer only
+ * @returns SUCCESS or ESIZE when the FIFO is full
+ */
+error_t spsc_fifo_put_byte(spsc_fifo_t* fifo, uint8_t byte);
+
+/**
+ * @brief Peek at the FIFO contents without popping, to be called by the consumer only. See fifo_peek()
+ * @returns SUCCESS or ESIZE when offset + len > current size
+ */
+error_t spsc_fifo_peek(spsc_fifo_t* fifo, uint8_t* buffer, uint16_t offset, uint16_t len);
+
+/**
+ * @brief Read and pop bytes from the FIFO, to be called by the consumer only
+ * @returns SUCCESS or ESIZE if len > current size
+ */
+error_t spsc_fifo_pop(spsc_fifo_t* fifo, uint8_t* buffer, uint16_t len);
+
+/**
+ * @brief Pop bytes from the FIFO without reading them, to be called by the consumer only
+ * @returns SUCCESS or ESIZE if len > current size
+ */
+error_t spsc_fifo_skip(spsc_fifo_t* fifo, uint16_t len);
+
+/**
+ * @brief Returns the longest contiguous span of data at the head of the FIFO, to be called by the consumer only. See fifo_get_contiguous_readable()
+ */
+uint16_t spsc_fifo_get_contiguous_readable(spsc_fifo_t* fifo, uint8_t** data);
+
+/**
+ * @brief Returns the number of bytes currently in the FIFO. Can be called by both sides, but the result might be
+ * outdated by the time it is used by the side which did not call it.
+ */
+uint16_t spsc_fifo_get_size(spsc_fifo_t* fifo);
+
 #endif // FIFO_H
 
 /** @}*/
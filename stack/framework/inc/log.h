@@ -29,6 +29,19 @@
  * Logging can be globally enabled or disabled by setting or clearing the 
  * 'FRAMEWORK_LOG_ENABLED' CMake option.
  *
+ * Formatting and outputting a log takes long enough to disturb the timing of the stack. With the
+ * 'FRAMEWORK_LOG_DEFERRED' CMake option log_print_stack_string() only stores the address of the format
+ * string and the raw arguments in a ring buffer, a task of the lowest priority outputs them as binary
+ * records. tools/log_decoder.py formats these using the format strings in the ELF file of the firmware,
+ * so %s arguments are only shown when they point to constant strings.
+ *
+ * The stack logs have a level. The debug logs (log_print_stack_string(), used by the DPRINT() macros of the stack)
+ * are only compiled in for the layers of which the '*_LOG_ENABLED' option is set, the info, warning and error logs
+ * (log_stack_info(), log_stack_warning() and log_stack_error()) for all layers. The levels above
+ * 'FRAMEWORK_LOG_LEVEL' are compiled out completely, so the warnings can be kept on in production builds.
+ * At runtime the output can be restricted further per layer and level, see log_set_level() and
+ * log_set_layer_enabled(), which the shell exposes as ATL.
+ *
  * \author maarten.weyn@uantwerpen.be
  * \author glenn.ergeerts@uantwerpen.be
  * \author daniel.vandenakker@uantwerpen.be
@@ -54,6 +67,13 @@ typedef enum
     LOG_STACK_FWK = 0x10
 } log_stack_layer_t; // TODO stack specific, move to stack component?
 
+/*! \brief The levels of the logs, as defines so FRAMEWORK_LOG_LEVEL can be compared by the preprocessor */
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
 #ifdef FRAMEWORK_LOG_ENABLED
 
 /*! \brief Reset the log counter back to zero */
@@ -63,18 +83,74 @@ __LINK_C void log_counter_reset();
  * format specifiers. */
 __LINK_C void log_print_string(char* format,...);
 
+#if FRAMEWORK_LOG_LEVEL >= LOG_LEVEL_DEBUG
 /*! \brief Log a string from a specific stack layer, which can be optionally formatted using printf() style
- * format specifiers. Note: this is only to be used from within stack code, not from application level code. */
+ * format specifiers. Note: this is only to be used from within stack code, not from application level code.
+ * The log has level LOG_LEVEL_DEBUG. */
 __LINK_C void log_print_stack_string(log_stack_layer_t type, char* format, ...);
+#else
+    #define log_print_stack_string(...) ((void)0)
+#endif
+
+/*! \brief Log a string of the given level from a specific stack layer, use the log_stack_*() macros instead */
+__LINK_C void log_print_stack_level(log_stack_layer_t type, uint8_t level, char* format, ...);
+
+/*! \brief Set the highest level of the logs which are output, as far as they are compiled in (see FRAMEWORK_LOG_LEVEL).
+ * All levels are output by default. */
+__LINK_C void log_set_level(uint8_t level);
+
+/*! \brief Get the highest level of the logs which are output */
+__LINK_C uint8_t log_get_level();
+
+/*! \brief Enable or disable the output of the logs of a stack layer, all layers are enabled by default */
+__LINK_C void log_set_layer_enabled(log_stack_layer_t type, bool enabled);
+
+/*! \brief Check whether the logs of a stack layer and level are output */
+__LINK_C bool log_is_enabled(log_stack_layer_t type, uint8_t level);
 
 /*! \brief Log raw data */
 __LINK_C void log_print_data(uint8_t* message, uint32_t length);
 
+#ifdef FRAMEWORK_LOG_DEFERRED
+/*! \brief Prepare the ring buffer of the deferred logs, the logs before are dropped */
+__LINK_C void log_init();
+
+/*! \brief Output the deferred logs now, for example before a reset. Not to be called from interrupt context */
+__LINK_C void log_flush();
+#else
+    #define log_init() ((void)0)
+    #define log_flush() ((void)0)
+#endif
+
 #else
     #define log_counter_reset() ((void)0)
     #define log_print_string(...) ((void)0)
     #define log_print_stack_string(...) ((void)0)
     #define log_print_data(...) ((void)0)
+    #define log_init() ((void)0)
+    #define log_flush() ((void)0)
+    #define log_set_level(...) ((void)0)
+    #define log_get_level() LOG_LEVEL_NONE
+    #define log_set_layer_enabled(...) ((void)0)
+    #define log_is_enabled(...) false
+#endif
+
+#if defined(FRAMEWORK_LOG_ENABLED) && FRAMEWORK_LOG_LEVEL >= LOG_LEVEL_ERROR
+    #define log_stack_error(type, ...) log_print_stack_level(type, LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+    #define log_stack_error(...) ((void)0)
+#endif
+
+#if defined(FRAMEWORK_LOG_ENABLED) && FRAMEWORK_LOG_LEVEL >= LOG_LEVEL_WARNING
+    #define log_stack_warning(type, ...) log_print_stack_level(type, LOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+    #define log_stack_warning(...) ((void)0)
+#endif
+
+#if defined(FRAMEWORK_LOG_ENABLED) && FRAMEWORK_LOG_LEVEL >= LOG_LEVEL_INFO
+    #define log_stack_info(type, ...) log_print_stack_level(type, LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+    #define log_stack_info(...) ((void)0)
 #endif
 
 #endif /* __LOG_H_ */
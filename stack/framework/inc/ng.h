@@ -37,12 +37,34 @@ enum
 {
     __ng_max_nodes__ = NODE_GLOBALS_MAX_NODES,
 };
-extern size_t __ng_node_id__;
+// With NODE_GLOBALS_TLS the current node is a property of the thread, so a simulator can run the nodes in parallel,
+// each thread selecting its own node with set_node_global_id()
+#if defined(NODE_GLOBALS_TLS)
+#define NG_THREAD_LOCAL	__thread
+#else
+#define NG_THREAD_LOCAL
+#endif
+
+extern NG_THREAD_LOCAL size_t __ng_node_id__;
 __LINK_C void set_node_global_id(size_t node_id);
 static inline size_t get_node_global_id() { assert(__ng_node_id__ < __ng_max_nodes__); return __ng_node_id__; }
 
+#if defined(NODE_GLOBALS_BLOCKS)
+#include <stdint.h>
+
+// The node globals of the whole stack are placed in one section by the linker, which is the layout of the state of a
+// node. Every node gets a copy of this block, initialized from the section by the first set_node_global_id(). NG()
+// addresses the variable at its offset in the block of the current node, through the offset which
+// set_node_global_id() sets, so the state of a node is contiguous and an access costs an add instead of a call.
+// This needs a linker which defines __start_ and __stop_ symbols for the section, like the GNU linkers on ELF
+extern NG_THREAD_LOCAL uintptr_t __ng_node_offset__;
+
+#define NG(var)			(*(__typeof__(__ng_glob_ ## var ## __)*)((uintptr_t)&__ng_glob_ ## var ## __ + __ng_node_offset__))
+#define NGDEF(var)		__attribute__((section("ng_node_globals"))) __ng_glob_ ## var ## __
+#else
 #define NG(var)			(__ng_glob_ ## var ## __[(get_node_global_id())])
 #define NGDEF(var)		(__ng_glob_ ## var ## __[__ng_max_nodes__])
+#endif
 
 #else
 
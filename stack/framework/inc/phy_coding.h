@@ -0,0 +1,125 @@
+/*! \file phy_coding.h
+ *
+
+ *  \copyright (C) Copyright 2017 University of Antwerp and others (http://oss-7.cosys.be)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef PHY_CODING_H_
+#define PHY_CODING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fec.h"
+#include "pn9.h"
+
+/*
+ * The coding of a D7A frame in software: on transmission the CRC-16 is appended, the frame is FEC encoded and the (encoded)
+ * bytes are whitened, reception undoes this in the reverse order. A frame is coded in a single pass, per block of a few
+ * bytes, instead of one pass over the whole frame per step. The radio drivers select the stages their transceiver does
+ * not apply itself.
+ */
+typedef enum
+{
+    PHY_STAGE_CRC = 1 << 0, // the CRC of the frame is written to (TX) or compared with (RX) its last 2 bytes
+    PHY_STAGE_FEC = 1 << 1,
+    PHY_STAGE_PN9 = 1 << 2,
+} phy_stage_t;
+
+typedef struct
+{
+    uint8_t stages;
+    uint16_t crc;
+    fec_encoder_t fec;
+    pn9_t pn9;
+} phy_encoder_t;
+
+typedef struct
+{
+    uint8_t stages;
+    uint8_t* output;
+    uint16_t frame_length;
+    uint16_t decoded_length; // the bytes of the frame in the output buffer so far
+    uint16_t crc_length;     // the bytes of the frame added to the CRC so far
+    uint16_t crc;
+    fec_decoder_t fec;
+    pn9_t pn9;
+} phy_decoder_t;
+
+/*! \brief The number of bytes on air of a frame of length bytes, the CRC included */
+uint16_t phy_calculate_encoded_length(uint8_t stages, uint16_t length);
+
+/*! \brief Codes a frame of length bytes in place, of which the last 2 receive the CRC with PHY_STAGE_CRC
+ *
+ * The buffer should hold phy_calculate_encoded_length(stages, length) bytes.
+ *
+ * \return	The number of encoded bytes
+ */
+uint16_t phy_encode_frame(uint8_t stages, uint8_t* data, uint16_t length);
+
+/*! \brief Decodes a frame of frame_length bytes, the CRC included, from encoded_length bytes in place
+ *
+ * \return	false when the frame is incomplete or, with PHY_STAGE_CRC, its CRC is invalid
+ */
+bool phy_decode_frame(uint8_t stages, uint8_t* data, uint16_t encoded_length, uint16_t frame_length);
+
+/*! \brief Starts coding a frame of which the bytes are supplied incrementally using phy_encoder_feed() */
+void phy_encoder_init(phy_encoder_t* encoder, uint8_t stages);
+
+/*! \brief Codes the next bytes of the frame, without its CRC
+ *
+ * The output should hold phy_calculate_encoded_length(stages, length) bytes. As for fec_encode_to(), the input may only
+ * overlap the end of the output, or be the output itself without PHY_STAGE_FEC.
+ *
+ * \return	The number of encoded bytes written to the output
+ */
+uint16_t phy_encoder_feed(phy_encoder_t* encoder, const uint8_t* data, uint16_t length, uint8_t* output);
+
+/*! \brief Ends the frame with its CRC (PHY_STAGE_CRC) and the trellis terminator (PHY_STAGE_FEC)
+ *
+ * \return	The number of encoded bytes written to the output, at most 10
+ */
+uint16_t phy_encoder_finish(phy_encoder_t* encoder, uint8_t* output);
+
+/*! \brief Starts decoding a frame of which the encoded bytes are supplied incrementally using phy_decoder_feed()
+ *
+ * \param output			The buffer receiving the frame_length bytes of the frame, bytes decoded beyond are dropped
+ * \param encoded_length	The number of encoded bytes of the frame
+ */
+void phy_decoder_init(phy_decoder_t* decoder, uint8_t stages, uint8_t* output, uint16_t frame_length,
+                      uint16_t encoded_length);
+
+/*! \brief Decodes the next encoded bytes of the frame, for example the bytes read from the radio FIFO in an ISR
+ *
+ * The data may be the output buffer itself, at or beyond the bytes decoded so far.
+ *
+ * \return	The number of bytes of the frame in the output buffer so far
+ */
+uint16_t phy_decoder_feed(phy_decoder_t* decoder, const uint8_t* data, uint16_t length);
+
+/*! \brief Decodes the first available bytes of the output buffer, which were read into it directly
+ *
+ * Only frames without PHY_STAGE_FEC can be read in place. The bytes decoded before are skipped.
+ */
+void phy_decoder_update(phy_decoder_t* decoder, uint16_t available);
+
+/*! \brief Ends the decoding of the frame
+ *
+ * \return	false when the frame is incomplete or, with PHY_STAGE_CRC, its CRC is invalid
+ */
+bool phy_decoder_finish(phy_decoder_t* decoder);
+
+#endif /* PHY_CODING_H_ */
@@ -25,6 +25,20 @@
 
 #define PN9_INITIALIZER (0x1ff)
 
+/*
+ * The state of the whitening of a frame given in parts, for example per FIFO chunk. Whitening is its own inverse.
+ */
+typedef struct
+{
+    uint16_t lfsr;
+    uint16_t position; // the bytes of the frame whitened so far
+} pn9_t;
+
+void pn9_init(pn9_t* pn9);
+
+// whitens (or dewhitens) the next length bytes of the frame
+void pn9_whiten(pn9_t* pn9, uint8_t* data, uint16_t length);
+
 /*
  * PN9 Encoder used for data whitening
  */
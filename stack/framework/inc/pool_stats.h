@@ -0,0 +1,84 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file pool_stats.h
+ * @addtogroup pool_stats
+ * @ingroup framework
+ * @{
+ * @brief Usage statistics of a statically sized pool (packets, commands, timers, ...), to size the pools from field data.
+ *
+ * The helpers below do not disable interrupts, they should be called from the context which already protects the pool.
+ */
+
+#ifndef POOL_STATS_H
+#define POOL_STATS_H
+
+#include "types.h"
+
+/**
+ * @brief The usage statistics of a pool
+ **/
+typedef struct {
+    uint8_t size;                   /**< The number of elements in the pool */
+    uint8_t in_use;                 /**< The number of elements currently in use */
+    uint8_t high_water_mark;        /**< The maximum number of elements which were in use at the same time */
+    uint16_t alloc_failed_count;    /**< The number of allocations which failed because the pool was exhausted, saturates at UINT16_MAX */
+} pool_stats_t;
+
+static inline void pool_stats_init(pool_stats_t* stats, uint8_t size)
+{
+    *stats = (pool_stats_t){ .size = size };
+}
+
+static inline void pool_stats_set_in_use(pool_stats_t* stats, uint8_t in_use)
+{
+    stats->in_use = in_use;
+    if(in_use > stats->high_water_mark)
+        stats->high_water_mark = in_use;
+}
+
+static inline void pool_stats_alloc(pool_stats_t* stats)
+{
+    pool_stats_set_in_use(stats, stats->in_use + 1);
+}
+
+static inline void pool_stats_free(pool_stats_t* stats)
+{
+    if(stats->in_use > 0)
+        stats->in_use--;
+}
+
+static inline void pool_stats_alloc_failed(pool_stats_t* stats)
+{
+    if(stats->alloc_failed_count < UINT16_MAX)
+        stats->alloc_failed_count++;
+}
+
+/**
+ * @brief Restarts the high water mark from the current usage and clears the failure count
+ */
+static inline void pool_stats_reset(pool_stats_t* stats)
+{
+    stats->high_water_mark = stats->in_use;
+    stats->alloc_failed_count = 0;
+}
+
+#endif // POOL_STATS_H
+
+/** @}*/
@@ -0,0 +1,51 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ramfunc.h
+ * @addtogroup ramfunc
+ * @ingroup framework
+ * @{
+ * @brief Placement of the hot paths of the stack in RAM, which has no wait states contrary to the flash.
+ *
+ * When FRAMEWORK_HOT_PATHS_IN_RAM is enabled the functions marked __HOT_RAMFUNC are linked in the .ram section and
+ * the (const) lookup tables marked __HOT_RAMDATA in the .data section, both copied from flash to RAM by the startup
+ * code (see the linker scripts of the EFM32, EZR32 and STM32F4 chips). This costs their size in RAM, in return for
+ * an execution time which does not depend on the flash wait states and the flash cache. On other MCUs, or when
+ * disabled, the attributes are empty.
+ *
+ * The functions are called through a long branch veneer of the linker, and calling flash functions from them costs
+ * one as well, so only leaf functions or functions calling other hot functions are worth marking.
+ */
+
+#ifndef RAMFUNC_H
+#define RAMFUNC_H
+
+#include "framework_defs.h"
+
+#if defined(FRAMEWORK_HOT_PATHS_IN_RAM) && defined(__arm__)
+  #define __HOT_RAMFUNC __attribute__((section(".ram")))
+  #define __HOT_RAMDATA __attribute__((section(".data.hot")))
+#else
+  #define __HOT_RAMFUNC
+  #define __HOT_RAMDATA
+#endif
+
+#endif // RAMFUNC_H
+
+/** @}*/
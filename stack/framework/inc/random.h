@@ -31,21 +31,31 @@
 
 /*! \brief Get a random number.
  * 
- * The exact implementation of the random number generator is platform specific. On (real)
- * hardware this call most likely forwards to the rand() function of the C-library.
- * In a simulation environment however, this call forwards to a random number generator of the
- * simulator itself to ensure that tests are repeatable
+ * The numbers come from a xoroshiro64** generator of which every node (see ng.h) has its own state, so the sequences
+ * are repeatable for a given seed. All bits are usable, also the low bits taken by a modulo.
  *
  * \return uint32_t	a semi-random number between 0 and 2^32-1
  */
 __LINK_C uint32_t get_rnd();
 
-/*! \brief Set the seed for the random nuber generator
+/*! \brief Set the seed for the random number generator
+ *
+ * The framework seeds it with hw_get_unique_id() at boot, so nodes booted at the same time do not back off alike.
  *
  * \param	seed	The seed for the random number generator
  *
  */
-__LINK_C void set_rng_seed(unsigned int seed);
+__LINK_C void set_rng_seed(uint64_t seed);
+
+/*! \brief Mix entropy into the state of the random number generator
+ *
+ * Meant for the low bits of noisy measurements, such as the RSSI of an idle channel or a hardware RNG, so the
+ * sequence also differs between boots of the same node.
+ *
+ * \param	entropy	The entropy, its bits do not need to be uniform
+ *
+ */
+__LINK_C void add_rng_entropy(uint32_t entropy);
 
 
 #endif // __RANDOM_H_
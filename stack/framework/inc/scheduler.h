@@ -31,12 +31,44 @@
 #include "link_c.h"
 #include "types.h"
 #include "errors.h"
+#include "framework_defs.h"
+#include "pool_stats.h"
 
 /*! \brief Type definition for tasks
  *
  */
 typedef void (*task_t)();
 
+/*! \brief Type definition for task handles
+ *
+ * A task handle identifies a registered task directly, without the lookup by function pointer
+ * the task_t based API has to do. Handles are obtained by sched_register_task_handle() or
+ * sched_get_task_handle() and remain valid for the lifetime of the application.
+ */
+typedef uint8_t task_handle_t;
+
+/*! \brief Type definition for deferred calls
+ *
+ * Contrary to tasks, deferred calls receive an argument and do not need to be registered.
+ * See sched_post_call().
+ */
+typedef void (*deferred_call_t)(void* arg);
+
+/*! \brief Type definition for the steps of a job, see sched_post_job()
+ *
+ * A step does a bounded amount of the work of the job and returns true when work is left, it is then
+ * called again.
+ */
+typedef bool (*job_step_t)(void* state);
+
+/*! \brief A long computation executed by steps, see sched_post_job() */
+typedef struct
+{
+	job_step_t step;	/**< The step of the job, called until it returns false */
+	void* state;		/**< The argument of the step, the state the job resumes from */
+	uint8_t priority;	/**< The priority of the steps, set by sched_post_job() */
+} sched_job_t;
+
 /*! \brief Initialise the scheduler sub system. 
  *
  * This function is called while bootstrapping the framework. On no account should you call this function 
@@ -58,6 +90,15 @@ __LINK_C void scheduler_init();
  */
 __LINK_C void scheduler_run();
 
+/*! \brief Executes the pending tasks, and the tasks they post, until no task is pending
+ *
+ * This is one iteration of the main task loop of scheduler_run(), without going to sleep. It is meant for host
+ * programs (see the 'native' platform), like fuzzers, which drive the framework themselves and need the control
+ * back when the stack is idle. An application running on a MCU should not call this function.
+ *
+ */
+__LINK_C void scheduler_run_pending_tasks();
+
 enum
 {
 	/*! \brief The minimum allowed priority for scheduled tasks
@@ -77,7 +118,8 @@ enum
 /*! \brief Register a task with the task scheduler.
  *
  *  If the task could not be registered due to memory constraints (This problem can be alleviated by increasing the SCHEDULER_MAX_TASKS CMake parameter) this will assert
- *	Also, when the task was already registered this function will assert.
+ *	Also, when the task was already registered this function will assert. A task which is always registered can be
+ *	registered at build time instead, see SCHED_REGISTER_TASK().
  *
  * \param task		The task to register
  *
@@ -85,6 +127,53 @@ enum
  */
 __LINK_C error_t sched_register_task(task_t task);
 
+/*! \brief Register a task with the task scheduler and retrieve its handle.
+ *
+ * This function behaves exactly like sched_register_task() but additionally returns the handle of the
+ * task, which can be used with the sched_*_handle() functions. Those run in constant time and are
+ * therefore preferred when posting from an interrupt context.
+ *
+ * \param task		The task to register
+ * \param handle	Pointer to store the handle of the registered task. May be NULL.
+ *
+ * \return error_t 	SUCCESS if the task was registered successfully
+ */
+__LINK_C error_t sched_register_task_handle(task_t task, task_handle_t* handle);
+
+/*! \brief Retrieve the handle of an already registered task
+ *
+ * \param task		The registered task
+ * \param handle	Pointer to store the handle of the task
+ *
+ * \return error_t	SUCCESS if the handle was retrieved
+ *			EINVAL if the task was not registered with the scheduler
+ */
+__LINK_C error_t sched_get_task_handle(task_t task, task_handle_t* handle);
+
+/*! \brief A task registered at build time, see SCHED_REGISTER_TASK() */
+typedef struct
+{
+	task_t task;
+} sched_task_descriptor_t;
+
+extern const sched_task_descriptor_t __start_sched_tasks[] __attribute__((weak));
+extern const sched_task_descriptor_t __stop_sched_tasks[] __attribute__((weak));
+
+/*! \brief Register a task at build time
+ *
+ * The descriptor of the task is placed in the sched_tasks section (in flash), the linker collects the descriptors of
+ * all linked objects in one table. scheduler_init() registers them before any module is initialised, in the order of
+ * the table, so the task does not need to be registered by sched_register_task() and its handle is fixed at link
+ * time (see SCHED_TASK_HANDLE()). The task should be declared before, this is used at file scope.
+ *
+ * \param name		The task to register
+ */
+#define SCHED_REGISTER_TASK(name) \
+	static const sched_task_descriptor_t sched_task_##name __attribute__((section("sched_tasks"), used)) = { &name }
+
+/*! \brief The handle of a task registered by SCHED_REGISTER_TASK() in the same file */
+#define SCHED_TASK_HANDLE(name) ((task_handle_t)(&sched_task_##name - __start_sched_tasks))
+
 /*! \brief Post a task with the given priority
  *
  * \param task		The task to be executed by the scheduler
@@ -109,6 +198,68 @@ __LINK_C error_t sched_post_task_prio(task_t task, uint8_t priority);
  */
 static inline error_t sched_post_task(task_t task) { return sched_post_task_prio(task,DEFAULT_PRIORITY);}
 
+#ifdef FRAMEWORK_SCHEDULER_DEADLINES_ENABLED
+
+/*! \brief Post a task with the given priority, to be executed before a deadline
+ *
+ * The tasks posted with a deadline are executed before the other tasks of their priority, the earliest deadline
+ * first. A task which starts after its deadline is counted as a deadline miss (see sched_get_deadline_miss_count()),
+ * it is executed nonetheless. The deadline does not change the priority: a task of a higher priority still runs first.
+ * Only available when the FRAMEWORK_SCHEDULER_DEADLINES_ENABLED CMake option is set.
+ *
+ * \param task		The task to be executed by the scheduler
+ * \param deadline	The time before which the task should start, in framework timer ticks (see timer_get_counter_value())
+ * \param priority	The priority of the task
+ *
+ * \return error_t	See sched_post_task_prio(). When the task was already scheduled its deadline is not changed.
+ */
+__LINK_C error_t sched_post_task_deadline_prio(task_t task, uint32_t deadline, uint8_t priority);
+
+/*! \brief Post a task at the default priority, to be executed before a deadline, see sched_post_task_deadline_prio()
+ */
+static inline error_t sched_post_task_deadline(task_t task, uint32_t deadline) { return sched_post_task_deadline_prio(task, deadline, DEFAULT_PRIORITY);}
+
+/*! \brief Get the number of tasks which started after their deadline */
+__LINK_C uint32_t sched_get_deadline_miss_count();
+
+/*! \brief Clear the number of deadline misses */
+__LINK_C void sched_reset_deadline_miss_count();
+
+#endif
+
+/*! \brief Post a deferred call with the given argument and priority
+ *
+ * The call is queued together with the tasks of the same priority and executed in FIFO order.
+ * Contrary to tasks, the same function can be queued multiple times (for instance with
+ * different arguments). The number of pending calls is bounded by the
+ * FRAMEWORK_SCHEDULER_MAX_DEFERRED_CALLS CMake parameter.
+ *
+ * \param call		The function to be executed by the scheduler
+ * \param arg		The argument to pass to the function
+ * \param priority	The priority of the call
+ *
+ * \return error_t	SUCCESS if the call was successfully queued
+ *			EINVAL if call is NULL
+ *			ESIZE if the priority is not between MAX_PRIORITY and MIN_PRIORITY
+ *			ENOMEM if there are already FRAMEWORK_SCHEDULER_MAX_DEFERRED_CALLS calls pending
+ */
+__LINK_C error_t sched_post_call(deferred_call_t call, void* arg, uint8_t priority);
+
+/*! \brief Post a job, executed by steps with the given priority
+ *
+ * A job is a computation which is too long to run to completion without delaying the other tasks, for instance
+ * the decryption of a frame. Each step is executed as a deferred call (see sched_post_call()) which is queued again
+ * for the next step, so the tasks posted meanwhile run in between: the tasks of a higher priority before the next
+ * step, the ones of the same priority in FIFO order. The job and its state should remain valid until the last
+ * step returned, the step itself reports the completion of the job.
+ *
+ * \param job		The job, its step and state should be set
+ * \param priority	The priority of the steps
+ *
+ * \return error_t	See sched_post_call()
+ */
+__LINK_C error_t sched_post_job(sched_job_t* job, uint8_t priority);
+
 /*! \brief Cancel an already scheduled task
  *
  * \param task		The task to cancel
@@ -125,7 +276,198 @@ __LINK_C error_t sched_cancel_task(task_t task);
  */
 __LINK_C bool sched_is_scheduled(task_t task);
 
+/*! \brief Post the task identified by handle with the given priority
+ *
+ * Equivalent to sched_post_task_prio() but without the lookup of the task.
+ *
+ * \param handle	The handle of the task to be executed by the scheduler
+ * \param priority	The priority of the task
+ *
+ * \return error_t	SUCCESS if the task was successfully scheduled
+ *			EINVAL if the handle is not valid
+ *			ESIZE if the priority is not between MAX_PRIORITY and MIN_PRIORITY
+ *			EALREADY if the task was already scheduled.
+ */
+__LINK_C error_t sched_post_handle_prio(task_handle_t handle, uint8_t priority);
+
+/*! \brief Post the task identified by handle with the given priority, from an interrupt handler
+ * Contrary to the other functions of the scheduler no critical section is entered: the task is marked in a set of
+ * pending tasks using atomic_set_bits() (lock free on the Cortex-M3/M4 chips) and appended to the queue of its
+ * priority by the scheduler before it picks the next task. This keeps the interrupts enabled, and it can be called from
+ * a handler above the critical sections of HAL_ATOMIC_USE_BASEPRI (see hwatomic.h). It can be called from any
+ * context, but sched_post_handle_prio() is cheaper outside of interrupts.
+ * \param handle	The handle of the task to be executed by the scheduler
+ * \param priority	The priority of the task
+ * \return error_t	SUCCESS if the task was successfully posted
+ *			EINVAL if the handle is not valid
+ *			ESIZE if the priority is not between MAX_PRIORITY and MIN_PRIORITY
+ *			EALREADY if the task was already scheduled or posted from an interrupt with this priority.
+ *			A task posted with several priorities runs once, with the highest of them.
+ */
+__LINK_C error_t sched_post_handle_from_isr(task_handle_t handle, uint8_t priority);
+
+/*! \brief Post the task identified by handle at the default priority
+ *
+ * \param handle	The handle of the task to be executed by the scheduler
+ *
+ * \return error_t	See sched_post_handle_prio()
+ */
+static inline error_t sched_post_handle(task_handle_t handle) { return sched_post_handle_prio(handle, DEFAULT_PRIORITY);}
+
+/*! \brief Cancel the already scheduled task identified by handle
+ *
+ * \param handle	The handle of the task to cancel
+ *
+ * \return error_t	SUCCESS if the task was cancelled successfully
+ * 			EINVAL if the handle is not valid
+ *			EALREADY if the task was not scheduled or has already been executed
+ */
+__LINK_C error_t sched_cancel_handle(task_handle_t handle);
+
+/*! \brief Check whether the task identified by handle is scheduled to be executed
+ *
+ * \return bool		TRUE if the task is scheduled, FALSE otherwise
+ */
+__LINK_C bool sched_is_handle_scheduled(task_handle_t handle);
+
+/*! \brief Get the usage statistics of the task table
+ *
+ * The in use count is the number of registered tasks, which can be used to size FRAMEWORK_SCHEDULER_MAX_TASKS.
+ *
+ * \param stats	Pointer to store the statistics
+ */
+__LINK_C void sched_get_task_table_stats(pool_stats_t* stats);
+
+/*! \brief Get the usage statistics of the deferred calls posted using sched_post_call()
+ *
+ * The failure count is the number of sched_post_call() calls which returned ENOMEM.
+ *
+ * \param stats	Pointer to store the statistics
+ */
+__LINK_C void sched_get_deferred_call_stats(pool_stats_t* stats);
+
+/*! \brief Restart the high water mark of the deferred calls from the current usage and clear the failure count */
+__LINK_C void sched_reset_deferred_call_stats();
+
+#if defined(FRAMEWORK_SCHEDULER_PROFILING_ENABLED) || defined(FRAMEWORK_SCHEDULER_STACK_WATERMARK_ENABLED)
+
+/*! \brief Get the number of registered tasks
+ *
+ * The handles of the registered tasks are in the range [0, sched_get_registered_task_count())
+ */
+__LINK_C uint8_t sched_get_registered_task_count();
+
+#endif
+
+#ifdef FRAMEWORK_SCHEDULER_PROFILING_ENABLED
+
+/*! \brief The execution profile of a registered task
+ *
+ * All durations are expressed in framework timer ticks (see timer_get_counter_value()).
+ * Only available when the FRAMEWORK_SCHEDULER_PROFILING_ENABLED CMake option is set.
+ */
+typedef struct
+{
+	uint32_t invocation_count;	/**< The number of times the task was executed */
+	uint32_t total_run_ticks;	/**< The total execution time of the task */
+	uint32_t max_run_ticks;		/**< The longest single execution of the task */
+	uint32_t total_latency_ticks;	/**< The total time spent between posting and executing the task */
+	uint32_t max_latency_ticks;	/**< The longest time spent between posting and executing the task */
+	uint32_t already_posted_count;	/**< The number of times posting the task returned EALREADY */
+} sched_task_profile_t;
+
+/*! \brief Retrieve the execution profile of a task
+ *
+ * \param handle	The handle of the task
+ * \param profile	Pointer to store the profile of the task
+ *
+ * \return error_t	SUCCESS if the profile was retrieved
+ *			EINVAL if the handle is not valid
+ */
+__LINK_C error_t sched_get_task_profile(task_handle_t handle, sched_task_profile_t* profile);
+
+/*! \brief Clear the execution profiles of all tasks */
+__LINK_C void sched_reset_profile();
+
+#endif
+
+#ifdef FRAMEWORK_SCHEDULER_STACK_WATERMARK_ENABLED
+
+/*! \brief The task handle reported when the stack was used deepest outside of a registered task */
+#define SCHED_NO_TASK_HANDLE 0xFF
+
+/*! \brief The usage of the main stack, in bytes
+ *
+ * The stack is painted by scheduler_init() and the deepest overwritten word is searched after every task and after
+ * waking up, see hw_get_stack_region(). The interrupts use the same stack: their use is attributed to the task they
+ * interrupted, or to SCHED_NO_TASK_HANDLE when the MCU was sleeping. Only available when the
+ * FRAMEWORK_SCHEDULER_STACK_WATERMARK_ENABLED CMake option is set.
+ */
+typedef struct
+{
+	uint16_t size;			/**< The size of the stack */
+	uint16_t max_used;		/**< The deepest use of the stack since boot */
+	task_handle_t max_used_task;	/**< The task which ran when max_used was reached, SCHED_NO_TASK_HANDLE for a
+					     deferred call or when sleeping */
+} sched_stack_stats_t;
+
+/*! \brief Retrieve the usage of the stack
+ *
+ * \param stats	Pointer to store the usage of the stack
+ */
+__LINK_C void sched_get_stack_stats(sched_stack_stats_t* stats);
+
+/*! \brief Retrieve the stack deepest used by a task
+ *
+ * As the stack is painted only once, a task only gets a value when it used the stack deeper than all before it.
+ * This is the use of the stack at the last time it did, 0 when it never did.
+ *
+ * \param handle	The handle of the task
+ * \param max_used	Pointer to store the used bytes of the stack
+ *
+ * \return error_t	SUCCESS if the usage was retrieved
+ *			EINVAL if the handle is not valid
+ */
+__LINK_C error_t sched_get_task_stack_max_used(task_handle_t handle, uint16_t* max_used);
+
+#endif
+
+#if FRAMEWORK_SCHEDULER_LIVENESS_CHECKS > 0
 
+/*! \brief Type definition for liveness checks, see sched_register_liveness_check() */
+typedef uint8_t sched_liveness_check_t;
+
+/*! \brief Register a liveness check, which has to be passed at least once per deadline
+ *
+ * When FRAMEWORK_SCHEDULER_LIVENESS_CHECKS is not 0 the watchdog is fed by the scheduler, between the tasks and
+ * before going to sleep, as long as every registered check was passed (see sched_liveness_check_in()) within its
+ * deadline. A critical task which stops running, or a task which blocks the scheduler, therefore results in a reset
+ * of the MCU once the watchdog timer elapses, while long operations of the other tasks no longer need to feed the
+ * watchdog themselves. The watchdog period should exceed the longest deadline, the check is registered as passed.
+ *
+ * \param deadline	The maximum time between two check ins, in timer ticks
+ * \param check		Pointer to store the identifier of the check
+ *
+ * \return error_t	SUCCESS if the check was registered
+ *			EINVAL if the deadline is 0
+ *			ENOMEM if FRAMEWORK_SCHEDULER_LIVENESS_CHECKS checks are registered already
+ */
+__LINK_C error_t sched_register_liveness_check(uint32_t deadline, sched_liveness_check_t* check);
+
+/*! \brief Pass a liveness check, this can be called from an interrupt context
+ *
+ * \param check		The identifier of the check, as returned by sched_register_liveness_check()
+ */
+__LINK_C void sched_liveness_check_in(sched_liveness_check_t check);
+
+#endif
+
+/*! \brief Get / set the low power mode the scheduler enters when no tasks are waiting
+ *
+ * When FRAMEWORK_SCHEDULER_LP_MODE_DYNAMIC is enabled this is the deepest mode the scheduler
+ * is allowed to enter; a shallower mode is used when the next timer event is due sooner
+ * than the wake-up latency of this mode (see hw_get_lowpower_mode_wakeup_latency()).
+ */
 __LINK_C uint8_t sched_get_low_power_mode(void);
 __LINK_C void    sched_set_low_power_mode(uint8_t mode);
 
@@ -35,13 +35,36 @@
 #include "types.h"
 #include "errors.h"
 #include "fifo.h"
+#include "pool_stats.h"
 
-typedef void (*cmd_handler_t)(fifo_t* cmd_fifo);
+#define SHELL_CMD_INVALID -1
+
+// returns the length of the command at the start of cmd (the AT$<id> header included) from the available bytes received
+// so far, 0 when more bytes are needed to know it, or SHELL_CMD_INVALID when the command is corrupted
+typedef int16_t (*cmd_length_t)(const uint8_t* cmd, uint16_t available);
+// processes a complete command, which is contiguous in memory and removed by the shell afterwards. Returns false when
+// the command is invalid, the shell then only drops the header and resyncs on the next "AT"
+typedef bool (*cmd_handler_t)(uint8_t* cmd, uint16_t length);
 typedef struct {
     int8_t id;
+    cmd_length_t get_cmd_length;
     cmd_handler_t cmd_handler_callback;
 } cmd_handler_registration_t;
 
+typedef void (*pool_stats_getter_t)(pool_stats_t* stats);
+typedef void (*pool_stats_reset_t)();
+
+#define SHELL_COUNTERS_MAX 8 // the maximum number of counters in a group
+
+typedef struct {
+    const char* name;
+    uint32_t value;
+} shell_counter_t;
+
+// fills the counters of a group, returns their number, at most SHELL_COUNTERS_MAX
+typedef uint8_t (*counters_getter_t)(shell_counter_t* counters);
+typedef void (*counters_reset_t)();
+
 #ifdef FRAMEWORK_SHELL_ENABLED
 
 void shell_init();
@@ -49,6 +72,16 @@ void shell_echo_enable();
 void shell_echo_disable();
 void shell_register_handler(cmd_handler_registration_t handler_registration);
 void shell_return_output(uint8_t origin, uint8_t* data, uint8_t length);
+// registers a pool of which the statistics are printed by the 'ATM' command, the scheduler and timer pools are registered by default.
+// reset_stats is optional
+void shell_register_pool_stats(const char* name, pool_stats_getter_t get_stats, pool_stats_reset_t reset_stats);
+// registers a group of counters, printed with the pools by shell_print_counters(). The console counters are registered
+// by default
+void shell_register_counters(const char* name, counters_getter_t get_counters, counters_reset_t reset_counters);
+// prints the pools and the counters, as a table for humans or as one "name:key=value,..." line per group
+void shell_print_counters(bool compact);
+// resets the registered counters and the statistics of the pools which can be reset
+void shell_reset_counters();
 
 #else
 
@@ -57,6 +90,10 @@ void shell_return_output(uint8_t origin, uint8_t* data, uint8_t length);
 #define shell_echo_disable()          ((void)0)
 #define shell_register_handler(...)   ((void)0)
 #define shell_return_output(...)      ((void)0)
+#define shell_register_pool_stats(...) ((void)0)
+#define shell_register_counters(...)  ((void)0)
+#define shell_print_counters(...)     ((void)0)
+#define shell_reset_counters()        ((void)0)
 
 #endif
 
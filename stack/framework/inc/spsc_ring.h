@@ -0,0 +1,77 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file spsc_ring.h
+ * @addtogroup spsc_ring
+ * @ingroup framework
+ * @{
+ * @brief A lock-free ring of fixed size elements, for passing events from a single producer to a single consumer,
+ * typically from an interrupt handler to a task.
+ *
+ * The producer only writes the tail index and the consumer only writes the head index, so neither side needs
+ * start_atomic(). An index is only updated after a memory barrier, so the other side never sees it before the element data.
+ * One slot is kept free to distinguish a full from an empty ring, so the ring holds element_count - 1 elements.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include "types.h"
+#include "errors.h"
+
+/**
+ * @brief This struct contains the ring state variables
+ **/
+typedef struct {
+    volatile uint16_t head_idx; /**< The index of the next element to get, only written by the consumer */
+    volatile uint16_t tail_idx; /**< The index of the next element to put, only written by the producer */
+    uint16_t element_count;     /**< The number of element slots in buffer */
+    uint8_t element_size;       /**< The size of an element in bytes */
+    uint8_t* buffer;            /**< The buffer where the elements are stored */
+} spsc_ring_t;
+
+/**
+ * @brief Initializes the ring.
+ * @param ring          Ring state, initialized by this function
+ * @param buffer        The buffer used for the ring, the caller is responsible for allocating element_size * element_count bytes
+ * @param element_size  The size of an element in bytes
+ * @param element_count The number of element slots in buffer, the ring can hold element_count - 1 elements
+ */
+void spsc_ring_init(spsc_ring_t* ring, void* buffer, uint8_t element_size, uint16_t element_count);
+
+/**
+ * @brief Copies an element in to the ring, to be called by the producer only
+ * @returns SUCCESS or ESIZE when the ring is full
+ */
+error_t spsc_ring_put(spsc_ring_t* ring, const void* element);
+
+/**
+ * @brief Copies the oldest element out of the ring and removes it, to be called by the consumer only
+ * @returns SUCCESS or ESIZE when the ring is empty
+ */
+error_t spsc_ring_get(spsc_ring_t* ring, void* element);
+
+/**
+ * @brief Returns if the ring contains no elements. When called by the producer the ring might be emptied concurrently.
+ */
+bool spsc_ring_is_empty(spsc_ring_t* ring);
+
+#endif // SPSC_RING_H
+
+/** @}*/
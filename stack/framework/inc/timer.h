@@ -36,7 +36,9 @@
  * The 32-bit counter of the timer (see timer_get_counter()) counts from 0 to MAX_INT
  * and then loops back to zero. Depending on the selected frequency this yield a loop time between
  * 1,5 days (32KHz timer) and 48 days (1MS ticks). timer_get_counter_value() therefore always
- * returns the time since system bootup (or since the last overflow)
+ * returns the time since system bootup (or since the last overflow). The times passed to the timer are taken as the
+ * nearest one to the current time, at most 2^31 ticks before or after it. Internally the events are kept on the
+ * 64-bit counter of timer_get_counter_value64(), which does not overflow.
  *
  * \author maarten.weyn@uantwerpen.be
  * \author daniel.vandenakker@uantwerpen.be
@@ -50,6 +52,7 @@
 #include "scheduler.h"
 #include "hwtimer.h"
 #include "framework_defs.h"
+#include "pool_stats.h"
 
 typedef uint32_t timer_tick_t;
 
@@ -58,6 +61,8 @@ typedef struct
     task_t f;
     timer_tick_t next_event;
     uint8_t priority;
+    timer_tick_t period;
+    timer_tick_t slack;
 } timer_event;
 
 //a bit of dirty macro evaluation to prepend HWTIMER_FREQ_ to the value of 'FRAMEWORK_TIMER_RESOLUTION'
@@ -74,6 +79,16 @@ typedef struct
  */
 #define TIMER_TICKS_PER_SEC ___CONCAT(HWTIMER_TICKS_, FRAMEWORK_TIMER_RESOLUTION)
 
+/*! \brief Convert a duration expressed in Ti (1/1024 s, the time unit used by DASH7) to framework timer ticks
+ *
+ * When the '1MS' resolution is used this is a no-op, with the '32K' resolution every Ti is 32 ticks.
+ */
+#define TI_TO_TIMER_TICKS(ti) ((timer_tick_t)(((uint64_t)(ti)) * TIMER_TICKS_PER_SEC / 1024))
+
+/*! \brief Convert a number of framework timer ticks to Ti (1/1024 s), rounding up
+ */
+#define TIMER_TICKS_TO_TI(ticks) ((uint32_t)((((uint64_t)(ticks)) * 1024 + TIMER_TICKS_PER_SEC - 1) / TIMER_TICKS_PER_SEC))
+
 
 
 /*! \brief Initialise the timer sub system
@@ -92,6 +107,14 @@ __LINK_C void timer_init();
  */
 __LINK_C timer_tick_t timer_get_counter_value();
 
+/*! \brief Retrieve the number of clock ticks since the device booted, on a 64-bit counter which does not overflow
+ *
+ * The lower 32 bits are the value of timer_get_counter_value().
+ *
+ * \return uint64_t	The current value of the counter.
+ */
+__LINK_C uint64_t timer_get_counter_value64();
+
 /*! \brief Post a task to be scheduled at a given time with a given priority
  *
  * The time parameter denotes the clock tick at which the task is to be scheduled
@@ -205,6 +228,98 @@ static inline error_t timer_post_task_delay(task_t task, timer_tick_t time) { re
  */
 static inline error_t timer_add_event( timer_event* event) { return timer_post_task_prio(event->f, event->next_event, event->priority);}
 
+/*! \brief Post a task to be scheduled at a given time, allowing it to be scheduled up to <slack> ticks later
+ *
+ * This behaves like timer_post_task_prio(), except that the task may be scheduled anywhere
+ * between <time> and <time> + <slack>. The framework timer uses this freedom to serve events
+ * whose windows overlap with a single (hardware) timer interrupt, so the MCU has to wake up
+ * less often. Use this for tasks that do not require exact timing, such as periodic
+ * measurements or watchdog feeds.
+ *
+ * \param task		The task to be scheduled.
+ * \param time		The earliest time at which to schedule the task for execution.
+ * \param slack		The number of ticks the task may be scheduled later than <time>.
+ * \param priority	The priority with which the task should be executed
+ *
+ * \returns error_t	SUCCESS if the task was posted successfully
+ *					ENOMEM if the task could not be posted there are already too
+ *						   many tasks waiting for execution.
+ *					EALREADY if the task was already scheduled with another priority.
+ *					EINVAL if an invalid priority was specified.
+ */
+__LINK_C error_t timer_post_task_with_slack(task_t task, timer_tick_t time, timer_tick_t slack, uint8_t priority);
+
+/*! \brief Post a task to be scheduled after <delay> ticks, allowing it to be scheduled up to <slack> ticks later
+ *
+ * This is equivalent to
+ * \code{.c}
+ *		timer_post_task_with_slack(task, timer_get_counter_value() + delay, slack, priority);
+ * \endcode
+ *
+ * See timer_post_task_with_slack() for more information.
+ */
+static inline error_t timer_post_task_delay_with_slack(task_t task, timer_tick_t delay, timer_tick_t slack, uint8_t priority)
+{
+    return timer_post_task_with_slack(task, timer_get_counter_value() + delay, slack, priority);
+}
+
+/*! \brief Post a task to be scheduled at an exact time, using the hardware timer reserved for it
+ *
+ * This behaves like timer_post_task_prio(), except that on platforms with a second hardware timer
+ * (PLATFORM_NUM_TIMERS > 1) the event is programmed on that timer directly: it fires on time, without
+ * waiting for the events of the framework timer to be handled and the framework timer to be re-programmed.
+ * It is meant for the timing of the radio, like the CCAs of the DLL and the response periods of the
+ * transport layer.
+ *
+ * There is a single precise event. When it is used by another task, when the time is further than the
+ * range of the hardware timer or less than 2 ticks away, or without a second hardware timer, the task is
+ * posted with timer_post_task_prio() instead. Posting the task with the other timer_post_ functions replaces
+ * its precise event, timer_cancel_task() cancels it.
+ *
+ * \param task		The task to be scheduled at the given time.
+ * \param time		The time at which to schedule the task for execution.
+ * \param priority	The priority with which the task should be executed
+ *
+ * \returns error_t	see timer_post_task_prio()
+ */
+__LINK_C error_t timer_post_precise_task_prio(task_t task, timer_tick_t time, uint8_t priority);
+
+/*! \brief Post a task to be scheduled exactly <delay> ticks from now, see timer_post_precise_task_prio()
+ */
+static inline error_t timer_post_precise_task_prio_delay(task_t task, timer_tick_t delay, uint8_t priority)
+{
+    return timer_post_precise_task_prio(task, timer_get_counter_value() + delay, priority);
+}
+
+/*! \brief Post a task to be scheduled every <period> ticks with a given priority
+ *
+ * The task is first scheduled <period> ticks from now. Every next deadline is calculated
+ * from the previous deadline (not from the time the task was actually executed), so
+ * the task is scheduled at an exact rate regardless of any scheduling latency.
+ *
+ * The task stays scheduled until it is canceled using timer_cancel_task(). Posting the
+ * same task again (periodic or not) replaces its deadline and period.
+ *
+ * \param task		The task to be scheduled periodically.
+ * \param period	The number of ticks between two executions, should be > 0.
+ * \param priority	The priority with which the task should be executed
+ *
+ * \returns error_t	SUCCESS if the task was posted successfully
+ *					ENOMEM if the task could not be posted there are already too
+ *						   many tasks waiting for execution.
+ *					EALREADY if the task was already scheduled with another priority.
+ *					EINVAL if an invalid priority or a period of 0 was specified.
+ */
+__LINK_C error_t timer_post_periodic_task(task_t task, timer_tick_t period, uint8_t priority);
+
+/*! \brief Post a task to be scheduled every <period> ticks, the first time at <time>
+ *
+ * This behaves like timer_post_periodic_task(), except that the first deadline is given, so the
+ * events of the task can be aligned on a time reference. A <time> in the past fires right away,
+ * the next deadlines remain <time> plus a multiple of <period>.
+ */
+__LINK_C error_t timer_post_periodic_task_at(task_t task, timer_tick_t time, timer_tick_t period, uint8_t priority);
+
 
 /*! \brief Cancel a previously scheduled task
  *
@@ -226,6 +341,32 @@ __LINK_C error_t timer_cancel_task(task_t task);
  */
 __LINK_C bool timer_is_task_scheduled(task_t task);
 
+/*! \brief Get the number of ticks until the next timer event fires
+ *
+ * This is used by the scheduler to decide how deep the MCU can sleep while idle.
+ * Events that are already due are reported with a delay of 0.
+ *
+ * \param delay	Pointer to store the number of ticks until the next event
+ *
+ * \return bool	true if a timer event is pending and delay was filled in
+ * 				false if no timer event is pending
+ *
+ */
+__LINK_C bool timer_get_next_event_delay(timer_tick_t* delay);
+
+/*! \brief Get the usage statistics of the timer event stack
+ *
+ * The high water mark and the number of timer_post_task_*() calls which failed with ENOMEM
+ * can be used to size FRAMEWORK_TIMER_STACK_SIZE.
+ *
+ * \param stats	Pointer to store the statistics
+ *
+ */
+__LINK_C void timer_get_stats(pool_stats_t* stats);
+
+/*! \brief Restart the high water mark of the timer event stack from the current usage and clear the failure count */
+__LINK_C void timer_reset_stats();
+
 #endif /* TIMER_H_ */
 
 /** @}*/
@@ -0,0 +1,96 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file trace.h
+ * \addtogroup trace
+ * \ingroup framework
+ * @{
+ * \brief A binary trace of timestamped events, recorded in RAM and dumped after the fact.
+ *
+ * Unlike the logs the recording does not format nor output anything, so it hardly changes the timing of the code
+ * being traced. The last FRAMEWORK_TRACE_SIZE records are kept, older records are overwritten.
+ *
+ * Tracing can be globally enabled or disabled by setting or clearing the 'FRAMEWORK_TRACE_ENABLED' CMake option.
+ */
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include "link_c.h"
+#include "framework_defs.h"
+#include "types.h"
+#include "log.h"
+
+/*! \brief The kind of event recorded, the meaning of the arguments depends on the event */
+typedef enum
+{
+    TRACE_EVENT_STATE = 0x01,   /**< A state transition, arg1 is the previous and arg2 the new state */
+    TRACE_EVENT_TX = 0x02,      /**< A frame is transmitted */
+    TRACE_EVENT_RX = 0x03,      /**< A frame is received */
+    TRACE_EVENT_TIMEOUT = 0x04, /**< A timer expired */
+    TRACE_EVENT_USER = 0x80     /**< Start of the events defined by the application */
+} trace_event_t;
+
+/*! \brief A single trace record */
+typedef struct
+{
+    uint32_t timestamp;         /**< The value of timer_get_counter_value() when the event occurred */
+    uint8_t layer;              /**< The source of the event, see log_stack_layer_t */
+    uint8_t event;              /**< See trace_event_t */
+    uint8_t dialog_id;          /**< The dialog the event belongs to, 0 when unknown */
+    uint8_t transaction_id;     /**< The transaction the event belongs to, 0 when unknown */
+    uint16_t arg1;
+    uint16_t arg2;
+} trace_record_t;
+
+#ifdef FRAMEWORK_TRACE_ENABLED
+
+/*! \brief Record an event in the trace
+ *
+ * This can be called from interrupt context.
+ */
+__LINK_C void trace_record(log_stack_layer_t layer, uint8_t event, uint8_t dialog_id, uint8_t transaction_id,
+                           uint16_t arg1, uint16_t arg2);
+
+/*! \brief Get the number of records in the trace */
+__LINK_C uint16_t trace_get_record_count();
+
+/*! \brief Copy a record from the trace
+ *
+ * \param index     The index of the record, 0 is the oldest record
+ * \param record    Pointer to store the record
+ * \return          SUCCESS, or ESIZE if there is no record with this index
+ */
+__LINK_C error_t trace_get_record(uint16_t index, trace_record_t* record);
+
+/*! \brief Print the trace, oldest record first, on the log output (the console or RTT, see FRAMEWORK_LOG_OUTPUT_ON_RTT) */
+__LINK_C void trace_dump();
+
+/*! \brief Discard all records */
+__LINK_C void trace_reset();
+
+#else
+    #define trace_record(...) ((void)0)
+    #define trace_get_record_count() 0
+    #define trace_get_record(...) ESIZE
+    #define trace_dump() ((void)0)
+    #define trace_reset() ((void)0)
+#endif
+
+#endif /* __TRACE_H_ */
+
+/** @}*/
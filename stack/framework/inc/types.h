@@ -36,4 +36,11 @@
 typedef int error_t;	//use 'int' since it matches the value expected for errors from <errno.h>
 						//and the EFM32GG toolchain actually defines it as such
 
+/* \brief get a pointer to the structure of the given type containing the given member
+ *
+ */
+#ifndef container_of
+#define container_of(ptr, type, member) ((type*)(((uint8_t*)(ptr)) - offsetof(type, member)))
+#endif
+
 #endif // __FRM_TYPES_H__
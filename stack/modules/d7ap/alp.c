@@ -25,11 +25,17 @@
 
 #include "alp.h"
 #include "packet.h"
+#include "packet_queue.h"
+#include "dll.h"
+#include "d7anp.h"
 #include "fs.h"
 #include "fifo.h"
+#include "bitmap.h"
 #include "log.h"
 #include "alp_cmd_handler.h"
 #include "shell.h"
+#include "remote_file_cache.h"
+#include "bulk_transfer.h"
 #include "MODULE_D7AP_defs.h"
 
 #if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_ALP_LOG_ENABLED)
@@ -43,27 +49,71 @@ static bool NGDEF(_shell_enabled);
 
 typedef struct {
   bool is_active;
+  bool is_forwarded; // the command queued requests on a D7ASP session, and completes when the session is flushed
   uint8_t fifo_token;
+  uint8_t first_request_id;
+  uint8_t last_request_id;
+  d7asp_result_t d7asp_result; // for a command received over D7ASP
   uint8_t tag_id;
   bool respond_when_completed;
   alp_command_origin_t origin;
+  // the callbacks of a command submitted with alp_submit_request()
+  alp_request_response_callback response_cb;
+  alp_request_completed_callback completed_cb;
+  void* context;
+  // the commands and responses are not stored: while processing, the command fifo is a cursor over the buffer of the
+  // caller and the response fifo writes into the buffer of the caller. Afterwards they are pointed to a buffer on the stack
+  // to output the asynchronous responses
   fifo_t alp_command_fifo;
   fifo_t alp_response_fifo;
-  uint8_t alp_command[ALP_PAYLOAD_MAX_SIZE];
-  uint8_t alp_response[ALP_PAYLOAD_MAX_SIZE];
 } alp_command_t;
 
 static alp_command_t NGDEF(_commands)[MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT];
 #define commands NG(_commands)
 
-static d7asp_result_t NGDEF(_current_d7asp_result);
-#define current_d7asp_result NG(_current_d7asp_result)
+static pool_stats_t NGDEF(_command_stats);
+#define command_stats NG(_command_stats)
 
 static alp_init_args_t* NGDEF(_init_args);
 #define init_args NG(_init_args)
 
+// how a command is split up in D7ASP requests
+typedef struct {
+  uint8_t max_request_length; // the MTU the actions were packed for
+  uint8_t action_count;
+  uint8_t request_count;
+  uint8_t request_lengths[MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT];
+  uint8_t response_lengths[MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT]; // the expected response length of each request
+} request_layout_t;
+
+// the request layout of the result of the action files executed most recently. The result of an action file has the same
+// actions every time, only the returned data differs, so it is only packed again when the file or the MTU changes
+typedef struct {
+  bool valid;
+  uint8_t action_file_id;
+  uint8_t result_length;
+  request_layout_t layout;
+} action_file_layout_t;
+
+static action_file_layout_t NGDEF(_action_file_layouts)[MODULE_D7AP_ALP_ACTION_FILE_CACHE_SIZE];
+#define action_file_layouts NG(_action_file_layouts)
+
+static uint8_t NGDEF(_action_file_layout_next);
+#define action_file_layout_next NG(_action_file_layout_next)
+
+typedef struct {
+  alp_operation_t operation;
+  alp_app_action_handler_t handler;
+} app_action_handler_registration_t;
+
+static app_action_handler_registration_t NGDEF(_app_action_handlers)[MODULE_D7AP_ALP_APP_ACTION_HANDLER_COUNT];
+#define app_action_handlers NG(_app_action_handlers)
+
 static void free_command(alp_command_t* command) {
   DPRINT("Free cmd %i", command->fifo_token);
+  if(command->is_active)
+    pool_stats_free(&command_stats);
+
   command->is_active = false;
   fifo_clear(&command->alp_command_fifo);
   fifo_clear(&command->alp_response_fifo);
@@ -72,6 +122,7 @@ static void free_command(alp_command_t* command) {
 
 static void init_commands()
 {
+  pool_stats_init(&command_stats, MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT);
   for(uint8_t i = 0; i < MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT; i++) {
     free_command(&commands[i]);
   }
@@ -82,36 +133,131 @@ static alp_command_t* alloc_command()
   for(uint8_t i = 0; i < MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT; i++) {
     if(commands[i].is_active == false) {
       commands[i].is_active = true;
+      commands[i].is_forwarded = false;
+      commands[i].respond_when_completed = false;
+      commands[i].response_cb = NULL;
+      commands[i].completed_cb = NULL;
+      pool_stats_alloc(&command_stats);
       return &(commands[i]);
     }
   }
 
-  DPRINT("Could not alloc command, all %i reserved slots active", MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT);
+  pool_stats_alloc_failed(&command_stats);
+
+  log_stack_warning(LOG_STACK_ALP, "Could not alloc command, all %i reserved slots active", MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT);
   return NULL;
 }
 
-static alp_command_t* get_command_by_fifo_token(uint8_t fifo_token) {
+// several forwarded commands can share a session, each one owns the range of requests it queued
+static alp_command_t* get_command_by_fifo_token(uint8_t fifo_token, uint8_t request_id) {
   for(uint8_t i = 0; i < MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT; i++) {
-    if(commands[i].fifo_token == fifo_token && commands[i].is_active)
+    if(commands[i].is_active && commands[i].is_forwarded && commands[i].fifo_token == fifo_token
+       && request_id >= commands[i].first_request_id && request_id <= commands[i].last_request_id)
       return &(commands[i]);
   }
 
-  DPRINT("No active command found with fifo_token = %i", fifo_token);
+  DPRINT("No active command found with fifo_token = %i and request %i", fifo_token, request_id);
   return NULL;
 }
 
+void alp_register_app_action_handler(alp_operation_t operation, alp_app_action_handler_t handler)
+{
+  assert(handler != NULL);
+  for(uint8_t i = 0; i < MODULE_D7AP_ALP_APP_ACTION_HANDLER_COUNT; i++) {
+    if(app_action_handlers[i].handler == NULL || app_action_handlers[i].operation == operation) {
+      app_action_handlers[i] = (app_action_handler_registration_t){ .operation = operation, .handler = handler };
+      return;
+    }
+  }
+
+  assert(false); // no empty spot found
+}
+
+void alp_get_command_stats(pool_stats_t* stats)
+{
+  *stats = command_stats;
+}
+
+void alp_reset_command_stats()
+{
+  pool_stats_reset(&command_stats);
+}
+
+#ifdef FRAMEWORK_SHELL_ENABLED
+// the counters of the lower layers, printed by the shell
+static uint8_t get_dll_counters(shell_counter_t* counters)
+{
+  dll_rx_drop_counters_t drops;
+  dll_get_rx_drop_counters(&drops);
+  counters[0] = (shell_counter_t){ .name = "no_buffer", .value = drops.no_buffer };
+  counters[1] = (shell_counter_t){ .name = "evicted", .value = drops.evicted };
+  counters[2] = (shell_counter_t){ .name = "too_late", .value = drops.too_late };
+  counters[3] = (shell_counter_t){ .name = "filtered", .value = drops.filtered };
+
+  // the totals of the link statistics
+  dll_link_stats_t link_stats[MODULE_D7AP_DLL_LINK_STATS_SIZE];
+  uint8_t count = dll_get_link_stats(link_stats, MODULE_D7AP_DLL_LINK_STATS_SIZE);
+  uint32_t cca_attempts = 0, cca_failures = 0, rx_good = 0, rx_bad_crc = 0;
+  for(uint8_t i = 0; i < count; i++)
+  {
+    cca_attempts += link_stats[i].cca_attempts;
+    cca_failures += link_stats[i].cca_failures;
+    rx_good += link_stats[i].rx_good;
+    rx_bad_crc += link_stats[i].rx_bad_crc;
+  }
+
+  counters[4] = (shell_counter_t){ .name = "cca", .value = cca_attempts };
+  counters[5] = (shell_counter_t){ .name = "cca_busy", .value = cca_failures };
+  counters[6] = (shell_counter_t){ .name = "rx_good", .value = rx_good };
+  counters[7] = (shell_counter_t){ .name = "rx_bad_crc", .value = rx_bad_crc };
+  return 8;
+}
+
+static void reset_dll_counters()
+{
+  dll_reset_rx_drop_counters();
+  dll_reset_link_stats();
+}
+
+static uint8_t get_nls_counters(shell_counter_t* counters)
+{
+  d7anp_security_counters_t nls;
+  d7anp_get_security_counters(&nls);
+  counters[0] = (shell_counter_t){ .name = "malformed", .value = nls.malformed };
+  counters[1] = (shell_counter_t){ .name = "unknown_key", .value = nls.unknown_key };
+  counters[2] = (shell_counter_t){ .name = "replayed", .value = nls.replayed };
+  counters[3] = (shell_counter_t){ .name = "auth_failed", .value = nls.auth_failed };
+  return 4;
+}
+#endif
+
 void alp_init(alp_init_args_t* alp_init_args, bool is_shell_enabled)
 {
   init_args = alp_init_args;
   shell_enabled = is_shell_enabled;
   init_commands();
+  memset(action_file_layouts, 0, sizeof(action_file_layouts));
+  memset(app_action_handlers, 0, sizeof(app_action_handlers));
+#ifdef MODULE_D7AP_REMOTE_FILE_CACHE_ENABLED
+  remote_file_cache_init();
+#endif
+#ifdef MODULE_D7AP_BULK_TRANSFER_ENABLED
+  bulk_transfer_init();
+#endif
 
   uint8_t read_firmware_version_alp_command[] = { 0x01, D7A_FILE_FIRMWARE_VERSION_FILE_ID, 0, D7A_FILE_FIRMWARE_VERSION_SIZE };
   if(shell_enabled)
   {
 #ifdef FRAMEWORK_SHELL_ENABLED
       shell_init();
-      shell_register_handler((cmd_handler_registration_t){ .id = ALP_CMD_HANDLER_ID, .cmd_handler_callback = &alp_cmd_handler });
+      alp_cmd_handler_init();
+      shell_register_handler((cmd_handler_registration_t){ .id = ALP_CMD_HANDLER_ID,
+                                                           .get_cmd_length = &alp_cmd_handler_get_cmd_length,
+                                                           .cmd_handler_callback = &alp_cmd_handler });
+      shell_register_pool_stats("packets", &packet_queue_get_stats, &packet_queue_reset_stats);
+      shell_register_pool_stats("alp cmds", &alp_get_command_stats, &alp_reset_command_stats);
+      shell_register_counters("dll", &get_dll_counters, &reset_dll_counters);
+      shell_register_counters("nls", &get_nls_counters, &d7anp_reset_security_counters);
       // alp_cmd_handler_set_appl_itf_callback(alp_cmd_handler_appl_itf_cb); // TODO
 
       // notify booted to serial
@@ -132,18 +278,126 @@ static uint8_t process_action(uint8_t* alp_action, uint8_t* alp_response, uint8_
 
 }
 
+uint8_t alp_get_length_operand_size(uint32_t length)
+{
+    assert(length <= ALP_LENGTH_OPERAND_MAX);
+    if(length < 0x40) return 1;
+    if(length < 0x4000) return 2;
+    if(length < 0x400000) return 3;
+    return 4;
+}
+
+uint8_t alp_encode_length_operand(uint8_t* ptr, uint32_t length)
+{
+    uint8_t size = alp_get_length_operand_size(length);
+    for(uint8_t i = 0; i < size; i++)
+        ptr[i] = length >> (8 * (size - 1 - i));
+
+    ptr[0] |= (size - 1) << 6;
+    return size;
+}
+
+uint8_t alp_decode_length_operand(const uint8_t* ptr, uint32_t* length)
+{
+    uint8_t size = (ptr[0] >> 6) + 1;
+    *length = ptr[0] & 0x3F;
+    for(uint8_t i = 1; i < size; i++)
+        *length = (*length << 8) | ptr[i];
+
+    return size;
+}
+
+static error_t pop_length_operand(fifo_t* fifo, uint32_t* length)
+{
+    uint8_t operand[4];
+    error_t err = fifo_pop(fifo, operand, 1);
+    if(err != SUCCESS)
+        return err;
+
+    err = fifo_pop(fifo, operand + 1, operand[0] >> 6);
+    if(err != SUCCESS)
+        return err;
+
+    alp_decode_length_operand(operand, length);
+    return SUCCESS;
+}
+
+static error_t put_length_operand(fifo_t* fifo, uint32_t length)
+{
+    uint8_t operand[4];
+    return fifo_put(fifo, operand, alp_encode_length_operand(operand, length));
+}
+
+// decodes the file ID, offset and length operands following the control byte of a file data action, returns the size
+// of the action up to its data or 0 when the operands exceed the available bytes
+static uint8_t decode_file_data_operands(const uint8_t* action, uint16_t available, alp_operand_file_offset_t* file_offset, uint32_t* length)
+{
+    if(available < 4)
+        return 0;
+
+    uint8_t size = 2; // the control byte and file ID
+    if(size + (action[size] >> 6) + 2 > available)
+        return 0;
+
+    file_offset->file_id = action[1];
+    size += alp_decode_length_operand(&action[size], &file_offset->offset);
+    if(size + (action[size] >> 6) + 1 > available)
+        return 0;
+
+    size += alp_decode_length_operand(&action[size], length);
+    return size;
+}
+
+// the command continues with a complete file data action header, the operands can be popped
+static bool has_file_data_operands(alp_command_t* command) {
+  uint8_t* action;
+  uint16_t readable = fifo_get_contiguous_readable(&command->alp_command_fifo, &action);
+  alp_operand_file_offset_t file_offset;
+  uint32_t length;
+  return decode_file_data_operands(action, readable, &file_offset, &length) != 0;
+}
+
+// the room left in the response, its fifo is sized to the buffer of the caller
+static uint16_t get_response_space(alp_command_t* command) {
+  return command->alp_response_fifo.max_size - fifo_get_size(&command->alp_response_fifo);
+}
+
+static alp_status_codes_t put_file_data_response(alp_command_t* command, const alp_operand_file_data_request_t* operand, const uint8_t* data) {
+  uint16_t response_length = 2 + alp_get_length_operand_size(operand->file_offset.offset)
+      + alp_get_length_operand_size(operand->requested_data_length) + operand->requested_data_length;
+  if(response_length > get_response_space(command))
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+
+  error_t err;
+  err = fifo_put_byte(&command->alp_response_fifo, ALP_OP_RETURN_FILE_DATA); assert(err == SUCCESS);
+  err = fifo_put_byte(&command->alp_response_fifo, operand->file_offset.file_id); assert(err == SUCCESS);
+  err = put_length_operand(&command->alp_response_fifo, operand->file_offset.offset); assert(err == SUCCESS);
+  err = put_length_operand(&command->alp_response_fifo, operand->requested_data_length); assert(err == SUCCESS);
+  err = fifo_put(&command->alp_response_fifo, data, operand->requested_data_length); assert(err == SUCCESS);
+  return ALP_STATUS_OK;
+}
+
 static alp_status_codes_t process_op_read_file_data(alp_command_t* command) {
   alp_operand_file_data_request_t operand;
+  if(!has_file_data_operands(command))
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+
   error_t err;
   err = fifo_skip(&command->alp_command_fifo, 1); assert(err == SUCCESS); // skip the control byte
   err = fifo_pop(&command->alp_command_fifo, &operand.file_offset.file_id, 1); assert(err == SUCCESS);
-  err = fifo_pop(&command->alp_command_fifo, &operand.file_offset.offset, 1); assert(err == SUCCESS); // TODO can be 1-4 bytes, assume 1 for now
-  err = fifo_pop(&command->alp_command_fifo, &operand.requested_data_length, 1); assert(err == SUCCESS);
-  DPRINT("READ FILE %i LEN %i", operand.file_offset.file_id, operand.requested_data_length);
+  err = pop_length_operand(&command->alp_command_fifo, &operand.file_offset.offset); assert(err == SUCCESS);
+  err = pop_length_operand(&command->alp_command_fifo, &operand.requested_data_length); assert(err == SUCCESS);
+  DPRINT("READ FILE %i OFFSET %i LEN %i", operand.file_offset.file_id, operand.file_offset.offset, operand.requested_data_length);
 
-  if(operand.requested_data_length <= 0)
+  // larger files are read in chunks, using the offset
+  if(operand.requested_data_length <= 0 || operand.requested_data_length > ALP_PAYLOAD_MAX_SIZE)
     return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error + move to fs_read_file?
 
+  // the data of the file system is put in the response directly
+  const uint8_t* view = fs_get_file_view(operand.file_offset.file_id, operand.file_offset.offset, operand.requested_data_length);
+  if(view != NULL)
+    return put_file_data_response(command, &operand, view);
+
   uint8_t data[operand.requested_data_length];
   alp_status_codes_t alp_status = fs_read_file(operand.file_offset.file_id, operand.file_offset.offset, data, operand.requested_data_length);
   if(alp_status == ALP_STATUS_FILE_ID_NOT_EXISTS) {
@@ -152,39 +406,331 @@ static alp_status_codes_t process_op_read_file_data(alp_command_t* command) {
       alp_status = init_args->alp_unhandled_read_action_cb(operand, data);
   }
 
-  if(alp_status == ALP_STATUS_OK) {
-    // fill response
-    err = fifo_put_byte(&command->alp_response_fifo, ALP_OP_RETURN_FILE_DATA); assert(err == SUCCESS);
-    err = fifo_put_byte(&command->alp_response_fifo, operand.file_offset.file_id); assert(err == SUCCESS);
-    err = fifo_put_byte(&command->alp_response_fifo, operand.file_offset.offset); assert(err == SUCCESS); // TODO can be 1-4 bytes, assume 1 for now
-    err = fifo_put_byte(&command->alp_response_fifo, operand.requested_data_length); assert(err == SUCCESS);
-    err = fifo_put(&command->alp_response_fifo, data, operand.requested_data_length); assert(err == SUCCESS);
-  }
+  if(alp_status == ALP_STATUS_OK)
+    alp_status = put_file_data_response(command, &operand, data);
 
   return alp_status;
 }
 
 static alp_status_codes_t process_op_write_file_data(alp_command_t* command) {
   alp_operand_file_data_t operand;
+  if(!has_file_data_operands(command))
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+
   error_t err;
   err = fifo_skip(&command->alp_command_fifo, 1); assert(err == SUCCESS); // skip the control byte
   err = fifo_pop(&command->alp_command_fifo, &operand.file_offset.file_id, 1); assert(err == SUCCESS);
-  err = fifo_pop(&command->alp_command_fifo, &operand.file_offset.offset, 1); assert(err == SUCCESS); // TODO can be 1-4 bytes, assume 1 for now
-  err = fifo_pop(&command->alp_command_fifo, &operand.provided_data_length, 1); assert(err == SUCCESS);
-  DPRINT("WRITE FILE %i LEN %i", operand.file_offset.file_id, operand.provided_data_length);
+  err = pop_length_operand(&command->alp_command_fifo, &operand.file_offset.offset); assert(err == SUCCESS);
+  err = pop_length_operand(&command->alp_command_fifo, &operand.provided_data_length); assert(err == SUCCESS);
+  DPRINT("WRITE FILE %i OFFSET %i LEN %i", operand.file_offset.file_id, operand.file_offset.offset, operand.provided_data_length);
+
+  // the data is written from the command buffer
+  uint8_t* data;
+  if(fifo_get_contiguous_readable(&command->alp_command_fifo, &data) < operand.provided_data_length)
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
 
-  uint8_t data[operand.provided_data_length];
-  err = fifo_pop(&command->alp_command_fifo, data, operand.provided_data_length);
+  err = fifo_skip(&command->alp_command_fifo, operand.provided_data_length); assert(err == SUCCESS);
   return fs_write_file(operand.file_offset.file_id, operand.file_offset.offset, data, operand.provided_data_length);
 }
 
+// the file header operand: permissions, properties, action file ID, interface file ID, file size and allocated size
+#define ALP_FILE_HEADER_OPERAND_SIZE 12
+
+#ifdef MODULE_D7AP_ALP_FILE_MANAGEMENT_ENABLED
+static alp_status_codes_t process_op_create_file(alp_command_t* command) {
+  uint8_t file_id;
+  uint8_t header[ALP_FILE_HEADER_OPERAND_SIZE];
+  if(fifo_get_size(&command->alp_command_fifo) < 2 + ALP_FILE_HEADER_OPERAND_SIZE)
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+
+  error_t err;
+  err = fifo_skip(&command->alp_command_fifo, 1); assert(err == SUCCESS); // skip the control byte
+  err = fifo_pop(&command->alp_command_fifo, &file_id, 1); assert(err == SUCCESS);
+  err = fifo_pop(&command->alp_command_fifo, header, ALP_FILE_HEADER_OPERAND_SIZE); assert(err == SUCCESS);
+  DPRINT("CREATE FILE %i", file_id);
+
+  // the file is allocated at its size, and interface files are not supported
+  uint32_t length;
+  memcpy(&length, header + 4, sizeof(uint32_t));
+  fs_file_header_t file_header = {
+    .file_properties.permissions = header[0],
+    .file_properties.action_protocol_enabled = header[1] >> 7,
+    .file_properties.action_condition = (header[1] >> 4) & 0x07,
+    .file_properties.storage_class = header[1] & 0x03,
+    .file_properties.action_file_id = header[2],
+    .length = __builtin_bswap32(length)
+  };
+
+  return fs_create_file(file_id, &file_header, NULL);
+}
+
+static alp_status_codes_t process_op_delete_file(alp_command_t* command) {
+  uint8_t file_id;
+  if(fifo_get_size(&command->alp_command_fifo) < 2)
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+
+  error_t err;
+  err = fifo_skip(&command->alp_command_fifo, 1); assert(err == SUCCESS); // skip the control byte
+  err = fifo_pop(&command->alp_command_fifo, &file_id, 1); assert(err == SUCCESS);
+  DPRINT("DELETE FILE %i", file_id);
+  return fs_delete_file(file_id);
+}
+#endif
+
+// the number of consecutive file data actions served at once
+#define ALP_MAX_BATCHED_FILE_ACTIONS 8
+
+// serves the consecutive read file data actions at the head of the command in one fs_read_files_v() pass, the data is
+// read in place in the response which is then added at once. Returns false when the actions have to be processed one by one
+static bool process_batched_read_file_data(alp_command_t* command) {
+  uint8_t* action;
+  uint16_t readable = fifo_get_contiguous_readable(&command->alp_command_fifo, &action);
+  uint8_t response[ALP_PAYLOAD_MAX_SIZE];
+  fs_file_segment_t segments[ALP_MAX_BATCHED_FILE_ACTIONS];
+  uint8_t count = 0;
+  uint16_t command_length = 0;
+  uint16_t response_length = 0;
+  // the control byte of the next action is only read while the command has bytes left
+  while(count < ALP_MAX_BATCHED_FILE_ACTIONS && command_length < readable) {
+    alp_control_t control = { .raw = action[0] };
+    alp_operand_file_offset_t file_offset;
+    uint32_t length;
+    uint8_t action_length = decode_file_data_operands(action, readable - command_length, &file_offset, &length);
+    if(action_length == 0 || control.operation != ALP_OP_READ_FILE_DATA || length == 0
+       || response_length + action_length + length > get_response_space(command))
+      break;
+
+    // the response action: operation, the operands as encoded in the request and the data
+    response[response_length] = ALP_OP_RETURN_FILE_DATA;
+    memcpy(&response[response_length + 1], &action[1], action_length - 1);
+    segments[count] = (fs_file_segment_t){ .file_id = file_offset.file_id, .offset = file_offset.offset, .length = length,
+                                           .buffer = &response[response_length + action_length] };
+    response_length += action_length + length;
+    command_length += action_length;
+    action += action_length;
+    count++;
+  }
+
+  if(count < 2 || fs_read_files_v(segments, count) != ALP_STATUS_OK)
+    return false;
+
+  DPRINT("READ %i FILES", count);
+  error_t err = fifo_skip(&command->alp_command_fifo, command_length); assert(err == SUCCESS);
+  err = fifo_put(&command->alp_response_fifo, response, response_length); assert(err == SUCCESS);
+  return true;
+}
+
+// like process_batched_read_file_data(), the data is written from the command buffer
+static bool process_batched_write_file_data(alp_command_t* command) {
+  uint8_t* action;
+  uint16_t readable = fifo_get_contiguous_readable(&command->alp_command_fifo, &action);
+  fs_file_segment_t segments[ALP_MAX_BATCHED_FILE_ACTIONS];
+  uint8_t count = 0;
+  uint16_t command_length = 0;
+  while(count < ALP_MAX_BATCHED_FILE_ACTIONS && command_length < readable) {
+    alp_control_t control = { .raw = action[0] };
+    alp_operand_file_offset_t file_offset;
+    uint32_t length;
+    uint8_t action_length = decode_file_data_operands(action, readable - command_length, &file_offset, &length);
+    if(action_length == 0 || control.operation != ALP_OP_WRITE_FILE_DATA || command_length + action_length + length > readable)
+      break;
+
+    segments[count] = (fs_file_segment_t){ .file_id = file_offset.file_id, .offset = file_offset.offset, .length = length,
+                                           .buffer = &action[action_length] };
+    command_length += action_length + length;
+    action += action_length + length;
+    count++;
+  }
+
+  if(count < 2 || fs_write_files_v(segments, count) != ALP_STATUS_OK)
+    return false;
+
+  DPRINT("WRITE %i FILES", count);
+  error_t err = fifo_skip(&command->alp_command_fifo, command_length); assert(err == SUCCESS);
+  return true;
+}
+
+// compares the big endian values a and b (zero when NULL), after masking, returns <0, 0 or >0
+static int compare_query_values(const uint8_t* a, const uint8_t* b, const uint8_t* mask, uint8_t length, bool signed_data) {
+  for(uint8_t i = 0; i < length; i++) {
+    uint8_t m = mask ? mask[i] : 0xFF;
+    uint8_t va = a[i] & m;
+    uint8_t vb = b ? b[i] & m : 0;
+    if(i == 0 && signed_data) {
+      // flipping the sign bit orders two's complement values as unsigned ones
+      va ^= 0x80;
+      vb ^= 0x80;
+    }
+
+    if(va != vb)
+      return va < vb ? -1 : 1;
+  }
+
+  return 0;
+}
+
+static bool is_comparison_true(int result, alp_query_comparison_t comparison) {
+  switch(comparison) {
+    case ALP_QUERY_COMP_INEQUALITY: return result != 0;
+    case ALP_QUERY_COMP_EQUALITY: return result == 0;
+    case ALP_QUERY_COMP_LESS_THAN: return result < 0;
+    case ALP_QUERY_COMP_LESS_THAN_OR_EQUAL: return result <= 0;
+    case ALP_QUERY_COMP_GREATER_THAN: return result > 0;
+    case ALP_QUERY_COMP_GREATER_THAN_OR_EQUAL: return result >= 0;
+    default: return false;
+  }
+}
+
+// the file data of a query is read in chunks through a buffer of this size, split in two for a comparison between files
+#define ALP_QUERY_CHUNK_SIZE 32
+
+// decodes the file ID and offset operands of a query, returns their size or 0 when they exceed the available bytes
+static uint8_t decode_query_file_offset(const uint8_t* operand, uint16_t available, alp_operand_file_offset_t* file_offset) {
+  if(available < 2 || 2 + (operand[1] >> 6) > available)
+    return 0;
+
+  file_offset->file_id = operand[0];
+  return 1 + alp_decode_length_operand(&operand[1], &file_offset->offset);
+}
+
+// compares the file area with the value of the command (zero when NULL) or, when given, with a second file area. The
+// areas are read completely, returns false when one cannot be read
+static bool compare_query_file_data(const alp_operand_file_offset_t* file, const alp_operand_file_offset_t* other_file,
+                                    const uint8_t* value, const uint8_t* mask, uint32_t length, bool signed_data, int* result) {
+  uint8_t buffer[ALP_QUERY_CHUNK_SIZE];
+  uint8_t chunk_size = other_file ? sizeof(buffer) / 2 : sizeof(buffer);
+  *result = 0;
+  for(uint32_t offset = 0; offset < length; offset += chunk_size) {
+    uint8_t size = length - offset < chunk_size ? length - offset : chunk_size;
+    if(fs_read_file(file->file_id, file->offset + offset, buffer, size) != ALP_STATUS_OK)
+      return false;
+
+    const uint8_t* reference = value ? value + offset : NULL;
+    if(other_file) {
+      reference = buffer + chunk_size;
+      if(fs_read_file(other_file->file_id, other_file->offset + offset, buffer + chunk_size, size) != ALP_STATUS_OK)
+        return false;
+    }
+
+    // only the first chunk holds the sign
+    if(*result == 0)
+      *result = compare_query_values(buffer, reference, mask ? mask + offset : NULL, size, signed_data && offset == 0);
+  }
+
+  return true;
+}
+
+// evaluates the query of an action or break query against the local files, a file area which cannot be read never matches.
+// The mask and the values are compared in place in the command
+static alp_status_codes_t process_op_query(alp_command_t* command, bool* match) {
+  *match = false;
+  uint8_t* action;
+  uint16_t available = fifo_get_contiguous_readable(&command->alp_command_fifo, &action);
+  if(available < 3 || 3 + (action[2] >> 6) > available) {
+    fifo_clear(&command->alp_command_fifo);
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+  }
+
+  alp_query_code_t code = { .raw = action[1] };
+  uint32_t length;
+  uint16_t size = 2 + alp_decode_length_operand(&action[2], &length);
+  if(length > ALP_PAYLOAD_MAX_SIZE) {
+    // the mask and value cannot be part of the command, the remaining actions cannot be parsed
+    fifo_clear(&command->alp_command_fifo);
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+  }
+
+  uint8_t value_count;
+  uint8_t file_count = 1;
+  switch(code.type) {
+    case ALP_QUERY_TYPE_NON_VOID:
+    case ALP_QUERY_TYPE_ARITH_COMP_WITH_ZERO:
+      value_count = 0;
+      break;
+    case ALP_QUERY_TYPE_ARITH_COMP_WITH_VALUE:
+      value_count = 1;
+      break;
+    case ALP_QUERY_TYPE_ARITH_COMP_BETWEEN_FILES:
+      value_count = 0;
+      file_count = 2;
+      break;
+    case ALP_QUERY_TYPE_RANGE_COMP:
+      value_count = 2;
+      break;
+    default:
+      // TODO string token search
+      DPRINT("Query type %i not supported", code.type);
+      fifo_clear(&command->alp_command_fifo);
+      return ALP_STATUS_UNKNOWN_OPERATION;
+  }
+
+  const uint8_t* mask = NULL;
+  if(code.mask_present) {
+    mask = &action[size];
+    size += length;
+  }
+
+  const uint8_t* values = &action[size];
+  size += value_count * length;
+  alp_operand_file_offset_t files[2];
+  for(uint8_t i = 0; i < file_count; i++) {
+    uint8_t operand_size = size < available ? decode_query_file_offset(&action[size], available - size, &files[i]) : 0;
+    if(operand_size == 0) {
+      fifo_clear(&command->alp_command_fifo);
+      return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+    }
+
+    size += operand_size;
+  }
+
+  error_t err = fifo_skip(&command->alp_command_fifo, size); assert(err == SUCCESS);
+
+  int result;
+  int maximum_result;
+  switch(code.type) {
+    case ALP_QUERY_TYPE_NON_VOID:
+      *match = compare_query_file_data(&files[0], NULL, NULL, NULL, length, false, &result);
+      break;
+    case ALP_QUERY_TYPE_ARITH_COMP_WITH_ZERO:
+    case ALP_QUERY_TYPE_ARITH_COMP_WITH_VALUE:
+      *match = compare_query_file_data(&files[0], NULL, value_count ? values : NULL, mask, length, code.signed_data, &result)
+               && is_comparison_true(result, code.comparison);
+      break;
+    case ALP_QUERY_TYPE_ARITH_COMP_BETWEEN_FILES:
+      *match = compare_query_file_data(&files[0], &files[1], NULL, mask, length, code.signed_data, &result)
+               && is_comparison_true(result, code.comparison);
+      break;
+    case ALP_QUERY_TYPE_RANGE_COMP:
+      *match = compare_query_file_data(&files[0], NULL, values, mask, length, code.signed_data, &result)
+               && compare_query_file_data(&files[0], NULL, values + length, mask, length, code.signed_data, &maximum_result)
+               && result >= 0 && maximum_result <= 0;
+      break;
+  }
+
+  DPRINT("QUERY type %i match %i", code.type, *match);
+  return ALP_STATUS_OK;
+}
+
 static alp_status_codes_t process_op_forward(alp_command_t* command, d7asp_master_session_config_t* session_config) {
   // TODO move session config to alp_command_t struct
-  uint8_t interface_id;
+  // the control byte, interface ID, QoS, dormant timeout, addressee control and access class precede the addressee ID
+  uint8_t header[6];
+  if(fifo_peek(&command->alp_command_fifo, header, 0, sizeof(header)) != SUCCESS)
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+
+  d7anp_addressee_ctrl addressee_ctrl = { .raw = header[4] };
+  if(fifo_get_size(&command->alp_command_fifo) < sizeof(header) + d7anp_addressee_id_length(addressee_ctrl.id_type))
+    return ALP_STATUS_UNKNOWN_ERROR;
+
+  if(header[1] != ALP_ITF_ID_D7ASP)
+    return ALP_STATUS_UNKNOWN_OPERATION; // only D7ASP supported for now
+
+  // the session is set up with the access profile and the NLS method of the addressee
+  if(!fs_is_access_class_defined(header[5] >> 4) || !d7anp_is_nls_method_supported(addressee_ctrl.nls_method))
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+
   error_t err;
-  err = fifo_skip(&command->alp_command_fifo, 1); assert(err == SUCCESS); // skip the control byte
-  err = fifo_pop(&command->alp_command_fifo, &interface_id, 1); assert(err == SUCCESS);
-  assert(interface_id == ALP_ITF_ID_D7ASP); // only D7ASP supported for now // TODO return error instead of asserting
+  err = fifo_skip(&command->alp_command_fifo, 2); assert(err == SUCCESS); // skip the control byte and interface ID
   err = fifo_pop(&command->alp_command_fifo, &session_config->qos.raw, 1); assert(err == SUCCESS);
   err = fifo_pop(&command->alp_command_fifo, &session_config->dormant_timeout, 1); assert(err == SUCCESS);
   err = fifo_pop(&command->alp_command_fifo, &session_config->addressee.ctrl.raw, 1); assert(err == SUCCESS);
@@ -196,7 +742,148 @@ static alp_status_codes_t process_op_forward(alp_command_t* command, d7asp_maste
   return ALP_STATUS_PARTIALLY_COMPLETED;
 }
 
+static uint8_t get_action_length(uint8_t* alp_action, uint16_t available, uint8_t* expected_response_length);
+
+#ifdef MODULE_D7AP_REMOTE_FILE_CACHE_ENABLED
+static void add_interface_status_action(fifo_t* alp_response_fifo, d7asp_result_t* d7asp_result);
+
+// answers the reads the host forwards to a node from the remote file cache, which is only done when all forwarded actions
+// are reads of fresh cached data. The response is an interface status and the returned file data, like over the air
+static bool answer_from_remote_file_cache(alp_command_t* command, d7asp_master_session_config_t* session_config) {
+  if(command->origin != ALP_CMD_ORIGIN_SERIAL_CONSOLE || session_config->addressee.ctrl.id_type != ID_TYPE_UID)
+    return false;
+
+  uint8_t* actions;
+  uint8_t actions_length = fifo_get_contiguous_readable(&command->alp_command_fifo, &actions);
+  if(actions_length == 0 || actions_length != fifo_get_size(&command->alp_command_fifo))
+    return false;
+
+  uint8_t data[MODULE_D7AP_REMOTE_FILE_CACHE_DATA_SIZE];
+  d7asp_result_t d7asp_result;
+  alp_operand_file_offset_t file_offset;
+  uint32_t length;
+  uint16_t response_length = ALP_D7ASP_INTERFACE_STATUS_ACTION_MAX_SIZE;
+  for(uint8_t* action = actions; action < actions + actions_length; ) {
+    uint8_t expected_response_length = 0;
+    uint8_t operands_length = decode_file_data_operands(action, actions + actions_length - action, &file_offset, &length);
+    uint8_t action_length = get_action_length(action, actions + actions_length - action, &expected_response_length);
+    if(alp_get_operation(action) != ALP_OP_READ_FILE_DATA || operands_length == 0 || action_length == 0
+       || length > MODULE_D7AP_REMOTE_FILE_CACHE_DATA_SIZE
+       || !remote_file_cache_read(session_config->addressee.id, file_offset.file_id, file_offset.offset, data, length, &d7asp_result))
+      return false;
+
+    response_length += operands_length + length;
+    action += action_length;
+  }
+
+  // the reads are forwarded when the cached data does not fit in the response
+  if(response_length > get_response_space(command))
+    return false;
+
+  DPRINT("Answered from the remote file cache");
+  d7asp_result.addressee = &session_config->addressee;
+  add_interface_status_action(&command->alp_response_fifo, &d7asp_result);
+  for(uint8_t* action = actions; action < actions + actions_length; ) {
+    uint8_t expected_response_length = 0;
+    uint8_t operands_length = decode_file_data_operands(action, actions + actions_length - action, &file_offset, &length);
+    remote_file_cache_read(session_config->addressee.id, file_offset.file_id, file_offset.offset, data, length, &d7asp_result);
+    error_t err = fifo_put_byte(&command->alp_response_fifo, ALP_OP_RETURN_FILE_DATA); assert(err == SUCCESS);
+    err = fifo_put(&command->alp_response_fifo, action + 1, operands_length - 1); assert(err == SUCCESS); // file ID, offset and length
+    err = fifo_put(&command->alp_response_fifo, data, length); assert(err == SUCCESS);
+    action += get_action_length(action, actions + actions_length - action, &expected_response_length);
+  }
+
+  fifo_skip(&command->alp_command_fifo, actions_length);
+  return true;
+}
+
+// the cached data of the files written by the forwarded actions is outdated
+static void invalidate_remote_files(d7anp_addressee_t* addressee, uint8_t* actions, uint8_t actions_length) {
+  if(addressee->ctrl.id_type != ID_TYPE_UID)
+    return;
+
+  for(uint8_t* action = actions; action < actions + actions_length; ) {
+    uint8_t expected_response_length = 0;
+    uint8_t action_length = get_action_length(action, actions + actions_length - action, &expected_response_length);
+    if(action_length == 0)
+      break; // these actions are dropped
+
+    if(alp_get_operation(action) == ALP_OP_WRITE_FILE_DATA)
+      remote_file_cache_invalidate(addressee->id, action[1]);
+
+    action += action_length;
+  }
+}
+
+// caches the file data returned in the response to a forwarded command
+static void cache_returned_file_data(d7asp_result_t* d7asp_result, uint8_t* actions, uint8_t actions_length) {
+  alp_operand_file_offset_t file_offset;
+  uint32_t length;
+  for(uint8_t* action = actions; action < actions + actions_length; ) {
+    uint8_t expected_response_length = 0;
+    uint8_t operands_length;
+    if(alp_get_operation(action) == ALP_OP_RETURN_FILE_DATA
+       && (operands_length = decode_file_data_operands(action, actions + actions_length - action, &file_offset, &length)) != 0
+       && length <= actions + actions_length - action - operands_length)
+      remote_file_cache_update(d7asp_result, file_offset.file_id, file_offset.offset, action + operands_length, length);
+
+    uint8_t action_length = get_action_length(action, actions + actions_length - action, &expected_response_length);
+    if(action_length == 0)
+      break;
+
+    action += action_length;
+  }
+}
+#endif
+
+// the remaining actions of the command are dispatched to the application
+static bool is_forward_to_app(alp_command_t* command) {
+  uint8_t interface_id;
+  if(fifo_peek(&command->alp_command_fifo, &interface_id, 1, 1) != SUCCESS || interface_id != ALP_ITF_ID_APP)
+    return false;
+
+  error_t err = fifo_skip(&command->alp_command_fifo, 2); assert(err == SUCCESS); // skip the control byte and interface ID
+  DPRINT("FORWARD to APP");
+  return true;
+}
+
+static alp_app_action_handler_t get_app_action_handler(alp_operation_t operation) {
+  for(uint8_t i = 0; i < MODULE_D7AP_ALP_APP_ACTION_HANDLER_COUNT; i++) {
+    if(app_action_handlers[i].handler != NULL && app_action_handlers[i].operation == operation)
+      return app_action_handlers[i].handler;
+  }
+
+  return NULL;
+}
+
+// the handler gets the action in place in the buffer of the command, instead of it being written to a file first
+static alp_status_codes_t process_app_action(alp_command_t* command) {
+  uint8_t* alp_action;
+  uint8_t expected_response_length = 0;
+  uint16_t available = fifo_get_contiguous_readable(&command->alp_command_fifo, &alp_action);
+  uint8_t alp_action_length = get_action_length(alp_action, available, &expected_response_length);
+  if(alp_action_length == 0) {
+    fifo_clear(&command->alp_command_fifo);
+    return ALP_STATUS_UNKNOWN_OPERATION; // the actions following it cannot be located
+  }
+
+  alp_status_codes_t alp_status = ALP_STATUS_UNKNOWN_OPERATION;
+  alp_app_action_handler_t handler = get_app_action_handler(alp_get_operation(alp_action));
+  if(handler != NULL)
+    alp_status = handler(alp_action, alp_action_length, &command->alp_response_fifo);
+  else if(alp_cmd_handler_process_appl_itf_action(alp_action, alp_action_length))
+    alp_status = ALP_STATUS_OK;
+  else
+    DPRINT("No APP handler for operation %i", alp_get_operation(alp_action));
+
+  error_t err = fifo_skip(&command->alp_command_fifo, alp_action_length); assert(err == SUCCESS);
+  return alp_status;
+}
+
 static alp_status_codes_t process_op_request_tag(alp_command_t* command, bool respond_when_completed) {
+  if(fifo_get_size(&command->alp_command_fifo) < 2)
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+
   error_t err;
   err = fifo_skip(&command->alp_command_fifo, 1); assert(err == SUCCESS); // skip the control byte
   err = fifo_pop(&command->alp_command_fifo, &command->tag_id, 1); assert(err == SUCCESS);
@@ -205,22 +892,26 @@ static alp_status_codes_t process_op_request_tag(alp_command_t* command, bool re
 }
 
 static alp_status_codes_t process_op_return_file_data(alp_command_t* command) {
-  uint8_t offset_operand_size = 2; // TODO we are assuming offset operand to be 2 bytes for now
-  uint8_t total_len = 1 + offset_operand_size; // ALP control byte
-  uint8_t requested_data_length_size = 1; // TODO we are assuming requested data length is coded in 1 bytes here, but can be 4
-  total_len += requested_data_length_size;
-  uint8_t data_len;
-  fifo_peek(&command->alp_command_fifo, &data_len, 1 + offset_operand_size, requested_data_length_size);
-  total_len += data_len;
-
-  uint8_t alp_response[ALP_PAYLOAD_MAX_SIZE];
-  fifo_pop(&command->alp_command_fifo, alp_response, total_len);
+  uint8_t* alp_response;
+  uint16_t readable = fifo_get_contiguous_readable(&command->alp_command_fifo, &alp_response);
+  alp_operand_file_offset_t file_offset;
+  uint32_t data_len;
+  uint8_t operands_len = decode_file_data_operands(alp_response, readable, &file_offset, &data_len);
+  if(operands_len == 0 || data_len > readable - operands_len)
+    return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+
+  uint8_t total_len = operands_len + data_len;
+  fifo_skip(&command->alp_command_fifo, total_len);
+
+#ifdef MODULE_D7AP_REMOTE_FILE_CACHE_ENABLED
+  remote_file_cache_update(&command->d7asp_result, file_offset.file_id, file_offset.offset, alp_response + operands_len, data_len);
+#endif
 
   if(shell_enabled)
-    alp_cmd_handler_output_d7asp_response(current_d7asp_result, alp_response, total_len);
+    alp_cmd_handler_output_d7asp_response(command->d7asp_result, alp_response, total_len);
 
   if(init_args != NULL && init_args->alp_received_unsolicited_data_cb != NULL)
-    init_args->alp_received_unsolicited_data_cb(current_d7asp_result, alp_response, total_len);
+    init_args->alp_received_unsolicited_data_cb(command->d7asp_result, alp_response, total_len);
 
   return ALP_STATUS_OK;
 }
@@ -233,17 +924,194 @@ static void add_tag_response(alp_command_t* command, bool eop, bool error) {
   err = fifo_put_byte(&command->alp_response_fifo, command->tag_id); assert(err == SUCCESS);
 }
 
+static bool process_command(alp_command_t* command, uint8_t* alp_command, uint8_t alp_command_length, uint8_t* alp_response,
+                            uint8_t* alp_response_length, uint8_t alp_response_max_length, alp_command_origin_t origin);
+
+// packs as many actions as fit in a request of max_request_length bytes in each request. Returns ESIZE when an action
+// does not fit a request, or when the actions need more requests than a session holds
+static error_t pack_alp_actions(uint8_t max_request_length, uint8_t* alp_actions, uint8_t alp_actions_length, request_layout_t* layout)
+{
+  uint8_t* request_start = alp_actions;
+  uint8_t* ptr = alp_actions;
+  uint8_t* end = alp_actions + alp_actions_length;
+  layout->max_request_length = max_request_length;
+  layout->action_count = 0;
+  layout->request_count = 0;
+
+  do {
+    uint8_t expected_response_length = 0;
+    ptr = request_start;
+    while(ptr < end) {
+      uint8_t action_response_length = 0;
+      uint8_t action_length = get_action_length(ptr, end - ptr, &action_response_length);
+      if(action_length == 0) {
+        // the actions following an unknown one cannot be located, they are not forwarded
+        log_stack_warning(LOG_STACK_ALP, "Unknown ALP operation %i, the remaining actions are dropped", alp_get_operation(ptr));
+        end = ptr;
+        break;
+      }
+
+      if(ptr != request_start && ptr + action_length - request_start > max_request_length)
+        break;
+
+      if(action_length > max_request_length) {
+        // TODO a single action which does not fit a frame needs to be split up
+        log_stack_warning(LOG_STACK_ALP, "ALP action of %i bytes exceeds the request MTU of %i bytes", action_length, max_request_length);
+        return ESIZE;
+      }
+
+      ptr += action_length;
+      expected_response_length += action_response_length;
+      layout->action_count++;
+    }
+
+    if(layout->request_count == MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT) {
+      log_stack_warning(LOG_STACK_ALP, "ALP actions need more than %i requests", MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT);
+      return ESIZE;
+    }
+
+    layout->request_lengths[layout->request_count] = ptr - request_start;
+    layout->response_lengths[layout->request_count] = expected_response_length;
+    layout->request_count++;
+    request_start = ptr;
+  } while(request_start < end);
+
+  return SUCCESS;
+}
+
+// the room for the requests is checked against the longest one
+static bool fits_session_queue(d7asp_master_session_t* session, const request_layout_t* layout)
+{
+  uint8_t max_request_length = 0;
+  for(uint8_t i = 0; i < layout->request_count; i++) {
+    if(layout->request_lengths[i] > max_request_length)
+      max_request_length = layout->request_lengths[i];
+  }
+
+  return d7asp_get_queue_capacity(session, max_request_length) >= layout->request_count;
+}
+
+// queues the requests of the layout, returns the first request with the worst case latency of the last one
+static d7asp_queue_result_t queue_alp_requests(d7asp_master_session_t* session, uint8_t* alp_actions, const request_layout_t* layout,
+                                               d7asp_request_priority_t priority, uint8_t* last_request_id)
+{
+  d7asp_queue_result_t first_result;
+  for(uint8_t i = 0; i < layout->request_count; i++) {
+    DPRINT("Queue request of %i bytes (MTU %i)", layout->request_lengths[i], layout->max_request_length);
+    d7asp_queue_result_t result = d7asp_queue_alp_actions(session, alp_actions, layout->request_lengths[i], layout->response_lengths[i], priority);
+    if(i == 0)
+      first_result = result;
+
+    first_result.worst_case_latency = result.worst_case_latency;
+    *last_request_id = result.request_id;
+    alp_actions += layout->request_lengths[i];
+  }
+
+  return first_result;
+}
+
+// queues the requests on the session, the results and the completion are routed back to the command
+static d7asp_queue_result_t forward_command_requests(alp_command_t* command, d7asp_master_session_t* session, uint8_t* alp_actions,
+                                                     const request_layout_t* layout, d7asp_request_priority_t priority)
+{
+  d7asp_queue_result_t queue_result = queue_alp_requests(session, alp_actions, layout, priority, &command->last_request_id);
+  command->fifo_token = queue_result.fifo_token;
+  command->first_request_id = queue_result.request_id;
+  command->is_forwarded = true;
+  DPRINT("Forwarded cmd on fifo %i, requests %i-%i", command->fifo_token, command->first_request_id, command->last_request_id);
+  return queue_result;
+}
+
+// queues the actions on the session matching the config, returns ESIZE when they do not fit the requests of the session.
+// Nothing is queued then, the command is not forwarded
+static error_t forward_command(alp_command_t* command, d7asp_master_session_config_t* session_config, uint8_t* alp_actions,
+                               uint8_t alp_actions_length, d7asp_request_priority_t priority, d7asp_queue_result_t* queue_result)
+{
+  d7asp_master_session_t* session = d7asp_master_session_create(session_config);
+  request_layout_t layout;
+  error_t err = pack_alp_actions(d7asp_get_max_request_length(session), alp_actions, alp_actions_length, &layout);
+  if(err != SUCCESS)
+    return err;
+
+  if(!fits_session_queue(session, &layout)) {
+    log_stack_warning(LOG_STACK_ALP, "No room for %i requests in the session", layout.request_count);
+    return ESIZE;
+  }
+
+  // no response is requested in these modes, the data requested by the actions is not expected back
+  if(session_config->qos.qos_resp_mode == SESSION_RESP_MODE_NO || session_config->qos.qos_resp_mode == SESSION_RESP_MODE_NO_RPT)
+    memset(layout.response_lengths, 0, sizeof(layout.response_lengths));
+
+  d7asp_queue_result_t result = forward_command_requests(command, session, alp_actions, &layout, priority);
+  if(queue_result != NULL)
+    *queue_result = result;
+
+  return SUCCESS;
+}
+
 void alp_process_command_result_on_d7asp(d7asp_master_session_config_t* session_config, uint8_t* alp_command, uint8_t alp_command_length, alp_command_origin_t origin)
 {
+  uint8_t alp_result[ALP_PAYLOAD_MAX_SIZE];
   uint8_t alp_result_length = 0;
   // TODO refactor
   alp_command_t* command = alloc_command();
   assert(command != NULL);
-  alp_process_command(alp_command, alp_command_length, command->alp_command, &alp_result_length, origin);
+  alp_process_command(alp_command, alp_command_length, alp_result, &alp_result_length, origin);
+  if(forward_command(command, session_config, alp_result, alp_result_length, D7ASP_PRIORITY_NORMAL, NULL) != SUCCESS) // D7ASP copies the requests
+    free_command(command);
+}
+
+void alp_process_action_file(uint8_t action_file_id, d7asp_master_session_config_t* session_config, uint8_t* alp_command, uint8_t alp_command_length)
+{
+  uint8_t alp_result[ALP_PAYLOAD_MAX_SIZE];
+  uint8_t alp_result_length = 0;
+  alp_command_t* command = alloc_command();
+  assert(command != NULL);
+  alp_process_command(alp_command, alp_command_length, alp_result, &alp_result_length, ALP_CMD_ORIGIN_D7AACTP);
+
   d7asp_master_session_t* session = d7asp_master_session_create(session_config);
-  uint8_t expected_response_length = alp_get_expected_response_length(command->alp_command, alp_result_length);
-  d7asp_queue_result_t result = d7asp_queue_alp_actions(session, command->alp_command, alp_result_length, expected_response_length);
-  command->fifo_token = result.fifo_token;
+  uint8_t max_request_length = d7asp_get_max_request_length(session);
+  action_file_layout_t* entry = NULL;
+  for(uint8_t i = 0; i < MODULE_D7AP_ALP_ACTION_FILE_CACHE_SIZE; i++) {
+    if(action_file_layouts[i].valid && action_file_layouts[i].action_file_id == action_file_id)
+      entry = &action_file_layouts[i];
+  }
+
+  if(entry == NULL) {
+    entry = &action_file_layouts[action_file_layout_next];
+    action_file_layout_next = (action_file_layout_next + 1) % MODULE_D7AP_ALP_ACTION_FILE_CACHE_SIZE;
+    entry->valid = false;
+  }
+
+  // the result length differs when an action failed
+  if(!entry->valid || entry->result_length != alp_result_length || entry->layout.max_request_length != max_request_length) {
+    // the action file is written over ALP, its result is not forwarded when it does not fit the requests
+    if(pack_alp_actions(max_request_length, alp_result, alp_result_length, &entry->layout) != SUCCESS) {
+      free_command(command);
+      return;
+    }
+
+    entry->valid = true;
+    entry->action_file_id = action_file_id;
+    entry->result_length = alp_result_length;
+    DPRINT("Packed action file %i: %i actions in %i requests", action_file_id, entry->layout.action_count, entry->layout.request_count);
+  }
+
+  if(!fits_session_queue(session, &entry->layout)) {
+    log_stack_warning(LOG_STACK_ALP, "No room for the %i requests of action file %i", entry->layout.request_count, action_file_id);
+    free_command(command);
+    return;
+  }
+
+  forward_command_requests(command, session, alp_result, &entry->layout, D7ASP_PRIORITY_NORMAL);
+}
+
+void alp_notify_file_changed(uint8_t file_id)
+{
+  for(uint8_t i = 0; i < MODULE_D7AP_ALP_ACTION_FILE_CACHE_SIZE; i++) {
+    if(action_file_layouts[i].action_file_id == file_id)
+      action_file_layouts[i].valid = false;
+  }
 }
 
 void alp_process_command_console_output(uint8_t* alp_command, uint8_t alp_command_length) {
@@ -271,43 +1139,107 @@ static void add_interface_status_action(fifo_t* alp_response_fifo, d7asp_result_
   fifo_put(alp_response_fifo, d7asp_result->addressee->id, address_len);
 }
 
-void alp_process_d7asp_result(uint8_t* alp_command, uint8_t alp_command_length, uint8_t* alp_response, uint8_t* alp_response_length, d7asp_result_t d7asp_result)
+bool alp_process_d7asp_result(uint8_t* alp_command, uint8_t alp_command_length, uint8_t* alp_response, uint8_t* alp_response_length,
+                              uint8_t alp_response_max_length, d7asp_result_t d7asp_result)
 {
-  alp_command_t* command = get_command_by_fifo_token(d7asp_result.fifo_token);
-  current_d7asp_result = d7asp_result; // TODO
+#ifdef MODULE_D7AP_BULK_TRANSFER_ENABLED
+  if(bulk_transfer_process_d7asp_result(&d7asp_result, alp_command, alp_command_length))
+    return true;
+#endif
+
+  alp_command_t* command = get_command_by_fifo_token(d7asp_result.fifo_token, d7asp_result.seqnr);
   if(command != NULL) {
     // received result for known command
     if(shell_enabled) {
+      // the response is encoded straight into the console output when it has room for it, the received actions are
+      // copied once from the packet then. Nothing is logged until it is committed
+      uint8_t alp_response_buffer[ALP_PAYLOAD_MAX_SIZE];
+      uint16_t max_length = ALP_D7ASP_INTERFACE_STATUS_ACTION_MAX_SIZE + alp_command_length + 2; // followed by the tag response
+      if(max_length > ALP_PAYLOAD_MAX_SIZE)
+        max_length = ALP_PAYLOAD_MAX_SIZE;
+
+      uint8_t* console_response = alp_cmd_handler_reserve_alp_command(max_length);
+      fifo_init(&(command->alp_response_fifo), console_response != NULL ? console_response : alp_response_buffer, max_length);
       add_interface_status_action(&(command->alp_response_fifo), &d7asp_result);
       fifo_put(&(command->alp_response_fifo), alp_command, alp_command_length);
 
       // tag and send response already with EOP bit cleared
       add_tag_response(command, false, false); // TODO error
       uint8_t alp_response_length = fifo_get_size(&(command->alp_response_fifo));
-      alp_cmd_handler_output_alp_command(command->alp_response, alp_response_length); // TODO pass fifo directly
+      if(console_response != NULL)
+        alp_cmd_handler_commit_alp_command(console_response, alp_response_length);
+      else
+        alp_cmd_handler_output_alp_command(alp_response_buffer, alp_response_length);
+
       fifo_clear(&(command->alp_response_fifo));
     }
 
+#ifdef MODULE_D7AP_REMOTE_FILE_CACHE_ENABLED
+    cache_returned_file_data(&d7asp_result, alp_command, alp_command_length);
+#endif
+
+    if(command->response_cb != NULL)
+      command->response_cb(command->context, &d7asp_result, alp_command, alp_command_length);
+
     if(init_args != NULL && init_args->alp_command_result_cb != NULL)
       init_args->alp_command_result_cb(d7asp_result, alp_command, alp_command_length);
 
     // TODO further bookkeeping
   } else {
     // uknown FIFO token; an incoming request or unsolicited response
-    alp_process_command(alp_command, alp_command_length, alp_response, alp_response_length, ALP_CMD_ORIGIN_D7ASP);
+    command = alloc_command();
+    assert(command != NULL); // TODO return error
+    command->d7asp_result = d7asp_result;
+    return process_command(command, alp_command, alp_command_length, alp_response, alp_response_length, alp_response_max_length,
+                           ALP_CMD_ORIGIN_D7ASP);
   }
+
+  return true;
+}
+
+error_t alp_submit_request(const alp_request_t* request, d7asp_queue_result_t* queue_result) {
+  if(request->alp_command_length == 0 || request->alp_command_length > ALP_PAYLOAD_MAX_SIZE)
+    return EINVAL;
+
+  d7asp_master_session_t* session = d7asp_master_session_create(request->session_config);
+  request_layout_t layout;
+  error_t err = pack_alp_actions(d7asp_get_max_request_length(session), request->alp_command, request->alp_command_length, &layout);
+  if(err != SUCCESS)
+    return err;
+
+  if(!fits_session_queue(session, &layout))
+    return ESIZE;
+
+  alp_command_t* command = alloc_command();
+  if(command == NULL)
+    return ENOMEM;
+
+  command->response_cb = request->response_cb;
+  command->completed_cb = request->completed_cb;
+  command->context = request->context;
+  d7asp_queue_result_t result = forward_command_requests(command, session, request->alp_command, &layout, request->priority);
+  if(queue_result != NULL)
+    *queue_result = result;
+
+  return SUCCESS;
 }
 
 void alp_execute_command(uint8_t* alp_command, uint8_t alp_command_length, d7asp_master_session_config_t* d7asp_master_session_config) {
+  alp_execute_command_with_priority(alp_command, alp_command_length, d7asp_master_session_config, D7ASP_PRIORITY_NORMAL);
+}
+
+d7asp_queue_result_t alp_execute_command_with_priority(uint8_t* alp_command, uint8_t alp_command_length,
+                                                       d7asp_master_session_config_t* d7asp_master_session_config,
+                                                       d7asp_request_priority_t priority) {
   DPRINT("ALP cmd size %i", alp_command_length);
   assert(alp_command_length <= ALP_PAYLOAD_MAX_SIZE);
 
-  alp_command_t* command = alloc_command(); // TODO check if we have a matching open session to append to
+  alp_command_t* command = alloc_command();
   assert(command != NULL); // TODO return to app
-  d7asp_master_session_t* session = d7asp_master_session_create(d7asp_master_session_config); // TODO store in alp_command_t
-  uint8_t expected_response_length = alp_get_expected_response_length(alp_command, alp_command_length);
-  d7asp_queue_result_t queue_result = d7asp_queue_alp_actions(session, alp_command, alp_command_length, expected_response_length); // TODO pass fifo directly?
-  command->fifo_token = queue_result.fifo_token;
+  d7asp_queue_result_t queue_result;
+  error_t err = forward_command(command, d7asp_master_session_config, alp_command, alp_command_length, priority, &queue_result); // TODO pass fifo directly?
+  assert(err == SUCCESS); // the application only executes actions which fit the requests, alp_submit_request() reports it otherwise
+  return queue_result;
 }
 
 // TODO refactor
@@ -316,47 +1248,107 @@ bool alp_process_command(uint8_t* alp_command, uint8_t alp_command_length, uint8
   DPRINT("ALP cmd size %i", alp_command_length);
   assert(alp_command_length <= ALP_PAYLOAD_MAX_SIZE);
 
-  // TODO support more than 1 active cmd
   alp_command_t* command = alloc_command();
   assert(command != NULL); // TODO return error
 
-  memcpy(command->alp_command, alp_command, alp_command_length); // TODO not needed to store this
-  fifo_init_filled(&(command->alp_command_fifo), command->alp_command, alp_command_length, ALP_PAYLOAD_MAX_SIZE);
-  fifo_init(&(command->alp_response_fifo), command->alp_response, ALP_PAYLOAD_MAX_SIZE);
+  return process_command(command, alp_command, alp_command_length, alp_response, alp_response_length, ALP_PAYLOAD_MAX_SIZE, origin);
+}
+
+// every command has its own slot, so forwarded commands remain active until their session is flushed while the next
+// commands are processed
+static bool process_command(alp_command_t* command, uint8_t* alp_command, uint8_t alp_command_length, uint8_t* alp_response,
+                            uint8_t* alp_response_length, uint8_t alp_response_max_length, alp_command_origin_t origin)
+{
+  fifo_init_filled(&(command->alp_command_fifo), alp_command, alp_command_length, alp_command_length);
+
+  // the response is written straight into the buffer of the caller, except when built in place of the command: a
+  // response (for example returned file data) can outgrow the actions it answers, and overwrite the ones not parsed yet
+  uint8_t scratch_response[alp_response == alp_command ? ALP_PAYLOAD_MAX_SIZE : 1];
+  uint8_t* response_buffer = alp_response == alp_command ? scratch_response : alp_response;
+  if(alp_response_max_length > ALP_PAYLOAD_MAX_SIZE)
+    alp_response_max_length = ALP_PAYLOAD_MAX_SIZE;
+
+  // the actions of which the response does not fit in the buffer of the caller fail
+  fifo_init(&(command->alp_response_fifo), response_buffer, alp_response_max_length);
   command->origin = origin;
 
   (*alp_response_length) = 0;
   d7asp_master_session_config_t d7asp_session_config;
   bool do_forward = false;
+  bool forward_failed = false;
+  bool forward_to_app = false;
+  bool query_match;
+  bool break_query_failed = false;
 
+  // the files written by the actions are notified once all actions are executed
+  fs_begin();
   while(fifo_get_size(&command->alp_command_fifo) > 0) {
     if(do_forward) {
       // forward rest of the actions over the D7ASP interface
       // TODO support multiple FIFOs
-      uint8_t forwarded_alp_size = fifo_get_size(&command->alp_command_fifo);
-      uint8_t forwarded_alp_actions[forwarded_alp_size];
-      fifo_pop(&command->alp_command_fifo, forwarded_alp_actions, forwarded_alp_size);
-      d7asp_master_session_t* session = d7asp_master_session_create(&d7asp_session_config);
-      // TODO current_command.fifo_token = session->token;
-      uint8_t expected_response_length = alp_get_expected_response_length(forwarded_alp_actions, forwarded_alp_size);
-      d7asp_queue_result_t queue_result = d7asp_queue_alp_actions(session, forwarded_alp_actions, forwarded_alp_size, expected_response_length); // TODO pass fifo directly?
-      command->fifo_token = queue_result.fifo_token;
+      uint8_t* forwarded_alp_actions;
+      uint8_t forwarded_alp_size = fifo_get_contiguous_readable(&command->alp_command_fifo, &forwarded_alp_actions);
+#ifdef MODULE_D7AP_REMOTE_FILE_CACHE_ENABLED
+      invalidate_remote_files(&d7asp_session_config.addressee, forwarded_alp_actions, forwarded_alp_size);
+#endif
+      if(forward_command(command, &d7asp_session_config, forwarded_alp_actions, forwarded_alp_size, D7ASP_PRIORITY_NORMAL, NULL) != SUCCESS) {
+        // the command completes here, with an error
+        do_forward = false;
+        forward_failed = true;
+      }
+
+      fifo_skip(&command->alp_command_fifo, forwarded_alp_size);
 
       break; // TODO return response
     }
 
+    if(forward_to_app) {
+      process_app_action(command);
+      continue;
+    }
+
     alp_control_t control;
     fifo_peek(&command->alp_command_fifo, &control.raw, 0, 1);
     alp_status_codes_t alp_status;
+    uint16_t remaining_length = fifo_get_size(&command->alp_command_fifo);
     switch(control.operation) {
       case ALP_OP_READ_FILE_DATA:
-        alp_status = process_op_read_file_data(command);
+        if(process_batched_read_file_data(command))
+          alp_status = ALP_STATUS_OK;
+        else
+          alp_status = process_op_read_file_data(command);
         break;
       case ALP_OP_WRITE_FILE_DATA:
-        alp_status = process_op_write_file_data(command);
+        if(process_batched_write_file_data(command))
+          alp_status = ALP_STATUS_OK;
+        else
+          alp_status = process_op_write_file_data(command);
+        break;
+#ifdef MODULE_D7AP_ALP_FILE_MANAGEMENT_ENABLED
+      case ALP_OP_CREATE_FILE:
+        alp_status = process_op_create_file(command);
+        break;
+      case ALP_OP_DELETE_FILE:
+        alp_status = process_op_delete_file(command);
         break;
+#endif
       case ALP_OP_FORWARD:
+        if(is_forward_to_app(command)) {
+          forward_to_app = true;
+          alp_status = ALP_STATUS_OK;
+          break;
+        }
+
         alp_status = process_op_forward(command, &d7asp_session_config);
+        if(alp_status != ALP_STATUS_PARTIALLY_COMPLETED)
+          break;
+
+#ifdef MODULE_D7AP_REMOTE_FILE_CACHE_ENABLED
+        if(answer_from_remote_file_cache(command, &d7asp_session_config)) {
+          alp_status = ALP_STATUS_OK;
+          break;
+        }
+#endif
         do_forward = true;
         break;
       case ALP_OP_REQUEST_TAG: ;
@@ -366,23 +1358,51 @@ bool alp_process_command(uint8_t* alp_command, uint8_t alp_command_length, uint8
       case ALP_OP_RETURN_FILE_DATA:
         alp_status = process_op_return_file_data(command);
         break;
+      case ALP_OP_BREAK_QUERY:
+        alp_status = process_op_query(command, &query_match);
+        if(!query_match) {
+          // the remaining actions are not executed
+          DPRINT("Break query failed");
+          fifo_clear(&command->alp_command_fifo);
+          break_query_failed = true;
+        }
+        break;
+      case ALP_OP_ACTION_QUERY:
+        alp_status = process_op_query(command, &query_match);
+        if(!query_match && fifo_get_size(&command->alp_command_fifo) > 0) {
+          // only the next action depends on the query, skip it
+          uint8_t* next_action;
+          uint8_t expected_response_length = 0;
+          uint16_t available = fifo_get_contiguous_readable(&command->alp_command_fifo, &next_action);
+          uint8_t action_length = get_action_length(next_action, available, &expected_response_length);
+          if(action_length == 0)
+            fifo_clear(&command->alp_command_fifo); // the actions following it cannot be located
+          else
+            fifo_skip(&command->alp_command_fifo, action_length);
+        }
+        break;
       default:
-        assert(false); // TODO return error
-        //alp_status = ALP_STATUS_UNKNOWN_OPERATION;
+        DPRINT("Unknown operation %d", control.operation);
+        alp_status = ALP_STATUS_UNKNOWN_OPERATION;
     }    
+
+    if(fifo_get_size(&command->alp_command_fifo) == remaining_length) {
+      // an unknown or malformed action is not consumed, the actions following it cannot be located
+      log_stack_warning(LOG_STACK_ALP, "ALP action not processed (status %x), the remaining actions are dropped", alp_status);
+      fifo_clear(&command->alp_command_fifo);
+    }
   }
 
+  fs_commit();
+
   if(command->origin == ALP_CMD_ORIGIN_SERIAL_CONSOLE) {
     // make sure we include tag response also for commands with interface HOST
     // for interface D7ASP this will be done when flush completes
     if(command->respond_when_completed && !do_forward)
-      add_tag_response(command, true, false); // TODO error
+      add_tag_response(command, true, forward_failed); // TODO error of the other actions
 
-    (*alp_response_length) = fifo_get_size(&command->alp_response_fifo);
-    if((*alp_response_length) > 0) {
-      memcpy(alp_response, command->alp_response, *alp_response_length);
-      alp_cmd_handler_output_alp_command(alp_response, (*alp_response_length));
-    }
+    if(fifo_get_size(&command->alp_response_fifo) > 0)
+      alp_cmd_handler_output_alp_command(response_buffer, fifo_get_size(&command->alp_response_fifo));
   }
 
     // TODO APP
@@ -392,12 +1412,13 @@ bool alp_process_command(uint8_t* alp_command, uint8_t alp_command_length, uint8
 //      return false;
 
   (*alp_response_length) = fifo_get_size(&command->alp_response_fifo);
-  memcpy(alp_response, command->alp_response, *alp_response_length);
+  if(response_buffer != alp_response)
+    memcpy(alp_response, response_buffer, *alp_response_length);
 
   if(!do_forward)
     free_command(command); // when forwarding the response will arrive async, clean up then
 
-  return true;
+  return !break_query_failed;
 }
 
 
@@ -405,19 +1426,161 @@ bool alp_process_command(uint8_t* alp_command, uint8_t alp_command_length, uint8
 void alp_d7asp_fifo_flush_completed(uint8_t fifo_token, uint8_t* progress_bitmap, uint8_t* success_bitmap, uint8_t bitmap_byte_count) {
   // TODO end session
   DPRINT("D7ASP flush completed");
-  alp_command_t* command = get_command_by_fifo_token(fifo_token);
-  assert(command != NULL);
-  bool error = memcmp(success_bitmap, progress_bitmap, bitmap_byte_count) != 0;
-  if(shell_enabled && command->respond_when_completed) {
-    add_tag_response(command, true, error);
-    uint8_t alp_response_length = fifo_get_size(&(command->alp_response_fifo));
-    alp_cmd_handler_output_alp_command(command->alp_response, alp_response_length); // TODO pass fifo directly
+  bool session_error = false;
+  bool is_command_session = true;
+  // the completion callbacks are called once all commands of the session are freed, they might submit new requests
+  struct {
+    alp_request_completed_callback completed_cb;
+    void* context;
+    bool success;
+  } completions[MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT];
+  uint8_t completion_count = 0;
+#ifdef MODULE_D7AP_BULK_TRANSFER_ENABLED
+  // the transfer might share the session with forwarded commands
+  is_command_session = !bulk_transfer_process_flush_completed(fifo_token, success_bitmap, bitmap_byte_count);
+#endif
+
+  // all commands forwarded on the session complete, each one reports the outcome of its own requests
+  for(uint8_t i = 0; i < MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT; i++) {
+    alp_command_t* command = &commands[i];
+    if(!command->is_active || !command->is_forwarded || command->fifo_token != fifo_token)
+      continue;
+
+    bool error = false;
+    for(uint8_t request_id = command->first_request_id; request_id <= command->last_request_id; request_id++) {
+      if(request_id < bitmap_byte_count * 8 && bitmap_get(progress_bitmap, request_id) != bitmap_get(success_bitmap, request_id))
+        error = true;
+    }
+
+    if(shell_enabled && command->respond_when_completed) {
+      uint8_t alp_response_buffer[ALP_PAYLOAD_MAX_SIZE];
+      fifo_init(&(command->alp_response_fifo), alp_response_buffer, ALP_PAYLOAD_MAX_SIZE);
+      add_tag_response(command, true, error);
+      uint8_t alp_response_length = fifo_get_size(&(command->alp_response_fifo));
+      alp_cmd_handler_output_alp_command(alp_response_buffer, alp_response_length); // TODO pass fifo directly
+    }
+
+    if(command->completed_cb != NULL) {
+      completions[completion_count].completed_cb = command->completed_cb;
+      completions[completion_count].context = command->context;
+      completions[completion_count].success = !error;
+      completion_count++;
+    }
+
+    session_error |= error;
+    is_command_session = true;
+    free_command(command);
   }
 
-  free_command(command);
+  for(uint8_t i = 0; i < completion_count; i++)
+    completions[i].completed_cb(completions[i].context, completions[i].success);
+
+  if(is_command_session && init_args != NULL && init_args->alp_command_completed_cb != NULL)
+    init_args->alp_command_completed_cb(fifo_token, !session_error);
+}
+
+// decodes the length operand at offset in the action and moves the offset past it, returns false when the operand exceeds
+// the available bytes
+static bool decode_action_length_operand(const uint8_t* alp_action, uint16_t available, uint32_t* offset, uint32_t* length) {
+  if(*offset >= available || *offset + 1 + (alp_action[*offset] >> 6) > available)
+    return false;
+
+  *offset += alp_decode_length_operand(&alp_action[*offset], length);
+  return true;
+}
 
-  if(init_args != NULL && init_args->alp_command_completed_cb != NULL)
-    init_args->alp_command_completed_cb(fifo_token, !error);
+// moves the offset past the file offset operand: the file ID and the offset length operand
+static bool skip_file_offset_operand(const uint8_t* alp_action, uint16_t available, uint32_t* offset) {
+  uint32_t file_offset;
+  *offset += 1; // skip file ID
+  return decode_action_length_operand(alp_action, available, offset, &file_offset);
+}
+
+// returns the length of the action, and adds the length of the data it requests to expected_response_length. Returns 0
+// for an unknown operation or an action exceeding the available bytes, the actions following it cannot be located then
+static uint8_t get_action_length(uint8_t* alp_action, uint16_t available, uint8_t* expected_response_length) {
+  if(available == 0)
+    return 0;
+
+  alp_control_t control;
+  control.raw = alp_action[0];
+  uint32_t length = 1; // the control byte
+  uint32_t response_length = 0;
+  switch(control.operation) {
+    case ALP_OP_READ_FILE_DATA:
+      if(!skip_file_offset_operand(alp_action, available, &length)
+         || !decode_action_length_operand(alp_action, available, &length, &response_length))
+        return 0;
+      break;
+    case ALP_OP_REQUEST_TAG:
+      length += 1; // skip tag ID operand
+      break;
+    case ALP_OP_CREATE_FILE:
+      length += 1 + ALP_FILE_HEADER_OPERAND_SIZE; // skip file ID and file header operand
+      break;
+    case ALP_OP_DELETE_FILE:
+      length += 1; // skip file ID operand
+      break;
+    case ALP_OP_RETURN_FILE_DATA:
+    case ALP_OP_WRITE_FILE_DATA: ;
+      uint32_t data_length;
+      if(!skip_file_offset_operand(alp_action, available, &length)
+         || !decode_action_length_operand(alp_action, available, &length, &data_length))
+        return 0;
+      length += data_length; // skip data
+      break;
+    case ALP_OP_FORWARD:
+      if(available < 2)
+        return 0;
+
+      if(alp_action[1] == ALP_ITF_ID_APP) {
+        length += 1; // skip interface ID, the application interface has no configuration
+        break;
+      }
+
+      // the interface ID, QoS, dormant timeout, addressee ctrl and access class precede the address
+      if(available < 6)
+        return 0;
+
+      d7anp_addressee_ctrl addressee_ctrl;
+      addressee_ctrl.raw = alp_action[4];
+      length = 6 + d7anp_addressee_id_length(addressee_ctrl.id_type);
+      break;
+    case ALP_OP_ACTION_QUERY:
+    case ALP_OP_BREAK_QUERY: ;
+      if(available < 2)
+        return 0;
+
+      alp_query_code_t code;
+      code.raw = alp_action[1];
+      length += 1; // skip query code
+      uint32_t compare_length;
+      if(!decode_action_length_operand(alp_action, available, &length, &compare_length))
+        return 0;
+
+      if(code.mask_present)
+        length += compare_length;
+
+      if(code.type == ALP_QUERY_TYPE_ARITH_COMP_WITH_VALUE)
+        length += compare_length; // skip compare value
+      else if(code.type == ALP_QUERY_TYPE_ARITH_COMP_BETWEEN_FILES && !skip_file_offset_operand(alp_action, available, &length))
+        return 0; // the second file offset operand is incomplete
+      else if(code.type == ALP_QUERY_TYPE_RANGE_COMP)
+        length += 2 * compare_length; // skip boundaries
+
+      if(!skip_file_offset_operand(alp_action, available, &length))
+        return 0;
+      break;
+    // TODO other operations
+    default:
+      return 0;
+  }
+
+  if(length > available)
+    return 0;
+
+  (*expected_response_length) += response_length;
+  return length;
 }
 
 uint8_t alp_get_expected_response_length(uint8_t* alp_command, uint8_t alp_command_length) {
@@ -425,40 +1588,11 @@ uint8_t alp_get_expected_response_length(uint8_t* alp_command, uint8_t alp_comma
   uint8_t* ptr = alp_command;
 
   while(ptr < alp_command + alp_command_length) {
-    alp_control_t control;
-    control.raw = (*ptr);
-    ptr++; // skip control byte
-    switch(control.operation) {
-      case ALP_OP_READ_FILE_DATA:
-        ptr += 2; // skip file offset operand // TODO we assume 2 bytes now but can be 2-5 bytes
-        expected_response_length += *ptr; ptr++; // TODO we assume length is coded in 1 byte but can be 4
-        // TODO
-        break;
-      case ALP_OP_REQUEST_TAG:
-        ptr += 1; // skip tag ID operand
-        break;
-      case ALP_OP_RETURN_FILE_DATA:
-      case ALP_OP_WRITE_FILE_DATA:
-        ptr += 2; // skip file offset operand // TODO we assume 2 bytes now but can be 2-5 bytes
-        uint8_t data_length = *ptr;
-        ptr += 1; // skip data length field // TODO we assume length is coded in 1 byte but can be 4
-        ptr += data_length; // skip data
-        break;
-      case ALP_OP_FORWARD:
-        ptr += 1; // skip interface ID
-        ptr += 1; // skip QoS
-        ptr += 1; // skip dormant
-        d7anp_addressee_ctrl addressee_ctrl;
-        addressee_ctrl.raw = *ptr;
-        ptr += 1; // skip addressee ctrl
-        ptr += 1; // skip access class
-        ptr += d7anp_addressee_id_length(addressee_ctrl.id_type); // skip address
-        // TODO refactor to reuse same logic for parsing and response length counting
-        break;
-      // TODO other operations
-      default:
-        assert(false);
-    }
+    uint8_t action_length = get_action_length(ptr, alp_command + alp_command_length - ptr, &expected_response_length);
+    if(action_length == 0)
+      break; // the actions following an unknown one cannot be located
+
+    ptr += action_length;
   }
 
   DPRINT("Expected ALP response length=%i", expected_response_length);
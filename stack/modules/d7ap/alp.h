@@ -26,7 +26,9 @@
 #include "stdint.h"
 #include "stdbool.h"
 
+#include "errors.h"
 #include "fifo.h"
+#include "pool_stats.h"
 
 #include "d7asp.h"
 
@@ -36,6 +38,10 @@
 
 #define ALP_PAYLOAD_MAX_SIZE 239 // TODO configurable?
 
+// the return status action of the D7ASP interface: the control and interface ID bytes, the interface status up to the
+// addressee ID, and the longest addressee ID
+#define ALP_D7ASP_INTERFACE_STATUS_ACTION_MAX_SIZE (2 + 12 + ID_TYPE_UID_ID_LENGTH)
+
 typedef enum
 {
     ALP_CMD_ORIGIN_APP,
@@ -87,6 +93,7 @@ typedef enum {
   ALP_STATUS_PARTIALLY_COMPLETED = 0x01,
   ALP_STATUS_UNKNOWN_ERROR = 0x80,
   ALP_STATUS_UNKNOWN_OPERATION = 0xF6,
+  ALP_STATUS_ALLOCATION_OVERFLOW = 0xFA,
   ALP_STATUS_INSUFFICIENT_PERMISSIONS = 0xFC,
   // TODO others
   ALP_STATUS_FILE_ID_ALREADY_EXISTS = 0xFE,
@@ -150,23 +157,80 @@ typedef struct {
     };
 } alp_control_tag_response_t;
 
+typedef enum {
+    ALP_QUERY_TYPE_NON_VOID = 0,
+    ALP_QUERY_TYPE_ARITH_COMP_WITH_ZERO = 1,
+    ALP_QUERY_TYPE_ARITH_COMP_WITH_VALUE = 2,
+    ALP_QUERY_TYPE_ARITH_COMP_BETWEEN_FILES = 3,
+    ALP_QUERY_TYPE_RANGE_COMP = 4,
+    ALP_QUERY_TYPE_STRING_TOKEN = 7
+} alp_query_type_t;
+
+typedef enum {
+    ALP_QUERY_COMP_INEQUALITY = 0,
+    ALP_QUERY_COMP_EQUALITY = 1,
+    ALP_QUERY_COMP_LESS_THAN = 2,
+    ALP_QUERY_COMP_LESS_THAN_OR_EQUAL = 3,
+    ALP_QUERY_COMP_GREATER_THAN = 4,
+    ALP_QUERY_COMP_GREATER_THAN_OR_EQUAL = 5
+} alp_query_comparison_t;
+
+/*! \brief The code of a query operand, the first byte of the operand of the action and break query operations
+ *
+ * The query is followed by the compare length, the mask (when present, compare length bytes) and, per type: nothing
+ * (non void, comparison with zero), the compare value, a second file offset (comparison between files) or the minimum
+ * and maximum boundaries (range comparison). The file offset of the data to compare comes last.
+ * The values are big endian integers.
+ */
+typedef struct {
+    union {
+        uint8_t raw;
+        struct {
+            alp_query_comparison_t comparison : 3; // unused for a range comparison, the boundaries are inclusive
+            bool signed_data : 1;
+            bool mask_present : 1;
+            alp_query_type_t type : 3;
+        };
+    };
+} alp_query_code_t;
+
 
 typedef struct {
     uint8_t file_id;
-    uint8_t offset; // TODO can be 1-4 bytes, assuming 1 byte for now
+    uint32_t offset;
 } alp_operand_file_offset_t;
 
 typedef struct {
     alp_operand_file_offset_t file_offset;
-    uint8_t requested_data_length;
+    uint32_t requested_data_length;
 } alp_operand_file_data_request_t;
 
 typedef struct {
     alp_operand_file_offset_t file_offset;
-    uint8_t provided_data_length;
+    uint32_t provided_data_length;
     // data
 } alp_operand_file_data_t;
 
+// the largest value of a length operand, the 2 MSBs of its first byte are the number of bytes following it
+#define ALP_LENGTH_OPERAND_MAX 0x3FFFFFFF
+
+/*!
+ * \brief The size of the length operand encoding the value (the file offsets and data lengths are length operands), 1 to 4 bytes
+ */
+uint8_t alp_get_length_operand_size(uint32_t length);
+
+/*!
+ * \brief Encodes a length operand, big endian, in the fewest bytes
+ * \return The number of bytes written
+ */
+uint8_t alp_encode_length_operand(uint8_t* ptr, uint32_t length);
+
+/*!
+ * \brief Decodes the length operand at ptr
+ * \return The number of bytes read, alp_get_length_operand_size() of the decoded value when it was encoded in the fewest bytes
+ */
+uint8_t alp_decode_length_operand(const uint8_t* ptr, uint32_t* length);
+
 typedef void (*alp_command_completed_callback)(uint8_t tag_id, bool success);
 typedef void (*alp_command_result_callback)(d7asp_result_t result, uint8_t* payload, uint8_t payload_length);
 typedef void (*alp_received_unsolicited_data_callback)(d7asp_result_t d7asp_result, uint8_t *alp_command, uint8_t alp_command_size);
@@ -190,6 +254,15 @@ typedef struct {
 
 
 
+/*!
+ * \brief Handler of the actions of an operation forwarded to the application interface (ALP_ITF_ID_APP)
+ * \param alp_action The action including its control byte, in place in the buffer of the command
+ * \param alp_action_length The length of the action
+ * \param alp_response_fifo The fifo to append response actions to
+ * \return The status of the action
+ */
+typedef alp_status_codes_t (*alp_app_action_handler_t)(uint8_t* alp_action, uint8_t alp_action_length, fifo_t* alp_response_fifo);
+
 /*!
  * \brief Initializes the ALP layer
  * \param init_args Specifies the callback function pointers
@@ -197,6 +270,15 @@ typedef struct {
  */
 void alp_init(alp_init_args_t* init_args, bool shell_enabled);
 
+/*!
+ * \brief Registers the handler of the actions of an operation which follow a forward action to ALP_ITF_ID_APP
+ *
+ * Actions of an operation without handler are passed to the callback set by alp_cmd_handler_set_appl_itf_callback().
+ * \param operation The operation, a handler registered before for it is replaced
+ * \param handler
+ */
+void alp_register_app_action_handler(alp_operation_t operation, alp_app_action_handler_t handler);
+
 /*!
  * \brief Returns the ALP operation type contained in alp_command
  * \param alp_command
@@ -212,6 +294,50 @@ alp_operation_t alp_get_operation(uint8_t* alp_command);
  */
 void alp_execute_command(uint8_t* alp_command, uint8_t alp_command_length, d7asp_master_session_config_t* d7asp_master_session_config);
 
+/*!
+ * \brief Execute the command asynchronously with the given priority, for instance D7ASP_PRIORITY_HIGH for alarms
+ * \returns The FIFO token of the command and the worst case latency until it is handled
+ */
+d7asp_queue_result_t alp_execute_command_with_priority(uint8_t* alp_command, uint8_t alp_command_length,
+                                                       d7asp_master_session_config_t* d7asp_master_session_config,
+                                                       d7asp_request_priority_t priority);
+
+/*!
+ * \brief Called for every response received to a request submitted with alp_submit_request()
+ * \param d7asp_result The link of the response: the addressee which responded, its RX level and link budget
+ * \param response The ALP actions of the response, a view on the received frame only valid during the call
+ */
+typedef void (*alp_request_response_callback)(void* context, const d7asp_result_t* d7asp_result, const uint8_t* response,
+                                              uint8_t response_length);
+
+/*!
+ * \brief Called once a request submitted with alp_submit_request() is handled
+ * \param success Whether all the D7ASP requests it was split up in were acknowledged
+ */
+typedef void (*alp_request_completed_callback)(void* context, bool success);
+
+/*! \brief A command to execute on a remote addressee, see alp_submit_request() */
+typedef struct {
+  d7asp_master_session_config_t* session_config; /**< The addressee and QoS, the requests with the same ones share a session */
+  uint8_t* alp_command;
+  uint8_t alp_command_length;
+  d7asp_request_priority_t priority;
+  alp_request_response_callback response_cb;    /**< Optional */
+  alp_request_completed_callback completed_cb;  /**< Optional */
+  void* context;                                /**< Passed to the callbacks, to tell the outstanding requests apart */
+} alp_request_t;
+
+/*!
+ * \brief Execute the command of the request asynchronously, with its own callbacks for the responses and the completion
+ *
+ * The command is copied, the requests of an application can be outstanding on several sessions at once, as many as
+ * MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT allows. The callbacks of alp_init_args_t are called as well.
+ * \param queue_result Set to the FIFO token of the command and the worst case latency until it is handled, may be NULL
+ * \return ENOMEM when all command slots are active, ESIZE when the session has no room for the command, EINVAL for an
+ * empty or too long command
+ */
+error_t alp_submit_request(const alp_request_t* request, d7asp_queue_result_t* queue_result);
+
 /*!
  * \brief Process the ALP command.
  * Processing will be done against the local host interface unless explicitely forwarded to another interface using an (indirect) forward action.
@@ -222,7 +348,8 @@ void alp_execute_command(uint8_t* alp_command, uint8_t alp_command_length, d7asp
  * \param alp_response Pointer to a buffer where a possible response will be written
  * \param alp_response_length The length of the response
  * \param origin Where the ALP command originates from, determines where response will go to
- * \return If the ALP command was processed correctly or not
+ * \return If the ALP command was processed correctly or not. False as well when a break query did not match, the
+ * remaining actions are then not executed
  */
 bool alp_process_command(uint8_t* alp_command, uint8_t alp_command_length, uint8_t* alp_response, uint8_t* alp_response_length, alp_command_origin_t origin);
 
@@ -234,9 +361,13 @@ bool alp_process_command(uint8_t* alp_command, uint8_t alp_command_length, uint8
  * \param alp_command_length The length of the command
  * \param alp_response Pointer to a buffer where a possible response will be written
  * \param alp_response_length The length of the response
+ * \param alp_response_max_length The size of the alp_response buffer, the actions of which the response does not fit fail
  * \param d7asp_result The result
+ * \return False when the command received over D7ASP contains a break query which did not match, the responder should
+ * remain silent
  */
-void alp_process_d7asp_result(uint8_t* alp_command, uint8_t alp_command_length, uint8_t* alp_response, uint8_t* alp_response_length, d7asp_result_t d7asp_result);
+bool alp_process_d7asp_result(uint8_t* alp_command, uint8_t alp_command_length, uint8_t* alp_response, uint8_t* alp_response_length,
+                              uint8_t alp_response_max_length, d7asp_result_t d7asp_result);
 
 /*!
  * \brief Process the ALP command on the local host interface and output the response to the D7ASP interface
@@ -248,6 +379,22 @@ void alp_process_d7asp_result(uint8_t* alp_command, uint8_t alp_command_length,
  */
 void alp_process_command_result_on_d7asp(d7asp_master_session_config_t* d7asp_fifo_config, uint8_t* alp_command, uint8_t alp_command_length, alp_command_origin_t origin);
 
+/*!
+ * \brief Execute the ALP command of an action file (D7AActP) and output the result to the D7ASP interface
+ *
+ * Like alp_process_command_result_on_d7asp(), but the split up of the result in D7ASP requests is kept per action file
+ * until the file changes, see alp_notify_file_changed().
+ *
+ * \param action_file_id The file containing the command
+ * \param d7asp_fifo_config The config of the D7ASP fifo to output the ALP response to
+ * \param alp_command   The raw command
+ * \param alp_command_length The length of the command
+ */
+void alp_process_action_file(uint8_t action_file_id, d7asp_master_session_config_t* d7asp_fifo_config, uint8_t* alp_command, uint8_t alp_command_length);
+
+/*! \brief Notify ALP that a file was written, invalidating what is kept about it when it is an action file */
+void alp_notify_file_changed(uint8_t file_id);
+
 /*!
  * \brief Process the ALP command and output the result on the console.
  * Processing will be done against the local host interface unless explicitely forwarded to another interface using an (indirect) forward action.
@@ -262,4 +409,15 @@ void alp_d7asp_fifo_flush_completed(uint8_t fifo_token, uint8_t* progress_bitmap
 
 uint8_t alp_get_expected_response_length(uint8_t* alp_command, uint8_t alp_command_length);
 
+/*!
+ * \brief Get the usage statistics of the active command table, to size MODULE_D7AP_ALP_MAX_ACTIVE_COMMAND_COUNT
+ * \param stats The statistics, the failure count is the number of commands dropped because all command slots were active
+ */
+void alp_get_command_stats(pool_stats_t* stats);
+
+/*!
+ * \brief Restarts the high water mark of the active command table from the current usage and clears the failure count
+ */
+void alp_reset_command_stats();
+
 #endif /* ALP_H_ */
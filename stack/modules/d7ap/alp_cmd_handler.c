@@ -22,9 +22,7 @@
 
 #include "alp_cmd_handler.h"
 
-#define ALP_CMD_MAX_SIZE 0xFF
 
-#include "hwatomic.h"
 #include "types.h"
 #include "alp.h"
 #include "shell.h"
@@ -33,6 +31,9 @@
 #include "MODULE_D7AP_defs.h"
 #include "ng.h"
 #include "log.h"
+#include "crc.h"
+#include "scheduler.h"
+#include "timer.h"
 
 #if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_ALP_LOG_ENABLED)
 #define DPRINT(...) log_print_stack_string(LOG_STACK_ALP, __VA_ARGS__)
@@ -45,63 +46,234 @@ static alp_cmd_handler_appl_itf_callback NGDEF(_alp_cmd_handler_appl_itf_cb);
 #define alp_cmd_handler_appl_itf_cb NG(_alp_cmd_handler_appl_itf_cb)
 
 #define SERIAL_ALP_FRAME_SYNC_BYTE 0xC0
-#define SERIAL_ALP_FRAME_VERSION   0x00
+#define SERIAL_ALP_FRAME_VERSION_0 0x00 // <sync byte><version><length><ALP command>
+#define SERIAL_ALP_FRAME_VERSION_1 0x01 // <sync byte><version><sequence number><length><ALP command><CRC16>
+#define SERIAL_ALP_FRAME_MAX_HEADER_SIZE 4
+#define SERIAL_ALP_FRAME_CRC_SIZE 2
 
-void alp_cmd_handler(fifo_t* cmd_fifo)
+// the version of the frames output, which follows the version of the last valid frame received
+static uint8_t NGDEF(_frame_version);
+#define frame_version NG(_frame_version)
+
+static uint8_t NGDEF(_tx_seqnr);
+#define tx_seqnr NG(_tx_seqnr)
+
+static uint8_t NGDEF(_rx_seqnr); // the sequence number expected in the next version 1 frame
+#define rx_seqnr NG(_rx_seqnr)
+
+static bool NGDEF(_rx_seqnr_valid);
+#define rx_seqnr_valid NG(_rx_seqnr_valid)
+
+#if MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE > 255
+    #error "MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE should not exceed 255, the length of a serial frame is 1 byte"
+#endif
+
+#if MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE > 0
+// D7ASP responses which are not yet output, each one is its interface status action followed by the received actions
+static uint8_t NGDEF(_response_batch)[MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE];
+#define response_batch NG(_response_batch)
+
+static uint8_t NGDEF(_response_batch_length);
+#define response_batch_length NG(_response_batch_length)
+#endif
+
+static void output_frame(const uint8_t* payload, uint8_t payload_len, const uint8_t* payload_tail, uint8_t payload_tail_len);
+#if MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE > 0
+static void flush_response_batch();
+#endif
+
+// AT$D<serial ALP frame>
+// where <serial ALP frame> is constructed as follows:
+// version 0: <sync byte (0xC0)><version (0x00)><length of ALP command (1 byte)><ALP command>
+// version 1: <sync byte (0xC0)><version (0x01)><sequence number (1 byte)><length of ALP command (1 byte)><ALP command><CRC16>
+// The CRC16 is the one used for D7A frames (see crc_calculate()) from the version byte up to the end of the ALP command, MSB first.
+// Invalid frames are dropped, the host detects this by the missing response to its command. The sequence numbers of the
+// frames in each direction count independently, so gaps reveal lost frames.
+// TODO other commands (AT$D to return ALP status)
+int16_t alp_cmd_handler_get_cmd_length(const uint8_t* cmd, uint16_t available)
 {
-    // AT$D<serial ALP command>
-    // where <serial ALP command> is constructed as follows:
-    // <sync byte (0xC0)><version (0x00)><length of ALP command (1 byte)><ALP command> // TODO CRC
-    // TODO other commands (AT$D to return ALP status)
-    if(fifo_get_size(cmd_fifo) > SHELL_CMD_HEADER_SIZE + 2)
+    if(available < SHELL_CMD_HEADER_SIZE + 3)
+        return 0;
+
+    const uint8_t* header = cmd + SHELL_CMD_HEADER_SIZE;
+    if(header[0] != SERIAL_ALP_FRAME_SYNC_BYTE)
     {
-        uint8_t byte;
-        error_t err;
-        fifo_peek(cmd_fifo, &byte, SHELL_CMD_HEADER_SIZE, 1);
-        if(byte == SERIAL_ALP_FRAME_SYNC_BYTE)
-        {
-            err = fifo_peek(cmd_fifo, &byte, SHELL_CMD_HEADER_SIZE + 1, 1); assert(err == SUCCESS);
-            assert(byte == SERIAL_ALP_FRAME_VERSION); // only version 0 implemented for now // TODO pop and return error
-            uint8_t alp_command_len;
-            err = fifo_peek(cmd_fifo, &alp_command_len, SHELL_CMD_HEADER_SIZE + 2, 1); assert(err == SUCCESS);
-            start_atomic();
-                if(fifo_get_size(cmd_fifo) >= SHELL_CMD_HEADER_SIZE + 3 + alp_command_len)
-                {
-                    uint8_t alp_command[ALP_CMD_MAX_SIZE] = { 0x00 };
-                    err = fifo_pop(cmd_fifo, alp_command, SHELL_CMD_HEADER_SIZE + 3); assert(err == SUCCESS); // pop header
-                    err = fifo_pop(cmd_fifo, alp_command, alp_command_len); assert(err == SUCCESS); // pop full ALP command
-
-                    uint8_t alp_response[ALP_CMD_MAX_SIZE] = { 0x00 };
-                    uint8_t alp_response_len = 0;
-                    alp_process_command_console_output(alp_command, alp_command_len);
-                }
-                else
-                {
-                    //DPRINT("ALP command not complete yet");
-                }
-            end_atomic();
-        }
-        else
+        DPRINT("invalid sync byte 0x%02X, resync", header[0]);
+        return SHELL_CMD_INVALID;
+    }
+
+    uint8_t header_len;
+    uint8_t crc_len;
+    if(header[1] == SERIAL_ALP_FRAME_VERSION_0)
+    {
+        header_len = 3;
+        crc_len = 0;
+    }
+    else if(header[1] == SERIAL_ALP_FRAME_VERSION_1)
+    {
+        if(available < SHELL_CMD_HEADER_SIZE + 4)
+            return 0;
+
+        header_len = 4;
+        crc_len = SERIAL_ALP_FRAME_CRC_SIZE;
+    }
+    else
+    {
+        DPRINT("serial frame version %i not supported, resync", header[1]);
+        return SHELL_CMD_INVALID;
+    }
+
+    uint8_t alp_command_len = header[header_len - 1];
+    if(alp_command_len > ALP_PAYLOAD_MAX_SIZE)
+    {
+        DPRINT("ALP command length %i too long, resync", alp_command_len);
+        return SHELL_CMD_INVALID;
+    }
+
+    return SHELL_CMD_HEADER_SIZE + header_len + alp_command_len + crc_len;
+}
+
+bool alp_cmd_handler(uint8_t* cmd, uint16_t length)
+{
+    // the frame is complete and valid up to its length, as checked by alp_cmd_handler_get_cmd_length()
+    uint8_t* header = cmd + SHELL_CMD_HEADER_SIZE;
+    uint8_t header_len = header[1] == SERIAL_ALP_FRAME_VERSION_1 ? 4 : 3;
+    uint8_t* alp_command = header + header_len;
+    uint8_t alp_command_len = header[header_len - 1];
+    if(header[1] == SERIAL_ALP_FRAME_VERSION_1)
+    {
+        uint8_t* crc = alp_command + alp_command_len;
+        uint16_t calculated_crc = crc_update(crc_calculate(header + 1, header_len - 1), alp_command, alp_command_len);
+        if(calculated_crc != ((crc[0] << 8) | crc[1]))
         {
-            assert(false); // TODO
+            DPRINT("serial frame CRC invalid, resync");
+            return false; // the shell drops the command header only, in case the length of the frame is corrupted as well
         }
 
-//        else if(alp_interface_id == ALP_ITF_ID_APP)
-//        {
-//            if(alp_cmd_handler_appl_itf_cb != NULL)
-//              alp_cmd_handler_appl_itf_cb(payload, length);
-//        }
+        if(rx_seqnr_valid && header[2] != rx_seqnr)
+            DPRINT("serial frame seqnr %i while expecting %i, frames lost", header[2], rx_seqnr);
+
+        rx_seqnr = header[2] + 1;
+        rx_seqnr_valid = true;
     }
+
+    frame_version = header[1];
+    alp_process_command_console_output(alp_command, alp_command_len);
+    return true;
+}
+
+bool alp_cmd_handler_process_appl_itf_action(uint8_t* alp_action, uint8_t alp_action_length)
+{
+    if(alp_cmd_handler_appl_itf_cb == NULL)
+        return false;
+
+    alp_cmd_handler_appl_itf_cb(alp_action, alp_action_length);
+    return true;
+}
+
+static inline uint8_t get_frame_header_length()
+{
+    return frame_version == SERIAL_ALP_FRAME_VERSION_1 ? 4 : 3;
+}
+
+static inline uint8_t get_frame_crc_length()
+{
+    return frame_version == SERIAL_ALP_FRAME_VERSION_1 ? SERIAL_ALP_FRAME_CRC_SIZE : 0;
+}
+
+static void encode_frame_header(uint8_t* header, uint8_t payload_len)
+{
+    uint8_t header_len = 0;
+    header[header_len++] = SERIAL_ALP_FRAME_SYNC_BYTE;
+    header[header_len++] = frame_version;
+    if(frame_version == SERIAL_ALP_FRAME_VERSION_1)
+        header[header_len++] = tx_seqnr++;
+
+    header[header_len++] = payload_len;
+}
+
+uint8_t* alp_cmd_handler_reserve_alp_command(uint8_t max_alp_command_len)
+{
+#if MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE > 0
+    flush_response_batch(); // keep the order in which the host receives the output
+#endif
+    uint8_t* frame = console_tx_reserve(get_frame_header_length() + max_alp_command_len + get_frame_crc_length());
+    return frame == NULL ? NULL : frame + get_frame_header_length();
+}
+
+void alp_cmd_handler_commit_alp_command(uint8_t* alp_command, uint8_t alp_command_len)
+{
+    uint8_t* frame = alp_command - get_frame_header_length();
+    encode_frame_header(frame, alp_command_len);
+    if(frame_version == SERIAL_ALP_FRAME_VERSION_1)
+    {
+        uint16_t crc = crc_calculate(frame + 1, get_frame_header_length() - 1 + alp_command_len);
+        alp_command[alp_command_len] = crc >> 8;
+        alp_command[alp_command_len + 1] = crc & 0xFF;
+    }
+
+    console_tx_commit(get_frame_header_length() + alp_command_len + get_frame_crc_length());
+}
+
+// outputs a frame of which the payload is in two parts, encoded straight into the console TX fifo when it has room for
+// it, else with header, payload parts and CRC each in one console write, instead of byte per byte
+static void output_frame(const uint8_t* payload, uint8_t payload_len, const uint8_t* payload_tail, uint8_t payload_tail_len)
+{
+    uint8_t* frame_payload = console_tx_reserve(get_frame_header_length() + payload_len + payload_tail_len + get_frame_crc_length());
+    if(frame_payload != NULL)
+    {
+        frame_payload += get_frame_header_length();
+        memcpy(frame_payload, payload, payload_len);
+        if(payload_tail_len > 0)
+            memcpy(frame_payload + payload_len, payload_tail, payload_tail_len);
+
+        alp_cmd_handler_commit_alp_command(frame_payload, payload_len + payload_tail_len);
+        return;
+    }
+
+    uint8_t header[SERIAL_ALP_FRAME_MAX_HEADER_SIZE];
+    encode_frame_header(header, payload_len + payload_tail_len);
+    console_print_bytes(header, get_frame_header_length());
+    console_print_bytes((uint8_t*) payload, payload_len);
+    if(payload_tail_len > 0)
+        console_print_bytes((uint8_t*) payload_tail, payload_tail_len);
+
+    if(frame_version == SERIAL_ALP_FRAME_VERSION_1)
+    {
+        uint16_t crc = crc_update(crc_calculate(header + 1, get_frame_header_length() - 1), payload, payload_len);
+        crc = __builtin_bswap16(crc_update(crc, payload_tail, payload_tail_len));
+        console_print_bytes((uint8_t*) &crc, SERIAL_ALP_FRAME_CRC_SIZE);
+    }
+}
+
+#if MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE > 0
+static void flush_response_batch()
+{
+    timer_cancel_task(&flush_response_batch);
+    if(response_batch_length == 0)
+        return;
+
+    DPRINT("output batch of %i bytes of D7ASP responses", response_batch_length);
+    output_frame(response_batch, response_batch_length, NULL, 0);
+    response_batch_length = 0;
+}
+#endif
+
+void alp_cmd_handler_init()
+{
+#if MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE > 0
+    response_batch_length = 0;
+    sched_register_task(&flush_response_batch);
+#endif
 }
 
 void alp_cmd_handler_output_alp_command(uint8_t *alp_command, uint8_t alp_command_len)
 {
     DPRINT("output ALP cmd of size %i", alp_command_len);
-    console_print_byte(SERIAL_ALP_FRAME_SYNC_BYTE);
-    console_print_byte(SERIAL_ALP_FRAME_VERSION);
-    console_print_byte(alp_command_len);
-    console_print_bytes(alp_command, alp_command_len);
-    // TODO crc?
+#if MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE > 0
+    flush_response_batch(); // keep the order in which the host receives the output
+#endif
+    output_frame(alp_command, alp_command_len, NULL, 0);
 }
 
 
@@ -136,20 +308,28 @@ void alp_cmd_handler_output_d7asp_response(d7asp_result_t d7asp_result, uint8_t
 {
     // TODO refactor, move partly to alp + call from SP when shell enabled instead of from app
     DPRINT("output D7ASP response to console");
-    uint8_t data[MODULE_D7AP_FIFO_COMMAND_BUFFER_SIZE] = { 0x00 };
-    uint8_t* ptr = data;
-
-    (*ptr) = SERIAL_ALP_FRAME_SYNC_BYTE; ptr++;               // serial interface sync byte
-    (*ptr) = SERIAL_ALP_FRAME_VERSION; ptr++;               // serial interface version
-    ptr++;                              // payload length byte, skip for now and fill later
+    // the received actions are copied once, straight from the packet into the batch or the console TX fifo
+    uint8_t status_action[ALP_D7ASP_INTERFACE_STATUS_ACTION_MAX_SIZE];
+    uint8_t status_action_length = append_interface_status_action(&d7asp_result, status_action);
 
-    ptr += append_interface_status_action(&d7asp_result, ptr);
+#if MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE > 0
+    uint8_t length = status_action_length + alp_command_size;
+    // the responses are collected in one frame, which is output when full or after the latency bound of the first response
+    if(response_batch_length + length > MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE)
+        flush_response_batch();
 
-    // the actual received data ...
-    memcpy(ptr, alp_command, alp_command_size); ptr+= alp_command_size;
+    if(length <= MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE)
+    {
+        if(response_batch_length == 0)
+            timer_post_task_delay(&flush_response_batch, MODULE_D7AP_SERIAL_RESPONSE_BATCH_LATENCY * TIMER_TICKS_PER_SEC / 1000);
 
-    data[2] = ptr - (data + 3);       // fill length byte
+        memcpy(response_batch + response_batch_length, status_action, status_action_length);
+        memcpy(response_batch + response_batch_length + status_action_length, alp_command, alp_command_size);
+        response_batch_length += length;
+        return;
+    }
+#endif
 
-    console_print_bytes(data, ptr - data);
+    output_frame(status_action, status_action_length, alp_command, alp_command_size);
 }
 
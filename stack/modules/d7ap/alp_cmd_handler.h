@@ -33,10 +33,23 @@
 typedef void (*alp_cmd_handler_appl_itf_callback)(uint8_t* alp_command, uint8_t alp_command_length);
 
 ///
-/// \brief Shell command handler for ALP interface
-/// \param cmd_fifo
+/// \brief Initialize the output to the shell interface, before any output
 ///
-void alp_cmd_handler(fifo_t* cmd_fifo);
+void alp_cmd_handler_init();
+
+///
+/// \brief Returns the length of the serial ALP frame at the start of cmd, see cmd_length_t
+/// \param cmd
+/// \param available
+///
+int16_t alp_cmd_handler_get_cmd_length(const uint8_t* cmd, uint16_t available);
+
+///
+/// \brief Shell command handler for ALP interface, processes a complete serial ALP frame
+/// \param cmd
+/// \param length
+///
+bool alp_cmd_handler(uint8_t* cmd, uint16_t length);
 
 ///
 /// \brief Output ALP command to the shell interface
@@ -45,8 +58,26 @@ void alp_cmd_handler(fifo_t* cmd_fifo);
 ///
 void alp_cmd_handler_output_alp_command(uint8_t *alp_command, uint8_t alp_command_len);
 
+///
+/// \brief Reserves the room of an ALP command of up to max_alp_command_len bytes in the console TX fifo, so it is encoded
+/// in place instead of being copied by alp_cmd_handler_output_alp_command(). Nothing may be output until the command is
+/// output by alp_cmd_handler_commit_alp_command()
+/// \param max_alp_command_len
+/// \return The buffer to encode the command in, or NULL when the console has no room for it in place
+///
+uint8_t* alp_cmd_handler_reserve_alp_command(uint8_t max_alp_command_len);
+
+///
+/// \brief Output the ALP command encoded in the buffer returned by alp_cmd_handler_reserve_alp_command()
+/// \param alp_command
+/// \param alp_command_len
+///
+void alp_cmd_handler_commit_alp_command(uint8_t* alp_command, uint8_t alp_command_len);
+
 ///
 /// \brief Output received responses received from D7ASP to the shell interface
+/// When MODULE_D7AP_SERIAL_RESPONSE_BATCH_SIZE is set several responses are output in one serial frame, after at most
+/// MODULE_D7AP_SERIAL_RESPONSE_BATCH_LATENCY ms
 /// \param d7asp_result
 /// \param alp_command
 /// \param alp_command_size
@@ -59,4 +90,12 @@ void alp_cmd_handler_output_d7asp_response(d7asp_result_t d7asp_result, uint8_t
 ///
 void alp_cmd_handler_set_appl_itf_callback(alp_cmd_handler_appl_itf_callback cb);
 
+///
+/// \brief Pass an action forwarded to the application interface to the callback, if one is set
+/// \param alp_action
+/// \param alp_action_length
+/// \return true when the callback is set
+///
+bool alp_cmd_handler_process_appl_itf_action(uint8_t* alp_action, uint8_t alp_action_length);
+
 #endif // ALP_CMD_HANDLER_H
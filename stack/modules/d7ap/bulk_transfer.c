@@ -0,0 +1,299 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bulk_transfer.h"
+
+#include "MODULE_D7AP_defs.h"
+#ifdef MODULE_D7AP_BULK_TRANSFER_ENABLED
+
+#include "string.h"
+#include "debug.h"
+#include "ng.h"
+#include "scheduler.h"
+#include "bitmap.h"
+#include "alp.h"
+#include "log.h"
+
+#if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_MISC_LOG_ENABLED)
+#define DPRINT(...) log_print_stack_string(LOG_STACK_FWK, __VA_ARGS__)
+#else
+#define DPRINT(...)
+#endif
+
+#if MODULE_D7AP_BULK_TRANSFER_WINDOW_SIZE > MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT
+    #error "MODULE_D7AP_BULK_TRANSFER_WINDOW_SIZE should not exceed MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT, a window is queued in one session"
+#endif
+
+// a block in the window, sent as one request of the session
+typedef struct {
+    uint16_t block;
+    uint8_t request_id;
+    uint8_t attempts;
+    bool is_done; // acked, or for reads returned
+} window_entry_t;
+
+typedef struct {
+    bool is_active;
+    bool is_write;
+    d7asp_master_session_config_t session_config;
+    uint8_t file_id;
+    uint32_t offset;
+    uint32_t length;
+    const uint8_t* data;
+    uint8_t block_size;
+    uint16_t block_count;
+    uint16_t next_block; // the first block which was not sent yet
+    uint8_t fifo_token;
+    window_entry_t window[MODULE_D7AP_BULK_TRANSFER_WINDOW_SIZE];
+    uint8_t window_count;
+    bulk_transfer_block_received_callback block_received_cb;
+    bulk_transfer_completed_callback completed_cb;
+} transfer_t;
+
+static transfer_t NGDEF(_transfer);
+#define transfer NG(_transfer)
+
+// the operands of a file data action: the control byte, file ID, offset and length
+static uint8_t get_block_header_size(uint32_t offset, uint8_t length)
+{
+    return 2 + alp_get_length_operand_size(offset) + alp_get_length_operand_size(length);
+}
+
+static inline uint32_t get_block_offset(uint16_t block)
+{
+    return transfer.offset + (uint32_t) block * transfer.block_size;
+}
+
+static uint8_t get_block_length(uint16_t block)
+{
+    uint32_t remaining = transfer.length - (uint32_t) block * transfer.block_size;
+    return remaining < transfer.block_size ? remaining : transfer.block_size;
+}
+
+static void complete(bool success)
+{
+    DPRINT("Bulk transfer of file %i completed, success %i", transfer.file_id, success);
+    transfer.is_active = false;
+    if(transfer.completed_cb != NULL)
+        transfer.completed_cb(success);
+}
+
+// keeps the blocks of the window which are not done yet, adds the next blocks and queues them as the requests of one session
+static void queue_window()
+{
+    if(!transfer.is_active)
+        return;
+
+    uint8_t count = 0;
+    for(uint8_t i = 0; i < transfer.window_count; i++)
+    {
+        if(transfer.window[i].is_done)
+            continue;
+
+        if(transfer.window[i].attempts > MODULE_D7AP_BULK_TRANSFER_RETRY_LIMIT)
+        {
+            DPRINT("Block %i failed", transfer.window[i].block);
+            complete(false);
+            return;
+        }
+
+        transfer.window[count++] = transfer.window[i];
+    }
+
+    d7asp_master_session_t* session = d7asp_master_session_create(&transfer.session_config);
+    uint8_t max_request_length = get_block_header_size(transfer.offset + transfer.length, transfer.block_size);
+    if(transfer.is_write)
+        max_request_length += transfer.block_size;
+
+    uint8_t capacity = d7asp_get_queue_capacity(session, max_request_length);
+    if(capacity > MODULE_D7AP_BULK_TRANSFER_WINDOW_SIZE)
+        capacity = MODULE_D7AP_BULK_TRANSFER_WINDOW_SIZE;
+
+    while(count < capacity && transfer.next_block < transfer.block_count)
+        transfer.window[count++] = (window_entry_t){ .block = transfer.next_block++ };
+
+    transfer.window_count = count;
+    if(count == 0)
+    {
+        complete(true);
+        return;
+    }
+
+    DPRINT("Bulk transfer window of %i blocks, next block %i", count, transfer.next_block);
+    for(uint8_t i = 0; i < count; i++)
+    {
+        window_entry_t* entry = &transfer.window[i];
+        uint32_t offset = get_block_offset(entry->block);
+        uint8_t length = get_block_length(entry->block);
+        uint8_t request[max_request_length];
+        uint8_t* ptr = request;
+        *ptr++ = transfer.is_write ? ALP_OP_WRITE_FILE_DATA : ALP_OP_READ_FILE_DATA;
+        *ptr++ = transfer.file_id;
+        ptr += alp_encode_length_operand(ptr, offset);
+        ptr += alp_encode_length_operand(ptr, length);
+        if(transfer.is_write)
+        {
+            memcpy(ptr, transfer.data + (offset - transfer.offset), length);
+            ptr += length;
+        }
+
+        d7asp_queue_result_t result = d7asp_queue_alp_actions(session, request, ptr - request, transfer.is_write ? 0 : length,
+                                                              D7ASP_PRIORITY_NORMAL);
+        transfer.fifo_token = result.fifo_token;
+        entry->request_id = result.request_id;
+        entry->attempts++;
+        entry->is_done = false;
+    }
+}
+
+SCHED_REGISTER_TASK(queue_window);
+
+void bulk_transfer_init()
+{
+    transfer.is_active = false;
+}
+
+static error_t start(const d7asp_master_session_config_t* session_config, uint8_t file_id, uint32_t offset, uint32_t length)
+{
+    if(transfer.is_active)
+        return EBUSY;
+
+    if(length == 0 || offset + length > ALP_LENGTH_OPERAND_MAX || session_config->qos.qos_resp_mode == SESSION_RESP_MODE_NO
+       || session_config->qos.qos_resp_mode == SESSION_RESP_MODE_NO_RPT)
+        return EINVAL;
+
+    // the largest block for which the action with its data fits a frame
+    d7asp_master_session_config_t config = *session_config;
+    uint8_t max_payload_length = d7asp_get_max_request_length(d7asp_master_session_create(&config));
+    uint8_t header_size = get_block_header_size(offset + length, max_payload_length);
+    if(max_payload_length <= header_size)
+        return EINVAL;
+
+    uint8_t block_size = max_payload_length - header_size;
+
+    transfer = (transfer_t){
+        .is_active = true,
+        .session_config = *session_config,
+        .file_id = file_id,
+        .offset = offset,
+        .length = length,
+        .block_size = block_size,
+        .block_count = (length + block_size - 1) / block_size,
+    };
+
+    DPRINT("Bulk transfer of %i bytes of file %i in %i blocks", length, file_id, transfer.block_count);
+    return SUCCESS;
+}
+
+error_t bulk_transfer_read_file(const d7asp_master_session_config_t* session_config, uint8_t file_id, uint32_t offset,
+                                uint32_t length, bulk_transfer_block_received_callback block_received_cb,
+                                bulk_transfer_completed_callback completed_cb)
+{
+    error_t err = start(session_config, file_id, offset, length);
+    if(err != SUCCESS)
+        return err;
+
+    transfer.block_received_cb = block_received_cb;
+    transfer.completed_cb = completed_cb;
+    queue_window();
+    return SUCCESS;
+}
+
+error_t bulk_transfer_write_file(const d7asp_master_session_config_t* session_config, uint8_t file_id, uint32_t offset,
+                                 const uint8_t* data, uint32_t length, bulk_transfer_completed_callback completed_cb)
+{
+    error_t err = start(session_config, file_id, offset, length);
+    if(err != SUCCESS)
+        return err;
+
+    transfer.is_write = true;
+    transfer.data = data;
+    transfer.completed_cb = completed_cb;
+    queue_window();
+    return SUCCESS;
+}
+
+bool bulk_transfer_is_active()
+{
+    return transfer.is_active;
+}
+
+static window_entry_t* get_window_entry(uint8_t fifo_token, uint8_t request_id)
+{
+    if(!transfer.is_active || fifo_token != transfer.fifo_token)
+        return NULL;
+
+    for(uint8_t i = 0; i < transfer.window_count; i++)
+    {
+        if(transfer.window[i].request_id == request_id)
+            return &transfer.window[i];
+    }
+
+    return NULL;
+}
+
+bool bulk_transfer_process_d7asp_result(const d7asp_result_t* d7asp_result, const uint8_t* alp_response, uint8_t alp_response_length)
+{
+    window_entry_t* entry = get_window_entry(d7asp_result->fifo_token, d7asp_result->seqnr);
+    if(entry == NULL)
+        return false;
+
+    if(transfer.is_write)
+        return true; // the ack is reported in the success bitmap
+
+    // the return file data action of the block, an error response leaves the block to be read again
+    uint32_t offset;
+    uint32_t length;
+    const uint8_t* ptr = alp_response;
+    if(alp_response_length < 4 || alp_get_operation((uint8_t*) ptr) != ALP_OP_RETURN_FILE_DATA || ptr[1] != transfer.file_id)
+        return true;
+
+    ptr += 2;
+    ptr += alp_decode_length_operand(ptr, &offset);
+    ptr += alp_decode_length_operand(ptr, &length);
+    if(offset != get_block_offset(entry->block) || length != get_block_length(entry->block)
+       || ptr + length > alp_response + alp_response_length)
+        return true;
+
+    if(!entry->is_done && transfer.block_received_cb != NULL)
+        transfer.block_received_cb(offset, ptr, length);
+
+    entry->is_done = true;
+    return true;
+}
+
+bool bulk_transfer_process_flush_completed(uint8_t fifo_token, const uint8_t* success_bitmap, uint8_t bitmap_byte_count)
+{
+    if(!transfer.is_active || fifo_token != transfer.fifo_token)
+        return false;
+
+    if(transfer.is_write)
+    {
+        for(uint8_t i = 0; i < transfer.window_count; i++)
+        {
+            uint8_t request_id = transfer.window[i].request_id;
+            transfer.window[i].is_done = request_id < bitmap_byte_count * 8 && bitmap_get((uint8_t*) success_bitmap, request_id);
+        }
+    }
+
+    // the session is reset after this call, the next window is queued afterwards
+    sched_post_task(&queue_window);
+    return true;
+}
+
+#endif // MODULE_D7AP_BULK_TRANSFER_ENABLED
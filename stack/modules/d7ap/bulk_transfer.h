@@ -0,0 +1,78 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file bulk_transfer.h
+ * \brief Reads or writes a large file of a remote node, instead of issuing the reads or writes of its chunks one by one
+ *
+ * The area of the file is split in blocks which fit a single frame to the addressee, the sequence number of a block is its
+ * index in the area. A window of blocks is queued as the requests of one session, so the blocks are sent back to back in a
+ * single dialog on the guarded channel. After the session is flushed, the blocks which were not acked (or for reads, not
+ * returned) are sent again in the next window together with the following blocks, up to MODULE_D7AP_BULK_TRANSFER_RETRY_LIMIT
+ * times per block. One transfer is active at a time. Requires MODULE_D7AP_BULK_TRANSFER_ENABLED.
+ */
+
+#ifndef BULK_TRANSFER_H_
+#define BULK_TRANSFER_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "errors.h"
+#include "d7asp.h"
+
+/**
+ * \brief Called for every block read, the blocks of different windows can arrive out of order
+ */
+typedef void (*bulk_transfer_block_received_callback)(uint32_t offset, const uint8_t* data, uint8_t length);
+
+typedef void (*bulk_transfer_completed_callback)(bool success);
+
+void bulk_transfer_init();
+
+/**
+ * \brief Read length bytes of a file of the addressee of the session, starting at offset
+ * \param session_config The session, which should request a response
+ * \return EBUSY when a transfer is active, EINVAL for an empty area or a session without responses
+ */
+error_t bulk_transfer_read_file(const d7asp_master_session_config_t* session_config, uint8_t file_id, uint32_t offset,
+                                uint32_t length, bulk_transfer_block_received_callback block_received_cb,
+                                bulk_transfer_completed_callback completed_cb);
+
+/**
+ * \brief Write length bytes of data to a file of the addressee of the session, starting at offset
+ *
+ * The data is not copied, it should stay valid until completed_cb is called.
+ * \return EBUSY when a transfer is active, EINVAL for an empty area or a session without responses
+ */
+error_t bulk_transfer_write_file(const d7asp_master_session_config_t* session_config, uint8_t file_id, uint32_t offset,
+                                 const uint8_t* data, uint32_t length, bulk_transfer_completed_callback completed_cb);
+
+bool bulk_transfer_is_active();
+
+/**
+ * \brief Called by ALP for every response received
+ * \return true when the response belongs to the active transfer, it should not be processed further then
+ */
+bool bulk_transfer_process_d7asp_result(const d7asp_result_t* d7asp_result, const uint8_t* alp_response, uint8_t alp_response_length);
+
+/**
+ * \brief Called by ALP when a session is flushed
+ * \return true when the session carried the window of the active transfer
+ */
+bool bulk_transfer_process_flush_completed(uint8_t fifo_token, const uint8_t* success_bitmap, uint8_t bitmap_byte_count);
+
+#endif /* BULK_TRANSFER_H_ */
@@ -25,10 +25,12 @@
 #include "fs.h"
 #include "ng.h"
 #include "log.h"
+#include "trace.h"
 #include "math.h"
 #include "hwdebug.h"
 #include "aes.h"
 #include "packet_queue.h"
+#include "random.h"
 
 #if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_NP_LOG_ENABLED)
 #define DPRINT(...) log_print_stack_string(LOG_STACK_NWL, __VA_ARGS__)
@@ -63,10 +65,232 @@ static d7anp_node_security_t NGDEF(_node_security_state);
 static d7anp_trusted_node_t* NGDEF(_latest_node);
 #define latest_node NG(_latest_node)
 
+/*
+ * The trusted node table is indexed by a hash of the UID, chained per bucket, so the frame counter of a node is
+ * found without scanning the table. When the table is full the least recently used node is replaced.
+ * The trusted node counters are written back to the FS in a low priority task instead of on every frame.
+ */
+#define NO_TRUSTED_NODE 0xFF
+#define TRUSTED_NODE_BUCKET_COUNT MODULE_D7AP_TRUSTED_NODE_TABLE_SIZE
+
+static uint8_t NGDEF(_trusted_node_buckets)[TRUSTED_NODE_BUCKET_COUNT];
+#define trusted_node_buckets NG(_trusted_node_buckets)
+
+static uint8_t NGDEF(_trusted_node_next)[MODULE_D7AP_TRUSTED_NODE_TABLE_SIZE];
+#define trusted_node_next NG(_trusted_node_next)
+
+static uint32_t NGDEF(_trusted_node_last_use)[MODULE_D7AP_TRUSTED_NODE_TABLE_SIZE];
+#define trusted_node_last_use NG(_trusted_node_last_use)
+
+static uint32_t NGDEF(_trusted_node_use_count);
+#define trusted_node_use_count NG(_trusted_node_use_count)
+
+static bool NGDEF(_trusted_node_dirty)[MODULE_D7AP_TRUSTED_NODE_TABLE_SIZE];
+#define trusted_node_dirty NG(_trusted_node_dirty)
+
+static uint8_t NGDEF(_stored_trusted_node_nb);
+#define stored_trusted_node_nb NG(_stored_trusted_node_nb)
+
+#if defined(MODULE_D7AP_NLS_ENABLED)
+/*
+ * The FS does not hold the last used TX frame counter but the end of a reserved range of frame counters, which is
+ * only written when that range is exhausted. After a reboot the frame counter resumes from the end of the range,
+ * so a frame counter is never reused.
+ */
+static uint32_t NGDEF(_reserved_frame_counter);
+#define reserved_frame_counter NG(_reserved_frame_counter)
+#endif
+
+// received secured frames waiting for decryption and authentication, in order of reception
+static packet_t* NGDEF(_nls_rx_jobs)[MODULE_D7AP_PACKET_QUEUE_SIZE];
+#define nls_rx_jobs NG(_nls_rx_jobs)
+
+static uint8_t NGDEF(_nls_rx_jobs_first);
+#define nls_rx_jobs_first NG(_nls_rx_jobs_first)
+
+static uint8_t NGDEF(_nls_rx_jobs_count);
+#define nls_rx_jobs_count NG(_nls_rx_jobs_count)
+
+static d7anp_security_counters_t NGDEF(_security_counters);
+#define security_counters NG(_security_counters)
+
+static void process_nls_rx_job();
+
+// a frame secured by CCM is decrypted by a job of a few blocks per step, so the other tasks are not delayed by the
+// decryption of a long frame
+#define NLS_RX_CCM_BLOCKS_PER_STEP 4
+
+static sched_job_t NGDEF(_nls_rx_ccm_job);
+#define nls_rx_ccm_job NG(_nls_rx_ccm_job)
+
+static aes_ccm_t NGDEF(_nls_rx_ccm);
+#define nls_rx_ccm NG(_nls_rx_ccm)
+
+static uint8_t NGDEF(_nls_rx_ccm_ctr_blk)[AES_BLOCK_SIZE];
+#define nls_rx_ccm_ctr_blk NG(_nls_rx_ccm_ctr_blk)
+
+// the frame being decrypted by the job, NULL when there is none
+static packet_t* NGDEF(_nls_rx_ccm_packet);
+#define nls_rx_ccm_packet NG(_nls_rx_ccm_packet)
+
+// expanded key schedules of the current key and of the key it replaced, to accept frames still using the previous key
+#define KEY_SLOT_COUNT 2
+
+typedef struct {
+    aes_ctx_t ctx;
+    uint8_t key_counter;
+    bool valid;
+} key_slot_t;
+
+static key_slot_t NGDEF(_key_slots)[KEY_SLOT_COUNT];
+#define key_slots NG(_key_slots)
+
+static uint8_t NGDEF(_current_key_slot);
+#define current_key_slot NG(_current_key_slot)
+
+#if defined(MODULE_D7AP_NLS_ENABLED) && (MODULE_D7AP_NLS_METHODS & 0xFE) == 0
+    #error "MODULE_D7AP_NLS_METHODS should select at least one NLS method when MODULE_D7AP_NLS_ENABLED is set"
+#endif
+
+#if defined(MODULE_D7AP_NWL_FORWARDING_ENABLED) && !defined(MODULE_D7AP_NWL_HOPPING_ENABLED)
+    #error "MODULE_D7AP_NWL_FORWARDING_ENABLED requires MODULE_D7AP_NWL_HOPPING_ENABLED"
+#endif
+
+#if MODULE_D7AP_NWL_HEADER_TEMPLATE_COUNT > 0
+/*
+ * The D7ANP headers of the last transmitted frames are kept as templates. A frame with the same control, origin access
+ * class, hopping control and key counter as a template is assembled by copying it, only the hop sequence number and the
+ * frame counter are patched. The templates hold the origin ID, they are dropped when the VID changes.
+ */
+#define HEADER_TEMPLATE_MAX_SIZE (1 + 1 + ID_TYPE_UID_ID_LENGTH + 1 + 1 + ID_TYPE_UID_ID_LENGTH + 1 + sizeof(uint32_t))
+
+typedef struct {
+    d7anp_ctrl_t ctrl;
+    uint8_t origin_access_class;
+    d7anp_hop_ctrl_t hop_ctrl;
+    uint8_t hop_dst_id[8];
+    uint8_t key_counter;
+    uint8_t length;
+    uint8_t hop_seq_index;          // 0 when the header holds no hopping control
+    uint8_t frame_counter_index;    // 0 when the header holds no frame counter
+    uint8_t header[HEADER_TEMPLATE_MAX_SIZE];
+} header_template_t;
+
+static header_template_t NGDEF(_header_templates)[MODULE_D7AP_NWL_HEADER_TEMPLATE_COUNT];
+#define header_templates NG(_header_templates)
+
+static uint8_t NGDEF(_header_template_count);
+#define header_template_count NG(_header_template_count)
+
+static uint8_t NGDEF(_header_template_next);
+#define header_template_next NG(_header_template_next)
+#endif
+
+#ifdef MODULE_D7AP_NWL_HOPPING_ENABLED
+#if MODULE_D7AP_NWL_HOP_LIMIT > 7
+    #error "MODULE_D7AP_NWL_HOP_LIMIT should not exceed 7, the size of the hop limit of the hopping control"
+#endif
+
+// the last received hopping frames, to drop the copies of a frame forwarded by other nodes
+#define DUPLICATE_CACHE_SIZE 8
+
+typedef struct {
+    id_type_t origin_id_type;
+    uint8_t origin_id[8];
+    uint8_t seq;
+} hopping_frame_t;
+
+static hopping_frame_t NGDEF(_duplicate_cache)[DUPLICATE_CACHE_SIZE];
+#define duplicate_cache NG(_duplicate_cache)
+
+static uint8_t NGDEF(_duplicate_cache_count);
+#define duplicate_cache_count NG(_duplicate_cache_count)
+
+static uint8_t NGDEF(_duplicate_cache_next);
+#define duplicate_cache_next NG(_duplicate_cache_next)
+
+static uint8_t NGDEF(_hop_seq);
+#define hop_seq NG(_hop_seq)
+
+static d7anp_neighbor_t NGDEF(_neighbors)[MODULE_D7AP_NWL_NEIGHBOR_TABLE_SIZE];
+#define neighbors NG(_neighbors)
+
+static uint8_t NGDEF(_neighbor_count);
+#define neighbor_count NG(_neighbor_count)
+
+#ifdef MODULE_D7AP_NWL_FORWARDING_ENABLED
+// the forwarded frames are repeated in the subnet they were received in, without DLL target
+static d7anp_addressee_t NGDEF(_forward_addressee);
+#define forward_addressee NG(_forward_addressee)
+#endif
+#endif
+
+// the NLS methods compiled in, see MODULE_D7AP_NLS_METHODS. The code of the other methods folds away, frames using them are
+// rejected
+#define NLS_METHOD_SUPPORTED(nls_method) ((MODULE_D7AP_NLS_METHODS >> (nls_method)) & 1)
+#define NLS_CBC_MAC_SUPPORTED (NLS_METHOD_SUPPORTED(AES_CBC_MAC_128) || NLS_METHOD_SUPPORTED(AES_CBC_MAC_64) \
+                               || NLS_METHOD_SUPPORTED(AES_CBC_MAC_32))
+#define NLS_CCM_SUPPORTED (NLS_METHOD_SUPPORTED(AES_CCM_128) || NLS_METHOD_SUPPORTED(AES_CCM_64) \
+                           || NLS_METHOD_SUPPORTED(AES_CCM_32))
+
+static inline bool nls_method_has_key_counter(uint8_t nls_method)
+{
+    return (nls_method == AES_CTR || nls_method == AES_CCM_32 ||
+            nls_method == AES_CCM_64 || nls_method == AES_CCM_128);
+}
+
+#if defined(MODULE_D7AP_NLS_ENABLED)
+static void load_security_key()
+{
+    uint8_t key[AES_BLOCK_SIZE];
+    key_slot_t* slot = &key_slots[current_key_slot];
+
+    assert(fs_read_nwl_security_key(key) == ALP_STATUS_OK); // TODO permission
+    fs_read_nwl_security(&security_state);
+    reserved_frame_counter = security_state.frame_counter;
+
+    if (slot->valid && memcmp(slot->ctx.key, key, AES_BLOCK_SIZE) == 0)
+    {
+        slot->key_counter = security_state.key_counter;
+        return;
+    }
+
+    // keep the schedule of the previous key, the new key is expanded once here instead of for every frame
+    if (slot->valid)
+    {
+        current_key_slot = (current_key_slot + 1) % KEY_SLOT_COUNT;
+        slot = &key_slots[current_key_slot];
+    }
+
+    DPRINT("KEY");
+    DPRINT_DATA(key, AES_BLOCK_SIZE);
+    AES128_ctx_init(&slot->ctx, key);
+    slot->key_counter = security_state.key_counter;
+    slot->valid = true;
+}
+#endif
+
+static const aes_ctx_t* get_key_ctx(packet_t* packet)
+{
+    // the key counter is only transmitted for the encrypting methods, the others use the current key
+    if (!nls_method_has_key_counter(packet->d7anp_ctrl.nls_method))
+        return &key_slots[current_key_slot].ctx;
+
+    for (uint8_t i = 0; i < KEY_SLOT_COUNT; i++)
+    {
+        uint8_t slot = (current_key_slot + KEY_SLOT_COUNT - i) % KEY_SLOT_COUNT;
+        if (key_slots[slot].valid && key_slots[slot].key_counter == packet->d7anp_security.key_counter)
+            return &key_slots[slot].ctx;
+    }
+
+    return NULL;
+}
+
 static inline uint8_t get_auth_len(uint8_t nls_method)
 {
     switch(nls_method)
     {
+    case AES_NONE:
     case AES_CTR:
         return 0;
     case AES_CBC_MAC_128:
@@ -85,6 +309,7 @@ static inline uint8_t get_auth_len(uint8_t nls_method)
 
 static void switch_state(state_t next_state)
 {
+    trace_record(LOG_STACK_NWL, TRACE_EVENT_STATE, 0, 0, d7anp_state, next_state);
     switch(next_state)
     {
         case D7ANP_STATE_TRANSMIT:
@@ -108,8 +333,10 @@ static void switch_state(state_t next_state)
           break;
     }
 
+#ifndef FRAMEWORK_DEBUG_PROBES_ENABLED
     // output state on debug pins
     d7anp_state == D7ANP_STATE_FOREGROUND_SCAN? DEBUG_PIN_SET(3) : DEBUG_PIN_CLR(3);
+#endif
 }
 
 static void foreground_scan_expired()
@@ -117,6 +344,7 @@ static void foreground_scan_expired()
     // the FG scan expiration may also happen while Tx is busy (d7anp_state = D7ANP_STATE_TRANSMIT) // TODO validate
     assert(d7anp_state == D7ANP_STATE_FOREGROUND_SCAN || d7anp_state == D7ANP_STATE_TRANSMIT);
     DPRINT("Foreground scan expired @%i", timer_get_counter_value());
+    trace_record(LOG_STACK_NWL, TRACE_EVENT_TIMEOUT, 0, 0, d7anp_state, 0);
 
     if (d7anp_state == D7ANP_STATE_FOREGROUND_SCAN) // when in D7ANP_STATE_TRANSMIT d7anp_signal_packet_transmitted() will switch state
       switch_state(D7ANP_STATE_IDLE);
@@ -184,45 +412,371 @@ void d7anp_stop_foreground_scan(bool auto_scan)
 void start_foreground_scan_after_D7AAdvP()
 {
     DPRINT("start_foreground_scan_after_D7AAdvP");
-    fg_scan_timeout_ticks = FG_SCAN_TIMEOUT;
+    fg_scan_timeout_ticks = TI_TO_TIMER_TICKS(FG_SCAN_TIMEOUT);
     d7anp_start_foreground_scan();
 }
 
-void d7anp_init()
+static uint8_t trusted_node_bucket(const uint8_t *address)
 {
-    uint8_t key[AES_BLOCK_SIZE];
+    // FNV-1a over the 64-bit UID
+    uint32_t hash = 2166136261u;
+
+    for (uint8_t i = 0; i < 8; i++)
+        hash = (hash ^ address[i]) * 16777619u;
+
+    return (uint8_t)(hash % TRUSTED_NODE_BUCKET_COUNT);
+}
+
+static void link_trusted_node(uint8_t index)
+{
+    uint8_t bucket = trusted_node_bucket(node_security_state.trusted_node_table[index].addr);
+
+    trusted_node_next[index] = trusted_node_buckets[bucket];
+    trusted_node_buckets[bucket] = index;
+}
+
+static void unlink_trusted_node(uint8_t index)
+{
+    uint8_t *link = &trusted_node_buckets[trusted_node_bucket(node_security_state.trusted_node_table[index].addr)];
+
+    while (*link != NO_TRUSTED_NODE)
+    {
+        if (*link == index)
+        {
+            *link = trusted_node_next[index];
+            return;
+        }
+        link = &trusted_node_next[*link];
+    }
+}
+
+static void index_trusted_nodes()
+{
+    memset(trusted_node_buckets, NO_TRUSTED_NODE, sizeof(trusted_node_buckets));
+    memset(trusted_node_dirty, 0, sizeof(trusted_node_dirty));
+    trusted_node_use_count = 0;
+
+    for (uint8_t i = 0; i < node_security_state.trusted_node_nb; i++)
+    {
+        link_trusted_node(i);
+        trusted_node_last_use[i] = 0;
+    }
 
+    stored_trusted_node_nb = node_security_state.trusted_node_nb;
+}
+
+#if defined(MODULE_D7AP_NLS_ENABLED)
+static void reserve_frame_counters()
+{
+    d7anp_security_t reserved = { .key_counter = security_state.key_counter };
+
+    if (security_state.frame_counter > (uint32_t)~0 - MODULE_D7AP_NLS_FRAME_COUNTER_RESERVATION)
+        reserved_frame_counter = (uint32_t)~0;
+    else
+        reserved_frame_counter = security_state.frame_counter + MODULE_D7AP_NLS_FRAME_COUNTER_RESERVATION;
+
+    DPRINT("Reserve frame counters up to %ld", reserved_frame_counter);
+    reserved.frame_counter = reserved_frame_counter;
+    fs_write_nwl_security(&reserved);
+}
+#endif
+
+static void flush_security_state()
+{
+    for (uint8_t i = 0; i < node_security_state.trusted_node_nb; i++)
+    {
+        if (trusted_node_dirty[i])
+        {
+            fs_update_nwl_security_state_register(&node_security_state.trusted_node_table[i], i + 1);
+            trusted_node_dirty[i] = false;
+        }
+    }
+
+    if (stored_trusted_node_nb != node_security_state.trusted_node_nb)
+    {
+        stored_trusted_node_nb = node_security_state.trusted_node_nb;
+        fs_add_nwl_security_state_register_entry(&node_security_state.trusted_node_table[stored_trusted_node_nb - 1],
+                                                 stored_trusted_node_nb);
+    }
+}
+
+static void touch_trusted_node(d7anp_trusted_node_t *node, bool dirty)
+{
+    uint8_t index = node - node_security_state.trusted_node_table;
+
+    trusted_node_last_use[index] = ++trusted_node_use_count;
+    if (dirty)
+    {
+        trusted_node_dirty[index] = true;
+        sched_post_task_prio(&flush_security_state, MIN_PRIORITY);
+    }
+}
+
+SCHED_REGISTER_TASK(foreground_scan_expired);
+SCHED_REGISTER_TASK(start_foreground_scan_after_D7AAdvP);
+SCHED_REGISTER_TASK(flush_security_state);
+SCHED_REGISTER_TASK(process_nls_rx_job);
+
+void d7anp_init()
+{
     d7anp_state = D7ANP_STATE_IDLE;
     fg_scan_timeout_ticks = 0;
 
-    sched_register_task(&foreground_scan_expired);
-    sched_register_task(&start_foreground_scan_after_D7AAdvP);
+    nls_rx_jobs_first = 0;
+    nls_rx_jobs_count = 0;
+    nls_rx_ccm_packet = NULL;
+    d7anp_reset_security_counters();
+    d7anp_notify_dll_conf_file_changed();
+
+#ifdef MODULE_D7AP_NWL_HOPPING_ENABLED
+    duplicate_cache_count = 0;
+    duplicate_cache_next = 0;
+    neighbor_count = 0;
+    // the frames sent before a reboot may still be in the duplicate caches of the other nodes
+    hop_seq = get_rnd();
+#ifdef MODULE_D7AP_NWL_FORWARDING_ENABLED
+    forward_addressee = (d7anp_addressee_t){ .ctrl.id_type = ID_TYPE_NOID };
+#endif
+#endif
 
 #if defined(MODULE_D7AP_NLS_ENABLED)
     /*
      * Init Security
-     * Read the 128 bits key from the "NWL Security Key" file
+     * Read the 128 bits key from the "NWL Security Key" file and the NWL security parameters
      */
-    assert (fs_read_nwl_security_key(key) == ALP_STATUS_OK); // TODO permission
-    DPRINT("KEY");
-    DPRINT_DATA(key, AES_BLOCK_SIZE);
-    AES128_init(key);
-
-    /* Read the NWL security parameters */
-    fs_read_nwl_security(&security_state);
+    memset(key_slots, 0, sizeof(key_slots));
+    current_key_slot = 0;
+    load_security_key();
     DPRINT("Initial Key counter %d", security_state.key_counter);
     DPRINT("Initial Frame counter %ld", security_state.frame_counter);
     /* Read the NWL security state of the successfully decrypted and authenticated devices */
     fs_read_nwl_security_state_register(&node_security_state);
     latest_node = NULL;
 #endif
+    index_trusted_nodes();
+}
+
+void d7anp_notify_nwl_security_file_changed()
+{
+#if defined(MODULE_D7AP_NLS_ENABLED)
+    load_security_key();
+#endif
+}
+
+void d7anp_notify_dll_conf_file_changed()
+{
+#if MODULE_D7AP_NWL_HEADER_TEMPLATE_COUNT > 0
+    // the templates hold the VID of the origin
+    header_template_count = 0;
+    header_template_next = 0;
+#endif
+}
+
+#ifdef MODULE_D7AP_NWL_HOPPING_ENABLED
+static bool is_own_id(id_type_t id_type, const uint8_t* id)
+{
+    const fs_identity_t* identity = fs_get_identity();
+    if (id_type == ID_TYPE_UID)
+        return memcmp(id, identity->uid, ID_TYPE_UID_ID_LENGTH) == 0;
+    else if (id_type == ID_TYPE_VID)
+        return identity->vid_valid && memcmp(id, identity->vid, ID_TYPE_VID_LENGTH) == 0;
+
+    return false;
+}
+
+static d7anp_neighbor_t* find_neighbor(id_type_t id_type, const uint8_t* id)
+{
+    for (uint8_t i = 0; i < neighbor_count; i++)
+    {
+        if (neighbors[i].id_type == id_type && memcmp(neighbors[i].id, id, d7anp_addressee_id_length(id_type)) == 0)
+            return &neighbors[i];
+    }
+
+    return NULL;
+}
+
+// the origin of a frame which did not hop is in range, the least recently heard neighbor is replaced when the table is full
+static void update_neighbor(packet_t* packet)
+{
+    id_type_t id_type = packet->d7anp_ctrl.origin_id_type;
+    if (packet->d7anp_ctrl.origin_void || ID_TYPE_IS_BROADCAST(id_type))
+        return;
+
+    int16_t rssi = packet->hw_radio_packet.rx_meta.rssi;
+    d7anp_neighbor_t* neighbor = find_neighbor(id_type, packet->origin_access_id);
+    if (neighbor)
+        rssi = (3 * neighbor->rssi + rssi) / 4;
+    else if (neighbor_count < MODULE_D7AP_NWL_NEIGHBOR_TABLE_SIZE)
+        neighbor = &neighbors[neighbor_count++];
+    else
+    {
+        timer_tick_t now = packet->hw_radio_packet.rx_meta.timestamp;
+        neighbor = &neighbors[0];
+        for (uint8_t i = 1; i < neighbor_count; i++)
+        {
+            if (now - neighbors[i].last_heard > now - neighbor->last_heard)
+                neighbor = &neighbors[i];
+        }
+    }
+
+    *neighbor = (d7anp_neighbor_t){
+        .id_type = id_type,
+        .rssi = rssi,
+        .lqi = packet->hw_radio_packet.rx_meta.lqi,
+        .last_heard = packet->hw_radio_packet.rx_meta.timestamp
+    };
+    memcpy(neighbor->id, packet->origin_access_id, d7anp_addressee_id_length(id_type));
+}
+
+// returns true when a copy of the frame was received already, otherwise the frame is recorded
+static bool is_duplicate(packet_t* packet)
+{
+    uint8_t id_length = d7anp_addressee_id_length(packet->d7anp_ctrl.origin_id_type);
+    for (uint8_t i = 0; i < duplicate_cache_count; i++)
+    {
+        hopping_frame_t* frame = &duplicate_cache[i];
+        if (frame->seq == packet->d7anp_hop.seq && frame->origin_id_type == packet->d7anp_ctrl.origin_id_type
+            && memcmp(frame->origin_id, packet->origin_access_id, id_length) == 0)
+            return true;
+    }
+
+    hopping_frame_t* frame = &duplicate_cache[duplicate_cache_next];
+    frame->origin_id_type = packet->d7anp_ctrl.origin_id_type;
+    frame->seq = packet->d7anp_hop.seq;
+    memcpy(frame->origin_id, packet->origin_access_id, id_length);
+    duplicate_cache_next = (duplicate_cache_next + 1) % DUPLICATE_CACHE_SIZE;
+    if (duplicate_cache_count < DUPLICATE_CACHE_SIZE)
+        duplicate_cache_count++;
+
+    return false;
+}
+
+#ifdef MODULE_D7AP_NWL_FORWARDING_ENABLED
+static bool should_forward(packet_t* packet)
+{
+    d7anp_hop_ctrl_t* hop_ctrl = &packet->d7anp_hop.ctrl;
+    if (hop_ctrl->hop_count >= hop_ctrl->hop_limit)
+        return false;
+
+    // after the last hop the frame is not forwarded anymore, a unicast destination has to be in range then
+    if (hop_ctrl->hop_count + 1 == hop_ctrl->hop_limit && !ID_TYPE_IS_BROADCAST(hop_ctrl->dst_id_type)
+        && find_neighbor(hop_ctrl->dst_id_type, packet->d7anp_hop.dst_id) == NULL)
+    {
+        DPRINT("Destination of the last hop is not a neighbor");
+        return false;
+    }
+
+    return true;
+}
+
+// the copy is repeated by the DLL, which frees it once transmitted
+static void forward_frame(packet_t* packet)
+{
+    packet_t* forwarded = packet_queue_alloc_packet(packet->hw_radio_packet.length);
+    if (forwarded == NULL)
+    {
+        DPRINT("No packet to forward the frame");
+        return;
+    }
+
+    memcpy(&forwarded->hw_radio_packet, &packet->hw_radio_packet, sizeof(hw_radio_packet_t) + packet->hw_radio_packet.length);
+    forwarded->type = FORWARDED_FRAME;
+    forwarded->dll_header = packet->dll_header;
+    forwarded->d7anp_ctrl = packet->d7anp_ctrl;
+    forwarded->d7anp_hop = packet->d7anp_hop;
+    forwarded->d7anp_hop.ctrl.hop_count++;
+    forwarded->d7anp_hop_index = packet->d7anp_hop_index;
+    forwarded->hw_radio_packet.data[forwarded->d7anp_hop_index] = forwarded->d7anp_hop.ctrl.raw;
+
+    forward_addressee.access_class = packet->dll_header.subnet;
+    forwarded->d7anp_addressee = &forward_addressee;
+
+    DPRINT("Forwarding frame %i, hop %i of %i", forwarded->d7anp_hop.seq, forwarded->d7anp_hop.ctrl.hop_count,
+           forwarded->d7anp_hop.ctrl.hop_limit);
+    // like the requests of the upper layers, the copy is processing until the DLL marks it transmitted
+    packet_queue_mark_processing(forwarded);
+    if (dll_tx_frame(forwarded) != SUCCESS)
+        packet_queue_free_packet(forwarded);
+}
+#endif
+
+// returns false when the received hopping frame is not for this node
+static bool process_received_hop(packet_t* packet)
+{
+    if (packet->d7anp_ctrl.origin_void || ID_TYPE_IS_BROADCAST(packet->d7anp_ctrl.origin_id_type))
+    {
+        DPRINT("Hopping frame without origin");
+        return false;
+    }
+
+    // the frames of this node come back from the forwarders
+    if (is_own_id(packet->d7anp_ctrl.origin_id_type, packet->origin_access_id) || is_duplicate(packet))
+    {
+        DPRINT("Dropping copy of hopping frame %i", packet->d7anp_hop.seq);
+        return false;
+    }
+
+    bool broadcast = ID_TYPE_IS_BROADCAST(packet->d7anp_hop.ctrl.dst_id_type);
+    bool for_us = broadcast || is_own_id(packet->d7anp_hop.ctrl.dst_id_type, packet->d7anp_hop.dst_id);
+
+#ifdef MODULE_D7AP_NWL_FORWARDING_ENABLED
+    if ((broadcast || !for_us) && should_forward(packet))
+        forward_frame(packet);
+#endif
+
+    return for_us;
 }
 
+// returns true when the frame hops: the responses to requests which hopped hop back over as many hops to the requester,
+// the requests hop up to MODULE_D7AP_NWL_HOP_LIMIT times
+static bool prepare_hopping(packet_t* packet)
+{
+    d7anp_hop_t* hop = &packet->d7anp_hop;
+    if (packet->type == RESPONSE_TO_UNICAST || packet->type == RESPONSE_TO_BROADCAST)
+    {
+        // the hopping control is still the one of the request
+        if (!packet->d7anp_ctrl.hop_enabled || hop->ctrl.hop_count == 0)
+            return false;
+
+        hop->ctrl.hop_limit = hop->ctrl.hop_count;
+        hop->ctrl.dst_id_type = packet->d7anp_ctrl.origin_id_type;
+        memcpy(hop->dst_id, packet->origin_access_id, sizeof(hop->dst_id));
+    }
+    else if (packet->type == RETRY_REQUEST)
+    {
+        if (!packet->d7anp_ctrl.hop_enabled)
+            return false;
+    }
+    else
+    {
+        if (MODULE_D7AP_NWL_HOP_LIMIT == 0)
+            return false;
+
+        hop->ctrl.hop_limit = MODULE_D7AP_NWL_HOP_LIMIT;
+        hop->ctrl.dst_id_type = packet->d7anp_addressee->ctrl.id_type;
+        memcpy(hop->dst_id, packet->d7anp_addressee->id, sizeof(hop->dst_id));
+    }
+
+    // every transmission is a new frame for the duplicate caches, including a retry
+    hop->ctrl.hop_count = 0;
+    hop->seq = hop_seq++;
+    return true;
+}
+#endif
+
 error_t d7anp_tx_foreground_frame(packet_t* packet, bool should_include_origin_template, uint8_t slave_listen_timeout_ct)
 {
     assert(d7anp_state == D7ANP_STATE_IDLE || d7anp_state == D7ANP_STATE_FOREGROUND_SCAN);
 
+#ifdef MODULE_D7AP_NWL_HOPPING_ENABLED
+    packet->d7anp_ctrl.hop_enabled = prepare_hopping(packet);
+
+    // the duplicate caches hold the origin of the frames, and the responses hop back to it
+    if (packet->d7anp_ctrl.hop_enabled)
+        should_include_origin_template = true;
+#else
     packet->d7anp_ctrl.hop_enabled = false;
+#endif
 
     // we need to switch back to the current state after the transmission procedure
     d7anp_prev_state = d7anp_state;
@@ -238,12 +792,10 @@ error_t d7anp_tx_foreground_frame(packet_t* packet, bool should_include_origin_t
     }
     else
     {
-        uint8_t vid[2];
-        fs_read_vid(vid);
-        if (memcmp(vid, (uint8_t[2]){ 0xFF, 0xFF }, 2) == 0)
-            packet->d7anp_ctrl.origin_id_type = ID_TYPE_UID;
-        else
+        if (fs_get_identity()->vid_valid)
             packet->d7anp_ctrl.origin_id_type = ID_TYPE_VID;
+        else
+            packet->d7anp_ctrl.origin_id_type = ID_TYPE_UID;
 
         packet->d7anp_ctrl.origin_void = false;
         // note we set packet->origin_access_class in DLL, since we cache the active access class there already
@@ -255,6 +807,8 @@ security:
 #if defined(MODULE_D7AP_NLS_ENABLED)
 
     packet->d7anp_ctrl.nls_method = packet->d7anp_addressee->ctrl.nls_method;
+    if (packet->d7anp_ctrl.nls_method != AES_NONE && !NLS_METHOD_SUPPORTED(packet->d7anp_ctrl.nls_method))
+        return EINVAL; // not in MODULE_D7AP_NLS_METHODS
 
     if (packet->d7anp_ctrl.nls_method == AES_CTR ||
         packet->d7anp_ctrl.nls_method == AES_CCM_32 ||
@@ -265,25 +819,38 @@ security:
         if (security_state.frame_counter == (uint32_t)~0)
             return EPERM;
 
+        // the frame counter is persisted before it is used
+        if (security_state.frame_counter >= reserved_frame_counter)
+            reserve_frame_counters();
+
         packet->d7anp_security.frame_counter = security_state.frame_counter++;
         packet->d7anp_security.key_counter = security_state.key_counter;
         DPRINT("Frame counter %ld", packet->d7anp_security.frame_counter);
-
-        // Update the frame counter in the D7A file
-        fs_write_nwl_security(&security_state);
     }
 #else
     assert(packet->d7anp_ctrl.nls_method == AES_NONE); // when encryption is requested the MODULE_D7AP_NLS_ENABLED cmake option should be set
 #endif
 
     switch_state(D7ANP_STATE_TRANSMIT);
-    dll_tx_frame(packet);
+    error_t err = dll_tx_frame(packet);
+    if (err != SUCCESS)
+        switch_state(d7anp_prev_state);
+
+    return err;
+}
+
+// the time the foreground scan starts before the ETA of a background frame. Besides the wake-up, the ETA is rounded
+// up to Ti by the requester and counted by two clocks of which the drift is bound here to 122 ppm, and the time of the
+// reception is known to a tick
+static timer_tick_t get_foreground_scan_wakeup_margin(timer_tick_t eta)
+{
+    return TI_TO_TIMER_TICKS(FG_SCAN_STARTUP_TIME + 1) + (eta >> 13) + 1;
 }
 
-static void schedule_foreground_scan_after_D7AAdvP(timer_tick_t eta)
+static void schedule_foreground_scan_after_D7AAdvP(timer_tick_t start)
 {
-    DPRINT("Perform a dll foreground scan at the end of the delay period (%i ticks)", eta);
-    assert(timer_post_task_delay(&start_foreground_scan_after_D7AAdvP, eta) == SUCCESS);
+    DPRINT("Perform a dll foreground scan at the end of the delay period (@%i)", start);
+    assert(timer_post_precise_task_prio(&start_foreground_scan_after_D7AAdvP, start, MAX_PRIORITY) == SUCCESS);
 }
 
 static inline void write_be32(uint8_t *buf, uint32_t val)
@@ -349,10 +916,15 @@ uint8_t d7anp_secure_payload(packet_t *packet, uint8_t *payload, uint8_t payload
     uint8_t auth_len;
     uint8_t add[AES_BLOCK_SIZE];
     uint8_t add_len = 0;
+    const aes_ctx_t* ctx = get_key_ctx(packet);
 
+    assert(ctx != NULL);
     nls_method = packet->d7anp_ctrl.nls_method;
     auth_len = get_auth_len(nls_method);
 
+    // the upper layers keep the payload within packet_max_payload_length(), so the tag and the CRC still fit
+    assert(payload + payload_len + auth_len + 2 <= packet->hw_radio_packet.data + PACKET_MAX_SIZE);
+
     /* When unicast access, add the auxiliary authentication data composed of the destination address */
     if(auth_len && !ID_TYPE_IS_BROADCAST(packet->d7anp_addressee->ctrl.id_type))
     {
@@ -360,18 +932,25 @@ uint8_t d7anp_secure_payload(packet_t *packet, uint8_t *payload, uint8_t payload
         memcpy(add, packet->d7anp_addressee->id, add_len);
     }
 
+    // the unsupported methods were rejected by d7anp_tx_foreground_frame()
     switch (nls_method)
     {
     case AES_CTR:
+        if (!NLS_METHOD_SUPPORTED(AES_CTR))
+            break;
+
         // Build the initial counter block
         build_iv(packet, payload_len, ctr_blk);
 
         // the encrypted payload replaces the plaintext
-        AES128_CTR_encrypt(payload, payload, payload_len, ctr_blk);
+        AES128_CTR_encrypt_ctx(ctx, payload, payload, payload_len, ctr_blk);
         break;
     case AES_CBC_MAC_128:
     case AES_CBC_MAC_64:
     case AES_CBC_MAC_32:
+        if (!NLS_CBC_MAC_SUPPORTED)
+            break;
+
         /* Build the header block to prepend to the payload */
         build_header(packet, payload_len, header);
 
@@ -379,7 +958,7 @@ uint8_t d7anp_secure_payload(packet_t *packet, uint8_t *payload, uint8_t payload
         header[0] |= ( add_len > 0 );
 
         /* Compute the CBC-MAC */
-        AES128_CBC_MAC(auth, payload, payload_len, header, add, add_len, auth_len);
+        AES128_CBC_MAC_ctx(ctx, auth, payload, payload_len, header, add, add_len, auth_len);
 
         /* Insert the authentication Tag */
         memcpy(payload + payload_len, auth, auth_len);
@@ -387,6 +966,9 @@ uint8_t d7anp_secure_payload(packet_t *packet, uint8_t *payload, uint8_t payload
     case AES_CCM_128:
     case AES_CCM_64:
     case AES_CCM_32:
+        if (!NLS_CCM_SUPPORTED)
+            break;
+
         /*
          * For CCM, the same IV is used for the header block and the counter block
          * Bits 0-3 are set with the flags in AES-CCM header whereas they are set
@@ -397,8 +979,7 @@ uint8_t d7anp_secure_payload(packet_t *packet, uint8_t *payload, uint8_t payload
         /* Set Header flags */
         header[0] |= ( add_len > 0 );
 
-        // TODO check that the payload length does not exceed the maximum size
-        AES128_CCM_encrypt(payload, payload_len, header, add, add_len, ctr_blk, auth_len);
+        AES128_CCM_encrypt_ctx(ctx, payload, payload_len, header, add, add_len, ctr_blk, auth_len);
         break;
     }
 
@@ -416,6 +997,13 @@ bool d7anp_unsecure_payload(packet_t *packet, uint8_t index)
     uint8_t *tag;
     uint8_t add[AES_BLOCK_SIZE];
     uint8_t add_len = 0;
+    const aes_ctx_t* ctx = get_key_ctx(packet);
+
+    if (ctx == NULL)
+    {
+        DPRINT("Unknown key counter %d", packet->d7anp_security.key_counter);
+        return false;
+    }
 
     nls_method = packet->d7anp_ctrl.nls_method;
 
@@ -434,12 +1022,12 @@ bool d7anp_unsecure_payload(packet_t *packet, uint8_t index)
         /* For unicast access, an additional authentication data is used by CBC-MAC */
         if(packet->dll_header.control_target_id_type == ID_TYPE_UID)
         {
-            fs_read_uid(add);
+            memcpy(add, fs_get_identity()->uid, 8);
             add_len = 8;
         }
         else if(packet->dll_header.control_target_id_type == ID_TYPE_VID)
         {
-            fs_read_vid(add);
+            memcpy(add, fs_get_identity()->vid, 2);
             add_len = 2;
         }
     }
@@ -447,17 +1035,23 @@ bool d7anp_unsecure_payload(packet_t *packet, uint8_t index)
     switch (nls_method)
     {
     case AES_CTR:
+        if (!NLS_METHOD_SUPPORTED(AES_CTR))
+            return false;
+
         /* Build the initial counter block */
         build_iv(packet, payload_len, ctr_blk);
 
         // the decrypted payload replaces the encrypted data
-        AES128_CTR_encrypt(packet->hw_radio_packet.data + index,
-                           packet->hw_radio_packet.data + index,
-                           payload_len, ctr_blk);
+        AES128_CTR_encrypt_ctx(ctx, packet->hw_radio_packet.data + index,
+                               packet->hw_radio_packet.data + index,
+                               payload_len, ctr_blk);
         break;
     case AES_CBC_MAC_128:
     case AES_CBC_MAC_64:
     case AES_CBC_MAC_32:
+        if (!NLS_CBC_MAC_SUPPORTED)
+            return false;
+
         /* Build the header block to prepend to the payload */
         build_header(packet, payload_len, header);
 
@@ -465,8 +1059,8 @@ bool d7anp_unsecure_payload(packet_t *packet, uint8_t index)
         header[0] |= ( add_len > 0 );
 
         /* Compute the CBC-MAC and check the authentication Tag */
-        AES128_CBC_MAC(auth, packet->hw_radio_packet.data + index,
-                       payload_len, header, add, add_len, auth_len);
+        AES128_CBC_MAC_ctx(ctx, auth, packet->hw_radio_packet.data + index,
+                           payload_len, header, add, add_len, auth_len);
 
         if (memcmp(auth, tag, auth_len) != 0)
         {
@@ -480,18 +1074,24 @@ bool d7anp_unsecure_payload(packet_t *packet, uint8_t index)
     case AES_CCM_128:
     case AES_CCM_64:
     case AES_CCM_32:
+        if (!NLS_CCM_SUPPORTED)
+            return false;
+
         /* For CCM, the same IV is used for the header block and the counter block */
         build_iv(packet, payload_len, header);
-        memcpy(ctr_blk, header, AES_BLOCK_SIZE);
+        memcpy(nls_rx_ccm_ctr_blk, header, AES_BLOCK_SIZE);
 
         /* Set Header flags */
         header[0] |= ( add_len > 0 );
 
-        if (AES128_CCM_decrypt(packet->hw_radio_packet.data + index,
-                               payload_len, header, add, add_len, ctr_blk,
-                               tag, auth_len) != 0)
+        // the payload is decrypted and the tag checked by the job, see process_nls_rx_job()
+        if (AES128_CCM_start_ctx(&nls_rx_ccm, ctx, true, packet->hw_radio_packet.data + index,
+                                 payload_len, header, add, add_len, nls_rx_ccm_ctr_blk,
+                                 tag, auth_len) != SUCCESS)
             return false;
 
+        nls_rx_ccm_packet = packet;
+
         /* remove the authentication Tag */
         packet->hw_radio_packet.length -= auth_len;
     }
@@ -500,9 +1100,76 @@ bool d7anp_unsecure_payload(packet_t *packet, uint8_t index)
 }
 
 
+#if MODULE_D7AP_NWL_HEADER_TEMPLATE_COUNT > 0
+static header_template_t* find_header_template(const packet_t* packet)
+{
+    for (uint8_t i = 0; i < header_template_count; i++)
+    {
+        header_template_t* template = &header_templates[i];
+        if (template->ctrl.raw != packet->d7anp_ctrl.raw)
+            continue;
+
+        if (!packet->d7anp_ctrl.origin_void && template->origin_access_class != packet->origin_access_class)
+            continue;
+
+        if (packet->d7anp_ctrl.hop_enabled && (template->hop_ctrl.raw != packet->d7anp_hop.ctrl.raw
+            || memcmp(template->hop_dst_id, packet->d7anp_hop.dst_id, d7anp_addressee_id_length(packet->d7anp_hop.ctrl.dst_id_type)) != 0))
+            continue;
+
+        if (template->frame_counter_index && template->key_counter != packet->d7anp_security.key_counter)
+            continue;
+
+        return template;
+    }
+
+    return NULL;
+}
+
+static void store_header_template(const packet_t* packet, const uint8_t* header, uint8_t length, uint8_t hop_seq_index,
+                                  uint8_t frame_counter_index)
+{
+    header_template_t* template = &header_templates[header_template_next];
+    template->ctrl = packet->d7anp_ctrl;
+    template->origin_access_class = packet->origin_access_class;
+    template->hop_ctrl = packet->d7anp_hop.ctrl;
+    memcpy(template->hop_dst_id, packet->d7anp_hop.dst_id, sizeof(template->hop_dst_id));
+    template->key_counter = packet->d7anp_security.key_counter;
+    template->length = length;
+    template->hop_seq_index = hop_seq_index;
+    template->frame_counter_index = frame_counter_index;
+    memcpy(template->header, header, length);
+
+    header_template_next = (header_template_next + 1) % MODULE_D7AP_NWL_HEADER_TEMPLATE_COUNT;
+    if (header_template_count < MODULE_D7AP_NWL_HEADER_TEMPLATE_COUNT)
+        header_template_count++;
+}
+#endif
+
 uint8_t d7anp_assemble_packet_header(packet_t *packet, uint8_t *data_ptr)
 {
-    assert(!packet->d7anp_ctrl.hop_enabled); // TODO hopping not yet supported
+#if MODULE_D7AP_NWL_HEADER_TEMPLATE_COUNT > 0
+    // the NBID of the origin is not part of the template key
+    bool use_template = packet->d7anp_ctrl.origin_void || packet->d7anp_ctrl.origin_id_type != ID_TYPE_NBID;
+    header_template_t* template = use_template ? find_header_template(packet) : NULL;
+    if (template)
+    {
+        memcpy(data_ptr, template->header, template->length);
+        if (template->hop_seq_index)
+            data_ptr[template->hop_seq_index] = packet->d7anp_hop.seq;
+
+        if (template->frame_counter_index)
+            write_be32(data_ptr + template->frame_counter_index, packet->d7anp_security.frame_counter);
+
+        // the origin ID follows the control and the origin access class
+        if (!packet->d7anp_ctrl.origin_void)
+            memcpy(packet->origin_access_id, data_ptr + 2, d7anp_addressee_id_length(packet->d7anp_ctrl.origin_id_type));
+
+        return template->length;
+    }
+
+    uint8_t hop_seq_index = 0;
+    uint8_t frame_counter_index = 0;
+#endif
 
     uint8_t* d7anp_header_start = data_ptr;
     (*data_ptr) = packet->d7anp_ctrl.raw; data_ptr++;
@@ -513,13 +1180,13 @@ uint8_t d7anp_assemble_packet_header(packet_t *packet, uint8_t *data_ptr)
 
         if (packet->d7anp_ctrl.origin_id_type == ID_TYPE_UID)
         {
-            fs_read_uid(data_ptr);
+            memcpy(data_ptr, fs_get_identity()->uid, 8);
             memcpy(packet->origin_access_id, data_ptr, 8);
             data_ptr += 8;
         }
         else if (packet->d7anp_ctrl.origin_id_type == ID_TYPE_VID)
         {
-            fs_read_vid(data_ptr);
+            memcpy(data_ptr, fs_get_identity()->vid, 2);
             memcpy(packet->origin_access_id, data_ptr, 2);
             data_ptr += 2;
         }
@@ -530,7 +1197,17 @@ uint8_t d7anp_assemble_packet_header(packet_t *packet, uint8_t *data_ptr)
         }
     }
 
-    // TODO hopping ctrl
+    if (packet->d7anp_ctrl.hop_enabled)
+    {
+        (*data_ptr) = packet->d7anp_hop.ctrl.raw; data_ptr++;
+#if MODULE_D7AP_NWL_HEADER_TEMPLATE_COUNT > 0
+        hop_seq_index = data_ptr - d7anp_header_start;
+#endif
+        (*data_ptr) = packet->d7anp_hop.seq; data_ptr++;
+        uint8_t dst_id_length = d7anp_addressee_id_length(packet->d7anp_hop.ctrl.dst_id_type);
+        memcpy(data_ptr, packet->d7anp_hop.dst_id, dst_id_length);
+        data_ptr += dst_id_length;
+    }
 
     if (packet->d7anp_ctrl.nls_method == AES_CTR ||
         packet->d7anp_ctrl.nls_method == AES_CCM_32 ||
@@ -538,20 +1215,31 @@ uint8_t d7anp_assemble_packet_header(packet_t *packet, uint8_t *data_ptr)
         packet->d7anp_ctrl.nls_method == AES_CCM_128)
     {
         (*data_ptr) = packet->d7anp_security.key_counter; data_ptr++;
+#if MODULE_D7AP_NWL_HEADER_TEMPLATE_COUNT > 0
+        frame_counter_index = data_ptr - d7anp_header_start;
+#endif
         write_be32(data_ptr, packet->d7anp_security.frame_counter);
         data_ptr += sizeof(uint32_t);
     }
 
+#if MODULE_D7AP_NWL_HEADER_TEMPLATE_COUNT > 0
+    if (use_template)
+        store_header_template(packet, d7anp_header_start, data_ptr - d7anp_header_start, hop_seq_index, frame_counter_index);
+#endif
+
     return data_ptr - d7anp_header_start;
 }
 
 d7anp_trusted_node_t *get_trusted_node(uint8_t *address)
 {
     //look up the sender's address in the trusted node table
-    for(uint8_t i = 0; i < node_security_state.trusted_node_nb; i++)
+    for(uint8_t i = trusted_node_buckets[trusted_node_bucket(address)]; i != NO_TRUSTED_NODE; i = trusted_node_next[i])
     {
         if(memcmp(node_security_state.trusted_node_table[i].addr, address, 8) == 0)
+        {
+            touch_trusted_node(&node_security_state.trusted_node_table[i], false);
             return &(node_security_state.trusted_node_table[i]);
+        }
     }
 
     return NULL;
@@ -567,21 +1255,76 @@ d7anp_trusted_node_t *add_trusted_node(uint8_t *address, uint32_t frame_counter,
         node_security_state.trusted_node_nb++;
     else
     {
-        DPRINT("SSR is full !");
-        return NULL;
+        // replace the least recently used node
+        index = 0;
+        for (uint8_t i = 1; i < MODULE_D7AP_TRUSTED_NODE_TABLE_SIZE; i++)
+        {
+            if (trusted_node_last_use[i] < trusted_node_last_use[index])
+                index = i;
+        }
+
+        DPRINT("SSR is full, evict node %d", index);
+        unlink_trusted_node(index);
+        if (latest_node == &node_security_state.trusted_node_table[index])
+            latest_node = NULL;
     }
 
     node = &node_security_state.trusted_node_table[index];
     memcpy(node->addr, address, 8);
     node->frame_counter = frame_counter;
     node->key_counter = key_counter;
+    link_trusted_node(index);
 
     DPRINT("Add node <%p> total number <%d>", node, node_security_state.trusted_node_nb);
     /* Update the FS */
-    fs_add_nwl_security_state_register_entry(node, node_security_state.trusted_node_nb);
+    touch_trusted_node(node, true);
     return node;
 }
 
+static inline bool is_replay_check_enabled(packet_t* packet)
+{
+    return nls_method_has_key_counter(packet->d7anp_ctrl.nls_method) && (node_security_state.filter_mode & ENABLE_SSR_FILTER);
+}
+
+/*
+ * Replay check of a received secured frame against the security state register, which only costs a hash lookup.
+ * The trusted node of the origin is returned in node, NULL when the check does not apply or the origin is new.
+ */
+static bool check_replay(packet_t* packet, d7anp_trusted_node_t** node)
+{
+    *node = NULL;
+    if (!is_replay_check_enabled(packet))
+        return true;
+
+    /* When Origin ID is not provided, try to use the latest node */
+    if (ID_TYPE_IS_BROADCAST(packet->d7anp_ctrl.origin_id_type))
+    {
+        // frame is not accepted if the Origin ID is really unknown
+        if (!latest_node)
+             return false;
+
+        *node = latest_node;
+    }
+    else
+        *node = get_trusted_node(packet->origin_access_id);
+
+    if (*node && ((*node)->frame_counter > packet->d7anp_security.frame_counter ||
+                  (*node)->frame_counter == (uint32_t)~0))
+    {
+        DPRINT("Replay attack detected cnt %ld->%ld shift back", (*node)->frame_counter, packet->d7anp_security.frame_counter);
+        return false;
+    }
+
+    if (!*node && ID_TYPE_IS_BROADCAST(packet->dll_header.control_target_id_type) &&
+         !(node_security_state.filter_mode & ALLOW_NEW_SSR_ENTRY_IN_BCAST))
+    {
+        DPRINT("New SSR entry not authorized in broadcast");
+        return false;
+    }
+
+    return true;
+}
+
 bool d7anp_disassemble_packet_header(packet_t* packet, uint8_t *data_idx)
 {
     packet->d7anp_ctrl.raw = packet->hw_radio_packet.data[(*data_idx)]; (*data_idx)++;
@@ -602,19 +1345,48 @@ bool d7anp_disassemble_packet_header(packet_t* packet, uint8_t *data_idx)
         }
     }
 
-    // TODO hopping
+    if (packet->d7anp_ctrl.hop_enabled)
+    {
+#ifdef MODULE_D7AP_NWL_HOPPING_ENABLED
+        packet->d7anp_hop_index = *data_idx;
+        packet->d7anp_hop.ctrl.raw = packet->hw_radio_packet.data[(*data_idx)]; (*data_idx)++;
+        packet->d7anp_hop.seq = packet->hw_radio_packet.data[(*data_idx)]; (*data_idx)++;
+        uint8_t dst_id_length = d7anp_addressee_id_length(packet->d7anp_hop.ctrl.dst_id_type);
+        memcpy(packet->d7anp_hop.dst_id, packet->hw_radio_packet.data + (*data_idx), dst_id_length);
+        (*data_idx) += dst_id_length;
+#else
+        DPRINT("Hopping not enabled");
+        return false;
+#endif
+    }
+
+#ifdef MODULE_D7AP_NWL_HOPPING_ENABLED
+    if (!packet->d7anp_ctrl.hop_enabled || packet->d7anp_hop.ctrl.hop_count == 0)
+        update_neighbor(packet);
+
+    // duplicates and frames for other nodes are dropped before any NLS processing, the forwarders do not need the key
+    if (packet->d7anp_ctrl.hop_enabled && !process_received_hop(packet))
+        return false;
+#endif
 
     if (packet->d7anp_ctrl.nls_method)
     {
-        d7anp_trusted_node_t *node;
         uint8_t nls_method = packet->d7anp_ctrl.nls_method;
-        bool create_node = false;
-        bool prevent_replay_attack = false;
 
         DPRINT("Received nls method %d", nls_method);
+        if (nls_method > AES_CCM_32)
+        {
+            DPRINT("Reserved nls method");
+            return false;
+        }
 
-        if (nls_method == AES_CTR || nls_method == AES_CCM_32 ||
-            nls_method == AES_CCM_64 || nls_method == AES_CCM_128)
+        if (!NLS_METHOD_SUPPORTED(nls_method))
+        {
+            DPRINT("nls method %d not supported by this build", nls_method);
+            return false;
+        }
+
+        if (nls_method_has_key_counter(nls_method))
         {
             // extract the key counter and the frame counter
             packet->d7anp_security.key_counter = packet->hw_radio_packet.data[(*data_idx)]; (*data_idx)++;
@@ -622,66 +1394,146 @@ bool d7anp_disassemble_packet_header(packet_t* packet, uint8_t *data_idx)
             (*data_idx) += sizeof(uint32_t);
 
             DPRINT("Received key counter <%d>, frame counter <%ld>", packet->d7anp_security.key_counter, packet->d7anp_security.frame_counter);
+        }
 
-            if (node_security_state.filter_mode & ENABLE_SSR_FILTER)
-                prevent_replay_attack = true;
+        // reject what can be rejected without any AES block operation, before the frame is queued for NLS
+        if (packet->hw_radio_packet.length + 1 < *data_idx + get_auth_len(nls_method) + 2)
+        {
+            DPRINT("Secured frame too short");
+            security_counters.malformed++;
+            return false;
         }
 
-        if (prevent_replay_attack)
+        if (get_key_ctx(packet) == NULL)
         {
-            /* When Origin ID is not provided, try to use the latest node */
-            if (ID_TYPE_IS_BROADCAST(packet->d7anp_ctrl.origin_id_type))
-            {
-                // frame is not accepted if the Origin ID is really unknown
-                if (!latest_node)
-                     return false;
+            DPRINT("Unknown key counter %d", packet->d7anp_security.key_counter);
+            security_counters.unknown_key++;
+            return false;
+        }
 
-                node = latest_node;
-            }
-            else
-                node = get_trusted_node(packet->origin_access_id);
+        d7anp_trusted_node_t* node;
+        if (!check_replay(packet, &node))
+        {
+            security_counters.replayed++;
+            return false;
+        }
 
-            if (node && (node->frame_counter > packet->d7anp_security.frame_counter ||
-                         node->frame_counter == (uint32_t)~0))
-            {
-                DPRINT("Replay attack detected cnt %ld->%ld shift back", node->frame_counter, packet->d7anp_security.frame_counter);
-                return false;
-            }
+        packet->d7anp_payload_index = *data_idx;
+    }
 
-            // update the node
-            if (node)
-                node->frame_counter = packet->d7anp_security.frame_counter;
-            else
-            {
-                if (ID_TYPE_IS_BROADCAST(packet->dll_header.control_target_id_type) &&
-                     !(node_security_state.filter_mode & ALLOW_NEW_SSR_ENTRY_IN_BCAST))
-                {
-                    DPRINT("New SSR entry not authorized in broadcast");
-                    return false;
-                }
-                else
-                    create_node = true;
-            }
-        }
+    return true;
+}
 
-        if (!d7anp_unsecure_payload(packet, *data_idx))
-            return false;
+// the job of the oldest frame is due before the frame is too old to be answered, the other tasks of its priority wait
+static void post_nls_rx_job()
+{
+#if defined(FRAMEWORK_SCHEDULER_DEADLINES_ENABLED) && MODULE_D7AP_DLL_RX_MAX_AGE > 0
+    timer_tick_t received = nls_rx_jobs[nls_rx_jobs_first]->hw_radio_packet.rx_meta.timestamp;
+    sched_post_task_deadline(&process_nls_rx_job, received + TI_TO_TIMER_TICKS(MODULE_D7AP_DLL_RX_MAX_AGE));
+#else
+    sched_post_task(&process_nls_rx_job);
+#endif
+}
+
+static void complete_nls_rx_job(packet_t* packet, bool authenticated)
+{
+    // frames of the same node authenticated in the meantime may have advanced its frame counter
+    d7anp_trusted_node_t* node;
+    if (!check_replay(packet, &node))
+    {
+        DPRINT("Skipping replayed packet");
+        security_counters.replayed++;
+        packet_queue_free_packet(packet);
+        return;
+    }
 
-        if (create_node)
-             add_trusted_node(packet->origin_access_id, packet->d7anp_security.frame_counter,
-                              packet->d7anp_security.key_counter);
+    if (!authenticated)
+    {
+        DPRINT("Skipping packet failing NLS");
+        security_counters.auth_failed++;
+        packet_queue_free_packet(packet);
+        return;
     }
 
-    assert(!packet->d7anp_ctrl.hop_enabled); // TODO hopping not yet supported
+    // the frame counter of a node is only updated by authenticated frames
+    if (node)
+    {
+        node->frame_counter = packet->d7anp_security.frame_counter;
+        touch_trusted_node(node, true);
+    }
+    else if (is_replay_check_enabled(packet))
+        add_trusted_node(packet->origin_access_id, packet->d7anp_security.frame_counter,
+                         packet->d7anp_security.key_counter);
 
-    return true;
+    packet_disassemble_nwl_payload(packet, packet->d7anp_payload_index);
+}
+
+static bool nls_rx_ccm_step(void* state)
+{
+    if (AES128_CCM_step(&nls_rx_ccm, NLS_RX_CCM_BLOCKS_PER_STEP))
+        return true;
+
+    packet_t* packet = nls_rx_ccm_packet;
+    nls_rx_ccm_packet = NULL;
+    complete_nls_rx_job(packet, AES128_CCM_finish(&nls_rx_ccm) == SUCCESS);
+
+    // the frames received meanwhile waited for the job
+    if (nls_rx_jobs_count)
+        post_nls_rx_job();
+
+    return false;
+}
+
+static void process_nls_rx_job()
+{
+    // a frame being decrypted by the CCM job posts the job of the next frame once done
+    if (nls_rx_jobs_count == 0 || nls_rx_ccm_packet != NULL)
+        return;
+
+    packet_t* packet = nls_rx_jobs[nls_rx_jobs_first];
+    nls_rx_jobs_first = (nls_rx_jobs_first + 1) % MODULE_D7AP_PACKET_QUEUE_SIZE;
+    nls_rx_jobs_count--;
+
+    d7anp_trusted_node_t* node;
+    if (!check_replay(packet, &node))
+    {
+        DPRINT("Skipping replayed packet");
+        security_counters.replayed++;
+        packet_queue_free_packet(packet);
+    }
+    else if (!d7anp_unsecure_payload(packet, packet->d7anp_payload_index))
+        complete_nls_rx_job(packet, false);
+    else if (nls_rx_ccm_packet != NULL)
+    {
+        nls_rx_ccm_job = (sched_job_t){ .step = &nls_rx_ccm_step, .state = NULL };
+        // without a free deferred call the frame is decrypted at once
+        if (sched_post_job(&nls_rx_ccm_job, DEFAULT_PRIORITY) != SUCCESS)
+            while (nls_rx_ccm_step(NULL));
+
+        return;
+    }
+    else
+        complete_nls_rx_job(packet, true);
+
+    // one frame per run, so the tasks handling the next frames are not delayed by a burst of secured frames
+    if (nls_rx_jobs_count)
+        post_nls_rx_job();
+}
+
+void d7anp_unsecure_received_packet(packet_t* packet)
+{
+    assert(nls_rx_jobs_count < MODULE_D7AP_PACKET_QUEUE_SIZE);
+
+    nls_rx_jobs[(nls_rx_jobs_first + nls_rx_jobs_count) % MODULE_D7AP_PACKET_QUEUE_SIZE] = packet;
+    nls_rx_jobs_count++;
+    post_nls_rx_job();
 }
 
 void d7anp_signal_transmission_failure()
 {
     assert(d7anp_state == D7ANP_STATE_TRANSMIT);
 
-    DPRINT("CSMA-CA insertion failed");
+    log_stack_warning(LOG_STACK_NWL, "CSMA-CA insertion failed");
 
     // switch back to the previous state before the transmission
     switch_state(d7anp_prev_state);
@@ -701,8 +1553,6 @@ void d7anp_signal_packet_transmitted(packet_t* packet)
 
 void d7anp_process_received_packet(packet_t* packet)
 {
-    // TODO handle case where we are intermediate node while hopping (ie start FG scan, after auth if needed, and return)
-
     if (d7anp_state == D7ANP_STATE_FOREGROUND_SCAN)
     {
         DPRINT("Received packet while in D7ANP_STATE_FOREGROUND_SCAN");
@@ -714,17 +1564,22 @@ void d7anp_process_received_packet(packet_t* packet)
         // check if DLL was performing a background scan
         if (packet->type == BACKGROUND_ADV)
         {
-            timer_tick_t time_elapsed = timer_get_counter_value() - packet->hw_radio_packet.rx_meta.timestamp;
-            if (packet->ETA > time_elapsed + FG_SCAN_STARTUP_TIME)
+            // the ETA counts from the end of the frame, the time the DLL derived from the sync word detection. The
+            // scan is timed from it rather than from now, so the processing delay does not push it back
+            timer_tick_t start = packet->hw_radio_packet.rx_meta.timestamp + packet->ETA
+                                 - get_foreground_scan_wakeup_margin(packet->ETA);
+            if ((int32_t)(start - timer_get_counter_value()) > TI_TO_TIMER_TICKS(FG_SCAN_STARTUP_TIME))
             {
-                DPRINT("FG scan start after %d", packet->ETA - (time_elapsed + FG_SCAN_STARTUP_TIME));
-                schedule_foreground_scan_after_D7AAdvP(packet->ETA - (time_elapsed + FG_SCAN_STARTUP_TIME));
-                // meanwhile stay in idle
+                DPRINT("FG scan start after %d", start - timer_get_counter_value());
+                schedule_foreground_scan_after_D7AAdvP(start);
+                // meanwhile the radio sleeps, it keeps the settings of the channel which are not reprogrammed then
                 dll_stop_background_scan();
             }
             else
             {
-                DPRINT("No time to switch to FG scan because ETA is too short %i", packet->ETA);
+                // too short to sleep, the radio is still on
+                DPRINT("ETA too short to sleep %i, FG scan now", packet->ETA);
+                start_foreground_scan_after_D7AAdvP();
             }
 
             packet_queue_free_packet(packet);
@@ -737,6 +1592,47 @@ void d7anp_process_received_packet(packet_t* packet)
     d7atp_process_received_packet(packet);
 }
 
+uint8_t d7anp_max_header_length(uint8_t nls_method)
+{
+    // control, origin access class and the longest origin ID, followed by the security header
+    uint8_t length = 1 + 1 + ID_TYPE_UID_ID_LENGTH;
+
+    if (nls_method_has_key_counter(nls_method))
+        length += 1 + sizeof(uint32_t);
+
+#ifdef MODULE_D7AP_NWL_HOPPING_ENABLED
+    // the hopping control, the sequence number and the longest destination ID
+    length += 1 + 1 + ID_TYPE_UID_ID_LENGTH;
+#endif
+
+    return length;
+}
+
+uint8_t d7anp_get_neighbors(d7anp_neighbor_t* neighbors_out, uint8_t max_count)
+{
+#ifdef MODULE_D7AP_NWL_HOPPING_ENABLED
+    uint8_t count = neighbor_count < max_count ? neighbor_count : max_count;
+    memcpy(neighbors_out, neighbors, count * sizeof(d7anp_neighbor_t));
+    return count;
+#else
+    return 0;
+#endif
+}
+
+uint8_t d7anp_auth_length(uint8_t nls_method)
+{
+    return get_auth_len(nls_method);
+}
+
+bool d7anp_is_nls_method_supported(uint8_t nls_method)
+{
+#if defined(MODULE_D7AP_NLS_ENABLED)
+    return nls_method == AES_NONE || (nls_method <= AES_CCM_32 && NLS_METHOD_SUPPORTED(nls_method));
+#else
+    return nls_method == AES_NONE;
+#endif
+}
+
 uint8_t d7anp_addressee_id_length(id_type_t id_type)
 {
     switch(id_type)
@@ -753,3 +1649,13 @@ uint8_t d7anp_addressee_id_length(id_type_t id_type)
           assert(false);
     }
 }
+
+void d7anp_get_security_counters(d7anp_security_counters_t* counters)
+{
+    *counters = security_counters;
+}
+
+void d7anp_reset_security_counters()
+{
+    security_counters = (d7anp_security_counters_t){ 0 };
+}
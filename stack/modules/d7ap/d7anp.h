@@ -44,6 +44,11 @@ typedef enum {
 
 #define ID_TYPE_IS_BROADCAST(id_type) (id_type == ID_TYPE_NBID || id_type == ID_TYPE_NOID)
 
+/*! \brief Upper bound of the size of the D7ANP header, in any configuration (see d7anp_max_header_length()): the
+ * control, the origin access class and the longest origin ID, the security header with its key counter, and the
+ * hopping control, the sequence number and the longest destination ID */
+#define D7ANP_MAX_HEADER_SIZE (1 + 1 + ID_TYPE_UID_ID_LENGTH + 1 + sizeof(uint32_t) + 1 + 1 + ID_TYPE_UID_ID_LENGTH)
+
 #define GET_NLS_METHOD(VAL) (uint8_t)(VAL & 0x0F)
 #define SET_NLS_METHOD(VAL) (uint8_t)(VAL << 4 & 0xF0)
 
@@ -51,7 +56,7 @@ typedef enum {
 #define ALLOW_NEW_SSR_ENTRY_IN_BCAST 0x02
 
 #define FG_SCAN_TIMEOUT    200   // expressed in Ti, to be adjusted
-#define FG_SCAN_STARTUP_TIME 100 // to be adjusted per platform
+#define FG_SCAN_STARTUP_TIME 2    // expressed in Ti, waking up the MCU and the radio, to be adjusted per platform
 enum
 {
     AES_NONE = 0, /* No security */
@@ -105,6 +110,38 @@ typedef struct {
     };
 } d7anp_ctrl_t;
 
+/*! \brief The D7ANP hopping control, following the origin when hop_enabled is set in the D7ANP control
+ *
+ * The DLL target of a hopping frame is void so every node in range receives it, the destination is the D7ANP
+ * destination ID. A forwarder increments the hop count, until it reaches the hop limit. Same bit order as d7anp_ctrl_t.
+ */
+typedef struct {
+    union {
+        uint8_t raw;
+        struct {
+            id_type_t dst_id_type : 2;
+            uint8_t hop_count : 3;
+            uint8_t hop_limit : 3;
+        };
+    };
+} d7anp_hop_ctrl_t;
+
+typedef struct {
+    d7anp_hop_ctrl_t ctrl;
+    uint8_t seq; // with the origin, identifies the frame to the nodes which received one of its copies already
+    uint8_t dst_id[8];
+} d7anp_hop_t;
+
+/*! \brief A node of which frames were received directly, without hopping */
+typedef struct
+{
+    id_type_t id_type;
+    uint8_t id[8];
+    int16_t rssi;               /*!< The RSSI of the received frames, averaged */
+    uint8_t lqi;                /*!< The LQI of the last received frame */
+    timer_tick_t last_heard;    /*!< The reception timestamp of the last received frame */
+} d7anp_neighbor_t;
+
 typedef struct {
     uint8_t key_counter;
     uint32_t frame_counter;
@@ -123,14 +160,38 @@ typedef struct {
     d7anp_trusted_node_t trusted_node_table[MODULE_D7AP_TRUSTED_NODE_TABLE_SIZE];
 } d7anp_node_security_t;
 
+/*! \brief Counters of received secured frames which were rejected by the NLS */
+typedef struct
+{
+    uint32_t malformed;     /*!< Frames too short for their security header and authentication tag */
+    uint32_t unknown_key;   /*!< Frames secured with a key which is not known */
+    uint32_t replayed;      /*!< Frames of which the frame counter is older than the last one of the node */
+    uint32_t auth_failed;   /*!< Frames failing the authentication */
+} d7anp_security_counters_t;
+
 void d7anp_init();
+void d7anp_notify_nwl_security_file_changed();
+void d7anp_notify_dll_conf_file_changed();
 error_t d7anp_tx_foreground_frame(packet_t* packet, bool should_include_origin_template, uint8_t slave_listen_timeout_ct);
 uint8_t d7anp_assemble_packet_header(packet_t* packet, uint8_t* data_ptr);
 bool d7anp_disassemble_packet_header(packet_t* packet, uint8_t* packet_idx);
+
+/*! \brief Queues a received secured frame for decryption and authentication
+ *
+ * The NLS processing runs in its own task, after which the frame continues through packet_disassemble_nwl_payload(),
+ * or is freed when it fails authentication.
+ */
+void d7anp_unsecure_received_packet(packet_t* packet);
 void d7anp_signal_transmission_failure();
 void d7anp_signal_packet_transmitted(packet_t* packet);
 void d7anp_process_received_packet(packet_t* packet);
+void d7anp_get_security_counters(d7anp_security_counters_t* counters);
+void d7anp_reset_security_counters();
+uint8_t d7anp_get_neighbors(d7anp_neighbor_t* neighbors, uint8_t max_count); // returns the number of entries copied
 uint8_t d7anp_addressee_id_length(id_type_t);
+uint8_t d7anp_max_header_length(uint8_t nls_method);
+uint8_t d7anp_auth_length(uint8_t nls_method);
+bool d7anp_is_nls_method_supported(uint8_t nls_method); // the methods of MODULE_D7AP_NLS_METHODS, and AES_NONE
 void d7anp_set_foreground_scan_timeout(timer_tick_t timeout);
 void d7anp_start_foreground_scan();
 void d7anp_stop_foreground_scan(bool auto_scan);
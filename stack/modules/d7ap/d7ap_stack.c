@@ -21,6 +21,8 @@
 #include "debug.h"
 #include "framework_defs.h"
 #include "alp.h"
+#include "time_sync.h"
+#include "MODULE_D7AP_defs.h"
 
 void d7ap_stack_init(fs_init_args_t* fs_init_args, alp_init_args_t* alp_init_args, bool enable_shell, alp_cmd_handler_appl_itf_callback alp_cmd_handler_appl_itf_cb)
 {
@@ -33,8 +35,12 @@ void d7ap_stack_init(fs_init_args_t* fs_init_args, alp_init_args_t* alp_init_arg
     d7anp_init();
     packet_queue_init();
     dll_init();
+#if MODULE_D7AP_TIME_SYNC_ROLE > 0
+    time_sync_init();
+#endif
 
     alp_init(alp_init_args, enable_shell);
+    alp_cmd_handler_set_appl_itf_callback(alp_cmd_handler_appl_itf_cb);
 
     uint8_t read_firmware_version_alp_command[] = { 0x01, D7A_FILE_FIRMWARE_VERSION_FILE_ID, 0, D7A_FILE_FIRMWARE_VERSION_SIZE };
 
@@ -22,6 +22,7 @@
 #include "debug.h"
 #include "ng.h"
 #include "log.h"
+#include "trace.h"
 #include "bitmap.h"
 #include "d7asp.h"
 #include "alp.h"
@@ -33,6 +34,11 @@
 #include "hwdebug.h"
 #include "random.h"
 #include "hwwatchdog.h"
+#include "timer.h"
+#include "dll.h"
+#include "compress.h"
+#include "crc.h"
+#include "time_sync.h"
 #include "MODULE_D7AP_defs.h"
 
 #if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_SP_LOG_ENABLED)
@@ -41,15 +47,22 @@
 #define DPRINT(...)
 #endif
 
+#if MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT > 255
+    #error "MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT should not exceed 255, the transaction ID is 1 byte and 0xFF is NO_ACTIVE_REQUEST_ID"
+#endif
 
 struct d7asp_master_session {
     d7asp_master_session_config_t config;
+    uint8_t requested_access_class; /**< The access class of the config passed by the upper layer, config.addressee.access_class follows the fallback and the rate adaptation */
     // TODO uint8_t dorm_timer;
     d7asp_master_session_state_t state;
     uint8_t token;
+    timer_tick_t dormant_expiry; /**< While dormant, the time the session becomes pending even without contact by the addressee */
     uint8_t progress_bitmap[REQUESTS_BITMAP_BYTE_COUNT];
     uint8_t success_bitmap[REQUESTS_BITMAP_BYTE_COUNT];
+    uint8_t priority_bitmap[REQUESTS_BITMAP_BYTE_COUNT]; /**< The requests queued with D7ASP_PRIORITY_HIGH */
     uint8_t next_request_id;
+    uint8_t failed_request_count; /**< The number of consecutive requests which reached the retry limit */
     uint8_t request_buffer_tail_idx;
     uint8_t requests_indices[MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT]; /**< Contains for every request ID the index in command_buffer the index where the request begins */
     uint8_t requests_lengths[MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT]; /**< Contains for every request ID the index in command_buffer the length of the ALP payload in that request */
@@ -57,9 +70,53 @@ struct d7asp_master_session {
     uint8_t request_buffer[MODULE_D7AP_FIFO_COMMAND_BUFFER_SIZE];
 };
 
-static d7asp_master_session_t NGDEF(_current_master_session); // TODO we only use 1 fifo for now, should be multiple later (1 per on unique addressee and QoS combination)
+static d7asp_master_session_t NGDEF(_master_sessions)[MODULE_D7AP_FIFO_MAX_SESSIONS]; // 1 per unique addressee and QoS combination
+#define master_sessions NG(_master_sessions)
+
+static d7asp_master_session_t* NGDEF(_current_master_session); // the session owning the ongoing dialog, only 1 dialog can be active at a time
 #define current_master_session NG(_current_master_session)
 
+static bool NGDEF(_current_dialog_started);
+#define current_dialog_started NG(_current_dialog_started)
+
+// as a master: the ALP response length of the pipelined requests since the last acked request of the dialog
+static uint8_t NGDEF(_pipelined_response_length);
+#define pipelined_response_length NG(_pipelined_response_length)
+
+// as a slave: the responses to the requests which were not acked yet, sent along with the next response of the dialog
+static uint8_t NGDEF(_aggregated_response)[ALP_PAYLOAD_MAX_SIZE];
+#define aggregated_response NG(_aggregated_response)
+
+static uint8_t NGDEF(_aggregated_response_length);
+#define aggregated_response_length NG(_aggregated_response_length)
+
+static uint8_t NGDEF(_aggregated_response_dialog_id);
+#define aggregated_response_dialog_id NG(_aggregated_response_dialog_id)
+
+#if MODULE_D7AP_SESSION_DUPLICATE_CACHE_SIZE > 0
+#define DUPLICATE_CACHE_MAX_AGE (MODULE_D7AP_SESSION_DUPLICATE_CACHE_MAX_AGE * TIMER_TICKS_PER_SEC / 1000)
+
+// as a slave: a request which was executed, a retry of it is answered with the same response without executing it again
+typedef struct {
+    bool valid;
+    bool responded;             // false when the request was not acked, its response was aggregated
+    id_type_t origin_id_type;
+    uint8_t origin_id[8];
+    uint8_t dialog_id;
+    uint8_t transaction_id;
+    uint16_t request_crc;       // the retries get a new NLS frame counter, the ALP request itself is the same
+    timer_tick_t timestamp;
+    uint8_t response_length;
+    uint8_t response[MODULE_D7AP_SESSION_DUPLICATE_RESPONSE_MAX_SIZE];
+} handled_request_t;
+
+static handled_request_t NGDEF(_handled_requests)[MODULE_D7AP_SESSION_DUPLICATE_CACHE_SIZE];
+#define handled_requests NG(_handled_requests)
+
+static uint8_t NGDEF(_next_handled_request);
+#define next_handled_request NG(_next_handled_request)
+#endif
+
 static uint8_t NGDEF(_current_request_id); // TODO move ?
 #define current_request_id NG(_current_request_id)
 
@@ -69,8 +126,36 @@ static uint8_t NGDEF(_current_request_retry_count);
 static packet_t* NGDEF(_current_request_packet);
 #define current_request_packet NG(_current_request_packet)
 
-static uint8_t NGDEF(_single_request_retry_limit);
-#define single_request_retry_limit NG(_single_request_retry_limit)
+static d7asp_retry_policy_t NGDEF(_retry_policy);
+#define retry_policy NG(_retry_policy)
+
+#if MODULE_D7AP_SESSION_RATE_ADAPTATION_PEER_COUNT > 0
+#define RATE_PROMOTION_RESPONSE_COUNT 4
+
+typedef enum
+{
+    PEER_RATE_LOW = -1,     // retry_policy.fallback_access_class
+    PEER_RATE_DEFAULT = 0,  // the access class requested for the session
+    PEER_RATE_HIGH = 1      // retry_policy.high_rate_access_class
+} peer_rate_level_t;
+
+// the level of the access class of the dialogs with a unicast addressee, raised after consecutive strong responses and
+// lowered after a request needed fallback_retries retries
+typedef struct
+{
+    id_type_t peer_id_type;
+    uint8_t peer_id[8];
+    int8_t level;                   // peer_rate_level_t
+    uint8_t strong_response_count;  // consecutive responses at MODULE_D7AP_SESSION_RATE_ADAPTATION_RX_LEVEL or better
+    timer_tick_t last_used;
+} peer_rate_t;
+
+static peer_rate_t NGDEF(_peer_rates)[MODULE_D7AP_SESSION_RATE_ADAPTATION_PEER_COUNT];
+#define peer_rates NG(_peer_rates)
+
+static uint8_t NGDEF(_peer_rate_count);
+#define peer_rate_count NG(_peer_rate_count)
+#endif
 
 static packet_t* NGDEF(_current_response_packet);
 #define current_response_packet NG(_current_response_packet)
@@ -83,23 +168,56 @@ typedef enum {
     D7ASP_STATE_PENDING_MASTER
 } state_t;
 
+// the listen period announced to a slave when extending its dialog to deliver a dormant session, 13 * 4^2 = 208 Ti
+#define DIALOG_EXTENSION_LISTEN_TIMEOUT_CT ((2 << 5) | 13)
+
 static state_t NGDEF(_state);
 #define d7asp_state NG(_state)
 
 static void switch_state(state_t new_state);
+static void flush_fifos();
+static void dormant_timeout_handler();
+
+// the scheduler feeds the watchdog itself when the liveness checks are enabled, see sched_register_liveness_check()
+static inline void feed_watchdog()
+{
+#if FRAMEWORK_SCHEDULER_LIVENESS_CHECKS == 0
+    hw_watchdog_feed();
+#endif
+}
+
+// makes sure a pending session will be flushed, as soon as the current slave dialog (if any) is terminated
+static void schedule_master()
+{
+    if (d7asp_state == D7ASP_STATE_IDLE)
+    {
+        switch_state(D7ASP_STATE_PENDING_MASTER);
+        sched_post_task(&flush_fifos);
+    }
+    else if (d7asp_state == D7ASP_STATE_SLAVE)
+        switch_state(D7ASP_STATE_SLAVE_PENDING_MASTER);
+}
 
 static void mark_current_request_done()
 {
-    bitmap_set(current_master_session.progress_bitmap, current_request_id);
+    bitmap_set(current_master_session->progress_bitmap, current_request_id);
     // current_request_packet will be free-ed in the packet_queue when the transaction is completed
 }
 
+static void mark_current_request_successful()
+{
+    bitmap_set(current_master_session->success_bitmap, current_request_id);
+    current_master_session->failed_request_count = 0;
+}
+
 static void init_master_session(d7asp_master_session_t* session) {
     session->state = D7ASP_MASTER_SESSION_IDLE;
     session->token = get_rnd() % 0xFF;
     memset(session->progress_bitmap, 0x00, REQUESTS_BITMAP_BYTE_COUNT);
     memset(session->success_bitmap, 0x00, REQUESTS_BITMAP_BYTE_COUNT);
+    memset(session->priority_bitmap, 0x00, REQUESTS_BITMAP_BYTE_COUNT);
     session->next_request_id = 0;
+    session->failed_request_count = 0;
     session->request_buffer_tail_idx = 0;
     memset(session->requests_indices, 0x00, MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT);
     memset(session->requests_lengths, 0x00, MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT);
@@ -107,14 +225,254 @@ static void init_master_session(d7asp_master_session_t* session) {
     memset(session->request_buffer, 0x00, MODULE_D7AP_FIFO_COMMAND_BUFFER_SIZE);
 }
 
+static bool is_session_pending(d7asp_master_session_t* session)
+{
+    return session->state == D7ASP_MASTER_SESSION_PENDING || session->state == D7ASP_MASTER_SESSION_ACTIVE;
+}
+
+// the first request of the session which is not acked or dropped yet, other than the request in progress. The bitmaps
+// are searched a word at a time, the cost does not grow with the number of requests already handled.
+static int16_t find_pending_request(d7asp_master_session_t* session, bool high_priority_only)
+{
+    uint16_t size = session->next_request_id;
+    for(uint16_t index = 0; index * BITMAP_WORD_BITS < size; index++)
+    {
+        uint32_t pending = bitmap_word(session->progress_bitmap, false, index, size);
+        if(high_priority_only)
+            pending &= bitmap_word(session->priority_bitmap, true, index, size);
+
+        if(session == current_master_session && current_request_id / BITMAP_WORD_BITS == index)
+            pending &= ~((uint32_t) 1 << (current_request_id % BITMAP_WORD_BITS));
+
+        if(pending != 0)
+            return index * BITMAP_WORD_BITS + __builtin_ctzl(pending);
+    }
+
+    return -1;
+}
+
+// high priority requests go ahead of the other requests of the session
+static int16_t get_next_request_id(d7asp_master_session_t* session)
+{
+    int16_t id = find_pending_request(session, true);
+    if(id == -1)
+        id = find_pending_request(session, false);
+
+    return id;
+}
+
+static bool is_last_request()
+{
+    return find_pending_request(current_master_session, false) == -1;
+}
+
+static bool has_high_priority_request(d7asp_master_session_t* session)
+{
+    return is_session_pending(session) && find_pending_request(session, true) != -1;
+}
+
+// round robin over the pending sessions, starting after the current one so a slow addressee does not block the others.
+// Sessions with high priority requests go first.
+static d7asp_master_session_t* get_next_pending_session()
+{
+    uint8_t current_index = current_master_session - master_sessions;
+    d7asp_master_session_t* found = NULL;
+    for(uint8_t i = 1; i <= MODULE_D7AP_FIFO_MAX_SESSIONS; i++)
+    {
+        d7asp_master_session_t* session = &master_sessions[(current_index + i) % MODULE_D7AP_FIFO_MAX_SESSIONS];
+        if(has_high_priority_request(session))
+            return session;
+
+        if(found == NULL && is_session_pending(session))
+            found = session;
+    }
+
+    return found;
+}
+
+static void end_dialog()
+{
+    if(current_dialog_started)
+        d7atp_signal_dialog_termination();
+
+    current_dialog_started = false;
+    pipelined_response_length = 0;
+}
+
 static void flush_completed() {
     DPRINT("FIFO flush completed");
-    alp_d7asp_fifo_flush_completed(current_master_session.token, current_master_session.progress_bitmap,
-                                   current_master_session.success_bitmap, REQUESTS_BITMAP_BYTE_COUNT);
-    init_master_session(&current_master_session);
-    current_master_session.state = D7ASP_MASTER_SESSION_IDLE;
+    alp_d7asp_fifo_flush_completed(current_master_session->token, current_master_session->progress_bitmap,
+                                   current_master_session->success_bitmap, REQUESTS_BITMAP_BYTE_COUNT);
+    init_master_session(current_master_session);
+    current_master_session->state = D7ASP_MASTER_SESSION_IDLE;
     d7atp_signal_dialog_termination();
-    switch_state(D7ASP_STATE_IDLE);
+    current_dialog_started = false;
+    pipelined_response_length = 0;
+
+    d7asp_master_session_t* next_session = get_next_pending_session();
+    if(next_session == NULL)
+    {
+        switch_state(D7ASP_STATE_IDLE);
+        return;
+    }
+
+    DPRINT("Continue flushing session %d", next_session->token);
+    current_master_session = next_session;
+    current_request_id = NO_ACTIVE_REQUEST_ID;
+    sched_post_task(&flush_fifos);
+}
+
+/*
+ * The listen period Tl of the slave after its response to the current request, in CT. It covers the response period
+ * and the retries of the current request (in case the response got lost), followed by the transmission of the next
+ * request of the FIFO.
+ */
+static uint8_t calculate_listen_timeout()
+{
+    d7anp_addressee_t* addressee = &current_master_session->config.addressee;
+    dae_access_profile_t access_profile;
+    fs_read_access_class(addressee->access_specifier, &access_profile);
+
+    uint8_t overhead = packet_max_frame_overhead(addressee);
+    uint8_t next_request_id = get_next_request_id(current_master_session);
+    timer_tick_t tc = d7atp_calculate_response_period(addressee, &access_profile,
+                                                      current_master_session->response_lengths[current_request_id]);
+    uint16_t tx_duration_current = dll_calculate_tx_duration(access_profile.channel_header.ch_class, access_profile.channel_header.ch_coding,
+                                                             current_master_session->requests_lengths[current_request_id] + overhead);
+    uint16_t tx_duration_next = dll_calculate_tx_duration(access_profile.channel_header.ch_class, access_profile.channel_header.ch_coding,
+                                                          current_master_session->requests_lengths[next_request_id] + overhead);
+    uint8_t retries_left = retry_policy.retry_limit - current_request_retry_count;
+
+    timer_tick_t tl = tc + retries_left * (tx_duration_current + tc) + tx_duration_next + t_g;
+    uint32_t tl_ti = TIMER_TICKS_TO_TI(tl);
+    if (tl_ti > UINT16_MAX)
+        tl_ti = UINT16_MAX;
+
+    DPRINT("Tl <%i (ticks)> for %i retries left", tl, retries_left);
+    return compress_data(tl_ti, true);
+}
+
+#if MODULE_D7AP_SESSION_RATE_ADAPTATION_PEER_COUNT > 0
+static peer_rate_t* get_peer_rate(const d7anp_addressee_t* addressee, bool add)
+{
+    if (ID_TYPE_IS_BROADCAST(addressee->ctrl.id_type))
+        return NULL;
+
+    uint8_t id_length = d7anp_addressee_id_length(addressee->ctrl.id_type);
+    peer_rate_t* peer = NULL;
+    for(uint8_t i = 0; i < peer_rate_count; i++)
+    {
+        if (peer_rates[i].peer_id_type == addressee->ctrl.id_type && memcmp(peer_rates[i].peer_id, addressee->id, id_length) == 0)
+        {
+            peer = &peer_rates[i];
+            break;
+        }
+    }
+
+    if (peer == NULL)
+    {
+        if (!add)
+            return NULL;
+
+        // a full table replaces the peer used least recently
+        if (peer_rate_count < MODULE_D7AP_SESSION_RATE_ADAPTATION_PEER_COUNT)
+            peer = &peer_rates[peer_rate_count++];
+        else
+        {
+            peer = &peer_rates[0];
+            for(uint8_t i = 1; i < peer_rate_count; i++)
+            {
+                if ((int32_t)(peer_rates[i].last_used - peer->last_used) < 0)
+                    peer = &peer_rates[i];
+            }
+        }
+
+        peer->peer_id_type = addressee->ctrl.id_type;
+        memset(peer->peer_id, 0, sizeof(peer->peer_id));
+        memcpy(peer->peer_id, addressee->id, id_length);
+        peer->level = PEER_RATE_DEFAULT;
+        peer->strong_response_count = 0;
+    }
+
+    peer->last_used = timer_get_counter_value();
+    return peer;
+}
+
+static uint8_t get_rate_access_class(d7asp_master_session_t* session, int8_t level)
+{
+    if (level == PEER_RATE_HIGH && retry_policy.high_rate_access_class != D7ASP_NO_FALLBACK_ACCESS_CLASS)
+        return retry_policy.high_rate_access_class;
+
+    if (level == PEER_RATE_LOW && retry_policy.fallback_access_class != D7ASP_NO_FALLBACK_ACCESS_CLASS)
+        return retry_policy.fallback_access_class;
+
+    return session->requested_access_class;
+}
+
+// a new dialog with the addressee starts on the access class its link allows
+static void adapt_access_class(d7asp_master_session_t* session)
+{
+    peer_rate_t* peer = get_peer_rate(&session->config.addressee, false);
+    if (peer == NULL)
+        return;
+
+    session->config.addressee.access_class = get_rate_access_class(session, peer->level);
+    DPRINT("Dialog on access class 0x%02x for rate level %i", session->config.addressee.access_class, peer->level);
+}
+
+static void update_peer_rate(d7asp_master_session_t* session, uint8_t rx_level)
+{
+    peer_rate_t* peer = get_peer_rate(&session->config.addressee, true);
+    if (peer == NULL)
+        return;
+
+    if (rx_level > MODULE_D7AP_SESSION_RATE_ADAPTATION_RX_LEVEL)
+    {
+        peer->strong_response_count = 0;
+        return;
+    }
+
+    if (peer->level == PEER_RATE_HIGH
+        || (peer->level == PEER_RATE_DEFAULT && retry_policy.high_rate_access_class == D7ASP_NO_FALLBACK_ACCESS_CLASS)
+        || ++peer->strong_response_count < RATE_PROMOTION_RESPONSE_COUNT)
+        return;
+
+    // the next dialogs use the faster access class, the current one keeps its channels
+    peer->level++;
+    peer->strong_response_count = 0;
+    DPRINT("Peer promoted to rate level %i", peer->level);
+}
+#endif
+
+// the access class on which the session continues after fallback_retries retries of a request
+static uint8_t get_fallback_access_class(d7asp_master_session_t* session)
+{
+#if MODULE_D7AP_SESSION_RATE_ADAPTATION_PEER_COUNT > 0
+    peer_rate_t* peer = get_peer_rate(&session->config.addressee, true);
+    if (peer != NULL)
+    {
+        // a dialog on the hi-rate access class falls back to the requested one first
+        if (peer->level == PEER_RATE_HIGH
+            || (peer->level == PEER_RATE_DEFAULT && retry_policy.fallback_access_class != D7ASP_NO_FALLBACK_ACCESS_CLASS))
+            peer->level--;
+
+        peer->strong_response_count = 0;
+        return get_rate_access_class(session, peer->level);
+    }
+#endif
+
+    return retry_policy.fallback_access_class;
+}
+
+// the requests pipelined before the acked request are successful when the responder recorded them
+static void process_ack_record(d7atp_ack_template_t* ack_template)
+{
+    for (uint8_t id = ack_template->ack_transaction_id_start;
+         id <= ack_template->ack_transaction_id_stop && id < current_master_session->next_request_id; id++)
+    {
+        if (bitmap_get(ack_template->ack_bitmap, id - ack_template->ack_transaction_id_start))
+            bitmap_set(current_master_session->success_bitmap, id);
+    }
 }
 
 static void flush_fifos()
@@ -131,13 +489,33 @@ static void flush_fifos()
         switch_state(D7ASP_STATE_MASTER);
 
     DPRINT("Flushing FIFOs");
-    hw_watchdog_feed(); // TODO do here?
+    feed_watchdog();
 
     if (current_request_id == NO_ACTIVE_REQUEST_ID)
     {
+        // the dialog is interleaved with the dialogs of the other pending sessions, one request at a time.
+        // A session selected before its dialog is started (for instance a woken dormant session) goes first.
+        d7asp_master_session_t* next_session = get_next_pending_session();
+        if (!current_dialog_started && is_session_pending(current_master_session)
+            && (next_session == NULL || has_high_priority_request(current_master_session) || !has_high_priority_request(next_session)))
+            next_session = current_master_session;
+
+        assert(next_session != NULL);
+        if (next_session != current_master_session)
+        {
+            DPRINT("Switching to session %d", next_session->token);
+            end_dialog();
+            if (current_master_session->state == D7ASP_MASTER_SESSION_ACTIVE)
+                current_master_session->state = D7ASP_MASTER_SESSION_PENDING;
+
+            current_master_session = next_session;
+        }
+
+        current_master_session->state = D7ASP_MASTER_SESSION_ACTIVE;
+
         // find first request which is not acked or dropped
-        int8_t found_next_req_index = bitmap_search(current_master_session.progress_bitmap, false, MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT);
-        if (found_next_req_index == -1 || found_next_req_index == current_master_session.next_request_id)
+        int16_t found_next_req_index = get_next_request_id(current_master_session);
+        if (found_next_req_index == -1)
         {
             // we handled all requests ...
             flush_completed();
@@ -147,44 +525,110 @@ static void flush_fifos()
         current_request_id = found_next_req_index;
         current_request_retry_count = 0;
 
-        current_request_packet = packet_queue_alloc_packet();
+        current_request_packet = packet_queue_alloc_packet(PACKET_MAX_SIZE);
+        assert(current_request_packet != NULL);
         packet_queue_mark_processing(current_request_packet);
-        current_request_packet->d7anp_addressee = &(current_master_session.config.addressee); // TODO explicitly pass addressee down the stack layers?
+        current_request_packet->d7anp_addressee = &(current_master_session->config.addressee); // TODO explicitly pass addressee down the stack layers?
 
-        memcpy(current_request_packet->payload, current_master_session.request_buffer + current_master_session.requests_indices[current_request_id], current_master_session.requests_lengths[current_request_id]);
-        current_request_packet->payload_length = current_master_session.requests_lengths[current_request_id];
+        current_request_packet->payload_length = current_master_session->requests_lengths[current_request_id];
 
-        if (current_request_id == 0)
+        if (!current_dialog_started)
+        {
             current_request_packet->type = INITIAL_REQUEST;
+#if MODULE_D7AP_SESSION_RATE_ADAPTATION_PEER_COUNT > 0
+            adapt_access_class(current_master_session);
+#endif
+        }
         else
             current_request_packet->type =  SUBSEQUENT_REQUEST;
-
-        // TODO calculate Tl
-        // Tl should correspond to the maximum time needed to send the remaining requests in the FIFO including the RETRY parameter
     }
     else
     {
         // retrying request ...
         DPRINT("Current request retry count: %i", current_request_retry_count);
-        if (current_request_retry_count == single_request_retry_limit)
+        if (current_request_retry_count >= retry_policy.retry_limit)
         {
             // mark request as failed and pop
             mark_current_request_done();
-            DPRINT("Request reached single request retry limit (%i), skipping request", single_request_retry_limit);
+            DPRINT("Request reached single request retry limit (%i), skipping request", retry_policy.retry_limit);
             packet_queue_free_packet(current_request_packet);
             current_request_id = NO_ACTIVE_REQUEST_ID;
+
+            current_master_session->failed_request_count++;
+            if (retry_policy.abort_failed_requests
+                && current_master_session->failed_request_count >= retry_policy.abort_failed_requests
+                && !ID_TYPE_IS_BROADCAST(current_master_session->config.addressee.ctrl.id_type))
+            {
+                // the link to the addressee is down, the remaining requests fail as well
+                log_stack_warning(LOG_STACK_SESSION, "%i consecutive requests failed, aborting session", current_master_session->failed_request_count);
+                for (uint8_t id = 0; id < current_master_session->next_request_id; id++)
+                    bitmap_set(current_master_session->progress_bitmap, id);
+            }
+
             sched_post_task(&flush_fifos); // continue flushing until all request handled ...
             return;
         }
 
         packet_queue_mark_processing(current_request_packet);
         current_request_packet->type = RETRY_REQUEST;
+
+        uint8_t fallback_access_class = D7ASP_NO_FALLBACK_ACCESS_CLASS;
+        if (current_request_retry_count == retry_policy.fallback_retries)
+            fallback_access_class = get_fallback_access_class(current_master_session);
+
+        if (fallback_access_class != D7ASP_NO_FALLBACK_ACCESS_CLASS
+            && current_master_session->config.addressee.access_class != fallback_access_class)
+        {
+            // continue the session on the fallback access class (and its channels) in a new dialog, so the response
+            // period is calculated for the new channel class as well
+            DPRINT("Switching session to fallback access class 0x%02x", fallback_access_class);
+            end_dialog();
+            current_master_session->config.addressee.access_class = fallback_access_class;
+            current_request_packet->type = INITIAL_REQUEST;
+        }
         // TODO stop on error
     }
 
-    uint8_t listen_timeout = 0; // TODO calculate timeout (and update during transaction lifetime) (based on Tc, channel, cs, payload size, # msgs, # retries)
-    ret = d7atp_send_request(current_master_session.token, current_request_id, (current_request_id == current_master_session.next_request_id - 1),
-                       current_request_packet, &current_master_session.config.qos, listen_timeout, current_master_session.response_lengths[current_request_id]);
+    // the request is copied from the FIFO into the frame only once it is assembled. Point back to the FIFO for
+    // retries as well, since the previous attempt might have left the payload encrypted in the frame
+    current_request_packet->payload = current_master_session->request_buffer + current_master_session->requests_indices[current_request_id];
+
+    current_dialog_started = true;
+    // the dialog ends after the last request, or when it will be interleaved with another session after this request.
+    // There is no need for the slave to listen afterwards.
+    bool is_dialog_end = is_last_request() || get_next_pending_session() != current_master_session;
+    uint8_t listen_timeout = 0;
+    if (!is_dialog_end)
+        listen_timeout = calculate_listen_timeout();
+
+    // in ack on error mode, the requests are pipelined until the last transaction of the dialog. The slave aggregates
+    // the responses to the pipelined requests in the response to the acked request, which has to fit a single frame.
+    uint8_t expected_response_length = current_master_session->response_lengths[current_request_id];
+    bool is_last_transaction = is_dialog_end;
+    if (current_master_session->config.qos.qos_resp_mode == SESSION_RESP_MODE_ON_ERR)
+    {
+        if (!is_dialog_end)
+        {
+            uint16_t aggregated_length = pipelined_response_length + expected_response_length
+                + current_master_session->response_lengths[get_next_request_id(current_master_session)];
+            if (aggregated_length > d7asp_get_max_request_length(current_master_session))
+                is_last_transaction = true;
+        }
+
+        if (current_request_packet->type != RETRY_REQUEST)
+        {
+            if (is_last_transaction)
+            {
+                expected_response_length += pipelined_response_length;
+                pipelined_response_length = 0;
+            }
+            else
+                pipelined_response_length += expected_response_length;
+        }
+    }
+
+    ret = d7atp_send_request(current_master_session->token, current_request_id, is_last_transaction,
+                       current_request_packet, &current_master_session->config.qos, listen_timeout, expected_response_length);
     if (ret == EPERM)
     {
         // this is probably because no further encryption is possible (frame counter reaches the maximum value)
@@ -196,6 +640,8 @@ static void flush_fifos()
 // TODO document state diagram
 static void switch_state(state_t new_state)
 {
+    trace_record(LOG_STACK_SESSION, TRACE_EVENT_STATE, current_master_session ? current_master_session->token : 0,
+                 current_request_id, d7asp_state, new_state);
     switch(new_state)
     {
         case D7ASP_STATE_MASTER:
@@ -257,47 +703,261 @@ static void switch_state(state_t new_state)
     }
 }
 
+SCHED_REGISTER_TASK(flush_fifos);
+SCHED_REGISTER_TASK(dormant_timeout_handler);
+
 void d7asp_init()
 {
     d7asp_state = D7ASP_STATE_IDLE;
     current_request_id = NO_ACTIVE_REQUEST_ID;
 
-    current_master_session.state = D7ASP_MASTER_SESSION_IDLE;
+    for(uint8_t i = 0; i < MODULE_D7AP_FIFO_MAX_SESSIONS; i++)
+        master_sessions[i].state = D7ASP_MASTER_SESSION_IDLE;
+
+    current_master_session = &master_sessions[0];
+    current_dialog_started = false;
+    pipelined_response_length = 0;
+    aggregated_response_length = 0;
+    aggregated_response_dialog_id = 0;
+
+#if MODULE_D7AP_SESSION_DUPLICATE_CACHE_SIZE > 0
+    memset(handled_requests, 0, sizeof(handled_requests));
+    next_handled_request = 0;
+#endif
+
+#if MODULE_D7AP_SESSION_RATE_ADAPTATION_PEER_COUNT > 0
+    peer_rate_count = 0;
+#endif
+
+    retry_policy = (d7asp_retry_policy_t){
+        .retry_limit = 3, // TODO read from SEL config file
+        .cca_failure_backoff = 16,
+        .no_ack_backoff = 0,
+        .max_backoff_exponent = 4,
+        .fallback_access_class = D7ASP_NO_FALLBACK_ACCESS_CLASS,
+        .fallback_retries = 2,
+        .high_rate_access_class = D7ASP_NO_FALLBACK_ACCESS_CLASS,
+        .abort_failed_requests = 3
+    };
+
+}
 
-    sched_register_task(&flush_fifos);
+static bool is_session_config_equal(d7asp_master_session_t* session, d7asp_master_session_config_t* config)
+{
+    return session->config.qos.raw == config->qos.raw
+        && session->config.addressee.ctrl.raw == config->addressee.ctrl.raw
+        && session->requested_access_class == config->addressee.access_class
+        && memcmp(session->config.addressee.id, config->addressee.id, d7anp_addressee_id_length(config->addressee.ctrl.id_type)) == 0;
+}
+
+static bool is_token_in_use(uint8_t token)
+{
+    for(uint8_t i = 0; i < MODULE_D7AP_FIFO_MAX_SESSIONS; i++)
+    {
+        if(master_sessions[i].state != D7ASP_MASTER_SESSION_IDLE && master_sessions[i].token == token)
+            return true;
+    }
+
+    return false;
+}
+
+static void schedule_dormant_timeout()
+{
+    timer_tick_t now = timer_get_counter_value();
+    d7asp_master_session_t* first = NULL;
+    for(uint8_t i = 0; i < MODULE_D7AP_FIFO_MAX_SESSIONS; i++)
+    {
+        if(master_sessions[i].state == D7ASP_MASTER_SESSION_DORMANT
+           && (first == NULL || (int32_t)(master_sessions[i].dormant_expiry - first->dormant_expiry) < 0))
+            first = &master_sessions[i];
+    }
+
+    if(first == NULL)
+    {
+        timer_cancel_task(&dormant_timeout_handler);
+        return;
+    }
+
+    timer_tick_t delay = (int32_t)(first->dormant_expiry - now) > 0 ? first->dormant_expiry - now : 0;
+    timer_post_task_delay(&dormant_timeout_handler, delay);
+}
+
+static void dormant_timeout_handler()
+{
+    timer_tick_t now = timer_get_counter_value();
+    bool expired = false;
+    for(uint8_t i = 0; i < MODULE_D7AP_FIFO_MAX_SESSIONS; i++)
+    {
+        if(master_sessions[i].state == D7ASP_MASTER_SESSION_DORMANT && (int32_t)(master_sessions[i].dormant_expiry - now) <= 0)
+        {
+            DPRINT("Dormant session %d expired", master_sessions[i].token);
+            master_sessions[i].state = D7ASP_MASTER_SESSION_PENDING;
+            expired = true;
+        }
+    }
+
+    if(expired)
+        schedule_master();
+
+    schedule_dormant_timeout();
+}
+
+// a dormant session for the origin of a received request is delivered in the same dialog, by extending it
+static bool wake_dormant_session(packet_t* packet)
+{
+    if(packet->d7anp_ctrl.origin_void || ID_TYPE_IS_BROADCAST(packet->d7anp_ctrl.origin_id_type))
+        return false;
+
+    for(uint8_t i = 0; i < MODULE_D7AP_FIFO_MAX_SESSIONS; i++)
+    {
+        d7asp_master_session_t* session = &master_sessions[i];
+        if(session->state == D7ASP_MASTER_SESSION_DORMANT
+           && session->config.addressee.ctrl.id_type == packet->d7anp_ctrl.origin_id_type
+           && memcmp(session->config.addressee.id, packet->origin_access_id, d7anp_addressee_id_length(packet->d7anp_ctrl.origin_id_type)) == 0)
+        {
+            DPRINT("Addressee of dormant session %d contacted us", session->token);
+            session->state = D7ASP_MASTER_SESSION_PENDING;
+            current_master_session = session; // flush it first, while the slave is still listening
+            schedule_dormant_timeout();
+            return true;
+        }
+    }
+
+    return false;
 }
 
 d7asp_master_session_t* d7asp_master_session_create(d7asp_master_session_config_t* d7asp_master_session_config) {
-    // TODO for now we assume only one concurrent session, in the future we should dynamically allocate (or return from pool) a session
+    d7asp_master_session_t* session = NULL;
 
-    if (current_master_session.state != D7ASP_MASTER_SESSION_IDLE)
-        return &current_master_session;
+    // requests for the same addressee and QoS are appended to the same FIFO
+    for(uint8_t i = 0; i < MODULE_D7AP_FIFO_MAX_SESSIONS; i++)
+    {
+        if(master_sessions[i].state != D7ASP_MASTER_SESSION_IDLE
+           && is_session_config_equal(&master_sessions[i], d7asp_master_session_config))
+            return &master_sessions[i];
+
+        if(session == NULL && master_sessions[i].state == D7ASP_MASTER_SESSION_IDLE && &master_sessions[i] != current_master_session)
+            session = &master_sessions[i];
+    }
+
+    // the current session is only reused last, it might still be referenced by the ongoing dialog
+    if(session == NULL && current_master_session->state == D7ASP_MASTER_SESSION_IDLE)
+        session = current_master_session;
+
+    assert(session != NULL); // TODO let the upper layer wait until a session is available
 
-    init_master_session(&current_master_session);
+    init_master_session(session);
+    while(is_token_in_use(session->token))
+        session->token = get_rnd() % 0xFF;
 
-    DPRINT("Create master session %d", current_master_session.token);
+    DPRINT("Create master session %d", session->token);
 
-    current_master_session.config.qos = d7asp_master_session_config->qos;
-    current_master_session.config.dormant_timeout = d7asp_master_session_config->dormant_timeout;
-    current_master_session.config.addressee.ctrl = d7asp_master_session_config->addressee.ctrl;
-    current_master_session.config.addressee.access_class = d7asp_master_session_config->addressee.access_class;
-    memcpy(current_master_session.config.addressee.id, d7asp_master_session_config->addressee.id, sizeof(current_master_session.config.addressee.id));
+    session->config.qos = d7asp_master_session_config->qos;
+    session->config.dormant_timeout = d7asp_master_session_config->dormant_timeout;
+    session->config.addressee.ctrl = d7asp_master_session_config->addressee.ctrl;
+    session->config.addressee.access_class = d7asp_master_session_config->addressee.access_class;
+    session->requested_access_class = d7asp_master_session_config->addressee.access_class;
+    memcpy(session->config.addressee.id, d7asp_master_session_config->addressee.id, sizeof(session->config.addressee.id));
 
-    return &current_master_session;
+    return session;
+}
+
+void d7asp_set_retry_policy(const d7asp_retry_policy_t* policy)
+{
+    retry_policy = *policy;
+}
+
+uint8_t d7asp_get_max_request_length(d7asp_master_session_t* session)
+{
+    return packet_max_payload_length(&session->config.addressee);
+}
+
+uint8_t d7asp_get_queue_capacity(d7asp_master_session_t* session, uint8_t request_length)
+{
+    // every request takes one byte more in the command buffer, see d7asp_queue_alp_actions()
+    uint8_t count = 0;
+    uint16_t tail_idx = session->request_buffer_tail_idx;
+    while(session->next_request_id + count < MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT
+          && tail_idx + request_length < MODULE_D7AP_FIFO_COMMAND_BUFFER_SIZE)
+    {
+        tail_idx += request_length + 1;
+        count++;
+    }
+
+    return count;
 }
 
 // TODO we assume a fifo contains only ALP commands, but according to spec this can be any kind of "Request"
 // we will see later what this means. For instance how to add a request which starts D7AAdvP etc
-d7asp_queue_result_t d7asp_queue_alp_actions(d7asp_master_session_t* session, uint8_t* alp_payload_buffer, uint8_t alp_payload_length, uint8_t expected_alp_response_length)
+// every attempt of the request and the back-off before its retries, the CSMA-CA channel access is not included
+static timer_tick_t get_request_worst_case_duration(d7asp_master_session_t* session, uint8_t request_id)
+{
+    d7anp_addressee_t* addressee = &session->config.addressee;
+    dae_access_profile_t access_profile;
+    fs_read_access_class(addressee->access_specifier, &access_profile);
+
+    timer_tick_t attempt = dll_calculate_tx_duration(access_profile.channel_header.ch_class, access_profile.channel_header.ch_coding,
+                                                     session->requests_lengths[request_id] + packet_max_frame_overhead(addressee));
+    if (session->config.qos.qos_resp_mode != SESSION_RESP_MODE_NO && session->config.qos.qos_resp_mode != SESSION_RESP_MODE_NO_RPT)
+        attempt += d7atp_calculate_response_period(addressee, &access_profile, session->response_lengths[request_id]);
+
+    timer_tick_t duration = (retry_policy.retry_limit + 1) * attempt;
+    uint16_t backoff = retry_policy.cca_failure_backoff > retry_policy.no_ack_backoff ? retry_policy.cca_failure_backoff : retry_policy.no_ack_backoff;
+    for (uint8_t retry = 0; retry < retry_policy.retry_limit; retry++)
+        duration += TI_TO_TIMER_TICKS((uint32_t)backoff << (retry < retry_policy.max_backoff_exponent ? retry : retry_policy.max_backoff_exponent));
+
+    return duration;
+}
+
+// the request in progress, the requests which may be sent before the request and the request itself
+static timer_tick_t get_worst_case_latency(d7asp_master_session_t* session, uint8_t request_id)
+{
+    bool high_priority = bitmap_get(session->priority_bitmap, request_id);
+    timer_tick_t latency = 0;
+
+    if (session->state == D7ASP_MASTER_SESSION_DORMANT)
+    {
+        timer_tick_t now = timer_get_counter_value();
+        if ((int32_t)(session->dormant_expiry - now) > 0)
+            latency += session->dormant_expiry - now;
+    }
+
+    // a dialog is only preempted between transactions
+    if (d7asp_state == D7ASP_STATE_MASTER && current_request_id != NO_ACTIVE_REQUEST_ID)
+        latency += get_request_worst_case_duration(current_master_session, current_request_id);
+
+    for (uint8_t i = 0; i < MODULE_D7AP_FIFO_MAX_SESSIONS; i++)
+    {
+        d7asp_master_session_t* s = &master_sessions[i];
+        if (s != session && !is_session_pending(s))
+            continue;
+
+        for (uint8_t id = 0; id < s->next_request_id; id++)
+        {
+            if (bitmap_get(s->progress_bitmap, id) || (s == current_master_session && id == current_request_id))
+                continue;
+
+            if (high_priority && !bitmap_get(s->priority_bitmap, id))
+                continue;
+
+            latency += get_request_worst_case_duration(s, id);
+        }
+    }
+
+    return latency;
+}
+
+d7asp_queue_result_t d7asp_queue_alp_actions(d7asp_master_session_t* session, uint8_t* alp_payload_buffer, uint8_t alp_payload_length,
+                                             uint8_t expected_alp_response_length, d7asp_request_priority_t priority)
 {
     DPRINT("Queuing ALP actions");
     // TODO can be called in all session states?
-    assert(session == &current_master_session); // TODO tmp
+    assert(session >= master_sessions && session < master_sessions + MODULE_D7AP_FIFO_MAX_SESSIONS);
     assert(session->request_buffer_tail_idx + alp_payload_length < MODULE_D7AP_FIFO_COMMAND_BUFFER_SIZE);
     assert(session->next_request_id < MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT); // TODO do not assert but let upper layer handle this
+    assert(alp_payload_length <= d7asp_get_max_request_length(session)); // the upper layer splits the actions over requests
     assert(!(expected_alp_response_length > 0 &&
              (session->config.qos.qos_resp_mode == SESSION_RESP_MODE_NO || session->config.qos.qos_resp_mode == SESSION_RESP_MODE_NO_RPT))); // TODO return error
-    single_request_retry_limit = 3; // TODO read from SEL config file
 
     // add request to buffer
     // TODO request can contain 1 or more ALP commands, find a way to group commands in requests instead of dumping all requests in one buffer
@@ -309,28 +969,145 @@ d7asp_queue_result_t d7asp_queue_alp_actions(d7asp_master_session_t* session, ui
     session->request_buffer_tail_idx += alp_payload_length + 1;
     session->next_request_id++;
 
-    // TODO for master only set to pending when asked by upper layer (ie new function call)
-    if (d7asp_state == D7ASP_STATE_IDLE)
+    if (priority == D7ASP_PRIORITY_HIGH)
+        bitmap_set(session->priority_bitmap, request_id);
+
+    if (session->state == D7ASP_MASTER_SESSION_IDLE && session->config.dormant_timeout)
     {
-        switch_state(D7ASP_STATE_PENDING_MASTER);
-        sched_post_task(&flush_fifos);
+        // keep the requests until the addressee contacts us, or the dormant timeout expires
+        DPRINT("Session %d is dormant", session->token);
+        session->state = D7ASP_MASTER_SESSION_DORMANT;
+        session->dormant_expiry = timer_get_counter_value() + CT_DECOMPRESS_TO_TICKS(session->config.dormant_timeout);
+        schedule_dormant_timeout();
+    }
+    else if (session->state != D7ASP_MASTER_SESSION_DORMANT)
+    {
+        // TODO for master only set to pending when asked by upper layer (ie new function call)
+        if (d7asp_state == D7ASP_STATE_IDLE)
+            current_master_session = session;
+
+        schedule_master();
+
+        // when in master state the session is picked up by the round robin in flush_fifos()
+        if (session->state == D7ASP_MASTER_SESSION_IDLE)
+            session->state = D7ASP_MASTER_SESSION_PENDING;
+    }
+
+    return (d7asp_queue_result_t){
+        .fifo_token = session->token,
+        .request_id = request_id,
+        .worst_case_latency = get_worst_case_latency(session, request_id)
+    };
+}
+
+// the ALP response is built in place of the received payload: it has to fit in the frame buffer from there on, and in the
+// payload of the response frame to the addressee
+static uint8_t get_response_max_length(packet_t* packet)
+{
+    uint8_t frame_space = PACKET_MAX_SIZE - (packet->payload - packet->hw_radio_packet.data);
+    uint8_t max_payload_length = packet_max_payload_length(packet->d7anp_addressee);
+    return frame_space < max_payload_length ? frame_space : max_payload_length;
+}
+
+// the response to a request which is not acked is kept, to be sent along with the response to the next acked request
+static void aggregate_response(packet_t* packet)
+{
+    if (packet->d7atp_dialog_id != aggregated_response_dialog_id)
+    {
+        aggregated_response_length = 0;
+        aggregated_response_dialog_id = packet->d7atp_dialog_id;
+    }
+
+    if (packet->payload_length == 0)
+        return;
+
+    if (aggregated_response_length + packet->payload_length > packet_max_payload_length(packet->d7anp_addressee))
+    {
+        log_stack_warning(LOG_STACK_SESSION, "Response of %i bytes does not fit the aggregated response, dropped", packet->payload_length);
+        return;
+    }
+
+    memcpy(aggregated_response + aggregated_response_length, packet->payload, packet->payload_length);
+    aggregated_response_length += packet->payload_length;
+}
+
+#if MODULE_D7AP_SESSION_DUPLICATE_CACHE_SIZE > 0
+static bool is_handled_request(handled_request_t* entry, packet_t* packet, uint16_t request_crc)
+{
+    // the frames without origin ID are only accepted within the dialog, which is identified by the dialog ID
+    return entry->valid
+        && entry->dialog_id == packet->d7atp_dialog_id
+        && entry->transaction_id == packet->d7atp_transaction_id
+        && entry->request_crc == request_crc
+        && entry->origin_id_type == packet->d7anp_addressee->ctrl.id_type
+        && memcmp(entry->origin_id, packet->d7anp_addressee->id, d7anp_addressee_id_length(entry->origin_id_type)) == 0
+        && timer_get_counter_value() - entry->timestamp <= DUPLICATE_CACHE_MAX_AGE;
+}
+
+static handled_request_t* find_handled_request(packet_t* packet, uint16_t request_crc)
+{
+    for(uint8_t i = 0; i < MODULE_D7AP_SESSION_DUPLICATE_CACHE_SIZE; i++)
+    {
+        if(is_handled_request(&handled_requests[i], packet, request_crc))
+            return &handled_requests[i];
     }
-    else if (d7asp_state == D7ASP_STATE_SLAVE)
-        switch_state(D7ASP_STATE_SLAVE_PENDING_MASTER);
 
-    current_master_session.state = D7ASP_MASTER_SESSION_ACTIVE;
+    return NULL;
+}
 
-    return (d7asp_queue_result_t){ .fifo_token = session->token, .request_id = request_id };
+// called with the response to the request in the payload, or none when the request is not acked
+static void store_handled_request(packet_t* packet, uint16_t request_crc, bool responded)
+{
+    if(responded && packet->payload_length > MODULE_D7AP_SESSION_DUPLICATE_RESPONSE_MAX_SIZE)
+    {
+        DPRINT("Response of %i bytes not kept for retries", packet->payload_length);
+        return;
+    }
+
+    handled_request_t* entry = &handled_requests[next_handled_request];
+    next_handled_request = (next_handled_request + 1) % MODULE_D7AP_SESSION_DUPLICATE_CACHE_SIZE;
+
+    entry->valid = true;
+    entry->responded = responded;
+    entry->origin_id_type = packet->d7anp_addressee->ctrl.id_type;
+    memcpy(entry->origin_id, packet->d7anp_addressee->id, sizeof(entry->origin_id));
+    entry->dialog_id = packet->d7atp_dialog_id;
+    entry->transaction_id = packet->d7atp_transaction_id;
+    entry->request_crc = request_crc;
+    entry->timestamp = timer_get_counter_value();
+    entry->response_length = responded ? packet->payload_length : 0;
+    memcpy(entry->response, packet->payload, entry->response_length);
+}
+#endif
+
+static void attach_aggregated_responses(packet_t* packet)
+{
+    if (aggregated_response_length == 0 || packet->d7atp_dialog_id != aggregated_response_dialog_id)
+        return;
+
+    if (aggregated_response_length + packet->payload_length <= packet_max_payload_length(packet->d7anp_addressee))
+    {
+        // the response is placed in the frame by packet_assemble(), the aggregated responses are only overwritten by
+        // the next request of the dialog, which comes after this response
+        DPRINT("Aggregating %i bytes of responses", aggregated_response_length);
+        memcpy(aggregated_response + aggregated_response_length, packet->payload, packet->payload_length);
+        packet->payload = aggregated_response;
+        packet->payload_length += aggregated_response_length;
+    }
+    else
+        log_stack_warning(LOG_STACK_SESSION, "Aggregated responses do not fit the response frame, dropped");
+
+    aggregated_response_length = 0;
 }
 
 bool d7asp_process_received_packet(packet_t* packet, bool extension)
 {
-    hw_watchdog_feed(); // TODO do here?
+    feed_watchdog();
     d7asp_result_t result = {
         .channel = packet->hw_radio_packet.rx_meta.rx_cfg.channel_id,
         .rx_level =  - packet->hw_radio_packet.rx_meta.rssi,
         .link_budget = (packet->dll_header.control_eirp_index - 32) - packet->hw_radio_packet.rx_meta.rssi,
-        .target_rx_level = 80, // TODO not implemented yet, use default for now
+        .target_rx_level = packet->d7atp_ctrl.ctrl_agc ? packet->d7atp_target_rx_level_i : 80, // default when not reported
         .status = {
             .ucast = 0, // TODO
             .nls = (packet->d7anp_ctrl.nls_method ? true : false),
@@ -344,30 +1121,42 @@ bool d7asp_process_received_packet(packet_t* packet, bool extension)
 
     if (d7asp_state == D7ASP_STATE_MASTER)
     {
-        assert(packet->d7atp_dialog_id == current_master_session.token);
+        assert(packet->d7atp_dialog_id == current_master_session->token);
         assert(packet->d7atp_transaction_id == current_request_id);
 
         // received ack
         DPRINT("Received ACK");
-        if (current_master_session.config.qos.qos_resp_mode != SESSION_RESP_MODE_NO
-           && current_master_session.config.qos.qos_resp_mode != SESSION_RESP_MODE_NO_RPT)
+        if (current_master_session->config.qos.qos_resp_mode != SESSION_RESP_MODE_NO
+           && current_master_session->config.qos.qos_resp_mode != SESSION_RESP_MODE_NO_RPT)
         {
             // for SESSION_RESP_MODE_NO and SESSION_RESP_MODE_NO_RPT the request was already marked as done
             // upon successfull CSMA insertion. We don't care about response in these cases.
 
-            result.fifo_token = current_master_session.token;
+            result.fifo_token = current_master_session->token;
             result.seqnr = current_request_id;
-            bitmap_set(current_master_session.success_bitmap, current_request_id);
+            mark_current_request_successful();
             mark_current_request_done();
             assert(packet != current_request_packet);
+
+            if (packet->d7atp_ctrl.ctrl_ack_record && packet->d7atp_ctrl.ctrl_ack_not_void)
+                process_ack_record(&packet->d7atp_ack_template);
+
+#if MODULE_D7AP_SESSION_RATE_ADAPTATION_PEER_COUNT > 0
+            update_peer_rate(current_master_session, result.rx_level);
+#endif
         }
 
-        alp_process_d7asp_result(packet->payload, packet->payload_length, packet->payload, &packet->payload_length, result);
+#if MODULE_D7AP_TIME_SYNC_ROLE == TIME_SYNC_ROLE_FOLLOWER
+        time_sync_process_response(packet);
+#endif
+
+        alp_process_d7asp_result(packet->payload, packet->payload_length, packet->payload, &packet->payload_length,
+                                 get_response_max_length(packet), result);
 
         packet_queue_free_packet(packet); // ACK can be cleaned
 
         /* In case of unicast session, it is acceptable to switch to the next request before the expiration of Tc */
-        if (!ID_TYPE_IS_BROADCAST(current_master_session.config.addressee.ctrl.id_type))
+        if (!ID_TYPE_IS_BROADCAST(current_master_session->config.addressee.ctrl.id_type))
         {
             DPRINT("Request completed, don't wait end of transaction");
             packet_queue_free_packet(current_request_packet);
@@ -375,7 +1164,7 @@ bool d7asp_process_received_packet(packet_t* packet, bool extension)
             // terminate the dialog if all request handled
             // we need to switch to the state idle otherwise we may receive a new packet before the task flush_fifos is handled
             // in this case, we may assert since the state remains MASTER
-            if (current_request_id == current_master_session.next_request_id - 1)
+            if (is_last_request())
             {
                 flush_completed();
                 return false;
@@ -386,14 +1175,17 @@ bool d7asp_process_received_packet(packet_t* packet, bool extension)
             d7atp_stop_transaction();
         }
         // switch to the state slave when the D7ATP Dialog Extension Procedure is initiated and all request are handled
-        else if ((extension) && (current_request_id == current_master_session.next_request_id - 1))
+        else if ((extension) && (is_last_request()))
         {
             DPRINT("Dialog Extension Procedure is initiated, mark the FIFO flush"
                     " completed before switching to a responder state");
-            alp_d7asp_fifo_flush_completed(current_master_session.token, current_master_session.progress_bitmap,
-                                           current_master_session.success_bitmap, REQUESTS_BITMAP_BYTE_COUNT);
-            current_master_session.state = D7ASP_MASTER_SESSION_IDLE;
+            alp_d7asp_fifo_flush_completed(current_master_session->token, current_master_session->progress_bitmap,
+                                           current_master_session->success_bitmap, REQUESTS_BITMAP_BYTE_COUNT);
+            current_master_session->state = D7ASP_MASTER_SESSION_IDLE;
+            current_dialog_started = false;
             switch_state(D7ASP_STATE_SLAVE);
+            if (get_next_pending_session() != NULL)
+                switch_state(D7ASP_STATE_SLAVE_PENDING_MASTER);
         }
         return false;
     }
@@ -408,19 +1200,65 @@ bool d7asp_process_received_packet(packet_t* packet, bool extension)
         else if (d7asp_state == D7ASP_STATE_PENDING_MASTER)
             switch_state(D7ASP_STATE_SLAVE_PENDING_MASTER);
 
+        if (wake_dormant_session(packet) && d7asp_state == D7ASP_STATE_SLAVE)
+            switch_state(D7ASP_STATE_SLAVE_PENDING_MASTER);
+
         result.fifo_token = packet->d7atp_dialog_id;
         result.seqnr = packet->d7atp_transaction_id;
 
-        if (packet->payload_length > 0)
+#if MODULE_D7AP_SESSION_DUPLICATE_CACHE_SIZE > 0
+        uint16_t request_crc = crc_calculate(packet->payload, packet->payload_length);
+        handled_request_t* handled_request = find_handled_request(packet, request_crc);
+        if (handled_request != NULL && (handled_request->responded || !packet->d7atp_ctrl.ctrl_is_ack_requested))
         {
-            alp_process_d7asp_result(packet->payload, packet->payload_length, packet->payload, &packet->payload_length, result);
+            // a retry of a request of which the response was lost: answered from the cache, not executed again
+            if (!packet->d7atp_ctrl.ctrl_is_ack_requested)
+            {
+                DPRINT("Duplicate request, already executed");
+                goto discard_request;
+            }
+
+            DPRINT("Duplicate request, sending the cached response");
+#if MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0
+            // the requester missed the response
+            dll_signal_peer_tx_failure(packet->d7anp_addressee->ctrl.id_type, packet->d7anp_addressee->id);
+#endif
+            memcpy(packet->payload, handled_request->response, handled_request->response_length);
+            packet->payload_length = handled_request->response_length;
+            goto respond;
+        }
+#endif
+
+        // the responders which do not match a break query of the request remain silent
+        if (packet->payload_length > 0
+            && !alp_process_d7asp_result(packet->payload, packet->payload_length, packet->payload, &packet->payload_length,
+                                         get_response_max_length(packet), result))
+        {
+            DPRINT("Break query failed, not responding");
+            goto discard_request;
         }
 
         // execute slave transaction
         if (!packet->d7atp_ctrl.ctrl_is_ack_requested)
+        {
+#if MODULE_D7AP_SESSION_DUPLICATE_CACHE_SIZE > 0
+            store_handled_request(packet, request_crc, false);
+#endif
+            aggregate_response(packet);
             goto discard_request; // no need to respond, clean up
+        }
 
+        attach_aggregated_responses(packet);
+#if MODULE_D7AP_SESSION_DUPLICATE_CACHE_SIZE > 0
+        store_handled_request(packet, request_crc, true);
+
+    respond:
+#endif
         DPRINT("Sending response");
+#if MODULE_D7AP_TIME_SYNC_ROLE == TIME_SYNC_ROLE_SOURCE
+        // after the response is stored in the duplicate cache, a response sent again carries the time of then
+        time_sync_attach(packet);
+#endif
 
         current_response_packet = packet;
 
@@ -434,6 +1272,7 @@ bool d7asp_process_received_packet(packet_t* packet, bool extension)
             packet->d7atp_ctrl.ctrl_is_start = true;
             // TODO set packet->d7anp_listen_timeout according the time remaining in the current transaction
             // + the maximum time to send the first request of the pending session.
+            packet->d7anp_listen_timeout = DIALOG_EXTENSION_LISTEN_TIMEOUT_CT;
         }
         else
             packet->d7atp_ctrl.ctrl_is_start = 0;
@@ -448,13 +1287,55 @@ bool d7asp_process_received_packet(packet_t* packet, bool extension)
         return false;
 }
 
-static void on_request_completed()
+bool d7asp_is_ack_only_request(packet_t* packet)
+{
+    // the ALP response is built in place of the request
+    if (packet->payload_length > 0)
+        return false;
+
+    if (aggregated_response_length > 0 && packet->d7atp_dialog_id == aggregated_response_dialog_id)
+        return false;
+
+#if MODULE_D7AP_SESSION_DUPLICATE_CACHE_SIZE > 0
+    handled_request_t* handled_request = find_handled_request(packet, crc_calculate(packet->payload, 0));
+    if (handled_request != NULL && handled_request->response_length > 0)
+        return false;
+#endif
+
+    return true;
+}
+
+static timer_tick_t get_retry_backoff(bool cca_failed)
+{
+    uint16_t base = cca_failed ? retry_policy.cca_failure_backoff : retry_policy.no_ack_backoff;
+    if (base == 0)
+        return 0;
+
+    uint8_t exponent = current_request_retry_count - 1;
+    if (exponent > retry_policy.max_backoff_exponent)
+        exponent = retry_policy.max_backoff_exponent;
+
+    uint32_t window = (uint32_t)base << exponent;
+    uint32_t backoff = window / 2 + get_rnd() % (window / 2 + 1);
+    return TI_TO_TIMER_TICKS(backoff);
+}
+
+static void on_request_completed(bool cca_failed)
 {
     assert(d7asp_state == D7ASP_STATE_MASTER);
-    if (!bitmap_get(current_master_session.progress_bitmap, current_request_id))
+    if (!bitmap_get(current_master_session->progress_bitmap, current_request_id))
     {
         current_request_retry_count++;
         // the request may be retransmitted, don't free yet (this will be done in flush_fifo() when failed)
+
+        // back off before retrying, retrying straight away into a busy channel only adds to the congestion
+        timer_tick_t backoff = current_request_retry_count < retry_policy.retry_limit ? get_retry_backoff(cca_failed) : 0;
+        if (backoff)
+        {
+            DPRINT("Retry in %i ticks", backoff);
+            timer_post_task_delay(&flush_fifos, backoff);
+            return;
+        }
     }
     else
     {
@@ -464,7 +1345,7 @@ static void on_request_completed()
         // terminate the dialog if all request handled
         // we need to switch to the state idle otherwise we may receive a new packet before the task flush_fifos is handled
         // in this case, we may assert since the state remains MASTER
-        if (current_request_id == current_master_session.next_request_id - 1)
+        if (is_last_request())
         {
             flush_completed();
             return;
@@ -482,11 +1363,16 @@ void d7asp_signal_packet_transmitted(packet_t *packet)
     if (d7asp_state == D7ASP_STATE_MASTER)
     {
         // for the lowest QoS level the packet is ack-ed when CSMA/CA process succeeded
-        if (current_master_session.config.qos.qos_resp_mode == SESSION_RESP_MODE_NO ||
-           current_master_session.config.qos.qos_resp_mode == SESSION_RESP_MODE_NO_RPT)
+        if (current_master_session->config.qos.qos_resp_mode == SESSION_RESP_MODE_NO ||
+           current_master_session->config.qos.qos_resp_mode == SESSION_RESP_MODE_NO_RPT)
+        {
+            mark_current_request_done();
+            mark_current_request_successful();
+        }
+        else if (!packet->d7atp_ctrl.ctrl_is_ack_requested)
         {
+            // a pipelined request, its success is reported in the ACK record of the last request of the dialog
             mark_current_request_done();
-            bitmap_set(current_master_session.success_bitmap, current_request_id);
         }
     }
     else if (d7asp_state == D7ASP_STATE_SLAVE || d7asp_state == D7ASP_STATE_SLAVE_PENDING_MASTER)
@@ -503,7 +1389,7 @@ void d7asp_signal_packet_transmitted(packet_t *packet)
 void d7asp_signal_transmission_failure()
 {
     if (d7asp_state == D7ASP_STATE_MASTER)
-        on_request_completed();
+        on_request_completed(true);
     else if (d7asp_state == D7ASP_STATE_SLAVE ||
              d7asp_state == D7ASP_STATE_SLAVE_PENDING_MASTER)
     {
@@ -516,7 +1402,7 @@ void d7asp_signal_transaction_terminated()
 {
     assert(d7asp_state == D7ASP_STATE_MASTER);
 
-    on_request_completed();
+    on_request_completed(false);
 }
 
 void d7asp_signal_dialog_terminated()
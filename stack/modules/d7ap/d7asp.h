@@ -69,11 +69,37 @@ typedef struct {
     };
 } d7asp_state_t;
 
+typedef enum {
+    D7ASP_PRIORITY_NORMAL,
+    D7ASP_PRIORITY_HIGH, /**< Sent before the normal requests of all sessions, preempting their dialogs between transactions */
+} d7asp_request_priority_t;
+
 typedef struct {
     uint8_t fifo_token;
     uint8_t request_id;
+    timer_tick_t worst_case_latency; /**< Upper bound of the time until the request is handled, assuming all retries are needed */
 } d7asp_queue_result_t;
 
+#define D7ASP_NO_FALLBACK_ACCESS_CLASS 0xFF
+
+/**
+ * /brief How failed requests are retried
+ *
+ * The back-off before a retry doubles with every retry of the request, up to 2^max_backoff_exponent times the base,
+ * and is randomized over the upper half of this window. A request which could not be transmitted because the channel
+ * was busy (CCA failure) and a request which was not acked within the response period have a different base.
+ */
+typedef struct {
+    uint8_t retry_limit; /**< The number of retries of a single request, before it is reported failed */
+    uint16_t cca_failure_backoff; /**< Back-off base after a CCA failure, in Ti */
+    uint16_t no_ack_backoff; /**< Back-off base after a missed ACK, in Ti. 0 retries immediately */
+    uint8_t max_backoff_exponent;
+    uint8_t fallback_access_class; /**< Access class used for the remaining requests of the session after fallback_retries retries, or D7ASP_NO_FALLBACK_ACCESS_CLASS */
+    uint8_t fallback_retries;
+    uint8_t high_rate_access_class; /**< Access class of the dialogs with the addressees with strong responses, see MODULE_D7AP_SESSION_RATE_ADAPTATION_PEER_COUNT, or D7ASP_NO_FALLBACK_ACCESS_CLASS */
+    uint8_t abort_failed_requests; /**< Unicast sessions are aborted after this number of consecutive failed requests, 0 never aborts */
+} d7asp_retry_policy_t;
+
 typedef struct {
     channel_id_t channel;
     uint8_t rx_level;
@@ -89,7 +115,13 @@ typedef struct {
 
 void d7asp_init();
 d7asp_master_session_t* d7asp_master_session_create(d7asp_master_session_config_t* d7asp_master_session_config);
-d7asp_queue_result_t d7asp_queue_alp_actions(d7asp_master_session_t* session, uint8_t* alp_payload_buffer, uint8_t alp_payload_length, uint8_t expected_alp_response_length); // TODO return status
+void d7asp_set_retry_policy(const d7asp_retry_policy_t* policy);
+/*! \brief The longest ALP payload of a request of the session, so it fits a single frame to the addressee */
+uint8_t d7asp_get_max_request_length(d7asp_master_session_t* session);
+/*! \brief The number of requests of request_length bytes which can still be queued on the session before it is flushed */
+uint8_t d7asp_get_queue_capacity(d7asp_master_session_t* session, uint8_t request_length);
+d7asp_queue_result_t d7asp_queue_alp_actions(d7asp_master_session_t* session, uint8_t* alp_payload_buffer, uint8_t alp_payload_length,
+                                             uint8_t expected_alp_response_length, d7asp_request_priority_t priority); // TODO return status
 
 /**
  * @brief Processes a received packet, and prepares the response packet if needed.
@@ -100,6 +132,15 @@ d7asp_queue_result_t d7asp_queue_alp_actions(d7asp_master_session_t* session, ui
 
 bool d7asp_process_received_packet(packet_t* packet, bool extension);
 
+/**
+ * @brief Whether the response to the received packet, if any, carries no ALP payload
+ *
+ * This is the case for a request without ALP actions, when no responses to the previous requests of the dialog wait
+ * to be attached to it. The acknowledgement is then built in the received frame buffer without ALP processing.
+ * The addressee of the packet should be its origin.
+ */
+bool d7asp_is_ack_only_request(packet_t* packet);
+
 /**
  * @brief Called by DLL to signal the CSMA/CA process completed succesfully and packet can be ack-ed for QoS = None
  */
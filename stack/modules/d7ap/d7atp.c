@@ -30,9 +30,12 @@
 #include "dll.h"
 #include "ng.h"
 #include "log.h"
+#include "trace.h"
 #include "fs.h"
 #include "MODULE_D7AP_defs.h"
 #include "compress.h"
+#include "bitmap.h"
+#include "time_sync.h"
 
 #if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_TP_LOG_ENABLED)
 #define DPRINT(...) log_print_stack_string(LOG_STACK_TRANS, __VA_ARGS__)
@@ -58,9 +61,59 @@ static uint8_t NGDEF(_current_access_class);
 static dae_access_profile_t NGDEF(_active_addressee_access_profile);
 #define active_addressee_access_profile NG(_active_addressee_access_profile)
 
+// the access profile version of active_addressee_access_profile
+static uint8_t NGDEF(_active_addressee_access_profile_version);
+#define active_addressee_access_profile_version NG(_active_addressee_access_profile_version)
+
 static bool NGDEF(_stop_dialog_after_tx);
 #define stop_dialog_after_tx NG(_stop_dialog_after_tx)
 
+#if MODULE_D7AP_TP_SLAVE_DIALOG_COUNT < 1
+#error "MODULE_D7AP_TP_SLAVE_DIALOG_COUNT should be at least 1"
+#endif
+
+// as a slave: a dialog with a requester, identified by its origin ID. The entry of a requester is kept after its
+// dialog ended, for the ACK record of a paused dialog
+typedef struct {
+    bool active;
+    id_type_t requester_id_type;
+    uint8_t requester_id[8];
+    uint8_t dialog_id;
+    timer_tick_t listen_end; // the end of the listen period announced by the last request of the dialog
+    // the transaction IDs received in the recorded dialog, for the ACK record in the response
+    uint8_t ack_record[D7ATP_ACK_BITMAP_SIZE];
+    uint8_t ack_record_dialog_id;
+} slave_dialog_t;
+
+static slave_dialog_t NGDEF(_slave_dialogs)[MODULE_D7AP_TP_SLAVE_DIALOG_COUNT];
+#define slave_dialogs NG(_slave_dialogs)
+
+// the dialog of the request being answered
+static slave_dialog_t* NGDEF(_current_slave_dialog);
+#define current_slave_dialog NG(_current_slave_dialog)
+
+static uint8_t NGDEF(_next_slave_dialog);
+#define next_slave_dialog NG(_next_slave_dialog)
+
+#if MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0
+// the addressee of the request of the master transaction, the unicast responses do not carry their origin
+static d7anp_addressee_t* NGDEF(_request_addressee);
+#define request_addressee NG(_request_addressee)
+#endif
+
+// the estimated number of responders to a broadcast (NOID) request, sizes the response period of the next one
+static uint8_t NGDEF(_broadcast_population);
+#define broadcast_population NG(_broadcast_population)
+
+static bool NGDEF(_estimate_population);
+#define estimate_population NG(_estimate_population)
+
+static uint8_t NGDEF(_broadcast_response_count);
+#define broadcast_response_count NG(_broadcast_response_count)
+
+static uint8_t NGDEF(_broadcast_collision_count);
+#define broadcast_collision_count NG(_broadcast_collision_count)
+
 typedef enum {
     D7ATP_STATE_IDLE,
     D7ATP_STATE_MASTER_TRANSACTION_REQUEST_PERIOD,
@@ -78,6 +131,7 @@ static state_t NGDEF(_d7atp_state);
 
 static void switch_state(state_t new_state)
 {
+    trace_record(LOG_STACK_TRANS, TRACE_EVENT_STATE, current_dialog_id, current_transaction_id, d7atp_state, new_state);
     switch(new_state)
     {
     case D7ATP_STATE_MASTER_TRANSACTION_REQUEST_PERIOD:
@@ -103,7 +157,9 @@ static void switch_state(state_t new_state)
         break;
     case D7ATP_STATE_SLAVE_TRANSACTION_RESPONSE_PERIOD:
         DPRINT("Switching to D7ATP_STATE_SLAVE_TRANSACTION_RESPONSE_PERIOD");
-        assert(d7atp_state == D7ATP_STATE_SLAVE_TRANSACTION_SENDING_RESPONSE);
+        // a request without response ends its dialog, the slave can stay in the response period of the other dialogs
+        assert(d7atp_state == D7ATP_STATE_SLAVE_TRANSACTION_SENDING_RESPONSE
+               || d7atp_state == D7ATP_STATE_SLAVE_TRANSACTION_RECEIVED_REQUEST);
         d7atp_state = new_state;
         break;
     case D7ATP_STATE_IDLE:
@@ -119,16 +175,66 @@ static void execution_delay_timeout_handler()
 {
     assert(d7atp_state == D7ATP_STATE_MASTER_TRANSACTION_RESPONSE_PERIOD);
 
+    trace_record(LOG_STACK_TRANS, TRACE_EVENT_TIMEOUT, current_dialog_id, current_transaction_id, d7atp_state, 0);
+
     // After the Execution Delay period, the Requester engages in a DLL foreground scan for a duration of TC
     DPRINT("Execution Delay period is expired @%i",  timer_get_counter_value());
 
     d7anp_start_foreground_scan();
 }
 
+static bool is_requester(slave_dialog_t* dialog, d7anp_addressee_t* origin)
+{
+    return dialog->requester_id_type == origin->ctrl.id_type
+        && memcmp(dialog->requester_id, origin->id, d7anp_addressee_id_length(origin->ctrl.id_type)) == 0;
+}
+
+// the entry of the requester, or an entry to start a dialog with it: the oldest one of the requesters not in a dialog
+static slave_dialog_t* get_slave_dialog(d7anp_addressee_t* origin)
+{
+    for (uint8_t i = 0; i < MODULE_D7AP_TP_SLAVE_DIALOG_COUNT; i++)
+    {
+        if (is_requester(&slave_dialogs[i], origin))
+            return &slave_dialogs[i];
+    }
+
+    for (uint8_t i = 0; i < MODULE_D7AP_TP_SLAVE_DIALOG_COUNT; i++)
+    {
+        slave_dialog_t* dialog = &slave_dialogs[next_slave_dialog];
+        next_slave_dialog = (next_slave_dialog + 1) % MODULE_D7AP_TP_SLAVE_DIALOG_COUNT;
+        if (!dialog->active)
+        {
+            dialog->requester_id_type = origin->ctrl.id_type;
+            memcpy(dialog->requester_id, origin->id, sizeof(dialog->requester_id));
+            dialog->ack_record_dialog_id = 0;
+            memset(dialog->ack_record, 0, D7ATP_ACK_BITMAP_SIZE);
+            return dialog;
+        }
+    }
+
+    return NULL;
+}
+
+// the time from now during which one of the dialogs can still receive a request, the foreground scan lasts this long
+static timer_tick_t get_listen_period()
+{
+    timer_tick_t now = timer_get_counter_value();
+    timer_tick_t listen_period = 0;
+    for (uint8_t i = 0; i < MODULE_D7AP_TP_SLAVE_DIALOG_COUNT; i++)
+    {
+        int32_t remaining = (int32_t)(slave_dialogs[i].listen_end - now);
+        if (slave_dialogs[i].active && remaining > (int32_t)listen_period)
+            listen_period = remaining;
+    }
+
+    return listen_period;
+}
+
 static void response_period_timeout_handler()
 {
 //    DEBUG_PIN_CLR(2);
     DPRINT("Expiration of the response period");
+    trace_record(LOG_STACK_TRANS, TRACE_EVENT_TIMEOUT, current_dialog_id, current_transaction_id, d7atp_state, 0);
 
     assert(d7atp_state == D7ATP_STATE_SLAVE_TRANSACTION_RESPONSE_PERIOD
            || d7atp_state == D7ATP_STATE_SLAVE_TRANSACTION_RECEIVED_REQUEST
@@ -138,6 +244,8 @@ static void response_period_timeout_handler()
 
     DPRINT("Transaction is terminated");
 
+    // the foreground scan covers the listen periods of all the dialogs
+    d7anp_set_foreground_scan_timeout(get_listen_period());
     d7anp_start_foreground_scan();
 }
 
@@ -165,15 +273,73 @@ static void schedule_response_period_timeout_handler(timer_tick_t timeout_ticks)
 }
 
 
+static void end_slave_dialogs()
+{
+    for (uint8_t i = 0; i < MODULE_D7AP_TP_SLAVE_DIALOG_COUNT; i++)
+        slave_dialogs[i].active = false;
+
+    current_slave_dialog = NULL;
+}
+
 static void terminate_dialog()
 {
     DPRINT("Dialog terminated");
     current_dialog_id = 0;
     stop_dialog_after_tx = false;
+    end_slave_dialogs();
     d7asp_signal_dialog_terminated();
     switch_state(D7ATP_STATE_IDLE);
 }
 
+// the dialog of the current request ends without listen period, the slave keeps listening for the other dialogs
+static void end_current_slave_dialog()
+{
+    current_slave_dialog->active = false;
+    timer_tick_t listen_period = get_listen_period();
+    if (listen_period == 0)
+    {
+        terminate_dialog();
+        d7anp_stop_foreground_scan(true); // restart scan automation
+        return;
+    }
+
+    DPRINT("Dialog %i terminated, listening %i ticks for the other dialogs", current_dialog_id, listen_period);
+    stop_dialog_after_tx = false;
+    current_dialog_id = 0;
+    current_transaction_id = NO_ACTIVE_REQUEST_ID;
+    switch_state(D7ATP_STATE_SLAVE_TRANSACTION_RESPONSE_PERIOD);
+    d7anp_set_foreground_scan_timeout(listen_period);
+    d7anp_start_foreground_scan();
+}
+
+/*
+ * Schoute's estimate for framed slotted ALOHA: every collided slot hides 2.39 responders on average. The corrupted
+ * frames received during the response period are counted as collided slots.
+ */
+static void update_broadcast_population_estimate()
+{
+    uint16_t estimate = broadcast_response_count + (broadcast_collision_count * 239 + 99) / 100;
+    if (estimate == 0)
+        estimate = 1;
+    else if (estimate > UINT8_MAX)
+        estimate = UINT8_MAX;
+
+    DPRINT("%i responses and %i collisions, estimated population %i", broadcast_response_count, broadcast_collision_count, estimate);
+    broadcast_population = estimate;
+}
+
+void d7atp_signal_corrupted_frame()
+{
+    if (d7atp_state == D7ATP_STATE_MASTER_TRANSACTION_RESPONSE_PERIOD && estimate_population
+        && broadcast_collision_count < UINT8_MAX)
+        broadcast_collision_count++;
+}
+
+uint8_t d7atp_get_broadcast_population_estimate()
+{
+    return broadcast_population;
+}
+
 void d7atp_signal_foreground_scan_expired()
 {
     // Reset the transaction Id
@@ -188,6 +354,9 @@ void d7atp_signal_foreground_scan_expired()
     }
     else if (d7atp_state == D7ATP_STATE_MASTER_TRANSACTION_RESPONSE_PERIOD)
     {
+        if (estimate_population)
+            update_broadcast_population_estimate();
+
         d7asp_signal_transaction_terminated();
     }
     else
@@ -206,6 +375,7 @@ void d7atp_signal_dialog_termination()
     switch_state(D7ATP_STATE_IDLE);
     current_dialog_id = 0;
     current_transaction_id = NO_ACTIVE_REQUEST_ID;
+    end_slave_dialogs();
 
     // Discard eventually the Tc timer
     timer_cancel_task(&response_period_timeout_handler);
@@ -226,15 +396,51 @@ void d7atp_stop_transaction()
     d7anp_stop_foreground_scan(false);
 }
 
+static void load_addressee_access_profile(uint8_t access_class, uint8_t access_specifier)
+{
+    if (access_class == current_access_class && active_addressee_access_profile_version == fs_get_access_profile_version())
+        return;
+
+    fs_read_access_class(access_specifier, &active_addressee_access_profile);
+    current_access_class = access_class;
+    active_addressee_access_profile_version = fs_get_access_profile_version();
+}
+
+SCHED_REGISTER_TASK(response_period_timeout_handler);
+SCHED_REGISTER_TASK(execution_delay_timeout_handler);
+
 void d7atp_init()
 {
     d7atp_state = D7ATP_STATE_IDLE;
     current_access_class = ACCESS_CLASS_NOT_SET;
     current_dialog_id = 0;
     stop_dialog_after_tx = false;
+    memset(slave_dialogs, 0, sizeof(slave_dialogs));
+    current_slave_dialog = NULL;
+    next_slave_dialog = 0;
+    broadcast_population = 32;
+    estimate_population = false;
 
-    sched_register_task(&response_period_timeout_handler);
-    sched_register_task(&execution_delay_timeout_handler);
+}
+
+timer_tick_t d7atp_calculate_response_period(d7anp_addressee_t* addressee, dae_access_profile_t* access_profile, uint8_t expected_response_length)
+{
+    // the response carries the same headers as the request, the frame length byte included
+    uint16_t response_length = expected_response_length + packet_max_frame_overhead(addressee);
+    if (response_length > PACKET_MAX_SIZE)
+        response_length = PACKET_MAX_SIZE;
+
+    uint16_t tx_duration_response = dll_calculate_tx_duration(access_profile->channel_header.ch_class,
+                                                              access_profile->channel_header.ch_coding,
+                                                              response_length);
+    uint8_t nb = 1;
+    if (addressee->ctrl.id_type == ID_TYPE_NOID)
+        nb = broadcast_population;
+    else if (addressee->ctrl.id_type == ID_TYPE_NBID)
+        nb = CT_DECOMPRESS(addressee->id[0]);
+
+    // Tc(NB, LEN, CH) = ceil((SFC  * NB  + 1) * TTX(CH, LEN) + TG) with NB the number of concurrent devices and SF the collision Avoidance Spreading Factor
+    return (SFc * nb + 1) * tx_duration_response + t_g;
 }
 
 error_t d7atp_send_request(uint8_t dialog_id, uint8_t transaction_id, bool is_last_transaction,
@@ -260,14 +466,9 @@ error_t d7atp_send_request(uint8_t dialog_id, uint8_t transaction_id, bool is_la
     packet->d7atp_dialog_id = current_dialog_id;
     packet->d7atp_transaction_id = current_transaction_id;
 
-    uint8_t access_class = packet->d7anp_addressee->access_class;
-    if (access_class != current_access_class)
-    {
-        fs_read_access_class(packet->d7anp_addressee->access_specifier, &active_addressee_access_profile);
-        current_access_class = access_class;
-    }
+    load_addressee_access_profile(packet->d7anp_addressee->access_class, packet->d7anp_addressee->access_specifier);
 
-    DPRINT("Start dialog Id=%i transID=%i on AC=%x, expected resp len=%i", dialog_id, transaction_id, access_class, expected_response_length);
+    DPRINT("Start dialog Id=%i transID=%i on AC=%x, expected resp len=%i", dialog_id, transaction_id, current_access_class, expected_response_length);
     uint8_t slave_listen_timeout = listen_timeout;
 
     bool ack_requested = true;
@@ -275,8 +476,11 @@ error_t d7atp_send_request(uint8_t dialog_id, uint8_t transaction_id, bool is_la
         && expected_response_length == 0)
       ack_requested = false;
 
-    // TODO based on what do we calculate Tc? payload length alone is not enough, depends on for example use of FEC, encryption ..
-    // keep the same as transmission timeout for now
+    // in ack on error mode the requests are pipelined, only the last transaction requests an ACK, which carries an
+    // ACK record of all the transactions received by the responder and the responses to the pipelined requests
+    bool ack_on_error = qos_settings->qos_resp_mode == SESSION_RESP_MODE_ON_ERR;
+    if (ack_on_error && !is_last_transaction)
+      ack_requested = false;
 
     // FG scan timeout is set (and scan started) in d7atp_signal_packet_transmitted() for now, to be verified
 
@@ -285,34 +489,30 @@ error_t d7atp_send_request(uint8_t dialog_id, uint8_t transaction_id, bool is_la
         .ctrl_is_ack_requested = ack_requested,
         .ctrl_ack_not_void = qos_settings->qos_resp_mode == SESSION_RESP_MODE_ON_ERR? true : false,
         .ctrl_te = false,
-        .ctrl_agc = false,
-        .ctrl_ack_record = false
+        .ctrl_agc = MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0,
+        .ctrl_ack_record = ack_on_error && ack_requested
     };
 
+    // the responders control the EIRP of their responses to reach this RX level
+    packet->d7atp_target_rx_level_i = MODULE_D7AP_DLL_TX_POWER_CONTROL_TARGET_RX_LEVEL;
+#if MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0
+    request_addressee = packet->d7anp_addressee;
+#endif
+
+    estimate_population = ack_requested && packet->d7anp_addressee->ctrl.id_type == ID_TYPE_NOID;
+
     if (ack_requested)
     {
-        // TODO payload length does not include headers ... + hardcoded subband
-        // TODO this length does not include lower layers overhead for now, use a minimum len of 50 for now ...
-        if (expected_response_length < 50)
-            expected_response_length = 50;
-
-        uint16_t tx_duration_response = dll_calculate_tx_duration(active_addressee_access_profile.channel_header.ch_class,
-                                                                  active_addressee_access_profile.channel_header.ch_coding,
-                                                                  expected_response_length);
-        uint8_t nb = 1;
-        if (packet->d7anp_addressee->ctrl.id_type == ID_TYPE_NOID)
-            nb = 32;
-        else if (packet->d7anp_addressee->ctrl.id_type == ID_TYPE_NBID)
-            nb = CT_DECOMPRESS(packet->d7anp_addressee->id[0]);
-
-        // Tc(NB, LEN, CH) = ceil((SFC  * NB  + 1) * TTX(CH, LEN) + TG) with NB the number of concurrent devices and SF the collision Avoidance Spreading Factor
-        uint16_t resp_tc = (SFc * nb + 1) * tx_duration_response + t_g;
-        packet->d7atp_tc = compress_data(resp_tc, true);
-
-        DPRINT("Tc <%i (Ti)> Tc <0x%02x (CT)> Tx duration <%i>", resp_tc, packet->d7atp_tc, tx_duration_response);
+        timer_tick_t resp_tc = d7atp_calculate_response_period(packet->d7anp_addressee, &active_addressee_access_profile,
+                                                               expected_response_length);
+        packet->d7atp_tc = compress_data(TIMER_TICKS_TO_TI(resp_tc), true);
+
+        DPRINT("Tc <%i (ticks)> Tc <0x%02x (CT)>", resp_tc, packet->d7atp_tc);
     }
 
 send_packet:
+    broadcast_response_count = 0;
+    broadcast_collision_count = 0;
     return(d7anp_tx_foreground_frame(packet, true, slave_listen_timeout));
 }
 
@@ -326,6 +526,8 @@ static void send_response(packet_t* packet)
     // leave ctrl_is_ack_requested as is, keep the requester value
     d7atp->ctrl_ack_not_void = false; // TODO
     d7atp->ctrl_ack_record = false; // TODO validate
+    d7atp->ctrl_agc = MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0;
+    packet->d7atp_target_rx_level_i = MODULE_D7AP_DLL_TX_POWER_CONTROL_TARGET_RX_LEVEL;
 
     bool should_include_origin_template = false; // we don't need to send origin ID, the requester will filter based on dialogID, but ...
 
@@ -347,9 +549,8 @@ static void send_response(packet_t* packet)
 
     uint8_t slave_listen_timeout = 0;
     // we are the slave here, so we don't need to lock the other party on the channel, unless we want to signal a pending dormant session with this addressee
-    if (!packet->d7atp_ctrl.ctrl_is_start)
-        slave_listen_timeout = 0;
-    // TODO dormant sessions
+    if (packet->d7atp_ctrl.ctrl_is_start)
+        slave_listen_timeout = packet->d7anp_listen_timeout;
 
     // dialog and transaction id remain the same
     DPRINT("Tl=%i", packet->d7anp_listen_timeout);
@@ -388,9 +589,32 @@ uint8_t d7atp_assemble_packet_header(packet_t* packet, uint8_t* data_ptr)
     else if (packet->d7atp_ctrl.ctrl_is_ack_requested && packet->d7atp_ctrl.ctrl_ack_not_void)
     {
         // add Responder ACK template
-        (*data_ptr) = packet->d7atp_transaction_id; data_ptr++; // transaction ID start
-        (*data_ptr) = packet->d7atp_transaction_id; data_ptr++; // transaction ID stop
-        // TODO ACK bitmap, support for multiple segments to ack not implemented yet
+        uint8_t start = packet->d7atp_transaction_id;
+        uint8_t stop = packet->d7atp_transaction_id;
+        assert(current_slave_dialog != NULL);
+        uint8_t* ack_record = current_slave_dialog->ack_record;
+        if (packet->d7atp_ctrl.ctrl_ack_record && stop < MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT)
+        {
+            int16_t first = bitmap_search(ack_record, true, MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT);
+            if (first >= 0 && first < start)
+                start = first;
+        }
+
+        (*data_ptr) = start; data_ptr++; // transaction ID start
+        (*data_ptr) = stop; data_ptr++; // transaction ID stop
+
+        if (packet->d7atp_ctrl.ctrl_ack_record)
+        {
+            uint8_t bitmap_size = (stop - start) / 8 + 1;
+            memset(data_ptr, 0, bitmap_size);
+            for (uint8_t i = 0; i <= stop - start; i++)
+            {
+                if (start + i == stop || bitmap_get(ack_record, start + i))
+                    bitmap_set(data_ptr, i);
+            }
+
+            data_ptr += bitmap_size;
+        }
     }
 
     return data_ptr - d7atp_header_start;
@@ -421,11 +645,26 @@ bool d7atp_disassemble_packet_header(packet_t *packet, uint8_t *data_idx)
       (*data_idx)++;
     }
 
-    if (packet->d7atp_ctrl.ctrl_is_ack_requested && packet->d7atp_ctrl.ctrl_ack_not_void)
+    // the ACK template is only present in responses
+    else if (packet->d7atp_ctrl.ctrl_is_ack_requested && packet->d7atp_ctrl.ctrl_ack_not_void)
     {
         packet->d7atp_ack_template.ack_transaction_id_start = packet->hw_radio_packet.data[(*data_idx)]; (*data_idx)++;
         packet->d7atp_ack_template.ack_transaction_id_stop = packet->hw_radio_packet.data[(*data_idx)]; (*data_idx)++;
-        // TODO ACK bitmap, support for multiple segments to ack not implemented yet
+
+        if (packet->d7atp_ctrl.ctrl_ack_record)
+        {
+            uint8_t start = packet->d7atp_ack_template.ack_transaction_id_start;
+            uint8_t stop = packet->d7atp_ack_template.ack_transaction_id_stop;
+            if (stop < start || (stop - start) / 8 + 1 > D7ATP_ACK_BITMAP_SIZE)
+            {
+                DPRINT("ACK record of transactions %i - %i not supported", start, stop);
+                return false;
+            }
+
+            uint8_t bitmap_size = (stop - start) / 8 + 1;
+            memcpy(packet->d7atp_ack_template.ack_bitmap, packet->hw_radio_packet.data + (*data_idx), bitmap_size);
+            (*data_idx) += bitmap_size;
+        }
     }
 
     return true;
@@ -433,6 +672,8 @@ bool d7atp_disassemble_packet_header(packet_t *packet, uint8_t *data_idx)
 
 void d7atp_signal_packet_transmitted(packet_t* packet)
 {
+    trace_record(LOG_STACK_TRANS, TRACE_EVENT_TX, packet->d7atp_dialog_id, packet->d7atp_transaction_id, packet->type,
+                 packet->hw_radio_packet.length);
     d7asp_signal_packet_transmitted(packet);
 
     if (d7atp_state == D7ATP_STATE_MASTER_TRANSACTION_REQUEST_PERIOD)
@@ -441,26 +682,26 @@ void d7atp_signal_packet_transmitted(packet_t* packet)
 
         if (packet->d7atp_ctrl.ctrl_is_ack_requested)
         {
-            timer_tick_t Tc = CT_DECOMPRESS(packet->d7atp_tc);
+            timer_tick_t Tc = CT_DECOMPRESS_TO_TICKS(packet->d7atp_tc);
 
             // Check if an Execution Delay period needs to be observed
             if (packet->d7atp_ctrl.ctrl_te)
             {
-                timer_tick_t Te = adjust_timeout_value(CT_DECOMPRESS(packet->d7atp_te), packet->hw_radio_packet.tx_meta.timestamp);
+                timer_tick_t Te = adjust_timeout_value(CT_DECOMPRESS_TO_TICKS(packet->d7atp_te), packet->hw_radio_packet.tx_meta.timestamp);
                 if (Te)
                 {
-                    d7anp_set_foreground_scan_timeout(Tc + 2); // we include Tt here for now
+                    d7anp_set_foreground_scan_timeout(Tc + TI_TO_TIMER_TICKS(2)); // we include Tt here for now
                     timer_post_task_delay(&execution_delay_timeout_handler, Te);
                     return;
                 }
                 // if the the time passed since transmission is greater than Te, Tc is updated to include Te
                 // and the foreground scan is started immediately
                 else
-                    Tc += CT_DECOMPRESS(packet->d7atp_te);
+                    Tc += CT_DECOMPRESS_TO_TICKS(packet->d7atp_te);
             }
 
             Tc = adjust_timeout_value( Tc, packet->hw_radio_packet.tx_meta.timestamp);
-            d7anp_set_foreground_scan_timeout(Tc + 2); // we include Tt here for now
+            d7anp_set_foreground_scan_timeout(Tc + TI_TO_TIMER_TICKS(2)); // we include Tt here for now
             d7anp_start_foreground_scan();
         }
         else
@@ -475,9 +716,8 @@ void d7atp_signal_packet_transmitted(packet_t* packet)
 
         if (stop_dialog_after_tx)
         {
-            // no FG scan and no response period are scheduled, we can end dialog now
-            terminate_dialog();
-            d7anp_stop_foreground_scan(true); // restart scan automation
+            // no FG scan and no response period are scheduled for this dialog, we can end it now
+            end_current_slave_dialog();
         }
     }
     else if (d7atp_state == D7ATP_STATE_IDLE)
@@ -489,13 +729,13 @@ void d7atp_signal_transmission_failure()
     assert((d7atp_state == D7ATP_STATE_MASTER_TRANSACTION_REQUEST_PERIOD) ||
            (d7atp_state == D7ATP_STATE_SLAVE_TRANSACTION_SENDING_RESPONSE));
 
-    DPRINT("CSMA-CA insertion failed, stopping transaction");
+    log_stack_warning(LOG_STACK_TRANS, "CSMA-CA insertion failed, stopping transaction");
 
     if (d7atp_state == D7ATP_STATE_SLAVE_TRANSACTION_SENDING_RESPONSE && stop_dialog_after_tx)
     {
         /* For Slaves, terminate the dialog if no FG scan and no response period are scheduled.*/
-        terminate_dialog();
-        d7anp_stop_foreground_scan(true); // restart scan automation
+        switch_state(D7ATP_STATE_SLAVE_TRANSACTION_RESPONSE_PERIOD);
+        end_current_slave_dialog();
         return;
     }
 
@@ -506,10 +746,21 @@ void d7atp_process_received_packet(packet_t* packet)
 {
     bool extension = false;
 
+    trace_record(LOG_STACK_TRANS, TRACE_EVENT_RX, packet->d7atp_dialog_id, packet->d7atp_transaction_id,
+                 packet->hw_radio_packet.rx_meta.rssi, packet->hw_radio_packet.length);
+
     assert(d7atp_state == D7ATP_STATE_MASTER_TRANSACTION_RESPONSE_PERIOD
            || d7atp_state == D7ATP_STATE_SLAVE_TRANSACTION_RESPONSE_PERIOD
            || d7atp_state == D7ATP_STATE_IDLE); // IDLE: when doing channel scanning outside of transaction
 
+    // the response is sent with the access profile of the origin, a node without it cannot take part in the dialog
+    if (!fs_is_access_class_defined(packet->origin_access_class >> 4))
+    {
+        DPRINT("Origin access class 0x%02x not defined, skipping segment", packet->origin_access_class);
+        packet_queue_free_packet(packet);
+        return;
+    }
+
     // copy addressee from NP origin
     current_addressee.ctrl.id_type = packet->d7anp_ctrl.origin_id_type;
     current_addressee.access_class = packet->origin_access_class;
@@ -517,9 +768,30 @@ void d7atp_process_received_packet(packet_t* packet)
     memcpy(current_addressee.id, packet->origin_access_id, 8);
     packet->d7anp_addressee = &current_addressee;
 
+    // the ALP response is built in place of the received frame, which might not fit in a short packet buffer. An ack
+    // only response holds no more than the headers, it is built in the received frame buffer whatever its size
+    uint8_t frame_length = UINT8_MAX;
+    if (d7asp_is_ack_only_request(packet))
+    {
+        frame_length = packet_max_frame_overhead(packet->d7anp_addressee);
+#if MODULE_D7AP_TIME_SYNC_ROLE == TIME_SYNC_ROLE_SOURCE
+        frame_length += TIME_SYNC_ACTION_SIZE;
+#endif
+    }
+
+    packet_t* max_length_packet = packet_queue_ensure_frame_length(packet, frame_length);
+    if (max_length_packet == NULL)
+    {
+        DPRINT("No max length packet available, skipping segment");
+        packet_queue_free_packet(packet);
+        return;
+    }
+
+    packet = max_length_packet;
+
     DPRINT("Recvd dialog %i trans id %i, curr %i - %i", packet->d7atp_dialog_id, packet->d7atp_transaction_id, current_dialog_id, current_transaction_id);
-    timer_tick_t Tl = CT_DECOMPRESS(packet->d7anp_listen_timeout);
-    DPRINT("Tl=%i (CT) -> %i (Ti) ", packet->d7anp_listen_timeout, Tl);
+    timer_tick_t Tl = CT_DECOMPRESS_TO_TICKS(packet->d7anp_listen_timeout);
+    DPRINT("Tl=%i (CT) -> %i (ticks) ", packet->d7anp_listen_timeout, Tl);
     if (IS_IN_MASTER_TRANSACTION())
     {
         if (packet->d7atp_dialog_id != current_dialog_id || packet->d7atp_transaction_id != current_transaction_id)
@@ -529,6 +801,16 @@ void d7atp_process_received_packet(packet_t* packet)
             return;
         }
 
+        if (estimate_population && broadcast_response_count < UINT8_MAX)
+            broadcast_response_count++;
+
+#if MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0
+        if (packet->d7anp_ctrl.origin_id_type == ID_TYPE_NOID)
+            dll_update_peer_tx_power(packet, request_addressee->ctrl.id_type, request_addressee->id);
+        else
+            dll_update_peer_tx_power(packet, current_addressee.ctrl.id_type, current_addressee.id);
+#endif
+
         // Check if a new dialog initiated by the responder is allowed
         if (packet->d7atp_ctrl.ctrl_is_start)
         {
@@ -537,7 +819,7 @@ void d7atp_process_received_packet(packet_t* packet)
             if (!ID_TYPE_IS_BROADCAST(packet->dll_header.control_target_id_type))
             {
                 Tl = adjust_timeout_value(Tl, packet->hw_radio_packet.rx_meta.timestamp);
-                DPRINT("Adjusted Tl=%i (Ti) ", Tl);
+                DPRINT("Adjusted Tl=%i (ticks) ", Tl);
                 DPRINT("Responder wants to append a new dialog");
                 d7anp_set_foreground_scan_timeout(Tl);
                 d7anp_start_foreground_scan();
@@ -558,11 +840,20 @@ void d7atp_process_received_packet(packet_t* packet)
     }
     else
     {
+        // the dialogs are recorded per requester, a slave can be in a dialog with several requesters at once
+        slave_dialog_t* dialog = get_slave_dialog(&current_addressee);
+        if (dialog == NULL)
+        {
+            DPRINT("Filtered frame starting a dialog while in a dialog with %i requesters", MODULE_D7AP_TP_SLAVE_DIALOG_COUNT);
+            packet_queue_free_packet(packet);
+            return;
+        }
+
          /*
           * when participating in a Dialog, responder discards segments with Dialog ID
           * not matching the recorded Dialog ID
           */
-        if ((current_dialog_id) && (current_dialog_id != packet->d7atp_dialog_id))
+        if (dialog->active && dialog->dialog_id != packet->d7atp_dialog_id)
         {
             DPRINT("Filtered frame with Dialog ID not matching the recorded Dialog ID");
             packet_queue_free_packet(packet);
@@ -570,7 +861,7 @@ void d7atp_process_received_packet(packet_t* packet)
         }
 
         // When not participating in a Dialog
-        if ((!current_dialog_id) && (!packet->d7atp_ctrl.ctrl_is_start))
+        if (!dialog->active && !packet->d7atp_ctrl.ctrl_is_start)
         {
             //Responders discard segments marked with START flag set to 0 until they receive a segment with START flag set to 1
             DPRINT("Filtered frame with START cleared");
@@ -581,11 +872,11 @@ void d7atp_process_received_packet(packet_t* packet)
          // The FG scan is only started when the response period expires.
         if (packet->d7atp_ctrl.ctrl_is_ack_requested)
         {
-            timer_tick_t Tc = CT_DECOMPRESS(packet->d7atp_tc);
+            timer_tick_t Tc = CT_DECOMPRESS_TO_TICKS(packet->d7atp_tc);
 
-            DPRINT("Tc=%i (CT) -> %i (Ti) ", packet->d7atp_tc, Tc);
+            DPRINT("Tc=%i (CT) -> %i (ticks) ", packet->d7atp_tc, Tc);
             if (packet->d7atp_ctrl.ctrl_te)
-                Tc += CT_DECOMPRESS(packet->d7atp_te);
+                Tc += CT_DECOMPRESS_TO_TICKS(packet->d7atp_te);
 
             // We choose to start the FG scan after the execution delay and the response period so Tl = Tl - Tc - Te
             if (Tl > Tc)
@@ -602,11 +893,9 @@ void d7atp_process_received_packet(packet_t* packet)
                 return;
             }
 
+            dialog->listen_end = timer_get_counter_value() + Tc + Tl;
             if (Tl)
-            {
-                d7anp_set_foreground_scan_timeout(Tl);
-                schedule_response_period_timeout_handler(Tc);
-            }
+                schedule_response_period_timeout_handler(Tc); // which starts the FG scan
 
             /* stop eventually the FG scan and force the radio to go back to IDLE */
             d7anp_stop_foreground_scan(false);
@@ -614,17 +903,36 @@ void d7atp_process_received_packet(packet_t* packet)
         else
         {
             Tl = adjust_timeout_value(Tl, packet->hw_radio_packet.rx_meta.timestamp);
+            dialog->listen_end = timer_get_counter_value() + Tl;
             if (Tl > 0)
             {
-                d7anp_set_foreground_scan_timeout(Tl);
+                dialog->active = true;
+                d7anp_set_foreground_scan_timeout(get_listen_period());
                 d7anp_start_foreground_scan();
             }
         }
 
         switch_state(D7ATP_STATE_SLAVE_TRANSACTION_RECEIVED_REQUEST);
 
+#if MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0
+        dll_update_peer_tx_power(packet, current_addressee.ctrl.id_type, current_addressee.id);
+#endif
+
         current_dialog_id = packet->d7atp_dialog_id;
         current_transaction_id = packet->d7atp_transaction_id;
+        current_slave_dialog = dialog;
+        dialog->active = true;
+        dialog->dialog_id = current_dialog_id;
+
+        // the record is kept over a pause of the dialog, requests which are not acked are followed by requests with START set
+        if (dialog->ack_record_dialog_id != current_dialog_id)
+        {
+            memset(dialog->ack_record, 0, D7ATP_ACK_BITMAP_SIZE);
+            dialog->ack_record_dialog_id = current_dialog_id;
+        }
+
+        if (current_transaction_id < MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT)
+            bitmap_set(dialog->ack_record, current_transaction_id);
 
         // store the received timestamp for later usage (eg CCA). the rx_meta.timestamp can be
         // overwritten since it is stored in a union with tx_meta and can thus be changed when
@@ -632,13 +940,10 @@ void d7atp_process_received_packet(packet_t* packet)
         packet->request_received_timestamp = packet->hw_radio_packet.rx_meta.timestamp;
 
         // set active_addressee_access_profile to the access_profile supplied by the requester
-        if (current_access_class != current_addressee.access_class)
-        {
-            fs_read_access_class(current_addressee.access_specifier, &active_addressee_access_profile);
-            current_access_class = current_addressee.access_class;
-        }
+        load_addressee_access_profile(current_addressee.access_class, current_addressee.access_specifier);
 
-        // DLL is taking care that we respond on the channel where we received the request on
+        // DLL is taking care that we respond on the channel where we received the request on, and holds the response
+        // until the end of the execution delay, the request is processed right away
 
         bool should_send_response = d7asp_process_received_packet(packet, extension);
         if (should_send_response)
@@ -650,7 +955,7 @@ void d7atp_process_received_packet(packet_t* packet)
             send_response(packet);
         }
         else if (Tl == 0)
-            terminate_dialog();
+            end_current_slave_dialog();
     }
 
 }
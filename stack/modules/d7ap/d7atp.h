@@ -28,6 +28,12 @@
 
 #include "session.h"
 #include "dae.h"
+#include "d7anp.h"
+#include "timer.h"
+#include "MODULE_D7AP_defs.h"
+
+/*! \brief The size of the ACK bitmap of an ACK record, which covers the transaction IDs of a FIFO */
+#define D7ATP_ACK_BITMAP_SIZE ((MODULE_D7AP_FIFO_MAX_REQUESTS_COUNT + 7) / 8)
 
 typedef struct packet packet_t;
 
@@ -56,17 +62,29 @@ typedef struct {
 typedef struct {
     uint8_t ack_transaction_id_start;
     uint8_t ack_transaction_id_stop;
-    // TODO ACK bitmap
+    uint8_t ack_bitmap[D7ATP_ACK_BITMAP_SIZE]; /**< Only for an ACK record: bit i is set when transaction ID start + i was received */
 } d7atp_ack_template_t;
 
 void d7atp_init();
 error_t  d7atp_send_request(uint8_t dialog_id, uint8_t transaction_id, bool is_last_transaction,
                         packet_t* packet, session_qos_t* qos_settings, uint8_t listen_timeout, uint8_t expected_response_length);
+
+/*! \brief The response period Tc, in timer ticks, for a request to the addressee expecting a response of the given ALP length
+ *
+ * Tc(NB, LEN, CH) = (SFc * NB + 1) * Ttx(CH, LEN) + Tg, where LEN includes the overhead of the lower layers.
+ */
+timer_tick_t d7atp_calculate_response_period(d7anp_addressee_t* addressee, dae_access_profile_t* access_profile, uint8_t expected_response_length);
 uint8_t d7atp_assemble_packet_header(packet_t* packet, uint8_t* data_ptr);
 bool d7atp_disassemble_packet_header(packet_t* packet, uint8_t* data_idx);
 void d7atp_signal_packet_transmitted(packet_t* packet);
 void d7atp_signal_transmission_failure();
 void d7atp_signal_foreground_scan_expired();
+
+/*! \brief Called for a frame received with an invalid CRC, a sign of colliding responses in a broadcast response period */
+void d7atp_signal_corrupted_frame();
+
+/*! \brief The number of responders expected to a broadcast request, estimated from the responses to the previous one */
+uint8_t d7atp_get_broadcast_population_estimate();
 void d7atp_process_received_packet(packet_t* packet);
 void d7atp_signal_dialog_termination();
 void d7atp_stop_transaction();
@@ -18,6 +18,7 @@
 
 
 #include "log.h"
+#include "trace.h"
 #include "dll.h"
 #include "hwradio.h"
 #include "packet_queue.h"
@@ -32,6 +33,9 @@
 #include "hwatomic.h"
 #include "compress.h"
 #include "fec.h"
+#include "spsc_ring.h"
+#include "rx_capture.h"
+#include "time_sync.h"
 
 #if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_DLL_LOG_ENABLED)
 #define DPRINT(...) log_print_stack_string(LOG_STACK_DLL, __VA_ARGS__)
@@ -42,26 +46,17 @@
 #endif
 
 
-
-typedef enum
-{
-    DLL_STATE_IDLE,
-    DLL_STATE_SCAN_AUTOMATION,
-    DLL_STATE_CSMA_CA_STARTED,
-    DLL_STATE_CSMA_CA_RETRY,
-    DLL_STATE_CCA1,
-    DLL_STATE_CCA2,
-    DLL_STATE_CCA_FAIL,
-    DLL_STATE_FOREGROUND_SCAN,
-    DLL_STATE_TX_FOREGROUND,
-    DLL_STATE_TX_BACKGROUND,
-    DLL_STATE_TX_FOREGROUND_COMPLETED,
-    DLL_STATE_TX_DISCARDED
-} dll_state_t;
-
 static dae_access_profile_t NGDEF(_current_access_profile);
 #define current_access_profile NG(_current_access_profile)
 
+// the access specifier and version of the access profile in current_access_profile, see load_access_profile()
+#define NO_ACCESS_PROFILE 0xFF
+static uint8_t NGDEF(_current_access_profile_specifier);
+#define current_access_profile_specifier NG(_current_access_profile_specifier)
+
+static uint8_t NGDEF(_current_access_profile_version);
+#define current_access_profile_version NG(_current_access_profile_version)
+
 #define NO_ACTIVE_ACCESS_CLASS 0xFF
 static uint8_t NGDEF(_active_access_class);
 #define active_access_class NG(_active_access_class)
@@ -72,25 +67,50 @@ static dll_state_t NGDEF(_dll_state);
 static packet_t* NGDEF(_current_packet);
 #define current_packet NG(_current_packet)
 
-// CSMA-CA parameters
-static int16_t NGDEF(_dll_tca);
-#define dll_tca NG(_dll_tca)
+// a frame waiting for the current CSMA-CA and TX cycle to complete. The access class is captured when the frame is queued,
+// since the addressee of a response is reused by the transport layer for the next received request
+typedef struct
+{
+    packet_t* packet;
+    uint8_t access_class;
+    uint8_t priority;
+} tx_queue_entry_t;
+
+// kept sorted on decreasing priority, frames of the same priority are sent in the order they were queued. The upper
+// layers hand down one frame at a time (the D7ANP transmits until its frame is sent or fails), so besides the forwarded
+// frames at most one of their frames is queued, while the DLL repeats a forwarded frame. The last entry is kept for it
+static tx_queue_entry_t NGDEF(_tx_queue)[MODULE_D7AP_DLL_TX_QUEUE_SIZE];
+#define tx_queue NG(_tx_queue)
+
+static uint8_t NGDEF(_tx_queue_count);
+#define tx_queue_count NG(_tx_queue_count)
 
-static int16_t NGDEF(_dll_to);
-#define dll_to NG(_dll_to)
+// CSMA-CA parameters, the end of Tca and the RIGD slots are kept in absolute time, the CCAs are aligned with them
+static timer_tick_t NGDEF(_csma_ca_deadline); /**< The end of Tca, the last CCA starts before it */
+#define csma_ca_deadline NG(_csma_ca_deadline)
 
-static uint16_t NGDEF(_dll_slot_duration);
+static timer_tick_t NGDEF(_dll_slot_start); /**< The start of the current RIGD slot */
+#define dll_slot_start NG(_dll_slot_start)
+
+static timer_tick_t NGDEF(_dll_slot_duration);
 #define dll_slot_duration NG(_dll_slot_duration)
 
-static uint32_t NGDEF(_dll_cca_started);
+static timer_tick_t NGDEF(_dll_cca_started); /**< The start of the CCA1 of the current attempt */
 #define dll_cca_started NG(_dll_cca_started)
 
+static timer_tick_t NGDEF(_csma_ca_started);
+#define csma_ca_started NG(_csma_ca_started)
+
 static bool NGDEF(_process_received_packets_after_tx);
 #define process_received_packets_after_tx NG(_process_received_packets_after_tx)
 
 static bool NGDEF(_resume_fg_scan);
 #define resume_fg_scan NG(_resume_fg_scan)
 
+// a frame forwarded for the D7ANP interrupted the scan automation, which is not restarted by the upper layers
+static bool NGDEF(_resume_scan_automation);
+#define resume_scan_automation NG(_resume_scan_automation)
+
 static eirp_t NGDEF(_current_eirp);
 #define current_eirp NG(_current_eirp)
 
@@ -103,25 +123,374 @@ static csma_ca_mode_t NGDEF(_csma_ca_mode);
 static uint8_t NGDEF(_tx_nf_method);
 #define tx_nf_method NG(_tx_nf_method)
 
+// Eccao, the offset in dB between the noise floor and the CCA threshold
+static uint8_t NGDEF(_cca_offset);
+#define cca_offset NG(_cca_offset)
+
 static int16_t NGDEF(_E_CCA);
 #define E_CCA NG(_E_CCA)
 
-static uint16_t NGDEF(_tsched);
+static timer_tick_t NGDEF(_tsched);
 #define tsched NG(_tsched)
 
-static bool NGDEF(_guarded_channel);
-#define guarded_channel NG(_guarded_channel)
+// a channel of the selectable subbands of an access profile, with the EIRP and CCA threshold of its subband, and the
+// access class and channel header it was selected for
+typedef struct
+{
+    uint16_t center_freq_index;
+    int8_t eirp;
+    int8_t cca;
+    uint8_t duty; // per-mil, 0 when the subband has no duty cycle limit
+    uint8_t access_class;
+    phy_channel_header_t channel_header;
+} dll_channel_t;
+
+static dll_channel_t NGDEF(_scan_channels)[MODULE_D7AP_DLL_SCAN_CHANNEL_COUNT];
+#define scan_channels NG(_scan_channels)
+
+static uint8_t NGDEF(_scan_channel_count);
+#define scan_channel_count NG(_scan_channel_count)
+
+// number of channels of a foreground scan automation received on by the additional radio instances, channel i being
+// scanned by radio i. All radios hand their frames to the received ring, their interrupts must not preempt each other.
+static uint8_t NGDEF(_secondary_scan_count);
+#define secondary_scan_count NG(_secondary_scan_count)
+
+static uint8_t NGDEF(_scan_channel_index);
+#define scan_channel_index NG(_scan_channel_index)
+
+#if MODULE_D7AP_DLL_SCAN_EXTRA_ACCESS_CLASS_COUNT > 0
+// the access classes scanned besides the active access class, see dll_set_extra_scan_access_classes()
+static uint8_t NGDEF(_extra_scan_access_classes)[MODULE_D7AP_DLL_SCAN_EXTRA_ACCESS_CLASS_COUNT];
+#define extra_scan_access_classes NG(_extra_scan_access_classes)
+
+static uint8_t NGDEF(_extra_scan_access_class_count);
+#define extra_scan_access_class_count NG(_extra_scan_access_class_count)
+#endif
+
+#if MODULE_D7AP_DLL_FG_SCAN_DWELL_TIME > 0
+// the start and length of the last frame the radios allocated a packet for, a hop of the foreground scan would abort it
+static timer_tick_t NGDEF(_rx_frame_start);
+#define rx_frame_start NG(_rx_frame_start)
+
+static uint8_t NGDEF(_rx_frame_length);
+#define rx_frame_length NG(_rx_frame_length)
+#endif
+
+// the period of the background scan events, each event scans the next channel so every channel is scanned once per tsched
+static timer_tick_t NGDEF(_scan_event_period);
+#define scan_event_period NG(_scan_event_period)
+
+// the foreground frame of a background advertising is assembled, see prepare_foreground_frame()
+static bool NGDEF(_foreground_frame_ready);
+#define foreground_frame_ready NG(_foreground_frame_ready)
+
+// the background scans are performed by the radio itself, see start_background_scan_events()
+static bool NGDEF(_background_sniffing);
+#define background_sniffing NG(_background_sniffing)
+
+// the channels on which the current packet can be transmitted, best ranked first
+static dll_channel_t NGDEF(_channel_queue)[MODULE_D7AP_DLL_CHANNEL_QUEUE_SIZE];
+#define channel_queue NG(_channel_queue)
+
+static uint8_t NGDEF(_channel_queue_count);
+#define channel_queue_count NG(_channel_queue_count)
+
+static uint8_t NGDEF(_channel_queue_index);
+#define channel_queue_index NG(_channel_queue_index)
+
+// the recent CCA and background scan RSSI samples of a channel
+typedef struct
+{
+    uint16_t center_freq_index;
+    uint8_t busy_score; // decaying average of the CCA results, from 0 (always clear) to 255 (always busy)
+    int16_t rssi;       // decaying average of the RSSI measured during CCA
+    int16_t noise_floor; // slowly varying average of the RSSI of the idle channel, used by D7ADLL_SLOW_RSSI_VARIATION
+} channel_history_t;
+
+static channel_history_t NGDEF(_channel_history)[MODULE_D7AP_DLL_CHANNEL_HISTORY_SIZE];
+#define channel_history NG(_channel_history)
+
+static uint8_t NGDEF(_channel_history_count);
+#define channel_history_count NG(_channel_history_count)
+
+static uint8_t NGDEF(_channel_history_next);
+#define channel_history_next NG(_channel_history_next)
+
+// a channel guarded for the dialog with one peer, the transmissions to this peer on this channel skip CSMA-CA until it expires
+typedef struct
+{
+    channel_id_t channel_id;
+    id_type_t peer_id_type;
+    uint8_t peer_id[8];
+    timer_tick_t expiration;
+} channel_guard_t;
+
+static channel_guard_t NGDEF(_channel_guards)[MODULE_D7AP_DLL_CHANNEL_GUARD_SIZE];
+#define channel_guards NG(_channel_guards)
+
+#if MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0
+// the link to a peer which reported the RX level it wants to receive at, the frames to it are sent at the EIRP reaching it
+typedef struct
+{
+    id_type_t peer_id_type;
+    uint8_t peer_id[8];
+    int16_t path_loss;          // decaying average of the EIRP of the peer minus the RSSI of its frames, in dB
+    uint8_t target_rx_level;    // -dBm
+    uint8_t boost;              // dB added after the failures, halved by every frame received from the peer
+    timer_tick_t last_heard;
+} peer_tx_power_t;
+
+static peer_tx_power_t NGDEF(_peer_tx_powers)[MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT];
+#define peer_tx_powers NG(_peer_tx_powers)
+
+static uint8_t NGDEF(_peer_tx_power_count);
+#define peer_tx_power_count NG(_peer_tx_power_count)
+#endif
+
+// the background requests of a source are advertised in the scan windows of its followers
+#if MODULE_D7AP_TIME_SYNC_ROLE == TIME_SYNC_ROLE_SOURCE && MODULE_D7AP_TIME_SYNC_SCAN_WINDOW_GUARD > 0
+#define SCAN_WINDOWS_ENABLED
+#define SCAN_WINDOW_GUARD ((timer_tick_t)MODULE_D7AP_TIME_SYNC_SCAN_WINDOW_GUARD * TIMER_TICKS_PER_SEC / 1000)
+#endif
+
+#if MODULE_D7AP_DLL_DUTY_CYCLE_CHANNEL_COUNT > 0
+// the airtime of a channel over the sliding window, accounted in buckets which leave the window one at a time
+#define DUTY_CYCLE_BUCKET_COUNT 8
+#define DUTY_CYCLE_WINDOW ((timer_tick_t)MODULE_D7AP_DLL_DUTY_CYCLE_WINDOW * TIMER_TICKS_PER_SEC)
+#define DUTY_CYCLE_BUCKET_DURATION (DUTY_CYCLE_WINDOW / DUTY_CYCLE_BUCKET_COUNT)
+
+typedef struct
+{
+    uint8_t ch_freq_band;
+    uint16_t center_freq_index;
+    uint8_t current_bucket;
+    timer_tick_t bucket_start; // the start of the current bucket
+    timer_tick_t airtime[DUTY_CYCLE_BUCKET_COUNT];
+} channel_airtime_t;
+
+static channel_airtime_t NGDEF(_channel_airtimes)[MODULE_D7AP_DLL_DUTY_CYCLE_CHANNEL_COUNT];
+#define channel_airtimes NG(_channel_airtimes)
+
+static uint8_t NGDEF(_channel_airtime_count);
+#define channel_airtime_count NG(_channel_airtime_count)
+#endif
+
+static dll_rx_drop_counters_t NGDEF(_rx_drop_counters);
+#define rx_drop_counters NG(_rx_drop_counters)
+
+static dll_link_stats_t NGDEF(_link_stats)[MODULE_D7AP_DLL_LINK_STATS_SIZE];
+#define link_stats NG(_link_stats)
+
+static uint8_t NGDEF(_link_stats_count);
+#define link_stats_count NG(_link_stats_count)
+
+static uint8_t NGDEF(_link_stats_next);
+#define link_stats_next NG(_link_stats_next)
+
+#if MODULE_D7AP_DLL_RX_OVERFLOW_POLICY == DLL_RX_OVERFLOW_PAUSE_BACKGROUND_SCAN
+static bool NGDEF(_background_scan_paused);
+#define background_scan_paused NG(_background_scan_paused)
+#endif
+
+// the radio interrupt callbacks hand the received and transmitted packets to the tasks below through these rings, so the
+// packet queue lists are only modified in task context. One slot is kept free by the ring, hence the extra element.
+static hw_radio_packet_t* NGDEF(_received_ring_buffer)[MODULE_D7AP_PACKET_QUEUE_SIZE + 1];
+#define received_ring_buffer NG(_received_ring_buffer)
+
+static spsc_ring_t NGDEF(_received_ring);
+#define received_ring NG(_received_ring)
+
+static hw_radio_packet_t* NGDEF(_transmitted_ring_buffer)[MODULE_D7AP_PACKET_QUEUE_SIZE + 1];
+#define transmitted_ring_buffer NG(_transmitted_ring_buffer)
+
+static spsc_ring_t NGDEF(_transmitted_ring);
+#define transmitted_ring NG(_transmitted_ring)
+
+// posted from the radio interrupt callbacks by their handles
+static void process_received_packets();
+static void notify_transmitted_packet();
+SCHED_REGISTER_TASK(process_received_packets);
+SCHED_REGISTER_TASK(notify_transmitted_packet);
 
 static void execute_cca();
 static void execute_csma_ca();
 static void start_foreground_scan();
+void start_background_scan();
+static void hop_foreground_scan();
 static void packet_received(hw_radio_packet_t* hw_radio_packet);
+static void refine_rx_timestamp(hw_radio_packet_t* hw_radio_packet);
 
 static hw_radio_packet_t* alloc_new_packet(uint8_t length)
 {
-    // note we don't use length because in the current implementation the packets in the queue are of
-    // fixed (maximum) size
-    return &(packet_queue_alloc_packet()->hw_radio_packet);
+    packet_t* packet = packet_queue_alloc_packet(length);
+    if (packet == NULL)
+    {
+        // all buffers are in use, the radio driver discards the frame when we return NULL
+#if MODULE_D7AP_DLL_RX_OVERFLOW_POLICY == DLL_RX_OVERFLOW_DROP_LOWEST_RSSI
+        packet = packet_queue_reclaim_lowest_rssi_received_packet(length);
+        if (packet != NULL)
+        {
+            rx_drop_counters.evicted++;
+            return &(packet->hw_radio_packet);
+        }
+#elif MODULE_D7AP_DLL_RX_OVERFLOW_POLICY == DLL_RX_OVERFLOW_PAUSE_BACKGROUND_SCAN
+        if (dll_state == DLL_STATE_SCAN_AUTOMATION && tsched > 0 && !background_scan_paused)
+        {
+            // resumed by process_received_packets() once the received packets are handled
+            timer_cancel_task(&start_background_scan);
+            background_scan_paused = true;
+        }
+#endif
+        rx_drop_counters.no_buffer++;
+        return NULL;
+    }
+
+#if MODULE_D7AP_DLL_FG_SCAN_DWELL_TIME > 0
+    rx_frame_start = timer_get_counter_value();
+    rx_frame_length = length;
+#endif
+    return &(packet->hw_radio_packet);
+}
+
+// the access class of the scan channel, the active access class when the channel is not scanned
+static uint8_t get_scan_access_class(const channel_id_t* channel_id)
+{
+    for(uint8_t i = 0; i < scan_channel_count; i++)
+    {
+        if (scan_channels[i].center_freq_index == channel_id->center_freq_index
+            && scan_channels[i].channel_header.ch_class == channel_id->channel_header.ch_class
+            && scan_channels[i].channel_header.ch_coding == channel_id->channel_header.ch_coding
+            && scan_channels[i].channel_header.ch_freq_band == channel_id->channel_header.ch_freq_band)
+            return scan_channels[i].access_class;
+    }
+
+    return active_access_class;
+}
+
+static dll_link_stats_t* find_link_stats(uint8_t access_class, const channel_id_t* channel_id)
+{
+    for(uint8_t i = 0; i < link_stats_count; i++)
+    {
+        if (link_stats[i].access_class == access_class && hw_radio_channel_ids_equal(&link_stats[i].channel_id, channel_id))
+            return &link_stats[i];
+    }
+
+    return NULL;
+}
+
+// returns the statistics of the (access class, channel) pair, a full table replaces its entries in a round-robin way.
+// Only called from task context, the counters updated from interrupt context only use find_link_stats()
+static dll_link_stats_t* get_link_stats(uint8_t access_class, const channel_id_t* channel_id)
+{
+    dll_link_stats_t* stats = find_link_stats(access_class, channel_id);
+    if (stats != NULL)
+        return stats;
+
+    if (link_stats_count < MODULE_D7AP_DLL_LINK_STATS_SIZE)
+        stats = &link_stats[link_stats_count++];
+    else
+    {
+        stats = &link_stats[link_stats_next];
+        link_stats_next = (link_stats_next + 1) % MODULE_D7AP_DLL_LINK_STATS_SIZE;
+    }
+
+    start_atomic();
+    *stats = (dll_link_stats_t){
+        .access_class = access_class,
+        .channel_id = *channel_id
+    };
+    end_atomic();
+    return stats;
+}
+
+// the TX statistics are accounted to the access class of the frame and the channel it is sent on
+static dll_link_stats_t* get_tx_link_stats()
+{
+    return get_link_stats(current_packet->dll_header.subnet, &current_channel_id);
+}
+
+static void account_backoff_time()
+{
+    get_tx_link_stats()->backoff_time += timer_get_counter_value() - csma_ca_started;
+}
+
+static bool reject_frame_header()
+{
+    rx_drop_counters.filtered++;
+
+    dll_link_stats_t* stats = find_link_stats(get_scan_access_class(&current_channel_id), &current_channel_id);
+    if (stats != NULL)
+        stats->rx_filtered++;
+
+    return false;
+}
+
+void dll_count_received_frame(const packet_t* packet, bool crc_valid)
+{
+    dll_link_stats_t* stats = get_link_stats(get_scan_access_class(&packet->hw_radio_packet.rx_meta.rx_cfg.channel_id),
+                                             &packet->hw_radio_packet.rx_meta.rx_cfg.channel_id);
+    if (crc_valid)
+        stats->rx_good++;
+    else
+        stats->rx_bad_crc++;
+}
+
+// the subnet matches when its specifier is the wildcard or the one of the access class,
+// and its mask selects at least one subprofile of the access class
+static bool subnet_matches_access_class(uint8_t subnet, uint8_t access_class)
+{
+    uint8_t FSS = ACCESS_SPECIFIER(subnet);
+    if ((FSS != 0x0F) && (FSS != ACCESS_SPECIFIER(access_class)))
+        return false;
+
+    return (ACCESS_MASK(subnet) & ACCESS_MASK(access_class)) != 0;
+}
+
+// matches the active access class, or one of the extra access classes scanned
+static bool subnet_matches(uint8_t subnet)
+{
+    if (subnet_matches_access_class(subnet, active_access_class))
+        return true;
+
+#if MODULE_D7AP_DLL_SCAN_EXTRA_ACCESS_CLASS_COUNT > 0
+    for (uint8_t i = 0; i < extra_scan_access_class_count; i++)
+    {
+        if (subnet_matches_access_class(subnet, extra_scan_access_classes[i]))
+            return true;
+    }
+#endif
+
+    return false;
+}
+
+// Rejects the foreground frames dll_disassemble_packet_header() would skip, on their first bytes. This is called by the
+// radio driver from interrupt context, before a packet buffer is allocated and before any CRC or FEC processing.
+static bool filter_frame_header(uint8_t const* header, uint8_t length)
+{
+    // the length excludes the length byte itself, the shortest frame contains a subnet, a control byte and the CRC
+    if (header[0] < 4)
+        return reject_frame_header();
+
+    if (length < 2)
+        return true;
+
+    if (!subnet_matches(header[1]))
+        return reject_frame_header();
+
+    if (length < 4)
+        return true;
+
+    // only the first byte of the target address is available yet
+    uint8_t id_type = header[2] >> 6;
+    if (!ID_TYPE_IS_BROADCAST(id_type))
+    {
+        const fs_identity_t* identity = fs_get_identity();
+        if (header[3] != (id_type == ID_TYPE_UID ? identity->uid[0] : identity->vid[0]))
+            return reject_frame_header();
+    }
+
+    return true;
 }
 
 static void release_packet(hw_radio_packet_t* hw_radio_packet)
@@ -131,6 +500,8 @@ static void release_packet(hw_radio_packet_t* hw_radio_packet)
 
 static void switch_state(dll_state_t next_state)
 {
+    trace_record(LOG_STACK_DLL, TRACE_EVENT_STATE, current_packet ? current_packet->d7atp_dialog_id : 0,
+                 current_packet ? current_packet->d7atp_transaction_id : 0, dll_state, next_state);
     switch(next_state)
     {
     case DLL_STATE_CSMA_CA_STARTED:
@@ -216,6 +587,7 @@ static void switch_state(dll_state_t next_state)
         assert(false);
     }
 
+#ifndef FRAMEWORK_DEBUG_PROBES_ENABLED
     // output state on debug pins
     switch(dll_state)
     {
@@ -229,6 +601,7 @@ static void switch_state(dll_state_t next_state)
         default:
           DEBUG_PIN_CLR(2);
     }
+#endif
 }
 
 static bool is_tx_busy()
@@ -248,36 +621,771 @@ static bool is_tx_busy()
     }
 }
 
-void guard_period_expiration()
+static bool is_guard_expired(const channel_guard_t* guard, timer_tick_t now)
+{
+    return (int32_t)(guard->expiration - now) <= 0;
+}
+
+static channel_guard_t* find_channel_guard(const channel_id_t* channel_id, id_type_t peer_id_type, const uint8_t* peer_id)
+{
+    for(uint8_t i = 0; i < MODULE_D7AP_DLL_CHANNEL_GUARD_SIZE; i++)
+    {
+        channel_guard_t* guard = &channel_guards[i];
+        if (guard->peer_id_type == peer_id_type && hw_radio_channel_ids_equal(&guard->channel_id, channel_id)
+            && memcmp(guard->peer_id, peer_id, d7anp_addressee_id_length(peer_id_type)) == 0)
+            return guard;
+    }
+
+    return NULL;
+}
+
+/*
+ * Guards the channel for the dialog with the peer, starting at the end of a transmission of tx_duration. If the
+ * transmission duration is greater than or equal to the Guard Interval TG, the channel guard period is extended by TG
+ * following the transmission. A full table replaces the guard which expires first.
+ */
+static void guard_channel(const channel_id_t* channel_id, id_type_t peer_id_type, const uint8_t* peer_id,
+                          timer_tick_t end_of_tx, uint16_t tx_duration)
+{
+    channel_guard_t* guard = find_channel_guard(channel_id, peer_id_type, peer_id);
+    if (guard == NULL)
+    {
+        timer_tick_t now = timer_get_counter_value();
+        guard = &channel_guards[0];
+        for(uint8_t i = 1; i < MODULE_D7AP_DLL_CHANNEL_GUARD_SIZE && !is_guard_expired(guard, now); i++)
+        {
+            if (is_guard_expired(&channel_guards[i], now) || (int32_t)(channel_guards[i].expiration - guard->expiration) < 0)
+                guard = &channel_guards[i];
+        }
+
+        guard->channel_id = *channel_id;
+        guard->peer_id_type = peer_id_type;
+        memset(guard->peer_id, 0, sizeof(guard->peer_id));
+        memcpy(guard->peer_id, peer_id, d7anp_addressee_id_length(peer_id_type));
+    }
+
+    guard->expiration = end_of_tx + (tx_duration >= t_g ? t_g : t_g - tx_duration);
+    DPRINT("Channel %i guarded for the peer until %i", channel_id->center_freq_index, guard->expiration);
+}
+
+static bool is_channel_guarded(const channel_id_t* channel_id, id_type_t peer_id_type, const uint8_t* peer_id)
+{
+    channel_guard_t* guard = find_channel_guard(channel_id, peer_id_type, peer_id);
+    return guard != NULL && !is_guard_expired(guard, timer_get_counter_value());
+}
+
+void dll_guard_received_channel(packet_t* packet)
+{
+    const hw_rx_metadata_t* rx_meta = &packet->hw_radio_packet.rx_meta;
+    uint16_t tx_duration = dll_calculate_tx_duration(rx_meta->rx_cfg.channel_id.channel_header.ch_class,
+                                                     rx_meta->rx_cfg.channel_id.channel_header.ch_coding,
+                                                     packet->hw_radio_packet.length + 1);
+
+    guard_channel(&rx_meta->rx_cfg.channel_id, packet->d7anp_ctrl.origin_id_type, packet->origin_access_id,
+                  rx_meta->timestamp, tx_duration);
+}
+
+#if MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0
+static peer_tx_power_t* find_peer_tx_power(id_type_t peer_id_type, const uint8_t* peer_id)
+{
+    if (ID_TYPE_IS_BROADCAST(peer_id_type))
+        return NULL;
+
+    for(uint8_t i = 0; i < peer_tx_power_count; i++)
+    {
+        if (peer_tx_powers[i].peer_id_type == peer_id_type
+            && memcmp(peer_tx_powers[i].peer_id, peer_id, d7anp_addressee_id_length(peer_id_type)) == 0)
+            return &peer_tx_powers[i];
+    }
+
+    return NULL;
+}
+
+void dll_update_peer_tx_power(const packet_t* packet, id_type_t peer_id_type, const uint8_t* peer_id)
+{
+    if (ID_TYPE_IS_BROADCAST(peer_id_type) || !packet->d7atp_ctrl.ctrl_agc)
+        return;
+
+    int16_t path_loss = (packet->dll_header.control_eirp_index - 32) - packet->hw_radio_packet.rx_meta.rssi;
+    peer_tx_power_t* peer = find_peer_tx_power(peer_id_type, peer_id);
+    if (peer == NULL)
+    {
+        // a full table replaces the peer heard least recently
+        if (peer_tx_power_count < MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT)
+            peer = &peer_tx_powers[peer_tx_power_count++];
+        else
+        {
+            peer = &peer_tx_powers[0];
+            for(uint8_t i = 1; i < peer_tx_power_count; i++)
+            {
+                if ((int32_t)(peer_tx_powers[i].last_heard - peer->last_heard) < 0)
+                    peer = &peer_tx_powers[i];
+            }
+        }
+
+        peer->peer_id_type = peer_id_type;
+        memset(peer->peer_id, 0, sizeof(peer->peer_id));
+        memcpy(peer->peer_id, peer_id, d7anp_addressee_id_length(peer_id_type));
+        peer->path_loss = path_loss;
+        peer->boost = 0;
+    }
+    else
+    {
+        peer->path_loss = (3 * peer->path_loss + path_loss) / 4;
+        peer->boost /= 2;
+    }
+
+    peer->target_rx_level = packet->d7atp_target_rx_level_i;
+    peer->last_heard = timer_get_counter_value();
+    DPRINT("Peer path loss %i dB, target RX level -%i dBm", peer->path_loss, peer->target_rx_level);
+}
+
+void dll_signal_peer_tx_failure(id_type_t peer_id_type, const uint8_t* peer_id)
 {
-    guarded_channel = false;
-    DPRINT("Channel guarding period is terminated, Tx is now conditioned by CSMA");
+    peer_tx_power_t* peer = find_peer_tx_power(peer_id_type, peer_id);
+    if (peer == NULL)
+        return;
+
+    if (peer->boost <= UINT8_MAX - MODULE_D7AP_DLL_TX_POWER_CONTROL_MARGIN)
+        peer->boost += MODULE_D7AP_DLL_TX_POWER_CONTROL_MARGIN;
+}
+
+// the lowest EIRP, up to the allowed one, at which the frame reaches the peer at its target RX level with the margin
+static int8_t get_peer_eirp(const packet_t* packet, int8_t allowed_eirp)
+{
+    // the hopping frames are received by the relays, their RX level at the peer does not matter
+    if (packet->d7anp_addressee == NULL || packet->d7anp_ctrl.hop_enabled)
+        return allowed_eirp;
+
+    peer_tx_power_t* peer = find_peer_tx_power(packet->d7anp_addressee->ctrl.id_type, packet->d7anp_addressee->id);
+    if (peer == NULL)
+        return allowed_eirp;
+
+    int16_t eirp = peer->path_loss - peer->target_rx_level + MODULE_D7AP_DLL_TX_POWER_CONTROL_MARGIN + peer->boost;
+    if (eirp > allowed_eirp)
+        return allowed_eirp;
+
+    if (eirp < -32)
+        return -32; // the lowest EIRP index
+
+    DPRINT("EIRP %i dBm instead of %i dBm for the peer", eirp, allowed_eirp);
+    return eirp;
+}
+#else
+#define get_peer_eirp(packet, allowed_eirp) (allowed_eirp)
+#endif
+
+static void add_channel(dll_channel_t* channels, uint8_t* count, uint8_t max_count, const dae_access_profile_t* profile,
+                        uint8_t access_class, uint16_t center_freq_index, const subband_t* subband)
+{
+    for(uint8_t i = 0; i < *count; i++)
+    {
+        if (channels[i].center_freq_index == center_freq_index
+            && channels[i].channel_header.ch_class == profile->channel_header.ch_class
+            && channels[i].channel_header.ch_coding == profile->channel_header.ch_coding
+            && channels[i].channel_header.ch_freq_band == profile->channel_header.ch_freq_band)
+            return; // the subbands of different subprofiles can overlap
+    }
+
+    if (*count == max_count)
+    {
+        log_stack_warning(LOG_STACK_DLL, "Channel list full, skipping channel %i", center_freq_index);
+        return;
+    }
+
+    channels[*count] = (dll_channel_t){
+        .center_freq_index = center_freq_index,
+        .eirp = subband->eirp,
+        .cca = subband->cca,
+        .duty = subband->duty,
+        .access_class = access_class,
+        .channel_header = profile->channel_header
+    };
+    (*count)++;
+}
+
+// adds the channels of the subbands of the subprofiles of the access profile selected by the mask of the access class
+static void build_channel_list(const dae_access_profile_t* profile, uint8_t access_class, dll_channel_t* channels,
+                               uint8_t* count, uint8_t max_count)
+{
+    // the channels of the normal and hi rate classes are spaced 8 center frequency indexes apart
+    uint8_t spacing = profile->channel_header.ch_class == PHY_CLASS_LO_RATE? 1 : 8;
+
+    for(uint8_t i = 0; i < SUBPROFILES_NB; i++)
+    {
+        if (!(ACCESS_MASK(access_class) & (0x01 << i)))
+            continue;
+
+        for(uint8_t j = 0; j < SUBBANDS_NB; j++)
+        {
+            if (!(profile->subprofiles[i].subband_bitmap & (0x01 << j)))
+                continue;
+
+            const subband_t* subband = &profile->subbands[j];
+            uint32_t index = subband->channel_index_start;
+            do
+            {
+                add_channel(channels, count, max_count, profile, access_class, index, subband);
+                index += spacing;
+            } while (index <= subband->channel_index_end);
+        }
+    }
+}
+
+// The Scan Automation TSCHED is obtained as the minimum of all selected subprofiles' TSCHED, ~0 without any
+static timer_tick_t get_scan_automation_period(const dae_access_profile_t* profile, uint8_t access_class)
+{
+    timer_tick_t period = (timer_tick_t)~0;
+    for(uint8_t i = 0; i < SUBPROFILES_NB; i++)
+    {
+        // Only consider the selectable subprofiles (having their Access Mask bits set to 1 and having non-void subband bitmaps)
+        if ((ACCESS_MASK(access_class) & (0x01 << i)) && profile->subprofiles[i].subband_bitmap)
+        {
+            timer_tick_t scan_period = CT_DECOMPRESS_TO_TICKS(profile->subprofiles[i].scan_automation_period);
+            if (scan_period < period)
+                period = scan_period;
+        }
+    }
+
+    return period;
+}
+
+
+static channel_history_t* find_channel_history(uint16_t center_freq_index)
+{
+    for(uint8_t i = 0; i < channel_history_count; i++)
+    {
+        if (channel_history[i].center_freq_index == center_freq_index)
+            return &channel_history[i];
+    }
+
+    return NULL;
+}
+
+static void update_channel_history(uint16_t center_freq_index, int16_t rssi, bool busy)
+{
+    // the RSSI noise and the time of the samples differ between nodes and boots, unlike the seed of the RNG
+    add_rng_entropy(((uint32_t)(uint16_t) rssi << 16) ^ timer_get_counter_value());
+
+    channel_history_t* history = find_channel_history(center_freq_index);
+    if (history == NULL)
+    {
+        // replace the oldest entry when the history is full
+        history = &channel_history[channel_history_next];
+        channel_history_next = (channel_history_next + 1) % MODULE_D7AP_DLL_CHANNEL_HISTORY_SIZE;
+        if (channel_history_count < MODULE_D7AP_DLL_CHANNEL_HISTORY_SIZE)
+            channel_history_count++;
+
+        // a busy sample is a signal, not noise: start from the threshold used to judge it
+        *history = (channel_history_t){
+            .center_freq_index = center_freq_index,
+            .busy_score = busy? 255 : 0,
+            .rssi = rssi,
+            .noise_floor = busy? E_CCA - cca_offset : rssi
+        };
+        return;
+    }
+
+    history->busy_score = (3 * history->busy_score + (busy? 255 : 0)) / 4;
+    history->rssi = (3 * history->rssi + rssi) / 4;
+
+    // The idle samples are averaged into the noise floor. Busy samples only raise it by 1 dB, so the
+    // frames of other nodes hardly move it while a persistent interferer is absorbed into the floor over time
+    if (!busy)
+        history->noise_floor = (7 * history->noise_floor + rssi) / 8;
+    else if (rssi > history->noise_floor)
+        history->noise_floor++;
+}
+
+// returns Ecca = NF + Eccao for the channel. Until a channel is sampled, or when using D7ADLL_FIXED_NOISE_FLOOR,
+// the default CCA threshold of its subband is used as Ecca
+static int16_t get_cca_threshold(const dll_channel_t* channel)
+{
+    if (tx_nf_method == D7ADLL_SLOW_RSSI_VARIATION)
+    {
+        channel_history_t* history = find_channel_history(channel->center_freq_index);
+        if (history != NULL)
+            return history->noise_floor + cca_offset;
+    }
+
+    return channel->cca;
+}
+
+// a lower rank is better: the channels which were found busy least are preferred, then the quietest channels.
+// Channels without history are tried first, to learn about them.
+static int16_t get_channel_rank(uint16_t center_freq_index)
+{
+    channel_history_t* history = find_channel_history(center_freq_index);
+    if (history == NULL)
+        return INT16_MIN;
+
+    return (history->busy_score >> 5) * 512 + history->rssi;
+}
+
+static void select_queued_channel(packet_t* packet, uint8_t index)
+{
+    channel_queue_index = index;
+    current_channel_id.center_freq_index = channel_queue[index].center_freq_index;
+    packet->hw_radio_packet.tx_meta.tx_cfg.channel_id = current_channel_id;
+
+    E_CCA = get_cca_threshold(&channel_queue[index]);
+    DPRINT("Selected channel %i of the channel queue, E_CCA %i", current_channel_id.center_freq_index, E_CCA);
+}
+
+// fills the channel queue with the selectable channels of the addressee's access class, ranked by their CCA history.
+// The channels are shuffled first, so the channels with the same rank are used in turn by the nodes of a cell.
+static void build_channel_queue(uint8_t access_class)
+{
+    channel_queue_count = 0;
+    build_channel_list(&current_access_profile, access_class, channel_queue, &channel_queue_count,
+                       MODULE_D7AP_DLL_CHANNEL_QUEUE_SIZE);
+    // without any selectable subprofile, as in the access profiles with a void subband bitmap which only disable the
+    // scan automation, the first channel of the first subband is used
+    if (channel_queue_count == 0)
+        add_channel(channel_queue, &channel_queue_count, MODULE_D7AP_DLL_CHANNEL_QUEUE_SIZE, &current_access_profile,
+                    access_class, current_access_profile.subbands[0].channel_index_start, &current_access_profile.subbands[0]);
+
+    for(uint8_t i = channel_queue_count - 1; i > 0; i--)
+    {
+        uint8_t j = get_rnd() % (i + 1);
+        dll_channel_t channel = channel_queue[i];
+        channel_queue[i] = channel_queue[j];
+        channel_queue[j] = channel;
+    }
+
+    // stable insertion sort on rank, the queue is short
+    for(uint8_t i = 1; i < channel_queue_count; i++)
+    {
+        dll_channel_t channel = channel_queue[i];
+        int16_t rank = get_channel_rank(channel.center_freq_index);
+        uint8_t j = i;
+        while (j > 0 && get_channel_rank(channel_queue[j - 1].center_freq_index) > rank)
+        {
+            channel_queue[j] = channel_queue[j - 1];
+            j--;
+        }
+
+        channel_queue[j] = channel;
+    }
+}
+
+// moves to the next channel of the queue after a CCA failure. Returns false when all channels were tried,
+// the queue then restarts at the first channel
+static bool shift_channel_queue()
+{
+    if (channel_queue_count <= 1)
+        return false;
+
+    uint8_t index = channel_queue_index + 1;
+    if (index == channel_queue_count)
+        index = 0;
+
+    select_queued_channel(current_packet, index);
+    return index != 0;
+}
+
+#if MODULE_D7AP_DLL_DUTY_CYCLE_CHANNEL_COUNT > 0
+// drops the buckets which left the window, the timestamps are compared by their difference so the counter may wrap
+static void advance_channel_airtime(channel_airtime_t* channel, timer_tick_t now)
+{
+    timer_tick_t elapsed_buckets = (now - channel->bucket_start) / DUTY_CYCLE_BUCKET_DURATION;
+    if (elapsed_buckets >= DUTY_CYCLE_BUCKET_COUNT)
+    {
+        memset(channel->airtime, 0, sizeof(channel->airtime));
+        channel->current_bucket = 0;
+        channel->bucket_start = now;
+        return;
+    }
+
+    for (timer_tick_t i = 0; i < elapsed_buckets; i++)
+    {
+        channel->current_bucket = (channel->current_bucket + 1) % DUTY_CYCLE_BUCKET_COUNT;
+        channel->airtime[channel->current_bucket] = 0;
+    }
+
+    channel->bucket_start += elapsed_buckets * DUTY_CYCLE_BUCKET_DURATION;
+}
+
+static channel_airtime_t* find_channel_airtime(const channel_id_t* channel_id)
+{
+    for (uint8_t i = 0; i < channel_airtime_count; i++)
+    {
+        if (channel_airtimes[i].ch_freq_band == channel_id->channel_header.ch_freq_band
+            && channel_airtimes[i].center_freq_index == channel_id->center_freq_index)
+            return &channel_airtimes[i];
+    }
+
+    return NULL;
+}
+
+static timer_tick_t get_window_airtime(const channel_airtime_t* channel)
+{
+    timer_tick_t airtime = 0;
+    for (uint8_t i = 0; i < DUTY_CYCLE_BUCKET_COUNT; i++)
+        airtime += channel->airtime[i];
+
+    return airtime;
+}
+
+// a full table replaces the channel with the least airtime in the window, which is the least likely to be limited
+static void account_airtime(const channel_id_t* channel_id, timer_tick_t airtime)
+{
+    timer_tick_t now = timer_get_counter_value();
+    channel_airtime_t* channel = find_channel_airtime(channel_id);
+    if (channel == NULL)
+    {
+        if (channel_airtime_count < MODULE_D7AP_DLL_DUTY_CYCLE_CHANNEL_COUNT)
+            channel = &channel_airtimes[channel_airtime_count++];
+        else
+        {
+            channel = &channel_airtimes[0];
+            for (uint8_t i = 0; i < MODULE_D7AP_DLL_DUTY_CYCLE_CHANNEL_COUNT; i++)
+            {
+                advance_channel_airtime(&channel_airtimes[i], now);
+                if (get_window_airtime(&channel_airtimes[i]) < get_window_airtime(channel))
+                    channel = &channel_airtimes[i];
+            }
+        }
+
+        *channel = (channel_airtime_t){
+            .ch_freq_band = channel_id->channel_header.ch_freq_band,
+            .center_freq_index = channel_id->center_freq_index,
+            .bucket_start = now
+        };
+    }
+
+    advance_channel_airtime(channel, now);
+    channel->airtime[channel->current_bucket] += airtime;
+}
+
+// the delay until the airtime fits the duty cycle of the channel next to the airtime already in the window, 0 when it
+// fits now. Airtime longer than the budget of the whole window waits until the window is empty
+static timer_tick_t get_duty_cycle_delay(const dll_channel_t* channel, timer_tick_t airtime)
+{
+    if (channel->duty == 0)
+        return 0;
+
+    channel_id_t channel_id = { .channel_header = channel->channel_header, .center_freq_index = channel->center_freq_index };
+    channel_airtime_t* channel_airtime = find_channel_airtime(&channel_id);
+    if (channel_airtime == NULL)
+        return 0;
+
+    timer_tick_t now = timer_get_counter_value();
+    advance_channel_airtime(channel_airtime, now);
+    timer_tick_t budget = (uint64_t)DUTY_CYCLE_WINDOW * channel->duty / 1000;
+    timer_tick_t used = get_window_airtime(channel_airtime);
+    if (used + airtime <= budget)
+        return 0;
+
+    // the oldest bucket leaves the window at the end of the current bucket, the next ones a bucket later each
+    for (uint8_t i = 1; i <= DUTY_CYCLE_BUCKET_COUNT; i++)
+    {
+        used -= channel_airtime->airtime[(channel_airtime->current_bucket + i) % DUTY_CYCLE_BUCKET_COUNT];
+        if (used + airtime <= budget || i == DUTY_CYCLE_BUCKET_COUNT)
+            return channel_airtime->bucket_start + i * DUTY_CYCLE_BUCKET_DURATION - now;
+    }
+
+    return 0;
+}
+
+/*
+ * Keeps only the channels of the queue on which the airtime of the frame fits the duty cycle of their subband, so the
+ * CCA retries do not move to a channel over its budget. When none fits, the frame waits for the channel which frees
+ * first: the delay until then is returned.
+ */
+static timer_tick_t schedule_duty_cycle(packet_t* packet)
+{
+    timer_tick_t airtime = packet->tx_duration;
+    if (packet->type == BACKGROUND_ADV)
+        airtime += packet->ETA;
+
+    uint8_t count = 0;
+    uint8_t earliest = 0;
+    timer_tick_t earliest_delay = UINT32_MAX;
+    for (uint8_t i = 0; i < channel_queue_count; i++)
+    {
+        timer_tick_t delay = get_duty_cycle_delay(&channel_queue[i], airtime);
+        if (delay == 0)
+            channel_queue[count++] = channel_queue[i];
+        else if (delay < earliest_delay)
+        {
+            earliest = i;
+            earliest_delay = delay;
+        }
+    }
+
+    if (count == 0)
+    {
+        channel_queue[0] = channel_queue[earliest];
+        count = 1;
+    }
+    else
+        earliest_delay = 0;
+
+    channel_queue_count = count;
+    select_queued_channel(packet, 0);
+    return earliest_delay;
+}
+#endif
+
+#ifdef SCAN_WINDOWS_ENABLED
+/*
+ * The followers which scan the access class start a scan event at every multiple of their scan event period in network
+ * time, on the channel of the scan channel list selected by the event (see start_background_scan()). Returns the next
+ * scan of the channel at least lead ticks from now, false when the followers do not scan it. The network time wraps with
+ * the framework timer, a scan across the wrap is missed and the request is retried.
+ */
+static bool get_next_scan_window(uint8_t access_class, const channel_id_t* channel_id, timer_tick_t lead, timer_tick_t* window)
+{
+    timer_tick_t scan_tsched = get_scan_automation_period(&current_access_profile, access_class);
+    if (scan_tsched == 0 || scan_tsched == (timer_tick_t)~0)
+        return false;
+
+    dll_channel_t channels[MODULE_D7AP_DLL_SCAN_CHANNEL_COUNT];
+    uint8_t count = 0;
+    build_channel_list(&current_access_profile, access_class, channels, &count, MODULE_D7AP_DLL_SCAN_CHANNEL_COUNT);
+
+    uint8_t index = 0;
+    while (index < count && channels[index].center_freq_index != channel_id->center_freq_index)
+        index++;
+
+    if (index == count)
+        return false;
+
+    timer_tick_t period = scan_tsched / count;
+    if (period == 0)
+        period = 1;
+
+    // the first event after the lead, then the next event which scans the channel
+    timer_tick_t earliest = timer_get_counter_value() + lead;
+    timer_tick_t network_time = time_sync_to_network_time(earliest);
+    uint64_t event = ((uint64_t)network_time + period - 1) / period;
+    event += (index + count - event % count) % count;
+
+    *window = earliest + (timer_tick_t)(event * period - network_time);
+    return true;
+}
+
+// the advertising of a background request only covers the next scan of the followers after delay, plus the guard
+// before and after it. The CSMA-CA starts Tc before that, the delay until then is returned
+static timer_tick_t schedule_scan_window(packet_t* packet, timer_tick_t delay)
+{
+    timer_tick_t tc = (SFc + 1) * packet->tx_duration + t_g;
+    timer_tick_t lead = SCAN_WINDOW_GUARD + tc;
+    timer_tick_t eta = 2 * SCAN_WINDOW_GUARD + tc + packet->tx_duration;
+    timer_tick_t window;
+    if (eta >= packet->ETA
+        || !get_next_scan_window(packet->dll_header.subnet, &packet->hw_radio_packet.tx_meta.tx_cfg.channel_id,
+                                 delay + lead, &window))
+        return delay;
+
+    // the CCA retries stay on the channel of the window
+    packet->ETA = eta;
+    channel_queue_count = 1;
+    delay = window - lead - timer_get_counter_value();
+    DPRINT("Advertising in the scan window of channel %i in %i ticks",
+           packet->hw_radio_packet.tx_meta.tx_cfg.channel_id.center_freq_index, delay);
+    return delay;
+}
+#endif
+
+static dll_channel_t* next_scan_channel()
+{
+    scan_channel_index++;
+    if (scan_channel_index >= scan_channel_count)
+        scan_channel_index = 0;
+
+    current_channel_id.channel_header = scan_channels[scan_channel_index].channel_header;
+    current_channel_id.center_freq_index = scan_channels[scan_channel_index].center_freq_index;
+    return &scan_channels[scan_channel_index];
 }
 
 void start_background_scan()
 {
-    // Start a new tsched timer
-    assert(timer_post_task_delay(&start_background_scan, tsched) == SUCCESS);
+#if MODULE_D7AP_TIME_SYNC_ROLE > 0
+    // the synchronized nodes scan the channel of the event in network time, the sources know which one it is
+    if (scan_channel_count > 1 && time_sync_is_synchronized())
+    {
+        uint32_t event = (time_sync_get_network_time() + scan_event_period / 2) / scan_event_period;
+        scan_channel_index = (event + scan_channel_count - 1) % scan_channel_count;
+    }
+#endif
+
+    // the next scan is scheduled by the periodic scan event timer
+    dll_channel_t* channel = next_scan_channel();
+    E_CCA = get_cca_threshold(channel);
 
     hw_rx_cfg_t rx_cfg = {
         .channel_id = current_channel_id,
         .syncword_class = PHY_SYNCWORD_CLASS0,
        };
 
-    hw_radio_start_background_scan(&rx_cfg, &packet_received, E_CCA);
+    // the scan terminates right away with FAIL when no signal is detected, the radio then reports the RSSI it sampled,
+    // an idle channel sample (see hw_radio_start_background_scan())
+    if (hw_radio_start_background_scan(&rx_cfg, &packet_received, E_CCA) == FAIL)
+    {
+        int16_t rssi = hw_radio_get_rssi();
+        if (rssi != HW_RSSI_INVALID)
+            update_channel_history(current_channel_id.center_freq_index, rssi, false);
+    }
 }
 
-void dll_stop_background_scan()
+static void hop_foreground_scan()
 {
-    assert(dll_state == DLL_STATE_SCAN_AUTOMATION);
+#if MODULE_D7AP_DLL_FG_SCAN_DWELL_TIME > 0
+    // a frame being received would be aborted, the scan stays on the channel for another dwell time then. This keeps
+    // the long frames of the lo rate class from being cut more often than the others
+    start_atomic();
+    timer_tick_t frame_end = rx_frame_start + dll_calculate_tx_duration(current_channel_id.channel_header.ch_class,
+                                                                        current_channel_id.channel_header.ch_coding,
+                                                                        rx_frame_length);
+    end_atomic();
+    if ((int32_t)(frame_end - timer_get_counter_value()) > 0)
+        return;
+#endif
+
+    // the next hop is scheduled by the periodic dwell time timer, the channels of the additional radios are skipped
+    do
+        next_scan_channel();
+    while (scan_channel_index != 0 && scan_channel_index <= secondary_scan_count);
+    DPRINT("FG scan autom on channel %i", current_channel_id.center_freq_index);
+
+    hw_rx_cfg_t rx_cfg = {
+        .channel_id = current_channel_id,
+        .syncword_class = PHY_SYNCWORD_CLASS1,
+    };
 
+    hw_radio_set_rx(&rx_cfg, &packet_received, NULL);
+}
+
+static void start_secondary_scans()
+{
+    const hw_radio_t* radio;
+    while (secondary_scan_count + 1 < scan_channel_count
+           && (radio = hw_radio_get_instance(secondary_scan_count + 1)) != NULL)
+    {
+        secondary_scan_count++;
+        hw_rx_cfg_t rx_cfg = {
+            .channel_id = {
+                .channel_header = scan_channels[secondary_scan_count].channel_header,
+                .center_freq_index = scan_channels[secondary_scan_count].center_freq_index
+            },
+            .syncword_class = PHY_SYNCWORD_CLASS1
+        };
+
+        DPRINT("FG scan autom on channel %i by radio %i", rx_cfg.channel_id.center_freq_index, secondary_scan_count);
+        radio->set_rx(&rx_cfg, &packet_received, NULL);
+    }
+}
+
+static void stop_secondary_scans()
+{
+    for (uint8_t i = 1; i <= secondary_scan_count; i++)
+        hw_radio_get_instance(i)->set_idle();
+
+    secondary_scan_count = 0;
+}
+
+static void cancel_scan_automation_events()
+{
+    stop_secondary_scans();
+    background_sniffing = false;
     timer_cancel_task(&start_background_scan);
     sched_cancel_task(&start_background_scan);
+    timer_cancel_task(&hop_foreground_scan);
+    sched_cancel_task(&hop_foreground_scan);
+}
+
+// generates the scan start events of a background scan automation, every scan_event_period. A scan on a single
+// channel is offloaded to the radio when it can sniff by itself, the MCU is then only woken up by a received frame.
+static void start_background_scan_events()
+{
+#if MODULE_D7AP_TIME_SYNC_ROLE > 0
+    // the events of the synchronized nodes start at the multiples of scan_event_period in network time, so the sources
+    // know when they scan. This takes precedence over a sniff offloaded to the radio, which keeps its own time
+    if (time_sync_is_synchronized())
+    {
+        timer_tick_t now = timer_get_counter_value();
+        timer_tick_t next_event = now + scan_event_period - time_sync_to_network_time(now) % scan_event_period;
+        assert(timer_post_periodic_task_at(&start_background_scan, next_event, scan_event_period, DEFAULT_PRIORITY) == SUCCESS);
+        return;
+    }
+#endif
+
+#if defined(MODULE_D7AP_DLL_BACKGROUND_SNIFF_ENABLED)
+    if (scan_channel_count == 1)
+    {
+        current_channel_id.channel_header = scan_channels[0].channel_header;
+        current_channel_id.center_freq_index = scan_channels[0].center_freq_index;
+        E_CCA = get_cca_threshold(&scan_channels[0]);
+
+        hw_rx_cfg_t rx_cfg = {
+            .channel_id = current_channel_id,
+            .syncword_class = PHY_SYNCWORD_CLASS0,
+        };
+
+        if (hw_radio_start_background_sniff(&rx_cfg, &packet_received, E_CCA, scan_event_period) == SUCCESS)
+        {
+            DPRINT("Background scan offloaded to the radio");
+            background_sniffing = true;
+            return;
+        }
+    }
+#endif
+
+    assert(timer_post_periodic_task(&start_background_scan, scan_event_period, DEFAULT_PRIORITY) == SUCCESS);
+}
+
+timer_tick_t dll_get_background_scan_event_period()
+{
+    // the events of a scan offloaded to the radio do not wake the MCU
+    if (!timer_is_task_scheduled(&start_background_scan))
+        return 0;
+
+    return scan_event_period;
+}
+
+void dll_stop_background_scan()
+{
+    assert(dll_state == DLL_STATE_SCAN_AUTOMATION);
+
+    cancel_scan_automation_events();
     hw_radio_set_idle();
 }
 
+static void process_received_packet(packet_t* packet)
+{
+    DPRINT("Processing received packet");
+
+    if (packet->hw_radio_packet.rx_meta.rx_cfg.syncword_class == PHY_SYNCWORD_CLASS0)
+        packet->type = BACKGROUND_ADV;
+
+#if defined(MODULE_D7AP_DLL_BACKGROUND_SNIFF_ENABLED)
+    bool background_frame = packet->type == BACKGROUND_ADV; // the packet can be freed by the upper layers
+#endif
+
+    packet_queue_mark_processing(packet);
+    packet_disassemble(packet);
+
+#if defined(MODULE_D7AP_DLL_BACKGROUND_SNIFF_ENABLED)
+    // the radio stops sniffing at a received frame, resume unless the frame stopped the scan automation
+    if (background_sniffing && background_frame && dll_state == DLL_STATE_SCAN_AUTOMATION)
+        start_background_scan_events();
+#endif
+}
+
 static void process_received_packets()
 {
+    hw_radio_packet_t* hw_radio_packet;
+    while (spsc_ring_get(&received_ring, &hw_radio_packet) == SUCCESS)
+    {
+        refine_rx_timestamp(hw_radio_packet);
+#ifdef MODULE_D7AP_DLL_RX_CAPTURE_ENABLED
+        rx_capture_record(hw_radio_packet);
+#endif
+        packet_queue_mark_received(hw_radio_packet);
+    }
+
     if (is_tx_busy())
     {
         // this task might be scheduled while a TX is busy (for example after scheduling an execute_cca()).
@@ -287,54 +1395,184 @@ static void process_received_packets()
         return;
     }
 
-    packet_t* packet = packet_queue_get_received_packet();
-    assert(packet != NULL);
-    DPRINT("Processing received packet");
+#if MODULE_D7AP_DLL_RX_MAX_AGE > 0
+    // drop the packets which are too old to be answered before doing any decode work on them
+    uint8_t dropped = packet_queue_drop_received_packets_before(timer_get_counter_value() - TI_TO_TIMER_TICKS(MODULE_D7AP_DLL_RX_MAX_AGE));
+    if (dropped)
+    {
+        rx_drop_counters.too_late += dropped;
+        DPRINT("Dropped %i received packets which are too old", dropped);
+    }
+#endif
 
-    if (packet->hw_radio_packet.rx_meta.rx_cfg.syncword_class == PHY_SYNCWORD_CLASS0)
-        packet->type = BACKGROUND_ADV;
+    // the received packets are processed in order of reception, a burst back to back up to the budget of a task
+    // run so the other tasks are not starved. Processing a packet can start a TX, the next ones wait for it then.
+    for (uint8_t budget = MODULE_D7AP_DLL_RX_BATCH_SIZE; budget > 0; budget--)
+    {
+        packet_t* packet = packet_queue_get_received_packet();
+        if (packet == NULL)
+        {
+#if MODULE_D7AP_DLL_RX_OVERFLOW_POLICY == DLL_RX_OVERFLOW_PAUSE_BACKGROUND_SCAN
+            if (background_scan_paused)
+            {
+                background_scan_paused = false;
+                if (dll_state == DLL_STATE_SCAN_AUTOMATION && tsched > 0)
+                {
+                    DPRINT("Resuming background scan");
+                    start_background_scan_events();
+                }
+            }
+#endif
+            return;
+        }
 
-    packet_queue_mark_processing(packet);
-    packet_disassemble(packet);
+        process_received_packet(packet);
+        if (is_tx_busy())
+        {
+            process_received_packets_after_tx = true;
+            return;
+        }
+    }
 
-    // TODO check if more received packets are pending
+    // the budget is spent, continue in a new task
+    if (packet_queue_get_received_packet() != NULL)
+        sched_post_handle_prio(SCHED_TASK_HANDLE(process_received_packets), MAX_PRIORITY);
 }
 
 static void packet_received(hw_radio_packet_t* hw_radio_packet)
 {
     assert(dll_state == DLL_STATE_FOREGROUND_SCAN || dll_state == DLL_STATE_SCAN_AUTOMATION);
 
-    if (hw_radio_packet->rx_meta.rx_cfg.syncword_class == PHY_SYNCWORD_CLASS1)
+    // we are in interrupt context here, so hand the packet over to the task which marks it for further processing,
+    // schedule it and return
+    DPRINT("packet received @ %i , RSSI = %i", hw_radio_packet->rx_meta.timestamp, hw_radio_packet->rx_meta.rssi);
+    error_t err = spsc_ring_put(&received_ring, &hw_radio_packet); assert(err == SUCCESS);
+
+    /* the received packet needs to be handled in priority */
+    sched_post_handle_prio(SCHED_TASK_HANDLE(process_received_packets), MAX_PRIORITY);
+}
+
+// responses are bound to the Tc of their request and subsequent requests to the guard period of their dialog
+static uint8_t get_tx_priority(const packet_t* packet)
+{
+    switch(packet->type)
     {
-        uint16_t tx_duration = dll_calculate_tx_duration(current_access_profile.channel_header.ch_class,
-                                                         current_access_profile.channel_header.ch_coding,
-                                                         hw_radio_packet->length + 1);
-        // If the first transmission duration is greater than or equal to the Guard Interval TG,
-        // the channel guard period is extended by TG following the transmission.
-        if (tx_duration >= t_g)
-            timer_post_task_prio_delay(&guard_period_expiration, t_g, MAX_PRIORITY);
-        else
-            timer_post_task_prio_delay(&guard_period_expiration, t_g - tx_duration, MAX_PRIORITY);
+        case RESPONSE_TO_UNICAST:
+            return 3;
+        case RESPONSE_TO_BROADCAST:
+            return 2;
+        case SUBSEQUENT_REQUEST:
+            return 1;
+        default:
+            return 0;
+    }
+}
 
-        guarded_channel = true;
+static error_t queue_tx_frame(packet_t* packet)
+{
+    uint8_t queue_size = packet->type == FORWARDED_FRAME ? MODULE_D7AP_DLL_TX_QUEUE_SIZE - 1 : MODULE_D7AP_DLL_TX_QUEUE_SIZE;
+    if (tx_queue_count >= queue_size)
+    {
+        log_stack_warning(LOG_STACK_DLL, "TX queue full, frame dropped");
+        return ESIZE;
     }
 
-    // we are in interrupt context here, so mark packet for further processing,
-    // schedule it and return
-    DPRINT("packet received @ %i , RSSI = %i", hw_radio_packet->rx_meta.timestamp, hw_radio_packet->rx_meta.rssi);
-    packet_queue_mark_received(hw_radio_packet);
+    uint8_t priority = get_tx_priority(packet);
+    uint8_t i = tx_queue_count;
+    while (i > 0 && tx_queue[i - 1].priority < priority)
+    {
+        tx_queue[i] = tx_queue[i - 1];
+        i--;
+    }
+
+    tx_queue[i] = (tx_queue_entry_t){
+        .packet = packet,
+        .access_class = packet->d7anp_addressee->access_class,
+        .priority = priority
+    };
+    tx_queue_count++;
+    DPRINT("TX busy, frame queued at position %i of %i", i, tx_queue_count);
+    return SUCCESS;
+}
+
+// the frame of the upper layers is discarded like the current one, it stays theirs
+static void flush_tx_queue()
+{
+    for(uint8_t i = 0; i < tx_queue_count; i++)
+    {
+        if (tx_queue[i].packet->type == FORWARDED_FRAME)
+            packet_queue_free_packet(tx_queue[i].packet);
+    }
+
+    tx_queue_count = 0;
+}
+
+static void start_tx_frame(packet_t* packet, uint8_t access_class);
+
+// starts the next queued frame when the DLL is idle, the pending RX processing and foreground scan resume
+// only once the queue is drained
+static bool start_next_tx_frame()
+{
+    if (dll_state != DLL_STATE_IDLE || tx_queue_count == 0)
+        return false;
+
+    tx_queue_entry_t entry = tx_queue[0];
+    tx_queue_count--;
+    memmove(tx_queue, tx_queue + 1, tx_queue_count * sizeof(tx_queue_entry_t));
+
+    DPRINT("Start the queued frame, %i frames left", tx_queue_count);
+    // the upper layers take over the radio after their own frame
+    if (entry.packet->type != FORWARDED_FRAME)
+        resume_scan_automation = false;
+
+    start_tx_frame(entry.packet, entry.access_class);
+    return true;
+}
+
+static void resume_scan_automation_after_forwarding()
+{
+    if (!resume_scan_automation)
+        return;
+
+    resume_scan_automation = false;
+    dll_execute_scan_automation();
+}
 
-    /* the received packet needs to be handled in priority */
-    sched_post_task_prio(&process_received_packets, MAX_PRIORITY);
+// forwarded frames are not known to the upper layers, they are freed here
+static void signal_transmission_failure()
+{
+    if (current_packet->type == FORWARDED_FRAME)
+        packet_queue_free_packet(current_packet);
+    else
+        d7anp_signal_transmission_failure();
 }
 
 static void notify_transmitted_packet()
 {
-    packet_t* packet = packet_queue_get_transmitted_packet();
-    assert(packet != NULL);
+    hw_radio_packet_t* hw_radio_packet;
+    error_t err = spsc_ring_get(&transmitted_ring, &hw_radio_packet); assert(err == SUCCESS);
+    packet_t* packet = packet_queue_mark_transmitted(hw_radio_packet);
+
+    get_link_stats(packet->dll_header.subnet, &hw_radio_packet->tx_meta.tx_cfg.channel_id)->tx_airtime += packet->tx_duration;
+#if MODULE_D7AP_DLL_DUTY_CYCLE_CHANNEL_COUNT > 0
+    account_airtime(&hw_radio_packet->tx_meta.tx_cfg.channel_id, packet->tx_duration);
+#endif
 
     switch_state(DLL_STATE_IDLE);
-    d7anp_signal_packet_transmitted(packet);
+    if (packet->type == FORWARDED_FRAME)
+        packet_queue_free_packet(packet);
+    else
+    {
+        if (packet->d7anp_addressee != NULL)
+            guard_channel(&hw_radio_packet->tx_meta.tx_cfg.channel_id, packet->d7anp_addressee->ctrl.id_type,
+                          packet->d7anp_addressee->id, hw_radio_packet->tx_meta.timestamp, packet->tx_duration);
+
+        d7anp_signal_packet_transmitted(packet);
+    }
+
+    // on a guarded channel the next frame is sent right away, without CSMA-CA
+    if (start_next_tx_frame())
+        return;
 
     if (process_received_packets_after_tx)
     {
@@ -347,6 +1585,8 @@ static void notify_transmitted_packet()
         start_foreground_scan();
         resume_fg_scan = false;
     }
+    else
+        resume_scan_automation_after_forwarding();
 }
 
 void packet_transmitted(hw_radio_packet_t* hw_radio_packet)
@@ -355,17 +1595,16 @@ void packet_transmitted(hw_radio_packet_t* hw_radio_packet)
     switch_state(DLL_STATE_TX_FOREGROUND_COMPLETED);
     DPRINT("Transmitted packet @ %i with length = %i", hw_radio_packet->tx_meta.timestamp, hw_radio_packet->length);
 
-    packet_t* packet = packet_queue_mark_transmitted(hw_radio_packet);
-
-    if (packet->tx_duration >= t_g )
-    {
-        timer_post_task_prio_delay(&guard_period_expiration, t_g, MAX_PRIORITY);
-    }
-    else
-        timer_post_task_prio_delay(&guard_period_expiration, t_g - packet->tx_duration, MAX_PRIORITY);
+    error_t err = spsc_ring_put(&transmitted_ring, &hw_radio_packet); assert(err == SUCCESS);
 
     /* the notification task needs to be handled in priority */
-    sched_post_task_prio(&notify_transmitted_packet, MAX_PRIORITY);
+    sched_post_handle_prio(SCHED_TASK_HANDLE(notify_transmitted_packet), MAX_PRIORITY);
+}
+
+static void send_foreground_frame()
+{
+    DPRINT("Transmit packet @ %i", timer_get_counter_value()); // ensure that we are sending the foreground request within the guarded time
+    hw_radio_send_packet(&current_packet->hw_radio_packet, &packet_transmitted);
 }
 
 void background_advertising_terminated(hw_radio_packet_t* hw_radio_packet)
@@ -373,6 +1612,20 @@ void background_advertising_terminated(hw_radio_packet_t* hw_radio_packet)
     assert(dll_state == DLL_STATE_TX_BACKGROUND);
     switch_state(DLL_STATE_TX_FOREGROUND);
 
+    // the advertising lasts up to the initial ETA, the foreground frame is accounted once transmitted
+    get_tx_link_stats()->tx_airtime += current_packet->ETA;
+#if MODULE_D7AP_DLL_DUTY_CYCLE_CHANNEL_COUNT > 0
+    account_airtime(&current_channel_id, current_packet->ETA);
+#endif
+
+    // otherwise it is sent by prepare_foreground_frame() once assembled
+    if (foreground_frame_ready)
+        send_foreground_frame();
+}
+
+// assembles the foreground frame while the radio is advertising, so it is sent right at the end of the advertising
+static void prepare_foreground_frame()
+{
     current_packet->hw_radio_packet.tx_meta.tx_cfg.syncword_class = PHY_SYNCWORD_CLASS1;
     current_packet->type = INITIAL_REQUEST;
     packet_assemble(current_packet);
@@ -381,9 +1634,13 @@ void background_advertising_terminated(hw_radio_packet_t* hw_radio_packet)
                                                             current_access_profile.channel_header.ch_coding,
                                                             current_packet->hw_radio_packet.length + 1);
 
-    DPRINT("Transmit packet @ %i", timer_get_counter_value()); // ensure that we are sending the foreground request within the guarded time
-    hw_radio_send_packet(&current_packet->hw_radio_packet, &packet_transmitted);
-    guarded_channel = true;
+    start_atomic();
+    foreground_frame_ready = true;
+    bool advertising_terminated = (dll_state == DLL_STATE_TX_FOREGROUND);
+    end_atomic();
+
+    if (advertising_terminated)
+        send_foreground_frame();
 }
 
 static void discard_tx()
@@ -402,31 +1659,55 @@ static void discard_tx()
         timer_cancel_task(&execute_cca);
         sched_cancel_task(&execute_cca);
     }
-    else if ((dll_state == DLL_STATE_CCA_FAIL) || (dll_state == DLL_STATE_CSMA_CA_RETRY))
+    else if ((dll_state == DLL_STATE_CSMA_CA_STARTED) || (dll_state == DLL_STATE_CCA_FAIL) || (dll_state == DLL_STATE_CSMA_CA_RETRY))
     {
         timer_cancel_task(&execute_csma_ca);
         sched_cancel_task(&execute_csma_ca);
     }
     else if (dll_state == DLL_STATE_TX_FOREGROUND_COMPLETED)
     {
-        timer_cancel_task(&guard_period_expiration);
-        sched_cancel_task(&guard_period_expiration);
-        guarded_channel = false;
         sched_cancel_task(&notify_transmitted_packet);
+
+        // the transmission is not notified anymore and does not guard the channel, but the packet is still marked transmitted
+        hw_radio_packet_t* hw_radio_packet;
+        while (spsc_ring_get(&transmitted_ring, &hw_radio_packet) == SUCCESS)
+            packet_queue_mark_transmitted(hw_radio_packet);
     }
 
     switch_state(DLL_STATE_IDLE);
+
+    // the upper layers do not know the forwarded frames, and take over the radio
+    if (current_packet->type == FORWARDED_FRAME)
+        packet_queue_free_packet(current_packet);
+
+    resume_scan_automation = false;
+
+    if (tx_queue_count)
+    {
+        DPRINT("Discarding %i queued frames", tx_queue_count);
+        flush_tx_queue();
+    }
 }
 
-static void cca_rssi_valid(int16_t cur_rssi)
+// CCA2 starts t_g after CCA1, which is the shortest time between the start of the CCA and the transmission
+#define CCA_MIN_DURATION t_g
+
+#define TIMER_TICKS_TO_US(ticks) ((uint32_t)((uint64_t)(ticks) * 1000000 / TIMER_TICKS_PER_SEC))
+
+static void cca_completed(bool channel_clear, int16_t cur_rssi)
 {
-    DPRINT("cca_rssi_valid @%i", timer_get_counter_value());
+    DPRINT("cca_completed @%i", timer_get_counter_value());
 
     // When the radio goes back to Rx state, the rssi_valid callback may be still set. Skip it in this case
     if (dll_state != DLL_STATE_CCA1 && dll_state != DLL_STATE_CCA2)
         return;
 
-    if (cur_rssi <= E_CCA)
+    update_channel_history(current_channel_id.center_freq_index, cur_rssi, !channel_clear);
+
+    dll_link_stats_t* stats = get_tx_link_stats();
+    stats->cca_attempts++;
+
+    if (channel_clear)
     {
         if (dll_state == DLL_STATE_CCA1)
         {
@@ -434,8 +1715,12 @@ static void cca_rssi_valid(int16_t cur_rssi)
             switch_state(DLL_STATE_CCA2);
 
             // execute CCA2 directly after busy wait instead of scheduling this, to prevent another long running
-            // scheduled task to interfer with this timer (for instance d7asp_received_unsollicited_data_cb() )
-            hw_busy_wait(5000);
+            // scheduled task to interfer with this timer (for instance d7asp_received_unsollicited_data_cb() ).
+            // The wait ends t_g after the start of CCA1, the time the RSSI took to settle is part of it
+            timer_tick_t elapsed = timer_get_counter_value() - dll_cca_started;
+            if (elapsed < CCA_MIN_DURATION)
+                hw_busy_wait(TIMER_TICKS_TO_US(CCA_MIN_DURATION - elapsed));
+
             execute_cca();
             return;
         }
@@ -445,30 +1730,30 @@ static void cca_rssi_valid(int16_t cur_rssi)
             error_t err;
             DPRINT("CCA2 RSSI: %d", cur_rssi);
             DPRINT("CCA2 succeeded, transmitting ...");
+            account_backoff_time();
             // log_print_data(current_packet->hw_radio_packet.data, current_packet->hw_radio_packet.length + 1); // TODO tmp
 
             if (current_packet->type == BACKGROUND_ADV)
             {
                 switch_state(DLL_STATE_TX_BACKGROUND);
                 DPRINT("Start background advertising @ %i", timer_get_counter_value());
+                foreground_frame_ready = false;
                 err = hw_radio_send_background_packet(&current_packet->hw_radio_packet,
                                                       &background_advertising_terminated,
                                                       current_packet->ETA, current_packet->tx_duration);
 
-                // To save time and guarantee to send the foreground frame within the guarded time,
-                // it should be optimal to prepare the foreground packet before the end of the
-                // advertising period, but for now, the sending of background packet is a none interrupted
-                // sequence
-
-                //current_packet->hw_radio_packet.tx_meta.tx_cfg.syncword_class = PHY_SYNCWORD_CLASS1;
-                //current_packet->type = INITIAL_REQUEST;
-                //packet_assemble(current_packet);
+                // the advertising is streamed by the radio driver, meanwhile the foreground frame is prepared
+                // to guarantee it is sent within the guarded time
+                if (err == SUCCESS)
+                    prepare_foreground_frame();
             }
             else
             {
                 switch_state(DLL_STATE_TX_FOREGROUND);
+#if MODULE_D7AP_TIME_SYNC_ROLE == TIME_SYNC_ROLE_SOURCE
+                time_sync_stamp_frame(current_packet);
+#endif
                 err = hw_radio_send_packet(&current_packet->hw_radio_packet, &packet_transmitted);
-                guarded_channel = true;
             }
 
             assert(err == SUCCESS);
@@ -478,70 +1763,187 @@ static void cca_rssi_valid(int16_t cur_rssi)
     else
     {
         DPRINT("Channel not clear, RSSI: %i", cur_rssi);
+        stats->cca_failures++;
         switch_state(DLL_STATE_CSMA_CA_RETRY);
         execute_csma_ca();
     }
 }
 
+// the CCA of the radios without a threshold comparison of their own
+static void cca_rssi_valid(int16_t cur_rssi)
+{
+    cca_completed(cur_rssi <= E_CCA, cur_rssi);
+}
+
 static void execute_cca()
 {
     DPRINT("execute_cca @%i", timer_get_counter_value());
 
     assert(dll_state == DLL_STATE_CCA1 || dll_state == DLL_STATE_CCA2);
 
+    if (dll_state == DLL_STATE_CCA1)
+        dll_cca_started = timer_get_counter_value();
+
     hw_rx_cfg_t rx_cfg =(hw_rx_cfg_t){
         .channel_id = current_channel_id,
         .syncword_class = PHY_SYNCWORD_CLASS1,
     };
 
-    hw_radio_set_rx(&rx_cfg, NULL, &cca_rssi_valid);
+    // the radio decides itself when it can, otherwise the RSSI is compared once it is valid
+    if (hw_radio_cca(&rx_cfg, E_CCA, &cca_completed) != SUCCESS)
+        hw_radio_set_rx(&rx_cfg, NULL, &cca_rssi_valid);
 }
 
+// the duration of one byte on air in timer ticks, in 16.16 fixed point and rounded up so durations are never underestimated
+#define BYTE_DURATION(bitrate) ((uint32_t)(((((uint64_t)8 * TIMER_TICKS_PER_SEC) << 16) + (bitrate) - 1) / (bitrate)))
+
+// the PA ramp-up and ramp-down symbols, one bit each in (G)FSK
+#define TX_RAMP_SYMBOLS 8
+
+typedef struct
+{
+    uint8_t preamble_length;
+    uint32_t byte_duration;
+} channel_class_timing_t;
+
+// indexed by phy_channel_class_t, the RFU class 0x01 is handled as normal rate
+static const channel_class_timing_t channel_class_timings[] = {
+    [PHY_CLASS_LO_RATE] = { PREAMBLE_LOW_RATE_CLASS, BYTE_DURATION(9600) },
+    [0x01] = { PREAMBLE_NORMAL_RATE_CLASS, BYTE_DURATION(55555) },
+    [PHY_CLASS_NORMAL_RATE] = { PREAMBLE_NORMAL_RATE_CLASS, BYTE_DURATION(55555) },
+    [PHY_CLASS_HI_RATE] = { PREAMBLE_HI_RATE_CLASS, BYTE_DURATION(166667) },
+};
+
 uint16_t dll_calculate_tx_duration(phy_channel_class_t channel_class, phy_coding_t ch_coding, uint8_t packet_length)
 {
-    double data_rate = 6.0; // Normal rate: 6.9 bytes/tick
+    const channel_class_timing_t* timing = &channel_class_timings[channel_class & 0x03];
 
+    // the FEC encoded length exceeds 255 bytes for long frames
+    uint16_t length = packet_length;
     if (ch_coding == PHY_CODING_FEC_PN9)
-        packet_length = fec_calculated_decoded_length(packet_length);
+        length = fec_calculated_decoded_length(packet_length);
+
+    length += timing->preamble_length + sizeof(uint16_t) + TX_RAMP_SYMBOLS / 8; // preamble, sync word and PA ramping
+
+    // round up to the next timer tick and add one tick for the transceiver turnaround
+    uint16_t duration = ((length * timing->byte_duration + 0xFFFF) >> 16) + 1;
+    DPRINT("Transmission duration  %i", duration);
+    return duration;
+}
+
+// the end of a received frame is derived from the timestamp of its sync word and its duration on air, since the driver
+// timestamps the end of the frame only after reading it from the FIFO. The response periods of the transport layer
+// are timed from this timestamp.
+static void refine_rx_timestamp(hw_radio_packet_t* hw_radio_packet)
+{
+    hw_rx_metadata_t* rx_meta = &hw_radio_packet->rx_meta;
+    const channel_class_timing_t* timing = &channel_class_timings[rx_meta->rx_cfg.channel_id.channel_header.ch_class & 0x03];
+
+    // a background frame has no length byte
+    uint16_t length = hw_radio_packet->length;
+    if (rx_meta->rx_cfg.syncword_class != PHY_SYNCWORD_CLASS0)
+        length++;
+
+    if (rx_meta->rx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+        length = fec_calculated_decoded_length(length);
+
+    // the durations are rounded up, the driver timestamp remains when it is earlier, e.g. when the sync word was only
+    // timestamped at the end of the frame
+    timer_tick_t end = rx_meta->timestamp - rx_meta->sync_offset + ((length * timing->byte_duration + 0xFFFF) >> 16);
+    if ((int32_t)(end - rx_meta->timestamp) < 0)
+        rx_meta->timestamp = end;
+}
+
+// the responders to a broadcast request spread over the slots of the response period by their UID, mixed with the
+// dialog and transaction ID so that responders which collided do not collide again in the next request
+static uint32_t get_response_slot(const packet_t* packet, uint32_t slot_count)
+{
+    const uint8_t* uid = fs_get_identity()->uid;
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (uint8_t i = 0; i < D7A_FILE_UID_SIZE; i++)
+        hash = (hash ^ uid[i]) * 16777619u;
+
+    hash = (hash ^ packet->d7atp_dialog_id) * 16777619u;
+    hash = (hash ^ packet->d7atp_transaction_id) * 16777619u;
+    return hash % slot_count;
+}
+
+/*
+ * During the period when the channel is guarded by the Requester, the transmission
+ * of a subsequent requests, or a single response to a unicast request on the
+ * guarded channel, is not conditioned by CSMA-CA. The channel is guarded per peer,
+ * so interleaved dialogs with several peers each keep their guard.
+ */
+static bool is_csma_ca_exempt(packet_t* packet)
+{
+    return (packet->type == SUBSEQUENT_REQUEST || packet->type == RESPONSE_TO_UNICAST) && packet->d7anp_addressee != NULL
+        && is_channel_guarded(&packet->hw_radio_packet.tx_meta.tx_cfg.channel_id,
+                              packet->d7anp_addressee->ctrl.id_type, packet->d7anp_addressee->id);
+}
 
-    packet_length += sizeof(uint16_t); // Sync word
+// the CCA1 of an attempt starts at the given time, which is posted on the precise timer to keep it aligned with its slot
+static void schedule_cca(timer_tick_t time)
+{
+    switch_state(DLL_STATE_CCA1);
+    if ((int32_t)(time - timer_get_counter_value()) > 0)
+        timer_post_precise_task_prio(&execute_cca, time, MAX_PRIORITY);
+    else
+        sched_post_task_prio(&execute_cca, MAX_PRIORITY);
+}
 
-    switch (channel_class)
+// the start of the next CCA after a busy channel, before the end of Tca. Returns false when RIGD has no slot left
+static bool get_next_cca_time(timer_tick_t now, timer_tick_t* time)
+{
+    switch (csma_ca_mode)
     {
-    case PHY_CLASS_LO_RATE:
-        packet_length += PREAMBLE_LOW_RATE_CLASS;
-        data_rate = 1.0; // Lo Rate 9.6 kbps: 1.2 bytes/tick
-        break;
-    case PHY_CLASS_NORMAL_RATE:
-        packet_length += PREAMBLE_NORMAL_RATE_CLASS;
-        data_rate = 6.0; // Normal Rate 55.555 kbps: 6.94 bytes/tick
-        break;
-    case PHY_CLASS_HI_RATE:
-        packet_length += PREAMBLE_HI_RATE_CLASS;
-        data_rate = 20.0; // High rate 166.667 kbps: 20.83 byte/tick
-    }
+        case CSMA_CA_MODE_UNC:
+        case CSMA_CA_MODE_AIND:
+        case CSMA_CA_MODE_RAIND:
+        {
+            // the rest of Tca is split in slots of Ttx from the failed attempt, the CCA is repeated at the start of a
+            // random one of them. Right away when less than a slot is left
+            uint32_t slot_count = (csma_ca_deadline - now) / dll_slot_duration;
+            uint32_t slot = slot_count ? get_rnd() % slot_count : 0;
+            DPRINT("AIND: wait %i slots of %i", slot, slot_count);
+            *time = now + slot * dll_slot_duration;
+            return true;
+        }
+        case CSMA_CA_MODE_RIGD:
+        {
+            // the slots which already ended during the CCA are skipped
+            do
+            {
+                dll_slot_start += dll_slot_duration;
+                dll_slot_duration >>= 1;
+            } while (dll_slot_duration != 0 && (int32_t)(dll_slot_start + dll_slot_duration - now) <= 0);
 
-    // TODO Add the power ramp-up/ramp-down symbols in the packet length?
+            if (dll_slot_duration == 0)
+                return false;
 
-    uint16_t duration = ceil(packet_length / data_rate) + 1;
-    DPRINT("Transmission duration  %i", duration);
-    return duration;
+            timer_tick_t earliest = (int32_t)(now - dll_slot_start) > 0 ? now - dll_slot_start : 0;
+            DPRINT("RIGD: slot duration: %i", dll_slot_duration);
+            *time = dll_slot_start + earliest + get_rnd() % (dll_slot_duration - earliest);
+            return true;
+        }
+    }
+
+    return false;
 }
 
 static void execute_csma_ca()
 {
-    // TODO select Channel at front of the channel queue
-
-    /*
-     * During the period when the channel is guarded by the Requester, the transmission
-     * of a subsequent requests, or a single response to a unicast request on the
-     * guarded channel, is not conditioned by CSMA-CA
-     */
-    if ((current_packet->type == SUBSEQUENT_REQUEST ||
-        current_packet->type == RESPONSE_TO_UNICAST) && guarded_channel)
+    DEBUG_PROBE_SET(CSMA_CA);
+    if (is_csma_ca_exempt(current_packet))
     {
+        csma_ca_mode = CSMA_CA_MODE_UNC;
         switch_state(DLL_STATE_TX_FOREGROUND);
+#if MODULE_D7AP_TIME_SYNC_ROLE == TIME_SYNC_ROLE_SOURCE
+        time_sync_stamp_frame(current_packet);
+#endif
         assert(hw_radio_send_packet(&current_packet->hw_radio_packet, &packet_transmitted) == SUCCESS);
+        DEBUG_PROBE_CLR(CSMA_CA);
         return;
     }
 
@@ -549,28 +1951,29 @@ static void execute_csma_ca()
     {
         case DLL_STATE_CSMA_CA_STARTED:
         {
-            uint16_t dll_tc;
+            timer_tick_t dll_tc;
 
             // in case of response, use the Tc parameter provided in the request
             if (current_packet->type == RESPONSE_TO_UNICAST || current_packet->type == RESPONSE_TO_BROADCAST)
-                dll_tc = CT_DECOMPRESS(current_packet->d7atp_tc);
+                dll_tc = CT_DECOMPRESS_TO_TICKS(current_packet->d7atp_tc);
             else
-                dll_tc = ceil((SFc + 1) * current_packet->tx_duration + t_g);
+                dll_tc = (SFc + 1) * current_packet->tx_duration + t_g;
 
             /*
              * Tca = Tc - Ttx - Tg
-             * we substract also 1 tick to take into account also the switching
+             * we substract also 1 Ti to take into account also the switching
              * time required in the transceiver.
              */
-            dll_tca = dll_tc - current_packet->tx_duration - t_g - 1;
-            dll_cca_started = timer_get_counter_value();
+            int32_t dll_tca = dll_tc - current_packet->tx_duration - t_g - TI_TO_TIMER_TICKS(1);
+            csma_ca_started = timer_get_counter_value();
             DPRINT("Tca= %i with Tc %i and Ttx %i", dll_tca, dll_tc, current_packet->tx_duration);
 
-            // Adjust TCA value according the time already elapsed since the reception time in case of response
+            // Adjust TCA value according the time already elapsed since the reception time in case of response.
+            // The CCA of a delayed response starts before the end of the execution delay, which extends Tca
             if (current_packet->request_received_timestamp)
             {
-                dll_tca -= dll_cca_started - current_packet->request_received_timestamp;
-                DPRINT("Adjusted Tca= %i = %i - %i", dll_tca, dll_cca_started, current_packet->request_received_timestamp);
+                dll_tca -= (int32_t)(csma_ca_started - current_packet->request_received_timestamp);
+                DPRINT("Adjusted Tca= %i = %i - %i", dll_tca, csma_ca_started, current_packet->request_received_timestamp);
             }
 
             if (dll_tca <= 0)
@@ -579,35 +1982,45 @@ static void execute_csma_ca()
                 // Let the upper layer decide eventually to change the channel in order to get a chance a send this frame
                 switch_state(DLL_STATE_IDLE); // TODO in this case we should return to scan automation
                 resume_fg_scan = false;
-                d7anp_signal_transmission_failure();
+                signal_transmission_failure();
+                if (!start_next_tx_frame())
+                    resume_scan_automation_after_forwarding();
+
                 break;
             }
 
-            uint16_t t_offset = 0;
+            csma_ca_deadline = csma_ca_started + dll_tca;
+            dll_slot_start = csma_ca_started;
+            timer_tick_t t_offset = 0;
 
-            if (current_packet->type == RESPONSE_TO_BROADCAST)
+            // the forwarders of a frame receive it at the same time, they are spread like the responders to a broadcast
+            if (current_packet->type == RESPONSE_TO_BROADCAST || current_packet->type == FORWARDED_FRAME)
                 csma_ca_mode = CSMA_CA_MODE_RAIND;
+#ifdef MODULE_D7AP_DLL_CSMA_CA_RIGD_ENABLED
+            else if (current_packet->type == INITIAL_REQUEST)
+                csma_ca_mode = CSMA_CA_MODE_RIGD;
+#endif
             else
                 csma_ca_mode = CSMA_CA_MODE_AIND;
 
-            // TODO determine how to enable CSMA_CA_MODE_RIGD
-
             switch(csma_ca_mode)
             {
-                case CSMA_CA_MODE_AIND: // TODO implement AIND
+                case CSMA_CA_MODE_UNC:
+                case CSMA_CA_MODE_AIND:
                 {
-                    // no initial delay, t_offset = 0
+                    // slots of Ttx, the first CCA right away
                     dll_slot_duration = current_packet->tx_duration;
                     break;
                 }
                 case CSMA_CA_MODE_RAIND:
                 {
+                    // slots of Ttx, the first CCA in a random slot of Tca
                     dll_slot_duration = current_packet->tx_duration;
-                    uint16_t max_nr_slots = dll_tca / dll_slot_duration;
+                    uint32_t max_nr_slots = dll_tca / dll_slot_duration;
 
                     if (max_nr_slots)
                     {
-                        uint16_t slots_wait = get_rnd() % max_nr_slots;
+                        uint32_t slots_wait = get_response_slot(current_packet, max_nr_slots);
                         t_offset = slots_wait * dll_slot_duration;
                         DPRINT("RAIND: slot %i of %i", slots_wait, max_nr_slots);
                     }
@@ -615,96 +2028,61 @@ static void execute_csma_ca()
                 }
                 case CSMA_CA_MODE_RIGD:
                 {
-                    dll_slot_duration = (uint16_t) ((double)dll_tca / 2 );
-                    t_offset = get_rnd() % dll_slot_duration;
+                    // the first slot is half of Tca, every next slot half of the previous one. One CCA at a random
+                    // time of each slot
+                    dll_slot_duration = dll_tca / 2;
+                    if (dll_slot_duration != 0)
+                        t_offset = get_rnd() % dll_slot_duration;
+
                     break;
                 }
             }
 
             DPRINT("slot duration: %i t_offset: %i csma ca mode: %i", dll_slot_duration, t_offset, csma_ca_mode);
-
-            dll_to = dll_tca;
-
-            if (t_offset)
-            {
-                switch_state(DLL_STATE_CCA1);
-                timer_post_task_prio_delay(&execute_cca, t_offset, MAX_PRIORITY);
-            }
-            else
-            {
-                switch_state(DLL_STATE_CCA1);
-                sched_post_task_prio(&execute_cca, MAX_PRIORITY);
-            }
-
+            schedule_cca(dll_slot_start + t_offset);
             break;
         }
         case DLL_STATE_CSMA_CA_RETRY:
         {
-            int32_t cca_duration = timer_get_counter_value() - dll_cca_started;
-            dll_to -= cca_duration;
-
-            if (dll_to <= 0)
+            timer_tick_t now = timer_get_counter_value();
+            if ((int32_t)(csma_ca_deadline - now) <= 0)
             {
-                DPRINT("CCA fail because dll_to = %i", dll_to);
+                DPRINT("CCA fail, Tca elapsed %i ticks ago", now - csma_ca_deadline);
                 switch_state(DLL_STATE_CCA_FAIL);
                 sched_post_task_prio(&execute_csma_ca, MAX_PRIORITY);
                 break;
             }
 
-            DPRINT("RETRY with dll_to = %i", dll_to);
-
-            // TODO shift channel queue
-
-            dll_tca = dll_to;
-            dll_cca_started = timer_get_counter_value();
-            uint16_t t_offset = 0;
-
-            switch(csma_ca_mode)
+            // retry on the next channel of the queue right away instead of backing off on the busy one,
+            // only back off once all channels of the queue were found busy
+            if (shift_channel_queue())
             {
-                case CSMA_CA_MODE_AIND:
-                case CSMA_CA_MODE_RAIND:
-                {
-                    uint16_t max_nr_slots = dll_tca / dll_slot_duration;
-
-                    if (max_nr_slots)
-                    {
-                        uint16_t slots_wait = get_rnd() % max_nr_slots;
-                        t_offset = slots_wait * dll_slot_duration;
-                        DPRINT("RAIND: wait %i slots of %i", slots_wait, max_nr_slots);
-                    }
-                    break;
-                }
-                case CSMA_CA_MODE_RIGD:
-                {
-                    dll_slot_duration >>= 1;
-                    if (dll_slot_duration != 0) // TODO can be 0, validate
-                        t_offset = get_rnd() % dll_slot_duration;
-
-                    DPRINT("RIGD: slot duration: %i", dll_slot_duration);
-                    break;
-                }
+                schedule_cca(now);
+                break;
             }
 
-            DPRINT("t_offset: %i", t_offset);
-
-            if (t_offset)
-            {
-                switch_state(DLL_STATE_CCA1);
-                timer_post_task_prio_delay(&execute_cca, t_offset, MAX_PRIORITY);
-            }
-            else
+            timer_tick_t cca_time;
+            if (!get_next_cca_time(now, &cca_time))
             {
-                switch_state(DLL_STATE_CCA1);
-                sched_post_task_prio(&execute_cca, MAX_PRIORITY);
+                DPRINT("CCA fail, no slot left in Tca");
+                switch_state(DLL_STATE_CCA_FAIL);
+                sched_post_task_prio(&execute_csma_ca, MAX_PRIORITY);
+                break;
             }
 
+            DPRINT("RETRY in %i ticks", cca_time - now);
+            schedule_cca(cca_time);
             break;
         }
         case DLL_STATE_CCA_FAIL:
         {
             // TODO hw_radio_set_idle();
+            account_backoff_time();
             switch_state(DLL_STATE_IDLE);
-            d7anp_signal_transmission_failure();
+            signal_transmission_failure();
+            if (start_next_tx_frame())
+                break;
+
             if (process_received_packets_after_tx)
             {
                 sched_post_task_prio(&process_received_packets, MAX_PRIORITY);
@@ -716,30 +2094,50 @@ static void execute_csma_ca()
                 start_foreground_scan();
                 resume_fg_scan = false;
             }
+            else
+                resume_scan_automation_after_forwarding();
+
             break;
         }
     }
+
+    DEBUG_PROBE_CLR(CSMA_CA);
+}
+
+// current_access_profile is shared by the scan automation and the transmissions, it is only read again when it holds
+// another access profile or the access profiles were written since
+static void load_access_profile(uint8_t access_specifier)
+{
+    if (current_access_profile_specifier == access_specifier && current_access_profile_version == fs_get_access_profile_version())
+        return;
+
+    fs_read_access_class(access_specifier, &current_access_profile);
+    current_access_profile_specifier = access_specifier;
+    current_access_profile_version = fs_get_access_profile_version();
 }
 
 void dll_execute_scan_automation()
 {
-    uint8_t scan_access_class = fs_read_dll_conf_active_access_class();
-    if (active_access_class != scan_access_class)
-    {
-        fs_read_access_class(ACCESS_SPECIFIER(scan_access_class), &current_access_profile);
-        active_access_class = scan_access_class;
-    }
+    active_access_class = fs_read_dll_conf_active_access_class();
+    load_access_profile(ACCESS_SPECIFIER(active_access_class));
 
     DPRINT("DLL execute scan autom AC=0x%02x", active_access_class);
 
+#if MODULE_D7AP_DLL_RX_OVERFLOW_POLICY == DLL_RX_OVERFLOW_PAUSE_BACKGROUND_SCAN
+    // (re)starting the scan automation lifts a pause caused by a full packet queue
+    background_scan_paused = false;
+#endif
+
     /*
      * The Scan Automation Parameters are uniquely defined based on the Active
-     * Access Class of the device.
-     * For now, the access mask and the subband bitmap are not used.
-     * By default, subprofile[0] is selected and subband[0] is used.
+     * Access Class of the device. The scan automation rotates through all the
+     * channels of the subbands of the selectable subprofiles.
      */
-
-    if(current_access_profile.subprofiles[0].subband_bitmap == 0)
+    cancel_scan_automation_events();
+    scan_channel_count = 0;
+    build_channel_list(&current_access_profile, active_access_class, scan_channels, &scan_channel_count,
+                       MODULE_D7AP_DLL_SCAN_CHANNEL_COUNT);
+    if(scan_channel_count == 0)
     {
         DPRINT("Scan autom ch list is void, not entering scan\n");
         hw_radio_set_idle();
@@ -750,29 +2148,16 @@ void dll_execute_scan_automation()
     }
 
     switch_state(DLL_STATE_SCAN_AUTOMATION);
-    hw_rx_cfg_t rx_cfg = {
-        .channel_id = {
-            .channel_header = current_access_profile.channel_header,
-            .center_freq_index = current_access_profile.subbands[0].channel_index_start
-        },
+    scan_channel_index = 0;
+    current_channel_id = (channel_id_t){
+        .channel_header = scan_channels[0].channel_header,
+        .center_freq_index = scan_channels[0].center_freq_index
     };
 
-    // The Scan Automation TSCHED is obtained as the minimum of all selected subprofiles' TSCHED.
-    uint16_t scan_period;
-    tsched = (uint16_t)~0;
-    for(uint8_t i = 0; i < SUBPROFILES_NB; i++)
-    {
-        // Only consider the selectable subprofiles (having their Access Mask bits set to 1 and having non-void subband bitmaps)
-        if ((ACCESS_MASK(active_access_class) & (0x01 << i)) && current_access_profile.subprofiles[i].subband_bitmap)
-        {
-            scan_period = CT_DECOMPRESS(current_access_profile.subprofiles[i].scan_automation_period);
-            if ((tsched == (uint16_t)~0) || (scan_period < tsched))
-                tsched = scan_period;
-        }
-    }
+    tsched = get_scan_automation_period(&current_access_profile, active_access_class);
 
     // tsched is necessarily set because at least one selectable subprofile should be found
-    assert(tsched != (uint16_t)~0);
+    assert(tsched != (timer_tick_t)~0);
 
     /*
      * If the scan automation period (To) is set to 0, the scan type is set to
@@ -780,27 +2165,41 @@ void dll_execute_scan_automation()
      */
     if (tsched == 0)
     {
-        rx_cfg.syncword_class = PHY_SYNCWORD_CLASS1;
+#if MODULE_D7AP_DLL_SCAN_EXTRA_ACCESS_CLASS_COUNT > 0
+        // the channels of the extra access classes follow the ones of the active access class
+        for (uint8_t i = 0; i < extra_scan_access_class_count; i++)
+        {
+            dae_access_profile_t profile;
+            fs_read_access_class(ACCESS_SPECIFIER(extra_scan_access_classes[i]), &profile);
+            build_channel_list(&profile, extra_scan_access_classes[i], scan_channels, &scan_channel_count,
+                               MODULE_D7AP_DLL_SCAN_CHANNEL_COUNT);
+        }
+#endif
+
+        hw_rx_cfg_t rx_cfg = {
+            .channel_id = current_channel_id,
+            .syncword_class = PHY_SYNCWORD_CLASS1
+        };
         hw_radio_set_rx(&rx_cfg, &packet_received, NULL);
+        start_secondary_scans();
+
+#if MODULE_D7AP_DLL_FG_SCAN_DWELL_TIME > 0
+        if (scan_channel_count > secondary_scan_count + 1)
+            assert(timer_post_periodic_task(&hop_foreground_scan, TI_TO_TIMER_TICKS(MODULE_D7AP_DLL_FG_SCAN_DWELL_TIME), DEFAULT_PRIORITY) == SUCCESS);
+#endif
     }
     else
     {
-        rx_cfg.syncword_class = PHY_SYNCWORD_CLASS0;
-
-        // compute Ecca = NF + Eccao
-        if (tx_nf_method == D7ADLL_FIXED_NOISE_FLOOR)
-        {
-            //Use the default channel CCA threshold
-            E_CCA = current_access_profile.subbands[0].cca; // Eccao is set to 0 dB
-            DPRINT("E_CCA %i", E_CCA);
-        }
-
-        // If TSCHED > 0, an independent scheduler is set to generate regular scan start events at TSCHED rate.
-        DPRINT("Perform a dll background scan at the end of TSCHED (%d ticks)", tsched);
-        assert(timer_post_task_delay(&start_background_scan, tsched) == SUCCESS);
+        // If TSCHED > 0, an independent scheduler is set to generate regular scan start events, scanning the channels
+        // in turn so each channel is scanned once per TSCHED. The first event scans the first channel.
+        scan_channel_index = scan_channel_count - 1;
+        scan_event_period = tsched / scan_channel_count;
+        if (scan_event_period == 0)
+            scan_event_period = 1;
+
+        DPRINT("Perform a dll background scan on %i channels every %d ticks", scan_channel_count, scan_event_period);
+        start_background_scan_events();
     }
-
-    current_channel_id = rx_cfg.channel_id;
 }
 
 void dll_notify_dll_conf_file_changed()
@@ -812,6 +2211,23 @@ void dll_notify_dll_conf_file_changed()
     }
 }
 
+error_t dll_set_extra_scan_access_classes(const uint8_t* access_classes, uint8_t count)
+{
+#if MODULE_D7AP_DLL_SCAN_EXTRA_ACCESS_CLASS_COUNT > 0
+    if (count > MODULE_D7AP_DLL_SCAN_EXTRA_ACCESS_CLASS_COUNT)
+        return ESIZE;
+
+    memcpy(extra_scan_access_classes, access_classes, count);
+    extra_scan_access_class_count = count;
+    if (dll_state == DLL_STATE_SCAN_AUTOMATION)
+        dll_execute_scan_automation();
+
+    return SUCCESS;
+#else
+    return count == 0 ? SUCCESS : ESIZE;
+#endif
+}
+
 void dll_notify_access_profile_file_changed()
 {
     DPRINT("AP file changed");
@@ -826,37 +2242,95 @@ void dll_notify_access_profile_file_changed()
     }
 }
 
+void dll_get_rx_drop_counters(dll_rx_drop_counters_t* counters)
+{
+    start_atomic();
+    *counters = rx_drop_counters;
+    end_atomic();
+}
+
+void dll_reset_rx_drop_counters()
+{
+    start_atomic();
+    rx_drop_counters = (dll_rx_drop_counters_t){ 0 };
+    end_atomic();
+}
+
+uint8_t dll_get_link_stats(dll_link_stats_t* stats, uint8_t max_count)
+{
+    start_atomic();
+    uint8_t count = link_stats_count < max_count ? link_stats_count : max_count;
+    memcpy(stats, link_stats, count * sizeof(dll_link_stats_t));
+    end_atomic();
+    return count;
+}
+
+void dll_reset_link_stats()
+{
+    start_atomic();
+    link_stats_count = 0;
+    link_stats_next = 0;
+    end_atomic();
+}
+
+SCHED_REGISTER_TASK(execute_cca);
+SCHED_REGISTER_TASK(execute_csma_ca);
+SCHED_REGISTER_TASK(dll_execute_scan_automation);
+SCHED_REGISTER_TASK(start_background_scan);
+SCHED_REGISTER_TASK(hop_foreground_scan);
+
 void dll_init()
 {
     uint8_t nf_ctrl;
 
-    sched_register_task(&process_received_packets);
-    sched_register_task(&notify_transmitted_packet);
-    sched_register_task(&execute_cca);
-    sched_register_task(&execute_csma_ca);
-    sched_register_task(&dll_execute_scan_automation);
-    sched_register_task(&start_background_scan);
-    sched_register_task(&guard_period_expiration);
 
-    hw_radio_init(&alloc_new_packet, &release_packet);
+    spsc_ring_init(&received_ring, received_ring_buffer, sizeof(hw_radio_packet_t*), MODULE_D7AP_PACKET_QUEUE_SIZE + 1);
+    spsc_ring_init(&transmitted_ring, transmitted_ring_buffer, sizeof(hw_radio_packet_t*), MODULE_D7AP_PACKET_QUEUE_SIZE + 1);
+
+    const hw_radio_t* radio;
+    for (uint8_t i = 0; (radio = hw_radio_get_instance(i)) != NULL; i++)
+    {
+        radio->init(&alloc_new_packet, &release_packet);
+        radio->set_rx_header_filter(&filter_frame_header);
+    }
 
     fs_read_file(D7A_FILE_DLL_CONF_FILE_ID, 4, &nf_ctrl, 1);
     tx_nf_method = (nf_ctrl >> 4) & 0x0F;
+    cca_offset = nf_ctrl & 0x0F;
 
     dll_state = DLL_STATE_IDLE;
     active_access_class = NO_ACTIVE_ACCESS_CLASS;
+    current_access_profile_specifier = NO_ACCESS_PROFILE;
     process_received_packets_after_tx = false;
     resume_fg_scan = false;
+    rx_drop_counters = (dll_rx_drop_counters_t){ 0 };
+    link_stats_count = 0;
+    link_stats_next = 0;
+#if MODULE_D7AP_DLL_RX_OVERFLOW_POLICY == DLL_RX_OVERFLOW_PAUSE_BACKGROUND_SCAN
+    background_scan_paused = false;
+#endif
+    memset(channel_guards, 0, sizeof(channel_guards));
+#if MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0
+    peer_tx_power_count = 0;
+#endif
+#if MODULE_D7AP_DLL_DUTY_CYCLE_CHANNEL_COUNT > 0
+    channel_airtime_count = 0;
+#endif
+    tx_queue_count = 0;
+    secondary_scan_count = 0;
     sched_post_task(&dll_execute_scan_automation);
-    guarded_channel = false;
 }
 
-void dll_tx_frame(packet_t* packet)
+error_t dll_tx_frame(packet_t* packet)
 {
+    // the frame is started once the current CSMA-CA and TX cycle completes, in priority order
+    if (is_tx_busy())
+        return queue_tx_frame(packet);
+
     if (dll_state == DLL_STATE_SCAN_AUTOMATION)
     {
-        timer_cancel_task(&start_background_scan);
-        sched_cancel_task(&start_background_scan);
+        cancel_scan_automation_events();
+        resume_scan_automation = (packet->type == FORWARDED_FRAME);
     }
 
     if (dll_state != DLL_STATE_FOREGROUND_SCAN)
@@ -867,72 +2341,107 @@ void dll_tx_frame(packet_t* packet)
     else
         resume_fg_scan = true;
 
+    start_tx_frame(packet, packet->d7anp_addressee->access_class);
+    return SUCCESS;
+}
+
+static void start_tx_frame(packet_t* packet, uint8_t access_class)
+{
     dll_header_t* dll_header = &(packet->dll_header);
-    dll_header->subnet = packet->d7anp_addressee->access_class;
+    dll_header->subnet = access_class;
     DPRINT("TX with subnet=0x%02x", dll_header->subnet);
 
     packet->origin_access_class = active_access_class;  // strictly speaking this is a D7ANP field,
                                                         // but we set it here to prevent rereading/caching in D7ANP
 
-    if (packet->d7atp_ctrl.ctrl_is_start && packet->d7anp_addressee != NULL) // when responding in a transaction we MAY skip targetID
+    // when responding in a transaction we MAY skip targetID. A hopping frame is received by every node in range, its
+    // destination is in the D7ANP hopping control
+    if (packet->d7atp_ctrl.ctrl_is_start && packet->d7anp_addressee != NULL && !packet->d7anp_ctrl.hop_enabled)
         dll_header->control_target_id_type = packet->d7anp_addressee->ctrl.id_type;
     else
         dll_header->control_target_id_type = ID_TYPE_NOID;
 
+    // responses and subsequent requests are sent on a single channel, there is no other channel to shift to
+    channel_queue_count = 0;
+    channel_queue_index = 0;
+
     // if the channel is locked, we shall use the channel of the initial request
     if (packet->type == SUBSEQUENT_REQUEST) // TODO MISO conditions not supported
     {
-        dll_header->control_eirp_index = current_eirp + 32;
+        int8_t eirp = get_peer_eirp(packet, current_eirp);
+        dll_header->control_eirp_index = eirp + 32;
 
         packet->hw_radio_packet.tx_meta.tx_cfg = (hw_tx_cfg_t){
             .channel_id = current_channel_id,
             .syncword_class = PHY_SYNCWORD_CLASS1,
-            .eirp = current_eirp
+            .eirp = eirp
         };
     }
+    else if (packet->type == FORWARDED_FRAME)
+    {
+        // repeated on the channel and at the EIRP of the received frame, the DLL header is kept as is
+        hw_rx_cfg_t rx_cfg = packet->hw_radio_packet.rx_meta.rx_cfg;
+        packet->hw_radio_packet.tx_meta.tx_cfg = (hw_tx_cfg_t){
+                .channel_id = rx_cfg.channel_id,
+                .syncword_class = rx_cfg.syncword_class,
+                .eirp = dll_header->control_eirp_index - 32
+            };
+    }
     else if (packet->type == RESPONSE_TO_UNICAST || packet->type == RESPONSE_TO_BROADCAST)
     {
-        dll_header->control_eirp_index = current_eirp + 32;
+        int8_t eirp = get_peer_eirp(packet, current_eirp);
+        dll_header->control_eirp_index = eirp + 32;
 
         packet->hw_radio_packet.tx_meta.tx_cfg = (hw_tx_cfg_t){
                 .channel_id = packet->hw_radio_packet.rx_meta.rx_cfg.channel_id,
                 .syncword_class = packet->hw_radio_packet.rx_meta.rx_cfg.syncword_class,
-                .eirp = current_eirp
+                .eirp = eirp
             };
     }
     else
     {
-        fs_read_access_class(packet->d7anp_addressee->access_specifier, &current_access_profile);
-        /*
-         * For now the access mask and the subband bitmap are not used
-         * By default, subprofile[0] is selected and subband[0] is used
-         */
+        load_access_profile(ACCESS_SPECIFIER(access_class));
+        build_channel_queue(access_class);
+
+        // the EIRP is part of the assembled header, so it cannot follow the channel when the queue shifts.
+        // Use the lowest EIRP of the queued channels, which is allowed on all of them
+        int8_t allowed_eirp = channel_queue[0].eirp;
+        for(uint8_t i = 1; i < channel_queue_count; i++)
+        {
+            if (channel_queue[i].eirp < allowed_eirp)
+                allowed_eirp = channel_queue[i].eirp;
+        }
 
-        // TODO generate random channel queue
-        // TODO assert if no selectable subprofile can be found
+#if MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0
+        // the previous attempt was not answered
+        if (packet->type == RETRY_REQUEST && packet->d7anp_addressee != NULL)
+            dll_signal_peer_tx_failure(packet->d7anp_addressee->ctrl.id_type, packet->d7anp_addressee->id);
+#endif
 
-        /* EIRP (dBm) = (EIRP_I – 32) dBm */
+        int8_t eirp = get_peer_eirp(packet, allowed_eirp);
 
         log_print_string("AC specifier=%i channel=%i",
-                         packet->d7anp_addressee->access_specifier,
-                         current_access_profile.subbands[0].channel_index_start);
-        dll_header->control_eirp_index = current_access_profile.subbands[0].eirp + 32;
+                         ACCESS_SPECIFIER(access_class),
+                         channel_queue[0].center_freq_index);
+
+        /* EIRP (dBm) = (EIRP_I – 32) dBm */
+        dll_header->control_eirp_index = eirp + 32;
 
         packet->hw_radio_packet.tx_meta.tx_cfg = (hw_tx_cfg_t){
             .channel_id.channel_header = current_access_profile.channel_header,
-            .channel_id.center_freq_index = current_access_profile.subbands[0].channel_index_start,
-            .eirp = current_access_profile.subbands[0].eirp
+            .channel_id.center_freq_index = channel_queue[0].center_freq_index,
+            .eirp = eirp
         };
 
         // The Access TSCHED is obtained as the maximum of all selected subprofiles' TSCHED.
-        uint16_t scan_period;
+        timer_tick_t scan_period;
         tsched = 0;
         for(uint8_t i = 0; i < SUBPROFILES_NB; i++)
         {
             // Only consider the selectable subprofiles (having their Access Mask bits set to 1 and having non-void subband bitmaps)
-            if ((packet->d7anp_addressee->access_mask & (0x01 << i)) && current_access_profile.subprofiles[i].subband_bitmap)
+            if ((ACCESS_MASK(access_class) & (0x01 << i)) && current_access_profile.subprofiles[i].subband_bitmap)
             {
-                scan_period = CT_DECOMPRESS(current_access_profile.subprofiles[i].scan_automation_period);
+                scan_period = CT_DECOMPRESS_TO_TICKS(current_access_profile.subprofiles[i].scan_automation_period);
                 if (scan_period > tsched)
                     tsched = scan_period;
             }
@@ -955,27 +2464,22 @@ void dll_tx_frame(packet_t* packet)
         else
             packet->hw_radio_packet.tx_meta.tx_cfg.syncword_class = PHY_SYNCWORD_CLASS1;
 
-        // store the channel id and eirp
-        current_eirp = current_access_profile.subbands[0].eirp;
+        // store the channel id and the allowed eirp, the subsequent frames of the dialog control it for their own peer
+        current_eirp = allowed_eirp;
         current_channel_id = packet->hw_radio_packet.tx_meta.tx_cfg.channel_id;
 
-        // compute Ecca = NF + Eccao
-        if (tx_nf_method == D7ADLL_FIXED_NOISE_FLOOR)
-        {
-            //Use the default channel CCA threshold
-            E_CCA = current_access_profile.subbands[0].cca; // Eccao is set to 0 dB
-            DPRINT("E_CCA %i", E_CCA);
-        }
-        else
-        {
-            //TODO support the Slow RSSI Variation computation method
-            assert(false);
-        }
+        select_queued_channel(packet, 0);
     }
 
     packet_assemble(packet);
 
-    if (packet->type != BACKGROUND_ADV)
+    if (packet->type == FORWARDED_FRAME)
+    {
+        packet->tx_duration = dll_calculate_tx_duration(packet->hw_radio_packet.tx_meta.tx_cfg.channel_id.channel_header.ch_class,
+                                                        packet->hw_radio_packet.tx_meta.tx_cfg.channel_id.channel_header.ch_coding,
+                                                        packet->hw_radio_packet.length + 1);
+    }
+    else if (packet->type != BACKGROUND_ADV)
     {
         packet->tx_duration = dll_calculate_tx_duration(current_access_profile.channel_header.ch_class,
                                                         current_access_profile.channel_header.ch_coding,
@@ -986,21 +2490,47 @@ void dll_tx_frame(packet_t* packet)
 
     switch_state(DLL_STATE_CSMA_CA_STARTED);
 
+#if MODULE_D7AP_DLL_DUTY_CYCLE_CHANNEL_COUNT > 0 || defined(SCAN_WINDOWS_ENABLED)
+    timer_tick_t csma_ca_delay = 0;
+#if MODULE_D7AP_DLL_DUTY_CYCLE_CHANNEL_COUNT > 0
+    // only the frames with a channel queue can wait, the frames of a dialog have to follow the previous frame
+    if (channel_queue_count > 0)
+    {
+        csma_ca_delay = schedule_duty_cycle(packet);
+        if (csma_ca_delay > 0)
+            DPRINT("Duty cycle of channel %i exhausted, waiting %i ticks", current_channel_id.center_freq_index, csma_ca_delay);
+    }
+#endif
+#ifdef SCAN_WINDOWS_ENABLED
+    if (packet->type == BACKGROUND_ADV)
+        csma_ca_delay = schedule_scan_window(packet, csma_ca_delay);
+#endif
+
+    if (csma_ca_delay > 0)
+    {
+        timer_post_task_prio_delay(&execute_csma_ca, csma_ca_delay, MAX_PRIORITY);
+        return;
+    }
+#endif
+
     if ((packet->type == RESPONSE_TO_UNICAST) || (packet->type == RESPONSE_TO_BROADCAST))
     {
-        // If the Requester provides an Execution Delay Timeout, the Responders delay their responses
+        // If the Requester provides an Execution Delay Timeout, the Responders delay their responses.
+        // The request was processed and the response assembled on receipt, so only the channel access is left: the
+        // CCA is started ahead so that the response is transmitted as soon as the Execution Delay period ends
         if (packet->d7atp_ctrl.ctrl_te)
         {
-            timer_tick_t Te = CT_DECOMPRESS(packet->d7atp_te);
+            timer_tick_t Te = CT_DECOMPRESS_TO_TICKS(packet->d7atp_te);
             timer_tick_t Trpd = timer_get_counter_value() - current_packet->request_received_timestamp; //response processing delay
+            timer_tick_t cca_lead = is_csma_ca_exempt(packet) ? 0 : CCA_MIN_DURATION;
 
             // the DLL foreground scan duration TC is adjusted to start after the Execution Delay period
             current_packet->request_received_timestamp += Te;
 
-            if (Te > Trpd)
+            if (Te > Trpd + cca_lead)
             {
-                Te -= Trpd;
-                timer_post_task_prio_delay(&execute_csma_ca, Te, MAX_PRIORITY);
+                Te -= Trpd + cca_lead;
+                timer_post_precise_task_prio_delay(&execute_csma_ca, Te, MAX_PRIORITY);
                 return;
             }
             // If the response processing delay TRPD is bigger than TE,
@@ -1015,8 +2545,7 @@ static void start_foreground_scan()
 {
     if (dll_state == DLL_STATE_SCAN_AUTOMATION)
     {
-        timer_cancel_task(&start_background_scan);
-        sched_cancel_task(&start_background_scan);
+        cancel_scan_automation_events();
         hw_radio_set_idle();
     }
 
@@ -1056,6 +2585,7 @@ void dll_stop_foreground_scan(bool auto_scan)
     else
     {
         DPRINT("Set the radio to idle state");
+        stop_secondary_scans();
         hw_radio_set_idle();
     }
 }
@@ -1103,23 +2633,15 @@ uint8_t dll_assemble_packet_header(packet_t* packet, uint8_t* data_ptr)
 bool dll_disassemble_packet_header(packet_t* packet, uint8_t* data_idx)
 {
     packet->dll_header.subnet = packet->hw_radio_packet.data[(*data_idx)]; (*data_idx)++;
-    uint8_t FSS = ACCESS_SPECIFIER(packet->dll_header.subnet);
-    uint8_t FSM = ACCESS_MASK(packet->dll_header.subnet);
     uint8_t address_len;
-    uint8_t id[8];
+    const uint8_t* id;
 
-    if ((FSS != 0x0F) && (FSS != ACCESS_SPECIFIER(active_access_class))) // check that the active access class is always set to the scan access class
+    if (!subnet_matches(packet->dll_header.subnet)) // check that the active access class is always set to the scan access class
     {
         DPRINT("Subnet 0x%02x does not match current access class 0x%02x, skipping packet", packet->dll_header.subnet, active_access_class);
         return false;
     }
 
-    if ((FSM & ACCESS_MASK(active_access_class)) == 0) // check that the active access class is always set to the scan access class
-    {
-        DPRINT("Subnet does not match current access class, skipping packet");
-        return false;
-    }
-
     packet->dll_header.control_target_id_type  = packet->hw_radio_packet.data[(*data_idx)] >> 6 ;
 
     if (packet->type == BACKGROUND_ADV)
@@ -1139,12 +2661,12 @@ bool dll_disassemble_packet_header(packet_t* packet, uint8_t* data_idx)
     {
         if (packet->dll_header.control_target_id_type == ID_TYPE_UID)
         {
-            fs_read_uid(id);
+            id = fs_get_identity()->uid;
             address_len = 8;
         }
         else
         {
-            fs_read_vid(id);
+            id = fs_get_identity()->vid;
             address_len = 2;
         }
 
@@ -46,9 +46,16 @@ typedef enum {
  */
 #define BACKGROUND_FRAME_LENGTH 6
 
+/*! \brief Upper bound of the size of the DLL header of a foreground frame: the subnet, the control and the longest
+ * target ID */
+#define DLL_MAX_HEADER_SIZE (1 + 1 + ID_TYPE_UID_ID_LENGTH)
+
 #define SFc    3 // Collision Avoidance Spreading Factor
 
-#define t_g    5 // Guarding period
+#define t_g    TI_TO_TIMER_TICKS(5) // Guarding period, in timer ticks
+
+/*! \brief Decompress a time value in Compressed Time format (expressed in Ti) to framework timer ticks */
+#define CT_DECOMPRESS_TO_TICKS(ct) TI_TO_TIMER_TICKS(CT_DECOMPRESS(ct))
 
 typedef struct packet packet_t;
 
@@ -64,17 +71,101 @@ typedef struct
     //uint8_t target_address[8]; // TODO assuming 8B UID for now
 } dll_header_t;
 
+/*! \brief The states of the DLL, the arguments of its TRACE_EVENT_STATE records */
+typedef enum
+{
+    DLL_STATE_IDLE,
+    DLL_STATE_SCAN_AUTOMATION,
+    DLL_STATE_CSMA_CA_STARTED,
+    DLL_STATE_CSMA_CA_RETRY,
+    DLL_STATE_CCA1,
+    DLL_STATE_CCA2,
+    DLL_STATE_CCA_FAIL,
+    DLL_STATE_FOREGROUND_SCAN,
+    DLL_STATE_TX_FOREGROUND,
+    DLL_STATE_TX_BACKGROUND,
+    DLL_STATE_TX_FOREGROUND_COMPLETED,
+    DLL_STATE_TX_DISCARDED
+} dll_state_t;
+
+/*! \brief Values for MODULE_D7AP_DLL_RX_OVERFLOW_POLICY, applied when a frame is received while the packet queue is full */
+#define DLL_RX_OVERFLOW_DROP_NEWEST             0
+#define DLL_RX_OVERFLOW_DROP_LOWEST_RSSI        1
+#define DLL_RX_OVERFLOW_PAUSE_BACKGROUND_SCAN   2
+
+/*! \brief Counters of received frames which were dropped by the DLL before being processed */
+typedef struct
+{
+    uint32_t no_buffer; /*!< Frames dropped because no packet buffer was available */
+    uint32_t evicted;   /*!< Queued frames dropped to make room for a new frame */
+    uint32_t too_late;  /*!< Queued frames dropped because they exceeded MODULE_D7AP_DLL_RX_MAX_AGE */
+    uint32_t filtered;  /*!< Frames aborted by the radio driver because their header does not match the subnet or address */
+} dll_rx_drop_counters_t;
+
+/*! \brief Link statistics of one access class on one channel, to tune the CSMA-CA parameters and channel plans */
+typedef struct
+{
+    uint8_t access_class;   /*!< The access class of the transmitted frames, or the one of the scanned channel when receiving */
+    channel_id_t channel_id;
+    uint16_t cca_attempts;  /*!< CCA measurements done */
+    uint16_t cca_failures;  /*!< CCA measurements which found the channel busy */
+    uint32_t backoff_time;  /*!< Time spent in CSMA-CA before transmitting or failing, in timer ticks */
+    uint32_t tx_airtime;    /*!< Time spent transmitting, in timer ticks, computed by dll_calculate_tx_duration() */
+    uint16_t rx_good;       /*!< Received frames with a valid CRC */
+    uint16_t rx_bad_crc;    /*!< Received frames with an invalid CRC */
+    uint16_t rx_filtered;   /*!< Frames aborted by the radio driver because their header does not match */
+} dll_link_stats_t;
+
 void dll_init();
-void dll_tx_frame(packet_t* packet);
+error_t dll_tx_frame(packet_t* packet); // ESIZE when the TX queue is full, the frame is not queued then and stays with the caller
 void dll_start_foreground_scan();
 void dll_stop_foreground_scan(bool auto_scan);
 void dll_execute_scan_automation();
 void dll_notify_dll_conf_file_changed();
+
+/*! \brief Sets the access classes a foreground scan automation scans besides the active access class
+ *
+ * The channels of their selectable subbands are added to the scan channel list of the active access class, with the
+ * channel header of their own access profile, so for instance a gateway receives the nodes using the lo rate and the
+ * normal rate class. The channels are scanned in turn for MODULE_D7AP_DLL_FG_SCAN_DWELL_TIME each, or in parallel
+ * by the additional radio instances. The frames addressed to the subnets of these access classes are accepted.
+ * \param access_classes   The access classes, which only apply when the active access class is scanned in foreground
+ * \param count            The number of access classes, 0 only scans the active access class
+ * \return SUCCESS, or ESIZE when count exceeds MODULE_D7AP_DLL_SCAN_EXTRA_ACCESS_CLASS_COUNT
+ */
+error_t dll_set_extra_scan_access_classes(const uint8_t* access_classes, uint8_t count);
+
 void dll_notify_access_profile_file_changed(); // TODO access specifier
 uint8_t dll_assemble_packet_header(packet_t* packet, uint8_t* data_ptr);
 bool dll_disassemble_packet_header(packet_t* packet, uint8_t* data_idx);
 uint16_t dll_calculate_tx_duration(phy_channel_class_t channel_class, phy_coding_t ch_coding, uint8_t packet_length);
 void dll_stop_background_scan();
+void dll_get_rx_drop_counters(dll_rx_drop_counters_t* counters);
+void dll_reset_rx_drop_counters();
+uint8_t dll_get_link_stats(dll_link_stats_t* stats, uint8_t max_count); // returns the number of entries copied
+void dll_reset_link_stats();
+
+/*! \brief The period of the scan events of the background scan automation, when it is driven by the MCU timer
+ *
+ * Tasks posted with this slack share the wakeup of a scan event, see timer_post_task_with_slack().
+ * \return 0 when no background scan events are scheduled
+ */
+timer_tick_t dll_get_background_scan_event_period();
+void dll_count_received_frame(const packet_t* packet, bool crc_valid);
+void dll_guard_received_channel(packet_t* packet); // called once the origin of a received foreground frame is known
+
+/*! \brief Updates the transmit power control of the frames to a peer with a frame received from it
+ *
+ * Only the frames carrying the target RX level of the peer (the D7ATP AGC flag) are used, the frames to the peers
+ * which did not report one are sent at the EIRP of the subband. Does nothing unless
+ * MODULE_D7AP_DLL_TX_POWER_CONTROL_PEER_COUNT > 0.
+ */
+void dll_update_peer_tx_power(const packet_t* packet, id_type_t peer_id_type, const uint8_t* peer_id);
+
+/*! \brief Raises the EIRP of the next frames to the peer by MODULE_D7AP_DLL_TX_POWER_CONTROL_MARGIN, after a frame
+ *  it missed
+ */
+void dll_signal_peer_tx_failure(id_type_t peer_id_type, const uint8_t* peer_id);
 
 
 #endif //OSS_7_DLL_H
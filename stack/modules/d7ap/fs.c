@@ -30,35 +30,314 @@
 #include "MODULE_D7AP_defs.h"
 #include "version.h"
 #include "dll.h"
+#include "packet_queue.h"
+#include "scheduler.h"
+#include "timer.h"
 #include "key.h"
+#include "bitmap.h"
+#include "random.h"
+#include "time_sync.h"
 
 #define D7A_PROTOCOL_VERSION_MAJOR 1
 #define D7A_PROTOCOL_VERSION_MINOR 1
 
-static fs_file_header_t NGDEF(_file_headers)[MODULE_D7AP_FS_FILE_COUNT] = { 0 };
-#define file_headers NG(_file_headers)
+#define FILE_ID_COUNT 256
+
+typedef struct
+{
+    uint8_t file_id;
+    uint16_t offset; // in data
+    fs_file_header_t header;
+} file_entry_t;
+
+// the index of the defined files sorted by file ID, so only the files in use take RAM
+static file_entry_t NGDEF(_files)[MODULE_D7AP_FS_FILE_COUNT];
+#define files NG(_files)
+
+static uint16_t NGDEF(_file_count);
+#define file_count NG(_file_count)
 
 static uint16_t NGDEF(_current_data_offset); // TODO we are using offset here instead of pointer because NG does not support pointers, fix later when NG is replaced
 #define current_data_offset NG(_current_data_offset)
 
+// the data of the files is kept contiguous in the order they were created, current_data_offset is the end
 static uint8_t NGDEF(_data)[MODULE_D7AP_FS_FILESYSTEM_SIZE] = { 0 };
 #define data NG(_data)
 
-static uint16_t NGDEF(_file_offsets)[MODULE_D7AP_FS_FILE_COUNT] = { 0 };
-#define file_offsets NG(_file_offsets)
-
 static bool NGDEF(_is_fs_init_completed);
 #define is_fs_init_completed NG(_is_fs_init_completed)
 
+static const fs_storage_backend_t* NGDEF(_file_storage);
+#define file_storage NG(_file_storage)
+
+// the files written since they were last stored
+static uint8_t NGDEF(_unstored_files)[FILE_ID_COUNT / 8];
+#define unstored_files NG(_unstored_files)
+
+static bool NGDEF(_is_store_pending);
+#define is_store_pending NG(_is_store_pending)
+
+// the nesting depth of fs_begin(), the notifications of the files written meanwhile are deferred to fs_commit()
+static uint8_t NGDEF(_transaction_depth);
+#define transaction_depth NG(_transaction_depth)
+
+static uint8_t NGDEF(_uncommitted_files)[FILE_ID_COUNT / 8];
+#define uncommitted_files NG(_uncommitted_files)
+
+#define ACCESS_PROFILE_NOT_CACHED 0xFF
+
+typedef struct
+{
+    uint8_t access_specifier; // ACCESS_PROFILE_NOT_CACHED when the entry is free
+    dae_access_profile_t access_profile;
+} access_profile_cache_entry_t;
+
+// the decoded access profiles, shared by the layers which switch between access classes
+static access_profile_cache_entry_t NGDEF(_access_profile_cache)[MODULE_D7AP_FS_ACCESS_PROFILE_CACHE_SIZE];
+#define access_profile_cache NG(_access_profile_cache)
+
+static uint8_t NGDEF(_access_profile_cache_next_entry);
+#define access_profile_cache_next_entry NG(_access_profile_cache_next_entry)
+
+static uint8_t NGDEF(_access_profile_version);
+#define access_profile_version NG(_access_profile_version)
+
+// see fs_get_generation()
+static uint16_t NGDEF(_generation);
+#define generation NG(_generation)
+
+static fs_identity_t NGDEF(_identity);
+#define identity NG(_identity)
+
+typedef struct
+{
+    timer_tick_t period; // 0 when the entry is free
+    timer_tick_t due_time; // the time of the execution without jitter, so the jitter does not accumulate
+    timer_tick_t execution_time;
+    fs_periodic_action_callback refresh_cb;
+    uint8_t file_id;
+} periodic_action_t;
+
+static periodic_action_t NGDEF(_periodic_actions)[MODULE_D7AP_FS_PERIODIC_ACTION_COUNT];
+#define periodic_actions NG(_periodic_actions)
+
+// the file of which the periodic action refreshes the content, its write does not trigger the action
+static periodic_action_t* NGDEF(_refreshed_periodic_action);
+#define refreshed_periodic_action NG(_refreshed_periodic_action)
+
+static void execute_periodic_actions();
+
+typedef struct
+{
+    fs_file_modified_callback callback; // NULL when the entry is free
+    uint8_t file_id;
+} file_modified_callback_registration_t;
+
+static file_modified_callback_registration_t NGDEF(_file_modified_callbacks)[MODULE_D7AP_FS_FILE_MODIFIED_CALLBACK_COUNT];
+#define file_modified_callbacks NG(_file_modified_callbacks)
+
+// the subscribed files written since their callbacks were last called
+static uint8_t NGDEF(_modified_files)[FILE_ID_COUNT / 8];
+#define modified_files NG(_modified_files)
+
+static void call_file_modified_callbacks();
+
+#if MODULE_D7AP_FS_FILE_COUNT > FILE_ID_COUNT
+    #error "MODULE_D7AP_FS_FILE_COUNT should not exceed the 256 file IDs"
+#endif
+
+#if D7A_FILE_LINK_STATS_SIZE > 255
+    #error "MODULE_D7AP_DLL_LINK_STATS_SIZE is too big, the link statistics file should not exceed 255 bytes"
+#endif
+
+#if D7A_FILE_ENERGY_STATS_SIZE > 255
+    #error "FRAMEWORK_ENERGY_TX_EIRP_COUNT is too big, the energy statistics file should not exceed 255 bytes"
+#endif
+
+// the index in files of file_id, or of the first file with a bigger ID when it is not defined
+static uint16_t find_file_index(uint8_t file_id)
+{
+    uint16_t low = 0;
+    uint16_t high = file_count;
+    while(low < high)
+    {
+        uint16_t middle = (low + high) / 2;
+        if(files[middle].file_id < file_id)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+static file_entry_t* get_file(uint8_t file_id)
+{
+    uint16_t index = find_file_index(file_id);
+    if(index < file_count && files[index].file_id == file_id)
+        return &files[index];
+
+    return NULL;
+}
+
 static inline bool is_file_defined(uint8_t file_id)
 {
-    return file_headers[file_id].length != 0;
+    return get_file(file_id) != NULL;
+}
+
+// NULL when the file is not defined
+static uint8_t* get_file_data(uint8_t file_id)
+{
+    file_entry_t* file = get_file(file_id);
+    return file != NULL ? data + file->offset : NULL;
+}
+
+static void add_file(uint8_t file_id, uint16_t offset, fs_file_header_t header)
+{
+    assert(file_count < MODULE_D7AP_FS_FILE_COUNT);
+    uint16_t index = find_file_index(file_id);
+    assert(index == file_count || files[index].file_id != file_id);
+    memmove(&files[index + 1], &files[index], (file_count - index) * sizeof(file_entry_t));
+    files[index] = (file_entry_t){ .file_id = file_id, .offset = offset, .header = header };
+    file_count++;
+}
+
+// the UID and firmware version are derived from the hardware and firmware on every boot, the statistics files are generated
+static bool is_stored_file(uint8_t file_id)
+{
+    if(file_id == D7A_FILE_UID_FILE_ID || file_id == D7A_FILE_FIRMWARE_VERSION_FILE_ID
+       || file_id == D7A_FILE_POOL_STATS_FILE_ID || file_id == D7A_FILE_LINK_STATS_FILE_ID
+       || file_id == D7A_FILE_ENERGY_STATS_FILE_ID || file_id == D7A_FILE_NETWORK_TIME_FILE_ID)
+        return false;
+
+    fs_storage_class_t storage_class = get_file(file_id)->header.file_properties.storage_class;
+    return storage_class == FS_STORAGE_PERMANENT || storage_class == FS_STORAGE_RESTORABLE;
+}
+
+static void store_files()
+{
+    is_store_pending = false;
+    for(uint16_t i = 0; i < file_count; i++)
+    {
+        if(!bitmap_get(unstored_files, files[i].file_id))
+            continue;
+
+        bitmap_clear(unstored_files, files[i].file_id);
+        file_storage->store_file(files[i].file_id, data + files[i].offset, files[i].header.length);
+    }
+}
+
+// the stored content replaces the defaults of the files which were just initialized
+static void load_files()
+{
+    for(uint16_t i = 0; i < file_count; i++)
+    {
+        if(is_stored_file(files[i].file_id))
+            file_storage->load_file(files[i].file_id, data + files[i].offset, files[i].header.length);
+    }
+}
+
+static uint8_t* write_pool_stats(uint8_t* ptr, const pool_stats_t* stats)
+{
+    (*ptr) = stats->size; ptr++;
+    (*ptr) = stats->in_use; ptr++;
+    (*ptr) = stats->high_water_mark; ptr++;
+    (*ptr) = stats->alloc_failed_count >> 8; ptr++;
+    (*ptr) = stats->alloc_failed_count & 0xFF; ptr++;
+    return ptr;
+}
+
+// the pool statistics are not stored in the filesystem but collected from the layers on every read
+static void read_pool_stats_file(uint8_t* file_data)
+{
+    pool_stats_t stats;
+    uint8_t* ptr = file_data;
+    packet_queue_get_stats(&stats); ptr = write_pool_stats(ptr, &stats);
+    alp_get_command_stats(&stats); ptr = write_pool_stats(ptr, &stats);
+    sched_get_task_table_stats(&stats); ptr = write_pool_stats(ptr, &stats);
+    sched_get_deferred_call_stats(&stats); ptr = write_pool_stats(ptr, &stats);
+    timer_get_stats(&stats); ptr = write_pool_stats(ptr, &stats);
+    assert(ptr - file_data == D7A_FILE_POOL_STATS_SIZE);
+}
+
+static void reset_pool_stats()
+{
+    packet_queue_reset_stats();
+    alp_reset_command_stats();
+    sched_reset_deferred_call_stats();
+    timer_reset_stats();
+}
+
+static uint8_t* write_uint16(uint8_t* ptr, uint16_t value)
+{
+    (*ptr) = value >> 8; ptr++;
+    (*ptr) = value & 0xFF; ptr++;
+    return ptr;
 }
 
+static uint8_t* write_uint32(uint8_t* ptr, uint32_t value)
+{
+    ptr = write_uint16(ptr, value >> 16);
+    return write_uint16(ptr, value & 0xFFFF);
+}
+
+// the link statistics are not stored in the filesystem but collected from the DLL on every read, unused entries are zero
+static void read_link_stats_file(uint8_t* file_data)
+{
+    dll_link_stats_t stats[MODULE_D7AP_DLL_LINK_STATS_SIZE];
+    uint8_t count = dll_get_link_stats(stats, MODULE_D7AP_DLL_LINK_STATS_SIZE);
+    uint8_t* ptr = file_data;
+    memset(file_data, 0, D7A_FILE_LINK_STATS_SIZE);
+    for(uint8_t i = 0; i < count; i++)
+    {
+        (*ptr) = stats[i].access_class; ptr++;
+        (*ptr) = stats[i].channel_id.channel_header_raw; ptr++;
+        ptr = write_uint16(ptr, stats[i].channel_id.center_freq_index);
+        ptr = write_uint16(ptr, stats[i].cca_attempts);
+        ptr = write_uint16(ptr, stats[i].cca_failures);
+        ptr = write_uint32(ptr, stats[i].backoff_time);
+        ptr = write_uint32(ptr, stats[i].tx_airtime);
+        ptr = write_uint16(ptr, stats[i].rx_good);
+        ptr = write_uint16(ptr, stats[i].rx_bad_crc);
+        ptr = write_uint16(ptr, stats[i].rx_filtered);
+    }
+
+    assert(ptr - file_data == count * D7A_FILE_LINK_STATS_ENTRY_SIZE);
+}
+
+#ifdef FRAMEWORK_ENERGY_ACCOUNTING_ENABLED
+// the energy statistics are not stored in the filesystem but collected on every read, unused TX entries are zero
+static void read_energy_stats_file(uint8_t* file_data)
+{
+    energy_stats_t stats;
+    energy_get_stats(&stats);
+    uint8_t* ptr = file_data;
+    memset(file_data, 0, D7A_FILE_ENERGY_STATS_SIZE);
+    ptr = write_uint32(ptr, stats.elapsed);
+    ptr = write_uint32(ptr, stats.cpu_active);
+    for(uint8_t mode = 0; mode < ENERGY_LOWPOWER_MODE_COUNT; mode++)
+        ptr = write_uint32(ptr, stats.cpu_sleep[mode]);
+
+    ptr = write_uint32(ptr, stats.radio[ENERGY_RADIO_IDLE]);
+    ptr = write_uint32(ptr, stats.radio[ENERGY_RADIO_RX]);
+    ptr = write_uint32(ptr, stats.radio[ENERGY_RADIO_TX]);
+    for(uint8_t i = 0; i < stats.tx_eirp_count; i++)
+    {
+        (*ptr) = stats.tx[i].eirp; ptr++;
+        ptr = write_uint32(ptr, stats.tx[i].time);
+    }
+
+    assert(ptr - file_data <= D7A_FILE_ENERGY_STATS_SIZE);
+}
+#endif
+
 static void execute_alp_command(uint8_t command_file_id)
 {
-    assert(is_file_defined(command_file_id));
-    uint8_t* data_ptr = (uint8_t*)(data + file_offsets[command_file_id]);
+    file_entry_t* command_file = get_file(command_file_id);
+    if(command_file == NULL)
+        return; // the action file was deleted
+
+    uint8_t* data_ptr = data + command_file->offset;
     uint8_t* file_start = data_ptr;
 
     // TODO refactor
@@ -72,26 +351,35 @@ static void execute_alp_command(uint8_t command_file_id)
     fifo_config.addressee.access_class = (*data_ptr); data_ptr++;
     memcpy(&(fifo_config.addressee.id), data_ptr, 8); data_ptr += 8; // TODO assume 8 for now
 
-    uint8_t alp_response[ALP_PAYLOAD_MAX_SIZE] = { 0 };
-    uint8_t alp_response_length = 0;
-    alp_process_command_result_on_d7asp(&fifo_config, data_ptr, file_headers[command_file_id].length - (uint8_t)(data_ptr - file_start), ALP_CMD_ORIGIN_D7AACTP);
+    alp_process_action_file(command_file_id, &fifo_config, data_ptr, command_file->header.length - (uint8_t)(data_ptr - file_start));
 }
 
 
+static void load_identity()
+{
+    fs_read_file(D7A_FILE_UID_FILE_ID, 0, identity.uid, D7A_FILE_UID_SIZE);
+    fs_read_file(D7A_FILE_DLL_CONF_FILE_ID, 0, &identity.active_access_class, 1);
+    fs_read_file(D7A_FILE_DLL_CONF_FILE_ID, 1, identity.vid, sizeof(identity.vid));
+    identity.vid_valid = identity.vid[0] != 0xFF || identity.vid[1] != 0xFF;
+}
+
+SCHED_REGISTER_TASK(execute_periodic_actions);
+SCHED_REGISTER_TASK(call_file_modified_callbacks);
+
 void fs_init(fs_init_args_t* init_args)
 {
-    // TODO store as big endian!
+    // the multi-byte fields of the system files are big endian, see the file structs in fs.h
     is_fs_init_completed = false;
     current_data_offset = 0;
+    file_count = 0;
 
     // 0x00 - UID
-    file_offsets[D7A_FILE_UID_FILE_ID] = current_data_offset;
-    file_headers[D7A_FILE_UID_FILE_ID] = (fs_file_header_t){
+    add_file(D7A_FILE_UID_FILE_ID, current_data_offset, (fs_file_header_t){
         .file_properties.action_protocol_enabled = 0,
         .file_properties.storage_class = FS_STORAGE_PERMANENT,
         .file_properties.permissions = 0, // TODO
         .length = D7A_FILE_UID_SIZE
-    };
+    });
 
     uint64_t id = hw_get_unique_id();
     uint64_t id_be = __builtin_bswap64(id);
@@ -100,13 +388,12 @@ void fs_init(fs_init_args_t* init_args)
 
 
     // 0x02 - Firmware version
-    file_offsets[D7A_FILE_FIRMWARE_VERSION_FILE_ID] = current_data_offset;
-    file_headers[D7A_FILE_FIRMWARE_VERSION_FILE_ID] = (fs_file_header_t){
+    add_file(D7A_FILE_FIRMWARE_VERSION_FILE_ID, current_data_offset, (fs_file_header_t){
         .file_properties.action_protocol_enabled = 0,
         .file_properties.storage_class = FS_STORAGE_PERMANENT,
         .file_properties.permissions = 0, // TODO
         .length = D7A_FILE_FIRMWARE_VERSION_SIZE
-    };
+    });
 
     memset(data + current_data_offset, D7A_PROTOCOL_VERSION_MAJOR, 1); current_data_offset++;
     memset(data + current_data_offset, D7A_PROTOCOL_VERSION_MINOR, 1); current_data_offset++;
@@ -116,13 +403,12 @@ void fs_init(fs_init_args_t* init_args)
     current_data_offset += D7A_FILE_FIRMWARE_VERSION_GIT_SHA1_SIZE;
 
     // 0x0A - DLL Configuration
-    file_offsets[D7A_FILE_DLL_CONF_FILE_ID] = current_data_offset;
-    file_headers[D7A_FILE_DLL_CONF_FILE_ID] = (fs_file_header_t){
+    add_file(D7A_FILE_DLL_CONF_FILE_ID, current_data_offset, (fs_file_header_t){
         .file_properties.action_protocol_enabled = 0,
         .file_properties.storage_class = FS_STORAGE_RESTORABLE,
         .file_properties.permissions = 0, // TODO
         .length = D7A_FILE_DLL_CONF_SIZE
-    };
+    });
 
     data[current_data_offset] = init_args->access_class; current_data_offset += 1; // active access class
     memset(data + current_data_offset, 0xFF, 2); current_data_offset += 2; // VID; 0xFFFF means not valid
@@ -132,75 +418,175 @@ void fs_init(fs_init_args_t* init_args)
     for(uint8_t i = 0; i < init_args->access_profiles_count; i++)
     {
         dae_access_profile_t* access_class = &(init_args->access_profiles[i]);
-        file_offsets[D7A_FILE_ACCESS_PROFILE_ID + i] = current_data_offset;
-        fs_write_access_class(i, access_class);
-        file_headers[D7A_FILE_ACCESS_PROFILE_ID + i] = (fs_file_header_t){
+        add_file(D7A_FILE_ACCESS_PROFILE_ID + i, current_data_offset, (fs_file_header_t){
             .file_properties.action_protocol_enabled = 0,
             .file_properties.storage_class = FS_STORAGE_PERMANENT,
             .file_properties.permissions = 0, // TODO
             .length = D7A_FILE_ACCESS_PROFILE_SIZE
-        };
+        });
+        fs_write_access_class(i, access_class);
+        current_data_offset += D7A_FILE_ACCESS_PROFILE_SIZE;
     }
 
     // 0x0D- Network security
-    file_offsets[D7A_FILE_NWL_SECURITY] = current_data_offset;
-    file_headers[D7A_FILE_NWL_SECURITY] = (fs_file_header_t){
+    add_file(D7A_FILE_NWL_SECURITY, current_data_offset, (fs_file_header_t){
         .file_properties.action_protocol_enabled = 0,
         .file_properties.storage_class = FS_STORAGE_PERMANENT,
         .file_properties.permissions = 0, // TODO
         .length = D7A_FILE_NWL_SECURITY_SIZE
-    };
+    });
 
     memset(data + current_data_offset, 0, D7A_FILE_NWL_SECURITY_SIZE);
     current_data_offset += D7A_FILE_NWL_SECURITY_SIZE;
 
     // 0x0E - Network security key
-    file_offsets[D7A_FILE_NWL_SECURITY_KEY] = current_data_offset;
-    file_headers[D7A_FILE_NWL_SECURITY_KEY] = (fs_file_header_t){
+    add_file(D7A_FILE_NWL_SECURITY_KEY, current_data_offset, (fs_file_header_t){
         .file_properties.action_protocol_enabled = 0,
         .file_properties.storage_class = FS_STORAGE_PERMANENT,
         .file_properties.permissions = 0, // TODO
         .length = D7A_FILE_NWL_SECURITY_KEY_SIZE
-    };
+    });
 
     memcpy(data + current_data_offset, AES128_key, D7A_FILE_NWL_SECURITY_KEY_SIZE);
     current_data_offset += D7A_FILE_NWL_SECURITY_KEY_SIZE;
 
     // 0x0F - Network security state register
-    file_offsets[D7A_FILE_NWL_SECURITY_STATE_REG] = current_data_offset;
-    file_headers[D7A_FILE_NWL_SECURITY_STATE_REG] = (fs_file_header_t){
+    add_file(D7A_FILE_NWL_SECURITY_STATE_REG, current_data_offset, (fs_file_header_t){
         .file_properties.action_protocol_enabled = 0,
         .file_properties.storage_class = FS_STORAGE_PERMANENT,
         .file_properties.permissions = 0, // TODO
         .length = init_args->ssr_filter_mode & ENABLE_SSR_FILTER ? D7A_FILE_NWL_SECURITY_STATE_REG_SIZE : 1
-    };
+    });
 
     data[current_data_offset] = init_args->ssr_filter_mode; current_data_offset++;
     data[current_data_offset] = 0; current_data_offset++;
     if (init_args->ssr_filter_mode & ENABLE_SSR_FILTER)
         current_data_offset += D7A_FILE_NWL_SECURITY_STATE_REG_SIZE - 2;
 
+    // 0x3F - Pool statistics
+    add_file(D7A_FILE_POOL_STATS_FILE_ID, current_data_offset, (fs_file_header_t){
+        .file_properties.action_protocol_enabled = 0,
+        .file_properties.storage_class = FS_STORAGE_VOLATILE,
+        .file_properties.permissions = 0, // TODO
+        .length = D7A_FILE_POOL_STATS_SIZE
+    });
+
+    // 0x3E - Link statistics
+    add_file(D7A_FILE_LINK_STATS_FILE_ID, current_data_offset, (fs_file_header_t){
+        .file_properties.action_protocol_enabled = 0,
+        .file_properties.storage_class = FS_STORAGE_VOLATILE,
+        .file_properties.permissions = 0, // TODO
+        .length = D7A_FILE_LINK_STATS_SIZE
+    });
+
+#ifdef FRAMEWORK_ENERGY_ACCOUNTING_ENABLED
+    // 0x3D - Energy statistics
+    add_file(D7A_FILE_ENERGY_STATS_FILE_ID, current_data_offset, (fs_file_header_t){
+        .file_properties.action_protocol_enabled = 0,
+        .file_properties.storage_class = FS_STORAGE_VOLATILE,
+        .file_properties.permissions = 0, // TODO
+        .length = D7A_FILE_ENERGY_STATS_SIZE
+    });
+#endif
+
+#if MODULE_D7AP_TIME_SYNC_ROLE > 0
+    // 0x3C - Network time
+    add_file(D7A_FILE_NETWORK_TIME_FILE_ID, current_data_offset, (fs_file_header_t){
+        .file_properties.action_protocol_enabled = 0,
+        .file_properties.storage_class = FS_STORAGE_VOLATILE,
+        .file_properties.permissions = 0, // TODO
+        .length = D7A_FILE_NETWORK_TIME_SIZE
+    });
+#endif
+
     // init user files
     if(init_args->fs_user_files_init_cb)
         init_args->fs_user_files_init_cb();
 
     assert(current_data_offset <= MODULE_D7AP_FS_FILESYSTEM_SIZE);
+
+    file_storage = init_args->storage_backend;
+    memset(unstored_files, 0, sizeof(unstored_files));
+    is_store_pending = false;
+    memset(uncommitted_files, 0, sizeof(uncommitted_files));
+    transaction_depth = 0;
+    generation = 0;
+    for(uint8_t i = 0; i < MODULE_D7AP_FS_ACCESS_PROFILE_CACHE_SIZE; i++)
+        access_profile_cache[i].access_specifier = ACCESS_PROFILE_NOT_CACHED;
+
+    access_profile_cache_next_entry = 0;
+    if(file_storage != NULL)
+    {
+        sched_register_task(&store_files);
+        load_files();
+    }
+
+    memset(periodic_actions, 0, sizeof(periodic_actions));
+    refreshed_periodic_action = NULL;
+
+    memset(file_modified_callbacks, 0, sizeof(file_modified_callbacks));
+    memset(modified_files, 0, sizeof(modified_files));
+
+    load_identity();
     is_fs_init_completed = true;
 }
 
 void fs_init_file(uint8_t file_id, const fs_file_header_t* file_header, const uint8_t* initial_data)
 {
-    assert(!is_fs_init_completed); // initing files not allowed after fs_init() completed (for now?)
-    assert(file_id < MODULE_D7AP_FS_FILE_COUNT);
+    assert(!is_fs_init_completed); // use fs_create_file() after fs_init() completed
     assert(file_id >= 0x40); // system files may not be inited
-    assert(current_data_offset + file_header->length <= MODULE_D7AP_FS_FILESYSTEM_SIZE);
+    alp_status_codes_t status = fs_create_file(file_id, file_header, initial_data);
+    assert(status == ALP_STATUS_OK);
+}
 
-    file_offsets[file_id] = current_data_offset;
-    memcpy(file_headers + file_id, file_header, sizeof(fs_file_header_t));
+alp_status_codes_t fs_create_file(uint8_t file_id, const fs_file_header_t* file_header, const uint8_t* initial_data)
+{
+    if(file_id < 0x40) return ALP_STATUS_INSUFFICIENT_PERMISSIONS; // system files cannot be created
+    if(is_file_defined(file_id)) return ALP_STATUS_FILE_ID_ALREADY_EXISTS;
+    if(file_header->length == 0) return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+    // the length of a created file comes from the command, it is bound before it is added to the 16 bit offsets
+    if(file_header->length > UINT16_MAX || file_count == MODULE_D7AP_FS_FILE_COUNT
+       || file_header->length > MODULE_D7AP_FS_FILESYSTEM_SIZE - current_data_offset)
+        return ALP_STATUS_ALLOCATION_OVERFLOW;
+
+    generation++;
+    add_file(file_id, current_data_offset, *file_header);
     memset(data + current_data_offset, 0, file_header->length);
     current_data_offset += file_header->length;
     if(initial_data != NULL)
         fs_write_file(file_id, 0, initial_data, file_header->length);
+
+    return ALP_STATUS_OK;
+}
+
+alp_status_codes_t fs_delete_file(uint8_t file_id)
+{
+    if(file_id < 0x40) return ALP_STATUS_INSUFFICIENT_PERMISSIONS; // system files cannot be deleted
+    uint16_t index = find_file_index(file_id);
+    if(index == file_count || files[index].file_id != file_id) return ALP_STATUS_FILE_ID_NOT_EXISTS;
+
+    fs_set_file_action_period(file_id, 0, NULL);
+
+    // the data of the files after it moves down, so the free space stays at the end
+    generation++;
+    uint16_t offset = files[index].offset;
+    uint16_t length = files[index].header.length;
+    memmove(data + offset, data + offset + length, current_data_offset - offset - length);
+    current_data_offset -= length;
+
+    memmove(&files[index], &files[index + 1], (file_count - index - 1) * sizeof(file_entry_t));
+    file_count--;
+    for(uint16_t i = 0; i < file_count; i++)
+    {
+        if(files[i].offset > offset)
+            files[i].offset -= length;
+    }
+
+    bitmap_clear(unstored_files, file_id);
+    bitmap_clear(uncommitted_files, file_id);
+    bitmap_clear(modified_files, file_id);
+    alp_notify_file_changed(file_id);
+    return ALP_STATUS_OK;
 }
 
 void fs_init_file_with_D7AActP(uint8_t file_id, const d7asp_master_session_config_t* fifo_config, const uint8_t* alp_command, const uint8_t alp_command_len)
@@ -227,48 +613,504 @@ void fs_init_file_with_D7AActP(uint8_t file_id, const d7asp_master_session_confi
     fs_init_file(file_id, &action_file_header, alp_command_buffer);
 }
 
-alp_status_codes_t fs_read_file(uint8_t file_id, uint8_t offset, uint8_t* buffer, uint8_t length)
+// offset + length can overflow for the offsets and lengths received over ALP
+static inline bool is_area_in_file(const file_entry_t* file, uint32_t offset, uint32_t length)
 {
-    if(!is_file_defined(file_id)) return ALP_STATUS_FILE_ID_NOT_EXISTS;
-    if(file_headers[file_id].length < offset + length) return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error (wait for spec discussion)
+    return offset <= file->header.length && length <= file->header.length - offset;
+}
 
-    memcpy(buffer, data + file_offsets[file_id] + offset, length);
+alp_status_codes_t fs_read_file(uint8_t file_id, uint32_t offset, uint8_t* buffer, uint32_t length)
+{
+    file_entry_t* file = get_file(file_id);
+    if(file == NULL) return ALP_STATUS_FILE_ID_NOT_EXISTS;
+    if(!is_area_in_file(file, offset, length)) return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error (wait for spec discussion)
+
+    if(file_id == D7A_FILE_POOL_STATS_FILE_ID)
+    {
+        // per pool: size, in use, high water mark and the alloc failed count (big endian, 2 bytes), in the order
+        // packet queue, ALP commands, scheduler tasks, scheduler deferred calls and timers
+        uint8_t file_data[D7A_FILE_POOL_STATS_SIZE];
+        read_pool_stats_file(file_data);
+        memcpy(buffer, file_data + offset, length);
+        return ALP_STATUS_OK;
+    }
+
+    if(file_id == D7A_FILE_LINK_STATS_FILE_ID)
+    {
+        // per access class and channel: the access class, the channel header, the center frequency index, the CCA attempts
+        // and failures, the backoff time and TX airtime in timer ticks (4 bytes), the received frames with a good and a bad CRC
+        // and the filtered frames. All multi-byte fields are big endian and 2 bytes unless specified otherwise
+        uint8_t file_data[D7A_FILE_LINK_STATS_SIZE];
+        read_link_stats_file(file_data);
+        memcpy(buffer, file_data + offset, length);
+        return ALP_STATUS_OK;
+    }
+
+#ifdef FRAMEWORK_ENERGY_ACCOUNTING_ENABLED
+    if(file_id == D7A_FILE_ENERGY_STATS_FILE_ID)
+    {
+        // in timer ticks (4 bytes, big endian): the elapsed time, the time the MCU is active and the time per low power
+        // mode, the time the radio is idle, receiving and transmitting. Followed by the TX time per EIRP: the EIRP in dBm
+        // and the time, in the order in which the EIRPs were first used
+        uint8_t file_data[D7A_FILE_ENERGY_STATS_SIZE];
+        read_energy_stats_file(file_data);
+        memcpy(buffer, file_data + offset, length);
+        return ALP_STATUS_OK;
+    }
+#endif
+
+#if MODULE_D7AP_TIME_SYNC_ROLE > 0
+    if(file_id == D7A_FILE_NETWORK_TIME_FILE_ID)
+    {
+        uint32_t network_time = __builtin_bswap32(time_sync_get_network_time());
+        memcpy(buffer, (uint8_t*)&network_time + offset, length);
+        return ALP_STATUS_OK;
+    }
+#endif
+
+    memcpy(buffer, data + file->offset + offset, length);
     return ALP_STATUS_OK;
 }
 
-alp_status_codes_t fs_write_file(uint8_t file_id, uint8_t offset, const uint8_t* buffer, uint8_t length)
+static void call_file_modified_callbacks()
+{
+    for(uint16_t file_id = 0; file_id < FILE_ID_COUNT; file_id++)
+    {
+        if(!bitmap_get(modified_files, file_id))
+            continue;
+
+        // cleared first, so a write from a callback posts the task again
+        bitmap_clear(modified_files, file_id);
+        for(uint8_t i = 0; i < MODULE_D7AP_FS_FILE_MODIFIED_CALLBACK_COUNT; i++)
+        {
+            if(file_modified_callbacks[i].callback != NULL && file_modified_callbacks[i].file_id == file_id)
+                file_modified_callbacks[i].callback(file_id);
+        }
+    }
+}
+
+// the callbacks are called from a task, the writes done meanwhile are reported once
+static void post_file_modified_callbacks(uint8_t file_id)
+{
+    for(uint8_t i = 0; i < MODULE_D7AP_FS_FILE_MODIFIED_CALLBACK_COUNT; i++)
+    {
+        if(file_modified_callbacks[i].callback != NULL && file_modified_callbacks[i].file_id == file_id)
+        {
+            bitmap_set(modified_files, file_id);
+            sched_post_task(&call_file_modified_callbacks);
+            return;
+        }
+    }
+}
+
+alp_status_codes_t fs_register_file_modified_callback(uint8_t file_id, fs_file_modified_callback callback)
 {
     if(!is_file_defined(file_id)) return ALP_STATUS_FILE_ID_NOT_EXISTS;
-    if(file_headers[file_id].length < offset + length) return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error (wait for spec discussion)
 
-    memcpy(data + file_offsets[file_id] + offset, buffer, length);
+    for(uint8_t i = 0; i < MODULE_D7AP_FS_FILE_MODIFIED_CALLBACK_COUNT; i++)
+    {
+        if(file_modified_callbacks[i].callback == NULL)
+        {
+            file_modified_callbacks[i] = (file_modified_callback_registration_t){ .callback = callback, .file_id = file_id };
+            return ALP_STATUS_OK;
+        }
+    }
+
+    return ALP_STATUS_UNKNOWN_ERROR; // all MODULE_D7AP_FS_FILE_MODIFIED_CALLBACK_COUNT entries are in use
+}
 
-    if(file_headers[file_id].file_properties.action_protocol_enabled == true
-            && file_headers[file_id].file_properties.action_condition == ALP_ACT_COND_WRITE) // TODO ALP_ACT_COND_WRITEFLUSH?
+void fs_unregister_file_modified_callback(uint8_t file_id, fs_file_modified_callback callback)
+{
+    for(uint8_t i = 0; i < MODULE_D7AP_FS_FILE_MODIFIED_CALLBACK_COUNT; i++)
     {
-        execute_alp_command(file_headers[file_id].file_properties.action_file_id);
+        if(file_modified_callbacks[i].callback == callback && file_modified_callbacks[i].file_id == file_id)
+            file_modified_callbacks[i].callback = NULL;
     }
+}
 
-    if(file_id == D7A_FILE_DLL_CONF_FILE_ID)
+// the defaults written while initializing are not stored, the stored content is loaded over them
+static void schedule_file_storage(uint8_t file_id)
+{
+    if(!is_fs_init_completed || file_storage == NULL || !is_stored_file(file_id))
+        return;
+
+    bitmap_set(unstored_files, file_id);
+    if(!is_store_pending)
     {
-        dll_notify_dll_conf_file_changed();
+        // the files written meanwhile are stored together
+        timer_post_task_delay(&store_files, MODULE_D7AP_FS_STORAGE_DELAY * TIMER_TICKS_PER_SEC / 1000);
+        is_store_pending = true;
     }
-    else if(file_id >= D7A_FILE_ACCESS_PROFILE_ID && file_id <= D7A_FILE_ACCESS_PROFILE_ID + 14)
+}
+
+// executes the action and schedules the storage of the file after it was written
+static void notify_file_changed(uint8_t file_id)
+{
+    alp_notify_file_changed(file_id);
+    post_file_modified_callbacks(file_id);
+    schedule_file_storage(file_id);
+
+    fs_file_properties_t* file_properties = &(get_file(file_id)->header.file_properties);
+    if(file_properties->action_protocol_enabled == true
+            && file_properties->action_condition == ALP_ACT_COND_WRITE // TODO ALP_ACT_COND_WRITEFLUSH?
+            && (refreshed_periodic_action == NULL || refreshed_periodic_action->file_id != file_id))
     {
+        execute_alp_command(file_properties->action_file_id);
+    }
+}
+
+static inline bool is_access_profile_file(uint8_t file_id)
+{
+    return file_id >= D7A_FILE_ACCESS_PROFILE_ID && file_id <= D7A_FILE_ACCESS_PROFILE_ID + 14;
+}
+
+static inline bool is_nwl_security_file(uint8_t file_id)
+{
+    return file_id == D7A_FILE_NWL_SECURITY_KEY || file_id == D7A_FILE_NWL_SECURITY;
+}
+
+static void notify_layers(bool is_dll_conf_changed, bool is_access_profile_changed, bool is_nwl_security_changed)
+{
+    if(is_dll_conf_changed)
+    {
+        d7anp_notify_dll_conf_file_changed();
+        dll_notify_dll_conf_file_changed();
+    }
+
+    if(is_access_profile_changed)
         dll_notify_access_profile_file_changed();
+
+    if(is_nwl_security_changed)
+        d7anp_notify_nwl_security_file_changed();
+}
+
+// the written data is visible immediately, also inside a transaction, so the decoded profile is dropped right away
+static void invalidate_access_profile(uint8_t access_specifier)
+{
+    for(uint8_t i = 0; i < MODULE_D7AP_FS_ACCESS_PROFILE_CACHE_SIZE; i++)
+    {
+        if(access_profile_cache[i].access_specifier == access_specifier)
+            access_profile_cache[i].access_specifier = ACCESS_PROFILE_NOT_CACHED;
+    }
+
+    access_profile_version++;
+}
+
+static void notify_file_written(uint8_t file_id)
+{
+    generation++;
+    if(is_access_profile_file(file_id))
+        invalidate_access_profile(file_id - D7A_FILE_ACCESS_PROFILE_ID);
+
+    if(file_id == D7A_FILE_UID_FILE_ID || file_id == D7A_FILE_DLL_CONF_FILE_ID)
+        load_identity();
+
+    if(transaction_depth > 0)
+    {
+        bitmap_set(uncommitted_files, file_id);
+        return;
+    }
+
+    notify_file_changed(file_id);
+    notify_layers(file_id == D7A_FILE_DLL_CONF_FILE_ID, is_access_profile_file(file_id), is_nwl_security_file(file_id));
+}
+
+void fs_begin()
+{
+    assert(transaction_depth < 255);
+    transaction_depth++;
+}
+
+void fs_commit()
+{
+    assert(transaction_depth > 0);
+    transaction_depth--;
+    if(transaction_depth > 0)
+        return; // the outermost fs_commit() notifies
+
+    bool is_dll_conf_changed = false;
+    bool is_access_profile_changed = false;
+    bool is_nwl_security_changed = false;
+    // by ID, the actions executed here can create or delete files
+    for(uint16_t file_id = 0; file_id < FILE_ID_COUNT; file_id++)
+    {
+        if(!bitmap_get(uncommitted_files, file_id))
+            continue;
+
+        // cleared first, the files written by the actions executed here are notified immediately
+        bitmap_clear(uncommitted_files, file_id);
+        notify_file_changed(file_id);
+        is_dll_conf_changed |= file_id == D7A_FILE_DLL_CONF_FILE_ID;
+        is_access_profile_changed |= is_access_profile_file(file_id);
+        is_nwl_security_changed |= is_nwl_security_file(file_id);
+    }
+
+    // the layers are notified once, even when several of their files were written
+    notify_layers(is_dll_conf_changed, is_access_profile_changed, is_nwl_security_changed);
+}
+
+// a random delay, so the nodes of a fleet booted together do not execute their periodic actions at the same time
+static timer_tick_t get_periodic_action_jitter(timer_tick_t period)
+{
+    timer_tick_t max_jitter = MODULE_D7AP_FS_PERIODIC_ACTION_JITTER * TIMER_TICKS_PER_SEC / 1000;
+    if(max_jitter > period / 2)
+        max_jitter = period / 2;
+
+    return get_rnd() % (max_jitter + 1);
+}
+
+static void schedule_periodic_actions()
+{
+    periodic_action_t* next_action = NULL;
+    for(uint8_t i = 0; i < MODULE_D7AP_FS_PERIODIC_ACTION_COUNT; i++)
+    {
+        if(periodic_actions[i].period != 0 && (next_action == NULL
+           || (int32_t)(periodic_actions[i].execution_time - next_action->execution_time) < 0))
+            next_action = &periodic_actions[i];
+    }
+
+    timer_cancel_task(&execute_periodic_actions);
+    if(next_action == NULL)
+        return;
+
+    // the slack lets the execution share the wakeup of the next scan event of the DLL, so the radio and MCU wake up once
+    // for both
+    timer_tick_t slack = dll_get_background_scan_event_period();
+    if(slack > next_action->period / 4)
+        slack = next_action->period / 4;
+
+    timer_post_task_with_slack(&execute_periodic_actions, next_action->execution_time, slack, DEFAULT_PRIORITY);
+}
+
+static void execute_periodic_actions()
+{
+    timer_tick_t now = timer_get_counter_value();
+    for(uint8_t i = 0; i < MODULE_D7AP_FS_PERIODIC_ACTION_COUNT; i++)
+    {
+        periodic_action_t* periodic_action = &periodic_actions[i];
+        if(periodic_action->period == 0 || (int32_t)(now - periodic_action->execution_time) < 0)
+            continue;
+
+        if(periodic_action->refresh_cb != NULL)
+        {
+            refreshed_periodic_action = periodic_action;
+            periodic_action->refresh_cb(periodic_action->file_id);
+            refreshed_periodic_action = NULL;
+        }
+
+        file_entry_t* file = get_file(periodic_action->file_id);
+        if(file != NULL && file->header.file_properties.action_protocol_enabled)
+            execute_alp_command(file->header.file_properties.action_file_id);
+
+        periodic_action->due_time += periodic_action->period;
+        if((int32_t)(now - periodic_action->due_time) >= 0)
+            periodic_action->due_time = now + periodic_action->period; // the executions which were missed are dropped
+
+        periodic_action->execution_time = periodic_action->due_time + get_periodic_action_jitter(periodic_action->period);
+    }
+
+    schedule_periodic_actions();
+}
+
+alp_status_codes_t fs_set_file_action_period(uint8_t file_id, uint32_t period, fs_periodic_action_callback refresh_cb)
+{
+    file_entry_t* file = get_file(file_id);
+    if(file == NULL) return ALP_STATUS_FILE_ID_NOT_EXISTS;
+    if(period != 0 && !file->header.file_properties.action_protocol_enabled) return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error
+
+    periodic_action_t* periodic_action = NULL;
+    for(uint8_t i = 0; i < MODULE_D7AP_FS_PERIODIC_ACTION_COUNT; i++)
+    {
+        if(periodic_actions[i].period != 0 && periodic_actions[i].file_id == file_id)
+            periodic_action = &periodic_actions[i];
+        else if(periodic_action == NULL && periodic_actions[i].period == 0)
+            periodic_action = &periodic_actions[i]; // replaced when the file has an entry further on
     }
 
+    if(period == 0)
+    {
+        if(periodic_action != NULL && periodic_action->file_id == file_id)
+            periodic_action->period = 0;
+    }
+    else
+    {
+        if(periodic_action == NULL)
+            return ALP_STATUS_UNKNOWN_ERROR; // all MODULE_D7AP_FS_PERIODIC_ACTION_COUNT entries are in use
+
+        timer_tick_t period_ticks = (uint64_t)period * TIMER_TICKS_PER_SEC / 1000;
+        *periodic_action = (periodic_action_t){
+            .period = period_ticks,
+            .due_time = timer_get_counter_value() + period_ticks,
+            .refresh_cb = refresh_cb,
+            .file_id = file_id
+        };
+        periodic_action->execution_time = periodic_action->due_time + get_periodic_action_jitter(period_ticks);
+    }
+
+    schedule_periodic_actions();
     return ALP_STATUS_OK;
 }
 
+alp_status_codes_t fs_write_file(uint8_t file_id, uint32_t offset, const uint8_t* buffer, uint32_t length)
+{
+    file_entry_t* file = get_file(file_id);
+    if(file == NULL) return ALP_STATUS_FILE_ID_NOT_EXISTS;
+    if(!is_area_in_file(file, offset, length)) return ALP_STATUS_UNKNOWN_ERROR; // TODO more specific error (wait for spec discussion)
+
+    if(file_id == D7A_FILE_POOL_STATS_FILE_ID)
+    {
+        reset_pool_stats();
+        return ALP_STATUS_OK;
+    }
+
+    if(file_id == D7A_FILE_LINK_STATS_FILE_ID)
+    {
+        dll_reset_link_stats();
+        return ALP_STATUS_OK;
+    }
+
+#ifdef FRAMEWORK_ENERGY_ACCOUNTING_ENABLED
+    if(file_id == D7A_FILE_ENERGY_STATS_FILE_ID)
+    {
+        energy_reset_stats();
+        return ALP_STATUS_OK;
+    }
+#endif
+
+#if MODULE_D7AP_TIME_SYNC_ROLE > 0
+    // a partial write changes these bytes of the current network time
+    if(file_id == D7A_FILE_NETWORK_TIME_FILE_ID)
+    {
+        uint32_t network_time = __builtin_bswap32(time_sync_get_network_time());
+        memcpy((uint8_t*)&network_time + offset, buffer, length);
+        time_sync_set_network_time(__builtin_bswap32(network_time));
+        return ALP_STATUS_OK;
+    }
+#endif
+
+    memcpy(data + file->offset + offset, buffer, length);
+    notify_file_written(file_id);
+    return ALP_STATUS_OK;
+}
+
+// the statistics files are generated when read, and reset when written. The network time file is generated as well
+static inline bool is_stats_file(uint8_t file_id)
+{
+    return file_id == D7A_FILE_POOL_STATS_FILE_ID || file_id == D7A_FILE_LINK_STATS_FILE_ID
+           || file_id == D7A_FILE_ENERGY_STATS_FILE_ID || file_id == D7A_FILE_NETWORK_TIME_FILE_ID;
+}
+
+const uint8_t* fs_get_file_view(uint8_t file_id, uint32_t offset, uint32_t length)
+{
+    file_entry_t* file = get_file(file_id);
+    if(file == NULL || !is_area_in_file(file, offset, length) || is_stats_file(file_id))
+        return NULL;
+
+    return data + file->offset + offset;
+}
+
+uint16_t fs_get_generation()
+{
+    return generation;
+}
+
+static alp_status_codes_t check_file_segments(const fs_file_segment_t* segments, uint8_t count)
+{
+    for(uint8_t i = 0; i < count; i++)
+    {
+        file_entry_t* file = get_file(segments[i].file_id);
+        if(file == NULL) return ALP_STATUS_FILE_ID_NOT_EXISTS;
+        if(!is_area_in_file(file, segments[i].offset, segments[i].length)) return ALP_STATUS_UNKNOWN_ERROR;
+    }
+
+    return ALP_STATUS_OK;
+}
+
+// the number of segments following segments[0] which continue both its area in the file system and in the buffer, so
+// they can be copied at once
+static uint8_t get_contiguous_segment_count(const fs_file_segment_t* segments, uint8_t count, uint32_t* length)
+{
+    *length = segments[0].length;
+    uint8_t* end = get_file_data(segments[0].file_id) + segments[0].offset + segments[0].length;
+    uint8_t i = 1;
+    for(; i < count; i++)
+    {
+        if(is_stats_file(segments[i].file_id) || get_file_data(segments[i].file_id) + segments[i].offset != end
+           || segments[i].buffer != segments[0].buffer + *length)
+            break;
+
+        *length += segments[i].length;
+        end += segments[i].length;
+    }
+
+    return i - 1;
+}
+
+alp_status_codes_t fs_read_files_v(const fs_file_segment_t* segments, uint8_t count)
+{
+    alp_status_codes_t status = check_file_segments(segments, count);
+    if(status != ALP_STATUS_OK) return status;
+
+    for(uint8_t i = 0; i < count; i++)
+    {
+        if(is_stats_file(segments[i].file_id))
+        {
+            fs_read_file(segments[i].file_id, segments[i].offset, segments[i].buffer, segments[i].length);
+            continue;
+        }
+
+        uint32_t length;
+        uint8_t merged = get_contiguous_segment_count(&segments[i], count - i, &length);
+        memcpy(segments[i].buffer, get_file_data(segments[i].file_id) + segments[i].offset, length);
+        i += merged;
+    }
+
+    return ALP_STATUS_OK;
+}
+
+alp_status_codes_t fs_write_files_v(const fs_file_segment_t* segments, uint8_t count)
+{
+    alp_status_codes_t status = check_file_segments(segments, count);
+    if(status != ALP_STATUS_OK) return status;
+
+    fs_begin();
+    for(uint8_t i = 0; i < count; i++)
+    {
+        if(is_stats_file(segments[i].file_id))
+            continue; // reset below
+
+        uint32_t length;
+        uint8_t merged = get_contiguous_segment_count(&segments[i], count - i, &length);
+        memcpy(get_file_data(segments[i].file_id) + segments[i].offset, segments[i].buffer, length);
+        i += merged;
+    }
+
+    for(uint8_t i = 0; i < count; i++)
+    {
+        if(is_stats_file(segments[i].file_id))
+            fs_write_file(segments[i].file_id, 0, NULL, 0);
+        else
+            notify_file_written(segments[i].file_id);
+    }
+
+    // every file is notified once, after all segments are written
+    fs_commit();
+    return ALP_STATUS_OK;
+}
+
+const fs_identity_t* fs_get_identity()
+{
+    return &identity;
+}
+
 void fs_read_uid(uint8_t *buffer)
 {
-    fs_read_file(D7A_FILE_UID_FILE_ID, 0, buffer, D7A_FILE_UID_SIZE);
+    memcpy(buffer, identity.uid, D7A_FILE_UID_SIZE);
 }
 
 void fs_read_vid(uint8_t *buffer)
 {
-    fs_read_file(D7A_FILE_DLL_CONF_FILE_ID, 1, buffer, 2);
+    memcpy(buffer, identity.vid, sizeof(identity.vid));
 }
 
 void fs_write_vid(uint8_t* buffer)
@@ -283,46 +1125,41 @@ alp_status_codes_t fs_read_nwl_security_key(uint8_t *buffer)
 
 alp_status_codes_t fs_read_nwl_security(d7anp_security_t *nwl_security)
 {
-    uint8_t* data_ptr = data + file_offsets[D7A_FILE_NWL_SECURITY];
-    uint32_t frame_counter;
-
-    if(!is_file_defined(D7A_FILE_NWL_SECURITY)) return ALP_STATUS_FILE_ID_NOT_EXISTS;
+    const fs_nwl_security_file_t* file = (const fs_nwl_security_file_t*)get_file_data(D7A_FILE_NWL_SECURITY);
+    if(file == NULL) return ALP_STATUS_FILE_ID_NOT_EXISTS;
 
-    nwl_security->key_counter = (*data_ptr); data_ptr++;
-    memcpy(&frame_counter, data_ptr, sizeof(uint32_t));
-    nwl_security->frame_counter = (uint32_t)__builtin_bswap32(frame_counter);
+    nwl_security->key_counter = file->key_counter;
+    nwl_security->frame_counter = __builtin_bswap32(file->frame_counter);
     return ALP_STATUS_OK;
 }
 
 alp_status_codes_t fs_write_nwl_security(d7anp_security_t *nwl_security)
 {
-    uint8_t* data_ptr = data + file_offsets[D7A_FILE_NWL_SECURITY];
-    uint32_t frame_counter;
+    fs_nwl_security_file_t* file = (fs_nwl_security_file_t*)get_file_data(D7A_FILE_NWL_SECURITY);
+    if(file == NULL) return ALP_STATUS_FILE_ID_NOT_EXISTS;
 
-    if(!is_file_defined(D7A_FILE_NWL_SECURITY)) return ALP_STATUS_FILE_ID_NOT_EXISTS;
+    generation++;
+    file->key_counter = nwl_security->key_counter;
+    file->frame_counter = __builtin_bswap32(nwl_security->frame_counter);
 
-    (*data_ptr) = nwl_security->key_counter; data_ptr++;
-    frame_counter = __builtin_bswap32(nwl_security->frame_counter);
-    memcpy(data_ptr, &frame_counter, sizeof(uint32_t));
+    // the D7ANP reserves the frame counters up to the written one, they are only used once stored
+    schedule_file_storage(D7A_FILE_NWL_SECURITY);
+    fs_flush_storage();
     return ALP_STATUS_OK;
 }
 
 alp_status_codes_t fs_read_nwl_security_state_register(d7anp_node_security_t *node_security_state)
 {
-    uint8_t* data_ptr = data + file_offsets[D7A_FILE_NWL_SECURITY_STATE_REG];
-    uint32_t frame_counter;
-
-    if(!is_file_defined(D7A_FILE_NWL_SECURITY_STATE_REG)) return ALP_STATUS_FILE_ID_NOT_EXISTS;
-
-    node_security_state->filter_mode = (*data_ptr); data_ptr++;
-    node_security_state->trusted_node_nb = (*data_ptr); data_ptr++;
+    const fs_nwl_security_state_register_file_t* file = (const fs_nwl_security_state_register_file_t*)get_file_data(D7A_FILE_NWL_SECURITY_STATE_REG);
+    if(file == NULL) return ALP_STATUS_FILE_ID_NOT_EXISTS;
 
+    node_security_state->filter_mode = file->filter_mode;
+    node_security_state->trusted_node_nb = file->trusted_node_nb;
     for(uint8_t i = 0; i < node_security_state->trusted_node_nb; i++)
     {
-        node_security_state->trusted_node_table[i].key_counter = (*data_ptr); data_ptr++;
-        memcpy(&frame_counter, data_ptr, sizeof(uint32_t)); data_ptr += sizeof(uint32_t);
-        node_security_state->trusted_node_table[i].frame_counter = (uint32_t)__builtin_bswap32(frame_counter);
-        memcpy(node_security_state->trusted_node_table[i].addr, data_ptr, 8); data_ptr += 8;
+        node_security_state->trusted_node_table[i].key_counter = file->trusted_nodes[i].key_counter;
+        node_security_state->trusted_node_table[i].frame_counter = __builtin_bswap32(file->trusted_nodes[i].frame_counter);
+        memcpy(node_security_state->trusted_node_table[i].addr, file->trusted_nodes[i].addr, 8);
     }
     return ALP_STATUS_OK;
 }
@@ -331,89 +1168,109 @@ alp_status_codes_t fs_read_nwl_security_state_register(d7anp_node_security_t *no
 alp_status_codes_t fs_add_nwl_security_state_register_entry(d7anp_trusted_node_t *trusted_node,
                                                             uint8_t trusted_node_nb)
 {
-    uint8_t* data_ptr = data + file_offsets[D7A_FILE_NWL_SECURITY_STATE_REG];
-    uint32_t frame_counter;
+    fs_nwl_security_state_register_file_t* file = (fs_nwl_security_state_register_file_t*)get_file_data(D7A_FILE_NWL_SECURITY_STATE_REG);
+    if(file == NULL) return ALP_STATUS_FILE_ID_NOT_EXISTS;
 
-    if(!is_file_defined(D7A_FILE_NWL_SECURITY_STATE_REG)) return ALP_STATUS_FILE_ID_NOT_EXISTS;
-
-    data_ptr[1] = trusted_node_nb;
-    data_ptr += (D7A_FILE_NWL_SECURITY_SIZE + D7A_FILE_UID_SIZE)*(trusted_node_nb - 1) + 2;
     assert(trusted_node_nb <= MODULE_D7AP_TRUSTED_NODE_TABLE_SIZE);
-
-    (*data_ptr) = trusted_node->key_counter; data_ptr++;
-    frame_counter = __builtin_bswap32(trusted_node->frame_counter);
-    memcpy(data_ptr, &frame_counter, sizeof(uint32_t));
-    data_ptr += sizeof(uint32_t);
-    memcpy(data_ptr, trusted_node->addr, 8);
+    generation++;
+    file->trusted_node_nb = trusted_node_nb;
+    file->trusted_nodes[trusted_node_nb - 1] = (fs_trusted_node_file_t){
+        .key_counter = trusted_node->key_counter,
+        .frame_counter = __builtin_bswap32(trusted_node->frame_counter)
+    };
+    memcpy(file->trusted_nodes[trusted_node_nb - 1].addr, trusted_node->addr, 8);
+    schedule_file_storage(D7A_FILE_NWL_SECURITY_STATE_REG);
     return ALP_STATUS_OK;
 }
 
 alp_status_codes_t fs_update_nwl_security_state_register(d7anp_trusted_node_t *trusted_node,
                                                         uint8_t trusted_node_index)
 {
-    uint8_t* data_ptr = data + file_offsets[D7A_FILE_NWL_SECURITY_STATE_REG];
-    uint32_t frame_counter;
+    fs_nwl_security_state_register_file_t* file = (fs_nwl_security_state_register_file_t*)get_file_data(D7A_FILE_NWL_SECURITY_STATE_REG);
+    if(file == NULL) return ALP_STATUS_FILE_ID_NOT_EXISTS;
+
+    // the address is written as well since an entry can be reused for another node
+    generation++;
+    file->trusted_nodes[trusted_node_index - 1] = (fs_trusted_node_file_t){
+        .key_counter = trusted_node->key_counter,
+        .frame_counter = __builtin_bswap32(trusted_node->frame_counter)
+    };
+    memcpy(file->trusted_nodes[trusted_node_index - 1].addr, trusted_node->addr, 8);
+    schedule_file_storage(D7A_FILE_NWL_SECURITY_STATE_REG);
+    return ALP_STATUS_OK;
+}
 
-    if(!is_file_defined(D7A_FILE_NWL_SECURITY_STATE_REG)) return ALP_STATUS_FILE_ID_NOT_EXISTS;
 
-    data_ptr += (D7A_FILE_NWL_SECURITY_SIZE + D7A_FILE_UID_SIZE)*(trusted_node_index - 1) + 2;
-    (*data_ptr) = trusted_node->key_counter; data_ptr++;
-    frame_counter = __builtin_bswap32(trusted_node->frame_counter);
-    memcpy(data_ptr, &frame_counter, sizeof(uint32_t));
-    return ALP_STATUS_OK;
+static void decode_access_profile(uint8_t access_class_index, dae_access_profile_t *access_class)
+{
+    const fs_access_profile_file_t* file = (const fs_access_profile_file_t*)get_file_data(D7A_FILE_ACCESS_PROFILE_ID + access_class_index);
+    access_class->channel_header = file->channel_header;
+    memcpy(access_class->subprofiles, file->subprofiles, sizeof(file->subprofiles));
+    for(uint8_t i = 0; i < SUBBANDS_NB; i++)
+    {
+        access_class->subbands[i] = (subband_t){
+            .channel_index_start = __builtin_bswap16(file->subbands[i].channel_index_start),
+            .channel_index_end = __builtin_bswap16(file->subbands[i].channel_index_end),
+            .eirp = file->subbands[i].eirp,
+            .cca = file->subbands[i].cca,
+            .duty = file->subbands[i].duty
+        };
+    }
 }
 
+bool fs_is_access_class_defined(uint8_t access_class_index)
+{
+    return access_class_index < 15 && is_file_defined(D7A_FILE_ACCESS_PROFILE_ID + access_class_index);
+}
 
 void fs_read_access_class(uint8_t access_class_index, dae_access_profile_t *access_class)
 {
     assert(access_class_index < 15);
     assert(is_file_defined(D7A_FILE_ACCESS_PROFILE_ID + access_class_index));
-    uint8_t* data_ptr = data + file_offsets[D7A_FILE_ACCESS_PROFILE_ID + access_class_index];
-    memcpy(&(access_class->channel_header), data_ptr, 1); data_ptr++;
-
-    for(uint8_t i = 0; i < SUBPROFILES_NB; i++)
+    for(uint8_t i = 0; i < MODULE_D7AP_FS_ACCESS_PROFILE_CACHE_SIZE; i++)
     {
-        memcpy(&(access_class->subprofiles[i].subband_bitmap), data_ptr, 1); data_ptr++;
-        memcpy(&(access_class->subprofiles[i].scan_automation_period), data_ptr, 1); data_ptr++;
+        if(access_profile_cache[i].access_specifier == access_class_index)
+        {
+            memcpy(access_class, &(access_profile_cache[i].access_profile), sizeof(dae_access_profile_t));
+            return;
+        }
     }
 
-    for(uint8_t i = 0; i < SUBBANDS_NB; i++)
-    {
-        memcpy(&(access_class->subbands[i].channel_index_start), data_ptr, 2); data_ptr += 2;
-        memcpy(&(access_class->subbands[i].channel_index_end), data_ptr, 2); data_ptr += 2;
-        memcpy(&(access_class->subbands[i].eirp), data_ptr, 1); data_ptr++;
-        memcpy(&(access_class->subbands[i].cca), data_ptr, 1); data_ptr++;
-        memcpy(&(access_class->subbands[i].duty), data_ptr, 1); data_ptr++;
-    }
+    // not cached, the entries are replaced round robin
+    access_profile_cache_entry_t* entry = &access_profile_cache[access_profile_cache_next_entry];
+    access_profile_cache_next_entry = (access_profile_cache_next_entry + 1) % MODULE_D7AP_FS_ACCESS_PROFILE_CACHE_SIZE;
+    decode_access_profile(access_class_index, &(entry->access_profile));
+    entry->access_specifier = access_class_index;
+    memcpy(access_class, &(entry->access_profile), sizeof(dae_access_profile_t));
+}
+
+uint8_t fs_get_access_profile_version()
+{
+    return access_profile_version;
 }
 
 void fs_write_access_class(uint8_t access_class_index, dae_access_profile_t* access_class)
 {
     assert(access_class_index < 15);
-    current_data_offset = file_offsets[D7A_FILE_ACCESS_PROFILE_ID + access_class_index];
-    memcpy(data + current_data_offset, &(access_class->channel_header), 1); current_data_offset++;
-
-    for(uint8_t i = 0; i < SUBPROFILES_NB; i++)
-    {
-        memcpy(data + current_data_offset, &(access_class->subprofiles[i].subband_bitmap), 1); current_data_offset++;
-        memcpy(data + current_data_offset, &(access_class->subprofiles[i].scan_automation_period), 1); current_data_offset++;
-    }
-
+    invalidate_access_profile(access_class_index);
+    fs_access_profile_file_t* file = (fs_access_profile_file_t*)get_file_data(D7A_FILE_ACCESS_PROFILE_ID + access_class_index);
+    file->channel_header = access_class->channel_header;
+    memcpy(file->subprofiles, access_class->subprofiles, sizeof(file->subprofiles));
     for(uint8_t i = 0; i < SUBBANDS_NB; i++)
     {
-        memcpy(data + current_data_offset, &(access_class->subbands[i].channel_index_start), 2); current_data_offset += 2;
-        memcpy(data + current_data_offset, &(access_class->subbands[i].channel_index_end), 2); current_data_offset += 2;
-        data[current_data_offset] = access_class->subbands[i].eirp; current_data_offset++;
-        data[current_data_offset] = access_class->subbands[i].cca; current_data_offset++;
-        data[current_data_offset] = access_class->subbands[i].duty; current_data_offset++;
+        file->subbands[i] = (fs_subband_file_t){
+            .channel_index_start = __builtin_bswap16(access_class->subbands[i].channel_index_start),
+            .channel_index_end = __builtin_bswap16(access_class->subbands[i].channel_index_end),
+            .eirp = access_class->subbands[i].eirp,
+            .cca = access_class->subbands[i].cca,
+            .duty = access_class->subbands[i].duty
+        };
     }
 }
 
 uint8_t fs_read_dll_conf_active_access_class()
 {
-    uint8_t access_class;
-    fs_read_file(D7A_FILE_DLL_CONF_FILE_ID, 0, &access_class, 1);
-    return access_class;
+    return identity.active_access_class;
 }
 
 void fs_write_dll_conf_active_access_class(uint8_t access_class)
@@ -421,8 +1278,17 @@ void fs_write_dll_conf_active_access_class(uint8_t access_class)
     fs_write_file(D7A_FILE_DLL_CONF_FILE_ID, 0, &access_class, 1);
 }
 
-uint8_t fs_get_file_length(uint8_t file_id)
+void fs_flush_storage()
+{
+    if(file_storage == NULL)
+        return;
+
+    timer_cancel_task(&store_files);
+    store_files();
+}
+
+uint32_t fs_get_file_length(uint8_t file_id)
 {
   assert(is_file_defined(file_id));
-  return file_headers[file_id].length;
+  return get_file(file_id)->header.length;
 }
@@ -28,6 +28,7 @@
 #include "dae.h"
 #include "alp.h"
 #include "MODULE_D7AP_defs.h"
+#include "energy.h"
 
 #define D7A_FILE_UID_FILE_ID 0x00
 #define D7A_FILE_UID_SIZE 8
@@ -52,6 +53,73 @@
 #define D7A_FILE_NWL_SECURITY_STATE_REG			0x0F
 #define D7A_FILE_NWL_SECURITY_STATE_REG_SIZE	2 + (MODULE_D7AP_TRUSTED_NODE_TABLE_SIZE)*(D7A_FILE_NWL_SECURITY_SIZE + D7A_FILE_UID_SIZE)
 
+// proprietary file in the RFU range of the system files, see fs_read_file() for the layout. Writing to it resets the statistics.
+#define D7A_FILE_POOL_STATS_FILE_ID 0x3F
+#define D7A_FILE_POOL_STATS_ENTRY_SIZE 5
+#define D7A_FILE_POOL_STATS_ENTRY_COUNT 5
+#define D7A_FILE_POOL_STATS_SIZE (D7A_FILE_POOL_STATS_ENTRY_COUNT * D7A_FILE_POOL_STATS_ENTRY_SIZE)
+
+// proprietary read-only file with the DLL link statistics per access class and channel, see fs_read_file() for the layout.
+// Writing to it resets the statistics.
+#define D7A_FILE_LINK_STATS_FILE_ID 0x3E
+#define D7A_FILE_LINK_STATS_ENTRY_SIZE 22
+#define D7A_FILE_LINK_STATS_SIZE (MODULE_D7AP_DLL_LINK_STATS_SIZE * D7A_FILE_LINK_STATS_ENTRY_SIZE)
+
+// proprietary read-only file with the time spent in each state of the radio and the MCU, only defined when
+// FRAMEWORK_ENERGY_ACCOUNTING_ENABLED is set. See fs_read_file() for the layout. Writing to it resets the statistics.
+#define D7A_FILE_ENERGY_STATS_FILE_ID 0x3D
+#define D7A_FILE_ENERGY_STATS_TX_ENTRY_SIZE 5
+#define D7A_FILE_ENERGY_STATS_SIZE (4 * (2 + ENERGY_LOWPOWER_MODE_COUNT + 3) \
+                                    + FRAMEWORK_ENERGY_TX_EIRP_COUNT * D7A_FILE_ENERGY_STATS_TX_ENTRY_SIZE)
+
+// proprietary file with the network time in timer ticks (big endian), only defined when MODULE_D7AP_TIME_SYNC_ROLE is
+// set. Writing to it sets the network time, see time_sync.h
+#define D7A_FILE_NETWORK_TIME_FILE_ID 0x3C
+#define D7A_FILE_NETWORK_TIME_SIZE 4
+
+// the layouts of the system files, as read and written over ALP. The multi-byte fields are big endian
+
+typedef struct __attribute__((__packed__))
+{
+    uint16_t channel_index_start;
+    uint16_t channel_index_end;
+    int8_t eirp;
+    int8_t cca;
+    uint8_t duty;
+} fs_subband_file_t;
+
+typedef struct __attribute__((__packed__))
+{
+    phy_channel_header_t channel_header;
+    subprofile_t subprofiles[SUBPROFILES_NB];
+    fs_subband_file_t subbands[SUBBANDS_NB];
+} fs_access_profile_file_t;
+
+typedef struct __attribute__((__packed__))
+{
+    uint8_t key_counter;
+    uint32_t frame_counter;
+} fs_nwl_security_file_t;
+
+typedef struct __attribute__((__packed__))
+{
+    uint8_t key_counter;
+    uint32_t frame_counter;
+    uint8_t addr[D7A_FILE_UID_SIZE];
+} fs_trusted_node_file_t;
+
+typedef struct __attribute__((__packed__))
+{
+    uint8_t filter_mode;
+    uint8_t trusted_node_nb;
+    fs_trusted_node_file_t trusted_nodes[MODULE_D7AP_TRUSTED_NODE_TABLE_SIZE];
+} fs_nwl_security_state_register_file_t;
+
+_Static_assert(sizeof(fs_access_profile_file_t) == D7A_FILE_ACCESS_PROFILE_SIZE, "fs_access_profile_file_t should be D7A_FILE_ACCESS_PROFILE_SIZE bytes");
+_Static_assert(sizeof(fs_nwl_security_file_t) == D7A_FILE_NWL_SECURITY_SIZE, "fs_nwl_security_file_t should be D7A_FILE_NWL_SECURITY_SIZE bytes");
+_Static_assert(sizeof(fs_nwl_security_state_register_file_t) == D7A_FILE_NWL_SECURITY_STATE_REG_SIZE,
+               "fs_nwl_security_state_register_file_t should be D7A_FILE_NWL_SECURITY_STATE_REG_SIZE bytes");
+
 typedef enum
 {
     FS_STORAGE_TRANSIENT = 0,
@@ -94,6 +162,17 @@ typedef struct
 typedef void (*fs_user_files_init_callback)(void);
 
 
+/**
+ * \brief Storage which keeps the content of the PERMANENT and RESTORABLE files across reboots
+ *
+ * The filesystem itself stays in RAM as a cache of the storage: the files are loaded at the end of fs_init() and stored
+ * some time after they were written, so writes to hot files are not stored synchronously.
+ */
+typedef struct {
+    bool (*load_file)(uint8_t file_id, uint8_t* buffer, uint32_t length); /**< Read the stored file, false when not stored (with this length) */
+    void (*store_file)(uint8_t file_id, const uint8_t* buffer, uint32_t length); /**< Store the file, replacing its previous content */
+} fs_storage_backend_t;
+
 /**
  * \brief Arguments used by the stack for filesystem initialization
  */
@@ -103,15 +182,160 @@ typedef struct {
     dae_access_profile_t* access_profiles; /**< The access profiles to be written to the filesystem (using increasing fileID starting from0x20) during init.  */    
     uint8_t access_class; /* The Active Access Class to be written in the DLL configuration file */
     uint8_t ssr_filter_mode; /* Initialise the SSR filter mode used to maintain the SSR */
+    const fs_storage_backend_t* storage_backend; /**< The storage of the PERMANENT and RESTORABLE files, NULL keeps all files in RAM only. See fs_flash_storage.h */
 } fs_init_args_t;
 
 void fs_init(fs_init_args_t* init_args);
 void fs_init_file(uint8_t file_id, const fs_file_header_t* file_header, const uint8_t* initial_data);
 void fs_init_file_with_D7AActP(uint8_t file_id, const d7asp_master_session_config_t* fifo_config, const uint8_t* alp_command, const uint8_t alp_command_len);
-alp_status_codes_t fs_read_file(uint8_t file_id, uint8_t offset, uint8_t* buffer, uint8_t length);
-alp_status_codes_t fs_write_file(uint8_t file_id, uint8_t offset, const uint8_t* buffer, uint8_t length);
+
+/**
+ * \brief Create a user file at runtime, also after fs_init() completed
+ *
+ * Files created after fs_init() are not created again at boot, so their stored content is not loaded.
+ * \return ALP_STATUS_FILE_ID_ALREADY_EXISTS, or ALP_STATUS_ALLOCATION_OVERFLOW when MODULE_D7AP_FS_FILE_COUNT files are
+ * defined or the file does not fit in MODULE_D7AP_FS_FILESYSTEM_SIZE
+ */
+alp_status_codes_t fs_create_file(uint8_t file_id, const fs_file_header_t* file_header, const uint8_t* initial_data);
+
+/**
+ * \brief Delete a user file, the space it takes is available for new files immediately
+ *
+ * The data of the files created after it moves, so pointers into the file data should not be kept.
+ */
+alp_status_codes_t fs_delete_file(uint8_t file_id);
+
+/**
+ * \brief Read an area of a file, files can be larger than 255 bytes so large files are read in chunks using the offset
+ * \return ALP_STATUS_UNKNOWN_ERROR when the area exceeds the file
+ */
+alp_status_codes_t fs_read_file(uint8_t file_id, uint32_t offset, uint8_t* buffer, uint32_t length);
+alp_status_codes_t fs_write_file(uint8_t file_id, uint32_t offset, const uint8_t* buffer, uint32_t length);
+
+/**
+ * \brief Get a pointer to an area of a file in the file system, to read it without copying
+ *
+ * The view is only valid as long as the file system is not changed: a write of any file or the creation or deletion of
+ * a file (which moves the data of the other files) increments fs_get_generation(). A caller keeping the view across tasks
+ * should take the generation with it, and get the view again when it changed.
+ * \return NULL when the file does not exist, when the area exceeds the file or for the generated files (the statistics
+ * and the network time), which are only read by fs_read_file()
+ */
+const uint8_t* fs_get_file_view(uint8_t file_id, uint32_t offset, uint32_t length);
+
+/**
+ * \brief The number of changes of the file system, see fs_get_file_view(). It wraps around
+ */
+uint16_t fs_get_generation();
+
+/**
+ * \brief An area of a file, and the buffer it is read into or written from
+ */
+typedef struct {
+    uint8_t file_id;
+    uint32_t offset;
+    uint32_t length;
+    uint8_t* buffer;
+} fs_file_segment_t;
+
+/**
+ * \brief Called from a task after a file was written, by the stack, a host or a remote node
+ */
+typedef void (*fs_file_modified_callback)(uint8_t file_id);
+
+/**
+ * \brief Subscribe to the writes of a file, instead of polling it or configuring an action file
+ *
+ * The callback is posted to the scheduler, so the writes done before it runs are reported once. The writes in a transaction
+ * are reported after fs_commit().
+ * \return ALP_STATUS_UNKNOWN_ERROR when MODULE_D7AP_FS_FILE_MODIFIED_CALLBACK_COUNT callbacks are registered
+ */
+alp_status_codes_t fs_register_file_modified_callback(uint8_t file_id, fs_file_modified_callback callback);
+void fs_unregister_file_modified_callback(uint8_t file_id, fs_file_modified_callback callback);
+
+/**
+ * \brief Called before the periodic action of a file is executed, to update the content of the file
+ *
+ * Writing the file here does not trigger its ALP_ACT_COND_WRITE action, the periodic action executes it once afterwards.
+ */
+typedef void (*fs_periodic_action_callback)(uint8_t file_id);
+
+/**
+ * \brief Execute the action of a file every period ms, instead of posting an own timer which writes the file
+ *
+ * The executions are delayed by a random jitter of up to MODULE_D7AP_FS_PERIODIC_ACTION_JITTER ms, so the nodes of a fleet
+ * do not push at the same time. While the DLL performs a background scan, an execution may be delayed further to share the
+ * wakeup of a scan event. The file should have its action protocol enabled.
+ * \param period The period in ms, 0 stops the periodic action
+ * \param refresh_cb Optional, see fs_periodic_action_callback
+ * \return ALP_STATUS_UNKNOWN_ERROR when the action protocol of the file is disabled, or when
+ * MODULE_D7AP_FS_PERIODIC_ACTION_COUNT files have a periodic action
+ */
+alp_status_codes_t fs_set_file_action_period(uint8_t file_id, uint32_t period, fs_periodic_action_callback refresh_cb);
+
+/**
+ * \brief Read several file areas in one pass
+ *
+ * All segments are checked first, so either all of them are read or none. Segments which are contiguous both in the
+ * file system and in the buffer are copied at once.
+ * \return ALP_STATUS_OK, or the error of the first invalid segment
+ */
+alp_status_codes_t fs_read_files_v(const fs_file_segment_t* segments, uint8_t count);
+
+/**
+ * \brief Write several file areas in one pass
+ *
+ * Like fs_read_files_v(). The file actions and the notifications of the stack layers are executed once per file,
+ * after all segments are written.
+ */
+alp_status_codes_t fs_write_files_v(const fs_file_segment_t* segments, uint8_t count);
+
+/**
+ * \brief Start a transaction, for example to write a configuration in several chunks
+ *
+ * The files are still written immediately, but their actions, storage and the notifications of the stack layers are
+ * deferred to fs_commit(). Transactions can be nested, only the outermost fs_commit() notifies.
+ */
+void fs_begin();
+
+/**
+ * \brief End a transaction started by fs_begin()
+ *
+ * Every file written during the transaction is notified once, and every stack layer at most once.
+ */
+void fs_commit();
+
+/**
+ * \brief Read the decoded access profile of an access specifier
+ *
+ * The decoded profiles are cached (MODULE_D7AP_FS_ACCESS_PROFILE_CACHE_SIZE) and dropped when their file is written, so
+ * switching between access classes does not parse the file again.
+ */
 void fs_read_access_class(uint8_t access_class_index, dae_access_profile_t* access_class);
+
+/*! \brief Whether the access profile of an access specifier is defined, fs_read_access_class() asserts it is */
+bool fs_is_access_class_defined(uint8_t access_class_index);
+
+/**
+ * \brief The version of the access profiles, which changes on every write of an access profile file
+ *
+ * The layers keeping a copy of an access profile compare it with the version of their copy to know when to read it again.
+ */
+uint8_t fs_get_access_profile_version();
 void fs_write_access_class(uint8_t access_class_index, dae_access_profile_t* access_class);
+/**
+ * \brief The identity of the node, kept in RAM so the layers do not read the UID and DLL configuration files per frame
+ *
+ * Updated as soon as the UID or the DLL configuration file is written. The IDs are big endian, as in the files.
+ */
+typedef struct {
+    uint8_t uid[D7A_FILE_UID_SIZE];
+    uint8_t vid[2];
+    bool vid_valid;                 /**< False when the VID is 0xFFFF, the node is then addressed by its UID */
+    uint8_t active_access_class;    /**< The access class scanned by the scan automation, its subnet filters the frames */
+} fs_identity_t;
+
+const fs_identity_t* fs_get_identity();
 void fs_read_uid(uint8_t* buffer);
 void fs_read_vid(uint8_t* buffer);
 void fs_write_vid(uint8_t* buffer);
@@ -123,6 +347,11 @@ alp_status_codes_t fs_write_nwl_security(d7anp_security_t *nwl_security);
 alp_status_codes_t fs_read_nwl_security_state_register(d7anp_node_security_t *node_security_state);
 alp_status_codes_t fs_add_nwl_security_state_register_entry(d7anp_trusted_node_t *trusted_node, uint8_t trusted_node_nb);
 alp_status_codes_t fs_update_nwl_security_state_register(d7anp_trusted_node_t *trusted_node, uint8_t trusted_node_index);
-uint8_t fs_get_file_length(uint8_t file_id);
+uint32_t fs_get_file_length(uint8_t file_id);
+
+/**
+ * \brief Store the written PERMANENT and RESTORABLE files now instead of after MODULE_D7AP_FS_STORAGE_DELAY, for example before a reset
+ */
+void fs_flush_storage();
 
 #endif /* FS_H_ */
@@ -0,0 +1,338 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fs_flash_storage.h"
+
+#include "MODULE_D7AP_defs.h"
+#ifdef MODULE_D7AP_FS_FLASH_STORAGE_ENABLED
+
+#include "string.h"
+#include "debug.h"
+#include "ng.h"
+#include "hwflash.h"
+#include "crc.h"
+#include "log.h"
+
+#if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_MISC_LOG_ENABLED)
+#define DPRINT(...) log_print_stack_string(LOG_STACK_FWK, __VA_ARGS__)
+#else
+#define DPRINT(...)
+#endif
+
+#if MODULE_D7AP_FS_FLASH_STORAGE_AREA_SIZE < 2 * (MODULE_D7AP_FS_FILESYSTEM_SIZE + 8 * MODULE_D7AP_FS_FILE_COUNT)
+    #error "MODULE_D7AP_FS_FLASH_STORAGE_AREA_SIZE should be at least twice the filesystem size and record headers, or compaction cannot make room"
+#endif
+
+// <magic (2 bytes)><sequence number (2 bytes)>, the area with a valid header and the highest sequence number is the active one.
+// The header is only written after the area is filled, so an interrupted compaction leaves the previous area active
+#define AREA_MAGIC 0xD7F6 // changed with the record layout, areas of the former layout are erased
+#define AREA_HEADER_SIZE 4
+
+// <file ID><RFU><length (2 bytes)><CRC16 of the data><RFU (2 bytes)><data, padded to a multiple of 4 bytes>,
+// a file ID of 0xFF marks the erased end of the log
+#define RECORD_HEADER_SIZE 8
+#define RECORD_FREE 0xFF
+#define RECORD_SIZE(length) (RECORD_HEADER_SIZE + (((length) + 3) & ~3))
+
+// files can be larger than what fits on the stack, record data is read and written in chunks of this size
+#define RECORD_CHUNK_SIZE 64
+
+typedef struct {
+    uint8_t file_id;
+    uint8_t _rfu;
+    uint16_t length;
+    uint16_t crc;
+    uint16_t _rfu2;
+} record_header_t;
+
+_Static_assert(sizeof(record_header_t) == RECORD_HEADER_SIZE, "record_header_t does not match RECORD_HEADER_SIZE");
+
+static uint32_t NGDEF(_active_area); // the address of the active area, 0 when not known yet
+#define active_area NG(_active_area)
+
+static uint16_t NGDEF(_active_sequence_number);
+#define active_sequence_number NG(_active_sequence_number)
+
+static uint32_t NGDEF(_log_end); // the address the next record is appended to
+#define log_end NG(_log_end)
+
+static uint32_t get_area_address(uint8_t index)
+{
+    return hw_flash_get_size() - (2 - index) * MODULE_D7AP_FS_FLASH_STORAGE_AREA_SIZE;
+}
+
+static bool read_area_header(uint32_t area, uint16_t* sequence_number)
+{
+    uint16_t header[2];
+    hw_flash_read(area, header, AREA_HEADER_SIZE);
+    *sequence_number = header[1];
+    return header[0] == AREA_MAGIC;
+}
+
+static inline uint32_t get_area_end(uint32_t area)
+{
+    return area + MODULE_D7AP_FS_FLASH_STORAGE_AREA_SIZE;
+}
+
+// a record which was not completely written (reset while writing) is invalid
+static bool is_record_valid(uint32_t address, const record_header_t* header)
+{
+    uint8_t chunk[RECORD_CHUNK_SIZE];
+    uint16_t crc = 0xFFFF;
+    for(uint16_t i = 0; i < header->length; i += RECORD_CHUNK_SIZE)
+    {
+        uint8_t chunk_length = header->length - i < RECORD_CHUNK_SIZE ? header->length - i : RECORD_CHUNK_SIZE;
+        hw_flash_read(address + RECORD_HEADER_SIZE + i, chunk, chunk_length);
+        crc = crc_update(crc, chunk, chunk_length);
+    }
+
+    return crc == header->crc;
+}
+
+// reads the header of the record at address, false at the end of the log
+static bool read_record_header(uint32_t area, uint32_t address, record_header_t* header)
+{
+    if(address + RECORD_HEADER_SIZE > get_area_end(area))
+        return false;
+
+    hw_flash_read(address, header, RECORD_HEADER_SIZE);
+    return header->file_id != RECORD_FREE && address + RECORD_SIZE(header->length) <= get_area_end(area);
+}
+
+// returns the address of the last valid record of the file between address and end, 0 when none
+static uint32_t find_valid_record(uint32_t area, uint32_t address, uint32_t end, uint8_t file_id)
+{
+    uint32_t found = 0;
+    record_header_t header;
+    while(address < end && read_record_header(area, address, &header))
+    {
+        if(header.file_id == file_id && is_record_valid(address, &header))
+            found = address;
+
+        address += RECORD_SIZE(header.length);
+    }
+
+    return found;
+}
+
+// returns the address of the last valid record of the file starting from address, 0 when none. Only the data of the
+// last record of the file is read to check its CRC, the earlier records only when it was not completely written, so
+// loading the files at boot reads the log headers but not the data of every record
+static uint32_t find_record(uint32_t area, uint32_t address, uint8_t file_id)
+{
+    uint32_t start = address;
+    uint32_t last = 0;
+    record_header_t header;
+    record_header_t last_header;
+    while(read_record_header(area, address, &header))
+    {
+        if(header.file_id == file_id)
+        {
+            last = address;
+            last_header = header;
+        }
+
+        address += RECORD_SIZE(header.length);
+    }
+
+    if(last == 0 || is_record_valid(last, &last_header))
+        return last;
+
+    return find_valid_record(area, start, last, file_id);
+}
+
+// the last record of the file in the active area, when it has the length of the file
+static uint32_t find_file(uint8_t file_id, uint16_t length)
+{
+    uint32_t record = find_record(active_area, active_area + AREA_HEADER_SIZE, file_id);
+    if(record == 0)
+        return 0;
+
+    record_header_t header;
+    hw_flash_read(record, &header, RECORD_HEADER_SIZE);
+    return header.length == length ? record : 0; // else stored by a firmware with another file layout
+}
+
+static void erase_area(uint32_t area)
+{
+    for(uint32_t page = area; page < get_area_end(area); page += hw_flash_get_page_size())
+    {
+        error_t err = hw_flash_erase_page(page); assert(err == SUCCESS);
+    }
+}
+
+static uint32_t find_log_end(uint32_t area)
+{
+    uint32_t address = area + AREA_HEADER_SIZE;
+    record_header_t header;
+    while(read_record_header(area, address, &header))
+        address += RECORD_SIZE(header.length);
+
+    return address;
+}
+
+static void find_active_area()
+{
+    if(active_area != 0)
+        return;
+
+    assert(MODULE_D7AP_FS_FLASH_STORAGE_AREA_SIZE % hw_flash_get_page_size() == 0);
+    uint16_t sequence_numbers[2];
+    bool valid[2];
+    for(uint8_t i = 0; i < 2; i++)
+        valid[i] = read_area_header(get_area_address(i), &sequence_numbers[i]);
+
+    uint8_t active = 0;
+    if(valid[0] && valid[1])
+        active = (int16_t)(sequence_numbers[1] - sequence_numbers[0]) > 0 ? 1 : 0;
+    else if(valid[1])
+        active = 1;
+    else if(!valid[0])
+    {
+        // nothing stored yet (or the storage was erased by flashing), start the log in the first area
+        uint32_t area = get_area_address(0);
+        erase_area(area);
+        uint16_t header[2] = { AREA_MAGIC, 0 };
+        error_t err = hw_flash_write(area, header, AREA_HEADER_SIZE); assert(err == SUCCESS);
+        sequence_numbers[0] = 0;
+    }
+
+    active_area = get_area_address(active);
+    active_sequence_number = sequence_numbers[active];
+    log_end = find_log_end(active_area);
+    DPRINT("Flash storage area %i active, seqnr %i, %i bytes used", active, active_sequence_number, log_end - active_area);
+}
+
+// the header is written before the data, a record interrupted while writing its data fails the CRC check
+static void append_record(uint32_t* address, uint8_t file_id, const uint8_t* buffer, uint16_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for(uint16_t i = 0; i < length; i += 255)
+        crc = crc_update(crc, (uint8_t*) buffer + i, length - i < 255 ? length - i : 255);
+
+    record_header_t header = { .file_id = file_id, ._rfu = 0xFF, .length = length, .crc = crc, ._rfu2 = 0xFFFF };
+    error_t err = hw_flash_write(*address, &header, RECORD_HEADER_SIZE); assert(err == SUCCESS);
+
+    // copied to a word aligned chunk, the file data itself is not aligned
+    uint32_t chunk[RECORD_CHUNK_SIZE / 4];
+    for(uint16_t i = 0; i < length; i += RECORD_CHUNK_SIZE)
+    {
+        uint8_t chunk_length = length - i < RECORD_CHUNK_SIZE ? length - i : RECORD_CHUNK_SIZE;
+        memset(chunk, 0xFF, sizeof(chunk));
+        memcpy(chunk, buffer + i, chunk_length);
+        err = hw_flash_write(*address + RECORD_HEADER_SIZE + i, chunk, (chunk_length + 3) & ~3); assert(err == SUCCESS);
+    }
+
+    *address += RECORD_SIZE(length);
+}
+
+// copies the record, including its header and padding, from the active area to address
+static void copy_record(uint32_t* address, uint32_t record, uint16_t length)
+{
+    uint32_t chunk[RECORD_CHUNK_SIZE / 4];
+    for(uint16_t i = 0; i < RECORD_SIZE(length); i += RECORD_CHUNK_SIZE)
+    {
+        uint8_t chunk_length = RECORD_SIZE(length) - i < RECORD_CHUNK_SIZE ? RECORD_SIZE(length) - i : RECORD_CHUNK_SIZE;
+        hw_flash_read(record + i, chunk, chunk_length);
+        error_t err = hw_flash_write(*address + i, chunk, chunk_length); assert(err == SUCCESS);
+    }
+
+    *address += RECORD_SIZE(length);
+}
+
+// copies the last record of every file except skip_file_id to the other area, which becomes the active area
+static void compact(uint8_t skip_file_id)
+{
+    uint32_t area = active_area == get_area_address(0) ? get_area_address(1) : get_area_address(0);
+    DPRINT("Compacting flash storage");
+    erase_area(area);
+
+    uint32_t address = area + AREA_HEADER_SIZE;
+    uint32_t record = active_area + AREA_HEADER_SIZE;
+    record_header_t header;
+    while(read_record_header(active_area, record, &header))
+    {
+        // only the last record of a file is kept, this also drops the content of a file which changed length
+        if(header.file_id != skip_file_id && find_record(active_area, record, header.file_id) == record)
+            copy_record(&address, record, header.length);
+
+        record += RECORD_SIZE(header.length);
+    }
+
+    active_sequence_number++;
+    uint16_t area_header[2] = { AREA_MAGIC, active_sequence_number };
+    error_t err = hw_flash_write(area, area_header, AREA_HEADER_SIZE); assert(err == SUCCESS);
+    active_area = area;
+    log_end = address;
+}
+
+static bool load_file(uint8_t file_id, uint8_t* buffer, uint32_t length)
+{
+    if(file_id == RECORD_FREE)
+        return false; // not stored, see store_file()
+
+    find_active_area();
+    uint32_t record = find_file(file_id, length);
+    if(record == 0)
+        return false;
+
+    hw_flash_read(record + RECORD_HEADER_SIZE, buffer, length);
+    return true;
+}
+
+static void store_file(uint8_t file_id, const uint8_t* buffer, uint32_t length)
+{
+    if(file_id == RECORD_FREE)
+        return; // the ID of the erased flash, file 0xFF cannot be stored
+
+    assert(length <= UINT16_MAX); // TODO files do not exceed MODULE_D7AP_FS_FILESYSTEM_SIZE, which fits 16 bits for now
+
+    find_active_area();
+
+    // rewriting unchanged content only wears the flash
+    uint32_t record = find_file(file_id, length);
+    if(record != 0)
+    {
+        uint8_t chunk[RECORD_CHUNK_SIZE];
+        uint16_t i = 0;
+        for(; i < length; i += RECORD_CHUNK_SIZE)
+        {
+            uint8_t chunk_length = length - i < RECORD_CHUNK_SIZE ? length - i : RECORD_CHUNK_SIZE;
+            hw_flash_read(record + RECORD_HEADER_SIZE + i, chunk, chunk_length);
+            if(memcmp(chunk, buffer + i, chunk_length) != 0)
+                break;
+        }
+
+        if(i >= length)
+            return;
+    }
+
+    if(log_end + RECORD_SIZE(length) > get_area_end(active_area))
+        compact(file_id);
+
+    assert(log_end + RECORD_SIZE(length) <= get_area_end(active_area));
+    DPRINT("Store file %i (%i bytes)", file_id, length);
+    append_record(&log_end, file_id, buffer, length);
+}
+
+const fs_storage_backend_t fs_flash_storage_backend = {
+    .load_file = &load_file,
+    .store_file = &store_file
+};
+
+#endif // MODULE_D7AP_FS_FLASH_STORAGE_ENABLED
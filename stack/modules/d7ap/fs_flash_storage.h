@@ -0,0 +1,35 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file fs_flash_storage.h
+ * \brief Storage backend of the filesystem in the internal flash
+ *
+ * The files are appended as records to a log in one of two areas at the end of the internal flash, the last record of a
+ * file holds its content. When the active area is full the last records are copied to the other area, which then becomes
+ * the active one. Every word is only written once between erases and the erases alternate over both areas, which spreads
+ * the wear. Requires MODULE_D7AP_FS_FLASH_STORAGE_ENABLED.
+ */
+
+#ifndef FS_FLASH_STORAGE_H_
+#define FS_FLASH_STORAGE_H_
+
+#include "fs.h"
+
+extern const fs_storage_backend_t fs_flash_storage_backend;
+
+#endif /* FS_FLASH_STORAGE_H_ */
@@ -22,7 +22,9 @@
 #include "log.h"
 #include "d7asp.h"
 #include "fec.h"
+#include "fs.h"
 #include "MODULE_D7AP_defs.h"
+#include "hwdebug.h"
 
 #include "debug.h"
 
@@ -40,12 +42,6 @@
 #define DPRINT_DATA_DLL(...)
 #endif
 
-#ifdef HAL_RADIO_USE_HW_CRC
-static bool has_hardware_crc = true;
-#else
-static bool has_hardware_crc = false;
-#endif
-
 void packet_init(packet_t* packet)
 {
     memset(packet, 0x00, sizeof(packet_t));
@@ -54,19 +50,34 @@ void packet_init(packet_t* packet)
 void packet_assemble(packet_t* packet)
 {
     uint8_t* data_ptr = packet->hw_radio_packet.data + 1; // skip length field for now, we fill this later
-    uint8_t* nwl_payload;
-
-    data_ptr += dll_assemble_packet_header(packet, data_ptr);
 
-    if (packet->type != BACKGROUND_ADV)
+    if (packet->type == FORWARDED_FRAME)
+    {
+        // repeated as received, the D7ANP updated the hopping control in place so only the CRC changes
+        data_ptr += packet->hw_radio_packet.length - 2;
+    }
+    else if (packet->type != BACKGROUND_ADV)
     {
-        data_ptr += d7anp_assemble_packet_header(packet, data_ptr);
-        nwl_payload = data_ptr;
+        // the payload might already be in the frame buffer (for example a response built in place of the request),
+        // so assemble the headers aside first and only move the payload when the headers changed in size
+        uint8_t header[PACKET_MAX_HEADER_SIZE];
+        uint8_t header_len = dll_assemble_packet_header(packet, header);
+        header_len += d7anp_assemble_packet_header(packet, header + header_len);
+        uint8_t nwl_header_len = header_len;
+        header_len += d7atp_assemble_packet_header(packet, header + header_len);
+        assert(header_len <= PACKET_MAX_HEADER_SIZE);
+
+        uint8_t* nwl_payload = data_ptr + nwl_header_len;
+        if (packet->payload != data_ptr + header_len)
+        {
+            if (packet->payload_length > 0)
+                memmove(data_ptr + header_len, packet->payload, packet->payload_length);
 
-        data_ptr += d7atp_assemble_packet_header(packet, data_ptr);
+            packet->payload = data_ptr + header_len;
+        }
 
-        // add payload
-        memcpy(data_ptr, packet->payload, packet->payload_length); data_ptr += packet->payload_length;
+        memcpy(data_ptr, header, header_len);
+        data_ptr += header_len + packet->payload_length;
 
         /* Encrypt/authenticate nwl_payload if needed */
         if (packet->d7anp_ctrl.nls_method)
@@ -74,8 +85,10 @@ void packet_assemble(packet_t* packet)
     }
     else
     {
+        data_ptr += dll_assemble_packet_header(packet, data_ptr);
+
         // add ETA for background frames
-        uint16_t eta = __builtin_bswap16(packet->ETA);
+        uint16_t eta = __builtin_bswap16(TIMER_TICKS_TO_TI(packet->ETA));
         memcpy(data_ptr, &eta, sizeof(uint16_t));
         data_ptr += sizeof(uint16_t);
     }
@@ -85,44 +98,86 @@ void packet_assemble(packet_t* packet)
 
     // TODO network protocol footer
 
-    // add CRC - SW CRC when using FEC or when the packet is a background frame
+    packet_update_crc(packet);
+}
+
+void packet_update_crc(packet_t* packet)
+{
+    // add CRC - SW CRC unless the radio driver generates it
+    uint8_t* crc_ptr = packet->hw_radio_packet.data + 1 + packet->hw_radio_packet.length - 2;
+    uint8_t radio_capabilities = hw_radio_get_capabilities();
     if (packet->type == BACKGROUND_ADV)
     {
-        uint16_t crc = __builtin_bswap16(crc_calculate(packet->hw_radio_packet.data + 1, packet->hw_radio_packet.length - 2));
-        memcpy(data_ptr, &crc, 2);
+        if (!(radio_capabilities & HW_RADIO_CAP_CRC_BACKGROUND))
+        {
+            uint16_t crc = __builtin_bswap16(crc_calculate(packet->hw_radio_packet.data + 1, packet->hw_radio_packet.length - 2));
+            memcpy(crc_ptr, &crc, 2);
+        }
     }
-    else if (!has_hardware_crc ||
-              packet->hw_radio_packet.tx_meta.tx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+    else if (!(radio_capabilities & (packet->hw_radio_packet.tx_meta.tx_cfg.channel_id.channel_header.ch_coding == PHY_CODING_FEC_PN9 ?
+                                     HW_RADIO_CAP_CRC_FEC : HW_RADIO_CAP_CRC)))
     {
         uint16_t crc = __builtin_bswap16(crc_calculate(packet->hw_radio_packet.data, packet->hw_radio_packet.length + 1 - 2));
-        memcpy(data_ptr, &crc, 2);
+        memcpy(crc_ptr, &crc, 2);
     }
+}
 
+uint8_t packet_max_payload_length(d7anp_addressee_t* addressee)
+{
+    dae_access_profile_t access_profile;
+    uint8_t frame_size = PACKET_MAX_SIZE;
+
+    fs_read_access_class(addressee->access_specifier, &access_profile);
+    if (access_profile.channel_header.ch_coding == PHY_CODING_FEC_PN9)
+        frame_size = PACKET_MAX_FEC_SIZE;
+
+    return frame_size - packet_max_frame_overhead(addressee);
 }
 
-void packet_disassemble(packet_t* packet)
+uint8_t packet_max_frame_overhead(d7anp_addressee_t* addressee)
 {
+    uint8_t nls_method = addressee->ctrl.nls_method;
+    uint8_t overhead = 1 + 2; // length byte and CRC
+    overhead += 1 + 1; // DLL subnet and control
+    if (!ID_TYPE_IS_BROADCAST(addressee->ctrl.id_type))
+        overhead += d7anp_addressee_id_length(addressee->ctrl.id_type);
 
+    overhead += d7anp_max_header_length(nls_method) + d7anp_auth_length(nls_method);
+    overhead += PACKET_MAX_D7ATP_HEADER_SIZE;
+
+    return overhead;
+}
+
+static void disassemble(packet_t* packet)
+{
     if (packet->hw_radio_packet.rx_meta.crc_status == HW_CRC_UNAVAILABLE)
     {
-        uint16_t crc;
+        uint16_t crc = 0;
+        // a frame too short to hold its CRC is corrupted
+        bool too_short = packet->hw_radio_packet.length < (packet->type == BACKGROUND_ADV ? 2 : 1);
         // The length byte is not transmitted in the background frame. Therefore, this byte is not included in the CRC computation
-        if (packet->type == BACKGROUND_ADV)
+        if (!too_short && packet->type == BACKGROUND_ADV)
             crc = __builtin_bswap16(crc_calculate(packet->hw_radio_packet.data + 1 , packet->hw_radio_packet.length - 2));
-        else
+        else if (!too_short)
             crc = __builtin_bswap16(crc_calculate(packet->hw_radio_packet.data, packet->hw_radio_packet.length + 1 - 2));
-        if(memcmp(&crc, packet->hw_radio_packet.data + packet->hw_radio_packet.length + 1 - 2, 2) != 0)
+        if(too_short || memcmp(&crc, packet->hw_radio_packet.data + packet->hw_radio_packet.length + 1 - 2, 2) != 0)
         {
             DPRINT_DLL("CRC invalid");
+            dll_count_received_frame(packet, false);
+            d7atp_signal_corrupted_frame();
             goto cleanup;
         }
     }
     else if (packet->hw_radio_packet.rx_meta.crc_status == HW_CRC_INVALID)
     {
         DPRINT_DLL("CRC invalid");
+        dll_count_received_frame(packet, false);
+        d7atp_signal_corrupted_frame();
         goto cleanup;
     }
 
+    dll_count_received_frame(packet, true);
+
     uint8_t data_idx = 1;
 
     if(!dll_disassemble_packet_header(packet, &data_idx))
@@ -133,12 +188,15 @@ void packet_disassemble(packet_t* packet)
         if(!d7anp_disassemble_packet_header(packet, &data_idx))
             goto cleanup;
 
-        if(!d7atp_disassemble_packet_header(packet, &data_idx))
-            goto cleanup;
+        // secured frames are decrypted and authenticated in a separate stage which continues the disassembly
+        if (packet->d7anp_ctrl.nls_method)
+        {
+            d7anp_unsecure_received_packet(packet);
+            return;
+        }
 
-        // extract payload
-        packet->payload_length = packet->hw_radio_packet.length + 1 - data_idx - 2; // exclude the headers CRC bytes // TODO exclude footers
-        memcpy(packet->payload, packet->hw_radio_packet.data + data_idx, packet->payload_length);
+        packet_disassemble_nwl_payload(packet, data_idx);
+        return;
     }
     else
     {
@@ -148,7 +206,7 @@ void packet_disassemble(packet_t* packet)
         assert(packet->payload_length == sizeof(uint16_t));
 
         memcpy(&eta, packet->hw_radio_packet.data + data_idx, packet->payload_length);
-        packet->ETA = __builtin_bswap16(eta);
+        packet->ETA = TI_TO_TIMER_TICKS(__builtin_bswap16(eta));
     }
     // TODO footers
 
@@ -164,3 +222,33 @@ void packet_disassemble(packet_t* packet)
         packet_queue_free_packet(packet);
         return;
 }
+
+void packet_disassemble(packet_t* packet)
+{
+    DEBUG_PROBE_SET(PACKET_DISASSEMBLE);
+    disassemble(packet);
+    DEBUG_PROBE_CLR(PACKET_DISASSEMBLE);
+}
+
+void packet_disassemble_nwl_payload(packet_t* packet, uint8_t data_idx)
+{
+    // the frame is authenticated and its origin is known, the channel is now guarded for the dialog with it
+    dll_guard_received_channel(packet);
+
+    if(!d7atp_disassemble_packet_header(packet, &data_idx))
+    {
+        DPRINT_FWK("Skipping packet");
+        packet_queue_free_packet(packet);
+        return;
+    }
+
+    // the payload is processed in place
+    packet->payload_length = packet->hw_radio_packet.length + 1 - data_idx - 2; // exclude the headers CRC bytes // TODO exclude footers
+    packet->payload = packet->hw_radio_packet.data + data_idx;
+
+    // TODO footers
+
+    DPRINT_FWK("Done disassembling packet");
+
+    d7anp_process_received_packet(packet);
+}
@@ -32,13 +32,23 @@
 #include "d7anp.h"
 #include "hwradio.h"
 
+/*! \brief Upper bound of the size of the D7ATP header */
+#define PACKET_MAX_D7ATP_HEADER_SIZE (8 + D7ATP_ACK_BITMAP_SIZE)
+
+/*! \brief Upper bound of the size of the DLL, D7ANP and D7ATP headers of a foreground frame */
+#define PACKET_MAX_HEADER_SIZE (DLL_MAX_HEADER_SIZE + D7ANP_MAX_HEADER_SIZE + PACKET_MAX_D7ATP_HEADER_SIZE)
+
+/*! \brief Longest frame, including the length byte, fec_encode() can code in place in a PACKET_MAX_SIZE frame buffer */
+#define PACKET_MAX_FEC_SIZE 125
+
 typedef enum {
     INITIAL_REQUEST,
     SUBSEQUENT_REQUEST,
     RETRY_REQUEST,
     RESPONSE_TO_UNICAST,
     RESPONSE_TO_BROADCAST,
-    BACKGROUND_ADV
+    BACKGROUND_ADV,
+    FORWARDED_FRAME // a received hopping frame repeated by this node, it is not known to the upper layers
 } packet_type;
 
 /*! \brief A D7AP 'packet' used over all layers of the stack. Contains both the raw packet data (as transmitted over the air) as well
@@ -52,6 +62,9 @@ struct packet
     uint8_t origin_access_class;
     uint8_t origin_access_id[8];
     d7anp_security_t d7anp_security;
+    uint8_t d7anp_payload_index;    // start of the secured NWL payload, kept while the frame waits for the NLS stage
+    d7anp_hop_t d7anp_hop;
+    uint8_t d7anp_hop_index;        // position of the hopping control in the frame, a forwarder updates it in place
     d7atp_ctrl_t d7atp_ctrl;
     d7anp_addressee_t* d7anp_addressee;
     d7atp_ack_template_t d7atp_ack_template;
@@ -62,23 +75,38 @@ struct packet
     uint8_t d7atp_te;
     uint8_t d7atp_target_rx_level_i;
     packet_type type;
-    uint16_t ETA;
+    timer_tick_t ETA;
     uint16_t tx_duration;
     // TODO d7atp ack template
     uint8_t payload_length;
-    uint8_t payload[239]; // TODO make max size configurable using cmake
-                            // TODO store payload here or only pointer to file where we need to fetch it? can we assume data will not be changed in between
+    uint8_t network_time_index; // position in the payload of the network time written at the transmission, 0 when the
+                                // frame does not carry it (see time_sync.h)
+    uint8_t* payload;   // view on the payload, not a copy: points into hw_radio_packet.data for received or assembled packets,
+                        // or to the buffer of the upper layer for a packet to transmit, until packet_assemble() places it in the frame
 
     hw_radio_packet_t hw_radio_packet; // TODO we might not need all metadata included in hw_radio_packet_t. If not copy needed data fields
-    uint8_t __data[255];    // reserves space for hw_radio_packet_t.data flexible array member,
-                            // do not use this directly but use hw_radio_packet_t.data instead, which contains the length byte
-                            // TODO configure max length from cmake
+                                       // the space for the hw_radio_packet_t.data flexible array member is reserved by the packet queue,
+                                       // which contains the length byte. This has to remain the last member
 };
 
 
 void packet_init(packet_t*);
 void packet_assemble(packet_t*);
 void packet_disassemble(packet_t*);
+void packet_disassemble_nwl_payload(packet_t* packet, uint8_t data_idx);
+
+/*! \brief Write the CRC of the assembled frame again after it was changed in place, unless the radio generates it */
+void packet_update_crc(packet_t* packet);
+
+/*! \brief The largest D7ATP payload a foreground frame to the addressee can carry
+ *
+ * Accounts for the channel coding of the access class of the addressee, the DLL header, the largest D7ANP and D7ATP
+ * headers, the NLS security header and authentication tag, and the CRC.
+ */
+uint8_t packet_max_payload_length(d7anp_addressee_t* addressee);
+
+/*! \brief The number of bytes a foreground frame to the addressee adds to its D7ATP payload at most, before FEC */
+uint8_t packet_max_frame_overhead(d7anp_addressee_t* addressee);
 
 #endif //OSS_7_PACKET_H
 
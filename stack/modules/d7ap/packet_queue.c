@@ -16,12 +16,15 @@
  * limitations under the License.
  */
 
+#include <string.h>
+
 #include "packet_queue.h"
 #include "MODULE_D7AP_defs.h"
 #include "debug.h"
 #include "packet.h"
 #include "ng.h"
 #include "log.h"
+#include "hwatomic.h"
 
 #if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_MISC_LOG_ENABLED)
 #define DPRINT(...) log_print_stack_string(LOG_STACK_FWK, __VA_ARGS__)
@@ -29,6 +32,12 @@
 #define DPRINT(...)
 #endif
 
+#if MODULE_D7AP_PACKET_QUEUE_SIZE >= 255
+    #error "MODULE_D7AP_PACKET_QUEUE_SIZE should be smaller than 255"
+#endif
+
+#define NO_PACKET 0xFF
+
 typedef enum
 {
     PACKET_QUEUE_ELEMENT_STATUS_FREE,       /*! The element is free */
@@ -38,132 +47,403 @@ typedef enum
     PACKET_QUEUE_ELEMENT_STATUS_PROCESSING  /*! Indicates the supplied packet is being processed */
 } packet_queue_element_status_t;
 
-static packet_t NGDEF(_packet_queue)[MODULE_D7AP_PACKET_QUEUE_SIZE];
-#define packet_queue NG(_packet_queue)
+/*! A doubly linked list of queue elements, linked using their index */
+typedef struct
+{
+    uint8_t head;
+    uint8_t tail;
+} packet_list_t;
+
+#define SHORT_PACKET_COUNT MODULE_D7AP_PACKET_QUEUE_SHORT_FRAME_COUNT
+#define LONG_PACKET_COUNT (MODULE_D7AP_PACKET_QUEUE_SIZE - MODULE_D7AP_PACKET_QUEUE_SHORT_FRAME_COUNT)
+
+#if LONG_PACKET_COUNT < 1
+    #error "MODULE_D7AP_PACKET_QUEUE_SHORT_FRAME_COUNT should be smaller than MODULE_D7AP_PACKET_QUEUE_SIZE, at least one packet needs a max length frame buffer"
+#endif
+
+/*! A packet with a frame buffer which can hold frames of any length */
+typedef struct
+{
+    packet_t packet;
+    uint8_t data[PACKET_MAX_SIZE];  // reserves space for the hw_radio_packet_t.data flexible array member
+} long_packet_t;
+
+static long_packet_t NGDEF(_long_packets)[LONG_PACKET_COUNT];
+#define long_packets NG(_long_packets)
+
+#if SHORT_PACKET_COUNT > 0
+/*! A packet with a frame buffer which only holds short frames, like background frames or small sensor frames */
+typedef struct
+{
+    packet_t packet;
+    uint8_t data[MODULE_D7AP_PACKET_QUEUE_SHORT_FRAME_SIZE];
+} short_packet_t;
+
+static short_packet_t NGDEF(_short_packets)[SHORT_PACKET_COUNT];
+#define short_packets NG(_short_packets)
+#endif
+
+// the packets are indexed with the short packets first, followed by the long packets
 static packet_queue_element_status_t NGDEF(_packet_queue_element_status)[MODULE_D7AP_PACKET_QUEUE_SIZE];
 #define packet_queue_element_status NG(_packet_queue_element_status)
+static uint8_t NGDEF(_packet_queue_next)[MODULE_D7AP_PACKET_QUEUE_SIZE];
+#define packet_queue_next NG(_packet_queue_next)
+static uint8_t NGDEF(_packet_queue_prev)[MODULE_D7AP_PACKET_QUEUE_SIZE];
+#define packet_queue_prev NG(_packet_queue_prev)
+
+// elements which are allocated or processing are not kept in a list since we never need to iterate over them
+static packet_list_t NGDEF(_free_list);
+#define free_list NG(_free_list)
+static packet_list_t NGDEF(_short_free_list);
+#define short_free_list NG(_short_free_list)
+static packet_list_t NGDEF(_received_list);
+#define received_list NG(_received_list)
+static packet_list_t NGDEF(_transmitted_list);
+#define transmitted_list NG(_transmitted_list)
+
+static pool_stats_t NGDEF(_packet_queue_stats);
+#define packet_queue_stats NG(_packet_queue_stats)
+
+// all functions below may be called from both interrupt and task context, list operations are done atomically
+static inline bool is_short_packet(uint8_t index)
+{
+    return index < SHORT_PACKET_COUNT;
+}
+
+static inline bool fits_packet(uint8_t index, uint8_t length)
+{
+    // keep a byte margin, the drivers write the length byte in front of background frames of the supplied length
+    return !is_short_packet(index) || length < MODULE_D7AP_PACKET_QUEUE_SHORT_FRAME_SIZE;
+}
+
+static packet_t* get_packet(uint8_t index)
+{
+#if SHORT_PACKET_COUNT > 0
+    if(is_short_packet(index))
+        return &(short_packets[index].packet);
+#endif
+    return &(long_packets[index - SHORT_PACKET_COUNT].packet);
+}
+
+static packet_list_t* get_list(uint8_t index, packet_queue_element_status_t status)
+{
+    switch(status)
+    {
+        case PACKET_QUEUE_ELEMENT_STATUS_FREE: return is_short_packet(index)? &short_free_list : &free_list;
+        case PACKET_QUEUE_ELEMENT_STATUS_RECEIVED: return &received_list;
+        case PACKET_QUEUE_ELEMENT_STATUS_TRANSMITTED: return &transmitted_list;
+        default: return NULL;
+    }
+}
+
+static void list_append(packet_list_t* list, uint8_t index)
+{
+    packet_queue_next[index] = NO_PACKET;
+    packet_queue_prev[index] = list->tail;
+    if(list->tail == NO_PACKET)
+        list->head = index;
+    else
+        packet_queue_next[list->tail] = index;
+
+    list->tail = index;
+}
+
+static void list_insert_after(packet_list_t* list, uint8_t prev, uint8_t index)
+{
+    if(prev == NO_PACKET)
+    {
+        // insert at the head
+        packet_queue_prev[index] = NO_PACKET;
+        packet_queue_next[index] = list->head;
+        if(list->head == NO_PACKET)
+            list->tail = index;
+        else
+            packet_queue_prev[list->head] = index;
+
+        list->head = index;
+        return;
+    }
+
+    if(prev == list->tail)
+    {
+        list_append(list, index);
+        return;
+    }
+
+    packet_queue_prev[index] = prev;
+    packet_queue_next[index] = packet_queue_next[prev];
+    packet_queue_prev[packet_queue_next[prev]] = index;
+    packet_queue_next[prev] = index;
+}
+
+static void list_remove(packet_list_t* list, uint8_t index)
+{
+    if(packet_queue_prev[index] == NO_PACKET)
+        list->head = packet_queue_next[index];
+    else
+        packet_queue_next[packet_queue_prev[index]] = packet_queue_next[index];
+
+    if(packet_queue_next[index] == NO_PACKET)
+        list->tail = packet_queue_prev[index];
+    else
+        packet_queue_prev[packet_queue_next[index]] = packet_queue_prev[index];
+}
+
+static void set_status(uint8_t index, packet_queue_element_status_t status)
+{
+    if(packet_queue_element_status[index] == PACKET_QUEUE_ELEMENT_STATUS_FREE && status != PACKET_QUEUE_ELEMENT_STATUS_FREE)
+        pool_stats_alloc(&packet_queue_stats);
+    else if(packet_queue_element_status[index] != PACKET_QUEUE_ELEMENT_STATUS_FREE && status == PACKET_QUEUE_ELEMENT_STATUS_FREE)
+        pool_stats_free(&packet_queue_stats);
+
+    packet_list_t* list = get_list(index, packet_queue_element_status[index]);
+    if(list)
+        list_remove(list, index);
+
+    packet_queue_element_status[index] = status;
+    list = get_list(index, status);
+    if(list)
+        list_append(list, index);
+}
+
+static inline bool received_before(uint8_t a, uint8_t b)
+{
+    return ((int32_t)(get_packet(a)->hw_radio_packet.rx_meta.timestamp - get_packet(b)->hw_radio_packet.rx_meta.timestamp)) < 0;
+}
+
+static uint8_t get_index(packet_t* packet)
+{
+#if SHORT_PACKET_COUNT > 0
+    if((void*)packet >= (void*)short_packets && (void*)packet < (void*)(short_packets + SHORT_PACKET_COUNT))
+    {
+        uint8_t index = container_of(packet, short_packet_t, packet) - short_packets;
+        assert(packet == &(short_packets[index].packet));
+        return index;
+    }
+#endif
+
+    uint8_t index = container_of(packet, long_packet_t, packet) - long_packets;
+    assert(index < LONG_PACKET_COUNT && packet == &(long_packets[index].packet));
+    return index + SHORT_PACKET_COUNT;
+}
+
+static uint8_t get_hw_radio_packet_index(hw_radio_packet_t* hw_radio_packet)
+{
+    return get_index(container_of(hw_radio_packet, packet_t, hw_radio_packet));
+}
 
 void packet_queue_init()
 {
+    free_list = (packet_list_t){ .head = NO_PACKET, .tail = NO_PACKET };
+    short_free_list = free_list;
+    received_list = free_list;
+    transmitted_list = free_list;
+    pool_stats_init(&packet_queue_stats, MODULE_D7AP_PACKET_QUEUE_SIZE);
     for(uint8_t i = 0; i < MODULE_D7AP_PACKET_QUEUE_SIZE; i++)
     {
-        packet_init(&(packet_queue[i]));
+        packet_init(get_packet(i));
         packet_queue_element_status[i] = PACKET_QUEUE_ELEMENT_STATUS_FREE;
+        list_append(get_list(i, PACKET_QUEUE_ELEMENT_STATUS_FREE), i);
     }
 }
 
-packet_t* packet_queue_alloc_packet()
+packet_t* packet_queue_alloc_packet(uint8_t length)
 {
-    for(uint8_t i = 0; i < MODULE_D7AP_PACKET_QUEUE_SIZE; i++)
+    packet_t* packet = NULL;
+
+    start_atomic();
+    // prefer a short packet when the frame fits, to keep the long packets for the frames which need them
+    uint8_t index = short_free_list.head;
+    if(index == NO_PACKET || !fits_packet(index, length))
+        index = free_list.head;
+
+    if(index != NO_PACKET)
     {
-        if(packet_queue_element_status[i] == PACKET_QUEUE_ELEMENT_STATUS_FREE)
-        {
-            packet_queue_element_status[i] = PACKET_QUEUE_ELEMENT_STATUS_ALLOCATED;
-            DPRINT("Packet queue alloc %p", &(packet_queue[i]));
-            return &(packet_queue[i]);
-        }
+        set_status(index, PACKET_QUEUE_ELEMENT_STATUS_ALLOCATED);
+        packet = get_packet(index);
     }
+    else
+        pool_stats_alloc_failed(&packet_queue_stats);
+    end_atomic();
 
-    assert(false); // should not happen, possible to small PACKET_QUEUE_SIZE or not always free()-ed correctly?
+    DPRINT("Packet queue alloc %p", packet);
+    return packet;
 }
 
 void packet_queue_free_packet(packet_t* packet)
 {
     DPRINT("Packet queue mark free %p", packet);
-    for(uint8_t i = 0; i < MODULE_D7AP_PACKET_QUEUE_SIZE; i++)
+    uint8_t index = get_index(packet);
+    packet_init(packet);
+
+    start_atomic();
+    assert(packet_queue_element_status[index] >= PACKET_QUEUE_ELEMENT_STATUS_ALLOCATED);
+    set_status(index, PACKET_QUEUE_ELEMENT_STATUS_FREE);
+    end_atomic();
+}
+
+packet_t* packet_queue_reclaim_lowest_rssi_received_packet(uint8_t length)
+{
+    packet_t* packet = NULL;
+
+    start_atomic();
+    uint8_t lowest = NO_PACKET;
+    for(uint8_t index = received_list.head; index != NO_PACKET; index = packet_queue_next[index])
     {
-        if(packet == &(packet_queue[i]))
-        {
-            assert(packet_queue_element_status[i] >= PACKET_QUEUE_ELEMENT_STATUS_ALLOCATED);
-            packet_queue_element_status[i] = PACKET_QUEUE_ELEMENT_STATUS_FREE;
-            packet_init(&(packet_queue[i]));
-            return;
-        }
+        if(!fits_packet(index, length))
+            continue;
+
+        if(lowest == NO_PACKET || get_packet(index)->hw_radio_packet.rx_meta.rssi < get_packet(lowest)->hw_radio_packet.rx_meta.rssi)
+            lowest = index;
+    }
+
+    if(lowest != NO_PACKET)
+    {
+        // reuse the buffer directly instead of passing through the free list, so no other alloc can take it
+        set_status(lowest, PACKET_QUEUE_ELEMENT_STATUS_ALLOCATED);
+        packet = get_packet(lowest);
     }
+    end_atomic();
 
-    assert(false); // should never happen
+    if(packet != NULL)
+    {
+        DPRINT("Packet queue reclaimed received packet %p, rssi %i", packet, packet->hw_radio_packet.rx_meta.rssi);
+        packet_init(packet);
+    }
+
+    return packet;
 }
 
 packet_t* packet_queue_find_packet(hw_radio_packet_t* hw_radio_packet)
 {
-    for(uint8_t i = 0; i < MODULE_D7AP_PACKET_QUEUE_SIZE; i++)
-    {
-        if(&(packet_queue[i].hw_radio_packet) == hw_radio_packet)
-            return &(packet_queue[i]);
-    }
+    return get_packet(get_hw_radio_packet_index(hw_radio_packet));
+}
 
-    return NULL;
+packet_t* packet_queue_ensure_max_length_packet(packet_t* packet)
+{
+    return packet_queue_ensure_frame_length(packet, UINT8_MAX);
+}
+
+packet_t* packet_queue_ensure_frame_length(packet_t* packet, uint8_t length)
+{
+#if SHORT_PACKET_COUNT > 0
+    uint8_t index = get_index(packet);
+    if(fits_packet(index, length))
+        return packet;
+
+    start_atomic();
+    uint8_t new_index = free_list.head;
+    if(new_index != NO_PACKET)
+        set_status(new_index, packet_queue_element_status[index]);
+    end_atomic();
+
+    if(new_index == NO_PACKET)
+        return NULL;
+
+    // the short packet is copied as a whole, including the frame, and the payload view is moved along
+    packet_t* new_packet = get_packet(new_index);
+    memcpy(new_packet, packet, sizeof(short_packet_t));
+    if(packet->payload != NULL)
+        new_packet->payload = new_packet->hw_radio_packet.data + (packet->payload - packet->hw_radio_packet.data);
+
+    DPRINT("Packet queue moved %p to max length packet %p", packet, new_packet);
+    packet_queue_free_packet(packet);
+    return new_packet;
+#else
+    return packet;
+#endif
 }
 
 void packet_queue_mark_received(hw_radio_packet_t* hw_radio_packet)
 {
-    for(uint8_t i = 0; i < MODULE_D7AP_PACKET_QUEUE_SIZE; i++)
-    {
-        if(&(packet_queue[i].hw_radio_packet) == hw_radio_packet)
-        {
-            assert(packet_queue_element_status[i] == PACKET_QUEUE_ELEMENT_STATUS_ALLOCATED);
-            DPRINT("Packet queue mark received %p", &(packet_queue[i].hw_radio_packet));
-            packet_queue_element_status[i] = PACKET_QUEUE_ELEMENT_STATUS_RECEIVED;
-            return;
-        }
-    }
+    uint8_t index = get_hw_radio_packet_index(hw_radio_packet);
+    DPRINT("Packet queue mark received %p", hw_radio_packet);
 
-    assert(false);
+    start_atomic();
+    assert(packet_queue_element_status[index] == PACKET_QUEUE_ELEMENT_STATUS_ALLOCATED);
+    packet_queue_element_status[index] = PACKET_QUEUE_ELEMENT_STATUS_RECEIVED;
+    // keep the received packets ordered on rx timestamp, normally the packet is appended at the tail
+    uint8_t prev = received_list.tail;
+    while(prev != NO_PACKET && received_before(index, prev))
+        prev = packet_queue_prev[prev];
+
+    list_insert_after(&received_list, prev, index);
+    end_atomic();
 }
 
 packet_t* packet_queue_mark_transmitted(hw_radio_packet_t* hw_radio_packet)
 {
-    for(uint8_t i = 0; i < MODULE_D7AP_PACKET_QUEUE_SIZE; i++)
-    {
-        if(&(packet_queue[i].hw_radio_packet) == hw_radio_packet)
-        {
-            assert(packet_queue_element_status[i] == PACKET_QUEUE_ELEMENT_STATUS_PROCESSING);
-            DPRINT("Packet queue mark transmitted %p", &(packet_queue[i].hw_radio_packet));
-            packet_queue_element_status[i] = PACKET_QUEUE_ELEMENT_STATUS_TRANSMITTED;
-            return &(packet_queue[i]);
-        }
-    }
+    uint8_t index = get_hw_radio_packet_index(hw_radio_packet);
+    DPRINT("Packet queue mark transmitted %p", hw_radio_packet);
 
-    assert(false);
+    start_atomic();
+    assert(packet_queue_element_status[index] == PACKET_QUEUE_ELEMENT_STATUS_PROCESSING);
+    set_status(index, PACKET_QUEUE_ELEMENT_STATUS_TRANSMITTED);
+    end_atomic();
+
+    return get_packet(index);
 }
 
 packet_t* packet_queue_get_received_packet()
 {
-    // note: we return the first found received packet, this may not be the oldest one
-    for(uint8_t i = 0; i < MODULE_D7AP_PACKET_QUEUE_SIZE; i++)
+    // received packets are queued in the order they were received
+    uint8_t index = received_list.head;
+    return index == NO_PACKET? NULL : get_packet(index);
+}
+
+uint8_t packet_queue_drop_received_packets_before(timer_tick_t timestamp)
+{
+    uint8_t dropped = 0;
+    while(true)
     {
-        if(packet_queue_element_status[i] == PACKET_QUEUE_ELEMENT_STATUS_RECEIVED)
-            return &(packet_queue[i]);
+        start_atomic();
+        uint8_t index = received_list.head;
+        if(index == NO_PACKET || ((int32_t)(get_packet(index)->hw_radio_packet.rx_meta.timestamp - timestamp)) >= 0)
+        {
+            end_atomic();
+            break;
+        }
+
+        // take it out of the received list first, so it can be cleared outside of the atomic section
+        set_status(index, PACKET_QUEUE_ELEMENT_STATUS_PROCESSING);
+        end_atomic();
+
+        DPRINT("Dropping received packet %p, received @ %i", get_packet(index), get_packet(index)->hw_radio_packet.rx_meta.timestamp);
+        packet_queue_free_packet(get_packet(index));
+        dropped++;
     }
 
-    return NULL;
+    return dropped;
 }
 
 packet_t* packet_queue_get_transmitted_packet()
 {
-    // note: we return the first found transmitted packet but it is not expected to find more than one entry
-    for(uint8_t i = 0; i < MODULE_D7AP_PACKET_QUEUE_SIZE; i++)
-    {
-        if(packet_queue_element_status[i] == PACKET_QUEUE_ELEMENT_STATUS_TRANSMITTED)
-            return &(packet_queue[i]);
-    }
-
-    return NULL;
+    // note: it is not expected to find more than one entry
+    uint8_t index = transmitted_list.head;
+    return index == NO_PACKET? NULL : get_packet(index);
 }
 
 void packet_queue_mark_processing(packet_t* packet)
 {
     DPRINT("Packet queue mark processing %p", packet);
-    for(uint8_t i = 0; i < MODULE_D7AP_PACKET_QUEUE_SIZE; i++)
-    {
-        if(packet == &(packet_queue[i]))
-        {
-            assert(packet_queue_element_status[i] != PACKET_QUEUE_ELEMENT_STATUS_FREE);
+    uint8_t index = get_index(packet);
 
-            packet_queue_element_status[i] = PACKET_QUEUE_ELEMENT_STATUS_PROCESSING;
-            return;
-        }
-    }
+    start_atomic();
+    assert(packet_queue_element_status[index] != PACKET_QUEUE_ELEMENT_STATUS_FREE);
+    set_status(index, PACKET_QUEUE_ELEMENT_STATUS_PROCESSING);
+    end_atomic();
+}
 
-    assert(false);
+void packet_queue_get_stats(pool_stats_t* stats)
+{
+    start_atomic();
+    *stats = packet_queue_stats;
+    end_atomic();
+}
+
+void packet_queue_reset_stats()
+{
+    start_atomic();
+    pool_stats_reset(&packet_queue_stats);
+    end_atomic();
 }
@@ -27,16 +27,28 @@
 #define OSS_7_PACKET_QUEUE_H
 
 #include "packet.h"
+#include "pool_stats.h"
 
 /*! Initializes the packet queue */
 void packet_queue_init();
 
-/*! Returns the first free packet buffer in the queue and marks this as used until this is free()-ed again */
-packet_t* packet_queue_alloc_packet();
+/*! Returns a free packet buffer from the queue which can hold a frame of the supplied length and marks this as used until this is free()-ed again.
+ * A short packet buffer is returned when the frame fits in it. Returns NULL if all packets which can hold the frame are in use. */
+packet_t* packet_queue_alloc_packet(uint8_t length);
 
 /*! Marks the packet buffer as free again */
 void packet_queue_free_packet(packet_t*);
 
+/*! Frees the queued received packet with the lowest RSSI which can hold a frame of the supplied length and allocates it again, for when the queue is full. Returns NULL if no such received packet queued. */
+packet_t* packet_queue_reclaim_lowest_rssi_received_packet(uint8_t length);
+
+/*! Returns the supplied packet if it has a max length frame buffer, otherwise moves it to a free max length packet buffer and frees the short one.
+ * Returns NULL, leaving the supplied packet untouched, if all max length packet buffers are in use. */
+packet_t* packet_queue_ensure_max_length_packet(packet_t*);
+
+/*! Like packet_queue_ensure_max_length_packet(), but keeps the packet in its short packet buffer when a frame of the supplied length fits in it */
+packet_t* packet_queue_ensure_frame_length(packet_t* packet, uint8_t length);
+
 /*! Finds the packet_t corresponding to the supplied hw_radio_packet_t */
 packet_t* packet_queue_find_packet(hw_radio_packet_t*);
 
@@ -49,11 +61,20 @@ packet_t* packet_queue_mark_transmitted(hw_radio_packet_t*);
 /*! Indicates the supplied packet is being processed */
 void packet_queue_mark_processing(packet_t*);
 
-/*! Get a received packet for further processing. Returns NULL if no received packet queued. */
+/*! Get the received packet which was marked received first, for further processing. Returns NULL if no received packet queued. */
 packet_t* packet_queue_get_received_packet();
 
+/*! Frees all received packets with an rx timestamp before the supplied timestamp, without processing them. Returns the number of dropped packets. */
+uint8_t packet_queue_drop_received_packets_before(timer_tick_t timestamp);
+
 /*! Get a transmitted packet for further processing. Returns NULL if no transmitted packet queued. */
 packet_t* packet_queue_get_transmitted_packet();
+
+/*! Get the usage statistics of the queue, the failure count is the number of packet_queue_alloc_packet() calls which returned NULL */
+void packet_queue_get_stats(pool_stats_t* stats);
+
+/*! Restarts the high water mark of the queue from the current usage and clears the failure count */
+void packet_queue_reset_stats();
 #endif //OSS_7_PACKET_QUEUE_H
 
 /** @}*/
@@ -0,0 +1,132 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "remote_file_cache.h"
+
+#include "MODULE_D7AP_defs.h"
+#ifdef MODULE_D7AP_REMOTE_FILE_CACHE_ENABLED
+
+#include "string.h"
+#include "debug.h"
+#include "ng.h"
+#include "timer.h"
+#include "log.h"
+
+#if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_MISC_LOG_ENABLED)
+#define DPRINT(...) log_print_stack_string(LOG_STACK_FWK, __VA_ARGS__)
+#else
+#define DPRINT(...)
+#endif
+
+#define MAX_AGE (MODULE_D7AP_REMOTE_FILE_CACHE_MAX_AGE * TIMER_TICKS_PER_SEC / 1000)
+
+// one contiguous range of a file of a node
+typedef struct {
+    bool is_valid;
+    uint8_t uid[ID_TYPE_UID_ID_LENGTH];
+    uint8_t file_id;
+    uint32_t offset;
+    uint8_t length;
+    timer_tick_t timestamp;
+    d7asp_result_t d7asp_result; // the addressee is not kept
+    uint8_t data[MODULE_D7AP_REMOTE_FILE_CACHE_DATA_SIZE];
+} cache_entry_t;
+
+static cache_entry_t NGDEF(_entries)[MODULE_D7AP_REMOTE_FILE_CACHE_SIZE];
+#define entries NG(_entries)
+
+static cache_entry_t* find_entry(const uint8_t* uid, uint8_t file_id)
+{
+    for(uint8_t i = 0; i < MODULE_D7AP_REMOTE_FILE_CACHE_SIZE; i++)
+    {
+        if(entries[i].is_valid && entries[i].file_id == file_id && memcmp(entries[i].uid, uid, ID_TYPE_UID_ID_LENGTH) == 0)
+            return &entries[i];
+    }
+
+    return NULL;
+}
+
+void remote_file_cache_init()
+{
+    memset(entries, 0, sizeof(entries));
+}
+
+void remote_file_cache_update(const d7asp_result_t* d7asp_result, uint8_t file_id, uint32_t offset, const uint8_t* data, uint32_t length)
+{
+    if(d7asp_result->addressee == NULL || d7asp_result->addressee->ctrl.id_type != ID_TYPE_UID)
+        return;
+
+    const uint8_t* uid = d7asp_result->addressee->id;
+    cache_entry_t* entry = find_entry(uid, file_id);
+    if(length > MODULE_D7AP_REMOTE_FILE_CACHE_DATA_SIZE)
+    {
+        // too big to cache, the data cached before is outdated now
+        if(entry != NULL)
+            entry->is_valid = false;
+
+        return;
+    }
+
+    if(entry == NULL)
+    {
+        // a free entry, or else the one cached longest ago
+        entry = &entries[0];
+        for(uint8_t i = 0; i < MODULE_D7AP_REMOTE_FILE_CACHE_SIZE && entry->is_valid; i++)
+        {
+            if(!entries[i].is_valid || timer_get_counter_value() - entries[i].timestamp > timer_get_counter_value() - entry->timestamp)
+                entry = &entries[i];
+        }
+    }
+
+    DPRINT("Cache file %i of %02x%02x%02x%02x%02x%02x%02x%02x", file_id, uid[0], uid[1], uid[2], uid[3], uid[4], uid[5], uid[6], uid[7]);
+    entry->is_valid = true;
+    memcpy(entry->uid, uid, ID_TYPE_UID_ID_LENGTH);
+    entry->file_id = file_id;
+    entry->offset = offset;
+    entry->length = length;
+    entry->timestamp = timer_get_counter_value();
+    entry->d7asp_result = *d7asp_result;
+    entry->d7asp_result.addressee = NULL;
+    memcpy(entry->data, data, length);
+}
+
+bool remote_file_cache_read(const uint8_t* uid, uint8_t file_id, uint32_t offset, uint8_t* buffer, uint32_t length, d7asp_result_t* d7asp_result)
+{
+    cache_entry_t* entry = find_entry(uid, file_id);
+    if(entry == NULL || offset < entry->offset || offset - entry->offset > entry->length || length > entry->length - (offset - entry->offset))
+        return false;
+
+    if(timer_get_counter_value() - entry->timestamp > MAX_AGE)
+    {
+        entry->is_valid = false;
+        return false;
+    }
+
+    memcpy(buffer, entry->data + (offset - entry->offset), length);
+    *d7asp_result = entry->d7asp_result;
+    return true;
+}
+
+void remote_file_cache_invalidate(const uint8_t* uid, uint8_t file_id)
+{
+    cache_entry_t* entry = find_entry(uid, file_id);
+    if(entry != NULL)
+        entry->is_valid = false;
+}
+
+#endif // MODULE_D7AP_REMOTE_FILE_CACHE_ENABLED
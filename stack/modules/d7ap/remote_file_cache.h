@@ -0,0 +1,56 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file remote_file_cache.h
+ * \brief Cache of the files returned by remote nodes, for gateways
+ *
+ * The file data returned by nodes addressed by UID is kept for MODULE_D7AP_REMOTE_FILE_CACHE_MAX_AGE ms. ALP answers the
+ * forwarded reads of the host from the cache while the data is fresh, instead of starting a dialog. Forwarding a write to
+ * a cached file drops it. Requires MODULE_D7AP_REMOTE_FILE_CACHE_ENABLED.
+ */
+
+#ifndef REMOTE_FILE_CACHE_H_
+#define REMOTE_FILE_CACHE_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "d7asp.h"
+
+void remote_file_cache_init();
+
+/**
+ * \brief Cache file data returned by a remote node, ignored unless the node is addressed by UID
+ *
+ * The data replaces the data cached earlier for this file of this node.
+ */
+void remote_file_cache_update(const d7asp_result_t* d7asp_result, uint8_t file_id, uint32_t offset, const uint8_t* data, uint32_t length);
+
+/**
+ * \brief Read file data of a remote node from the cache
+ *
+ * \param d7asp_result The result of the response the data was received in, its addressee is set to NULL
+ * \return false when the requested data is not cached completely or is older than MODULE_D7AP_REMOTE_FILE_CACHE_MAX_AGE
+ */
+bool remote_file_cache_read(const uint8_t* uid, uint8_t file_id, uint32_t offset, uint8_t* buffer, uint32_t length, d7asp_result_t* d7asp_result);
+
+/**
+ * \brief Drop the cached data of a file of a remote node, for example when a write to it is forwarded
+ */
+void remote_file_cache_invalidate(const uint8_t* uid, uint8_t file_id);
+
+#endif /* REMOTE_FILE_CACHE_H_ */
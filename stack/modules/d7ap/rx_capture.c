@@ -0,0 +1,45 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rx_capture.h"
+
+#include "MODULE_D7AP_defs.h"
+#ifdef MODULE_D7AP_DLL_RX_CAPTURE_ENABLED
+
+#include "stdio.h"
+
+void rx_capture_record(const hw_radio_packet_t* hw_radio_packet)
+{
+    const hw_rx_metadata_t* rx_meta = &hw_radio_packet->rx_meta;
+    uint8_t header[1 + RX_CAPTURE_HEADER_SIZE] = {
+        RX_CAPTURE_RECORD_MARKER,
+        rx_meta->timestamp & 0xFF, (rx_meta->timestamp >> 8) & 0xFF,
+        (rx_meta->timestamp >> 16) & 0xFF, (rx_meta->timestamp >> 24) & 0xFF,
+        (uint16_t)rx_meta->rssi & 0xFF, (uint16_t)rx_meta->rssi >> 8,
+        rx_meta->rx_cfg.channel_id.channel_header_raw,
+        rx_meta->rx_cfg.channel_id.center_freq_index & 0xFF, rx_meta->rx_cfg.channel_id.center_freq_index >> 8,
+        rx_meta->rx_cfg.syncword_class
+    };
+
+    // the length byte is data[0], the frame follows it
+    fwrite(header, 1, sizeof(header), stdout);
+    fwrite(hw_radio_packet->data, 1, hw_radio_packet->length + 1, stdout);
+    fflush(stdout);
+}
+
+#endif // MODULE_D7AP_DLL_RX_CAPTURE_ENABLED
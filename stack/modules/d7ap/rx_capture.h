@@ -0,0 +1,47 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file rx_capture.h
+ * \brief Captures the frames received by the DLL in a compact binary log, to replay them later into a host build
+ *
+ * Every received frame is written as a record on the log output (the console or RTT, see FRAMEWORK_LOG_OUTPUT_ON_RTT)
+ * before the stack processes it. The record starts with RX_CAPTURE_RECORD_MARKER, which neither occurs in the text logs
+ * nor starts a deferred log record, followed by RX_CAPTURE_HEADER_SIZE header bytes and the frame:
+ *   - the timestamp of the frame (32 bit, little endian, in timer ticks)
+ *   - the RSSI (16 bit, little endian, signed)
+ *   - the raw channel header and the center frequency index (16 bit, little endian) of the channel
+ *   - the syncword class
+ *   - the length byte of the frame, followed by that many bytes of the frame as the radio delivered them (with its CRC)
+ *
+ * tests/native/replay.c feeds a capture through the stack of the native platform. Requires MODULE_D7AP_DLL_RX_CAPTURE_ENABLED.
+ */
+
+#ifndef RX_CAPTURE_H_
+#define RX_CAPTURE_H_
+
+#include "hwradio.h"
+
+#define RX_CAPTURE_RECORD_MARKER 0x1F
+#define RX_CAPTURE_HEADER_SIZE 10
+
+/**
+ * \brief Write the record of a received frame, not to be called from interrupt context
+ */
+void rx_capture_record(const hw_radio_packet_t* hw_radio_packet);
+
+#endif /* RX_CAPTURE_H_ */
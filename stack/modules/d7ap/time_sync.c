@@ -0,0 +1,154 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "time_sync.h"
+
+#include "MODULE_D7AP_defs.h"
+#if MODULE_D7AP_TIME_SYNC_ROLE > 0
+
+#include "string.h"
+#include "alp.h"
+#include "debug.h"
+#include "fs.h"
+#include "ng.h"
+#include "log.h"
+
+#if defined(FRAMEWORK_LOG_ENABLED) && defined(MODULE_D7AP_MISC_LOG_ENABLED)
+#define DPRINT(...) log_print_stack_string(LOG_STACK_FWK, __VA_ARGS__)
+#else
+#define DPRINT(...)
+#endif
+
+#if MODULE_D7AP_TIME_SYNC_ROLE != TIME_SYNC_ROLE_FOLLOWER && MODULE_D7AP_TIME_SYNC_ROLE != TIME_SYNC_ROLE_SOURCE
+#error "MODULE_D7AP_TIME_SYNC_ROLE should be 0, 1 (follower) or 2 (source)"
+#endif
+
+#define HOLDOVER ((timer_tick_t)MODULE_D7AP_TIME_SYNC_HOLDOVER * TIMER_TICKS_PER_SEC)
+
+// a follower steps to the time of the source when it is off by more than this, a smaller error is halved on every
+// response so the jitter of the timestamps is filtered
+#define MAX_SLEW (TIMER_TICKS_PER_SEC / 8)
+
+// the operands of the action carrying the network time, followed by the time
+static const uint8_t time_action_header[] = {
+    ALP_OP_RETURN_FILE_DATA, D7A_FILE_NETWORK_TIME_FILE_ID, 0, D7A_FILE_NETWORK_TIME_SIZE
+};
+
+_Static_assert(sizeof(time_action_header) + D7A_FILE_NETWORK_TIME_SIZE == TIME_SYNC_ACTION_SIZE,
+               "the network time action should be TIME_SYNC_ACTION_SIZE bytes");
+
+static timer_tick_t NGDEF(_network_time_offset); // the network time minus the time of the framework timer
+#define network_time_offset NG(_network_time_offset)
+
+static bool NGDEF(_synchronized);
+#define synchronized NG(_synchronized)
+
+static timer_tick_t NGDEF(_last_sync);
+#define last_sync NG(_last_sync)
+
+void time_sync_init()
+{
+    network_time_offset = 0;
+    synchronized = false;
+    last_sync = 0;
+}
+
+timer_tick_t time_sync_to_network_time(timer_tick_t local_time)
+{
+    return local_time + network_time_offset;
+}
+
+void time_sync_set_network_time(timer_tick_t network_time)
+{
+    timer_tick_t now = timer_get_counter_value();
+    network_time_offset = network_time - now;
+    synchronized = true;
+    last_sync = now;
+}
+
+bool time_sync_is_synchronized()
+{
+#if MODULE_D7AP_TIME_SYNC_ROLE == TIME_SYNC_ROLE_SOURCE
+    return true;
+#else
+    if (synchronized && timer_get_counter_value() - last_sync > HOLDOVER)
+    {
+        DPRINT("Network time not refreshed for %i ticks, lost the synchronization", HOLDOVER);
+        synchronized = false;
+    }
+
+    return synchronized;
+#endif
+}
+
+void time_sync_attach(packet_t* packet)
+{
+#if MODULE_D7AP_TIME_SYNC_ROLE == TIME_SYNC_ROLE_SOURCE
+    packet->network_time_index = 0;
+    if (packet->d7anp_ctrl.nls_method
+        || packet->payload_length + TIME_SYNC_ACTION_SIZE > packet_max_payload_length(packet->d7anp_addressee))
+        return;
+
+    memcpy(packet->payload + packet->payload_length, time_action_header, sizeof(time_action_header));
+    packet->payload_length += sizeof(time_action_header);
+    packet->network_time_index = packet->payload_length;
+    memset(packet->payload + packet->payload_length, 0, D7A_FILE_NETWORK_TIME_SIZE);
+    packet->payload_length += D7A_FILE_NETWORK_TIME_SIZE;
+#endif
+}
+
+void time_sync_stamp_frame(packet_t* packet)
+{
+    if (packet->network_time_index == 0)
+        return;
+
+    // the receiver timestamps the end of the frame
+    uint32_t network_time = __builtin_bswap32(time_sync_get_network_time() + packet->tx_duration);
+    memcpy(packet->payload + packet->network_time_index, &network_time, sizeof(network_time));
+    packet_update_crc(packet);
+}
+
+void time_sync_process_response(packet_t* packet)
+{
+#if MODULE_D7AP_TIME_SYNC_ROLE == TIME_SYNC_ROLE_FOLLOWER
+    if (packet->d7anp_ctrl.nls_method || packet->payload_length < TIME_SYNC_ACTION_SIZE)
+        return;
+
+    uint8_t* action = packet->payload + packet->payload_length - TIME_SYNC_ACTION_SIZE;
+    if (memcmp(action, time_action_header, sizeof(time_action_header)) != 0)
+        return;
+
+    uint32_t network_time;
+    memcpy(&network_time, action + sizeof(time_action_header), sizeof(network_time));
+    network_time = __builtin_bswap32(network_time);
+    packet->payload_length -= TIME_SYNC_ACTION_SIZE;
+
+    timer_tick_t received = packet->hw_radio_packet.rx_meta.timestamp;
+    int32_t error = (int32_t)(network_time - time_sync_to_network_time(received));
+    if (!time_sync_is_synchronized() || error > MAX_SLEW || error < -MAX_SLEW)
+        network_time_offset = network_time - received;
+    else
+        network_time_offset += error / 2;
+
+    DPRINT("Network time off by %i ticks", error);
+    synchronized = true;
+    last_sync = received;
+#endif
+}
+
+#endif // MODULE_D7AP_TIME_SYNC_ROLE > 0
@@ -0,0 +1,89 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2015 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file time_sync.h
+ * \brief Network time distributed by the gateways, to align the background scans of the endpoints
+ *
+ * The network time counts timer ticks like the framework timer of the node, offset by the difference with the time of the
+ * gateway (the nodes of a network use the same FRAMEWORK_TIMER_RESOLUTION). The framework timer itself is not changed,
+ * so the scheduled events keep their deadlines.
+ *
+ * A source (MODULE_D7AP_TIME_SYNC_ROLE 2, gateways) appends the file data of D7A_FILE_NETWORK_TIME_FILE_ID to the
+ * unsecured responses it sends: return file data, offset 0, length 4 and the network time at the end of the frame (big
+ * endian), written right before the transmission. A follower (MODULE_D7AP_TIME_SYNC_ROLE 1, endpoints) takes the time
+ * of the responses it receives and drops the action before the response reaches ALP. It remains synchronized for
+ * MODULE_D7AP_TIME_SYNC_HOLDOVER seconds after the last response. Secured frames are encrypted before the channel
+ * access, they do not carry the time.
+ *
+ * The synchronized nodes start their background scan events at the multiples of the scan event period in network time,
+ * scanning the channel of the scan channel list selected by the network time. With MODULE_D7AP_TIME_SYNC_SCAN_WINDOW_GUARD
+ * a source then advertises its background requests only around the next scan of the channel, see dll.c.
+ */
+
+#ifndef TIME_SYNC_H_
+#define TIME_SYNC_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "timer.h"
+#include "packet.h"
+
+#define TIME_SYNC_ROLE_FOLLOWER 1
+#define TIME_SYNC_ROLE_SOURCE 2
+
+/*! \brief The size of the action carrying the network time: operation, file ID, offset, length and the time */
+#define TIME_SYNC_ACTION_SIZE 8
+
+void time_sync_init();
+
+/**
+ * \brief The network time at a time of the framework timer
+ */
+timer_tick_t time_sync_to_network_time(timer_tick_t local_time);
+
+static inline timer_tick_t time_sync_get_network_time()
+{
+    return time_sync_to_network_time(timer_get_counter_value());
+}
+
+/**
+ * \brief Set the network time, for example written by the host of a gateway. A follower is synchronized then
+ */
+void time_sync_set_network_time(timer_tick_t network_time);
+
+/**
+ * \brief Whether the network time follows a source, always true for a source
+ */
+bool time_sync_is_synchronized();
+
+/**
+ * \brief Append the network time to the payload of a response, stamped by time_sync_stamp_frame(). Only for a source
+ */
+void time_sync_attach(packet_t* packet);
+
+/**
+ * \brief Write the network time in the assembled frame of a packet which carries it, right before its transmission
+ */
+void time_sync_stamp_frame(packet_t* packet);
+
+/**
+ * \brief Take the network time of a received response which carries it, and drop it from the payload. Only for a follower
+ */
+void time_sync_process_response(packet_t* packet);
+
+#endif /* TIME_SYNC_H_ */
@@ -20,14 +20,23 @@
 #include <stdio.h>
 #include <string.h>
 #include "aes.h"
+#include "hal_defs.h"
+
+#ifdef HAL_AES_USE_HW
+#include "hwaes.h"
+#endif
 
 /*
  * This unit-test application is used to confirm that our implementation has
  * correctly implemented AES-ECB, AES-CBC, AES-CTR and AES-CCM mode. All the
  * test vectors use AES with a 128 bit key;
  *
- * The AES-ECB, AES-CBC, AES-CBC-MAC modes are implicitly tested through the
- * testing of the AES-CTR and AES-CCM mode
+ * The AES-CBC, AES-CBC-MAC modes are implicitly tested through the
+ * testing of the AES-CCM mode
+ *
+ * After the known-answer tests, the cost per byte of each mode is measured
+ * for the AES backend the framework is built with, and for the raw hw_aes
+ * functions when the MCU has an AES accelerator.
  */
 
 #define DPRINT(...) printf(__VA_ARGS__)
@@ -44,6 +53,68 @@ void print_array(uint8_t* buffer, uint8_t length)
     printf("\n");
 }
 
+/*
+ * Cycle counter used for the benchmark: the DWT cycle counter on Cortex-M3/M4,
+ * the framework timer on other targets.
+ */
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#define BENCH_UNIT "cycles"
+#define DEMCR (*(volatile uint32_t *)0xE000EDFC)
+#define DEMCR_TRCENA (1UL << 24)
+#define DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+
+static void bench_counter_init()
+{
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= 1;
+}
+
+static uint32_t bench_counter() { return DWT_CYCCNT; }
+#else
+#include "timer.h"
+#define BENCH_UNIT "timer ticks"
+
+static void bench_counter_init() {}
+static uint32_t bench_counter() { return timer_get_counter_value(); }
+#endif
+
+/*
+ * AES-ECB test vectors from:
+ *
+ * NIST SP 800-38A, F.1.1 ECB-AES128.Encrypt
+ */
+
+#define ECB_TEST_VECTORS_NB 4
+
+static const uint8_t ecb_key[AES_BLOCK_SIZE] = {
+    0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+    0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C
+};
+
+static const uint8_t ecb_pt[ECB_TEST_VECTORS_NB][AES_BLOCK_SIZE] = {
+    { 0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96,
+      0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A },
+    { 0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C,
+      0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51 },
+    { 0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11,
+      0xE5, 0xFB, 0xC1, 0x19, 0x1A, 0x0A, 0x52, 0xEF },
+    { 0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B, 0x17,
+      0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10 }
+};
+
+static const uint8_t ecb_ct[ECB_TEST_VECTORS_NB][AES_BLOCK_SIZE] = {
+    { 0x3A, 0xD7, 0x7B, 0xB4, 0x0D, 0x7A, 0x36, 0x60,
+      0xA8, 0x9E, 0xCA, 0xF3, 0x24, 0x66, 0xEF, 0x97 },
+    { 0xF5, 0xD3, 0xD5, 0x85, 0x03, 0xB9, 0x69, 0x9D,
+      0xE7, 0x85, 0x89, 0x5A, 0x96, 0xFD, 0xBA, 0xAF },
+    { 0x43, 0xB1, 0xCD, 0x7F, 0x59, 0x8E, 0xCE, 0x23,
+      0x88, 0x1B, 0x00, 0xE3, 0xED, 0x03, 0x06, 0x88 },
+    { 0x7B, 0x0C, 0x78, 0x5E, 0x27, 0xE8, 0xAD, 0x3F,
+      0x82, 0x23, 0x20, 0x71, 0x04, 0x72, 0x5D, 0xD4 }
+};
+
 /*
  * AES-CCM test vectors from:
  *
@@ -207,6 +278,106 @@ static const unsigned char ctr_ct[CTR_TEST_VECTORS_NB][36] =
 
 static const int ctr_len[CTR_TEST_VECTORS_NB] = { 16, 32, 36 };
 
+/*
+ * Benchmark, over the payload sizes of a D7A frame
+ */
+
+#define BENCH_ITERATIONS 16
+#define BENCH_SIZES_NB 5
+#define BENCH_AUTH_LEN 4 // allows CCM over the largest payload
+
+static const uint8_t bench_size[BENCH_SIZES_NB] = { 16, 32, 64, 128, 239 };
+
+typedef enum {
+    BENCH_ECB,
+    BENCH_CTR,
+    BENCH_CBC_MAC,
+    BENCH_CCM,
+#ifdef HAL_AES_USE_HW
+    BENCH_HW_ECB,
+    BENCH_HW_CTR,
+#endif
+    BENCH_MODES_NB
+} bench_mode_t;
+
+static const char* bench_mode_name[BENCH_MODES_NB] = {
+    "ECB",
+    "CTR",
+    "CBC-MAC",
+    "CCM",
+#ifdef HAL_AES_USE_HW
+    "hw_aes ECB",
+    "hw_aes CTR",
+#endif
+};
+
+static void bench_run(bench_mode_t mode, uint8_t *buffer, uint8_t length)
+{
+    uint8_t ctr[AES_BLOCK_SIZE];
+    uint8_t auth[AES_BLOCK_SIZE];
+    uint8_t i;
+
+    memcpy(ctr, ccm_ctr[0], AES_BLOCK_SIZE);
+
+    switch (mode)
+    {
+    case BENCH_ECB:
+        // the partial last block is processed as a full block
+        for (i = 0; i < length; i += AES_BLOCK_SIZE)
+            AES128_ECB_encrypt(buffer + i, buffer + i);
+        break;
+    case BENCH_CTR:
+        AES128_CTR_encrypt(buffer, buffer, length, ctr);
+        break;
+    case BENCH_CBC_MAC:
+        AES128_CBC_MAC(auth, buffer, length, ccm_iv[0], ad, sizeof(ad), BENCH_AUTH_LEN);
+        break;
+    case BENCH_CCM:
+        AES128_CCM_encrypt(buffer, length, ccm_iv[0], ad, sizeof(ad), ctr, BENCH_AUTH_LEN);
+        break;
+#ifdef HAL_AES_USE_HW
+    case BENCH_HW_ECB:
+        hw_aes_ecb128(buffer, buffer, length - (length % AES_BLOCK_SIZE), ccm_key, true);
+        break;
+    case BENCH_HW_CTR:
+        hw_aes_ctr128(buffer, buffer, length - (length % AES_BLOCK_SIZE), ccm_key, ctr);
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+static void bench()
+{
+    // room for the CCM authentication tag and the padding of the last ECB block
+    uint8_t buffer[255 + AES_BLOCK_SIZE];
+    uint32_t start;
+    uint32_t elapsed;
+    uint8_t mode;
+    uint8_t i;
+    uint8_t n;
+
+    DPRINT("Benchmark in " BENCH_UNIT " per byte x100, %d iterations\n", BENCH_ITERATIONS);
+    bench_counter_init();
+    AES128_init(ccm_key);
+    memset(buffer, 0xA5, sizeof(buffer));
+
+    for (mode = 0; mode < BENCH_MODES_NB; mode++)
+    {
+        for (i = 0; i < BENCH_SIZES_NB; i++)
+        {
+            start = bench_counter();
+            for (n = 0; n < BENCH_ITERATIONS; n++)
+                bench_run(mode, buffer, bench_size[i]);
+            elapsed = bench_counter() - start;
+
+            DPRINT("%-10s %3d bytes: %lu\n", bench_mode_name[mode], bench_size[i],
+                   (unsigned long)(((uint64_t)elapsed * 100) / ((uint32_t)BENCH_ITERATIONS * bench_size[i])));
+        }
+    }
+}
+
 int main(int argc, char *argv[])
 {
     int i;
@@ -220,6 +391,31 @@ int main(int argc, char *argv[])
     // TODO set a minimal platform configuration to enable the AES hardware module
 #endif
 
+    /* test AES-ECB mode*/
+    AES128_init(ecb_key);
+    for (i = 0; i < ECB_TEST_VECTORS_NB; i++)
+    {
+        AES128_ECB_encrypt((uint8_t *)ecb_pt[i], payload);
+        if (memcmp(payload, ecb_ct[i], AES_BLOCK_SIZE) != 0)
+        {
+            DPRINT("AES-ECB encryption output \n");
+            DPRINT_DATA(payload, AES_BLOCK_SIZE);
+            DPRINT("AES-ECB encryption #%d failed\n", i + 1);
+            return -1;
+        }
+
+        AES128_ECB_decrypt(payload, payload);
+        if (memcmp(payload, ecb_pt[i], AES_BLOCK_SIZE) != 0)
+        {
+            DPRINT("AES-ECB decryption output \n");
+            DPRINT_DATA(payload, AES_BLOCK_SIZE);
+            DPRINT("AES-ECB decryption #%d failed\n", i + 1);
+            return -1;
+        }
+
+        DPRINT("AES-ECB test vector #%d passed\n", i + 1);
+    }
+
     /* test AES-CTR mode*/
     for (i = 0; i < CTR_TEST_VECTORS_NB; i++)
     {
@@ -289,5 +485,7 @@ int main(int argc, char *argv[])
     }
 
     DPRINT("AES all unit tests OK !\n");
+
+    bench();
     return 0;
 }
@@ -1,158 +1,317 @@
+/*
+ * Host side benchmark and regression test of the FEC of the framework (framework/components/fec/fec.c).
+ *
+ * The framework encoder and decoders (fec_decode_packet() and the incremental fec_decoder_t) are compared bit exactly
+ * against each other and against the original implementation in reference_fec.c, for frames with and without bit
+ * errors. The corrected frame rate is reported for random and burst bit errors, and the encode and decode speed in cycles
+ * (nanoseconds when no cycle counter is available) per byte of payload.
+ *
+ * usage: fec [-n frames] [-b bit error rate] [-l burst length] [-s seed]
+ *
+ * The exit status is the number of failed regression checks.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L // getopt() and clock_gettime() when built with -std=c99, unless the build sets it
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "fec.h"
+#include "reference_fec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIME_UNIT "cycles"
+#else
+#define TIME_UNIT "ns"
+#endif
+
+#define MAX_FRAME_SIZE 255
+#define MAX_ENCODED_SIZE (2 * (MAX_FRAME_SIZE + 3))
+// the encoded frame has to fit the uint8_t packet length of fec_decode_packet() and the 128 byte buffer of the reference
+#define MAX_PACKET_FRAME_SIZE 124
+#define BENCHMARK_ITERATIONS 2000
+
+static uint16_t frame_count = 2000;
+static double bit_error_rate = 0.01;
+static uint8_t burst_length = 8;
+static unsigned int failures = 0;
+
+static uint64_t get_timestamp()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
 
-#define BINARY 0
-
-
-const char *byte_to_binary(uint8_t x)
+static void print_array(uint8_t* buffer, uint16_t length)
 {
-    static char b[9];
-    b[0] = '\0';
+	for (uint16_t i = 0; i < length; i++)
+		printf("%02X", buffer[i]);
+}
 
-    uint8_t z;
-    for (z = 128; z > 0; z >>= 1)
-    {
-        strcat(b, ((x & z) == z) ? "1" : "0");
-    }
+static void fail(const char* check, uint8_t* frame, uint16_t length)
+{
+	// only the first failures are printed in full
+	if (failures++ < 10)
+	{
+		printf("FAIL %s, frame %d: ", check, length);
+		print_array(frame, length);
+		printf("\n");
+	}
+}
 
-    return b;
+static void random_frame(uint8_t* frame, uint16_t length)
+{
+	for (uint16_t i = 0; i < length; i++)
+		frame[i] = rand();
 }
 
-unsigned char Partab[] = { 0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,1,0,0,1,0,1,1,0,0,1,1,0,1,0
-,0,1,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,1
-,0,0,1,0,1,1,0,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1,0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,};
+static bool random_event(double probability)
+{
+	return rand() < probability * ((double) RAND_MAX + 1);
+}
 
-#define TRELLIS_TERMINATOR 0x0B
-const static uint8_t fec_lut[16] = {0, 3, 1, 2, 3, 0, 2, 1, 3, 0, 2, 1, 0, 3, 1, 2};
+// flips every bit with a probability of ber, or bursts of burst_length bits at the same mean bit error rate
+static uint16_t inject_errors(uint8_t* data, uint16_t length, double ber, uint8_t burst)
+{
+	uint16_t errors = 0;
+	for (uint32_t bit = 0; bit < length * 8; bit++)
+	{
+		if (!random_event(burst ? ber / burst : ber))
+			continue;
+
+		for (uint32_t i = bit; i < bit + (burst ? burst : 1) && i < length * 8; i++)
+		{
+			data[i / 8] ^= 1 << (i % 8);
+			errors++;
+		}
+	}
+
+	return errors;
+}
 
+// decodes with an incremental decoder, fed in chunks of random size like the radio drivers do
+static bool decode_incremental(const uint8_t* encoded, uint16_t encoded_length, uint8_t* output, uint8_t length)
+{
+	fec_decoder_t decoder;
+	fec_decoder_init(&decoder, output, length, encoded_length);
+	uint16_t fed = 0;
+	while (fed < encoded_length)
+	{
+		uint8_t chunk = 1 + rand() % 16;
+		if (chunk > encoded_length - fed)
+			chunk = encoded_length - fed;
+
+		fec_decoder_feed(&decoder, encoded + fed, chunk);
+		fed += chunk;
+	}
+
+	return fec_decoder_finish(&decoder);
+}
 
+static void test_encoder()
+{
+	uint8_t frame[MAX_FRAME_SIZE];
+	uint8_t encoded[MAX_ENCODED_SIZE];
+	uint8_t encoded_in_place[MAX_ENCODED_SIZE];
+	uint8_t reference[MAX_ENCODED_SIZE];
+
+	for (uint16_t length = 1; length <= MAX_FRAME_SIZE; length++)
+	{
+		random_frame(frame, length);
+		uint16_t encoded_length = fec_encode_to(frame, length, encoded);
+		if (encoded_length != fec_calculate_encoded_length(length))
+			fail("encoded length", frame, length);
+
+		memcpy(encoded_in_place, frame, length);
+		if (fec_encode(encoded_in_place, length) != encoded_length || memcmp(encoded, encoded_in_place, encoded_length) != 0)
+			fail("fec_encode() against fec_encode_to()", frame, length);
+
+		if (length <= MAX_PACKET_FRAME_SIZE)
+		{
+			memcpy(reference, frame, length);
+			if (reference_fec_encode(reference, length) != encoded_length || memcmp(encoded, reference, encoded_length) != 0)
+				fail("encoder against the reference", frame, length);
+		}
+	}
+}
 
-void test_interleaver()
+// the decoders have to give the same output bit exactly, correct or not
+static void test_decoders(double ber, uint8_t burst)
 {
-	uint8_t fecbuffer[4] = {0xFF,0x00,0xAB,0x00};
-	uint8_t buffer[4]= {0,0,0,0};
-	uint8_t buffer2[4]= {0,0,0,0};
-	uint8_t *output = buffer;
-	uint8_t *input = buffer;
-
-	*output++ = ((fecbuffer[0] & 0x03)) |\
-				((fecbuffer[1] & 0x03) << 2) |\
-				((fecbuffer[2] & 0x03) << 4) |\
-				((fecbuffer[3] & 0x03) << 6);
-	*output++ = (((fecbuffer[0] >> 2) & 0x03)) |\
-					(((fecbuffer[1] >> 2) & 0x03) << 2) |\
-					(((fecbuffer[2] >> 2) & 0x03) << 4) |\
-					(((fecbuffer[3] >> 2) & 0x03) << 6);
-	*output++ = (((fecbuffer[0] >> 4) & 0x03)) |\
-					(((fecbuffer[1] >> 4) & 0x03) << 2) |\
-					(((fecbuffer[2] >> 4) & 0x03) << 4) |\
-					(((fecbuffer[3] >> 4) & 0x03) << 6);
-	*output++ = (((fecbuffer[0] >> 6) & 0x03)) |\
-					(((fecbuffer[1] >> 6) & 0x03) << 2) |\
-					(((fecbuffer[2] >> 6) & 0x03) << 4) |\
-					(((fecbuffer[3] >> 6) & 0x03) << 6);
-
-	printf("Input : "); print_array((uint8_t*) fecbuffer, 4, BINARY); printf("\n");
-	printf("Interl: "); print_array((uint8_t*) buffer, 4, BINARY); printf("\n");
-
-	fecbuffer[0] = ((input[0] & 0x03)) |\
-				((input[1] & 0x03) << 2) |\
-				((input[2] & 0x03) << 4) |\
-				((input[3] & 0x03) << 6);
-	fecbuffer[1] = (((input[0] >> 2) & 0x03)) |\
-					(((input[1] >> 2) & 0x03) << 2) |\
-					(((input[2] >> 2) & 0x03) << 4) |\
-					(((input[3] >> 2) & 0x03) << 6);
-	fecbuffer[2] = (((input[0] >> 4) & 0x03)) |\
-					(((input[1] >> 4) & 0x03) << 2) |\
-					(((input[2] >> 4) & 0x03) << 4) |\
-					(((input[3] >> 4) & 0x03) << 6);
-	fecbuffer[3] = (((input[0] >> 6) & 0x03)) |\
-					(((input[1] >> 6) & 0x03) << 2) |\
-					(((input[2] >> 6) & 0x03) << 4) |\
-					(((input[3] >> 6) & 0x03) << 6);
-
-
-	printf("Deint : "); print_array((uint8_t*) fecbuffer, 4, BINARY); printf("\n");
+	uint8_t frame[MAX_FRAME_SIZE];
+	uint8_t encoded[MAX_ENCODED_SIZE];
+	uint8_t decoded[MAX_ENCODED_SIZE];
+	uint8_t reference[MAX_ENCODED_SIZE];
+	uint8_t incremental[MAX_FRAME_SIZE];
+
+	for (uint16_t i = 0; i < frame_count; i++)
+	{
+		uint16_t length = 1 + rand() % MAX_FRAME_SIZE;
+		random_frame(frame, length);
+		uint16_t encoded_length = fec_encode_to(frame, length, encoded);
+		inject_errors(encoded, encoded_length, ber, burst);
+
+		if (!decode_incremental(encoded, encoded_length, incremental, length))
+			fail("incremental decoder did not finish", frame, length);
+
+		if (ber == 0 && memcmp(incremental, frame, length) != 0)
+			fail("incremental decoder without errors", frame, length);
+
+		if (length > MAX_PACKET_FRAME_SIZE)
+			continue;
+
+		memcpy(decoded, encoded, encoded_length);
+		fec_decode_packet(decoded, encoded_length, UINT8_MAX);
+		memcpy(reference, encoded, encoded_length);
+		reference_fec_decode_packet(reference, encoded_length, UINT8_MAX);
+		if (memcmp(decoded, reference, length) != 0)
+			fail("fec_decode_packet() against the reference", frame, length);
+
+		if (memcmp(decoded, incremental, length) != 0)
+			fail("incremental decoder against fec_decode_packet()", frame, length);
+	}
+}
 
+static void test_robustness(uint8_t frame_length)
+{
+	const double rates[] = { 0.001, 0.005, 0.01, 0.02, 0.05, bit_error_rate };
+	uint8_t frame[MAX_FRAME_SIZE];
+	uint8_t encoded[MAX_ENCODED_SIZE];
+	uint8_t decoded[MAX_FRAME_SIZE];
+
+	printf("\nCorrected frames of %d bytes (%d frames, bursts of %d bits)\n", frame_length, frame_count, burst_length);
+	printf("%10s %12s %12s %12s %12s\n", "BER", "random", "uncoded", "burst", "uncoded");
+	for (uint8_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+	{
+		unsigned int corrected[2] = { 0, 0 };
+		unsigned int error_free[2] = { 0, 0 };
+		for (uint8_t burst = 0; burst < 2; burst++)
+		{
+			for (uint16_t i = 0; i < frame_count; i++)
+			{
+				random_frame(frame, frame_length);
+				uint16_t encoded_length = fec_encode_to(frame, frame_length, encoded);
+				inject_errors(encoded, encoded_length, rates[r], burst ? burst_length : 0);
+				decode_incremental(encoded, encoded_length, decoded, frame_length);
+				corrected[burst] += memcmp(decoded, frame, frame_length) == 0;
+
+				// the frame without FEC, for comparison
+				memcpy(decoded, frame, frame_length);
+				error_free[burst] += inject_errors(decoded, frame_length, rates[r], burst ? burst_length : 0) == 0;
+			}
+		}
+
+		printf("%10.4f %11.2f%% %11.2f%% %11.2f%% %11.2f%%\n", rates[r],
+			   100.0 * corrected[0] / frame_count, 100.0 * error_free[0] / frame_count,
+			   100.0 * corrected[1] / frame_count, 100.0 * error_free[1] / frame_count);
+	}
+}
 
+static void benchmark()
+{
+	const uint8_t lengths[] = { 8, 16, 32, 64, 124, 255 };
+	uint8_t frame[MAX_FRAME_SIZE];
+	uint8_t encoded[MAX_ENCODED_SIZE];
+	uint8_t decoded[MAX_ENCODED_SIZE];
+
+	printf("\n%s per byte\n", TIME_UNIT);
+	printf("%6s %10s %10s %10s %10s %10s\n", "frame", "encode", "decode", "packet", "ref enc", "ref dec");
+	for (uint8_t l = 0; l < sizeof(lengths); l++)
+	{
+		uint8_t length = lengths[l];
+		uint64_t time[5] = { 0, 0, 0, 0, 0 };
+		random_frame(frame, length);
+		uint16_t encoded_length = fec_encode_to(frame, length, encoded);
+
+		for (uint16_t i = 0; i < BENCHMARK_ITERATIONS; i++)
+		{
+			uint64_t start = get_timestamp();
+			fec_encode_to(frame, length, decoded);
+			time[0] += get_timestamp() - start;
+
+			fec_decoder_t decoder;
+			start = get_timestamp();
+			fec_decoder_init(&decoder, decoded, length, encoded_length);
+			for (uint16_t fed = 0; fed < encoded_length; fed += 128)
+				fec_decoder_feed(&decoder, encoded + fed, encoded_length - fed < 128 ? encoded_length - fed : 128);
+
+			fec_decoder_finish(&decoder);
+			time[1] += get_timestamp() - start;
+
+			if (length > MAX_PACKET_FRAME_SIZE)
+				continue;
+
+			memcpy(decoded, encoded, encoded_length);
+			start = get_timestamp();
+			fec_decode_packet(decoded, encoded_length, UINT8_MAX);
+			time[2] += get_timestamp() - start;
+
+			memcpy(decoded, frame, length);
+			start = get_timestamp();
+			reference_fec_encode(decoded, length);
+			time[3] += get_timestamp() - start;
+
+			memcpy(decoded, encoded, encoded_length);
+			start = get_timestamp();
+			reference_fec_decode_packet(decoded, encoded_length, UINT8_MAX);
+			time[4] += get_timestamp() - start;
+		}
+
+		printf("%6d", length);
+		for (uint8_t t = 0; t < 5; t++)
+		{
+			if (length > MAX_PACKET_FRAME_SIZE && t > 1)
+				printf(" %10s", "-");
+			else
+				printf(" %10.1f", (double) time[t] / BENCHMARK_ITERATIONS / length);
+		}
+
+		printf("\n");
+	}
 }
 
 int main(int argc, char *argv[])
 {
-	//test_interleaver();
-	uint8_t input[] = {0x19,0x00,0x80,0x00,0x0B,0x57,0x00,0x00,0x07,0x8C,0x63,0x20,0x00,0x0B,0x57,0x00,0x00,0x07,0x8F,0x52,0x41,0x07,0x00,0x00,0xD0,0x81};
-	uint8_t input_length = sizeof(input);
-	uint8_t encoded[255];
-	uint8_t decoded[255];
-	uint8_t errors[255];
-
-	memset(errors, 0, 255);
-
-
-	printf("Input: %d ", input_length);
-	print_array(input, input_length, BINARY);
-	printf("\n");
-
-	memcpy(encoded, input, input_length);
-
-	uint16_t lenght_encoded = fec_encode(encoded, input_length);
-
-	printf("Encoded: %d ", lenght_encoded);
-	print_array(encoded, lenght_encoded, BINARY);
-	printf("\n");
-
-	memcpy(decoded, encoded, lenght_encoded);
-
-
-	uint8_t length_decoded =  fec_decode_packet(decoded, lenght_encoded, 255);
-
-	printf("Decoded: %d ", length_decoded);
-	print_array(decoded, length_decoded, BINARY);
-	printf("\n");
-
-	int nr_errors = 1;
-	int notrecovered = 0;
-	srand(time(NULL));
-
-//	while (notrecovered < 1)
-//	{
-//		int r = rand() % (lenght_encoded * 8);
-//		//printf("Rand: %d\n", r);
-//
-//		encoded[r/8] ^= 1 << r % 8;
-//		errors[r/8] ^= 1 << r % 8;
-//		printf("Errors %d - BER %d%%\n", nr_errors, (nr_errors * 100) / (lenght_encoded * 8));
-//		printf("Error: ");
-//		print_array(errors, lenght_encoded);
-//		printf("\n");
-//		printf("Enc. error: ");
-//		print_array(encoded, lenght_encoded);
-//		printf("\n");
-//
-//		length_decoded =  fec_decode_packet(encoded, lenght_encoded, decoded, 255);
-//
-//		printf("Decoded: ");
-//		print_array(decoded, length_decoded);
-//		printf("\n");
-//
-//		if (memcmp(input, decoded, input_length) == 0)
-//		{
-//			printf("ok\n");
-//		}
-//		else
-//		{
-//			printf("error\n");
-//			notrecovered++;
-//		}
-//
-//		nr_errors++;
-//	}
-
-
-    return 0;
+	unsigned int seed = time(NULL);
+	int option;
+	while ((option = getopt(argc, argv, "n:b:l:s:")) != -1)
+	{
+		switch (option)
+		{
+		case 'n': frame_count = atoi(optarg); break;
+		case 'b': bit_error_rate = atof(optarg); break;
+		case 'l': burst_length = atoi(optarg); break;
+		case 's': seed = strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "usage: %s [-n frames] [-b bit error rate] [-l burst length] [-s seed]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	printf("Seed %u\n", seed);
+	srand(seed);
+
+	test_encoder();
+	test_decoders(0, 0);
+	test_decoders(bit_error_rate, 0);
+	test_decoders(bit_error_rate, burst_length);
+	printf("Regression: %u failures\n", failures);
+
+	test_robustness(32);
+	test_robustness(MAX_FRAME_SIZE);
+	benchmark();
+
+	return failures;
 }
@@ -1,4 +1,4 @@
-/*! \file fec.c
+/*! \file reference_fec.c
  *
  *  \copyright (C) Copyright 2015 University of Antwerp and others (http://oss-7.cosys.be)
  *
@@ -27,7 +27,7 @@
 #include <stdint.h>
 #include <string.h>
 
-#include "fec.h"
+#include "reference_fec.h"
 
 #define INITIAL_FECSTATE 0x00
 #define TRELLIS_TERMINATOR 0x0B
@@ -59,28 +59,8 @@ static VITERBISTATE vstate;
 static bool fec_decode(uint8_t* input);
 
 #define DPRINT(...) printf(__VA_ARGS__)
-#define DPRINT_DATA(...) print_array(__VA_ARGS__)
 
-void print_array(uint8_t* buffer, uint8_t length, uint8_t binary)
-{
-	int i = 0;
-	for (; i < length; i++)
-	{
-	    printf("%02X", buffer[i]);
-	}
-
-	if (binary)
-	{
-		printf(" ");
-
-		for (i = 0; i < length; i++)
-		{
-			printf("%s", byte_to_binary(buffer[i]));
-		}
-	}
-}
-
-const char *int_to_binary(uint16_t x)
+static const char *int_to_binary(uint16_t x)
 {
     static char b[17];
     b[0] = '\0';
@@ -119,7 +99,7 @@ static void print_vstate()
 }
 
 /* Convolutional encoder */
-uint16_t fec_encode(uint8_t *data, uint16_t nbytes)
+uint16_t reference_fec_encode(uint8_t *data, uint16_t nbytes)
 {
 	memcpy(data_buffer, data, nbytes);
 	uint8_t *input = data_buffer;
@@ -203,7 +183,7 @@ uint16_t fec_encode(uint8_t *data, uint16_t nbytes)
 	return length;
 }
 
-uint8_t fec_decode_packet(uint8_t* data, uint8_t packet_length, uint8_t output_length)
+uint8_t reference_fec_decode_packet(uint8_t* data, uint8_t packet_length, uint8_t output_length)
 {
 	uint8_t* output = data_buffer;
 	if(output_length < packet_length)
@@ -372,9 +352,9 @@ static bool fec_decode(uint8_t* input)
 					min_state = j;
 			}
 
-	        //Normalize costs
-			if (vstate.old[min_state].cost > 0)
-				for (j = 0; j < 8; j++) vstate.old[j].cost -= vstate.old[min_state].cost;
+	        //Normalize costs, by the lowest cost read before the cost of min_state itself is cleared
+			uint8_t min_cost = vstate.old[min_state].cost;
+			for (j = 0; j < 8; j++) vstate.old[j].cost -= min_cost;
 
 			*output_buffer++ = vstate.old[min_state].path >> 8;
 			vstate.path_size--;
@@ -1,4 +1,4 @@
-/*! \file fec.h
+/*! \file reference_fec.h
  *
  *  \copyright (C) Copyright 2015 University of Antwerp and others (http://oss-7.cosys.be)
  *
@@ -20,8 +20,8 @@
  *
  */
 
-#ifndef FEC_H_
-#define FEC_H_
+#ifndef REFERENCE_FEC_H_
+#define REFERENCE_FEC_H_
 
 #ifdef __cplusplus
 extern "C" {
@@ -43,14 +43,15 @@ typedef struct {
 	VITERBIPATH states2[8];
 } VITERBISTATE;
 
-void print_array(uint8_t* buffer, uint8_t length, uint8_t binary);
-
-uint16_t fec_encode(uint8_t *data, uint16_t nbytes);
-uint8_t fec_decode_packet(uint8_t* data, uint8_t packet_length, uint8_t output_length);
-uint16_t fec_calculated_decoded_length(uint8_t packet_length);
+/*
+ * The original implementation of the FEC, the reference the framework implementation is tested against. Frames are
+ * encoded and decoded through a buffer of 128 bytes.
+ */
+uint16_t reference_fec_encode(uint8_t *data, uint16_t nbytes);
+uint8_t reference_fec_decode_packet(uint8_t* data, uint8_t packet_length, uint8_t output_length);
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif /* FEC_H_ */
+#endif /* REFERENCE_FEC_H_ */
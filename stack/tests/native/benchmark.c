@@ -0,0 +1,288 @@
+/*
+ * Host side benchmark of the framework components on the native platform, to follow the effect of algorithmic
+ * changes without hardware. The coding and crypto components are timed per byte of a frame, the random number
+ * generator per number, the delta coding per value, the bitmap search per bitmap, the scheduler and the timer per task or event. The times are host nanoseconds: compare runs on the same host, not with a MCU.
+ *
+ * usage: benchmark [-i iterations]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes.h"
+#include "bitmap.h"
+#include "bootstrap.h"
+#include "compress.h"
+#include "crc.h"
+#include "fec.h"
+#include "fifo.h"
+#include "hwsystem.h"
+#include "phy_coding.h"
+#include "pn9.h"
+#include "random.h"
+#include "scheduler.h"
+#include "timer.h"
+
+#define FRAME_SIZE 255
+
+static unsigned long iterations = 20000;
+static volatile uint32_t task_runs;
+
+void bootstrap()
+{
+}
+
+static uint64_t get_timestamp()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void report(const char* name, uint64_t start, unsigned long count, const char* unit)
+{
+	printf("%-24s %10.2f ns per %s\n", name, (double)(get_timestamp() - start) / count, unit);
+}
+
+static void task()
+{
+	task_runs++;
+}
+
+static void benchmark_coding()
+{
+	uint8_t frame[FRAME_SIZE];
+	uint8_t encoded[2 * (FRAME_SIZE + 3)];
+	uint8_t decoded[2 * (FRAME_SIZE + 3)];
+	for (uint16_t i = 0; i < sizeof(frame); i++)
+		frame[i] = rand();
+
+	uint64_t start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+		frame[0] = crc_calculate(frame, sizeof(frame));
+	report("crc_calculate", start, iterations * sizeof(frame), "byte");
+
+	start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		pn9_t pn9;
+		pn9_init(&pn9);
+		pn9_whiten(&pn9, frame, sizeof(frame));
+	}
+	report("pn9_whiten", start, iterations * sizeof(frame), "byte");
+
+	uint16_t encoded_length = 0;
+	start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+		encoded_length = fec_encode_to(frame, sizeof(frame), encoded);
+	report("fec_encode_to", start, iterations * sizeof(frame), "byte");
+
+	start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		fec_decoder_t decoder;
+		fec_decoder_init(&decoder, decoded, sizeof(frame), encoded_length);
+		fec_decoder_feed(&decoder, encoded, encoded_length);
+		fec_decoder_finish(&decoder);
+	}
+	report("fec_decoder", start, iterations * sizeof(frame), "byte");
+
+	// the longest FEC coded frame of the D7A stack (PACKET_MAX_FEC_SIZE)
+	const uint8_t stages = PHY_STAGE_CRC | PHY_STAGE_FEC | PHY_STAGE_PN9;
+	const uint16_t length = 125;
+	start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		memcpy(decoded, frame, length);
+		encoded_length = phy_encode_frame(stages, decoded, length);
+	}
+	report("phy_encode_frame", start, iterations * length, "byte");
+
+	memcpy(encoded, decoded, encoded_length);
+	start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		memcpy(decoded, encoded, encoded_length);
+		phy_decode_frame(stages, decoded, encoded_length, length);
+	}
+	report("phy_decode_frame", start, iterations * length, "byte");
+}
+
+static void benchmark_aes()
+{
+	const uint8_t key[AES_BLOCK_SIZE] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+	                                      0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+	uint8_t data[240];
+	uint8_t ctr[AES_BLOCK_SIZE] = { 0 };
+	aes_ctx_t ctx;
+	memset(data, 0x5A, sizeof(data));
+
+	uint64_t start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+		AES128_ctx_init(&ctx, key);
+	report("AES128_ctx_init", start, iterations, "key");
+
+	start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+		AES128_CTR_encrypt_ctx(&ctx, data, data, sizeof(data), ctr);
+	report("AES128_CTR_encrypt_ctx", start, iterations * sizeof(data), "byte");
+}
+
+static void benchmark_fifo()
+{
+	uint8_t buffer[256];
+	uint8_t chunk[64];
+	fifo_t fifo;
+	fifo_init(&fifo, buffer, sizeof(buffer));
+	memset(chunk, 0xA5, sizeof(chunk));
+
+	uint64_t start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		fifo_put(&fifo, chunk, sizeof(chunk));
+		fifo_pop(&fifo, chunk, sizeof(chunk));
+	}
+	report("fifo_put + fifo_pop", start, iterations * sizeof(chunk), "byte");
+}
+
+static void benchmark_random()
+{
+	uint32_t sum = 0;
+	uint64_t start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+		sum += get_rnd();
+	report("get_rnd", start, iterations, "number");
+	if (sum == 0)
+		printf("get_rnd only returned zeros\n");
+}
+
+// records of slowly changing sensor values, a report of 16 records of 5 values
+static void benchmark_delta_coding()
+{
+	int32_t records[16][5];
+	for (uint8_t i = 0; i < 16; i++)
+		for (uint8_t j = 0; j < 5; j++)
+			records[i][j] = 1000 * j + i * (rand() % 5 - 2);
+
+	uint8_t data[16 * 5 * COMPRESS_VARINT_MAX_SIZE];
+	uint8_t length = 0;
+	uint64_t start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		int32_t previous[5] = { 0 };
+		length = 0;
+		for (uint8_t j = 0; j < 16; j++)
+			length += compress_delta_encode(previous, records[j], 5, data + length, sizeof(data) - length);
+	}
+	report("compress_delta_encode", start, iterations * 16 * 5, "value");
+
+	bool equal = true;
+	start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		int32_t previous[5] = { 0 };
+		uint8_t offset = 0;
+		for (uint8_t j = 0; j < 16; j++)
+		{
+			int32_t values[5];
+			offset += compress_delta_decode(previous, data + offset, length - offset, values, 5);
+			equal &= memcmp(values, records[j], sizeof(values)) == 0;
+		}
+	}
+	report("compress_delta_decode", start, iterations * 16 * 5, "value");
+	if (!equal)
+		printf("compress_delta_decode did not restore the records\n");
+	printf("%-24s %10u bytes for %u\n", "delta coded report", length, (unsigned) sizeof(records));
+}
+
+// the progress bitmap of a session of 255 requests of which only the last one is left
+static void benchmark_bitmap()
+{
+	uint8_t bitmap[32];
+	memset(bitmap, 0xFF, sizeof(bitmap));
+	bitmap_clear(bitmap, 254);
+
+	unsigned long found = 0;
+	uint64_t start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+		found += bitmap_search(bitmap, false, 255);
+	report("bitmap_search", start, iterations, "bitmap");
+	if (found != 254 * iterations)
+		printf("bitmap_search did not find the cleared bit\n");
+}
+
+static void benchmark_scheduler()
+{
+	task_handle_t handle;
+	sched_register_task_handle(&task, &handle);
+	task_runs = 0;
+	uint64_t start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		sched_post_task(&task);
+		scheduler_run_pending_tasks();
+	}
+	report("sched_post_task + run", start, iterations, "task");
+
+	start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		sched_post_handle_from_isr(handle, i % (MIN_PRIORITY + 1));
+		scheduler_run_pending_tasks();
+	}
+	report("post_from_isr + run", start, iterations, "task");
+
+#ifdef FRAMEWORK_SCHEDULER_DEADLINES_ENABLED
+	start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		sched_post_task_deadline(&task, timer_get_counter_value() + TIMER_TICKS_PER_SEC);
+		scheduler_run_pending_tasks();
+	}
+	report("post_deadline + run", start, iterations, "task");
+#endif
+
+	// the virtual time jumps to the event
+	start = get_timestamp();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		timer_post_task_delay(&task, 1 + i % TIMER_TICKS_PER_SEC);
+		timer_tick_t delay;
+		while (timer_get_next_event_delay(&delay))
+		{
+			hw_enter_lowpower_mode(0);
+			scheduler_run_pending_tasks();
+		}
+	}
+	report("timer_post_task + fire", start, iterations, "event");
+}
+
+int main(int argc, char *argv[])
+{
+	int option;
+	while ((option = getopt(argc, argv, "i:")) != -1)
+	{
+		switch (option)
+		{
+		case 'i': iterations = strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "usage: %s [-i iterations]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	__framework_bootstrap();
+	scheduler_run_pending_tasks();
+
+	benchmark_coding();
+	benchmark_aes();
+	benchmark_fifo();
+	benchmark_random();
+	benchmark_delta_coding();
+	benchmark_bitmap();
+	benchmark_scheduler();
+	return 0;
+}
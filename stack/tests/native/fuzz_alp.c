@@ -0,0 +1,30 @@
+/*
+ * Fuzzer of alp_process_command(), with the ALP commands of the application. Commands forwarded over D7A start a
+ * session, the virtual time advances by a second after each command to let them complete.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "alp.h"
+#include "harness.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	uint8_t response[ALP_PAYLOAD_MAX_SIZE];
+	uint8_t response_length = 0;
+
+	harness_init();
+	// alp_process_command() takes a mutable command of at most ALP_PAYLOAD_MAX_SIZE bytes. The copy has the exact
+	// size of the command, so the sanitizers catch the reads beyond its end
+	if (size > ALP_PAYLOAD_MAX_SIZE)
+		size = ALP_PAYLOAD_MAX_SIZE;
+
+	uint8_t* command = malloc(size ? size : 1);
+	memcpy(command, data, size);
+	alp_process_command(command, size, response, &response_length, ALP_CMD_ORIGIN_APP);
+	free(command);
+	harness_run(TIMER_TICKS_PER_SEC);
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Standalone driver of the fuzzers, used instead of libFuzzer (TEST_NATIVE_LIBFUZZER) so they also build with gcc:
+ * the inputs are read from the given files, for instance to replay a corpus or a crash, or they are random.
+ *
+ * usage: fuzz_<target> [-n random inputs] [-s seed] [file...]
+ *
+ * A failed assertion or a crash aborts the program, the exit status is 0 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_INPUT_SIZE 4096
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+static int run_file(const char* path)
+{
+	static uint8_t input[MAX_INPUT_SIZE];
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+
+	size_t size = fread(input, 1, sizeof(input), file);
+	fclose(file);
+	printf("Running %s (%zu bytes)\n", path, size);
+	LLVMFuzzerTestOneInput(input, size);
+	return 0;
+}
+
+static void run_random(unsigned long count)
+{
+	uint8_t input[UINT8_MAX];
+	for (unsigned long i = 0; i < count; i++)
+	{
+		size_t size = rand() % (sizeof(input) + 1);
+		for (size_t j = 0; j < size; j++)
+			input[j] = rand();
+
+		LLVMFuzzerTestOneInput(input, size);
+	}
+
+	printf("Ran %lu random inputs\n", count);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long count = 1000;
+	unsigned int seed = time(NULL);
+	int option;
+	while ((option = getopt(argc, argv, "n:s:")) != -1)
+	{
+		switch (option)
+		{
+		case 'n': count = strtoul(optarg, NULL, 0); break;
+		case 's': seed = strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "usage: %s [-n random inputs] [-s seed] [file...]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	if (optind < argc)
+	{
+		for (int i = optind; i < argc; i++)
+		{
+			if (run_file(argv[i]) != 0)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	printf("Seed %u\n", seed);
+	srand(seed);
+	run_random(count);
+	return 0;
+}
@@ -0,0 +1,18 @@
+/*
+ * Fuzzer of the reception of D7A frames: packet_disassemble() and the layers above it, up to the ALP commands of the
+ * requests. The input is a foreground frame without its length byte and CRC, which are added so the frames pass the
+ * CRC check. The virtual time advances by a second after each frame, long enough for the responses and most
+ * timeouts.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "harness.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	harness_init();
+	harness_receive_frame(data, size > UINT8_MAX ? UINT8_MAX : size);
+	harness_run(TIMER_TICKS_PER_SEC);
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * The D7A stack on the native platform, driven by the fuzzers instead of by scheduler_run().
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include "bootstrap.h"
+#include "crc.h"
+#include "d7ap_stack.h"
+#include "hwsystem.h"
+#include "native_radio.h"
+#include "scheduler.h"
+#include "harness.h"
+
+static alp_init_args_t alp_init_args;
+
+void bootstrap()
+{
+	dae_access_profile_t access_profiles[1] = {
+		{
+			.channel_header = {
+				.ch_coding = PHY_CODING_PN9,
+				.ch_class = PHY_CLASS_NORMAL_RATE,
+				.ch_freq_band = PHY_BAND_868
+			},
+			.subprofiles[0] = {
+				.subband_bitmap = 0x01, // only the first subband is selectable
+				.scan_automation_period = 0,
+			},
+			.subbands[0] = (subband_t){
+				.channel_index_start = 0,
+				.channel_index_end = 0,
+				.eirp = 10,
+				.cca = -86,
+				.duty = 0,
+			}
+		}
+	};
+
+	fs_init_args_t fs_init_args = (fs_init_args_t){
+		.fs_user_files_init_cb = NULL,
+		.access_profiles_count = sizeof(access_profiles) / sizeof(dae_access_profile_t),
+		.access_profiles = access_profiles,
+		.access_class = 0x01 // use access profile 0 and select the first subprofile
+	};
+
+	d7ap_stack_init(&fs_init_args, &alp_init_args, false, NULL);
+}
+
+void harness_init()
+{
+	static bool initialized = false;
+	if (initialized)
+		return;
+
+	// the native platform initialises nothing else before the framework
+	__framework_bootstrap();
+	initialized = true;
+
+	// complete the boot, like the broadcast of the firmware version, so the first input reaches a listening idle node
+	harness_run(5 * TIMER_TICKS_PER_SEC);
+}
+
+void harness_run(timer_tick_t duration)
+{
+	timer_tick_t end = timer_get_counter_value() + duration;
+	scheduler_run_pending_tasks();
+
+	timer_tick_t delay;
+	while (timer_get_next_event_delay(&delay) && (int32_t)(end - timer_get_counter_value()) >= (int32_t)delay)
+	{
+		// sleeping jumps the virtual time to the next timer event
+		hw_enter_lowpower_mode(0);
+		scheduler_run_pending_tasks();
+	}
+}
+
+void harness_receive_frame(const uint8_t* data, uint8_t length)
+{
+	// the length byte, the data and the CRC
+	uint8_t frame[PACKET_MAX_SIZE];
+	if (length > PACKET_MAX_SIZE - 3)
+		length = PACKET_MAX_SIZE - 3;
+
+	frame[0] = length + 2;
+	memcpy(frame + 1, data, length);
+	uint16_t crc = crc_calculate(frame, length + 1);
+	frame[length + 1] = crc >> 8;
+	frame[length + 2] = crc & 0xFF;
+	native_radio_receive(frame + 1, length + 2, -60);
+}
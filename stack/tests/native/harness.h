@@ -0,0 +1,23 @@
+/*
+ * The D7A stack on the native platform, driven by the fuzzers instead of by scheduler_run().
+ *
+ * The node listens continuously on the channel of access profile 0 (normal rate, 868 MHz, channel 0), the frames are
+ * received through native_radio_receive() and the time only advances in harness_run().
+ */
+
+#ifndef HARNESS_H_
+#define HARNESS_H_
+
+#include <stdint.h>
+#include "timer.h"
+
+// bootstraps the framework and the stack, only the first call has effect
+void harness_init();
+
+// executes the pending tasks and the timer events due within the next duration ticks of virtual time
+void harness_run(timer_tick_t duration);
+
+// receives a foreground frame on the channel, the CRC is appended to the bytes following the length byte
+void harness_receive_frame(const uint8_t* data, uint8_t length);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * Replays a capture of received frames (MODULE_D7AP_DLL_RX_CAPTURE_ENABLED, see rx_capture.h) through the D7A stack
+ * of the native platform, from packet_disassemble() up to ALP, to profile the reception path under real traffic. The
+ * capture is the raw log output of the gateway; the text and the deferred log records in between the capture records
+ * are skipped.
+ *
+ * The virtual time advances from frame to frame as the captured timestamps do, so the timeouts of the stack expire as
+ * they did on the gateway, but the replay runs at full host speed. The frames are received on the channel the harness
+ * listens to, whatever channel they were captured on. The background frames are skipped, the harness does no scan
+ * automation.
+ *
+ * usage: replay [-r repeat] capture
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "native_radio.h"
+#include "rx_capture.h"
+#include "harness.h"
+
+// see log.c
+#define LOG_RECORD_MARKER 0x1E
+
+static uint64_t get_timestamp()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint8_t* read_file(const char* path, size_t* size)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+		return NULL;
+
+	uint8_t* data = NULL;
+	size_t length = 0;
+	size_t allocated = 0;
+	size_t read;
+	do
+	{
+		if (length == allocated)
+		{
+			allocated = allocated ? 2 * allocated : 65536;
+			data = realloc(data, allocated);
+		}
+
+		read = fread(data + length, 1, allocated - length, file);
+		length += read;
+	} while (read > 0);
+
+	fclose(file);
+	*size = length;
+	return data;
+}
+
+static uint32_t get_uint(const uint8_t* bytes, uint8_t size)
+{
+	uint32_t value = 0;
+	for (uint8_t i = 0; i < size; i++)
+		value |= (uint32_t)bytes[i] << (8 * i);
+
+	return value;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long repeat = 1;
+	int option;
+	while ((option = getopt(argc, argv, "r:")) != -1)
+	{
+		switch (option)
+		{
+		case 'r': repeat = strtoul(optarg, NULL, 0); break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "usage: %s [-r repeat] capture\n", argv[0]);
+		return -1;
+	}
+
+	size_t size;
+	uint8_t* capture = read_file(argv[optind], &size);
+	if (capture == NULL)
+	{
+		perror(argv[optind]);
+		return -1;
+	}
+
+	harness_init();
+
+	unsigned long frames = 0, skipped = 0, rejected = 0;
+	uint64_t start = get_timestamp();
+	for (unsigned long r = 0; r < repeat; r++)
+	{
+		bool first = true;
+		timer_tick_t previous_timestamp = 0;
+		size_t i = 0;
+		while (i < size)
+		{
+			if (capture[i] == LOG_RECORD_MARKER && i + 1 < size)
+			{
+				i += 2 + capture[i + 1];
+				continue;
+			}
+
+			if (capture[i] != RX_CAPTURE_RECORD_MARKER)
+			{
+				i++;
+				continue;
+			}
+
+			// a record cut off at the end of the capture is dropped
+			const uint8_t* header = capture + i + 1;
+			if (i + 1 + RX_CAPTURE_HEADER_SIZE + 1 > size || i + 1 + RX_CAPTURE_HEADER_SIZE + 1 + header[RX_CAPTURE_HEADER_SIZE] > size)
+				break;
+
+			timer_tick_t timestamp = get_uint(header, 4);
+			int16_t rssi = (int16_t)get_uint(header + 4, 2);
+			syncword_class_t syncword_class = header[9];
+			uint8_t length = header[RX_CAPTURE_HEADER_SIZE];
+			i += 1 + RX_CAPTURE_HEADER_SIZE + 1 + length;
+
+			if (syncword_class == PHY_SYNCWORD_CLASS0)
+			{
+				skipped++;
+				continue;
+			}
+
+			if (!first)
+				harness_run(timestamp - previous_timestamp);
+
+			first = false;
+			previous_timestamp = timestamp;
+			if (native_radio_receive(header + RX_CAPTURE_HEADER_SIZE + 1, length, rssi) != SUCCESS)
+				rejected++;
+
+			frames++;
+		}
+
+		// the responses and the timeouts of the last frame
+		harness_run(TIMER_TICKS_PER_SEC);
+	}
+
+	uint64_t duration = get_timestamp() - start;
+	printf("replayed %lu frames (%lu rejected by the radio, %lu background frames skipped)", frames, rejected, skipped);
+	if (frames)
+		printf(", %.2f us per frame", (double)duration / frames / 1000);
+
+	printf("\n");
+	free(capture);
+	return 0;
+}
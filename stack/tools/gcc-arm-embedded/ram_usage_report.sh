@@ -0,0 +1,110 @@
+#!/usr/bin/env bash
+#
+# OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+# lowpower wireless sensor communication
+#
+# Copyright 2015 University of Antwerp
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Reports the static RAM usage (.data, .bss and COMMON input sections) found in a GNU ld linker map,
+# per symbol, per object file and per library, and fails when the total exceeds the supplied budget.
+# The symbol names are only known when compiling with -fdata-sections, which all our ARM platforms do.
+#
+MAP=${1:?Usage $0 <MAP_FILE> [<BUDGET_BYTES>]}
+BUDGET=${2:-0}
+
+if [ ! -e "$MAP" ]
+then
+    echo "Missing map file '$MAP'" 1>&2
+    exit 1
+fi
+
+if ! grep -q "Linker script and memory map" "$MAP"
+then
+    echo "Malformatted linker map '$MAP'" 1>&2
+    exit 1
+fi
+
+# collect '<size> <symbol> <library> <object>' lines. Input sections with a long name are wrapped by ld,
+# in that case the address, size and origin are on the next line
+USAGE=`awk '
+    /^Linker script and memory map/ { in_map = 1; next }
+    !in_map { next }
+    pending != "" {
+        if ($1 ~ /^0x/ && $2 ~ /^0x/ && NF >= 3) { section = pending; size = $2; origin = $3 }
+        pending = ""
+        if (section != "") { emit() }
+        next
+    }
+    /^ (\.data|\.bss|COMMON)/ {
+        if (NF == 1) { pending = $1; next }
+        if (NF >= 4 && $2 ~ /^0x/ && $3 ~ /^0x/) { section = $1; size = $3; origin = $4; emit() }
+        next
+    }
+    # portable replacement for the gawk only strtonum()
+    function hex(str,    i, value) {
+        value = 0
+        str = tolower(substr(str, 3))
+        for (i = 1; i <= length(str); i++)
+            value = value * 16 + index("0123456789abcdef", substr(str, i, 1)) - 1
+        return value
+    }
+    function emit(    bytes, symbol, library, object) {
+        bytes = hex(size)
+        if (bytes > 0) {
+            symbol = section
+            sub(/^\.(data|bss)\.?/, "", symbol)
+            if (symbol == "" || symbol == "COMMON") symbol = "(" section ")"
+            library = origin; object = origin
+            if (match(origin, /\(.*\)$/)) {
+                library = substr(origin, 1, RSTART - 1)
+                object = substr(origin, RSTART + 1, RLENGTH - 2)
+            } else {
+                library = "(objects)"
+            }
+            sub(/.*\//, "", library); sub(/.*\//, "", object)
+            printf "%d %s %s %s\n", bytes, symbol, library, object
+        }
+        section = ""
+    }
+' "$MAP"`
+
+if [ -z "$USAGE" ]
+then
+    echo "No .data or .bss sections found in '$MAP'" 1>&2
+    exit 1
+fi
+
+echo "Static RAM usage per symbol:"
+echo "$USAGE" | sort -n -r | awk '{ printf "  %8d  %-40s %s(%s)\n", $1, $2, $3, $4 }'
+echo
+echo "Static RAM usage per object file:"
+echo "$USAGE" | awk '{ total[$3 "(" $4 ")"] += $1 } END { for (o in total) printf "%d %s\n", total[o], o }' | sort -n -r | awk '{ printf "  %8d  %s\n", $1, $2 }'
+echo
+echo "Static RAM usage per library:"
+echo "$USAGE" | awk '{ total[$3] += $1 } END { for (l in total) printf "%d %s\n", total[l], l }' | sort -n -r | awk '{ printf "  %8d  %s\n", $1, $2 }'
+echo
+
+TOTAL=`echo "$USAGE" | awk '{ total += $1 } END { print total }'`
+if [ "$BUDGET" -gt 0 ]
+then
+    echo "Total static RAM usage: $TOTAL bytes, budget $BUDGET bytes"
+    if [ "$TOTAL" -gt "$BUDGET" ]
+    then
+        echo "Static RAM usage exceeds the budget by `expr $TOTAL - $BUDGET` bytes" 1>&2
+        exit 1
+    fi
+else
+    echo "Total static RAM usage: $TOTAL bytes"
+fi
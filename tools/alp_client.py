@@ -0,0 +1,467 @@
+#!/usr/bin/env python
+
+# host side of the serial ALP interface of the modem and gateway applications (see alp_cmd_handler.c), to drive several
+# modems at once from one process. The frames output by a modem are parsed incrementally from the byte stream, the
+# actions of a frame are decoded in place (memoryview slices of the frame) and the responses are matched to the
+# outstanding requests, which complete asynchronously.
+#
+# As a library:
+#
+#   modem = Modem("/dev/ttyUSB0", 115200)
+#   request = modem.send([read_file_data_action(0x40, 0, 8)])
+#   request.add_done_callback(lambda request: print(request.responses))
+#   modem.send(forward_d7asp_actions(uid, 0x01) + [read_file_data_action(0x40, 0, 8)]).wait(5)
+#
+# Every request starts with a tag request action, the modem ends it with the tag response (with the end of packet flag).
+# The response of a local request is in the frame of its tag response. The responses of the remote nodes to a forwarded
+# request are output as they are received, each one preceded by its D7ASP interface status; they are matched to the
+# outstanding forwarded requests to the addressee of the response (or to a broadcast), as they carry no tag.
+# SERIAL_RESPONSE_BATCH_SIZE batches are split on the interface status actions.
+#
+# As a tool, reading a file from the modems (or through them, from a node) on every port given:
+#
+#   alp_client.py -s /dev/ttyUSB0 -s /dev/ttyUSB1 -f 0x40 -l 8 [-u <UID in hex>] [-a <access class>]
+#
+# The delta coded records of the sensor files (see compress_delta_encode()) are decoded by decode_delta_records(),
+# or with -r <values per record>.
+
+from __future__ import print_function
+
+import argparse
+import binascii
+import collections
+import struct
+import sys
+import threading
+
+FRAME_SYNC_BYTE = 0xC0
+FRAME_VERSION_0 = 0x00 # <sync byte><version><length><ALP command>
+FRAME_VERSION_1 = 0x01 # <sync byte><version><sequence number><length><ALP command><CRC16>
+ALP_PAYLOAD_MAX_SIZE = 239 # ALP_PAYLOAD_MAX_SIZE of the firmware, the longest command the modem accepts
+SHELL_CMD_HEADER = b"AT$D"
+
+ALP_ITF_ID_D7ASP = 0xD7
+ALP_ITF_ID_FS = 0x00
+ALP_ITF_ID_APP = 0x01
+
+ALP_OP_READ_FILE_DATA = 1
+ALP_OP_WRITE_FILE_DATA = 4
+ALP_OP_RETURN_FILE_DATA = 32
+ALP_OP_RETURN_STATUS = 34
+ALP_OP_RETURN_TAG = 35
+ALP_OP_FORWARD = 50
+ALP_OP_REQUEST_TAG = 52
+
+ID_TYPE_NBID = 0
+ID_TYPE_NOID = 1
+ID_TYPE_UID = 2
+ID_TYPE_VID = 3
+ID_LENGTHS = { ID_TYPE_NBID: 1, ID_TYPE_NOID: 0, ID_TYPE_UID: 8, ID_TYPE_VID: 2 }
+
+SESSION_RESP_MODE_ANY = 2
+
+
+def crc16(data, crc=0xFFFF):
+  """the CRC of the D7A frames (see crc_calculate()): polynomial 0x1021, initial value 0xFFFF, no final XOR"""
+  for byte in bytearray(data):
+    crc ^= byte << 8
+    for _ in range(8):
+      crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+    crc &= 0xFFFF
+  return crc
+
+
+def encode_length(length):
+  """an ALP length operand: the number of extra bytes in the 2 MSBs of the first byte, big endian"""
+  size = 1 if length < 0x40 else 2 if length < 0x4000 else 3 if length < 0x400000 else 4
+  encoded = bytearray((length >> (8 * (size - 1 - i))) & 0xFF for i in range(size))
+  encoded[0] |= (size - 1) << 6
+  return encoded
+
+
+def decode_length(data, offset):
+  """returns the length operand at offset and the offset after it"""
+  size = (data[offset] >> 6) + 1
+  length = data[offset] & 0x3F
+  for i in range(1, size):
+    length = (length << 8) | data[offset + i]
+  return length, offset + size
+
+
+def decode_delta_records(data, value_count, reference=None):
+  """the records of value_count values delta coded in data by compress_delta_encode() of the firmware, the first one
+  against reference (by default all zeros)"""
+  data = bytearray(data)
+  previous = list(reference or [0] * value_count)
+  records = []
+  offset = 0
+  while offset < len(data):
+    record = []
+    for i in range(value_count):
+      delta = 0
+      shift = 0
+      while True:
+        if offset == len(data) or shift > 28:
+          raise ValueError("truncated record at offset {0}".format(offset))
+        byte = data[offset]
+        offset += 1
+        delta |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+          break
+      value = (previous[i] + ((delta >> 1) ^ -(delta & 1))) & 0xFFFFFFFF
+      record.append(value - (1 << 32) if value & 0x80000000 else value)
+    previous = record
+    records.append(record)
+  return records
+
+
+def read_file_data_action(file_id, offset, length):
+  return bytearray([ALP_OP_READ_FILE_DATA, file_id]) + encode_length(offset) + encode_length(length)
+
+
+def write_file_data_action(file_id, offset, data):
+  return bytearray([ALP_OP_WRITE_FILE_DATA, file_id]) + encode_length(offset) + encode_length(len(data)) + bytearray(data)
+
+
+def request_tag_action(tag_id, respond_when_completed=True):
+  return bytearray([ALP_OP_REQUEST_TAG | (respond_when_completed << 7), tag_id])
+
+
+def forward_d7asp_actions(address, access_class, id_type=None, resp_mode=SESSION_RESP_MODE_ANY, dormant_timeout=0,
+                          nls_method=0):
+  """the forward action to the D7ASP interface, the actions after it are sent to the addressee. Without address the
+  request is broadcast (NOID), else the id type follows from the length of the address (UID or VID)"""
+  address = bytearray(address or b"")
+  if id_type is None:
+    id_type = { 0: ID_TYPE_NOID, 2: ID_TYPE_VID, 8: ID_TYPE_UID }[len(address)]
+  addressee_ctrl = (nls_method & 0x0F) | (id_type << 4)
+  return [bytearray([ALP_OP_FORWARD, ALP_ITF_ID_D7ASP, resp_mode, dormant_timeout, addressee_ctrl, access_class]) +
+          address]
+
+
+# the actions decoded from a frame, the data are slices of the frame
+ReturnFileData = collections.namedtuple("ReturnFileData", "file_id offset data")
+ReturnTag = collections.namedtuple("ReturnTag", "tag_id eop error")
+# the status of the D7ASP interface: the channel as output by the firmware (the first 3 bytes of channel_id_t), the RX
+# level, link budget and target RX level, the D7ASP status, FIFO token, sequence number and response timeout, the
+# addressee control, access class and ID of the responder
+D7aspStatus = collections.namedtuple("D7aspStatus", "channel rx_level link_budget target_rx_level status fifo_token "
+                                     "seqnr response_to addressee_ctrl access_class addressee_id")
+InterfaceStatus = collections.namedtuple("InterfaceStatus", "interface_id status")
+# an operation which is not decoded, the rest of the frame can't be located
+UnknownAction = collections.namedtuple("UnknownAction", "operation data")
+
+D7ASP_STATUS_HEADER_SIZE = 12 # the status up to the addressee ID
+
+
+def parse_actions(payload):
+  """yields the actions of the payload of a frame, decoded in place"""
+  data = memoryview(payload)
+  raw = bytearray(payload) if sys.version_info[0] < 3 else data # indexing a memoryview gives ints from python 3 on
+  offset = 0
+  while offset < len(data):
+    control = raw[offset]
+    operation = control & 0x3F
+    if operation == ALP_OP_RETURN_FILE_DATA:
+      file_id = raw[offset + 1]
+      file_offset, offset = decode_length(raw, offset + 2)
+      length, offset = decode_length(raw, offset)
+      yield ReturnFileData(file_id, file_offset, data[offset:offset + length])
+      offset += length
+    elif operation == ALP_OP_RETURN_TAG:
+      yield ReturnTag(raw[offset + 1], bool(control & 0x80), bool(control & 0x40))
+      offset += 2
+    elif operation == ALP_OP_RETURN_STATUS and control & 0x40 and raw[offset + 1] == ALP_ITF_ID_D7ASP:
+      status = offset + 2
+      addressee_ctrl = raw[status + 10]
+      id_length = ID_LENGTHS[(addressee_ctrl >> 4) & 0x03]
+      end = status + D7ASP_STATUS_HEADER_SIZE + id_length
+      fields = struct.unpack_from("<bBBBBBB", bytes(data[status + 3:status + 10]))
+      yield InterfaceStatus(ALP_ITF_ID_D7ASP, D7aspStatus(data[status:status + 3], *(fields + (addressee_ctrl,
+                                                          raw[status + 11], data[status + 12:end]))))
+      offset = end
+    else:
+      yield UnknownAction(operation, data[offset:])
+      return
+
+
+class FrameParser(object):
+  """extracts the ALP frames from the bytes received from a modem, which can be interleaved with other output (logs):
+  the bytes which do not start a valid frame are skipped"""
+
+  def __init__(self):
+    self.buffer = bytearray()
+    self.rx_seqnr = None
+    self.lost_frames = 0
+    self.skipped_bytes = 0
+
+  def feed(self, data):
+    """returns the payloads of the frames completed by data"""
+    self.buffer += data
+    frames = []
+    start = 0
+    while True:
+      sync = self.buffer.find(FRAME_SYNC_BYTE, start)
+      if sync < 0:
+        self.skipped_bytes += len(self.buffer) - start
+        start = len(self.buffer)
+        break
+
+      self.skipped_bytes += sync - start
+      start = sync
+      available = len(self.buffer) - start
+      if available < 3:
+        break
+
+      version = self.buffer[start + 1]
+      if version == FRAME_VERSION_0:
+        header_length, crc_length = 3, 0
+      elif version == FRAME_VERSION_1:
+        header_length, crc_length = 4, 2
+      else:
+        start += 1
+        continue
+
+      if available < header_length:
+        break
+
+      length = self.buffer[start + header_length - 1]
+      end = start + header_length + length + crc_length
+      if end > len(self.buffer):
+        break
+
+      if version == FRAME_VERSION_1:
+        crc, = struct.unpack_from(">H", self.buffer, end - 2)
+        if crc16(self.buffer[start + 1:end - 2]) != crc:
+          start += 1 # a sync byte in other output, or a corrupted frame
+          continue
+
+        seqnr = self.buffer[start + 2]
+        if self.rx_seqnr is not None and seqnr != self.rx_seqnr:
+          self.lost_frames += (seqnr - self.rx_seqnr) & 0xFF
+        self.rx_seqnr = (seqnr + 1) & 0xFF
+
+      frames.append(bytes(self.buffer[start + header_length:end - crc_length]))
+      start = end
+
+    del self.buffer[:start]
+    return frames
+
+
+def encode_frame(alp_command, version=FRAME_VERSION_1, seqnr=0):
+  """the shell command which carries an ALP command to the modem"""
+  if len(alp_command) > ALP_PAYLOAD_MAX_SIZE:
+    raise ValueError("ALP command of {0} bytes too long".format(len(alp_command)))
+
+  frame = bytearray([FRAME_SYNC_BYTE, version])
+  if version == FRAME_VERSION_1:
+    frame.append(seqnr & 0xFF)
+  frame.append(len(alp_command))
+  frame += alp_command
+  if version == FRAME_VERSION_1:
+    frame += struct.pack(">H", crc16(frame[1:]))
+  return SHELL_CMD_HEADER + bytes(frame)
+
+
+class Response(object):
+  """the actions answering a request, with the D7ASP status of the responder for a forwarded request"""
+
+  def __init__(self, status, actions):
+    self.status = status
+    self.actions = actions
+
+  def __repr__(self):
+    return "Response({0}, {1})".format(self.status, self.actions)
+
+
+class Request(object):
+  """an outstanding request, completed by its tag response"""
+
+  def __init__(self, tag_id, addressee):
+    self.tag_id = tag_id
+    self.addressee = addressee # the (id type, address) of a forwarded request, None for a local one
+    self.responses = []
+    self.error = None
+    self.done = threading.Event()
+    self.callbacks = []
+
+  def add_done_callback(self, callback):
+    """calls callback(request) once completed, from the thread reading the modem"""
+    self.callbacks.append(callback)
+    if self.done.is_set():
+      callback(self)
+
+  def wait(self, timeout=None):
+    """returns whether the request completed within timeout seconds"""
+    return self.done.wait(timeout)
+
+  def matches(self, status):
+    id_type, address = self.addressee
+    return id_type in (ID_TYPE_NOID, ID_TYPE_NBID) or bytes(status.addressee_id) == address
+
+
+class Modem(object):
+  """a modem on a serial port, the frames it outputs are read by a thread. The requests are tagged with the IDs
+  0 - 255, a tag is reused once its request completed"""
+
+  def __init__(self, port, baudrate=115200, version=FRAME_VERSION_1, unsolicited_callback=None, serial_port=None):
+    if serial_port is None:
+      import serial
+      serial_port = serial.Serial(port, baudrate, timeout=0.1)
+    self.serial = serial_port
+    self.version = version
+    self.unsolicited_callback = unsolicited_callback # called with the responses which match no request
+    self.parser = FrameParser()
+    self.lock = threading.Lock()
+    self.requests = collections.OrderedDict()
+    self.next_tag_id = 0
+    self.tx_seqnr = 0
+    self.pending_local_response = None
+    self.running = True
+    self.reader = threading.Thread(target=self._read)
+    self.reader.daemon = True
+    self.reader.start()
+
+  def close(self):
+    self.running = False
+    self.reader.join()
+    self.serial.close()
+
+  def send(self, actions):
+    """sends the actions as one tagged command, actions is a list of encoded actions (see *_action()). A forward
+    action (see forward_d7asp_actions()) should come first"""
+    command = bytearray().join(bytearray(action) for action in actions)
+    addressee = None
+    if command and command[0] & 0x3F == ALP_OP_FORWARD and command[1] == ALP_ITF_ID_D7ASP:
+      id_type = (command[4] >> 4) & 0x03
+      addressee = (id_type, bytes(command[6:6 + ID_LENGTHS[id_type]]))
+
+    with self.lock:
+      tag_id = self._allocate_tag_id()
+      request = Request(tag_id, addressee)
+      self.requests[tag_id] = request
+      frame = encode_frame(request_tag_action(tag_id) + command, self.version, self.tx_seqnr)
+      self.tx_seqnr += 1
+      self.serial.write(frame)
+    return request
+
+  def _allocate_tag_id(self):
+    for _ in range(256):
+      tag_id = self.next_tag_id
+      self.next_tag_id = (self.next_tag_id + 1) & 0xFF
+      if tag_id not in self.requests:
+        return tag_id
+    raise RuntimeError("256 requests outstanding")
+
+  def _read(self):
+    while self.running:
+      data = self.serial.read(self.serial.in_waiting or 1)
+      if data:
+        for frame in self.parser.feed(data):
+          self.process_frame(frame)
+
+  def process_frame(self, payload):
+    """dispatches the actions of a frame: the responses of remote nodes start with their interface status, the other
+    actions are the response of the request of the tag response following them"""
+    status = None
+    actions = []
+    completed = []
+    for action in parse_actions(payload):
+      if isinstance(action, InterfaceStatus):
+        self._dispatch(status, actions)
+        status, actions = action.status, []
+      elif isinstance(action, ReturnTag):
+        self._dispatch(status, actions)
+        status, actions = None, []
+        completed.append(action)
+      else:
+        actions.append(action)
+
+    self._dispatch(status, actions)
+    for tag in completed:
+      self._complete(tag)
+
+  def _dispatch(self, status, actions):
+    if status is None and not actions:
+      return
+
+    response = Response(status, actions)
+    with self.lock:
+      if status is None:
+        # a local response, completed by the tag response which follows it in the frame
+        self.pending_local_response = response
+        return
+
+      matched = [request for request in self.requests.values() if request.addressee and request.matches(status)]
+
+    for request in matched:
+      request.responses.append(response)
+    if not matched and self.unsolicited_callback:
+      self.unsolicited_callback(response)
+
+  def _complete(self, tag):
+    with self.lock:
+      request = self.requests.pop(tag.tag_id, None)
+      local_response, self.pending_local_response = self.pending_local_response, None
+
+    if request is None:
+      return
+
+    if local_response is not None:
+      request.responses.append(local_response)
+    request.error = tag.error
+    request.done.set()
+    for callback in request.callbacks:
+      callback(request)
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Reads a file from the modems on the serial ports, or through them from "
+                                   "a node, concurrently.")
+  parser.add_argument("-s", "--serial", help="serial port of a modem, can be repeated", action="append", required=True)
+  parser.add_argument("-b", "--baudrate", help="baudrate", type=int, default=115200)
+  parser.add_argument("-f", "--file-id", help="file ID", type=lambda x: int(x, 0), default=0x00)
+  parser.add_argument("-o", "--offset", help="offset in the file", type=int, default=0)
+  parser.add_argument("-l", "--length", help="number of bytes to read", type=int, default=8)
+  parser.add_argument("-u", "--uid", help="read from the node with this UID (hex) instead of the modem")
+  parser.add_argument("-a", "--access-class", help="access class of the forwarded request", type=lambda x: int(x, 0),
+                      default=0x01)
+  parser.add_argument("-r", "--delta-values", help="decode the data as delta coded records of this many values (see "
+                      "compress_delta_encode())", type=int)
+  parser.add_argument("-t", "--timeout", help="seconds to wait for the responses", type=float, default=10)
+  config = parser.parse_args()
+
+  actions = [read_file_data_action(config.file_id, config.offset, config.length)]
+  if config.uid:
+    actions = forward_d7asp_actions(binascii.unhexlify(config.uid), config.access_class) + actions
+
+  modems = [Modem(port, config.baudrate) for port in config.serial]
+  requests = [(port, modem.send(actions)) for port, modem in zip(config.serial, modems)]
+  status = 0
+  for port, request in requests:
+    if not request.wait(config.timeout):
+      print("{0}: no response".format(port))
+      status = 1
+      continue
+
+    for response in request.responses:
+      for action in response.actions:
+        if isinstance(action, ReturnFileData):
+          origin = binascii.hexlify(bytes(response.status.addressee_id)).decode() if response.status else "modem"
+          if config.delta_values:
+            data = decode_delta_records(action.data, config.delta_values)
+          else:
+            data = binascii.hexlify(bytes(action.data)).decode()
+          print("{0}: {1} file {2:#04x} offset {3}: {4}".format(port, origin, action.file_id, action.offset, data))
+    if request.error:
+      print("{0}: completed with an error".format(port))
+      status = 1
+
+  for modem in modems:
+    modem.close()
+  return status
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,204 @@
+#!/usr/bin/env python
+
+# decodes the deferred logs of the stack (FRAMEWORK_LOG_DEFERRED), read from a serial connection like scat.py or from a
+# file, using the format strings in the ELF file of the firmware. Everything else in the log output is passed through.
+
+from __future__ import print_function
+
+import argparse
+import re
+import struct
+import sys
+
+from signal import signal, SIGPIPE, SIG_DFL
+signal(SIGPIPE, SIG_DFL)
+
+RECORD_MARKER = 0x1E
+# the header of a record after its length: the 16 bit counter, the layer and the address of the format string
+RECORD_HEADER_SIZE = 7
+LAYERS = { 0x01: "PHY", 0x02: "DLL", 0x03: "MAC", 0x04: "NWL", 0x05: "TRANS", 0x06: "SESSION", 0x07: "ALP", 0x10: "FWK" }
+CONVERSION = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|j|z|t|L)?([diouxXeEfFgGaAcspn%])")
+
+
+class Elf(object):
+  """the allocated sections of a little endian ELF file, to read the (constant) strings of the firmware"""
+
+  def __init__(self, path):
+    with open(path, "rb") as f:
+      data = f.read()
+
+    if data[:4] != b"\x7fELF" or bytearray(data)[5] != 1:
+      raise ValueError("{0} is not a little endian ELF file".format(path))
+
+    self.is_64 = bytearray(data)[4] == 2
+    if self.is_64:
+      shoff, = struct.unpack_from("<Q", data, 0x28)
+      shentsize, shnum = struct.unpack_from("<HH", data, 0x3A)
+    else:
+      shoff, = struct.unpack_from("<I", data, 0x20)
+      shentsize, shnum = struct.unpack_from("<HH", data, 0x2E)
+
+    self.sections = []
+    for i in range(shnum):
+      offset = shoff + i * shentsize
+      if self.is_64:
+        type, flags, addr, file_offset, size = struct.unpack_from("<IQQQQ", data, offset + 4)
+      else:
+        type, flags, addr, file_offset, size = struct.unpack_from("<IIIII", data, offset + 4)
+
+      SHT_NOBITS = 8
+      SHF_ALLOC = 0x2
+      if (flags & SHF_ALLOC) and type != SHT_NOBITS and addr != 0:
+        self.sections.append((addr, data[file_offset:file_offset + size]))
+
+  def read_string(self, address):
+    for addr, content in self.sections:
+      if addr <= address < addr + len(content):
+        start = address - addr
+        end = content.find(b"\0", start)
+        if end < 0:
+          return None
+        return content[start:end].decode("ascii", "replace")
+
+    return None
+
+
+class Decoder(object):
+  def __init__(self, elf, out):
+    self.elf = elf
+    self.out = out
+    self.buffer = bytearray()
+    self.last_counter = None
+
+  def feed(self, data):
+    self.buffer += bytearray(data)
+    while self.buffer:
+      marker = self.buffer.find(bytearray([RECORD_MARKER]))
+      if marker < 0:
+        self.write(self.buffer)
+        self.buffer = bytearray()
+        return
+
+      self.write(self.buffer[:marker])
+      del self.buffer[:marker]
+      if len(self.buffer) < 2 or len(self.buffer) < 2 + self.buffer[1]:
+        return # wait for the rest of the record
+
+      length = self.buffer[1]
+      record = self.buffer[2:2 + length]
+      del self.buffer[:2 + length]
+      self.decode(record)
+
+  def write(self, data):
+    if isinstance(data, bytearray):
+      data = bytes(data).decode("ascii", "replace")
+    if data:
+      self.out.write(data)
+      self.out.flush()
+
+  def decode(self, record):
+    if len(record) < RECORD_HEADER_SIZE or (len(record) - RECORD_HEADER_SIZE) % 4 != 0:
+      self.write("\n\r<invalid log record>")
+      return
+
+    counter, layer, format_address = struct.unpack_from("<HBI", bytes(record))
+    args = list(struct.unpack_from("<{0}I".format((len(record) - RECORD_HEADER_SIZE) // 4), bytes(record), RECORD_HEADER_SIZE))
+    if self.last_counter is not None and counter != (self.last_counter + 1) & 0xFFFF:
+      self.write("\n\r<{0} logs dropped or not deferred>".format((counter - self.last_counter - 1) & 0xFFFF))
+
+    self.last_counter = counter
+    format = self.elf.read_string(format_address)
+    if format is None:
+      text = "<unknown format string at 0x{0:08X}> {1}".format(format_address, " ".join("0x{0:08X}".format(a) for a in args))
+    else:
+      text = self.format(format, args)
+
+    self.write("\n\r[{0:03d}] {1}{2}".format(counter, "" if layer in LAYERS else "<layer {0}> ".format(layer), text))
+
+  def pop(self, args, size):
+    words = []
+    for i in range(max(1, size // 4)):
+      if not args:
+        return None
+      words.append(args.pop(0))
+
+    return words[0] if len(words) == 1 else words[0] | (words[1] << 32)
+
+  def format(self, format, args):
+    # the sizes of the arguments as stored by log_print_stack_string()
+    long_size = 8 if self.elf.is_64 else 4
+    sizes = { None: 4, "hh": 4, "h": 4, "l": long_size, "ll": 8, "j": 8, "z": long_size, "t": long_size, "L": 8 }
+
+    def convert(match):
+      flags, width, precision, length, conversion = match.groups()
+      if conversion == "%":
+        return "%"
+
+      spec = "%" + flags
+      for part, prefix in ((width, ""), (precision, ".")):
+        if part == "*":
+          value = self.pop(args, 4)
+          part = "" if value is None else str(struct.unpack("<i", struct.pack("<I", value))[0])
+        if part is not None:
+          spec += prefix + part
+
+      size = 8 if conversion in "eEfFgGaA" else long_size if conversion in "sp" else sizes[length]
+      value = self.pop(args, size)
+      if value is None:
+        return "<?>"
+
+      if conversion in "di":
+        return (spec + "d") % (value - (1 << (size * 8)) if value >> (size * 8 - 1) else value)
+      if conversion == "u":
+        return (spec + "d") % value
+      if conversion in "oxX":
+        return (spec + conversion) % value
+      if conversion == "c":
+        return (spec + "c") % chr(value & 0xFF)
+      if conversion in "eEfFgGaA":
+        number, = struct.unpack("<d", struct.pack("<Q", value))
+        return (spec + ("f" if conversion in "FaA" else conversion)) % number
+      if conversion == "s":
+        string = self.elf.read_string(value)
+        return (spec + "s") % (string if string is not None else "<0x{0:08X}>".format(value))
+      return "0x{0:x}".format(value) # p, n
+
+    return CONVERSION.sub(convert, format)
+
+
+def main(config):
+  decoder = Decoder(Elf(config.elf), sys.stdout)
+  if config.serial:
+    import serial
+    source = serial.Serial(config.serial, config.baudrate)
+    read = lambda: source.read(max(1, source.in_waiting))
+  else:
+    source = open(config.input, "rb") if config.input else getattr(sys.stdin, "buffer", sys.stdin)
+    # reads what is available, so the output keeps up when following a pipe
+    read = lambda: source.read1(1024) if hasattr(source, "read1") else source.read(1)
+
+  try:
+    while True:
+      data = read()
+      if not data:
+        break
+      decoder.feed(data)
+  except KeyboardInterrupt:
+    pass
+
+  print()
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(
+    description="Decodes the deferred logs (FRAMEWORK_LOG_DEFERRED) of the stack, read from a serial connection or a file."
+  )
+
+  parser.add_argument("-e", "--elf", help="the ELF file of the firmware", required=True)
+  parser.add_argument("-b", "--baudrate", help="baudrate", default=115200)
+  parser.add_argument("-s", "--serial", help="serial port to read")
+  parser.add_argument("input", nargs="?", help="file to read, instead of the serial port or stdin")
+
+  config = parser.parse_args()
+
+  main(config)
@@ -0,0 +1,104 @@
+#!/usr/bin/env python
+
+# decodes the binary RSSI blocks of the noise_logger app (APP_NOISE_LOGGER_BINARY_OUTPUT), read from a serial connection
+# or from a file, into the same lines as its text output: the channel, the timestamp and the RSSI values. With
+# APP_NOISE_LOGGER_AGGREGATE these are the minimum, maximum, median and 90th percentile of the samples. Everything else
+# in the output of the app is passed through.
+
+from __future__ import print_function
+
+import argparse
+import struct
+import sys
+
+from signal import signal, SIGPIPE, SIG_DFL
+signal(SIGPIPE, SIG_DFL)
+
+BLOCK_MARKER = 0x1D
+# the header of a block after its length: the sequence number, the type, the channel header, the center frequency index
+# and the timestamp
+BLOCK_HEADER_SIZE = 9
+BANDS = { 2: "433", 3: "868", 4: "915" }
+CLASSES = { 0: "L", 2: "N", 3: "H" }
+
+
+class Decoder(object):
+  def __init__(self, out):
+    self.out = out
+    self.buffer = bytearray()
+    self.last_sequence_number = None
+
+  def feed(self, data):
+    self.buffer += bytearray(data)
+    while self.buffer:
+      marker = self.buffer.find(bytearray([BLOCK_MARKER]))
+      if marker < 0:
+        self.write(self.buffer)
+        self.buffer = bytearray()
+        return
+
+      self.write(self.buffer[:marker])
+      del self.buffer[:marker]
+      if len(self.buffer) < 2 or len(self.buffer) < 2 + self.buffer[1]:
+        return # wait for the rest of the block
+
+      length = self.buffer[1]
+      block = self.buffer[2:2 + length]
+      del self.buffer[:2 + length]
+      self.decode(block)
+
+  def write(self, data):
+    if isinstance(data, bytearray):
+      data = bytes(data).decode("ascii", "replace")
+    if data:
+      self.out.write(data)
+      self.out.flush()
+
+  def decode(self, block):
+    if len(block) < BLOCK_HEADER_SIZE:
+      self.write("<invalid block>\n")
+      return
+
+    sequence_number, type, channel_header, center_freq_index, timestamp = struct.unpack_from("<BcBHI", bytes(block))
+    if self.last_sequence_number is not None and sequence_number != (self.last_sequence_number + 1) & 0xFF:
+      self.write("<{0} blocks dropped>\n".format((sequence_number - self.last_sequence_number - 1) & 0xFF))
+
+    self.last_sequence_number = sequence_number
+    channel = "{0}{1}{2:03d}".format(BANDS.get((channel_header >> 4) & 0x07, "???"),
+                                     CLASSES.get((channel_header >> 2) & 0x03, "?"), center_freq_index)
+    values = ",".join("{0:04d}".format(-rssi) for rssi in block[BLOCK_HEADER_SIZE:])
+    self.write("{0:>7s},{1},{2}\n".format(channel, timestamp, values))
+
+
+def main(config):
+  decoder = Decoder(sys.stdout)
+  if config.serial:
+    import serial
+    source = serial.Serial(config.serial, config.baudrate)
+    read = lambda: source.read(max(1, source.in_waiting))
+  else:
+    source = open(config.input, "rb") if config.input else getattr(sys.stdin, "buffer", sys.stdin)
+    read = lambda: source.read1(1024) if hasattr(source, "read1") else source.read(1)
+
+  try:
+    while True:
+      data = read()
+      if not data:
+        break
+      decoder.feed(data)
+  except KeyboardInterrupt:
+    pass
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(
+    description="Decodes the binary RSSI blocks of the noise_logger app, read from a serial connection or a file."
+  )
+
+  parser.add_argument("-b", "--baudrate", help="baudrate", default=115200)
+  parser.add_argument("-s", "--serial", help="serial port to read")
+  parser.add_argument("input", nargs="?", help="file to read, instead of the serial port or stdin")
+
+  config = parser.parse_args()
+
+  main(config)